@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""
+Compare microbenchmark results against a stored baseline
+
+Both files are Google Benchmark JSON output (--benchmark_out_format=json).
+Prints the ns/op and allocs/op change for every benchmark and exits non-zero
+if any benchmark got slower than the threshold or allocates more per op.
+
+Usage: compare_micro.py [--threshold PCT] baseline.json current.json
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    for bench in data.get("benchmarks", []):
+        if bench.get("run_type") == "aggregate" and bench.get("aggregate_name") != "mean":
+            continue
+        name = bench.get("run_name", bench["name"])
+        # Normalise to nanoseconds regardless of the reported time unit
+        scale = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}[bench.get("time_unit", "ns")]
+        results[name] = {
+            "ns_per_op": bench["cpu_time"] * scale,
+            "allocs_per_op": bench.get("allocs/op"),
+        }
+    return results
+
+
+def pct_change(old, new):
+    return (new - old) / old * 100.0 if old else 0.0
+
+
+def fmt_allocs(value):
+    return "-" if value is None else f"{value:.1f}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare microbenchmark JSON results")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="Allowed ns/op regression in percent (default: 10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = []
+    print(f"{'Benchmark':<34} {'base ns/op':>12} {'ns/op':>12} {'change':>9} "
+          f"{'base allocs':>12} {'allocs':>8}")
+    print("-" * 92)
+    for name, cur in current.items():
+        base = baseline.get(name)
+        if base is None:
+            print(f"{name:<34} {'-':>12} {cur['ns_per_op']:>12.1f} {'new':>9}")
+            continue
+
+        change = pct_change(base["ns_per_op"], cur["ns_per_op"])
+        base_allocs = base["allocs_per_op"]
+        cur_allocs = cur["allocs_per_op"]
+        print(f"{name:<34} {base['ns_per_op']:>12.1f} {cur['ns_per_op']:>12.1f} {change:>+8.1f}% "
+              f"{fmt_allocs(base_allocs):>12} {fmt_allocs(cur_allocs):>8}")
+
+        if change > args.threshold:
+            regressions.append(f"{name}: ns/op {change:+.1f}%")
+        if base_allocs is not None and cur_allocs is not None and cur_allocs > base_allocs + 0.5:
+            regressions.append(f"{name}: allocs/op {base_allocs:g} -> {cur_allocs:g}")
+
+    for name in baseline.keys() - current.keys():
+        print(f"{name:<34} missing from current results")
+
+    if regressions:
+        print("\nRegressions:")
+        for line in regressions:
+            print(f"  {line}")
+        return 1
+
+    print("\nNo regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
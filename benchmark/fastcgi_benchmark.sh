@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# Requests/sec and latency of scripts forwarded to a FastCGI application on loopback,
+# with the application multiplexing requests on each connection and without (php-fpm)
+# Requires: a meson build of shelob, loadgen and fcgi_echo (meson compile -C builddir)
+
+set -e
+
+echo "=== Fishjelly FastCGI Benchmark ==="
+echo "Requests/sec through --fastcgi: multiplexed vs one request per connection"
+echo
+
+BUILDDIR=${BUILDDIR:-builddir}
+PORT=${PORT:-8092}
+METRICS_PORT=${METRICS_PORT:-9192}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-4}
+FASTCGI_CONNECTIONS=${FASTCGI_CONNECTIONS:-4} # Per server event loop
+RESPONSE_KB=${RESPONSE_KB:-0}                 # 0 echoes a short line with Content-Length
+SCRIPT_NAME="fcgi-bench.sh"
+URL="http://127.0.0.1:$PORT/$SCRIPT_NAME"
+if [ "$RESPONSE_KB" -gt 0 ]; then
+    URL="$URL?size=$((RESPONSE_KB * 1024))"
+fi
+
+SHELOB="./$BUILDDIR/src/shelob"
+LOADGEN="./$BUILDDIR/benchmark/loadgen"
+FCGI_ECHO="./$BUILDDIR/benchmark/fcgi_echo"
+for binary in "$SHELOB" "$LOADGEN" "$FCGI_ECHO"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build with: meson compile -C $BUILDDIR"
+        exit 1
+    fi
+done
+
+WORKDIR=$(mktemp -d)
+SOCKET="$WORKDIR/fcgi.sock"
+SERVER_PID=""
+APP_PID=""
+stop() {
+    for pid in "$@"; do
+        if [ -n "$pid" ]; then
+            kill $pid 2>/dev/null || true
+            wait $pid 2>/dev/null || true
+        fi
+    done
+}
+cleanup() {
+    stop "$SERVER_PID" "$APP_PID"
+    rm -f "base/htdocs/$SCRIPT_NAME"
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+# Only its presence matters; the application answers for it
+printf '#!/bin/sh\n' > "base/htdocs/$SCRIPT_NAME"
+
+run() {
+    local label=$1
+    shift
+    "$FCGI_ECHO" "$SOCKET" "$@" > "$WORKDIR/$label-app.log" 2>&1 &
+    APP_PID=$!
+    "$SHELOB" -p "$PORT" --metrics-port "$METRICS_PORT" --fastcgi "$SOCKET" \
+        --fastcgi-connections "$FASTCGI_CONNECTIONS" > "$WORKDIR/$label-server.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        echo "Error: Server failed to start"
+        cat "$WORKDIR/$label-server.log"
+        exit 1
+    fi
+
+    echo "--- $label ---"
+    "$LOADGEN" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -l "$label" \
+        -o "$WORKDIR/$label.json" "$URL"
+    curl -s "http://127.0.0.1:$METRICS_PORT/metrics" | grep '^shelob_fastcgi' || true
+    echo
+
+    stop "$SERVER_PID"
+    SERVER_PID=""
+    stop "$APP_PID"
+    APP_PID=""
+    tail -n 1 "$WORKDIR/$label-app.log"
+    echo
+}
+
+run multiplexed
+run one-per-connection --no-multiplex
@@ -0,0 +1,32 @@
+// FastCGI echo application for trying out and benchmarking shelob --fastcgi
+//
+//   fcgi_echo SOCKET [--no-multiplex]
+//
+// See fastcgi_echo_app.h for what it answers.
+
+#include "../tests/fastcgi_echo_app.h"
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argv[1][0] == '-') {
+        std::cerr << "Usage: " << argv[0] << " SOCKET [--no-multiplex]" << std::endl;
+        return 1;
+    }
+    std::string path = argv[1];
+    bool multiplex = !(argc > 2 && std::strcmp(argv[2], "--no-multiplex") == 0);
+
+    asio::io_context io;
+    std::filesystem::remove(path);
+    FastCgiEchoApp app(io, path, multiplex);
+    asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](auto, auto) { io.stop(); });
+    std::cout << "fcgi_echo listening on " << path << std::endl;
+    io.run();
+
+    std::filesystem::remove(path);
+    std::cout << app.requests() << " requests on " << app.connections() << " connections"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#!/bin/bash
+
+# Syscalls per request and tail latency of the epoll and io_uring builds on loopback
+# Requires: two meson builds of shelob, the default (epoll) one and one configured
+#           with -Dio-uring=enabled (liburing, Boost >= 1.78):
+#               meson setup builddir && meson setup builddir-uring -Dio-uring=enabled
+#           perf (preferred) or strace to count syscalls
+
+set -e
+
+echo "=== Fishjelly io_uring Benchmark ==="
+echo "Syscalls/request and p99 latency: epoll vs io_uring backend"
+echo
+
+EPOLL_BUILDDIR=${EPOLL_BUILDDIR:-builddir}
+URING_BUILDDIR=${URING_BUILDDIR:-builddir-uring}
+PORT=${PORT:-8090}
+DURATION=${DURATION:-15}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-4}
+RATE=${RATE:-20000} # Open loop, so p99 includes queueing behind slow requests
+FILE_KB=${FILE_KB:-256}
+FILE_NAME="uring-bench-${FILE_KB}k.bin"
+SMALL_URL="http://127.0.0.1:$PORT/index.html"
+LARGE_URL="http://127.0.0.1:$PORT/$FILE_NAME"
+
+LOADGEN="./$EPOLL_BUILDDIR/benchmark/loadgen"
+for binary in "./$EPOLL_BUILDDIR/src/shelob" "./$URING_BUILDDIR/src/shelob" "$LOADGEN"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build both with: meson compile -C <builddir>"
+        exit 1
+    fi
+done
+
+if command -v perf >/dev/null && perf stat -e raw_syscalls:sys_enter true 2>/dev/null; then
+    COUNTER=perf
+elif command -v strace >/dev/null; then
+    COUNTER=strace
+    echo "Note: perf unavailable, counting syscalls with strace in a separate run"
+else
+    echo "Error: need perf or strace to count syscalls"
+    exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -f "base/htdocs/$FILE_NAME"
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+head -c $((FILE_KB * 1024)) /dev/urandom > "base/htdocs/$FILE_NAME"
+
+start_server() {
+    local builddir=$1
+    "./$builddir/src/shelob" -p "$PORT" > "$WORKDIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        echo "Error: Server failed to start"
+        cat "$WORKDIR/server.log"
+        exit 1
+    fi
+}
+
+stop_server() {
+    kill $SERVER_PID 2>/dev/null || true
+    wait $SERVER_PID 2>/dev/null || true
+    SERVER_PID=""
+}
+
+# Count the server's syscalls while loadgen runs: count_syscalls OUT loadgen-args...
+count_syscalls() {
+    local out=$1
+    shift
+    if [ "$COUNTER" = perf ]; then
+        perf stat -e raw_syscalls:sys_enter -x, -o "$out.perf" -p $SERVER_PID &
+        local counter_pid=$!
+        "$LOADGEN" "$@"
+        kill -INT $counter_pid
+        wait $counter_pid || true
+        awk -F, '/raw_syscalls/ { print $1 }' "$out.perf" > "$out"
+    else
+        strace -f -c -o "$out.strace" -p $SERVER_PID &
+        local counter_pid=$!
+        sleep 1
+        "$LOADGEN" "$@" > /dev/null
+        kill -INT $counter_pid
+        wait $counter_pid || true
+        awk '$NF == "total" { print $4 }' "$out.strace" > "$out"
+    fi
+}
+
+# Run one backend against one URL: run_benchmark LABEL BUILDDIR URL
+run_benchmark() {
+    local label=$1
+    local builddir=$2
+    local url=$3
+
+    echo -e "\n### $label ###"
+    start_server "$builddir"
+    local args=(-c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -R "$RATE" -l "$label")
+    if [ "$COUNTER" = perf ]; then
+        count_syscalls "$WORKDIR/$label.syscalls" "${args[@]}" -o "$WORKDIR/$label.json" "$url"
+    else
+        # strace slows the server down, so latency comes from an untraced run
+        "$LOADGEN" "${args[@]}" -o "$WORKDIR/$label.json" "$url"
+        count_syscalls "$WORKDIR/$label.syscalls" "${args[@]}" -o "$WORKDIR/$label.traced.json" \
+            "$url"
+    fi
+    stop_server
+}
+
+run_benchmark epoll-small "$EPOLL_BUILDDIR" "$SMALL_URL"
+run_benchmark uring-small "$URING_BUILDDIR" "$SMALL_URL"
+run_benchmark epoll-large "$EPOLL_BUILDDIR" "$LARGE_URL"
+run_benchmark uring-large "$URING_BUILDDIR" "$LARGE_URL"
+
+echo -e "\n=== COMPARISON SUMMARY ==="
+python3 - "$WORKDIR" "$COUNTER" <<'EOF'
+import json
+import os
+import sys
+
+workdir, counter = sys.argv[1], sys.argv[2]
+print(f"{'run':<12} {'req/s':>10} {'p50 ms':>8} {'p99 ms':>8} {'syscalls/req':>13}")
+for label in ["epoll-small", "uring-small", "epoll-large", "uring-large"]:
+    with open(os.path.join(workdir, f"{label}.json")) as f:
+        result = json.load(f)[label]
+    # Syscalls were counted during the run with this many requests
+    traced = os.path.join(workdir, f"{label}.traced.json")
+    requests = result["throughput"]["total_requests"]
+    if counter == "strace":
+        with open(traced) as f:
+            requests = json.load(f)[label]["throughput"]["total_requests"]
+    with open(os.path.join(workdir, f"{label}.syscalls")) as f:
+        syscalls = int(f.read().strip() or 0)
+    per_request = syscalls / requests if requests else float("nan")
+    print(f"{label:<12} {result['throughput']['requests_per_second']:>10.0f} "
+          f"{result['latency']['median_ms']:>8.3f} {result['latency']['p99_ms']:>8.3f} "
+          f"{per_request:>13.2f}")
+EOF
@@ -0,0 +1,100 @@
+#!/bin/bash
+
+# HTTPS large-file throughput with and without kernel TLS (kTLS) on loopback
+# Requires: meson build in builddir (shelob + benchmark/loadgen), openssl,
+#           Linux with the tls module loaded for the kTLS run (modprobe tls)
+
+set -e
+
+echo "=== Fishjelly kTLS Benchmark ==="
+echo "HTTPS static file throughput: userspace TLS vs kernel TLS"
+echo
+
+BUILDDIR=${BUILDDIR:-builddir}
+PORT=${PORT:-8443}
+DURATION=${DURATION:-15}
+CONNECTIONS=${CONNECTIONS:-8}
+THREADS=${THREADS:-2}
+FILE_MB=${FILE_MB:-64}
+FILE_NAME="ktls-bench-${FILE_MB}m.bin"
+URL="https://127.0.0.1:$PORT/$FILE_NAME"
+
+SHELOB="./$BUILDDIR/src/shelob"
+LOADGEN="./$BUILDDIR/benchmark/loadgen"
+for binary in "$SHELOB" "$LOADGEN"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build with: meson compile -C $BUILDDIR"
+        exit 1
+    fi
+done
+
+if [ "$(uname)" != "Linux" ]; then
+    echo "Warning: kTLS is Linux-only; both runs will use userspace TLS"
+elif ! grep -qw tls /proc/sys/net/ipv4/tcp_available_ulp 2>/dev/null; then
+    echo "Warning: tls ULP not available (try: sudo modprobe tls); kTLS run will fall back"
+fi
+
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -f "base/htdocs/$FILE_NAME"
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+# Self-signed certificate and test file
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+    -keyout "$WORKDIR/key.pem" -out "$WORKDIR/cert.pem" 2>/dev/null
+head -c $((FILE_MB * 1024 * 1024)) /dev/urandom > "base/htdocs/$FILE_NAME"
+
+# Function to run benchmark
+run_benchmark() {
+    local mode=$1
+    shift
+
+    echo -e "\n### $mode ###"
+    "$SHELOB" --ssl --ssl-port "$PORT" --ssl-cert "$WORKDIR/cert.pem" \
+        --ssl-key "$WORKDIR/key.pem" "$@" > "$WORKDIR/$mode.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+
+    # Check if server started
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        echo "Error: Server failed to start"
+        cat "$WORKDIR/$mode.log"
+        exit 1
+    fi
+
+    "$LOADGEN" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -l "$mode" \
+        -o "$WORKDIR/$mode.json" "$URL"
+
+    kill $SERVER_PID 2>/dev/null || true
+    wait $SERVER_PID 2>/dev/null || true
+    SERVER_PID=""
+}
+
+run_benchmark userspace
+run_benchmark ktls --ktls
+
+# Compare MB/s from the loadgen JSON results
+echo -e "\n=== COMPARISON SUMMARY ==="
+python3 - "$WORKDIR/userspace.json" "$WORKDIR/ktls.json" <<'EOF'
+import json
+import sys
+
+rates = {}
+for path in sys.argv[1:]:
+    with open(path) as f:
+        for mode, result in json.load(f).items():
+            t = result["throughput"]
+            rates[mode] = t["bytes_received"] / t["duration"] / (1024 * 1024)
+            print(f"{mode:<10} {rates[mode]:>10.1f} MB/s  {t['requests_per_second']:>8.1f} req/s  "
+                  f"p99 {result['latency']['p99_ms']:.1f}ms")
+
+if rates.get("userspace"):
+    print(f"\nkTLS speedup: {rates['ktls'] / rates['userspace']:.2f}x")
+EOF
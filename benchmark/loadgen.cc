@@ -0,0 +1,1126 @@
+/**
+ * Native HTTP load generator
+ *
+ * Drives many connections across threads (one io_context per thread) with
+ * HTTP/1.1 keep-alive and pipelining, HTTP/2 streams, and optional TLS.
+ *
+ * In open-loop mode (--rate) every connection sends on a fixed schedule that
+ * does not wait for responses, and latency is measured from the time a request
+ * was scheduled rather than when it was actually written. Time spent queued
+ * behind a stalled request is therefore included, which closed-loop clients
+ * silently drop (coordinated omission). In closed-loop mode each connection
+ * sends as fast as responses come back; --expected-interval applies the
+ * HdrHistogram-style correction instead.
+ *
+ * With --random-paths each request picks one of a fixed set of random names
+ * under the URL's path, the traffic of a scanner probing for files that
+ * don't exist.
+ *
+ * Results are written in the same JSON layout as benchmark_results.json.
+ */
+
+#include "../src/metrics.h"
+
+#include <argparse.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#ifdef HAVE_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifndef GIT_HASH
+#define GIT_HASH "unknown"
+#endif
+
+namespace asio = boost::asio;
+namespace ssl = asio::ssl;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string url;
+    std::string scheme;
+    std::string host;
+    std::string port;
+    std::string path;
+    std::vector<std::string> paths; // Requested at random instead of path, if any
+    std::string method;
+    std::vector<std::string> headers;
+    int connections;
+    int threads;
+    double duration;   // Seconds
+    double rate;       // Total requests per second, 0 for closed-loop
+    int pipeline;      // Requests in flight per connection (HTTP/1.1 depth or HTTP/2 streams)
+    bool keep_alive;   // Reuse connections (HTTP/1.1)
+    bool http2;        // Speak HTTP/2 (ALPN over TLS, prior knowledge over cleartext)
+    double timeout;    // Seconds to wait for in-flight requests after the run
+    double expected_interval_ms; // Closed-loop coordinated-omission correction
+    int expect_status;           // Also counted as completed, besides 2xx and 3xx
+    std::string label;
+    std::string output;
+
+    bool tls() const { return scheme == "https"; }
+};
+
+/**
+ * Split http[s]://host[:port][/path] into its parts
+ */
+bool parseUrl(Options& options) {
+    std::string_view url = options.url;
+    size_t scheme_end = url.find("://");
+    if (scheme_end == std::string_view::npos) {
+        return false;
+    }
+    options.scheme = std::string(url.substr(0, scheme_end));
+    if (options.scheme != "http" && options.scheme != "https") {
+        return false;
+    }
+    url.remove_prefix(scheme_end + 3);
+
+    size_t path_start = url.find('/');
+    std::string_view authority = url.substr(0, path_start);
+    options.path = path_start == std::string_view::npos ? "/" : std::string(url.substr(path_start));
+
+    size_t colon = authority.rfind(':');
+    if (colon != std::string_view::npos && authority.find(']', colon) == std::string_view::npos) {
+        options.host = std::string(authority.substr(0, colon));
+        options.port = std::string(authority.substr(colon + 1));
+    } else {
+        options.host = std::string(authority);
+        options.port = options.tls() ? "443" : "80";
+    }
+    if (options.host.size() > 2 && options.host.front() == '[') {
+        options.host = options.host.substr(1, options.host.size() - 2);
+    }
+    return !options.host.empty();
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+/**
+ * Per-thread results, merged once all threads have finished
+ */
+struct WorkerStats {
+    LogLinearHistogram latency; // Nanoseconds, successful responses only
+    uint64_t completed = 0;     // 2xx and 3xx responses, and the expected status
+    uint64_t errors = 0;        // Other responses and requests that never got one
+    uint64_t connect_errors = 0;
+    uint64_t bytes_received = 0;
+    uint64_t connections_ok = 0; // Connections that completed at least one request
+
+    void merge(const WorkerStats& other) {
+        latency.merge(other.latency);
+        completed += other.completed;
+        errors += other.errors;
+        connect_errors += other.connect_errors;
+        bytes_received += other.bytes_received;
+        connections_ok += other.connections_ok;
+    }
+};
+
+/**
+ * When each request on a connection is due
+ *
+ * Open-loop schedules are fixed up front; a closed-loop request is due as soon
+ * as the connection has a free slot.
+ */
+class Schedule {
+  public:
+    Schedule(Clock::time_point first, Clock::duration interval)
+        : next_(first), interval_(interval) {}
+
+    bool open_loop() const { return interval_.count() > 0; }
+
+    Clock::time_point next() {
+        if (!open_loop()) {
+            return Clock::now();
+        }
+        Clock::time_point due = next_;
+        next_ += interval_;
+        return due;
+    }
+
+  private:
+    Clock::time_point next_;
+    Clock::duration interval_;
+};
+
+/**
+ * Single-threaded wakeup for coroutines sharing an io_context
+ *
+ * Waiters must re-check their condition in a loop, since a notify() that
+ * arrives while nobody is waiting is not remembered.
+ */
+class Event {
+  public:
+    explicit Event(const asio::any_io_executor& executor)
+        : timer_(executor, Clock::time_point::max()) {}
+
+    asio::awaitable<void> wait() {
+        timer_.expires_at(Clock::time_point::max());
+        boost::system::error_code ec;
+        co_await timer_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+    }
+
+    void notify() { timer_.cancel(); }
+
+  private:
+    asio::steady_timer timer_;
+};
+
+tcp::socket& lowestLayer(tcp::socket& stream) { return stream; }
+tcp::socket& lowestLayer(ssl::stream<tcp::socket>& stream) { return stream.next_layer(); }
+
+class Worker {
+  public:
+    Worker(const Options& options, const tcp::resolver::results_type& endpoints,
+           ssl::context& ssl_context, Clock::time_point start, Clock::time_point deadline)
+        : options_(options), endpoints_(endpoints), ssl_context_(ssl_context), start_(start),
+          deadline_(deadline) {
+        if (options_.paths.empty()) {
+            requests_.push_back(buildRequest(options_.path));
+        }
+        for (const auto& path : options_.paths) {
+            requests_.push_back(buildRequest(path));
+        }
+    }
+
+    /**
+     * @param index Connection number across all threads, used to stagger start times
+     */
+    void addConnection(int index) {
+        asio::co_spawn(io_context_, connectionLoop(index), asio::detached);
+    }
+
+    void run() {
+        // Anything still in flight this long after the deadline is abandoned
+        asio::steady_timer hard_stop(io_context_);
+        hard_stop.expires_at(deadline_ + std::chrono::duration_cast<Clock::duration>(
+                                              std::chrono::duration<double>(options_.timeout)));
+        hard_stop.async_wait([this](const boost::system::error_code&) { io_context_.stop(); });
+        io_context_.run();
+    }
+
+    const WorkerStats& stats() const { return stats_; }
+
+  private:
+    std::string buildRequest(const std::string& path) const {
+        std::string request =
+            std::format("{} {} HTTP/1.1\r\nHost: {}\r\nUser-Agent: fishjelly-loadgen\r\n",
+                        options_.method, path, authority());
+        for (const auto& header : options_.headers) {
+            request += header + "\r\n";
+        }
+        if (!options_.keep_alive) {
+            request += "Connection: close\r\n";
+        }
+        return request + "\r\n";
+    }
+
+    const std::string& nextRequest() {
+        if (requests_.size() == 1) {
+            return requests_.front();
+        }
+        return requests_[std::uniform_int_distribution<size_t>(0, requests_.size() - 1)(random_)];
+    }
+
+    std::string authority() const {
+        bool default_port = options_.port == (options_.tls() ? "443" : "80");
+        std::string host = options_.host.find(':') != std::string::npos
+                               ? "[" + options_.host + "]"
+                               : options_.host;
+        return default_port ? host : host + ":" + options_.port;
+    }
+
+    void record(Clock::time_point due, int status, const Schedule& schedule) {
+        if ((status < 200 || status >= 400) && status != options_.expect_status) {
+            stats_.errors++;
+            return;
+        }
+        stats_.completed++;
+        auto latency = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count());
+        if (!schedule.open_loop() && options_.expected_interval_ms > 0) {
+            stats_.latency.record_corrected(
+                latency, static_cast<uint64_t>(options_.expected_interval_ms * 1e6));
+        } else {
+            stats_.latency.record(latency);
+        }
+    }
+
+    asio::awaitable<void> connectionLoop(int index) {
+        Clock::duration interval{0};
+        Clock::time_point first = start_;
+        if (options_.rate > 0) {
+            interval = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(options_.connections / options_.rate));
+            first += interval * index / options_.connections;
+        }
+        Schedule schedule(first, interval);
+
+        asio::steady_timer start_timer(io_context_, start_);
+        co_await start_timer.async_wait(asio::use_awaitable);
+
+        bool counted = false;
+        while (Clock::now() < deadline_) {
+            bool ok = false;
+            try {
+                tcp::socket socket(io_context_);
+                co_await asio::async_connect(socket, endpoints_, asio::use_awaitable);
+                socket.set_option(tcp::no_delay(true));
+
+                if (options_.tls()) {
+                    ssl::stream<tcp::socket> stream(std::move(socket), ssl_context_);
+                    SSL_set_tlsext_host_name(stream.native_handle(), options_.host.c_str());
+                    co_await stream.async_handshake(ssl::stream_base::client, asio::use_awaitable);
+                    ok = co_await runSession(stream, schedule);
+                } else {
+                    ok = co_await runSession(socket, schedule);
+                }
+            } catch (const std::exception& e) {
+                if (stats_.connect_errors++ == 0) {
+                    std::cerr << "Connection error: " << e.what() << std::endl;
+                }
+            }
+
+            if (ok && !counted) {
+                stats_.connections_ok++;
+                counted = true;
+            }
+            if (!ok) {
+                // Avoid spinning on a server that refuses or drops connections
+                asio::steady_timer backoff(io_context_, std::chrono::milliseconds(10));
+                co_await backoff.async_wait(asio::use_awaitable);
+            }
+        }
+    }
+
+    template <typename Stream>
+    asio::awaitable<bool> runSession(Stream& stream, Schedule& schedule) {
+#ifdef HAVE_NGHTTP2
+        if (options_.http2) {
+            co_return co_await runHttp2(stream, schedule);
+        }
+#endif
+        co_return co_await runHttp1(stream, schedule);
+    }
+
+    // ------------------------------------------------------------------
+    // HTTP/1.1
+    // ------------------------------------------------------------------
+
+    struct Response {
+        int status;
+        bool close;
+    };
+
+    template <typename Stream>
+    asio::awaitable<bool> readMore(Stream& stream, std::string& buffer) {
+        constexpr size_t READ_SIZE = 16384;
+        size_t old_size = buffer.size();
+        buffer.resize(old_size + READ_SIZE);
+        boost::system::error_code ec;
+        size_t n =
+            co_await stream.async_read_some(asio::buffer(buffer.data() + old_size, READ_SIZE),
+                                            asio::redirect_error(asio::use_awaitable, ec));
+        buffer.resize(old_size + n);
+        stats_.bytes_received += n;
+        co_return !ec;
+    }
+
+    /**
+     * Read one response (status line, headers, and a Content-Length, chunked
+     * or read-to-close body) from the front of the buffer and consume it
+     */
+    template <typename Stream>
+    asio::awaitable<std::optional<Response>> readResponse(Stream& stream, std::string& buffer) {
+        size_t header_end;
+        while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!co_await readMore(stream, buffer)) {
+                co_return std::nullopt;
+            }
+        }
+
+        std::string_view head(buffer.data(), header_end);
+        if (head.size() < 12 || !head.starts_with("HTTP/1.")) {
+            co_return std::nullopt;
+        }
+        Response response{0, head[7] == '0'};
+        std::from_chars(head.data() + 9, head.data() + 12, response.status);
+
+        std::optional<size_t> content_length;
+        bool chunked = false;
+        size_t line_start = head.find("\r\n");
+        while (line_start != std::string_view::npos) {
+            line_start += 2;
+            size_t line_end = head.find("\r\n", line_start);
+            std::string_view line = head.substr(line_start, line_end - line_start);
+            line_start = line_end;
+
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+
+            if (iequals(name, "Content-Length")) {
+                size_t length = 0;
+                std::from_chars(value.data(), value.data() + value.size(), length);
+                content_length = length;
+            } else if (iequals(name, "Transfer-Encoding")) {
+                chunked = value.find("chunked") != std::string_view::npos;
+            } else if (iequals(name, "Connection")) {
+                response.close = iequals(value, "close");
+            }
+        }
+
+        size_t pos = header_end + 4;
+        bool no_body = options_.method == "HEAD" || response.status == 204 ||
+                       response.status == 304 || response.status < 200;
+        if (no_body) {
+            // Nothing to skip
+        } else if (chunked) {
+            while (true) {
+                size_t size_end;
+                while ((size_end = buffer.find("\r\n", pos)) == std::string::npos) {
+                    if (!co_await readMore(stream, buffer)) {
+                        co_return std::nullopt;
+                    }
+                }
+                size_t chunk_size = 0;
+                std::from_chars(buffer.data() + pos, buffer.data() + size_end, chunk_size, 16);
+                pos = size_end + 2;
+                if (chunk_size == 0) {
+                    // Skip trailers up to the terminating empty line
+                    size_t trailer_end;
+                    while ((trailer_end = buffer.find("\r\n", pos)) == std::string::npos) {
+                        if (!co_await readMore(stream, buffer)) {
+                            co_return std::nullopt;
+                        }
+                    }
+                    if (trailer_end == pos) {
+                        pos += 2;
+                        break;
+                    }
+                    pos = trailer_end + 2;
+                    continue;
+                }
+                while (buffer.size() < pos + chunk_size + 2) {
+                    if (!co_await readMore(stream, buffer)) {
+                        co_return std::nullopt;
+                    }
+                }
+                pos += chunk_size + 2;
+            }
+        } else if (content_length) {
+            while (buffer.size() < pos + *content_length) {
+                if (!co_await readMore(stream, buffer)) {
+                    co_return std::nullopt;
+                }
+            }
+            pos += *content_length;
+        } else {
+            // Body runs to end of connection
+            while (co_await readMore(stream, buffer)) {
+            }
+            pos = buffer.size();
+            response.close = true;
+        }
+
+        buffer.erase(0, pos);
+        co_return response;
+    }
+
+    /**
+     * State shared between the writer and reader of one HTTP/1.1 connection
+     */
+    struct Http1State {
+        explicit Http1State(const asio::any_io_executor& executor)
+            : send_timer(executor), slot_free(executor), request_sent(executor),
+              writer_exited(executor) {}
+
+        std::deque<Clock::time_point> in_flight; // Due times of unanswered requests
+        asio::steady_timer send_timer;
+        Event slot_free;
+        Event request_sent;
+        Event writer_exited;
+        bool stop = false;
+        bool writer_running = true;
+    };
+
+    template <typename Stream>
+    asio::awaitable<void> http1Writer(Stream& stream, Schedule& schedule, Http1State& state) {
+        size_t depth = options_.keep_alive ? static_cast<size_t>(options_.pipeline) : 1;
+        while (!state.stop) {
+            while (!state.stop && state.in_flight.size() >= depth) {
+                co_await state.slot_free.wait();
+            }
+            if (state.stop) {
+                break;
+            }
+
+            Clock::time_point due = schedule.next();
+            if (due >= deadline_) {
+                break;
+            }
+            if (due > Clock::now()) {
+                boost::system::error_code ec;
+                state.send_timer.expires_at(due);
+                co_await state.send_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                if (state.stop) {
+                    break;
+                }
+            }
+
+            state.in_flight.push_back(due);
+            state.request_sent.notify();
+
+            boost::system::error_code ec;
+            co_await asio::async_write(stream, asio::buffer(nextRequest()),
+                                       asio::redirect_error(asio::use_awaitable, ec));
+            if (ec || !options_.keep_alive) {
+                break;
+            }
+        }
+        state.writer_running = false;
+        state.request_sent.notify();
+        state.writer_exited.notify();
+    }
+
+    /**
+     * Run requests over one connection until the deadline or the connection
+     * closes. Returns true if at least one response was received.
+     */
+    template <typename Stream>
+    asio::awaitable<bool> runHttp1(Stream& stream, Schedule& schedule) {
+        Http1State state(stream.get_executor());
+        asio::co_spawn(stream.get_executor(), http1Writer(stream, schedule, state),
+                       asio::detached);
+
+        std::string buffer;
+        bool answered = false;
+        while (true) {
+            while (state.in_flight.empty() && state.writer_running) {
+                co_await state.request_sent.wait();
+            }
+            if (state.in_flight.empty()) {
+                break;
+            }
+
+            auto response = co_await readResponse(stream, buffer);
+            if (!response) {
+                break;
+            }
+            answered = true;
+            record(state.in_flight.front(), response->status, schedule);
+            state.in_flight.pop_front();
+            state.slot_free.notify();
+            if (response->close) {
+                break;
+            }
+        }
+
+        // Stop the writer and wait for it, since it references this frame
+        state.stop = true;
+        state.send_timer.cancel();
+        state.slot_free.notify();
+        boost::system::error_code ec;
+        lowestLayer(stream).shutdown(tcp::socket::shutdown_send, ec);
+        while (state.writer_running) {
+            co_await state.writer_exited.wait();
+        }
+
+        // Requests still in flight were dropped by the connection closing
+        stats_.errors += state.in_flight.size();
+        co_return answered;
+    }
+
+#ifdef HAVE_NGHTTP2
+    // ------------------------------------------------------------------
+    // HTTP/2
+    // ------------------------------------------------------------------
+
+    struct Http2Stream {
+        Clock::time_point due;
+        int status = 0;
+    };
+
+    /**
+     * Client session for one HTTP/2 connection. Frames are serialized with
+     * nghttp2_session_mem_send() and written by whichever coroutine calls
+     * flush() first.
+     */
+    template <typename Stream> class Http2Client {
+      public:
+        Http2Client(Worker& worker, Stream& stream, Schedule& schedule)
+            : worker_(worker), stream_(stream), schedule_(schedule),
+              send_timer_(stream.get_executor()), slot_free_(stream.get_executor()),
+              request_sent_(stream.get_executor()), writer_exited_(stream.get_executor()) {
+            nghttp2_session_callbacks* callbacks;
+            nghttp2_session_callbacks_new(&callbacks);
+            nghttp2_session_callbacks_set_on_header_callback(callbacks, onHeader);
+            nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, onStreamClose);
+            nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, onFrameRecv);
+            nghttp2_session_client_new(&session_, callbacks, this);
+            nghttp2_session_callbacks_del(callbacks);
+
+            const auto& options = worker_.options_;
+            std::string scheme = options.scheme;
+            std::string authority = worker_.authority();
+            headers_ = {{":method", options.method},
+                        {":scheme", scheme},
+                        {":authority", authority},
+                        {":path", options.path},
+                        {"user-agent", "fishjelly-loadgen"}};
+            for (const auto& header : options.headers) {
+                size_t colon = header.find(':');
+                if (colon == std::string::npos) {
+                    continue;
+                }
+                std::string name = header.substr(0, colon);
+                std::ranges::transform(name, name.begin(), [](unsigned char c) {
+                    return static_cast<char>(std::tolower(c));
+                });
+                std::string value = header.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(' '));
+                headers_.emplace_back(std::move(name), std::move(value));
+            }
+            for (auto& [name, value] : headers_) {
+                nva_.push_back({reinterpret_cast<uint8_t*>(name.data()),
+                                reinterpret_cast<uint8_t*>(value.data()), name.size(),
+                                value.size(), NGHTTP2_NV_FLAG_NONE});
+            }
+        }
+
+        ~Http2Client() { nghttp2_session_del(session_); }
+
+        Http2Client(const Http2Client&) = delete;
+        Http2Client& operator=(const Http2Client&) = delete;
+
+        asio::awaitable<bool> run() {
+            nghttp2_settings_entry settings[] = {
+                {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
+                 static_cast<uint32_t>(worker_.options_.pipeline)},
+                {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1u << 24}};
+            nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings, std::size(settings));
+            nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE, 0, 1 << 30);
+            co_await flush();
+
+            asio::co_spawn(stream_.get_executor(), writer(), asio::detached);
+
+            std::array<char, 16384> buffer;
+            while (!failed_) {
+                while (streams_.empty() && writer_running_ && !failed_) {
+                    co_await request_sent_.wait();
+                }
+                if (streams_.empty()) {
+                    break;
+                }
+
+                boost::system::error_code ec;
+                size_t n = co_await stream_.async_read_some(
+                    asio::buffer(buffer), asio::redirect_error(asio::use_awaitable, ec));
+                if (ec) {
+                    break;
+                }
+                worker_.stats_.bytes_received += n;
+                ssize_t consumed = nghttp2_session_mem_recv(
+                    session_, reinterpret_cast<const uint8_t*>(buffer.data()), n);
+                if (consumed < 0) {
+                    std::cerr << "nghttp2_session_mem_recv error: "
+                              << nghttp2_strerror(static_cast<int>(consumed)) << std::endl;
+                    break;
+                }
+                co_await flush();
+            }
+
+            stop_ = true;
+            send_timer_.cancel();
+            slot_free_.notify();
+            boost::system::error_code ec;
+            lowestLayer(stream_).shutdown(tcp::socket::shutdown_send, ec);
+            while (writer_running_) {
+                co_await writer_exited_.wait();
+            }
+
+            worker_.stats_.errors += streams_.size();
+            co_return answered_;
+        }
+
+      private:
+        asio::awaitable<void> writer() {
+            size_t depth = static_cast<size_t>(worker_.options_.pipeline);
+            while (!stop_ && !goaway_) {
+                while (!stop_ && streams_.size() >= depth) {
+                    co_await slot_free_.wait();
+                }
+                if (stop_ || goaway_) {
+                    break;
+                }
+
+                Clock::time_point due = schedule_.next();
+                if (due >= worker_.deadline_) {
+                    break;
+                }
+                if (due > Clock::now()) {
+                    boost::system::error_code ec;
+                    send_timer_.expires_at(due);
+                    co_await send_timer_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (stop_) {
+                        break;
+                    }
+                }
+
+                int32_t stream_id =
+                    nghttp2_submit_request(session_, nullptr, nva_.data(), nva_.size(), nullptr,
+                                           nullptr);
+                if (stream_id < 0) {
+                    break;
+                }
+                streams_[stream_id] = Http2Stream{due};
+                request_sent_.notify();
+                co_await flush();
+            }
+            writer_running_ = false;
+            request_sent_.notify();
+            writer_exited_.notify();
+        }
+
+        asio::awaitable<void> flush() {
+            if (writing_) {
+                co_return; // The active flush() picks up anything queued meanwhile
+            }
+            writing_ = true;
+            while (!failed_) {
+                output_.clear();
+                const uint8_t* data;
+                ssize_t n;
+                while ((n = nghttp2_session_mem_send(session_, &data)) > 0) {
+                    output_.append(reinterpret_cast<const char*>(data), static_cast<size_t>(n));
+                }
+                if (n < 0) {
+                    failed_ = true;
+                }
+                if (output_.empty()) {
+                    break;
+                }
+                boost::system::error_code ec;
+                co_await asio::async_write(stream_, asio::buffer(output_),
+                                           asio::redirect_error(asio::use_awaitable, ec));
+                if (ec) {
+                    failed_ = true;
+                }
+            }
+            writing_ = false;
+        }
+
+        static int onHeader(nghttp2_session*, const nghttp2_frame* frame, const uint8_t* name,
+                            size_t namelen, const uint8_t* value, size_t valuelen, uint8_t,
+                            void* user_data) {
+            auto* self = static_cast<Http2Client*>(user_data);
+            std::string_view header_name(reinterpret_cast<const char*>(name), namelen);
+            if (header_name == ":status") {
+                auto it = self->streams_.find(frame->hd.stream_id);
+                if (it != self->streams_.end()) {
+                    const char* begin = reinterpret_cast<const char*>(value);
+                    std::from_chars(begin, begin + valuelen, it->second.status);
+                }
+            }
+            return 0;
+        }
+
+        static int onStreamClose(nghttp2_session*, int32_t stream_id, uint32_t error_code,
+                                 void* user_data) {
+            auto* self = static_cast<Http2Client*>(user_data);
+            auto it = self->streams_.find(stream_id);
+            if (it == self->streams_.end()) {
+                return 0;
+            }
+            if (error_code == NGHTTP2_NO_ERROR) {
+                self->worker_.record(it->second.due, it->second.status, self->schedule_);
+                self->answered_ = true;
+            } else {
+                self->worker_.stats_.errors++;
+            }
+            self->streams_.erase(it);
+            self->slot_free_.notify();
+            return 0;
+        }
+
+        static int onFrameRecv(nghttp2_session*, const nghttp2_frame* frame, void* user_data) {
+            if (frame->hd.type == NGHTTP2_GOAWAY) {
+                static_cast<Http2Client*>(user_data)->goaway_ = true;
+            }
+            return 0;
+        }
+
+        Worker& worker_;
+        Stream& stream_;
+        Schedule& schedule_;
+        nghttp2_session* session_ = nullptr;
+        std::vector<std::pair<std::string, std::string>> headers_;
+        std::vector<nghttp2_nv> nva_;
+        std::unordered_map<int32_t, Http2Stream> streams_;
+        std::string output_;
+        asio::steady_timer send_timer_;
+        Event slot_free_;
+        Event request_sent_;
+        Event writer_exited_;
+        bool writing_ = false;
+        bool writer_running_ = true;
+        bool stop_ = false;
+        bool failed_ = false;
+        bool goaway_ = false;
+        bool answered_ = false;
+    };
+
+    template <typename Stream>
+    asio::awaitable<bool> runHttp2(Stream& stream, Schedule& schedule) {
+        if constexpr (std::is_same_v<Stream, ssl::stream<tcp::socket>>) {
+            const unsigned char* alpn = nullptr;
+            unsigned int alpn_len = 0;
+            SSL_get0_alpn_selected(stream.native_handle(), &alpn, &alpn_len);
+            if (std::string_view(reinterpret_cast<const char*>(alpn), alpn_len) != "h2") {
+                throw std::runtime_error("server did not negotiate h2 via ALPN");
+            }
+        }
+        Http2Client<Stream> client(*this, stream, schedule);
+        co_return co_await client.run();
+    }
+#endif // HAVE_NGHTTP2
+
+    const Options& options_;
+    const tcp::resolver::results_type& endpoints_;
+    ssl::context& ssl_context_;
+    Clock::time_point start_;
+    Clock::time_point deadline_;
+    std::vector<std::string> requests_; // Formatted requests, one per path
+    std::minstd_rand random_{std::random_device{}()};
+    WorkerStats stats_;
+    asio::io_context io_context_{1};
+};
+
+Options parseOptions(int argc, char* argv[]) {
+    argparse::ArgumentParser program("loadgen", GIT_HASH);
+
+    program.add_description("HTTP load generator with open-loop mode and latency histograms");
+    program.add_epilog("Example: loadgen -c 64 -t 4 -d 30 -R 20000 http://127.0.0.1:8080/");
+
+    program.add_argument("url").help("target URL (http:// or https://)");
+
+    program.add_argument("-c", "--connections")
+        .help("total connections across all threads")
+        .default_value(16)
+        .scan<'i', int>();
+
+    program.add_argument("-t", "--threads")
+        .help("worker threads")
+        .default_value(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+        .scan<'i', int>();
+
+    program.add_argument("-d", "--duration")
+        .help("test duration in seconds")
+        .default_value(10.0)
+        .scan<'g', double>();
+
+    program.add_argument("-R", "--rate")
+        .help("open-loop: total requests per second (0 runs closed-loop)")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("-p", "--pipeline")
+        .help("requests in flight per connection (HTTP/1.1 pipelining or HTTP/2 streams)")
+        .default_value(1)
+        .scan<'i', int>();
+
+    program.add_argument("-m", "--method").help("request method").default_value(std::string("GET"));
+
+    program.add_argument("-H", "--header")
+        .help("extra request header, may be repeated")
+        .append()
+        .default_value(std::vector<std::string>{});
+
+    program.add_argument("--no-keepalive")
+        .help("open a new connection for every request")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--http2")
+        .help("use HTTP/2 (h2 over TLS, prior knowledge over cleartext)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--timeout")
+        .help("seconds to wait for in-flight requests after the test ends")
+        .default_value(5.0)
+        .scan<'g', double>();
+
+    program.add_argument("--expected-interval")
+        .help("closed-loop: expected ms between requests per connection, for CO correction")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("--random-paths")
+        .help("request one of N random names under the URL's path each time (scanner misses)")
+        .default_value(0)
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--expect-status")
+        .help("also count responses with this status as completed, e.g. 404 with --random-paths")
+        .default_value(0)
+        .scan<'i', int>()
+        .metavar("CODE");
+
+    program.add_argument("-l", "--label")
+        .help("result key in the JSON output")
+        .default_value(std::string("loadgen"));
+
+    program.add_argument("-o", "--output").help("write JSON results to FILE").metavar("FILE");
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        std::exit(1);
+    }
+
+    Options options{.url = program.get<std::string>("url"),
+                    .scheme = {},
+                    .host = {},
+                    .port = {},
+                    .path = {},
+                    .paths = {},
+                    .method = program.get<std::string>("--method"),
+                    .headers = program.get<std::vector<std::string>>("--header"),
+                    .connections = std::max(1, program.get<int>("--connections")),
+                    .threads = std::max(1, program.get<int>("--threads")),
+                    .duration = program.get<double>("--duration"),
+                    .rate = program.get<double>("--rate"),
+                    .pipeline = std::max(1, program.get<int>("--pipeline")),
+                    .keep_alive = !program.get<bool>("--no-keepalive"),
+                    .http2 = program.get<bool>("--http2"),
+                    .timeout = program.get<double>("--timeout"),
+                    .expected_interval_ms = program.get<double>("--expected-interval"),
+                    .expect_status = program.get<int>("--expect-status"),
+                    .label = program.get<std::string>("--label"),
+                    .output = program.present("--output").value_or("")};
+    options.threads = std::min(options.threads, options.connections);
+
+    if (!parseUrl(options)) {
+        std::cerr << "Invalid URL: " << options.url << std::endl;
+        std::exit(1);
+    }
+    if (int count = program.get<int>("--random-paths"); count > 0) {
+        if (options.http2) {
+            std::cerr << "Error: --random-paths is only supported over HTTP/1.1" << std::endl;
+            std::exit(1);
+        }
+        // The same names on every connection, so a server can recognise repeats
+        std::string base = options.path.ends_with('/') ? options.path : options.path + "/";
+        std::mt19937_64 random(42);
+        for (int i = 0; i < count; ++i) {
+            options.paths.push_back(std::format("{}{:016x}.php", base, random()));
+        }
+    }
+#ifndef HAVE_NGHTTP2
+    if (options.http2) {
+        std::cerr << "Error: HTTP/2 support not available. Rebuild with libnghttp2." << std::endl;
+        std::exit(1);
+    }
+#endif
+    return options;
+}
+
+double toMs(uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+std::string localTimestamp() {
+    auto now = std::chrono::system_clock::now();
+    time_t seconds = std::chrono::system_clock::to_time_t(now);
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()) %
+                  1000000;
+    std::array<char, 32> buf;
+    strftime(buf.data(), buf.size(), "%Y-%m-%dT%H:%M:%S", localtime(&seconds));
+    return std::format("{}.{:06}", buf.data(), micros.count());
+}
+
+/**
+ * Render results using the benchmark_results.json layout, keyed by label
+ */
+std::string toJson(const Options& options, const WorkerStats& stats, double elapsed) {
+    const LogLinearHistogram& h = stats.latency;
+    bool corrected = options.rate > 0 || options.expected_interval_ms > 0;
+    uint64_t failed = static_cast<uint64_t>(options.connections) - stats.connections_ok;
+    std::string protocol = options.http2 ? "h2" : "http/1.1";
+
+    std::string json = "{\n";
+    json += std::format("  \"{}\": {{\n", options.label);
+    json += std::format("    \"mode\": \"{}\",\n", options.label);
+    json += std::format("    \"timestamp\": \"{}\",\n", localTimestamp());
+    json += "    \"throughput\": {\n";
+    json += std::format("      \"requests_per_second\": {},\n",
+                        static_cast<double>(stats.completed) / elapsed);
+    json += std::format("      \"total_requests\": {},\n", stats.completed);
+    json += std::format("      \"errors\": {},\n", stats.errors);
+    json += std::format("      \"connect_errors\": {},\n", stats.connect_errors);
+    json += std::format("      \"bytes_received\": {},\n", stats.bytes_received);
+    json += std::format("      \"duration\": {}\n", elapsed);
+    json += "    },\n";
+    json += "    \"latency\": {\n";
+    json += std::format("      \"mean_ms\": {},\n", h.mean() / 1e6);
+    json += std::format("      \"median_ms\": {},\n", toMs(h.percentile(0.5)));
+    json += std::format("      \"min_ms\": {},\n", toMs(h.min()));
+    json += std::format("      \"max_ms\": {},\n", toMs(h.max()));
+    json += std::format("      \"p90_ms\": {},\n", toMs(h.percentile(0.9)));
+    json += std::format("      \"p95_ms\": {},\n", toMs(h.percentile(0.95)));
+    json += std::format("      \"p99_ms\": {},\n", toMs(h.percentile(0.99)));
+    json += std::format("      \"p999_ms\": {},\n", toMs(h.percentile(0.999)));
+    json += std::format("      \"errors\": {},\n", stats.errors);
+    json += std::format("      \"corrected\": {}\n", corrected);
+    json += "    },\n";
+    json += "    \"concurrent\": {\n";
+    json += std::format("      \"attempted\": {},\n", options.connections);
+    json += std::format("      \"successful\": {},\n", stats.connections_ok);
+    json += std::format("      \"failed\": {},\n", failed);
+    json += std::format("      \"success_rate\": {}\n",
+                        100.0 * static_cast<double>(stats.connections_ok) / options.connections);
+    json += "    },\n";
+    json += "    \"config\": {\n";
+    json += std::format("      \"url\": \"{}\",\n", options.url);
+    json += std::format("      \"protocol\": \"{}\",\n", protocol);
+    json += std::format("      \"connections\": {},\n", options.connections);
+    json += std::format("      \"threads\": {},\n", options.threads);
+    json += std::format("      \"pipeline\": {},\n", options.pipeline);
+    json += std::format("      \"keep_alive\": {},\n", options.keep_alive);
+    json += std::format("      \"target_rate\": {}\n", options.rate);
+    json += "    }\n";
+    json += "  }\n";
+    json += "}\n";
+    return json;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options = parseOptions(argc, argv);
+
+    tcp::resolver::results_type endpoints;
+    try {
+        asio::io_context resolver_context;
+        tcp::resolver resolver(resolver_context);
+        endpoints = resolver.resolve(options.host, options.port);
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot resolve " << options.host << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Benchmark targets normally use self-signed certificates, so don't verify
+    ssl::context ssl_context(ssl::context::tls_client);
+    ssl_context.set_verify_mode(ssl::verify_none);
+    static const unsigned char alpn_h2[] = {2, 'h', '2'};
+    static const unsigned char alpn_http11[] = {8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+    if (options.http2) {
+        SSL_CTX_set_alpn_protos(ssl_context.native_handle(), alpn_h2, sizeof(alpn_h2));
+    } else {
+        SSL_CTX_set_alpn_protos(ssl_context.native_handle(), alpn_http11, sizeof(alpn_http11));
+    }
+
+    std::cout << std::format("Running {}s test @ {}\n", options.duration, options.url);
+    std::cout << std::format("  {} threads and {} connections, {} {}{}\n", options.threads,
+                             options.connections, options.http2 ? "HTTP/2" : "HTTP/1.1",
+                             options.rate > 0 ? std::format("open-loop at {} req/s", options.rate)
+                                              : std::string("closed-loop"),
+                             options.pipeline > 1
+                                 ? std::format(", {} in flight per connection", options.pipeline)
+                                 : std::string());
+
+    // Give every thread time to set up before the first request is due
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(100);
+    Clock::time_point deadline =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.duration));
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; ++i) {
+        workers.push_back(
+            std::make_unique<Worker>(options, endpoints, ssl_context, start, deadline));
+    }
+    for (int i = 0; i < options.connections; ++i) {
+        workers[static_cast<size_t>(i % options.threads)]->addConnection(i);
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker] { worker->run(); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    WorkerStats total;
+    for (const auto& worker : workers) {
+        total.merge(worker->stats());
+    }
+
+    const LogLinearHistogram& h = total.latency;
+    bool corrected = options.rate > 0 || options.expected_interval_ms > 0;
+    std::cout << std::format("  Latency{}\n", corrected ? " (corrected for coordinated omission)"
+                                                        : "");
+    std::cout << std::format("    mean {:.3f}ms  p50 {:.3f}ms  p90 {:.3f}ms  p99 {:.3f}ms  "
+                             "p99.9 {:.3f}ms  max {:.3f}ms\n",
+                             h.mean() / 1e6, toMs(h.percentile(0.5)), toMs(h.percentile(0.9)),
+                             toMs(h.percentile(0.99)), toMs(h.percentile(0.999)), toMs(h.max()));
+    std::cout << std::format("  {} requests, {} errors, {} connect errors, {:.1f} MB read\n",
+                             total.completed, total.errors, total.connect_errors,
+                             static_cast<double>(total.bytes_received) / (1024 * 1024));
+    std::cout << std::format("Requests/sec: {:.2f}\n",
+                             static_cast<double>(total.completed) / options.duration);
+
+    if (!options.output.empty()) {
+        std::ofstream out(options.output);
+        if (!out) {
+            std::cerr << "Error: Unable to write " << options.output << std::endl;
+            return 1;
+        }
+        out << toJson(options, total, options.duration);
+    }
+
+    return total.completed > 0 ? 0 : 1;
+}
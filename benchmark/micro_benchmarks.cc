@@ -0,0 +1,394 @@
+/**
+ * Component microbenchmarks for the request hot path
+ *
+ * Each benchmark reports time per iteration (ns/op) and heap allocations per
+ * iteration (allocs/op). Allocations are counted by replacing the global
+ * operator new for this binary only.
+ *
+ * Run with --benchmark_out=<file> --benchmark_out_format=json and compare
+ * against benchmark/micro_baseline.json using benchmark/compare_micro.py.
+ */
+
+#include "../src/content_negotiator.h"
+#include "../src/filter.h"
+#include "../src/form_parser.h"
+#include "../src/http.h"
+#include "../src/mime.h"
+#include "../src/router.h"
+#include "../src/security_middleware.h"
+#include "../src/timer_wheel.h"
+#include "../src/token.h"
+#include "../src/websocket_deflate.h"
+
+#include <benchmark/benchmark.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef FISHJELLY_SOURCE_ROOT
+#define FISHJELLY_SOURCE_ROOT "."
+#endif
+
+namespace {
+
+std::atomic<uint64_t> allocation_count{0};
+
+void* counted_alloc(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+/**
+ * Counts allocations over the timed loop and publishes them as allocs/op
+ */
+class AllocationScope {
+  public:
+    explicit AllocationScope(benchmark::State& state)
+        : state_(state), start_(allocation_count.load(std::memory_order_relaxed)) {}
+    ~AllocationScope() {
+        uint64_t allocations = allocation_count.load(std::memory_order_relaxed) - start_;
+        state_.counters["allocs/op"] = benchmark::Counter(static_cast<double>(allocations),
+                                                          benchmark::Counter::kAvgIterations);
+    }
+
+  private:
+    benchmark::State& state_;
+    uint64_t start_;
+};
+
+// The Http constructor hashes the default users' passwords, so share one instance
+Http& shared_http() {
+    static Http http;
+    return http;
+}
+
+const std::string kGetRequest = "GET /index.html HTTP/1.1\r\n"
+                                "Host: localhost:8080\r\n"
+                                "User-Agent: Mozilla/5.0 (X11; Linux x86_64) Firefox/128.0\r\n"
+                                "Accept: text/html,application/xhtml+xml,*/*;q=0.8\r\n"
+                                "Accept-Language: en-US,en;q=0.5\r\n"
+                                "Accept-Encoding: gzip, deflate, br\r\n"
+                                "Connection: keep-alive\r\n"
+                                "\r\n";
+
+std::string make_multipart_body(const std::string& boundary) {
+    std::string body;
+    body += "--" + boundary + "\r\n";
+    body += "Content-Disposition: form-data; name=\"title\"\r\n\r\n";
+    body += "Quarterly report\r\n";
+    body += "--" + boundary + "\r\n";
+    body += "Content-Disposition: form-data; name=\"description\"\r\n\r\n";
+    body += std::string(512, 'x') + "\r\n";
+    body += "--" + boundary + "\r\n";
+    body += "Content-Disposition: form-data; name=\"upload\"; filename=\"report.txt\"\r\n";
+    body += "Content-Type: text/plain\r\n\r\n";
+    body += std::string(4096, 'y') + "\r\n";
+    body += "--" + boundary + "--\r\n";
+    return body;
+}
+
+// JSON updates as pushed over WebSocket: the keys repeat, the values vary
+std::vector<std::string> make_json_messages() {
+    std::vector<std::string> messages;
+    for (int i = 0; i < 64; ++i) {
+        messages.push_back(std::format(R"({{"type":"quote","seq":{},"symbol":"FJ{}","bid":{}.{},)"
+                                       R"("ask":{}.{},"size":{},"venue":"loopback","flags":[]}})",
+                                       100000 + i, i % 8, 100 + i % 7, i * 13 % 100,
+                                       101 + i % 5, i * 29 % 100, 100 * (1 + i % 9)));
+    }
+    return messages;
+}
+
+// Frame header plus payload
+size_t websocket_wire_bytes(size_t payload) {
+    return payload + (payload < 126 ? 2 : payload <= 0xFFFF ? 4 : 10);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+static void BM_ParseHeader(benchmark::State& state) {
+    Http& http = shared_http();
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(http.parseHeader(kGetRequest));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kGetRequest.size()));
+}
+BENCHMARK(BM_ParseHeader);
+
+static void BM_SanitizePath(benchmark::State& state) {
+    const std::filesystem::path base = std::filesystem::current_path();
+    const std::string path = "/docs/../images/./logo.png";
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(SecurityMiddleware::sanitize_path(path, base));
+    }
+}
+BENCHMARK(BM_SanitizePath);
+
+static void BM_MimeFromExtension(benchmark::State& state) {
+    Mime& mime = Mime::getInstance();
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mime.getMimeFromExtension("/images/photo.jpeg"));
+    }
+}
+BENCHMARK(BM_MimeFromExtension);
+
+static void BM_ContentNegotiation(benchmark::State& state) {
+    ContentNegotiator negotiator;
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(negotiator.selectBestMatch(
+            "/data", "application/json;q=0.9, text/html;q=0.8, */*;q=0.1"));
+    }
+}
+BENCHMARK(BM_ContentNegotiation);
+
+static void BM_Tokenize(benchmark::State& state) {
+    Token token;
+    std::vector<std::string> tokens;
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        tokens.clear();
+        token.tokenize(kGetRequest, tokens, "\r\n");
+        benchmark::DoNotOptimize(tokens.data());
+    }
+}
+BENCHMARK(BM_Tokenize);
+
+static void BM_AddFooter(benchmark::State& state) {
+    Filter filter;
+    const std::string page = "<html><head><title>Bench</title></head><body>" +
+                             std::string(static_cast<size_t>(state.range(0)), 'p') +
+                             "</body></html>";
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(filter.addFooter(page));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * page.size()));
+}
+BENCHMARK(BM_AddFooter)->Arg(1 << 10)->Arg(64 << 10);
+
+static void BM_SendHeader(benchmark::State& state) {
+    Http& http = shared_http();
+    const std::vector<std::string> extra_headers = {"ETag: \"1a2b-400-17d3e\"",
+                                                    "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT"};
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        http.sendHeader(200, 1024, "text/html", true, extra_headers);
+    }
+}
+BENCHMARK(BM_SendHeader);
+
+static void BM_ParseRangeHeader(benchmark::State& state) {
+    Http& http = shared_http();
+    const std::string range = "bytes=0-499, 1000-1499, -500";
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(http.parseRangeHeader(range));
+    }
+}
+BENCHMARK(BM_ParseRangeHeader);
+
+static void BM_ParseMultipartFormData(benchmark::State& state) {
+    Http& http = shared_http();
+    const std::string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+    const std::string body = make_multipart_body(boundary);
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(http.parseMultipartFormData(body, boundary));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_ParseMultipartFormData);
+
+// The body arriving in pieces of the given size, as the connection reads it
+static void BM_MultipartParser(benchmark::State& state) {
+    const std::string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+    const std::string body = make_multipart_body(boundary);
+    const size_t piece = static_cast<size_t>(state.range(0));
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        MultipartParser parser(boundary);
+        for (size_t pos = 0; pos < body.size(); pos += piece) {
+            parser.consume(std::string_view(body).substr(pos, piece));
+        }
+        benchmark::DoNotOptimize(parser.finish());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_MultipartParser)->Arg(1460)->Arg(64 << 10);
+
+static void BM_UrlEncodedParser(benchmark::State& state) {
+    std::string body;
+    for (int i = 0; i < 32; ++i) {
+        body += std::format("field{}=some+value+%C3%A9t%C3%A9+{}&", i, i);
+    }
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        UrlEncodedParser parser;
+        parser.consume(body);
+        benchmark::DoNotOptimize(parser.finish());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * body.size()));
+}
+BENCHMARK(BM_UrlEncodedParser);
+
+// A parameterized route found among the given number of routes; time shouldn't grow with it
+static void BM_RouterMatch(benchmark::State& state) {
+    Router router;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        router.add(Method::Get, std::format("/api/v1/resource{}/:id/items/*rest", i),
+                   [](Http&, const RouteRequest&) {});
+    }
+    const std::string path = std::format("/api/v1/resource{}/42/items/a/b", state.range(0) / 2);
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(router.match(Method::Get, path));
+    }
+}
+BENCHMARK(BM_RouterMatch)->Arg(10)->Arg(1000);
+
+// Connections idle in the reactor while the measured one re-arms its timeout
+constexpr int kIdleConnections = 10000;
+
+static void BM_DeadlineRearm(benchmark::State& state) {
+    asio::io_context io;
+    TimerWheel wheel(io.get_executor());
+    std::vector<std::unique_ptr<Deadline>> idle;
+    for (int i = 0; i < kIdleConnections; ++i) {
+        idle.push_back(std::make_unique<Deadline>(wheel, [] {}));
+        idle.back()->arm(std::chrono::seconds(1 + i % 60));
+    }
+    Deadline deadline(wheel, [] {});
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        deadline.arm(std::chrono::seconds(10));
+        deadline.cancel();
+    }
+}
+BENCHMARK(BM_DeadlineRearm);
+
+// What each read and write used to do: arm a timer and race it (wait + cancel)
+static void BM_SteadyTimerRearm(benchmark::State& state) {
+    asio::io_context io;
+    std::vector<std::unique_ptr<asio::steady_timer>> idle;
+    for (int i = 0; i < kIdleConnections; ++i) {
+        idle.push_back(std::make_unique<asio::steady_timer>(io));
+        idle.back()->expires_after(std::chrono::seconds(1 + i % 60));
+        idle.back()->async_wait([](const boost::system::error_code&) {});
+    }
+    asio::steady_timer timer(io);
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        timer.expires_after(std::chrono::seconds(10));
+        timer.async_wait([](const boost::system::error_code&) {});
+        timer.cancel();
+        io.poll_one();
+    }
+}
+BENCHMARK(BM_SteadyTimerRearm);
+
+// permessage-deflate: ns/op is the CPU cost of compressing one message and
+// wire_bytes/op what it takes on the wire (uncompressed: raw_bytes/op)
+static void BM_WebSocketDeflate(benchmark::State& state) {
+    bool takeover = state.range(0) != 0;
+    WebSocketDeflate::Options options{.enabled = true, .level = static_cast<int>(state.range(1))};
+    WebSocketDeflate::Deflater deflater(options, options.window_bits, takeover);
+    const std::vector<std::string> messages = make_json_messages();
+    std::string compressed;
+    size_t raw = 0;
+    size_t wire = 0;
+    size_t next = 0;
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        const std::string& message = messages[next++ % messages.size()];
+        compressed.clear();
+        deflater.compress(message, compressed);
+        raw += websocket_wire_bytes(message.size());
+        wire += websocket_wire_bytes(compressed.size());
+    }
+    state.counters["raw_bytes/op"] =
+        benchmark::Counter(static_cast<double>(raw), benchmark::Counter::kAvgIterations);
+    state.counters["wire_bytes/op"] =
+        benchmark::Counter(static_cast<double>(wire), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_WebSocketDeflate)
+    ->ArgNames({"takeover", "level"})
+    ->Args({0, 1})
+    ->Args({0, 6})
+    ->Args({1, 1})
+    ->Args({1, 6});
+
+// The receiving side; without context takeover each message gets a fresh
+// inflater, as the hub does to keep idle subscribers' windows freed
+static void BM_WebSocketInflate(benchmark::State& state) {
+    bool takeover = state.range(0) != 0;
+    WebSocketDeflate::Options options{.enabled = true};
+    WebSocketDeflate::Deflater deflater(options, options.window_bits, takeover);
+    std::vector<std::string> compressed;
+    for (const std::string& message : make_json_messages()) {
+        deflater.compress(message, compressed.emplace_back());
+    }
+    std::optional<WebSocketDeflate::Inflater> inflater;
+    std::string message;
+    size_t next = 0;
+    AllocationScope allocations(state);
+    for (auto _ : state) {
+        // A shared window has to see every message from the first one on
+        if (!takeover || next % compressed.size() == 0) {
+            inflater.emplace(options.window_bits);
+        }
+        message.clear();
+        inflater->decompress(compressed[next++ % compressed.size()], message, 64 * 1024);
+        benchmark::DoNotOptimize(message);
+    }
+}
+BENCHMARK(BM_WebSocketInflate)->ArgName("takeover")->Arg(0)->Arg(1);
+
+/**
+ * Run from a scratch directory holding mime.types and a set of negotiable
+ * variants, so results don't depend on the caller's working directory
+ */
+int main(int argc, char** argv) {
+    namespace fs = std::filesystem;
+
+    fs::path workdir = fs::temp_directory_path() / "fishjelly-microbench";
+    fs::create_directories(workdir);
+    fs::copy_file(fs::path(FISHJELLY_SOURCE_ROOT) / "base" / "mime.types", workdir / "mime.types",
+                  fs::copy_options::overwrite_existing);
+    for (const char* variant : {"data.html", "data.json", "data.xml"}) {
+        std::ofstream(workdir / variant) << "variant\n";
+    }
+    fs::current_path(workdir);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
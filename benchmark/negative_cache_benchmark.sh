@@ -0,0 +1,91 @@
+#!/bin/bash
+
+# Requests/sec and latency of 404s for random missing paths, the traffic of a
+# vulnerability scanner, with the negative cache off and on. Scanners repeat a
+# wordlist, so the paths come from a fixed set (REPEATED); the unique run uses
+# so many that nearly every request is a first miss, to show what remembering
+# them costs when nothing repeats.
+# Requires: a meson build of shelob and loadgen (meson compile -C builddir)
+
+set -e
+
+echo "=== Fishjelly Negative Cache Benchmark ==="
+echo "Requests/sec of random-miss 404s: --negative-cache off vs on"
+echo
+
+BUILDDIR=${BUILDDIR:-builddir}
+PORT=${PORT:-8095}
+METRICS_PORT=${METRICS_PORT:-9195}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-4}
+REPEATED=${REPEATED:-10000} # Distinct paths in the scanner-like runs
+UNIQUE=${UNIQUE:-5000000}   # Enough that paths rarely repeat within DURATION
+ENTRIES=${ENTRIES:-100000}  # --negative-cache size when on
+
+SHELOB="./$BUILDDIR/src/shelob"
+LOADGEN="./$BUILDDIR/benchmark/loadgen"
+for binary in "$SHELOB" "$LOADGEN"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build with: meson compile -C $BUILDDIR"
+        exit 1
+    fi
+done
+
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+        SERVER_PID=""
+    fi
+}
+cleanup() {
+    stop_server
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+# run LABEL PATHS shelob-args...
+run() {
+    local label=$1
+    local paths=$2
+    shift 2
+    "$SHELOB" -p "$PORT" --metrics-port "$METRICS_PORT" "$@" > "$WORKDIR/$label-server.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+    if ! kill -0 $SERVER_PID 2>/dev/null; then
+        echo "Error: Server failed to start"
+        cat "$WORKDIR/$label-server.log"
+        exit 1
+    fi
+
+    echo "--- $label ---"
+    "$LOADGEN" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -l "$label" \
+        --random-paths "$paths" --expect-status 404 \
+        -o "$WORKDIR/$label.json" "http://127.0.0.1:$PORT/scan/"
+    curl -s "http://127.0.0.1:$METRICS_PORT/metrics" | grep '^shelob_negative_cache' || true
+    echo
+    stop_server
+}
+
+run repeated-off "$REPEATED"
+run repeated-on "$REPEATED" --negative-cache "$ENTRIES"
+run unique-off "$UNIQUE"
+run unique-on "$UNIQUE" --negative-cache "$ENTRIES"
+
+echo "=== COMPARISON SUMMARY ==="
+python3 - "$WORKDIR" <<'EOF'
+import json
+import os
+import sys
+
+workdir = sys.argv[1]
+print(f"{'run':<14} {'req/s':>10} {'p50 ms':>8} {'p99 ms':>8}")
+for label in ["repeated-off", "repeated-on", "unique-off", "unique-on"]:
+    with open(os.path.join(workdir, f"{label}.json")) as f:
+        result = json.load(f)[label]
+    print(f"{label:<14} {result['throughput']['requests_per_second']:>10.0f} "
+          f"{result['latency']['median_ms']:>8.3f} {result['latency']['p99_ms']:>8.3f}")
+EOF
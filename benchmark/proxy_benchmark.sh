@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Requests/sec and latency through the reverse proxy to two upstream shelob
+# instances on loopback, with pooled keep-alive upstream connections and without,
+# next to the same requests sent straight to an upstream
+# Requires: a meson build of shelob and loadgen (meson compile -C builddir)
+
+set -e
+
+echo "=== Fishjelly Reverse Proxy Benchmark ==="
+echo "Requests/sec: direct vs --proxy with and without upstream keep-alive"
+echo
+
+BUILDDIR=${BUILDDIR:-builddir}
+PORT=${PORT:-8093}
+UPSTREAM_PORT=${UPSTREAM_PORT:-8094} # And the next port for the second upstream
+METRICS_PORT=${METRICS_PORT:-9193}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-4}
+BALANCE=${BALANCE:-round-robin}
+PATH_TESTED=${PATH_TESTED:-/index.html}
+
+SHELOB="./$BUILDDIR/src/shelob"
+LOADGEN="./$BUILDDIR/benchmark/loadgen"
+for binary in "$SHELOB" "$LOADGEN"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build with: meson compile -C $BUILDDIR"
+        exit 1
+    fi
+done
+
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+UPSTREAM_PIDS=""
+stop() {
+    for pid in "$@"; do
+        if [ -n "$pid" ]; then
+            kill $pid 2>/dev/null || true
+            wait $pid 2>/dev/null || true
+        fi
+    done
+}
+cleanup() {
+    stop "$SERVER_PID" $UPSTREAM_PIDS
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+started() {
+    if ! kill -0 "$1" 2>/dev/null; then
+        echo "Error: Server failed to start"
+        cat "$2"
+        exit 1
+    fi
+}
+
+for port in "$UPSTREAM_PORT" $((UPSTREAM_PORT + 1)); do
+    "$SHELOB" -p "$port" > "$WORKDIR/upstream-$port.log" 2>&1 &
+    UPSTREAM_PIDS="$UPSTREAM_PIDS $!"
+done
+sleep 1
+for pid in $UPSTREAM_PIDS; do
+    started $pid "$WORKDIR/upstream-$UPSTREAM_PORT.log"
+done
+
+echo "--- direct ---"
+"$LOADGEN" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -l direct \
+    -o "$WORKDIR/direct.json" "http://127.0.0.1:$UPSTREAM_PORT$PATH_TESTED"
+echo
+
+run() {
+    local label=$1
+    shift
+    "$SHELOB" -p "$PORT" --metrics-port "$METRICS_PORT" \
+        --proxy "/=127.0.0.1:$UPSTREAM_PORT,127.0.0.1:$((UPSTREAM_PORT + 1))" \
+        --proxy-balance "$BALANCE" "$@" > "$WORKDIR/$label-server.log" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+    started $SERVER_PID "$WORKDIR/$label-server.log"
+
+    echo "--- $label ---"
+    "$LOADGEN" -c "$CONNECTIONS" -t "$THREADS" -d "$DURATION" -l "$label" \
+        -o "$WORKDIR/$label.json" "http://127.0.0.1:$PORT$PATH_TESTED"
+    curl -s "http://127.0.0.1:$METRICS_PORT/metrics" | grep '^shelob_proxy' || true
+    echo
+
+    stop "$SERVER_PID"
+    SERVER_PID=""
+}
+
+run proxied-keepalive
+run proxied-no-keepalive --proxy-idle 0
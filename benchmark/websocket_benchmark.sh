@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# Messages/sec delivered by the WebSocket pub/sub hub to many subscribers on loopback
+# Requires: a meson build of shelob and the wsfanout client (meson compile -C builddir)
+#           Both ends hold one descriptor per subscriber, so the hard RLIMIT_NOFILE
+#           must allow SUBSCRIBERS plus some headroom (ulimit -Hn)
+
+set -e
+
+echo "=== Fishjelly WebSocket Fan-out Benchmark ==="
+echo "Messages/sec delivered to every subscriber of one topic"
+echo
+
+BUILDDIR=${BUILDDIR:-builddir}
+PORT=${PORT:-8091}
+METRICS_PORT=${METRICS_PORT:-9191}
+SUBSCRIBERS=${SUBSCRIBERS:-10000}
+THREADS=${THREADS:-4}               # Client threads
+PUBSUB_THREADS=${PUBSUB_THREADS:-4} # Server hub shards
+DURATION=${DURATION:-10}
+MESSAGE_SIZE=${MESSAGE_SIZE:-128}
+RATE=${RATE:-0}                     # 0 publishes as fast as the connection allows
+URL="ws://127.0.0.1:$PORT/pubsub/bench"
+
+SHELOB="./$BUILDDIR/src/shelob"
+WSFANOUT="./$BUILDDIR/benchmark/wsfanout"
+for binary in "$SHELOB" "$WSFANOUT"; do
+    if [ ! -x "$binary" ]; then
+        echo "Error: $binary not found. Build with: meson compile -C $BUILDDIR"
+        exit 1
+    fi
+done
+
+if [ "$(ulimit -Hn)" != unlimited ] && [ "$(ulimit -Hn)" -lt $((SUBSCRIBERS + 1024)) ]; then
+    echo "Error: hard descriptor limit $(ulimit -Hn) is too low for $SUBSCRIBERS subscribers"
+    exit 1
+fi
+ulimit -n "$(ulimit -Hn)"
+
+WORKDIR=$(mktemp -d)
+SERVER_PID=""
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill $SERVER_PID 2>/dev/null || true
+        wait $SERVER_PID 2>/dev/null || true
+    fi
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+"$SHELOB" -p "$PORT" --metrics-port "$METRICS_PORT" --pubsub-threads "$PUBSUB_THREADS" \
+    > "$WORKDIR/server.log" 2>&1 &
+SERVER_PID=$!
+sleep 1
+if ! kill -0 $SERVER_PID 2>/dev/null; then
+    echo "Error: Server failed to start"
+    cat "$WORKDIR/server.log"
+    exit 1
+fi
+
+"$WSFANOUT" -s "$SUBSCRIBERS" -t "$THREADS" -d "$DURATION" -m "$MESSAGE_SIZE" -R "$RATE" \
+    -l fanout -o "$WORKDIR/fanout.json" "$URL"
+
+echo -e "\n=== SERVER METRICS ==="
+curl -s "http://127.0.0.1:$METRICS_PORT/metrics" | grep '^shelob_websocket' || true
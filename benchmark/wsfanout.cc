@@ -0,0 +1,428 @@
+/**
+ * WebSocket pub/sub fan-out benchmark
+ *
+ * Subscribes many WebSocket clients to one /pubsub/ topic, spread over
+ * threads (one io_context each), then publishes from one more connection on
+ * the same topic for a fixed time and counts every message the subscribers
+ * receive. Reports messages/sec delivered and the fraction of
+ * published x subscribers that arrived (the rest were dropped by the
+ * server's slow consumer policy or still queued when the run ended).
+ *
+ * Each subscriber holds a file descriptor, so the soft RLIMIT_NOFILE is
+ * raised to the hard limit first; the server needs the same.
+ */
+
+#include <argparse.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef GIT_HASH
+#define GIT_HASH "unknown"
+#endif
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr char WARMUP_MARK = 'W';
+constexpr char MESSAGE_MARK = 'M';
+
+struct Options {
+    std::string url;
+    std::string host;
+    std::string port;
+    std::string path;
+    int subscribers;
+    int threads;
+    double duration; // Seconds of publishing
+    double rate;     // Messages per second, 0 publishes as fast as the socket allows
+    int message_size;
+    std::string label;
+    std::string output;
+};
+
+bool parseUrl(Options& options) {
+    constexpr std::string_view scheme = "ws://";
+    std::string_view url = options.url;
+    if (!url.starts_with(scheme)) {
+        return false;
+    }
+    url.remove_prefix(scheme.size());
+    size_t slash = url.find('/');
+    std::string_view authority = url.substr(0, slash);
+    options.path = slash == std::string_view::npos ? "/" : std::string(url.substr(slash));
+    size_t colon = authority.rfind(':');
+    options.host = std::string(authority.substr(0, colon));
+    options.port =
+        colon == std::string_view::npos ? "80" : std::string(authority.substr(colon + 1));
+    return !options.host.empty();
+}
+
+// Counters for one thread's subscribers, on their own cache line
+struct alignas(64) ThreadStats {
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<int> connected{0};
+    std::atomic<int> warmed{0};  // Subscribers that have seen a warm-up message
+    std::atomic<int> failed{0};
+    std::atomic<int64_t> last_delivery_ns{0}; // Since the measurement start
+};
+
+using WsStream = websocket::stream<tcp::socket>;
+
+asio::awaitable<std::unique_ptr<WsStream>> connect(const Options& options,
+                                                   const tcp::resolver::results_type& endpoints) {
+    auto ws = std::make_unique<WsStream>(co_await asio::this_coro::executor);
+    co_await asio::async_connect(ws->next_layer(), endpoints, asio::use_awaitable);
+    ws->next_layer().set_option(tcp::no_delay(true));
+    co_await ws->async_handshake(options.host, options.path, asio::use_awaitable);
+    co_return ws;
+}
+
+/**
+ * Read messages until the connection closes, counting measured ones
+ */
+asio::awaitable<void> subscribe(const Options& options,
+                                const tcp::resolver::results_type& endpoints, ThreadStats& stats,
+                                const std::atomic<int64_t>& start_ns) {
+    std::unique_ptr<WsStream> ws;
+    try {
+        ws = co_await connect(options, endpoints);
+    } catch (const std::exception&) {
+        stats.failed.fetch_add(1, std::memory_order_relaxed);
+        co_return;
+    }
+    stats.connected.fetch_add(1, std::memory_order_relaxed);
+
+    beast::flat_buffer buffer;
+    bool warmed = false;
+    try {
+        while (true) {
+            co_await ws->async_read(buffer, asio::use_awaitable);
+            auto data = buffer.data();
+            char mark = data.size() > 0 ? *static_cast<const char*>(data.data()) : '\0';
+            buffer.consume(buffer.size());
+            if (mark == MESSAGE_MARK) {
+                stats.delivered.fetch_add(1, std::memory_order_relaxed);
+                auto now = Clock::now().time_since_epoch().count();
+                stats.last_delivery_ns.store(now - start_ns.load(std::memory_order_relaxed),
+                                             std::memory_order_relaxed);
+            } else if (mark == WARMUP_MARK && !warmed) {
+                warmed = true;
+                stats.warmed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    } catch (const std::exception&) {
+        // Closed by the server (slow consumer) or at the end of the run
+    }
+}
+
+/**
+ * Publish from one more client on the topic and return how many measured
+ * messages were sent. Subscriptions register asynchronously, so warm-up
+ * messages go out every 100ms until warmed() reports that every subscriber
+ * has seen one; the publisher's own copies are read and discarded.
+ */
+asio::awaitable<uint64_t> publish(const Options& options,
+                                  const tcp::resolver::results_type& endpoints,
+                                  std::function<bool()> warmed, std::atomic<int64_t>& start_ns) {
+    auto executor = co_await asio::this_coro::executor;
+    std::shared_ptr<WsStream> ws = co_await connect(options, endpoints);
+    ws->text(true);
+    asio::co_spawn(
+        executor,
+        [ws]() -> asio::awaitable<void> {
+            beast::flat_buffer buffer;
+            while (true) {
+                co_await ws->async_read(buffer, asio::use_awaitable);
+                buffer.consume(buffer.size());
+            }
+        },
+        asio::detached);
+
+    asio::steady_timer timer(executor);
+    std::string warmup(1, WARMUP_MARK);
+    for (auto deadline = Clock::now() + std::chrono::seconds(30);
+         !warmed() && Clock::now() < deadline;) {
+        co_await ws->async_write(asio::buffer(warmup), asio::use_awaitable);
+        timer.expires_after(std::chrono::milliseconds(100));
+        co_await timer.async_wait(asio::use_awaitable);
+    }
+
+    std::string message(static_cast<size_t>(options.message_size), 'x');
+    message[0] = MESSAGE_MARK;
+    auto start = Clock::now();
+    start_ns = start.time_since_epoch().count();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.duration));
+    uint64_t published = 0;
+    while (Clock::now() < end) {
+        if (options.rate > 0) {
+            timer.expires_at(start + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double>(published / options.rate)));
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        co_await ws->async_write(asio::buffer(message), asio::use_awaitable);
+        ++published;
+    }
+
+    beast::error_code ignored;
+    ws->next_layer().close(ignored);
+    co_return published;
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    argparse::ArgumentParser program("wsfanout", GIT_HASH);
+
+    program.add_description("WebSocket pub/sub fan-out benchmark");
+    program.add_epilog("Example: wsfanout -s 10000 -t 4 -d 10 ws://127.0.0.1:8080/pubsub/bench");
+
+    program.add_argument("url").help("topic URL (ws://host:port/pubsub/<topic>)");
+
+    program.add_argument("-s", "--subscribers")
+        .help("subscriber connections across all threads")
+        .default_value(10000)
+        .scan<'i', int>();
+
+    program.add_argument("-t", "--threads")
+        .help("subscriber threads")
+        .default_value(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+        .scan<'i', int>();
+
+    program.add_argument("-d", "--duration")
+        .help("seconds to publish for")
+        .default_value(10.0)
+        .scan<'g', double>();
+
+    program.add_argument("-R", "--rate")
+        .help("messages published per second (0 publishes as fast as possible)")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("-m", "--message-size")
+        .help("payload bytes per message")
+        .default_value(128)
+        .scan<'i', int>();
+
+    program.add_argument("-l", "--label")
+        .help("result key in the JSON output")
+        .default_value(std::string("wsfanout"));
+
+    program.add_argument("-o", "--output").help("write JSON results to FILE").metavar("FILE");
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        std::exit(1);
+    }
+
+    Options options{.url = program.get<std::string>("url"),
+                    .host = {},
+                    .port = {},
+                    .path = {},
+                    .subscribers = std::max(1, program.get<int>("--subscribers")),
+                    .threads = std::max(1, program.get<int>("--threads")),
+                    .duration = program.get<double>("--duration"),
+                    .rate = program.get<double>("--rate"),
+                    .message_size = std::max(1, program.get<int>("--message-size")),
+                    .label = program.get<std::string>("--label"),
+                    .output = program.present("--output").value_or("")};
+    if (!parseUrl(options)) {
+        std::cerr << "Invalid URL: " << options.url << std::endl;
+        std::exit(1);
+    }
+    return options;
+}
+
+void raiseFileLimit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+template <typename Predicate> bool waitFor(Predicate done, std::chrono::seconds timeout) {
+    for (auto end = Clock::now() + timeout; Clock::now() < end;) {
+        if (done()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return done();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options = parseOptions(argc, argv);
+    raiseFileLimit();
+
+    tcp::resolver::results_type endpoints;
+    try {
+        asio::io_context resolver_context;
+        tcp::resolver resolver(resolver_context);
+        endpoints = resolver.resolve(options.host, options.port);
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot resolve " << options.host << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Subscribers: each thread connects its share one at a time, so the
+    // server's accept backlog never overflows
+    std::atomic<int64_t> start_ns{0};
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    std::vector<std::unique_ptr<ThreadStats>> stats;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; ++t) {
+        contexts.push_back(std::make_unique<asio::io_context>(1));
+        stats.push_back(std::make_unique<ThreadStats>());
+        int share = options.subscribers / options.threads +
+                    (t < options.subscribers % options.threads ? 1 : 0);
+        asio::co_spawn(
+            *contexts.back(),
+            [&, share, &thread_stats = *stats.back()]() -> asio::awaitable<void> {
+                auto executor = co_await asio::this_coro::executor;
+                for (int i = 0; i < share; ++i) {
+                    int before = thread_stats.connected + thread_stats.failed;
+                    asio::co_spawn(executor, subscribe(options, endpoints, thread_stats, start_ns),
+                                   asio::detached);
+                    while (thread_stats.connected + thread_stats.failed == before) {
+                        asio::steady_timer timer(executor, std::chrono::microseconds(50));
+                        co_await timer.async_wait(asio::use_awaitable);
+                    }
+                }
+            },
+            asio::detached);
+    }
+    std::vector<asio::executor_work_guard<asio::io_context::executor_type>> work;
+    for (auto& context : contexts) {
+        work.push_back(asio::make_work_guard(*context));
+        threads.emplace_back([&context] { context->run(); });
+    }
+
+    auto sum = [&stats](auto member) {
+        int64_t total = 0;
+        for (const auto& s : stats) {
+            total += ((*s).*member).load(std::memory_order_relaxed);
+        }
+        return total;
+    };
+
+    std::cout << std::format("Connecting {} subscribers to {} on {} threads\n",
+                             options.subscribers, options.url, options.threads);
+    auto connect_start = Clock::now();
+    waitFor([&] {
+        return sum(&ThreadStats::connected) + sum(&ThreadStats::failed) >= options.subscribers;
+    }, std::chrono::seconds(120));
+    int64_t connected = sum(&ThreadStats::connected);
+    std::cout << std::format("  {} connected, {} failed in {:.2f}s\n", connected,
+                             sum(&ThreadStats::failed),
+                             std::chrono::duration<double>(Clock::now() - connect_start).count());
+    if (connected == 0) {
+        std::cerr << "Error: no subscriber could connect" << std::endl;
+        return 1;
+    }
+
+    asio::io_context publisher_context(1);
+    uint64_t published = 0;
+    bool publisher_ok = false;
+    asio::co_spawn(
+        publisher_context,
+        publish(options, endpoints, [&] { return sum(&ThreadStats::warmed) >= connected; },
+                start_ns),
+        [&](std::exception_ptr error, uint64_t count) {
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: publisher failed: " << e.what() << std::endl;
+                }
+                return;
+            }
+            published = count;
+            publisher_ok = true;
+        });
+    publisher_context.run();
+    if (!publisher_ok) {
+        return 1;
+    }
+    int64_t warmed = sum(&ThreadStats::warmed);
+    if (warmed < connected) {
+        std::cerr << std::format("Warning: only {} of {} subscribers received the warm-up\n",
+                                 warmed, connected);
+    }
+
+    // Let queued frames drain: stop once deliveries stall for a second
+    int64_t delivered = sum(&ThreadStats::delivered);
+    for (int64_t previous = -1; delivered != previous;) {
+        previous = delivered;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        delivered = sum(&ThreadStats::delivered);
+    }
+    int64_t last_ns = 0;
+    for (const auto& s : stats) {
+        last_ns = std::max<int64_t>(last_ns, s->last_delivery_ns.load());
+    }
+    double elapsed = std::max(static_cast<double>(last_ns) / 1e9, options.duration);
+
+    for (auto& context : contexts) {
+        context->stop();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    double expected = static_cast<double>(published) * static_cast<double>(warmed);
+    double rate = static_cast<double>(delivered) / elapsed;
+    double ratio = expected > 0 ? static_cast<double>(delivered) / expected : 0.0;
+    std::cout << std::format("  {} messages published to {} subscribers in {:.2f}s\n", published,
+                             warmed, options.duration);
+    std::cout << std::format("  {} delivered ({:.1f}% of published x subscribers)\n", delivered,
+                             100.0 * ratio);
+    std::cout << std::format("Messages/sec delivered: {:.0f}\n", rate);
+
+    if (!options.output.empty()) {
+        std::ofstream out(options.output);
+        if (!out) {
+            std::cerr << "Error: Unable to write " << options.output << std::endl;
+            return 1;
+        }
+        out << "{\n";
+        out << std::format("  \"{}\": {{\n", options.label);
+        out << std::format("    \"subscribers\": {},\n", warmed);
+        out << std::format("    \"published\": {},\n", published);
+        out << std::format("    \"delivered\": {},\n", delivered);
+        out << std::format("    \"delivery_ratio\": {},\n", ratio);
+        out << std::format("    \"messages_per_second\": {},\n", rate);
+        out << std::format("    \"message_size\": {},\n", options.message_size);
+        out << std::format("    \"duration\": {}\n", elapsed);
+        out << "  }\n";
+        out << "}\n";
+    }
+    return delivered > 0 ? 0 : 1;
+}
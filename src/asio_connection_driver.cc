@@ -0,0 +1,1814 @@
+#include "asio_connection_driver.h"
+#include "blocking_pool.h"
+#include "body_framing.h"
+#include "conditional_request.h"
+#include "connection_timeouts.h"
+#include "fastcgi_pool.h"
+#include "metrics.h"
+#include "negative_cache.h"
+#include "proxy_pool.h"
+#include "request_limits.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <type_traits>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+#include "buffer_pool.h"
+#include "registered_buffers.h"
+#include <boost/asio/random_access_file.hpp>
+#include <tuple>
+#include <unistd.h>
+#endif
+
+namespace {
+
+template <typename Stream> constexpr bool is_plain_socket = std::is_same_v<Stream, tcp::socket>;
+template <typename Stream> constexpr bool is_ktls_stream = std::is_same_v<Stream, KtlsStream>;
+
+// Largest piece of a file handed to the kernel in one call, so other
+// connections on this thread get a turn during large transfers
+constexpr size_t SEND_FILE_CHUNK = 512 * 1024;
+
+// Request body bytes read (and parsed, or passed on) at a time
+constexpr size_t BODY_READ_CHUNK = 64 * 1024;
+
+// Upstream response bytes read at a time, and the largest response head accepted
+constexpr size_t PROXY_READ_CHUNK = 64 * 1024;
+constexpr size_t PROXY_MAX_RESPONSE_HEAD = 64 * 1024;
+
+// Bytes of the size line and CRLF around a chunk of data
+size_t chunk_framing_size(size_t size) {
+    size_t digits = 1;
+    while (size >>= 4) {
+        ++digits;
+    }
+    return digits + 4;
+}
+
+// Count a finished request once its response has been written
+void record_request(std::string_view version, std::string_view method, int status,
+                    std::chrono::steady_clock::time_point start, size_t bytes_in,
+                    size_t bytes_out) {
+    Metrics::increment(Metrics::Counter::BytesReceived, bytes_in);
+    Metrics::increment(Metrics::Counter::BytesSent, bytes_out);
+    Metrics::record_request(Metrics::protocol_from_version(version), method, status,
+                            std::chrono::steady_clock::now() - start);
+}
+
+// Counts a request in flight on an upstream server for least-connections
+class ActiveRequest {
+  public:
+    explicit ActiveRequest(Proxy::Server& server) : server_(server) { Proxy::begin(server_); }
+    ~ActiveRequest() { Proxy::end(server_); }
+    ActiveRequest(const ActiveRequest&) = delete;
+    ActiveRequest& operator=(const ActiveRequest&) = delete;
+
+  private:
+    Proxy::Server& server_;
+};
+
+std::vector<ResponseCache::Field> owned_fields(const std::vector<Proxy::Header>& headers) {
+    std::vector<ResponseCache::Field> fields;
+    fields.reserve(headers.size());
+    for (const auto& [name, value] : headers) {
+        fields.emplace_back(name, value);
+    }
+    return fields;
+}
+
+// An entry with its body, read back from the disk tier if it was moved there
+asio::awaitable<std::shared_ptr<const ResponseCache::Entry>>
+with_body(const ResponseCache::Request& request,
+          std::shared_ptr<const ResponseCache::Entry> entry) {
+    if (!entry || !entry->on_disk()) {
+        co_return entry;
+    }
+    co_return co_await BlockingPool::getInstance().run(
+        [&] { return ResponseCache::getInstance().load(request, *entry); });
+}
+
+// Store a fetched response, on the blocking pool when that may write to the disk tier
+asio::awaitable<void> store_response(const ResponseCache::Request& request, int status,
+                                     std::string_view reason,
+                                     const std::vector<ResponseCache::Field>& fields,
+                                     std::string body) {
+    auto store = [&] {
+        return ResponseCache::getInstance().store(request, status, reason, fields, std::move(body));
+    };
+    if (ResponseCache::options().disk_path.empty()) {
+        store();
+    } else {
+        co_await BlockingPool::getInstance().run(store);
+    }
+}
+
+/**
+ * Fetch a proxied GET response again for the cache with no client waiting
+ * for it (stale-while-revalidate). It may outlive the connection that
+ * started it, so it owns everything it uses and has its own timer.
+ * @param lock Held until the response is stored, so misses wait for it
+ */
+asio::awaitable<void> refresh_proxied(Proxy::Group& group, std::string head,
+                                      std::string client_address, bool tls,
+                                      ResponseCache::Request cache_request,
+                                      [[maybe_unused]] ResponseCache::FetchLock lock) {
+    auto request = Proxy::parse_request(head);
+    std::vector<bool> tried(group.size());
+    auto index = request ? group.pick(request->target, tried) : std::nullopt;
+    if (!index) {
+        co_return;
+    }
+    Proxy::Server& server = group.server(*index);
+    bool alone = group.size() == 1;
+    ActiveRequest active(server);
+    auto executor = co_await asio::this_coro::executor;
+    auto& pool = asio::use_service<ProxyPool>(asio::query(executor, asio::execution::context));
+
+    // One deadline for the whole exchange; the socket is shared with the
+    // timer's handler, which can run after this coroutine is gone
+    auto upstream = std::make_shared<tcp::socket>(executor);
+    asio::steady_timer timer(executor, std::chrono::seconds(Proxy::options().timeout));
+    timer.async_wait([upstream](boost::system::error_code ec) {
+        if (!ec) {
+            upstream->cancel(ec);
+        }
+    });
+
+    // A reused connection that closed before answering is retried once on a new one
+    std::string out = Proxy::upstream_head(*request, client_address, tls, server);
+    std::optional<Proxy::Response> response;
+    size_t response_head = 0;
+    std::string buffer;
+    for (int attempt = 0; attempt < 2 && !response; ++attempt) {
+        buffer.clear();
+        auto idle = attempt == 0 ? pool.take(server) : std::nullopt;
+        bool reused = idle.has_value();
+        if (reused) {
+            *upstream = std::move(*idle);
+            Metrics::increment(Metrics::Counter::ProxyConnectionsReused);
+        } else {
+            *upstream = tcp::socket(executor);
+            auto [connect_ec, endpoint] = co_await asio::async_connect(
+                *upstream, server.endpoints(), asio::as_tuple(asio::use_awaitable));
+            if (connect_ec) {
+                break;
+            }
+            Metrics::increment(Metrics::Counter::ProxyConnectionsOpened);
+        }
+        auto [write_ec, written] = co_await asio::async_write(
+            *upstream, asio::buffer(out), asio::as_tuple(asio::use_awaitable));
+        while (!write_ec) {
+            auto [read_ec, size] = co_await asio::async_read_until(
+                *upstream, asio::dynamic_buffer(buffer, PROXY_MAX_RESPONSE_HEAD), "\r\n\r\n",
+                asio::as_tuple(asio::use_awaitable));
+            if (read_ec) {
+                break;
+            }
+            response = Proxy::parse_response(std::string_view(buffer).substr(0, size));
+            if (!response || response->status >= 200) {
+                response_head = size;
+                break;
+            }
+            buffer.erase(0, size);
+            response.reset();
+        }
+        if (!reused || !buffer.empty() || timer.expiry() <= std::chrono::steady_clock::now()) {
+            break;
+        }
+    }
+    if (!response || response->status == 101) {
+        Proxy::report_failure(server, alone);
+        co_return;
+    }
+
+    int status = response->status;
+    std::string reason(response->reason);
+    std::vector<ResponseCache::Field> fields = owned_fields(response->headers);
+    bool bodiless = status == 204 || status == 304;
+    bool until_close = !bodiless && !response->chunked && !response->content_length;
+    size_t limit = ResponseCache::options().max_object_size;
+    if (!ResponseCache::cacheable(status, fields) || response->content_length > limit) {
+        Proxy::report_success(server);
+        co_return; // Not worth reading; the connection is closed instead
+    }
+    buffer.erase(0, response_head);
+
+    std::string body;
+    ChunkedDecoder decoder;
+    bool complete = bodiless;
+    bool extra = false; // The upstream sent more than the response
+    while (!complete && body.size() <= limit) {
+        if (response->content_length) {
+            size_t take = std::min(buffer.size(), *response->content_length - body.size());
+            body.append(buffer, 0, take);
+            extra = take < buffer.size();
+            complete = body.size() == *response->content_length;
+        } else if (response->chunked) {
+            size_t offset = 0;
+            std::string_view piece;
+            while (offset < buffer.size() && !decoder.done()) {
+                auto used = decoder.consume(std::string_view(buffer).substr(offset), piece);
+                if (!used) {
+                    Proxy::report_failure(server, alone);
+                    co_return;
+                }
+                body += piece;
+                offset += *used;
+            }
+            extra = offset < buffer.size();
+            complete = decoder.done();
+        } else {
+            body += buffer;
+        }
+        if (complete) {
+            break;
+        }
+
+        buffer.resize(PROXY_READ_CHUNK);
+        auto [read_ec, size] = co_await upstream->async_read_some(
+            asio::buffer(buffer), asio::as_tuple(asio::use_awaitable));
+        buffer.resize(size);
+        if (read_ec) {
+            complete = until_close && read_ec == asio::error::eof;
+            if (!complete) {
+                Proxy::report_failure(server, alone);
+                co_return;
+            }
+        }
+    }
+    timer.cancel();
+    if (!complete) {
+        co_return; // Too large to store
+    }
+    Proxy::report_success(server);
+    if (response->keep_alive && !until_close && !extra) {
+        pool.put(server, std::move(*upstream));
+    }
+    co_await store_response(cache_request, status, reason, fields, std::move(body));
+}
+
+// The cache's view of a request Http forwarded to the FastCGI application
+std::optional<ResponseCache::Request> fastcgi_cache_request(const FastCgi::Params& params) {
+    std::string_view method;
+    std::string_view target;
+    std::vector<ResponseCache::Field> fields;
+    for (const auto& [name, value] : params) {
+        if (name == "REQUEST_METHOD") {
+            method = value;
+        } else if (name == "REQUEST_URI") {
+            target = value;
+        } else if (name.starts_with("HTTP_")) {
+            fields.emplace_back(name.substr(5), value); // ResponseCache matches '_' to '-'
+        }
+    }
+    return ResponseCache::request(method, target, std::move(fields));
+}
+
+// An application's response fields as the client gets them (see FastCgi::http_head)
+std::vector<ResponseCache::Field> fastcgi_fields(const FastCgi::ResponseHead& head) {
+    std::vector<ResponseCache::Field> fields = {
+        {"Date", ConditionalRequest::formatHttpDate(time(nullptr))},
+        {"Server", "SHELOB/0.5 (Unix)"}};
+    fields.insert(fields.end(), head.headers.begin(), head.headers.end());
+    return fields;
+}
+
+// Run a FastCGI GET request again for the cache with no client waiting for it
+asio::awaitable<void> refresh_fastcgi(FastCgi::Params params,
+                                      ResponseCache::Request cache_request,
+                                      [[maybe_unused]] ResponseCache::FetchLock lock) {
+    const FastCgi::Options& options = FastCgi::options();
+    auto executor = co_await asio::this_coro::executor;
+    auto& pool = asio::use_service<FastCgiPool>(asio::query(executor, asio::execution::context));
+    auto timeout = std::chrono::seconds(options.timeout);
+    size_t limit = ResponseCache::options().max_object_size + RequestLimits::MAX_HEADER_SIZE;
+    Metrics::increment(Metrics::Counter::FastCgiRequests);
+
+    auto exchange = co_await pool.start(options, std::move(params), "");
+    if (!exchange) {
+        Metrics::increment(Metrics::Counter::FastCgiFailures);
+        co_return;
+    }
+    std::string output;
+    std::string chunk;
+    while (output.size() <= limit) {
+        if (!co_await exchange->read(chunk, timeout)) {
+            break;
+        }
+        output += chunk;
+    }
+    FastCgi::ResponseHead head;
+    std::optional<size_t> head_size;
+    if (!exchange->failed() && !exchange->timed_out() && output.size() <= limit) {
+        head_size = FastCgi::parse_response_head(output, head);
+    }
+    if (!head_size || *head_size == 0) {
+        Metrics::increment(Metrics::Counter::FastCgiFailures);
+        exchange->abandon();
+        co_return;
+    }
+    std::string body = output.substr(*head_size, head.content_length.value_or(output.size()));
+    if (head.content_length && body.size() < *head.content_length) {
+        co_return;
+    }
+    co_await store_response(cache_request, head.status, head.reason, fastcgi_fields(head),
+                            std::move(body));
+}
+
+} // namespace
+
+template <typename Stream>
+AsioConnectionDriver<Stream>::AsioConnectionDriver(Stream& stream, AsioHttpConnection& connection,
+                                                   TimerWheel& timers)
+    : stream_(stream), connection_(connection), timers_(timers), deadline_(timers, [this] {
+          if (deadline_.too_slow()) {
+              Metrics::increment(Metrics::Counter::SlowConnectionsClosed);
+          }
+          boost::system::error_code ignored;
+          tcp_layer(stream_).cancel(ignored);
+      }) {
+    // Large files skip the response buffer when the kernel can send them:
+    // always for plain TCP, and for TLS only once kTLS is active
+    if constexpr (is_plain_socket<Stream>) {
+#ifdef __linux__
+        connection_.setFileSendEnabled(true);
+#endif
+    } else if constexpr (is_ktls_stream<Stream>) {
+        connection_.setFileSendEnabled(stream_.ktls_send());
+    }
+#ifdef BOOST_ASIO_HAS_IO_URING
+    // Other streams read the file asynchronously instead (read_file_chunks)
+    connection_.setFileSendEnabled(true);
+#endif
+    connection_.setFastCgiEnabled(FastCgi::options().enabled);
+    connection_.setStreamingEnabled(true);
+}
+
+template <typename Stream> tcp::socket& AsioConnectionDriver<Stream>::tcp_layer(Stream& stream) {
+    if constexpr (is_plain_socket<Stream>) {
+        return stream;
+    } else {
+        return stream.next_layer();
+    }
+}
+
+template <typename Stream>
+asio::awaitable<int> AsioConnectionDriver<Stream>::serve(size_t head_size, const bool& stopping) {
+    int requests = 0;
+    while (true) {
+        std::string_view head(connection_.input().data(), head_size);
+        bool keep_alive = false;
+        auto route_key = Request::route_key(head);
+        auto route = route_key ? Http::router().match(route_key->first, route_key->second)
+                               : std::nullopt;
+        // A GET or HEAD for a path Http found missing gets the same 404 without it,
+        // unless Http would have looked at its query, body or credentials first, or
+        // could turn the request away with a 503 or 429 instead
+        HandlerTransport transport(*this);
+        std::optional<Request> missing;
+        if (route_key && !route && !connection_.http().screensRequests() &&
+            (route_key->first == Method::Get || route_key->first == Method::Head) &&
+            NegativeCache::getInstance().contains(route_key->second)) {
+            missing.emplace(head, connection_.input(), head_size, transport);
+            if (!missing->valid() || missing->target() != missing->path() ||
+                missing->header("Content-Length") || missing->header("Transfer-Encoding") ||
+                connection_.protects(*missing)) {
+                missing.reset();
+            }
+        }
+        if (Proxy::Group* group = Proxy::match_request(head)) {
+            // Forwarded without Http, the body streamed instead of read up front
+            if (!co_await proxy_request(*group, head_size, keep_alive)) {
+                break;
+            }
+            if (requests++ > 0) {
+                Metrics::increment(Metrics::Counter::KeepAliveReuse);
+            }
+        } else if (route && route->async_handler) {
+            // The handler reads the body itself, as it needs it
+            if (!co_await run_handler(*route->async_handler, head_size, keep_alive)) {
+                break;
+            }
+            if (requests++ > 0) {
+                Metrics::increment(Metrics::Counter::KeepAliveReuse);
+            }
+        } else if (missing) {
+            if (!co_await send_missing(*missing, head_size, keep_alive)) {
+                break;
+            }
+            if (requests++ > 0) {
+                Metrics::increment(Metrics::Counter::KeepAliveReuse);
+            }
+        } else {
+            // Read a Content-Length or chunked body up front so Http can consume it
+            // from the buffer, parse it as it arrives if it's a form Http answers
+            // itself, or leave it to stream to the FastCGI application if it's for
+            // a script. Bodies over the upload limit, and ones whose framing is
+            // ambiguous, are left for Http to reject, then the connection is closed
+            // since the rest of the body is never read.
+            auto framing = BodyFraming::parse(head);
+            auto content_length = framing ? framing->content_length() : std::nullopt;
+            size_t body_size = 0;
+            size_t parsed_size = 0; // Of a form body parsed, or a body streamed, as it arrived
+            // Set when the body isn't read to its end (too large, or badly framed)
+            bool incomplete = !framing || (content_length &&
+                                           *content_length > RequestLimits::MAX_UPLOAD_SIZE);
+            bool has_body = framing && (framing->chunked() || content_length.value_or(0) > 0);
+            // A script's body is read by forward_fastcgi(), once Http has forwarded it
+            bool streamed =
+                has_body && !incomplete && connection_.streamBodyToApplication(head, *framing);
+            if (!streamed && framing && framing->chunked()) {
+                auto form = connection_.formParser(head);
+                size_t read = 0;
+                if (!co_await read_chunked_body(head_size, form.get(), read, incomplete)) {
+                    break;
+                }
+                if (form) {
+                    connection_.setParsedForm(std::move(form));
+                    parsed_size = read;
+                } else {
+                    body_size = read;
+                }
+            } else if (!streamed && content_length && !incomplete) {
+                auto form = connection_.formParser(head);
+                if (form) {
+                    if (!co_await read_form_body(head_size, *content_length, *form)) {
+                        break;
+                    }
+                    connection_.setParsedForm(std::move(form));
+                    parsed_size = *content_length;
+                } else {
+                    if (!co_await read_request_body(head_size + *content_length)) {
+                        break; // Body read timed out or the client went away
+                    }
+                    body_size = *content_length;
+                }
+            }
+
+            auto request_start = std::chrono::steady_clock::now();
+            // Http opens files, verifies passwords and runs route handlers
+            // synchronously, so it runs on the blocking pool while this thread serves
+            // other connections. A file the open file cache holds (or its 304) is
+            // served right here, as the hop to the pool would cost more than that.
+            bool processed = false;
+            if (!route && !has_body && connection_.servesFromCache(head)) {
+                processed = connection_.process(head_size, body_size);
+            } else {
+                processed = co_await BlockingPool::getInstance().run([&] {
+                    return connection_.process(head_size, body_size);
+                });
+            }
+            keep_alive = processed && !incomplete;
+            if (requests++ > 0) {
+                Metrics::increment(Metrics::Counter::KeepAliveReuse);
+            }
+
+            int status = connection_.http().lastStatus();
+            size_t bytes_out = 0;
+            auto forwarded = connection_.takeForwardedRequest();
+            if (!forwarded && streamed) {
+                keep_alive = false; // Http answered itself, so the body was never read
+            }
+            if (forwarded) {
+                // Http left the response to the FastCGI application
+                auto sent = co_await forward_fastcgi(std::move(*forwarded), keep_alive, status,
+                                                     parsed_size);
+                if (!sent) {
+                    break;
+                }
+                bytes_out = *sent;
+            } else {
+                // Send the response with timeout protection (against Slow Read attacks)
+                const OutputChain& output = connection_.output();
+                if (auto producer = connection_.takeBodyProducer()) {
+                    // Only the head was queued; it goes out with the first chunk
+                    auto sent = co_await write_produced_body(output.str(), *producer);
+                    if (!sent) {
+                        break;
+                    }
+                    bytes_out = *sent;
+                } else {
+                    if (!co_await write_output(output)) {
+                        break; // Write timeout or error - terminate connection
+                    }
+                    bytes_out = output.memory_size() + output.file_size();
+                }
+            }
+            const Http& http = connection_.http();
+            record_request(http.lastVersion(), http.lastMethod(), status, request_start,
+                           connection_.consumed() + parsed_size, bytes_out);
+        }
+        connection_.finishRequest();
+
+        if (!keep_alive || stopping) {
+            break;
+        }
+
+        auto timeout = std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC);
+        if constexpr (is_plain_socket<Stream>) {
+            // Idle keep-alive connections give their buffers back until data arrives
+            if (!connection_.hasPendingInput()) {
+                connection_.releaseBuffers();
+                if (!co_await wait_readable()) {
+                    break; // Keep-alive timeout or connection closed
+                }
+                connection_.acquireBuffers();
+            }
+        } else {
+            // A TLS stream may hold decrypted bytes the TCP socket no longer
+            // reports as readable, so wait by reading with the keep-alive timeout
+            timeout = std::chrono::seconds(ConnectionTimeouts::KEEPALIVE_TIMEOUT_SEC);
+        }
+
+        head_size = co_await read_request_head(timeout);
+        if (head_size == 0) {
+            break;
+        }
+    }
+    co_return requests;
+}
+
+template <typename Stream>
+asio::awaitable<size_t>
+AsioConnectionDriver<Stream>::read_request_head(std::chrono::seconds timeout) {
+    // Request line plus header block; anything larger is rejected by closing
+    constexpr size_t max_head =
+        RequestLimits::MAX_REQUEST_LINE + RequestLimits::MAX_HEADER_SIZE + 4;
+
+    // A timeout (likely a Slowloris attack) cancels the read
+    deadline_.arm(timeout);
+    auto [ec, head_size] = co_await asio::async_read_until(
+        stream_, asio::dynamic_buffer(connection_.input(), max_head), "\r\n\r\n",
+        asio::as_tuple(asio::use_awaitable));
+    deadline_.cancel();
+
+    co_return ec ? 0 : head_size;
+}
+
+template <typename Stream>
+asio::awaitable<bool>
+AsioConnectionDriver<Stream>::HandlerTransport::read_more(std::string& input) {
+    // Protects against Slow POST attacks, as for bodies read up front
+    driver_.deadline_.arm_transfer(
+        std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+    auto [ec, bytes] = co_await asio::async_read(
+        driver_.stream_, asio::dynamic_buffer(input),
+        driver_.deadline_.reporting(asio::transfer_at_least(1)),
+        asio::as_tuple(asio::use_awaitable));
+    driver_.deadline_.cancel();
+
+    co_return !ec;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::HandlerTransport::write(
+    std::string_view prefix, std::string_view data, bool chunked) {
+    co_return co_await driver_.write_chunk(prefix, data, chunked);
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::run_handler(
+    const Router::AsyncHandler& handler, size_t head_size, bool& keep_alive) {
+    auto start = std::chrono::steady_clock::now();
+    std::string& input = connection_.input();
+    HandlerTransport transport(*this);
+    Request request(std::string_view(input).substr(0, head_size), input, head_size, transport);
+    ResponseWriter response(transport, request);
+    keep_alive = false;
+
+    if (!request.valid()) {
+        // Where the body ends is unknown, so the connection can't go on
+        response.close();
+        bool sent = co_await response.send(400, "text/plain", "Bad Request\n");
+        if (sent) {
+            record_request(request.version(), request.method_name(), 400, start, head_size,
+                           response.bytes_sent());
+        }
+        co_return false;
+    }
+
+    if (connection_.protects(request)) {
+        // Credentials are checked by Http, whose password hashing blocks
+        bool authorized = co_await BlockingPool::getInstance().run(
+            [&] { return connection_.authorize(request); });
+        if (!authorized) {
+            // The 401 leaves the body unread, so the connection closes after it
+            const OutputChain& challenge = connection_.output();
+            bool sent = co_await write_output(challenge);
+            if (sent) {
+                record_request(request.version(), request.method_name(), 401, start, head_size,
+                               challenge.memory_size());
+            }
+            co_return false;
+        }
+        connection_.finishRequest(); // Only clears the 401 Http didn't write
+    }
+
+    // Parameters view the request's own copy of the path, which outlives the input buffer
+    if (auto route = Http::router().match(request.method(), request.path())) {
+        request.set_params(std::move(route->params));
+    }
+
+    bool failed = false;
+    try {
+        co_await Http::router().run(handler, request, response);
+    } catch (const std::exception& e) {
+        std::cerr << "Handler for " << request.path() << " failed: " << e.what() << std::endl;
+        failed = true;
+    }
+    if (!response.head_sent()) {
+        if (failed) {
+            response.close();
+        }
+        co_await response.send(failed ? 500 : response.status(), "", "");
+    } else if (!response.finished()) {
+        if (failed) {
+            // Part of the response is out, so only closing can tell the client
+            response.close();
+        } else {
+            co_await response.end();
+        }
+    }
+
+    keep_alive = response.keep_alive() && request.keep_alive() && request.body_read() &&
+                 response.finished();
+    connection_.setConsumed(std::min(request.consumed(), input.size()));
+    record_request(request.version(), request.method_name(), response.status(), start,
+                   head_size + request.bytes_read(), response.bytes_sent());
+    co_return response.finished();
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::send_missing(const Request& request,
+                                                                 size_t head_size,
+                                                                 bool& keep_alive) {
+    auto start = std::chrono::steady_clock::now();
+    keep_alive = request.keep_alive();
+    // Held, as the thread builds a new one when the second changes
+    auto response = NegativeCache::response(keep_alive, request.method() == Method::Head);
+    if (!co_await write_response(*response)) {
+        co_return false;
+    }
+    Metrics::increment(Metrics::Counter::NegativeCacheHits);
+    connection_.setConsumed(head_size);
+    record_request(request.version(), request.method_name(), 404, start, head_size,
+                   response->size());
+    co_return true;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::read_request_body(size_t size) {
+    std::string& input = connection_.input();
+    if (input.size() >= size) {
+        co_return true; // Arrived together with the head
+    }
+
+    // Protects against Slow POST attacks
+    deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+    auto [ec, bytes] = co_await asio::async_read(
+        stream_, asio::dynamic_buffer(input),
+        deadline_.reporting(asio::transfer_exactly(size - input.size())),
+        asio::as_tuple(asio::use_awaitable));
+    deadline_.cancel();
+
+    co_return !ec;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::read_form_body(size_t head_size, size_t size,
+                                                                   FormParser& form) {
+    std::string& input = connection_.input();
+    bool parsing = true; // Once the form is unusable the rest of the body is only drained
+    bool armed = false;
+    while (size > 0) {
+        if (input.size() == head_size) {
+            if (!armed) {
+                // Protects against Slow POST attacks
+                deadline_.arm_transfer(
+                    std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+                armed = true;
+            }
+            auto [ec, bytes] = co_await asio::async_read(
+                stream_, asio::dynamic_buffer(input),
+                deadline_.reporting(asio::transfer_exactly(std::min(size, BODY_READ_CHUNK))),
+                asio::as_tuple(asio::use_awaitable));
+            if (ec) {
+                deadline_.cancel();
+                co_return false;
+            }
+        }
+
+        size_t take = std::min(size, input.size() - head_size);
+        if (parsing) {
+            std::string_view piece(input.data() + head_size, take);
+            parsing = co_await BlockingPool::getInstance().run(
+                [&form, piece] { return form.consume(piece); });
+        }
+        input.erase(head_size, take);
+        size -= take;
+    }
+    if (armed) {
+        deadline_.cancel();
+    }
+    co_return true;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::read_chunked_body(size_t head_size,
+                                                                      FormParser* form,
+                                                                      size_t& body_size,
+                                                                      bool& incomplete) {
+    std::string& input = connection_.input();
+    size_t limit = form ? RequestLimits::MAX_UPLOAD_SIZE : RequestLimits::MAX_BODY_SIZE;
+    ChunkedDecoder decoder;
+    size_t pos = head_size; // Decoded up to here
+    size_t out = head_size; // End of a form's data decoded in place, not yet parsed
+    size_t decoded = 0;
+    bool parsing = form != nullptr; // Once the form is unusable its data is only drained
+    bool armed = false;
+    body_size = 0;
+    incomplete = false;
+    while (true) {
+        while (pos < input.size() && !decoder.done()) {
+            std::string_view data;
+            auto used = decoder.consume(std::string_view(input).substr(pos), data);
+            if (!used) {
+                incomplete = true;
+                if (form) {
+                    form->reject(FormParser::Error::Malformed);
+                }
+                break;
+            }
+            pos += *used;
+            decoded += data.size();
+            bool chunk_too_large = !form && decoder.chunk_size() > RequestLimits::MAX_CHUNK_SIZE;
+            if (decoded > limit || chunk_too_large) {
+                incomplete = true;
+                if (form) {
+                    form->reject(FormParser::Error::TooLarge);
+                }
+                break;
+            }
+            if (form && !data.empty()) {
+                // The data moves back over the framing before it
+                std::memmove(input.data() + out, data.data(), data.size());
+                out += data.size();
+            }
+        }
+        if (form) {
+            if (parsing && out > head_size) {
+                std::string_view piece(input.data() + head_size, out - head_size);
+                parsing = co_await BlockingPool::getInstance().run(
+                    [form, piece] { return form->consume(piece); });
+            }
+            input.erase(head_size, pos - head_size);
+            body_size += pos - head_size;
+            pos = out = head_size;
+        }
+        if (decoder.done() || incomplete) {
+            break;
+        }
+
+        if (!armed) {
+            // Protects against Slow POST attacks
+            deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+            armed = true;
+        }
+        auto [ec, bytes] = co_await asio::async_read(
+            stream_, asio::dynamic_buffer(input), deadline_.reporting(asio::transfer_at_least(1)),
+            asio::as_tuple(asio::use_awaitable));
+        if (ec) {
+            deadline_.cancel();
+            co_return false;
+        }
+    }
+    if (armed) {
+        deadline_.cancel();
+    }
+    if (!form) {
+        body_size = pos - head_size;
+    }
+    co_return true;
+}
+
+template <typename Stream> asio::awaitable<bool> AsioConnectionDriver<Stream>::wait_readable() {
+    // Use keep-alive timeout between requests
+    deadline_.arm(std::chrono::seconds(ConnectionTimeouts::KEEPALIVE_TIMEOUT_SEC));
+    auto [ec] = co_await tcp_layer(stream_).async_wait(tcp::socket::wait_read,
+                                                       asio::as_tuple(asio::use_awaitable));
+    deadline_.cancel();
+
+    co_return !ec;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::write_response(const std::string& response) {
+    // Protects against Slow Read attacks; a write error means the client went away
+    deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
+    auto [ec, bytes_written] = co_await asio::async_write(
+        stream_, asio::buffer(response), deadline_.reporting(asio::transfer_all()),
+        asio::as_tuple(asio::use_awaitable));
+    deadline_.cancel();
+
+    co_return !ec;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::write_output(const OutputChain& output) {
+    size_t index = 0;
+    while (index < output.segments()) {
+        // Memory segments up to the next file range go out in one gather write
+        gather_.clear();
+        index = output.gather(index, gather_);
+        if (!gather_.empty()) {
+            deadline_.arm_transfer(
+                std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
+            auto [ec, bytes_written] = co_await asio::async_write(
+                stream_, gather_, deadline_.reporting(asio::transfer_all()),
+                asio::as_tuple(asio::use_awaitable));
+            deadline_.cancel();
+            if (ec) {
+                co_return false;
+            }
+        }
+        if (const OutputChain::FileRange* file = output.file_at(index)) {
+            if (file->count > 0 && !co_await write_file_body(*file)) {
+                co_return false;
+            }
+            ++index;
+        }
+    }
+    co_return true;
+}
+
+template <typename Stream>
+asio::awaitable<std::optional<size_t>>
+AsioConnectionDriver<Stream>::forward_fastcgi(AsioSocketAdapter::ForwardedRequest request,
+                                              bool& keep_alive, int& status, size_t& bytes_in) {
+    const FastCgi::Options& options = FastCgi::options();
+    auto& pool = asio::use_service<FastCgiPool>(
+        asio::query(stream_.get_executor(), asio::execution::context));
+    auto timeout = std::chrono::seconds(options.timeout);
+    const BodyFraming* streamed = connection_.streamedBody();
+
+    std::optional<ResponseCache::Request> cacheable;
+    CacheLookup cached;
+    if (ResponseCache::options().enabled && request.body.empty() && !streamed) {
+        cacheable = fastcgi_cache_request(request.params);
+    }
+    if (cacheable) {
+        auto refresh = [this, &request, &cacheable](ResponseCache::FetchLock lock) {
+            FastCgi::Params params = request.params;
+            for (auto& [name, value] : params) {
+                if (name == "REQUEST_METHOD") {
+                    value = "GET"; // The cache answers HEAD from GET
+                }
+            }
+            asio::co_spawn(stream_.get_executor(),
+                           refresh_fastcgi(std::move(params), *cacheable, std::move(lock)),
+                           asio::detached);
+        };
+        cached = co_await consult_cache(*cacheable, keep_alive, refresh);
+        if (cached.failed) {
+            co_return std::nullopt;
+        }
+        if (cached.sent) {
+            status = cached.status;
+            co_return cached.sent;
+        }
+    }
+    Metrics::increment(Metrics::Counter::FastCgiRequests);
+
+    auto exchange = co_await pool.start(options, std::move(request.params),
+                                        std::move(request.body), streamed != nullptr);
+    if (streamed) {
+        // The body goes out as it arrives. If it can't all be read, or the
+        // application answers without it, the rest is left unread and the
+        // connection closes after the response.
+        int refused = 0;
+        if (exchange) {
+            refused = co_await fastcgi_request_body(*exchange, *streamed, bytes_in);
+        }
+        if (!exchange || refused != 0) {
+            keep_alive = false;
+        }
+        if (refused != 0 && !exchange->failed() && !exchange->ended()) {
+            exchange->abandon();
+            status = refused;
+            std::string response = FastCgi::error_response(status, false);
+            if (!co_await write_response(response)) {
+                co_return std::nullopt;
+            }
+            co_return response.size();
+        }
+    }
+
+    // Collect output until the CGI header block is complete
+    std::string output;
+    std::string chunk;
+    FastCgi::ResponseHead head;
+    std::optional<size_t> head_size = 0;
+    while (exchange && head_size == 0u) {
+        if (!co_await exchange->read(chunk, timeout)) {
+            break;
+        }
+        output += chunk;
+        head_size = FastCgi::parse_response_head(output, head);
+        if (head_size == 0u && output.size() > RequestLimits::MAX_HEADER_SIZE) {
+            head_size.reset();
+        }
+    }
+    if (!head_size || *head_size == 0) {
+        Metrics::increment(Metrics::Counter::FastCgiFailures);
+        status = 502;
+        if (exchange) {
+            exchange->abandon();
+            if (exchange->timed_out()) {
+                status = 504;
+            } else if (exchange->protocol_status() == FastCgi::OVERLOADED) {
+                status = 503;
+            }
+        }
+        if (cacheable) {
+            if (auto sent = co_await send_stale(*cacheable, cached, keep_alive)) {
+                status = cached.status;
+                co_return sent;
+            }
+            if (cached.failed) {
+                co_return std::nullopt;
+            }
+        }
+        std::string response = FastCgi::error_response(status, keep_alive);
+        if (!co_await write_response(response)) {
+            co_return std::nullopt;
+        }
+        co_return response.size();
+    }
+
+    if (head.status >= 500 && cacheable) {
+        // The application's error is replaced by a stored response if it may be
+        if (auto sent = co_await send_stale(*cacheable, cached, keep_alive)) {
+            exchange->abandon();
+            status = cached.status;
+            co_return sent;
+        }
+        if (cached.failed) {
+            exchange->abandon();
+            co_return std::nullopt;
+        }
+    }
+
+    // Without a length the body is chunked, or for HTTP/1.0 ends with the connection
+    status = head.status;
+    bool bodiless = status == 204 || status == 304 || status < 200;
+    bool chunked = false;
+    if (!head.content_length && !bodiless) {
+        if (keep_alive && connection_.http().lastVersion() == "HTTP/1.1") {
+            chunked = true;
+        } else {
+            keep_alive = false;
+        }
+    }
+    std::optional<size_t> remaining = head.content_length;
+    if (bodiless) {
+        remaining = 0;
+    }
+
+    // Send each piece as the application writes it; the head goes with the first.
+    // A response the cache may keep is also copied as it goes.
+    std::string prefix = FastCgi::http_head(head, chunked, keep_alive);
+    std::optional<std::string> captured;
+    if (cacheable && !cacheable->head && ResponseCache::cacheable(status, head.headers)) {
+        captured.emplace();
+    }
+    size_t sent = 0;
+    std::string_view body = std::string_view(output).substr(*head_size);
+    while (true) {
+        if (remaining) {
+            body = body.substr(0, *remaining); // Anything past Content-Length is dropped
+            *remaining -= body.size();
+        }
+        if (captured && captured->size() + body.size() > ResponseCache::options().max_object_size) {
+            captured.reset();
+        } else if (captured) {
+            captured->append(body);
+        }
+        if (!prefix.empty() || !body.empty()) {
+            if (!co_await write_chunk(prefix, body, chunked)) {
+                exchange->abandon();
+                co_return std::nullopt;
+            }
+            sent += prefix.size() + body.size();
+            prefix.clear();
+        }
+        if (!co_await exchange->read(output, timeout)) {
+            break;
+        }
+        body = output;
+    }
+
+    bool complete = !exchange->failed() && !exchange->timed_out() && remaining.value_or(0) == 0;
+    if (!complete) {
+        // The client can only tell a cut-off response by the connection closing
+        Metrics::increment(Metrics::Counter::FastCgiFailures);
+        exchange->abandon();
+        co_return std::nullopt;
+    }
+    if (chunked) {
+        static const std::string last_chunk = "0\r\n\r\n";
+        if (!co_await write_response(last_chunk)) {
+            co_return std::nullopt;
+        }
+        sent += last_chunk.size();
+    }
+    if (captured) {
+        co_await store_response(*cacheable, status, head.reason, fastcgi_fields(head),
+                                std::move(*captured));
+    }
+    co_return sent;
+}
+
+template <typename Stream>
+asio::awaitable<int>
+AsioConnectionDriver<Stream>::fastcgi_request_body(FastCgiPool::Exchange& exchange,
+                                                   const BodyFraming& framing, size_t& bytes_in) {
+    // The body follows the head in the input buffer, and each piece is dropped
+    // from it once sent; what is left after the body is the next request
+    std::string& input = connection_.input();
+    size_t head_size = connection_.consumed();
+    std::optional<size_t> remaining = framing.content_length(); // Unless chunked
+    ChunkedDecoder decoder;
+    size_t decoded = 0;
+    bool armed = false;
+    int refused = 0;
+    while (true) {
+        size_t take = 0; // Bytes of the input buffer used
+        size_t out = head_size; // End of the data to send
+        if (remaining) {
+            take = std::min(*remaining, input.size() - head_size);
+            *remaining -= take;
+            out += take;
+        } else {
+            while (head_size + take < input.size() && !decoder.done()) {
+                std::string_view data;
+                auto used = decoder.consume(std::string_view(input).substr(head_size + take), data);
+                if (!used) {
+                    refused = 400;
+                    break;
+                }
+                take += *used;
+                decoded += data.size();
+                if (decoded > RequestLimits::MAX_UPLOAD_SIZE) {
+                    refused = 413;
+                    break;
+                }
+                // The data moves back over the framing before it
+                std::memmove(input.data() + out, data.data(), data.size());
+                out += data.size();
+            }
+        }
+        if (refused != 0) {
+            break;
+        }
+        if (out > head_size) {
+            bool written = co_await exchange.write_body(
+                std::string_view(input).substr(head_size, out - head_size));
+            if (!written) {
+                refused = 502;
+                break;
+            }
+        }
+        input.erase(head_size, take);
+        bytes_in += take;
+        if (remaining ? *remaining == 0 : decoder.done()) {
+            bool ended = co_await exchange.write_body({});
+            refused = ended ? 0 : 502;
+            break;
+        }
+
+        if (!armed) {
+            // Protects against Slow POST attacks
+            deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+            armed = true;
+        }
+        // A Content-Length body is read no further than its end
+        boost::system::error_code ec;
+        if (remaining) {
+            auto [read_ec, bytes] = co_await asio::async_read(
+                stream_, asio::dynamic_buffer(input),
+                deadline_.reporting(asio::transfer_exactly(std::min(*remaining, BODY_READ_CHUNK))),
+                asio::as_tuple(asio::use_awaitable));
+            ec = read_ec;
+        } else {
+            auto [read_ec, bytes] = co_await asio::async_read(
+                stream_, asio::dynamic_buffer(input),
+                deadline_.reporting(asio::transfer_at_least(1)),
+                asio::as_tuple(asio::use_awaitable));
+            ec = read_ec;
+        }
+        if (ec) {
+            refused = 400; // Cut off, or too slow
+            break;
+        }
+    }
+    if (armed) {
+        deadline_.cancel();
+    }
+    co_return refused;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::proxy_request(Proxy::Group& group,
+                                                                  size_t head_size,
+                                                                  bool& keep_alive) {
+    auto start = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::seconds(Proxy::options().timeout);
+
+    // The head and the body that came with it stay in the input buffer until
+    // the response is done, since the parsed request points into it
+    std::string& input = connection_.input();
+    std::string_view buffered = std::string_view(input).substr(head_size);
+    auto request = Proxy::parse_request(std::string_view(input).substr(0, head_size));
+
+    ChunkedDecoder decoder;
+    size_t body_buffered = 0;
+    bool framed = request.has_value();
+    if (request && request->chunked) {
+        std::string_view data;
+        while (framed && body_buffered < buffered.size() && !decoder.done()) {
+            auto used = decoder.consume(buffered.substr(body_buffered), data);
+            framed = used.has_value();
+            body_buffered += used.value_or(0);
+        }
+    } else if (request && request->content_length) {
+        body_buffered = std::min(buffered.size(), *request->content_length);
+    }
+    if (!framed) {
+        // Where the body ends is unknown, so the connection can't go on
+        Metrics::increment(Metrics::Counter::ProxyRequests);
+        keep_alive = false;
+        std::string response = Proxy::error_response(400, false);
+        if (co_await write_response(response)) {
+            record_request(request ? request->version : "HTTP/1.1",
+                           request ? request->method : "", 400, start, head_size,
+                           response.size());
+        }
+        co_return false;
+    }
+    bool body_consumed = request->chunked
+                             ? decoder.done()
+                             : body_buffered == request->content_length.value_or(0);
+    size_t bytes_in = head_size + body_buffered;
+    keep_alive = request->keep_alive;
+
+    boost::system::error_code ec;
+    auto client = tcp_layer(stream_).remote_endpoint(ec);
+    std::string client_address = ec ? "unknown" : client.address().to_string();
+
+    // GET requests without a body may be answered from the response cache
+    std::optional<ResponseCache::Request> cacheable;
+    CacheLookup cached;
+    if (ResponseCache::options().enabled && !request->chunked && body_buffered == 0 &&
+        body_consumed) {
+        cacheable = ResponseCache::request(request->method, request->target,
+                                           owned_fields(request->headers));
+    }
+    if (cacheable) {
+        auto refresh = [&](ResponseCache::FetchLock lock) {
+            std::string head(input, 0, head_size);
+            if (request->method == "HEAD") {
+                head.replace(0, 4, "GET"); // The cache answers HEAD from GET
+            }
+            asio::co_spawn(stream_.get_executor(),
+                           refresh_proxied(group, std::move(head), client_address,
+                                           !is_plain_socket<Stream>, *cacheable, std::move(lock)),
+                           asio::detached);
+        };
+        cached = co_await consult_cache(*cacheable, keep_alive, refresh);
+        if (cached.failed) {
+            co_return false;
+        }
+        if (cached.sent) {
+            record_request(request->version, request->method, cached.status, start, bytes_in,
+                           *cached.sent);
+            connection_.setConsumed(head_size);
+            co_return true;
+        }
+    }
+    Metrics::increment(Metrics::Counter::ProxyRequests);
+
+    auto& pool = asio::use_service<ProxyPool>(
+        asio::query(stream_.get_executor(), asio::execution::context));
+    tcp::socket upstream(stream_.get_executor());
+    Deadline upstream_deadline(timers_, [&upstream] {
+        boost::system::error_code ignored;
+        upstream.cancel(ignored);
+    });
+
+    // Servers are tried until one takes the connection. Once the request has
+    // gone out it may have been acted on, so it is only sent again when a
+    // reused connection fails before anything comes back or is read from the
+    // client body: most likely the server closed it while it was idle.
+    std::vector<bool> tried(group.size());
+    Proxy::Server* server = nullptr;
+    bool fresh = false;        // Retrying on a new connection to the same server
+    bool body_started = false; // Part of the body was read from the client
+    int status = 502;
+    std::string leftover; // Read past the body: the next pipelined request
+    std::string buffer;
+    while (true) {
+        if (!fresh) {
+            auto index = group.pick(request->target, tried);
+            if (!index) {
+                break;
+            }
+            tried[*index] = true;
+            server = &group.server(*index);
+        }
+        bool alone = group.size() == 1;
+        std::optional<tcp::socket> idle;
+        if (!fresh) {
+            idle = pool.take(*server);
+        }
+        fresh = false;
+        bool reused = idle.has_value();
+        if (reused) {
+            upstream = std::move(*idle);
+            Metrics::increment(Metrics::Counter::ProxyConnectionsReused);
+        } else {
+            upstream = tcp::socket(stream_.get_executor());
+            upstream_deadline.arm(timeout);
+            auto [connect_ec, endpoint] = co_await asio::async_connect(
+                upstream, server->endpoints(), asio::as_tuple(asio::use_awaitable));
+            upstream_deadline.cancel();
+            if (connect_ec) {
+                // Nothing was sent, so the next server can have the request
+                Proxy::report_failure(*server, alone);
+                status = upstream_deadline.expired() ? 504 : 502;
+                continue;
+            }
+            upstream.set_option(tcp::no_delay(true), ec);
+            Metrics::increment(Metrics::Counter::ProxyConnectionsOpened);
+        }
+        ActiveRequest active(*server);
+
+        // The head and buffered body in one write, then the rest of the body
+        std::string head =
+            Proxy::upstream_head(*request, client_address, !is_plain_socket<Stream>, *server);
+        std::array<asio::const_buffer, 2> buffers = {asio::buffer(head),
+                                                     asio::buffer(buffered.data(), body_buffered)};
+        upstream_deadline.arm(timeout);
+        auto [write_ec, written] = co_await asio::async_write(
+            upstream, buffers, asio::as_tuple(asio::use_awaitable));
+        upstream_deadline.cancel();
+        bool sent = !write_ec;
+        if (sent && !body_consumed) {
+            if (request->expect_continue) {
+                static const std::string interim = "HTTP/1.1 100 Continue\r\n\r\n";
+                if (!co_await write_response(interim)) {
+                    co_return false;
+                }
+            }
+            body_started = true;
+            sent = co_await proxy_request_body(upstream, upstream_deadline,
+                                               request->chunked ? &decoder : nullptr,
+                                               request->content_length.value_or(0) - body_buffered,
+                                               leftover, bytes_in);
+            body_consumed = sent;
+        }
+
+        // The response head, after any interim 1xx responses
+        std::optional<Proxy::Response> response;
+        size_t response_head = 0;
+        bool received = false;
+        buffer.clear();
+        while (sent) {
+            upstream_deadline.arm(timeout);
+            auto [read_ec, size] = co_await asio::async_read_until(
+                upstream, asio::dynamic_buffer(buffer, PROXY_MAX_RESPONSE_HEAD), "\r\n\r\n",
+                asio::as_tuple(asio::use_awaitable));
+            upstream_deadline.cancel();
+            if (read_ec) {
+                break;
+            }
+            received = true;
+            response = Proxy::parse_response(std::string_view(buffer).substr(0, size));
+            if (!response || response->status >= 200 || response->status == 101) {
+                response_head = size;
+                break;
+            }
+            buffer.erase(0, size);
+            response.reset();
+        }
+        if (!response || response->status == 101) {
+            bool timed_out = upstream_deadline.expired();
+            if (reused && !timed_out && !body_started && !received && buffer.empty()) {
+                Metrics::increment(Metrics::Counter::ProxyRetries);
+                fresh = true;
+                continue;
+            }
+            Proxy::report_failure(*server, alone);
+            status = timed_out ? 504 : 502;
+            break;
+        }
+        if (response->status >= 500 && cacheable) {
+            // The upstream's error is replaced by a stored response if it may be
+            if (auto sent = co_await send_stale(*cacheable, cached, keep_alive)) {
+                record_request(request->version, request->method, cached.status, start, bytes_in,
+                               *sent);
+                connection_.setConsumed(head_size);
+                co_return true;
+            }
+            if (cached.failed) {
+                co_return false;
+            }
+        }
+
+        // Without a length the body goes to the client chunked, or for
+        // HTTP/1.0 ends with the connection
+        status = response->status;
+        bool bodiless = request->method == "HEAD" || status == 204 || status == 304;
+        bool until_close = !bodiless && !response->chunked && !response->content_length;
+        bool chunked = false;
+        if (!bodiless && !response->content_length) {
+            if (keep_alive && request->version == "HTTP/1.1") {
+                chunked = true;
+            } else {
+                keep_alive = false;
+            }
+        }
+        std::optional<size_t> remaining = response->content_length;
+        if (bodiless) {
+            remaining = 0;
+        }
+        bool reusable = response->keep_alive && !until_close;
+
+        // Send each piece as it arrives; the head goes with the first. A
+        // response the cache may keep is also copied as it goes.
+        std::string prefix = Proxy::client_head(*response, chunked, keep_alive);
+        std::string reason;
+        std::vector<ResponseCache::Field> fields;
+        std::optional<std::string> captured;
+        if (cacheable && !cacheable->head) {
+            fields = owned_fields(response->headers);
+            if (ResponseCache::cacheable(status, fields)) {
+                reason = response->reason;
+                captured.emplace();
+            }
+        }
+        buffer.erase(0, response_head);
+        ChunkedDecoder response_decoder;
+        bool complete = false;
+        bool malformed = false;
+        bool extra = false; // The upstream sent more than the response
+        size_t bytes_out = 0;
+        while (true) {
+            std::string_view data = buffer;
+            if (remaining) {
+                data = data.substr(0, *remaining);
+                *remaining -= data.size();
+                extra = data.size() < buffer.size();
+                complete = *remaining == 0;
+            } else if (response->chunked) {
+                // Chunk data is moved up to the front of the buffer, dropping the framing
+                size_t offset = 0;
+                size_t length = 0;
+                std::string_view piece;
+                while (offset < buffer.size() && !response_decoder.done()) {
+                    auto used = response_decoder.consume(std::string_view(buffer).substr(offset),
+                                                         piece);
+                    if (!used) {
+                        malformed = true;
+                        break;
+                    }
+                    if (!piece.empty()) {
+                        std::memmove(buffer.data() + length, piece.data(), piece.size());
+                        length += piece.size();
+                    }
+                    offset += *used;
+                }
+                data = std::string_view(buffer).substr(0, length);
+                extra = offset < buffer.size();
+                complete = response_decoder.done();
+            }
+            if (captured &&
+                captured->size() + data.size() > ResponseCache::options().max_object_size) {
+                captured.reset();
+            } else if (captured) {
+                captured->append(data);
+            }
+            if (!prefix.empty() || !data.empty()) {
+                if (!co_await write_chunk(prefix, data, chunked)) {
+                    co_return false;
+                }
+                bytes_out += prefix.size() + data.size();
+                prefix.clear();
+            }
+            if (complete || malformed) {
+                break;
+            }
+
+            buffer.resize(PROXY_READ_CHUNK);
+            upstream_deadline.arm(timeout);
+            auto [read_ec, size] = co_await upstream.async_read_some(
+                asio::buffer(buffer), asio::as_tuple(asio::use_awaitable));
+            upstream_deadline.cancel();
+            buffer.resize(size);
+            if (read_ec) {
+                complete = until_close && read_ec == asio::error::eof;
+                break;
+            }
+        }
+
+        if (!complete) {
+            // The client can only tell a cut-off response by the connection closing
+            Metrics::increment(Metrics::Counter::ProxyFailures);
+            Proxy::report_failure(*server, alone);
+            co_return false;
+        }
+        if (chunked) {
+            static const std::string last_chunk = "0\r\n\r\n";
+            if (!co_await write_response(last_chunk)) {
+                co_return false;
+            }
+            bytes_out += last_chunk.size();
+        }
+        Proxy::report_success(*server);
+        if (reusable && !extra) {
+            pool.put(*server, std::move(upstream));
+        }
+        if (captured) {
+            co_await store_response(*cacheable, status, reason, fields, std::move(*captured));
+        }
+        record_request(request->version, request->method, status, start, bytes_in, bytes_out);
+        connection_.setConsumed(head_size + body_buffered);
+        input += leftover;
+        co_return true;
+    }
+
+    // No server answered. Unless the whole body was read, the rest of it is
+    // still coming and the connection can't be used for another request.
+    Metrics::increment(Metrics::Counter::ProxyFailures);
+    if (cacheable) {
+        if (auto sent = co_await send_stale(*cacheable, cached, keep_alive)) {
+            record_request(request->version, request->method, cached.status, start, bytes_in,
+                           *sent);
+            connection_.setConsumed(head_size);
+            co_return true;
+        }
+        if (cached.failed) {
+            co_return false;
+        }
+    }
+    keep_alive = keep_alive && body_consumed;
+    std::string response = Proxy::error_response(status, keep_alive);
+    if (!co_await write_response(response)) {
+        co_return false;
+    }
+    record_request(request->version, request->method, status, start, bytes_in, response.size());
+    connection_.setConsumed(head_size + body_buffered);
+    input += leftover;
+    co_return true;
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::proxy_request_body(
+    tcp::socket& upstream, Deadline& upstream_deadline, ChunkedDecoder* decoder, size_t remaining,
+    std::string& leftover, size_t& bytes_in) {
+    auto timeout = std::chrono::seconds(Proxy::options().timeout);
+    std::string chunk(PROXY_READ_CHUNK, '\0');
+
+    // The whole body shares one deadline and data rate, as when Http reads it
+    // (Protects against Slow POST attacks)
+    deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC));
+    while (!deadline_.expired()) {
+        auto [read_ec, size] = co_await stream_.async_read_some(
+            asio::buffer(chunk), asio::as_tuple(asio::use_awaitable));
+        if (read_ec) {
+            break;
+        }
+        deadline_.add_bytes(size);
+
+        // Bytes past the end of the body belong to the next request
+        std::string_view data(chunk.data(), size);
+        bool done = false;
+        if (decoder) {
+            size_t offset = 0;
+            std::string_view piece;
+            while (offset < data.size() && !decoder->done()) {
+                auto used = decoder->consume(data.substr(offset), piece);
+                if (!used) {
+                    deadline_.cancel();
+                    co_return false;
+                }
+                offset += *used;
+            }
+            done = decoder->done();
+            leftover = data.substr(offset);
+            data = data.substr(0, offset);
+        } else {
+            size_t take = std::min(size, remaining);
+            remaining -= take;
+            leftover = data.substr(take);
+            data = data.substr(0, take);
+            done = remaining == 0;
+        }
+        bytes_in += data.size();
+
+        upstream_deadline.arm(timeout);
+        auto [write_ec, written] = co_await asio::async_write(
+            upstream, asio::buffer(data), asio::as_tuple(asio::use_awaitable));
+        upstream_deadline.cancel();
+        if (write_ec) {
+            break;
+        }
+        if (done) {
+            deadline_.cancel();
+            co_return true;
+        }
+    }
+    deadline_.cancel();
+    co_return false;
+}
+
+template <typename Stream>
+asio::awaitable<typename AsioConnectionDriver<Stream>::CacheLookup>
+AsioConnectionDriver<Stream>::consult_cache(
+    const ResponseCache::Request& request, bool keep_alive,
+    const std::function<void(ResponseCache::FetchLock)>& refresh) {
+    ResponseCache& cache = ResponseCache::getInstance();
+    CacheLookup lookup;
+    if (request.refresh) {
+        Metrics::increment(Metrics::Counter::CacheMisses);
+        co_return lookup; // The client asked for a response from the backend
+    }
+
+    auto entry = cache.find(request);
+    auto now = std::chrono::steady_clock::now();
+    std::string_view status_field = "HIT";
+    if (entry && !entry->fresh(now) && entry->revalidatable(now)) {
+        // Sent stale while one background fetch replaces it
+        auto claim = cache.claim(request.key);
+        if (auto* lock = std::get_if<ResponseCache::FetchLock>(&claim)) {
+            refresh(std::move(*lock));
+        }
+        status_field = "STALE";
+    } else if (!entry || !entry->fresh(now)) {
+        // A miss waits for the request already fetching the key, if any, then
+        // looks again. Whoever still has to fetch takes the key, so later
+        // misses wait for it in turn.
+        lookup.stale = entry && entry->usable_on_error(now) ? entry : nullptr;
+        entry = nullptr;
+        auto claim = cache.claim(request.key);
+        if (auto* fetch = std::get_if<std::shared_ptr<ResponseCache::Fetch>>(&claim)) {
+            Metrics::increment(Metrics::Counter::CacheCoalescedWaiters);
+            co_await (*fetch)->wait(std::chrono::seconds(ResponseCache::options().lock_timeout));
+            entry = cache.find(request);
+            now = std::chrono::steady_clock::now();
+            if (!entry || !entry->fresh(now)) {
+                if (entry && entry->usable_on_error(now)) {
+                    lookup.stale = entry;
+                }
+                entry = nullptr;
+                claim = cache.claim(request.key);
+            }
+        }
+        if (auto* lock = std::get_if<ResponseCache::FetchLock>(&claim)) {
+            lookup.lock.emplace(std::move(*lock));
+        }
+    }
+
+    entry = co_await with_body(request, std::move(entry));
+    if (!entry) {
+        Metrics::increment(Metrics::Counter::CacheMisses);
+        co_return lookup;
+    }
+    Metrics::increment(status_field == "HIT" ? Metrics::Counter::CacheHits
+                                             : Metrics::Counter::CacheStaleHits);
+    lookup.status = entry->status;
+    lookup.sent = co_await send_cached(*entry, request.head, keep_alive, status_field);
+    lookup.failed = !lookup.sent;
+    co_return lookup;
+}
+
+template <typename Stream>
+asio::awaitable<std::optional<size_t>>
+AsioConnectionDriver<Stream>::send_stale(const ResponseCache::Request& request,
+                                         CacheLookup& lookup, bool keep_alive) {
+    if (!lookup.stale || !lookup.stale->usable_on_error(std::chrono::steady_clock::now())) {
+        co_return std::nullopt;
+    }
+    auto entry = co_await with_body(request, lookup.stale);
+    if (!entry) {
+        co_return std::nullopt;
+    }
+    Metrics::increment(Metrics::Counter::CacheStaleHits);
+    lookup.status = entry->status;
+    auto sent = co_await send_cached(*entry, request.head, keep_alive, "STALE");
+    lookup.failed = !sent;
+    co_return sent;
+}
+
+template <typename Stream>
+asio::awaitable<std::optional<size_t>>
+AsioConnectionDriver<Stream>::send_cached(const ResponseCache::Entry& entry, bool head,
+                                          bool keep_alive, std::string_view status_field) {
+    std::string prefix = ResponseCache::head(entry, keep_alive, status_field);
+    std::string_view body = head ? std::string_view() : std::string_view(entry.body);
+    if (!co_await write_chunk(prefix, body, false)) {
+        co_return std::nullopt;
+    }
+    Metrics::increment(Metrics::Counter::CacheBytesSaved, prefix.size() + body.size());
+    co_return prefix.size() + body.size();
+}
+
+template <typename Stream>
+asio::awaitable<bool> AsioConnectionDriver<Stream>::write_chunk(std::string_view prefix,
+                                                                std::string_view data,
+                                                                bool chunked) {
+    std::string size_line = chunked && !data.empty() ? std::format("{:x}\r\n", data.size()) : "";
+    std::string_view chunk_end = size_line.empty() ? "" : "\r\n";
+    std::array<asio::const_buffer, 4> buffers = {asio::buffer(prefix), asio::buffer(size_line),
+                                                 asio::buffer(data), asio::buffer(chunk_end)};
+
+    deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
+    auto [ec, bytes_written] =
+        co_await asio::async_write(stream_, buffers, deadline_.reporting(asio::transfer_all()),
+                                   asio::as_tuple(asio::use_awaitable));
+    deadline_.cancel();
+
+    co_return !ec;
+}
+
+template <typename Stream>
+asio::awaitable<std::optional<size_t>>
+AsioConnectionDriver<Stream>::write_produced_body(std::string_view head, BodyProducer& producer) {
+    // The head goes out with the first chunk
+    std::string piece;
+    size_t sent = 0;
+    while (true) {
+        piece.clear();
+        bool more = co_await BlockingPool::getInstance().run([&] { return producer(piece); });
+        if (!more) {
+            break;
+        }
+        if (piece.empty()) {
+            continue; // An empty chunk would end the body
+        }
+        if (!co_await write_chunk(head, piece, true)) {
+            co_return std::nullopt;
+        }
+        sent += head.size() + chunk_framing_size(piece.size()) + piece.size();
+        head = {};
+    }
+    static const std::string last_chunk = "0\r\n\r\n";
+    if (!co_await write_chunk(head, last_chunk, false)) {
+        co_return std::nullopt;
+    }
+    co_return sent + head.size() + last_chunk.size();
+}
+
+template <typename Stream>
+asio::awaitable<bool>
+AsioConnectionDriver<Stream>::write_file_body(const AsioSocketAdapter::FileBody& file) {
+    // The whole file shares one deadline and data rate, like a buffered response
+    deadline_.arm_transfer(std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
+#ifdef BOOST_ASIO_HAS_IO_URING
+    bool kernel_send = is_plain_socket<Stream>;
+    if constexpr (is_ktls_stream<Stream>) {
+        kernel_send = stream_.ktls_send();
+    }
+    bool sent_all =
+        kernel_send ? co_await send_file_chunks(file) : co_await read_file_chunks(file);
+#else
+    bool sent_all = co_await send_file_chunks(file);
+#endif
+    deadline_.cancel();
+
+    co_return sent_all;
+}
+
+template <typename Stream>
+asio::awaitable<bool>
+AsioConnectionDriver<Stream>::send_file_chunks(const AsioSocketAdapter::FileBody& file) {
+    if constexpr (is_plain_socket<Stream>) {
+        stream_.native_non_blocking(true); // sendfile must not block the thread
+    }
+
+    off_t offset = file.offset;
+    size_t remaining = file.count;
+    while (remaining > 0) {
+        if (deadline_.expired()) {
+            co_return false; // Timeout or too slow - likely Slow Read attack
+        }
+        size_t chunk = std::min(remaining, SEND_FILE_CHUNK);
+
+        if constexpr (is_ktls_stream<Stream>) {
+            // Records are built and encrypted by the kernel (SSL_sendfile)
+            auto [ec, sent] = co_await stream_.async_sendfile(file.fd, offset, chunk,
+                                                              asio::as_tuple(asio::use_awaitable));
+            if (ec || sent == 0) {
+                co_return false;
+            }
+            offset += static_cast<off_t>(sent);
+            remaining -= sent;
+            deadline_.add_bytes(sent);
+        } else if constexpr (is_plain_socket<Stream>) {
+#ifdef __linux__
+            ssize_t sent = ::sendfile(stream_.native_handle(), file.fd, &offset, chunk);
+            if (sent > 0) {
+                remaining -= static_cast<size_t>(sent);
+                deadline_.add_bytes(static_cast<size_t>(sent));
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent == 0 || errno != EAGAIN) {
+                co_return false; // File shrank or the connection failed
+            }
+
+            // Socket buffer full - wait until the client drains it
+            auto [ec] = co_await stream_.async_wait(tcp::socket::wait_write,
+                                                    asio::as_tuple(asio::use_awaitable));
+            if (ec) {
+                co_return false;
+            }
+#else
+            co_return false;
+#endif
+        } else {
+            co_return false; // ssl::stream only sends files through read_file_chunks
+        }
+    }
+    co_return true;
+}
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+template <typename Stream>
+asio::awaitable<bool>
+AsioConnectionDriver<Stream>::read_file_chunks(const AsioSocketAdapter::FileBody& file) {
+    // The file object closes its descriptor, and the adapter still owns file.fd
+    int fd = ::dup(file.fd);
+    if (fd < 0) {
+        co_return false;
+    }
+    asio::random_access_file source(stream_.get_executor());
+    source.assign(fd);
+
+    // A registered buffer if one is free, else a pooled one of the same size
+    auto& registered = asio::use_service<RegisteredBuffers>(
+        asio::query(stream_.get_executor(), asio::execution::context));
+    auto lease = registered.acquire();
+    std::string fallback;
+    if (!lease) {
+        fallback = BufferPool::acquire();
+        fallback.resize(RegisteredBuffers::BUFFER_SIZE);
+    }
+    char* data = lease ? static_cast<char*>(lease->buffer().data()) : fallback.data();
+
+    uint64_t offset = static_cast<uint64_t>(file.offset);
+    size_t remaining = file.count;
+    while (remaining > 0 && !deadline_.expired()) {
+        size_t chunk = std::min(remaining, RegisteredBuffers::BUFFER_SIZE);
+        std::tuple<boost::system::error_code, size_t> result;
+        if (lease) {
+            result = co_await source.async_read_some_at(
+                offset, asio::buffer(lease->buffer(), chunk), asio::as_tuple(asio::use_awaitable));
+        } else {
+            result = co_await source.async_read_some_at(offset, asio::buffer(data, chunk),
+                                                        asio::as_tuple(asio::use_awaitable));
+        }
+        auto [read_ec, bytes_read] = result;
+        if (read_ec || bytes_read == 0) {
+            break; // File shrank or the read failed
+        }
+
+        auto [write_ec, written] = co_await asio::async_write(
+            stream_, asio::buffer(data, bytes_read), deadline_.reporting(asio::transfer_all()),
+            asio::as_tuple(asio::use_awaitable));
+        if (write_ec) {
+            break;
+        }
+        offset += bytes_read;
+        remaining -= bytes_read;
+    }
+
+    if (!lease) {
+        BufferPool::release(std::move(fallback));
+    }
+    co_return remaining == 0;
+}
+#endif
+
+template class AsioConnectionDriver<tcp::socket>;
+template class AsioConnectionDriver<asio::ssl::stream<tcp::socket>>;
+template class AsioConnectionDriver<KtlsStream>;
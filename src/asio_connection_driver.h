@@ -0,0 +1,272 @@
+#ifndef ASIO_CONNECTION_DRIVER_H
+#define ASIO_CONNECTION_DRIVER_H
+
+#include "asio_http_connection.h"
+#include "chunked_decoder.h"
+#include "fastcgi_pool.h"
+#include "handler.h"
+#include "ktls_stream.h"
+#include "proxy.h"
+#include "response_cache.h"
+#include "timer_wheel.h"
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ssl.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+/**
+ * HTTP/1.1 request loop shared by the plain and TLS servers
+ *
+ * Runs read head -> read body -> Http dispatch -> write response -> keep-alive
+ * over any asio stream, with the per-stage timeouts from ConnectionTimeouts.
+ * Every stage re-arms the connection's one deadline in the server's TimerWheel;
+ * expiry cancels the socket, which ends whichever operation is pending. Body
+ * reads and response writes must also keep up MIN_DATA_RATE_BYTES_PER_SEC, so a
+ * slow-POST or slow-read client is dropped within one measurement window
+ * instead of holding its buffers and coroutine for the whole stage timeout.
+ * AsioServer drives it over tcp::socket and AsioSSLServer over
+ * ssl::stream<tcp::socket> (or KtlsStream in kTLS mode) once the handshake is
+ * done, so HTTPS serves the same Http pipeline and pays for the handshake once
+ * per connection rather than once per request.
+ *
+ * Large static files are sent straight from the page cache when the stream
+ * allows it: sendfile() on plain TCP, SSL_sendfile() once kTLS is active. In
+ * io_uring builds every other stream gets them too, read asynchronously in
+ * registered-buffer chunks rather than loaded whole by Http.
+ *
+ * Scripts Http forwards to the FastCGI application are answered from this
+ * thread's FastCgiPool: the response is written as the application produces
+ * it, chunked when it gives no Content-Length.
+ *
+ * Requests matching a reverse proxy route skip Http altogether: the head is
+ * rewritten, the body is streamed to an upstream server as it arrives from the
+ * client, and the response is streamed back, reusing this thread's idle
+ * upstream connections (ProxyPool). The whole body is sent before the
+ * response is read, so an upstream that answers early (say, rejecting a large
+ * upload) is only heard once the upload is done.
+ *
+ * Form POSTs Http answers itself have their body parsed as it arrives (see
+ * FormParser) rather than read into the input buffer first, so an upload of
+ * any size needs a bounded amount of memory. Chunked bodies are decoded with
+ * ChunkedDecoder as they are read, straight from the input buffer.
+ *
+ * Responses Http streams (Http::sendChunkedResponse) go out a chunk at a
+ * time, the next one generated only once the last has been written.
+ *
+ * Requests routed to a coroutine handler (Router::AsyncHandler) skip Http
+ * too: the handler runs here, on the event loop, reading the body and writing
+ * the response through the same deadlines as every other stage. Synchronous
+ * handlers are still run by Http on the BlockingPool.
+ *
+ * With the response cache enabled, proxied and FastCGI GET requests are
+ * answered from ResponseCache when it can, and the responses fetched for the
+ * rest are copied into it as they are streamed to the client.
+ *
+ * Explicitly instantiated for each stream type in asio_connection_driver.cc.
+ */
+template <typename Stream> class AsioConnectionDriver {
+  public:
+    AsioConnectionDriver(Stream& stream, AsioHttpConnection& connection, TimerWheel& timers);
+
+    /**
+     * Read a request head (through the blank line) into the connection's input
+     * buffer. Completes immediately if a pipelined request is already buffered.
+     * @return Size of the head, or 0 on timeout, error or oversized head
+     */
+    asio::awaitable<size_t> read_request_head(std::chrono::seconds timeout);
+
+    /**
+     * Serve requests until the client closes, keep-alive ends or stopping is set
+     * @param head_size Size of the first request head, already in the input buffer
+     * @return Number of requests answered
+     */
+    asio::awaitable<int> serve(size_t head_size, const bool& stopping);
+
+    // Underlying TCP socket (the stream itself for plain connections)
+    static tcp::socket& tcp_layer(Stream& stream);
+
+  private:
+    // A cacheable request's state once the response cache has been consulted
+    struct CacheLookup {
+        std::optional<size_t> sent; // Bytes sent, if the cache answered
+        bool failed = false;        // The cache answered but the write failed
+        int status = 0;             // Of the response the cache sent
+        std::shared_ptr<const ResponseCache::Entry> stale; // For stale-if-error
+        std::optional<ResponseCache::FetchLock> lock;      // Held while this request fetches
+    };
+
+    // The connection as a coroutine handler reads and writes it
+    class HandlerTransport : public HandlerStream {
+      public:
+        explicit HandlerTransport(AsioConnectionDriver& driver) : driver_(driver) {}
+
+        asio::awaitable<bool> read_more(std::string& input) override;
+        asio::awaitable<bool> write(std::string_view prefix, std::string_view data,
+                                    bool chunked) override;
+
+      private:
+        AsioConnectionDriver& driver_;
+    };
+
+    /**
+     * Answer a request with a route's coroutine handler, run through the
+     * router's middleware. Whatever the handler leaves unsent is finished
+     * here: a 500 if it sent nothing (or threw), else the end of the body.
+     * @param head_size Size of the request head in the input buffer
+     * @param keep_alive Set to whether the connection can stay open
+     * @return False if the connection has to close
+     */
+    asio::awaitable<bool> run_handler(const Router::AsyncHandler& handler, size_t head_size,
+                                      bool& keep_alive);
+
+    /**
+     * Answer a request for a path Http found missing with NegativeCache's 404
+     * @param keep_alive Set to whether the connection can stay open
+     * @return False if the write failed
+     */
+    asio::awaitable<bool> send_missing(const Request& request, size_t head_size,
+                                       bool& keep_alive);
+
+    // Read a Content-Length body that follows the head into the input buffer
+    asio::awaitable<bool> read_request_body(size_t size);
+
+    /**
+     * Feed a Content-Length body that follows the head to a form parser as it
+     * arrives, leaving only the head (and anything after the body) in the
+     * input buffer. Parsing runs on the BlockingPool since large parts are
+     * written to files.
+     */
+    asio::awaitable<bool> read_form_body(size_t head_size, size_t size, FormParser& form);
+
+    /**
+     * Read a chunked body that follows the head. A form's data is decoded in
+     * place and fed to its parser as it arrives, leaving only the head in the
+     * input buffer; any other body is kept there, still chunked, for Http.
+     * @param form Parser for a form body, if it is one
+     * @param body_size Set to the bytes of body read, framing included
+     * @param incomplete Set if reading stopped before the end of the body,
+     *        at bad framing or once a size limit was passed (so Http or the
+     *        form reports the error and the connection can't be kept)
+     * @return False if the client went away or timed out
+     */
+    asio::awaitable<bool> read_chunked_body(size_t head_size, FormParser* form, size_t& body_size,
+                                            bool& incomplete);
+
+    // Wait for the next request on an idle keep-alive connection
+    asio::awaitable<bool> wait_readable();
+
+    // Write response with timeout protection (for slow read attack prevention)
+    asio::awaitable<bool> write_response(const std::string& response);
+
+    /**
+     * Write the response Http queued: each run of memory segments with one
+     * gather write, and file ranges between them as write_file_body() does
+     */
+    asio::awaitable<bool> write_output(const OutputChain& output);
+
+    /**
+     * Stream the response to a request Http forwarded to the FastCGI application,
+     * and first the request body if the connection left it unread
+     * @param keep_alive Cleared if the response has to end with the connection
+     * @param status Set to the status sent to the client
+     * @param bytes_in Increased by the body bytes read from the client
+     * @return Bytes sent, or nothing if the connection has to close
+     */
+    asio::awaitable<std::optional<size_t>>
+    forward_fastcgi(AsioSocketAdapter::ForwardedRequest request, bool& keep_alive, int& status,
+                    size_t& bytes_in);
+
+    /**
+     * Stream a request body from the client to the FastCGI application as STDIN
+     * records, each piece sent from the input buffer as it arrives
+     * @param bytes_in Increased by the body bytes read
+     * @return 0 once all of it has gone out, else the status for the client
+     *         should the application not answer: 400 if the body was cut off
+     *         or malformed, 413 if it was too large, 502 if the application
+     *         stopped taking it
+     */
+    asio::awaitable<int> fastcgi_request_body(FastCgiPool::Exchange& exchange,
+                                              const BodyFraming& framing, size_t& bytes_in);
+
+    /**
+     * Forward a request matching a proxy route and stream the response back
+     * @param head_size Size of the request head in the input buffer
+     * @param keep_alive Set to whether the client connection can stay open
+     * @return False if the connection has to close
+     */
+    asio::awaitable<bool> proxy_request(Proxy::Group& group, size_t head_size, bool& keep_alive);
+
+    /**
+     * Stream the rest of a request body from the client to the upstream
+     * @param decoder Where a chunked body's framing has been parsed up to
+     * @param remaining Bytes of a Content-Length body still to come
+     * @param leftover Set to bytes read past the body (a pipelined request)
+     * @param bytes_in Increased by the body bytes read
+     * @return False if either side failed or timed out
+     */
+    asio::awaitable<bool> proxy_request_body(tcp::socket& upstream, Deadline& upstream_deadline,
+                                             ChunkedDecoder* decoder, size_t remaining,
+                                             std::string& leftover, size_t& bytes_in);
+
+    /**
+     * Answer a request from the response cache if it can: fresh, or stale
+     * while refresh starts a background fetch. A miss for a key another
+     * request is fetching waits for that fetch first.
+     * @param refresh Starts a fetch that stores the response with no client
+     */
+    asio::awaitable<CacheLookup>
+    consult_cache(const ResponseCache::Request& request, bool keep_alive,
+                  const std::function<void(ResponseCache::FetchLock)>& refresh);
+
+    /**
+     * Send the stored response a failed fetch falls back to (stale-if-error)
+     * @return Bytes sent, or nothing if there is none or the write failed
+     *         (which sets lookup.failed)
+     */
+    asio::awaitable<std::optional<size_t>>
+    send_stale(const ResponseCache::Request& request, CacheLookup& lookup, bool keep_alive);
+
+    // Send a stored response, its body in memory; nothing if the write failed
+    asio::awaitable<std::optional<size_t>> send_cached(const ResponseCache::Entry& entry,
+                                                       bool head, bool keep_alive,
+                                                       std::string_view status_field);
+
+    // Write part of a streamed response, as one HTTP chunk if chunked
+    asio::awaitable<bool> write_chunk(std::string_view prefix, std::string_view data, bool chunked);
+
+    /**
+     * Send the response head Http wrote, then the body it streamed, one chunk
+     * per piece; each piece is generated (on the BlockingPool) only once the
+     * previous one has been written
+     * @return Bytes sent, or nothing if the write failed
+     */
+    asio::awaitable<std::optional<size_t>> write_produced_body(std::string_view head,
+                                                               BodyProducer& producer);
+
+    // Send a file range Http queued with send_file() (sendfile on TCP, SSL_sendfile on kTLS)
+    asio::awaitable<bool> write_file_body(const AsioSocketAdapter::FileBody& file);
+    asio::awaitable<bool> send_file_chunks(const AsioSocketAdapter::FileBody& file);
+#ifdef BOOST_ASIO_HAS_IO_URING
+    asio::awaitable<bool> read_file_chunks(const AsioSocketAdapter::FileBody& file);
+#endif
+
+    Stream& stream_;
+    AsioHttpConnection& connection_;
+    TimerWheel& timers_;
+    TransferDeadline deadline_; // Shared by every stage; only one runs at a time
+    std::vector<asio::const_buffer> gather_; // Buffers of write_output(), kept between requests
+};
+
+extern template class AsioConnectionDriver<tcp::socket>;
+extern template class AsioConnectionDriver<asio::ssl::stream<tcp::socket>>;
+extern template class AsioConnectionDriver<KtlsStream>;
+
+#endif // ASIO_CONNECTION_DRIVER_H
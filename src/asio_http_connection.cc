@@ -1,41 +1,194 @@
 #include "asio_http_connection.h"
-#include <iostream>
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <vector>
 
-AsioHttpConnection::AsioHttpConnection(tcp::socket socket)
-    : socket_(std::move(socket)), response_buffer_{} {}
+namespace {
 
-asio::awaitable<bool> AsioHttpConnection::process_request(const std::string& header) {
-    // Clear response buffer
-    response_buffer_.str("");
-    response_buffer_.clear();
+std::vector<std::unique_ptr<AsioHttpConnection>>& connectionPool() {
+    thread_local std::vector<std::unique_ptr<AsioHttpConnection>> pool;
+    return pool;
+}
+
+bool startsWithIgnoreCase(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() &&
+           std::equal(prefix.begin(), prefix.end(), text.begin(), [](char a, char b) {
+               return std::tolower(static_cast<unsigned char>(a)) ==
+                      std::tolower(static_cast<unsigned char>(b));
+           });
+}
+
+// Value of the first header field with this name (lowercase, with the colon),
+// running to the end of its line
+std::optional<std::string_view> fieldValue(std::string_view head, std::string_view name) {
+    size_t line_start = head.find("\r\n");
+    while (line_start != std::string_view::npos) {
+        line_start += 2;
+        size_t line_end = head.find("\r\n", line_start);
+        std::string_view line = head.substr(line_start, line_end - line_start);
+        line_start = line_end;
+
+        if (startsWithIgnoreCase(line, name)) {
+            std::string_view value = line.substr(name.size());
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                value.remove_prefix(1);
+            }
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+// Swap out a buffer that grew past what is worth keeping for the next request
+void trimBuffer(std::string& buffer) {
+    if (buffer.capacity() > BufferPool::MAX_RETAINED_CAPACITY) {
+        std::string().swap(buffer);
+        buffer = BufferPool::acquire();
+    }
+}
+
+} // namespace
+
+AsioHttpConnection::AsioHttpConnection() {
+    http_.sock = &adapter_; // The adapter lives as long as the Http handler
+}
+
+void AsioHttpConnection::Deleter::operator()(AsioHttpConnection* connection) const noexcept {
+    // Unread pipelined bytes belong to the closed connection
+    connection->input_.clear();
+    connection->adapter_.output().clear(); // Closing any queued file
+    connection->releaseBuffers();
+    connection->adapter_.bind(nullptr, tcp::endpoint());
+    connection->adapter_.setRequestData({});
+    connection->adapter_.setFileSendEnabled(false);
+    connection->adapter_.setFastCgiEnabled(false);
+    connection->adapter_.takeForwardedRequest();
+    connection->adapter_.setParsedForm(nullptr);
+    connection->adapter_.setStreamedBody(std::nullopt);
+    connection->adapter_.setStreamingEnabled(false);
+    connection->adapter_.takeBodyProducer();
+    connection->consumed_ = 0;
+
+    auto& pool = connectionPool();
+    if (pool.size() < MAX_POOLED) {
+        pool.emplace_back(connection);
+    } else {
+        delete connection;
+    }
+}
+
+AsioHttpConnection::Ptr AsioHttpConnection::acquire(tcp::socket* socket,
+                                                    const tcp::endpoint& client_endpoint) {
+    auto& pool = connectionPool();
+    Ptr connection;
+    if (pool.empty()) {
+        connection.reset(new AsioHttpConnection());
+    } else {
+        connection.reset(pool.back().release());
+        pool.pop_back();
+    }
+    connection->adapter_.bind(socket, client_endpoint);
+    connection->acquireBuffers();
+    return connection;
+}
 
-    // Create a custom Socket wrapper that writes to our buffer instead of a real socket
-    // For now, we'll need to refactor the HTTP handler to support this
-    // TODO: Refactor Http class to use an abstract output interface
+size_t AsioHttpConnection::pooled() { return connectionPool().size(); }
 
-    // Process the header
-    bool keep_alive = http_handler_.parseHeader(header);
+bool AsioHttpConnection::process(size_t head_size, size_t body_size) {
+    std::string_view request(input_);
+    head_size = std::min(head_size, request.size());
 
-    // Send the accumulated response
-    co_await send_response();
+    // Http reads the body (Content-Length or chunked) through the adapter
+    adapter_.setRequestData(request.substr(head_size));
+    bool keep_alive = http_.parseHeader(request.substr(0, head_size));
 
-    co_return keep_alive;
+    // Skip a body Http didn't read (e.g. an error response) so it isn't
+    // mistaken for the next request
+    consumed_ = std::min(head_size + std::max(body_size, adapter_.consumed()), request.size());
+    return keep_alive;
 }
 
-asio::awaitable<void> AsioHttpConnection::send_response() {
-    std::string response = response_buffer_.str();
-    if (!response.empty()) {
-        co_await asio::async_write(socket_, asio::buffer(response), asio::use_awaitable);
+bool AsioHttpConnection::servesFromCache(std::string_view head) {
+    bool get = head.starts_with("GET ");
+    if (!get && !head.starts_with("HEAD ")) {
+        return false;
     }
+    size_t start = head.find(' ') + 1;
+    std::string_view target = head.substr(start, head.find(' ', start) - start);
+    return http_.servesFromCache(target, get && fieldValue(head, "accept:"));
+}
+
+bool AsioHttpConnection::authorize(const Request& request) {
+    // The body is left unread, so the connection closes after a 401
+    return http_.authorize(std::string(request.path()), std::string(request.method_name()),
+                           request.headers(), false);
+}
+
+void AsioHttpConnection::finishRequest() {
+    adapter_.setRequestData({});
+    input_.erase(0, consumed_);
+    consumed_ = 0;
+    adapter_.output().clear(); // Closing any queued file, and dropping shared bodies
+    adapter_.setParsedForm(nullptr); // Removing any files it spooled
+    adapter_.setStreamedBody(std::nullopt);
+    adapter_.takeBodyProducer();
+
+    trimBuffer(input_);
+    trimBuffer(adapter_.output().owned());
 }
 
-std::string AsioHttpConnection::get_client_address() const {
-    try {
-        auto endpoint = socket_.remote_endpoint();
-        return endpoint.address().to_string();
-    } catch (...) {
-        return "unknown";
+void AsioHttpConnection::releaseBuffers() {
+    if (input_.capacity() > 0 && input_.empty()) {
+        BufferPool::release(std::move(input_));
+        input_ = std::string();
+    }
+    std::string& response = adapter_.output().owned();
+    if (response.capacity() > 0 && adapter_.output().empty()) {
+        BufferPool::release(std::move(response));
+        response = std::string();
     }
 }
 
-void AsioHttpConnection::capture_http_output(const std::string& data) { response_buffer_ << data; }
\ No newline at end of file
+void AsioHttpConnection::acquireBuffers() {
+    if (input_.capacity() < BufferPool::INITIAL_CAPACITY) {
+        std::string buffer = BufferPool::acquire();
+        buffer.append(input_);
+        input_.swap(buffer);
+    }
+    std::string& response = adapter_.output().owned();
+    if (response.capacity() < BufferPool::INITIAL_CAPACITY && adapter_.output().empty()) {
+        std::string buffer = BufferPool::acquire();
+        response.swap(buffer);
+    }
+}
+
+std::unique_ptr<FormParser> AsioHttpConnection::formParser(std::string_view head) {
+    if (!head.starts_with("POST ")) {
+        return nullptr;
+    }
+    auto content_type = fieldValue(head, "content-type:");
+    std::unique_ptr<FormParser> form;
+    if (content_type) {
+        form = FormParser::create(*content_type);
+    }
+    std::string_view target = head.substr(5, head.find(' ', 5) - 5);
+    if (form && http_.runsScript(target.substr(0, target.find('?')))) {
+        return nullptr; // The application gets the body as it was sent
+    }
+    return form;
+}
+
+bool AsioHttpConnection::streamBodyToApplication(std::string_view head,
+                                                 const BodyFraming& framing) {
+    if (!adapter_.can_forward_fastcgi() || !head.starts_with("POST ")) {
+        return false;
+    }
+    std::string_view target = head.substr(5, head.find(' ', 5) - 5);
+    if (!http_.runsScript(target.substr(0, target.find('?')))) {
+        return false;
+    }
+    adapter_.setStreamedBody(framing);
+    return true;
+}
@@ -1,34 +1,165 @@
 #ifndef ASIO_HTTP_CONNECTION_H
 #define ASIO_HTTP_CONNECTION_H
 
+#include "asio_socket_adapter.h"
+#include "handler.h"
 #include "http.h"
 #include <boost/asio.hpp>
-#include <boost/asio/awaitable.hpp>
 #include <memory>
-#include <sstream>
 #include <string>
+#include <string_view>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 
-class AsioHttpConnection : public std::enable_shared_from_this<AsioHttpConnection> {
+/**
+ * Reusable state for one HTTP/1.1 connection
+ *
+ * Owns the Http handler (parser, auth, content negotiation and response
+ * state), the socket adapter it writes responses into, and the connection's
+ * input buffer. Objects are recycled through a per-thread pool, so the Http
+ * setup cost (argon2id hashing of the built-in users) is paid once per pooled
+ * object rather than once per connection, and keep-alive requests reuse the
+ * same buffers instead of allocating new ones.
+ *
+ * The input buffer persists across requests, so pipelined requests and a
+ * request body that arrived with the headers are kept for the next step.
+ *
+ * Memory: while a connection is idle between keep-alive requests its input
+ * and output buffers are returned to the BufferPool, leaving this object
+ * (about 1 KB plus the Auth tables, ~2 KB on the heap), the socket and the
+ * coroutine frame. An active connection additionally holds two buffers of
+ * BufferPool::INITIAL_CAPACITY (8 KB) each, more while sending a large
+ * response.
+ */
+class AsioHttpConnection {
   public:
-    explicit AsioHttpConnection(tcp::socket socket);
+    struct Deleter {
+        void operator()(AsioHttpConnection* connection) const noexcept;
+    };
+    using Ptr = std::unique_ptr<AsioHttpConnection, Deleter>;
 
-    // Process a single HTTP request/response cycle
-    asio::awaitable<bool> process_request(const std::string& header);
+    // Idle objects kept per thread
+    static constexpr size_t MAX_POOLED = 64;
 
-    // Get client address for logging
-    std::string get_client_address() const;
+    /**
+     * Take a connection object from this thread's pool, or create one, and
+     * bind it to a newly accepted socket. Buffers are acquired as well.
+     */
+    static Ptr acquire(tcp::socket* socket, const tcp::endpoint& client_endpoint);
+
+    /**
+     * Number of idle connection objects pooled on the calling thread
+     */
+    static size_t pooled();
+
+    AsioHttpConnection(const AsioHttpConnection&) = delete;
+    AsioHttpConnection& operator=(const AsioHttpConnection&) = delete;
+
+    // Buffer requests are read into; may hold pipelined bytes after the current request
+    std::string& input() { return input_; }
+    bool hasPendingInput() const { return !input_.empty(); }
+
+    /**
+     * Run the request at the front of the input buffer through Http
+     * @param head_size Bytes of request line and headers, including the blank line
+     * @param body_size Bytes of body already read into the buffer after the head
+     * @return true if the connection should be kept alive
+     */
+    bool process(size_t head_size, size_t body_size);
+
+    /**
+     * Whether process() can run on the event loop for a request without a
+     * body: a GET or HEAD that Http answers from the open file cache
+     * (Http::servesFromCache). Anything else may block.
+     */
+    bool servesFromCache(std::string_view head);
+
+    // Whether a coroutine route's request has to pass authentication first
+    bool protects(const Request& request) { return http_.protects(std::string(request.path())); }
+
+    /**
+     * Check the credentials of a coroutine route's request, leaving the 401
+     * in response() when they don't pass. Blocks (Argon2), like process().
+     */
+    bool authorize(const Request& request);
+
+    // Bytes of the input buffer used by the last processed request
+    size_t consumed() const { return consumed_; }
+
+    // Mark bytes of the input buffer as used by a request answered without Http
+    void setConsumed(size_t bytes) { consumed_ = bytes; }
+
+    const Http& http() const { return http_; }
+    // The response Http queued, in segments (see OutputChain)
+    const OutputChain& output() const { return adapter_.output(); }
+
+    // Its memory segments copied into one string (for tests)
+    std::string response() const { return adapter_.getResponse(); }
+
+    // File region Http queued with send_file(), if any
+    const AsioSocketAdapter::FileBody& fileBody() const { return adapter_.fileBody(); }
+
+    // Let Http hand large files to the driver instead of reading them into the response
+    void setFileSendEnabled(bool enabled) { adapter_.setFileSendEnabled(enabled); }
+
+    // Let Http leave script requests to the FastCGI application
+    void setFastCgiEnabled(bool enabled) { adapter_.setFastCgiEnabled(enabled); }
+
+    // Let Http stream response bodies of unknown length through the driver
+    void setStreamingEnabled(bool enabled) { adapter_.setStreamingEnabled(enabled); }
+
+    // Producer of the body to send after response(), if Http streamed one
+    std::optional<BodyProducer> takeBodyProducer() { return adapter_.takeBodyProducer(); }
+
+    // Request to forward instead of sending response(), if Http made one
+    std::optional<AsioSocketAdapter::ForwardedRequest> takeForwardedRequest() {
+        return adapter_.takeForwardedRequest();
+    }
+
+    /**
+     * A parser for the body of a form POST that Http answers itself, so the
+     * body can be parsed as it arrives instead of read into the input buffer
+     * first; nothing for other requests (including forms posted to scripts)
+     */
+    std::unique_ptr<FormParser> formParser(std::string_view head);
+
+    /**
+     * Leave the body of a POST to a script unread, for the driver to stream
+     * to the FastCGI application once Http has forwarded the request
+     * @return Whether the body was left (FastCGI is enabled and the target
+     *         runs a script)
+     */
+    bool streamBodyToApplication(std::string_view head, const BodyFraming& framing);
+
+    // Framing of the body left by streamBodyToApplication(), if it was
+    const BodyFraming* streamedBody() const { return adapter_.streamed_body(); }
+
+    // The form parsed from the current request's body, for Http to answer
+    void setParsedForm(std::unique_ptr<FormParser> form) {
+        adapter_.setParsedForm(std::move(form));
+    }
+
+    /**
+     * Drop the processed request from the input buffer and clear the response
+     * (closing any queued file), keeping buffer capacity for the next request
+     */
+    void finishRequest();
+
+    /**
+     * Hand the (empty) buffers back to the BufferPool while the connection is
+     * idle, and take them again when data arrives
+     */
+    void releaseBuffers();
+    void acquireBuffers();
 
   private:
-    tcp::socket socket_;
-    Http http_handler_;
-    std::stringstream response_buffer_;
+    AsioHttpConnection();
 
-    // Bridge functions to connect HTTP handler to ASIO socket
-    asio::awaitable<void> send_response();
-    void capture_http_output(const std::string& data);
+    Http http_;
+    AsioSocketAdapter adapter_;
+    std::string input_;
+    size_t consumed_ = 0;
 };
 
-#endif // ASIO_HTTP_CONNECTION_H
\ No newline at end of file
+#endif // ASIO_HTTP_CONNECTION_H
@@ -1,17 +1,17 @@
 #include "asio_server.h"
-#include "asio_socket_adapter.h"
+#include "asio_connection_driver.h"
+#include "asio_http_connection.h"
+#include "blocking_pool.h"
 #include "connection_timeouts.h"
 #include "http.h"
+#include "metrics.h"
 #include "websocket_handler.h"
 #include <algorithm>
-#include <boost/asio/experimental/awaitable_operators.hpp>
 #include <chrono>
 #include <iostream>
 
-using namespace boost::asio::experimental::awaitable_operators;
-
 AsioServer::AsioServer(int port, int test_requests)
-    : acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)),
+    : timers_(io_context_.get_executor()), acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)),
       signals_(io_context_, SIGINT, SIGTERM), port_(port), test_requests_(test_requests) {
     std::cout << "Starting ASIO server on port " << port_ << " process ID: " << getpid()
               << std::endl;
@@ -24,7 +24,11 @@ AsioServer::AsioServer(int port, int test_requests)
     signals_.async_wait([this](std::error_code /*ec*/, int /*signo*/) { stop(); });
 }
 
-AsioServer::~AsioServer() { stop(); }
+AsioServer::~AsioServer() {
+    stop();
+    // Workers may still be finishing requests for this io_context
+    BlockingPool::getInstance().drain();
+}
 
 void AsioServer::run() {
     // Start accepting connections
@@ -50,6 +54,7 @@ asio::awaitable<void> AsioServer::listener() {
     try {
         while (!stopping_) {
             auto socket = co_await acceptor_.async_accept(asio::use_awaitable);
+            Metrics::increment(Metrics::Counter::ConnectionsAccepted);
 
             // Handle each connection concurrently
             asio::co_spawn(io_context_, handle_connection(std::move(socket)), asio::detached);
@@ -62,83 +67,35 @@ asio::awaitable<void> AsioServer::listener() {
 }
 
 asio::awaitable<void> AsioServer::handle_connection(tcp::socket socket) {
+    Metrics::GaugeGuard active_connection(Metrics::Gauge::ActiveConnections);
+
     try {
         // Get client endpoint for logging
         auto client_endpoint = socket.remote_endpoint();
 
-        // First request doesn't use timeout
-        std::string header = co_await read_http_request(socket, false);
-        if (header.empty()) {
+        // Parser, response and buffer state reused for every request on this connection
+        auto connection = AsioHttpConnection::acquire(&socket, client_endpoint);
+        AsioConnectionDriver<tcp::socket> driver(socket, *connection, timers_);
+
+        // First request uses the header read timeout (protects against Slowloris)
+        size_t head_size = co_await driver.read_request_head(
+            std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
+        if (head_size == 0) {
             co_return;
         }
 
         // Check if this is a WebSocket upgrade request
-        if (is_websocket_upgrade(header)) {
+        std::string_view head(connection->input().data(), head_size);
+        if (is_websocket_upgrade(head)) {
             std::cout << "WebSocket upgrade detected from " << client_endpoint << std::endl;
+            std::string header(head);
+            connection.reset();
             co_await WebSocketHandler::handle_session(std::move(socket), header);
             co_return;
         }
 
         // Process as regular HTTP
-        // Create socket adapter
-        AsioSocketAdapter socket_adapter(&socket, client_endpoint);
-
-        // Create HTTP handler with the adapter
-        Http http;
-        http.sock = std::unique_ptr<Socket>(&socket_adapter);
-
-        // Provide the request data to the adapter
-        socket_adapter.setRequestData(header);
-
-        // Process the first request
-        bool keep_alive = http.parseHeader(header);
-
-        // Send the response with timeout protection (against Slow Read attacks)
-        std::string response = socket_adapter.getResponse();
-        if (!response.empty()) {
-            bool write_success = co_await write_response_with_timeout(socket, response);
-            if (!write_success) {
-                // Write timeout or error - terminate connection
-                http.sock.release();
-                co_return;
-            }
-        }
-
-        // Handle keep-alive
-        while (keep_alive && !stopping_) {
-            // Create new adapter for next request
-            AsioSocketAdapter next_adapter(&socket, client_endpoint);
-            http.sock.release(); // Release the previous adapter
-            http.sock = std::unique_ptr<Socket>(&next_adapter);
-
-            // Subsequent requests use timeout
-            header = co_await read_http_request(socket, true);
-            if (header.empty()) {
-                http.sock.release(); // Don't delete stack object
-                break;               // Timeout or connection closed
-            }
-
-            // Provide the request data to the adapter
-            next_adapter.setRequestData(header);
-
-            keep_alive = http.parseHeader(header);
-
-            // Send the response with timeout protection
-            response = next_adapter.getResponse();
-            if (!response.empty()) {
-                bool write_success = co_await write_response_with_timeout(socket, response);
-                if (!write_success) {
-                    // Write timeout or error - terminate connection
-                    http.sock.release();
-                    break;
-                }
-            }
-        }
-
-        // Don't delete the adapter if we didn't break out of the loop
-        if (http.sock) {
-            http.sock.release();
-        }
+        co_await driver.serve(head_size, stopping_);
 
         // Increment request count for test mode
         int count = ++request_count_;
@@ -152,114 +109,9 @@ asio::awaitable<void> AsioServer::handle_connection(tcp::socket socket) {
     }
 }
 
-asio::awaitable<std::string> AsioServer::read_http_request(tcp::socket& socket, bool use_timeout) {
-    try {
-        std::string request;
-        asio::streambuf buffer;
-
-        if (use_timeout) {
-            // Use keep-alive timeout for subsequent requests
-            asio::steady_timer timer(socket.get_executor());
-            timer.expires_after(std::chrono::seconds(ConnectionTimeouts::KEEPALIVE_TIMEOUT_SEC));
-
-            // Race between read and timeout
-            auto result = co_await (asio::async_read_until(socket, buffer, "\r\n\r\n",
-                                                           asio::as_tuple(asio::use_awaitable)) ||
-                                    timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-            if (result.index() == 1) {
-                // Timeout occurred
-                socket.cancel();
-                co_return "";
-            }
-
-            // Check for read error
-            auto [ec, bytes] = std::get<0>(result);
-            if (ec) {
-                co_return "";
-            }
-        } else {
-            // Use header read timeout for initial request (protects against Slowloris)
-            asio::steady_timer timer(socket.get_executor());
-            timer.expires_after(std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
-
-            // Race between read and timeout
-            auto result = co_await (asio::async_read_until(socket, buffer, "\r\n\r\n",
-                                                           asio::as_tuple(asio::use_awaitable)) ||
-                                    timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-            if (result.index() == 1) {
-                // Timeout occurred - likely Slowloris attack
-                socket.cancel();
-                co_return "";
-            }
-
-            // Check for read error
-            auto [ec, bytes] = std::get<0>(result);
-            if (ec) {
-                co_return "";
-            }
-        }
-
-        // Convert buffer to string
-        std::istream stream(&buffer);
-        std::string line;
-        while (std::getline(stream, line)) {
-            request += line + "\n";
-            if (line == "\r" || line.empty()) {
-                break;
-            }
-        }
-
-        co_return request;
-
-    } catch (const std::exception& e) {
-        co_return "";
-    }
-}
-
-asio::awaitable<void> AsioServer::write_response(tcp::socket& socket, const std::string& response) {
-    try {
-        co_await asio::async_write(socket, asio::buffer(response), asio::use_awaitable);
-    } catch (const std::exception& e) {
-        // Write error - client may have disconnected
-    }
-}
-
-asio::awaitable<bool> AsioServer::write_response_with_timeout(tcp::socket& socket,
-                                                              const std::string& response) {
-    try {
-        // Set up timeout for writing response (protects against Slow Read attacks)
-        asio::steady_timer timer(socket.get_executor());
-        timer.expires_after(std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
-
-        // Race between write and timeout
-        auto result = co_await (asio::async_write(socket, asio::buffer(response),
-                                                  asio::as_tuple(asio::use_awaitable)) ||
-                                timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-        if (result.index() == 1) {
-            // Timeout occurred - likely Slow Read attack
-            socket.cancel();
-            co_return false;
-        }
-
-        // Check for write error
-        auto [ec, bytes_written] = std::get<0>(result);
-        if (ec) {
-            co_return false;
-        }
-
-        co_return true;
-    } catch (const std::exception& e) {
-        // Write error - client may have disconnected
-        co_return false;
-    }
-}
-
-bool AsioServer::is_websocket_upgrade(const std::string& header) {
+bool AsioServer::is_websocket_upgrade(std::string_view header) {
     // Convert header to lowercase for case-insensitive comparison
-    std::string lower_header = header;
+    std::string lower_header(header);
     std::transform(lower_header.begin(), lower_header.end(), lower_header.begin(), ::tolower);
 
     // Check for "upgrade: websocket" and "connection: upgrade"
@@ -2,6 +2,7 @@
 #define ASIO_SERVER_H
 
 #include "connection_timeouts.h"
+#include "timer_wheel.h"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/asio/awaitable.hpp>
@@ -10,10 +11,10 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/signal_set.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/use_awaitable.hpp>
 #include <memory>
 #include <string>
+#include <string_view>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
@@ -26,6 +27,9 @@ class AsioServer {
     void run();
     void stop();
 
+    // Port actually bound (differs from the requested one when that was 0)
+    int port() const { return acceptor_.local_endpoint().port(); }
+
   private:
     // Coroutine to accept connections
     asio::awaitable<void> listener();
@@ -33,20 +37,11 @@ class AsioServer {
     // Coroutine to handle a single connection
     asio::awaitable<void> handle_connection(tcp::socket socket);
 
-    // Coroutine to read HTTP request with timeout
-    asio::awaitable<std::string> read_http_request(tcp::socket& socket, bool use_timeout = false);
-
-    // Write response to socket
-    asio::awaitable<void> write_response(tcp::socket& socket, const std::string& response);
-
-    // Write response with timeout protection (for slow read attack prevention)
-    asio::awaitable<bool> write_response_with_timeout(tcp::socket& socket,
-                                                      const std::string& response);
-
     // Check if request is a WebSocket upgrade
-    bool is_websocket_upgrade(const std::string& header);
+    bool is_websocket_upgrade(std::string_view header);
 
     asio::io_context io_context_;
+    TimerWheel timers_; // Per-stage connection timeouts
     tcp::acceptor acceptor_;
     asio::signal_set signals_;
 
@@ -1,9 +1,16 @@
 #include "asio_socket_adapter.h"
+#include "open_file_cache.h"
 #include <cstring>
 #include <iostream>
+#include <string>
 
 AsioSocketAdapter::AsioSocketAdapter(tcp::socket* asio_socket, const tcp::endpoint& client_endpoint)
-    : Socket(), asio_socket_(asio_socket) {
+    : Socket() {
+    bind(asio_socket, client_endpoint);
+}
+
+void AsioSocketAdapter::bind(tcp::socket* asio_socket, const tcp::endpoint& client_endpoint) {
+    asio_socket_ = asio_socket;
     (void)asio_socket_; // Currently unused but kept for future use
 
     // Set up client address for logging
@@ -20,10 +27,10 @@ AsioSocketAdapter::AsioSocketAdapter(tcp::socket* asio_socket, const tcp::endpoi
 }
 
 void AsioSocketAdapter::write_line(std::string_view line) {
-    response_buffer_ << line;
+    output_.append(line);
     // The base class adds newline, but we want to preserve exact output
     if (!line.empty() && line.back() != '\n') {
-        response_buffer_ << '\n';
+        output_.append("\n");
     }
 }
 
@@ -32,21 +39,17 @@ bool AsioSocketAdapter::read_line(std::string* buffer) {
         return false;
     }
 
-    // Read until newline or end of data
-    buffer->clear();
-    while (request_pos_ < request_data_.size()) {
-        char c = request_data_[request_pos_++];
-        buffer->push_back(c);
-        if (c == '\n') {
-            break;
-        }
-    }
+    // Up to and including the newline, or to the end of the data
+    size_t end = request_data_.find('\n', request_pos_);
+    end = end == std::string_view::npos ? request_data_.size() : end + 1;
+    buffer->assign(request_data_.substr(request_pos_, end - request_pos_));
+    request_pos_ = end;
 
     return !buffer->empty();
 }
 
 int AsioSocketAdapter::write_raw(const char* data, size_t size) {
-    response_buffer_.write(data, size);
+    output_.append(std::string_view(data, size));
     return size; // Always successful in buffer mode
 }
 
@@ -65,4 +68,33 @@ ssize_t AsioSocketAdapter::read_raw(char* buffer, size_t size) {
     }
 
     return to_read;
-}
\ No newline at end of file
+}
+
+bool AsioSocketAdapter::send_file(std::shared_ptr<const OpenFileCache::File> file, off_t offset,
+                                  size_t count) {
+    if (!file_send_enabled_ || output_.file().fd >= 0 || file->fd() < 0) {
+        return false; // One file per response
+    }
+
+    // The descriptor may be shared with other responses through the open file cache
+    int fd = file->fd();
+    output_.append_file(fd, offset, count, std::move(file));
+    return true;
+}
+
+bool AsioSocketAdapter::stream_response(BodyProducer producer) {
+    if (!streaming_enabled_) {
+        return false;
+    }
+    body_producer_ = std::move(producer);
+    return true;
+}
+
+bool AsioSocketAdapter::forward_fastcgi(std::vector<std::pair<std::string, std::string>> params,
+                                        std::string body) {
+    if (!fastcgi_enabled_) {
+        return false;
+    }
+    forwarded_ = ForwardedRequest{std::move(params), std::move(body)};
+    return true;
+}
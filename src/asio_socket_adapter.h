@@ -1,10 +1,18 @@
 #ifndef ASIO_SOCKET_ADAPTER_H
 #define ASIO_SOCKET_ADAPTER_H
 
+#include "body_framing.h"
+#include "form_parser.h"
+#include "output_chain.h"
 #include "socket.h"
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <memory>
-#include <sstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
@@ -12,35 +20,106 @@ using tcp = asio::ip::tcp;
 // Adapter class that makes ASIO socket look like the old Socket interface
 class AsioSocketAdapter : public Socket {
   public:
+    AsioSocketAdapter() : Socket() { client = {}; }
     AsioSocketAdapter(tcp::socket* asio_socket, const tcp::endpoint& client_endpoint);
+    ~AsioSocketAdapter() override = default;
 
-    // Override Socket methods to write to string buffer instead
+    // Point the adapter at a new connection (adapters are reused across connections)
+    void bind(tcp::socket* asio_socket, const tcp::endpoint& client_endpoint);
+
+    // Override Socket methods to queue output in the chain instead
     void write_line(std::string_view line) override;
     bool read_line(std::string* buffer) override;
     ssize_t read_raw(char* buffer, size_t size) override;
     int write_raw(const char* data, size_t size) override;
+    void write_shared(std::shared_ptr<const std::string> data) override {
+        output_.append(std::move(data));
+    }
+    std::string_view buffered_input() const override { return request_data_.substr(request_pos_); }
+    void skip(size_t count) override {
+        request_pos_ += std::min(count, request_data_.size() - request_pos_);
+    }
 
-    // Get accumulated response
-    std::string getResponse() const { return response_buffer_.str(); }
+    // The queued response, which the connection sends with gather writes
+    OutputChain& output() { return output_; }
+    const OutputChain& output() const { return output_; }
 
-    // Set request data for reading
-    void setRequestData(const std::string& data) {
+    // The response's memory segments copied into one string (for tests)
+    std::string getResponse() const { return output_.str(); }
+
+    // Set request data for reading (the request body, not copied; must outlive the request)
+    void setRequestData(std::string_view data) {
         request_data_ = data;
         request_pos_ = 0;
     }
 
-    // Add raw data to response (for sendFile)
-    void write_rawData(const char* data, size_t size) { response_buffer_.write(data, size); }
+    // Bytes of request data consumed through read_line()/read_raw()
+    size_t consumed() const { return request_pos_; }
+
+    // File region queued by send_file(), sent by the connection after the memory before it
+    using FileBody = OutputChain::FileRange;
+
+    // Set by the connection driver when its stream can send files (plain TCP or kTLS)
+    void setFileSendEnabled(bool enabled) { file_send_enabled_ = enabled; }
+    bool can_send_file() const override { return file_send_enabled_; }
+    bool send_file(std::shared_ptr<const OpenFileCache::File> file, off_t offset,
+                   size_t count) override;
+
+    const FileBody& fileBody() const { return output_.file(); }
+
+    // Request left to the FastCGI application by forward_fastcgi()
+    struct ForwardedRequest {
+        std::vector<std::pair<std::string, std::string>> params;
+        std::string body;
+    };
+
+    // Set by the connection driver when a FastCGI application is configured
+    void setFastCgiEnabled(bool enabled) { fastcgi_enabled_ = enabled; }
+    bool can_forward_fastcgi() const override { return fastcgi_enabled_; }
+    bool forward_fastcgi(std::vector<std::pair<std::string, std::string>> params,
+                         std::string body) override;
+
+    // The forwarded request, if any, for the connection to stream instead of the response buffer
+    std::optional<ForwardedRequest> takeForwardedRequest() {
+        return std::exchange(forwarded_, std::nullopt);
+    }
+
+    // Form body parsed by the connection as it arrived, for Http to answer
+    void setParsedForm(std::unique_ptr<FormParser> form) { parsed_form_ = std::move(form); }
+    FormParser* parsed_form() override { return parsed_form_.get(); }
+
+    // Framing of a script's body the connection streams to the application itself
+    void setStreamedBody(std::optional<BodyFraming> framing) { streamed_body_ = framing; }
+    const BodyFraming* streamed_body() const override {
+        return streamed_body_ ? &*streamed_body_ : nullptr;
+    }
+
+    // Set by the connection driver, which sends streamed bodies after the response buffer
+    void setStreamingEnabled(bool enabled) { streaming_enabled_ = enabled; }
+    bool can_stream_response() const override { return streaming_enabled_; }
+    bool stream_response(BodyProducer producer) override;
+
+    // The producer of the response body, if Http streamed it, for the connection to run
+    std::optional<BodyProducer> takeBodyProducer() {
+        return std::exchange(body_producer_, std::nullopt);
+    }
 
   private:
-    tcp::socket* asio_socket_; // Not owned
-    std::stringstream response_buffer_;
-    std::string request_data_;
+    tcp::socket* asio_socket_ = nullptr; // Not owned
+    OutputChain output_;
+    std::string_view request_data_;
     size_t request_pos_ = 0;
+    bool file_send_enabled_ = false;
+    bool fastcgi_enabled_ = false;
+    std::optional<ForwardedRequest> forwarded_;
+    std::unique_ptr<FormParser> parsed_form_;
+    std::optional<BodyFraming> streamed_body_;
+    bool streaming_enabled_ = false;
+    std::optional<BodyProducer> body_producer_;
 
     // Disable copy/move since we don't own the socket
     AsioSocketAdapter(const AsioSocketAdapter&) = delete;
     AsioSocketAdapter& operator=(const AsioSocketAdapter&) = delete;
 };
 
-#endif // ASIO_SOCKET_ADAPTER_H
\ No newline at end of file
+#endif // ASIO_SOCKET_ADAPTER_H
@@ -1,17 +1,19 @@
 #include "asio_ssl_server.h"
-#include "asio_socket_adapter.h"
+#include "asio_connection_driver.h"
+#include "asio_http_connection.h"
+#include "blocking_pool.h"
 #include "connection_timeouts.h"
 #include "http.h"
-#include <boost/asio/experimental/awaitable_operators.hpp>
+#include "ktls_stream.h"
+#include "metrics.h"
 #include <chrono>
 #include <iostream>
 
-using namespace boost::asio::experimental::awaitable_operators;
-
 AsioSSLServer::AsioSSLServer(int port, SSLContext& ssl_context, int test_requests)
-    : ssl_context_(ssl_context.get_context()),
+    : timers_(io_context_.get_executor()), ssl_context_(ssl_context.get_context()),
       acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)),
-      signals_(io_context_, SIGINT, SIGTERM), port_(port), test_requests_(test_requests) {
+      signals_(io_context_, SIGINT, SIGTERM), port_(port), use_ktls_(ssl_context.ktls_enabled()),
+      test_requests_(test_requests) {
     if (!ssl_context.is_configured()) {
         throw std::runtime_error(
             "SSL context not properly configured. Load certificate and key first.");
@@ -30,7 +32,11 @@ AsioSSLServer::AsioSSLServer(int port, SSLContext& ssl_context, int test_request
     signals_.async_wait([this](std::error_code /*ec*/, int /*signo*/) { stop(); });
 }
 
-AsioSSLServer::~AsioSSLServer() { stop(); }
+AsioSSLServer::~AsioSSLServer() {
+    stop();
+    // Workers may still be finishing requests for this io_context
+    BlockingPool::getInstance().drain();
+}
 
 void AsioSSLServer::run() {
     // Start accepting connections
@@ -57,12 +63,20 @@ asio::awaitable<void> AsioSSLServer::listener() {
         while (!stopping_) {
             // Accept TCP connection
             auto socket = co_await acceptor_.async_accept(asio::use_awaitable);
-
-            // Wrap in SSL stream
-            ssl_socket ssl_sock(std::move(socket), ssl_context_);
+            Metrics::increment(Metrics::Counter::ConnectionsAccepted);
 
             // Handle each connection concurrently
-            asio::co_spawn(io_context_, handle_connection(std::move(ssl_sock)), asio::detached);
+            if (use_ktls_) {
+                // OpenSSL on the socket itself, so it can switch to kernel TLS
+                KtlsStream ktls_stream(std::move(socket), ssl_context_);
+                asio::co_spawn(io_context_, handle_connection(std::move(ktls_stream)),
+                               asio::detached);
+            } else {
+                // Wrap in SSL stream
+                ssl_socket ssl_sock(std::move(socket), ssl_context_);
+                asio::co_spawn(io_context_, handle_connection(std::move(ssl_sock)),
+                               asio::detached);
+            }
         }
     } catch (const std::exception& e) {
         if (!stopping_) {
@@ -71,65 +85,57 @@ asio::awaitable<void> AsioSSLServer::listener() {
     }
 }
 
-asio::awaitable<void> AsioSSLServer::handle_connection(ssl_socket socket) {
+template <typename Stream>
+asio::awaitable<void> AsioSSLServer::handle_connection(Stream socket) {
+    Metrics::GaugeGuard active_connection(Metrics::Gauge::ActiveTlsConnections);
+
     try {
         // Get client endpoint for logging (before handshake)
         auto client_endpoint = socket.lowest_layer().remote_endpoint();
 
         // Perform SSL handshake with timeout
-        asio::steady_timer handshake_timer(socket.get_executor());
-        handshake_timer.expires_after(
-            std::chrono::seconds(ConnectionTimeouts::SSL_HANDSHAKE_TIMEOUT_SEC));
-
-        auto handshake_result = co_await (
-            socket.async_handshake(ssl::stream_base::server, asio::as_tuple(asio::use_awaitable)) ||
-            handshake_timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-        if (handshake_result.index() == 1) {
+        Deadline deadline(timers_, [&socket] {
+            boost::system::error_code ignored;
+            socket.lowest_layer().cancel(ignored);
+        });
+        deadline.arm(std::chrono::seconds(ConnectionTimeouts::SSL_HANDSHAKE_TIMEOUT_SEC));
+
+        auto handshake_start = std::chrono::steady_clock::now();
+        auto [handshake_ec] = co_await socket.async_handshake(
+            ssl::stream_base::server, asio::as_tuple(asio::use_awaitable));
+        auto handshake_time = std::chrono::steady_clock::now() - handshake_start;
+        deadline.cancel();
+
+        if (deadline.expired()) {
             // Handshake timeout
             std::cerr << "SSL handshake timeout from " << client_endpoint << std::endl;
+            Metrics::record_tls_handshake(handshake_time, false);
             co_return;
         }
-
-        auto [handshake_ec] = std::get<0>(handshake_result);
         if (handshake_ec) {
             std::cerr << "SSL handshake failed: " << handshake_ec.message() << std::endl;
+            Metrics::record_tls_handshake(handshake_time, false);
             co_return;
         }
+        Metrics::record_tls_handshake(handshake_time, true,
+                                      SSL_session_reused(socket.native_handle()) == 1);
 
-        // Create socket adapter (Note: We'll need to modify this for SSL)
-        // For now, we'll work with the socket directly similar to AsioServer
-        // TODO: Create SSL-aware socket adapter
-
-        // Create HTTP handler
-        Http http;
+        // Same request loop as plain HTTP, over the encrypted stream
+        auto connection = AsioHttpConnection::acquire(&socket.next_layer(), client_endpoint);
+        AsioConnectionDriver<Stream> driver(socket, *connection, timers_);
 
-        // First request doesn't use timeout
-        std::string header = co_await read_http_request(socket, false);
-        if (header.empty()) {
+        // First request uses the header read timeout (protects against Slowloris)
+        size_t head_size = co_await driver.read_request_head(
+            std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
+        if (head_size == 0) {
             co_return;
         }
+        co_await driver.serve(head_size, stopping_);
 
-        // For SSL we need to create a custom adapter that works with SSL streams
-        // For now, we'll use a simpler approach similar to the fork model
-        // Parse and handle the request
-        // Note: This is simplified - full integration with Http class requires
-        // an SSL-aware socket adapter
-
-        // Send a basic HTTPS response for testing
-        std::string response = "HTTP/1.1 200 OK\r\n"
-                               "Content-Type: text/html\r\n"
-                               "Content-Length: 85\r\n"
-                               "Connection: close\r\n"
-                               "\r\n"
-                               "<html><body><h1>HTTPS Works!</h1><p>SSL/TLS connection "
-                               "established.</p></body></html>";
-
-        co_await write_response(socket, response);
-
-        // Gracefully shutdown SSL
-        boost::system::error_code shutdown_ec;
-        co_await socket.async_shutdown(asio::redirect_error(asio::use_awaitable, shutdown_ec));
+        // Send close_notify, bounded so an unresponsive client can't hold the connection
+        deadline.arm(std::chrono::seconds(ConnectionTimeouts::SSL_HANDSHAKE_TIMEOUT_SEC));
+        co_await socket.async_shutdown(asio::as_tuple(asio::use_awaitable));
+        deadline.cancel();
 
         // Increment request count for test mode
         int count = ++request_count_;
@@ -143,103 +149,3 @@ asio::awaitable<void> AsioSSLServer::handle_connection(ssl_socket socket) {
         // SSL errors are also common (e.g., client doesn't support TLS version)
     }
 }
-
-asio::awaitable<std::string> AsioSSLServer::read_http_request(ssl_socket& socket,
-                                                              bool use_timeout) {
-    try {
-        std::string request;
-        asio::streambuf buffer;
-
-        if (use_timeout) {
-            // Use keep-alive timeout for subsequent requests
-            asio::steady_timer timer(socket.get_executor());
-            timer.expires_after(std::chrono::seconds(ConnectionTimeouts::KEEPALIVE_TIMEOUT_SEC));
-
-            // Race between read and timeout
-            auto result = co_await (asio::async_read_until(socket, buffer, "\r\n\r\n",
-                                                           asio::as_tuple(asio::use_awaitable)) ||
-                                    timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-            if (result.index() == 1) {
-                // Timeout occurred
-                co_return "";
-            }
-
-            auto [ec, bytes_transferred] = std::get<0>(result);
-            if (ec || bytes_transferred == 0) {
-                co_return "";
-            }
-        } else {
-            // Use header read timeout for initial request (protects against Slowloris)
-            asio::steady_timer timer(socket.get_executor());
-            timer.expires_after(std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
-
-            // Race between read and timeout
-            auto result = co_await (asio::async_read_until(socket, buffer, "\r\n\r\n",
-                                                           asio::as_tuple(asio::use_awaitable)) ||
-                                    timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-            if (result.index() == 1) {
-                // Timeout occurred - likely Slowloris attack
-                co_return "";
-            }
-
-            auto [ec, bytes_transferred] = std::get<0>(result);
-            if (ec || bytes_transferred == 0) {
-                co_return "";
-            }
-        }
-
-        // Convert buffer to string
-        std::istream is(&buffer);
-        std::string line;
-        while (std::getline(is, line) && line != "\r") {
-            request += line + "\n";
-        }
-        request += "\n"; // Add final newline
-
-        co_return request;
-
-    } catch (const std::exception& e) {
-        co_return "";
-    }
-}
-
-asio::awaitable<void> AsioSSLServer::write_response(ssl_socket& socket,
-                                                    const std::string& response) {
-    try {
-        co_await asio::async_write(socket, asio::buffer(response), asio::use_awaitable);
-    } catch (const std::exception& e) {
-        // Write error - client may have disconnected
-    }
-}
-
-asio::awaitable<bool> AsioSSLServer::write_response_with_timeout(ssl_socket& socket,
-                                                                 const std::string& response) {
-    try {
-        // Set up timeout for writing response (protects against Slow Read attacks)
-        asio::steady_timer timer(socket.get_executor());
-        timer.expires_after(std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
-
-        // Race between write and timeout
-        auto result = co_await (asio::async_write(socket, asio::buffer(response),
-                                                  asio::as_tuple(asio::use_awaitable)) ||
-                                timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-        if (result.index() == 1) {
-            // Timeout occurred - likely Slow Read attack
-            co_return false;
-        }
-
-        // Check for write error
-        auto [ec, bytes_written] = std::get<0>(result);
-        if (ec) {
-            co_return false;
-        }
-
-        co_return true;
-    } catch (const std::exception& e) {
-        // Write error - client may have disconnected
-        co_return false;
-    }
-}
@@ -3,6 +3,7 @@
 
 #include "connection_timeouts.h"
 #include "ssl_context.h"
+#include "timer_wheel.h"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/asio/awaitable.hpp>
@@ -12,7 +13,6 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/ssl.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/use_awaitable.hpp>
 #include <memory>
 #include <string>
@@ -23,7 +23,13 @@ using ssl_socket = boost::asio::ssl::stream<tcp::socket>;
 
 /**
  * ASIO-based HTTPS server with SSL/TLS support
- * Uses coroutines for async I/O and SSL streams for encryption
+ * Uses coroutines for async I/O and SSL streams for encryption. After the
+ * handshake, requests go through the same AsioConnectionDriver loop as
+ * AsioServer, with keep-alive over the established TLS session.
+ *
+ * When the SSLContext has kTLS enabled, connections use KtlsStream instead of
+ * ssl::stream so OpenSSL can hand encryption to the kernel and large files
+ * are sent with SSL_sendfile.
  */
 class AsioSSLServer {
   public:
@@ -50,25 +56,17 @@ class AsioSSLServer {
     // Coroutine to accept connections
     asio::awaitable<void> listener();
 
-    // Coroutine to handle a single SSL connection
-    asio::awaitable<void> handle_connection(ssl_socket socket);
-
-    // Coroutine to read HTTP request with timeout (over SSL)
-    asio::awaitable<std::string> read_http_request(ssl_socket& socket, bool use_timeout = false);
-
-    // Write response to SSL socket
-    asio::awaitable<void> write_response(ssl_socket& socket, const std::string& response);
-
-    // Write response with timeout protection (for slow read attack prevention)
-    asio::awaitable<bool> write_response_with_timeout(ssl_socket& socket,
-                                                      const std::string& response);
+    // Coroutine to handle a single SSL connection (ssl_socket, or KtlsStream in kTLS mode)
+    template <typename Stream> asio::awaitable<void> handle_connection(Stream socket);
 
     asio::io_context io_context_;
+    TimerWheel timers_; // Handshake and per-stage connection timeouts
     ssl::context& ssl_context_;
     tcp::acceptor acceptor_;
     asio::signal_set signals_;
 
     int port_;
+    bool use_ktls_;
     int test_requests_;
     std::atomic<int> request_count_{0};
     bool stopping_{false};
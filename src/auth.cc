@@ -1,4 +1,5 @@
 #include "auth.h"
+#include "metrics.h"
 #include <algorithm>
 #include <cctype>
 #include <fstream>
@@ -18,6 +19,9 @@ Auth::Auth() {
     if (sodium_init() < 0) {
         throw std::runtime_error("Failed to initialize libsodium");
     }
+
+    // Per-process key for the verified-credential cache digests
+    randombytes_buf(cache_key_.data(), cache_key_.size());
 }
 
 /**
@@ -153,9 +157,9 @@ bool Auth::verify_password(const std::string& password, const std::string& hash)
  * Generate a random nonce for Digest authentication
  */
 std::string Auth::generate_nonce() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> dis(0, 15);
+    // Requests are handled on blocking pool workers, so each thread has its own generator
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<> dis(0, 15);
 
     std::ostringstream ss;
     ss << std::hex;
@@ -401,10 +405,55 @@ bool Auth::validate_basic_auth(const std::string& auth_header) {
         return false;
     }
 
+    // argon2id is deliberately slow, so remember credentials that verified
+    // recently. Entries are tied to the stored hash and die with a password change.
+    std::string digest;
+    if (verified_cache_ttl_ > 0) {
+        digest = credential_digest(username_it->second, password_it->second);
+        auto cached = verified_cache_.find(digest);
+        if (cached != verified_cache_.end()) {
+            if (cached->second.expires > std::chrono::steady_clock::now() &&
+                cached->second.username == user_it->first &&
+                cached->second.password_hash == user_it->second) {
+                Metrics::increment(Metrics::Counter::AuthCacheHits);
+                return true;
+            }
+            verified_cache_.erase(cached);
+        }
+        Metrics::increment(Metrics::Counter::AuthCacheMisses);
+    }
+
     // Verify password using constant-time comparison (prevents timing attacks)
     // user_it->second contains the argon2id hash
     // password_it->second contains the plaintext password from the client
-    return verify_password(password_it->second, user_it->second);
+    if (!verify_password(password_it->second, user_it->second)) {
+        return false;
+    }
+
+    if (verified_cache_ttl_ > 0) {
+        // Drop the entry nearest to expiring when full. Clearing them all would
+        // send every client back through argon2id at once.
+        if (verified_cache_.size() >= MAX_VERIFIED_CACHE && !verified_cache_.contains(digest)) {
+            verified_cache_.erase(std::ranges::min_element(
+                verified_cache_, {}, [](const auto& entry) { return entry.second.expires; }));
+        }
+        verified_cache_[digest] = VerifiedCredential{
+            user_it->first, user_it->second,
+            std::chrono::steady_clock::now() + std::chrono::seconds(verified_cache_ttl_)};
+    }
+    return true;
+}
+
+/**
+ * Keyed BLAKE2b digest of a username/password pair for the verified-credential cache
+ */
+std::string Auth::credential_digest(const std::string& username, const std::string& password) {
+    std::string input = username + ":" + password;
+    std::array<unsigned char, crypto_generichash_BYTES> out;
+    crypto_generichash(out.data(), out.size(), reinterpret_cast<const unsigned char*>(input.data()),
+                       input.size(), cache_key_.data(), cache_key_.size());
+    sodium_memzero(input.data(), input.size());
+    return std::string(reinterpret_cast<const char*>(out.data()), out.size());
 }
 
 /**
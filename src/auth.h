@@ -1,10 +1,12 @@
 #ifndef SHELOB_AUTH_H
 #define SHELOB_AUTH_H 1
 
+#include <array>
 #include <chrono>
 #include <map>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 /**
  * Authentication manager for HTTP Basic and Digest authentication
@@ -28,6 +30,21 @@ class Auth {
     // Nonce timeout in seconds
     int nonce_timeout_ = 300; // 5 minutes
 
+    // Recently verified Basic credentials, so repeat requests skip argon2id.
+    // Keyed by a keyed BLAKE2b digest of "username:password"; the password
+    // itself is never stored. When full, the oldest entry makes room.
+    struct VerifiedCredential {
+        std::string username;
+        std::string password_hash; // Hash the credential was verified against
+        std::chrono::steady_clock::time_point expires;
+    };
+    std::unordered_map<std::string, VerifiedCredential> verified_cache_;
+    std::array<unsigned char, 32> cache_key_{};
+    int verified_cache_ttl_ = 60; // seconds, 0 disables the cache
+    static constexpr size_t MAX_VERIFIED_CACHE = 1024;
+
+    std::string credential_digest(const std::string& username, const std::string& password);
+
     // Base64 encoding/decoding
     std::string base64_encode(const std::string& input);
     std::string base64_decode(const std::string& input);
@@ -72,6 +89,7 @@ class Auth {
 
     // Configuration
     void set_nonce_timeout(int seconds) { nonce_timeout_ = seconds; }
+    void set_verified_cache_ttl(int seconds) { verified_cache_ttl_ = seconds; }
     void load_users_from_file(const std::string& filename);
 };
 
@@ -0,0 +1,84 @@
+#include "blocking_pool.h"
+
+namespace {
+
+size_t& configuredThreads() {
+    static size_t threads = BlockingPool::DEFAULT_THREADS;
+    return threads;
+}
+
+} // namespace
+
+BlockingPool& BlockingPool::getInstance() {
+    static BlockingPool instance(configuredThreads());
+    return instance;
+}
+
+void BlockingPool::configure(size_t threads) { configuredThreads() = threads; }
+
+BlockingPool::BlockingPool(size_t threads, size_t max_queued) : max_queued_(max_queued) {
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this] { worker(); });
+    }
+}
+
+BlockingPool::~BlockingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t BlockingPool::queued() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void BlockingPool::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return queue_.empty() && running_ == 0; });
+}
+
+bool BlockingPool::submit(Task& task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (workers_.empty() || stopping_ || queue_.size() >= max_queued_) {
+            return false;
+        }
+        queue_.push_back({std::move(task), std::chrono::steady_clock::now()});
+    }
+    Metrics::add(Metrics::Gauge::BlockingQueueDepth, 1);
+    ready_.notify_one();
+    return true;
+}
+
+void BlockingPool::worker() {
+    while (true) {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return; // Stopping, and everything queued has run
+            }
+            entry = std::move(queue_.front());
+            queue_.pop_front();
+            ++running_;
+        }
+        Metrics::add(Metrics::Gauge::BlockingQueueDepth, -1);
+        Metrics::record_blocking_wait(std::chrono::steady_clock::now() - entry.queued_at);
+        entry.task();
+        entry.task = nullptr; // Release the handler before reporting idle
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --running_;
+        }
+        idle_.notify_all();
+    }
+}
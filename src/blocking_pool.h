@@ -0,0 +1,145 @@
+#ifndef BLOCKING_POOL_H
+#define BLOCKING_POOL_H
+
+#include "metrics.h"
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace asio = boost::asio;
+
+/**
+ * Bounded thread pool for work that would stall an event loop
+ *
+ * Each server runs its io_context on one thread, so a disk read of a cold
+ * file, an Argon2 verification or a gzip of a large response blocks every
+ * other connection on that thread for its duration. Connections co_await
+ * run() instead: the function executes on a worker and the coroutine resumes
+ * on its own executor with the result, while the event loop keeps serving.
+ *
+ * The queue is bounded. When MAX_QUEUED tasks are already waiting, run()
+ * executes the function on the calling thread rather than queueing without
+ * limit, which degrades to the old behaviour under overload instead of
+ * growing memory and latency. A pool with no threads runs everything inline.
+ */
+class BlockingPool {
+  public:
+    static constexpr size_t DEFAULT_THREADS = 4;
+    static constexpr size_t MAX_QUEUED = 1024;
+
+    /**
+     * The process-wide pool, started on first use
+     */
+    static BlockingPool& getInstance();
+
+    /**
+     * Set the number of workers getInstance() starts with
+     * Must be called before the first getInstance(); later calls have no effect.
+     */
+    static void configure(size_t threads);
+
+    explicit BlockingPool(size_t threads, size_t max_queued = MAX_QUEUED);
+    ~BlockingPool();
+
+    BlockingPool(const BlockingPool&) = delete;
+    BlockingPool& operator=(const BlockingPool&) = delete;
+
+    /**
+     * Run fn on a worker and resume the calling coroutine on its executor
+     * Exceptions thrown by fn are rethrown in the caller.
+     */
+    template <typename F> asio::awaitable<std::invoke_result_t<F&>> run(F fn);
+
+    size_t threads() const { return workers_.size(); }
+
+    /**
+     * Tasks currently waiting for a worker
+     */
+    size_t queued();
+
+    /**
+     * Wait until every queued and running task has finished and delivered its
+     * result. Servers call this after stopping their io_context and before
+     * destroying it, so no worker posts to a destroyed executor.
+     */
+    void drain();
+
+  private:
+    using Task = std::move_only_function<void()>;
+
+    /**
+     * Queue a task for the workers
+     * @return false, leaving task untouched, if the queue is full or there are no workers
+     */
+    bool submit(Task& task);
+
+    void worker();
+
+    struct Entry {
+        Task task;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable idle_;
+    std::deque<Entry> queue_;
+    std::vector<std::thread> workers_;
+    size_t max_queued_;
+    size_t running_ = 0;
+    bool stopping_ = false;
+};
+
+template <typename F> asio::awaitable<std::invoke_result_t<F&>> BlockingPool::run(F fn) {
+    using Result = std::invoke_result_t<F&>;
+    using Storage = std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>>;
+
+    // Both live in this coroutine's frame, which stays put while it is suspended
+    Storage result{};
+    std::exception_ptr error;
+
+    auto executor = co_await asio::this_coro::executor;
+    co_await asio::async_initiate<decltype(asio::use_awaitable), void()>(
+        [&](auto handler) {
+            // Keeps the io_context running until the result is delivered
+            auto work = asio::make_work_guard(executor);
+            Task task = [&, handler = std::move(handler), work = std::move(work)]() mutable {
+                try {
+                    if constexpr (std::is_void_v<Result>) {
+                        fn();
+                    } else {
+                        result.emplace(fn());
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                auto resume_on = asio::get_associated_executor(handler, work.get_executor());
+                asio::post(resume_on, std::move(handler));
+            };
+            if (!submit(task)) {
+                Metrics::increment(Metrics::Counter::BlockingTasksInline);
+                task(); // Still resumes through post(), after initiation returns
+            }
+        },
+        asio::use_awaitable);
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if constexpr (!std::is_void_v<Result>) {
+        co_return std::move(*result);
+    }
+}
+
+#endif // BLOCKING_POOL_H
@@ -0,0 +1,65 @@
+#include "body_framing.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+namespace {
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+std::string_view trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+} // namespace
+
+bool BodyFraming::add(std::string_view name, std::string_view value) {
+    value = trim(value);
+    if (name.empty() || name.find_first_of(" \t") != std::string_view::npos) {
+        // "Content-Length : 5" is a Content-Length to some, and ignored by others
+        valid_ = false;
+    } else if (iequals(name, "Content-Length")) {
+        size_t length = 0;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+        if (ec != std::errc() || ptr != value.data() + value.size() ||
+            (content_length_ && *content_length_ != length)) {
+            valid_ = false;
+        }
+        content_length_ = length;
+    } else if (iequals(name, "Transfer-Encoding")) {
+        // Only chunked alone is understood; anything else can't be framed
+        if (chunked_ || !iequals(value, "chunked")) {
+            valid_ = false;
+        }
+        chunked_ = true;
+    }
+    return valid();
+}
+
+std::optional<BodyFraming> BodyFraming::parse(std::string_view head) {
+    BodyFraming framing;
+    size_t line_start = head.find("\r\n");
+    while (line_start != std::string_view::npos) {
+        line_start += 2;
+        size_t line_end = head.find("\r\n", line_start);
+        std::string_view line = head.substr(line_start, line_end - line_start);
+        line_start = line_end;
+
+        size_t colon = line.find(':');
+        if (colon != std::string_view::npos &&
+            !framing.add(line.substr(0, colon), line.substr(colon + 1))) {
+            return std::nullopt;
+        }
+    }
+    return framing;
+}
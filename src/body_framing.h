@@ -0,0 +1,46 @@
+#ifndef BODY_FRAMING_H
+#define BODY_FRAMING_H
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+/**
+ * Where an HTTP/1.1 message's body ends, from its header fields (RFC 9112
+ * section 6)
+ *
+ * Read as strictly as the RFC allows, since a server and a proxy in front of
+ * it that frame the same message differently disagree on where the next
+ * request starts (request smuggling, CWE-444). Field names are compared
+ * without regard to case, and may not hold whitespace. A Content-Length must
+ * be all digits, and repeats of it must agree; Transfer-Encoding must be
+ * chunked alone, given once; and a message with both is refused rather than
+ * letting one of them win.
+ */
+class BodyFraming {
+  public:
+    /**
+     * Take one header field into account
+     * @return False once the fields can't frame a body unambiguously
+     */
+    bool add(std::string_view name, std::string_view value);
+
+    // Whether the fields added so far frame a body unambiguously
+    bool valid() const { return valid_ && !(chunked_ && content_length_); }
+
+    /**
+     * Framing of a message head: a start line, then field lines ending in CRLF
+     * @return Nothing if it isn't valid
+     */
+    static std::optional<BodyFraming> parse(std::string_view head);
+
+    std::optional<size_t> content_length() const { return content_length_; }
+    bool chunked() const { return chunked_; }
+
+  private:
+    std::optional<size_t> content_length_;
+    bool chunked_ = false;
+    bool valid_ = true;
+};
+
+#endif // BODY_FRAMING_H
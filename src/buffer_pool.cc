@@ -0,0 +1,39 @@
+#include "buffer_pool.h"
+#include <vector>
+
+namespace {
+
+std::vector<std::string>& freeList() {
+    thread_local std::vector<std::string> buffers;
+    return buffers;
+}
+
+} // namespace
+
+std::string BufferPool::acquire() {
+    auto& buffers = freeList();
+    if (buffers.empty()) {
+        std::string buffer;
+        buffer.reserve(INITIAL_CAPACITY);
+        return buffer;
+    }
+    std::string buffer = std::move(buffers.back());
+    buffers.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::string&& buffer) {
+    auto& buffers = freeList();
+    if (buffer.capacity() < INITIAL_CAPACITY || buffer.capacity() > MAX_RETAINED_CAPACITY ||
+        buffers.size() >= MAX_POOLED) {
+        std::string().swap(buffer);
+        return;
+    }
+    if (buffers.capacity() == 0) {
+        buffers.reserve(MAX_POOLED);
+    }
+    buffer.clear();
+    buffers.push_back(std::move(buffer));
+}
+
+size_t BufferPool::pooled() { return freeList().size(); }
@@ -0,0 +1,38 @@
+#ifndef SHELOB_BUFFER_POOL_H
+#define SHELOB_BUFFER_POOL_H 1
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Per-thread free list of I/O buffers
+ *
+ * Connections take their input and output buffers from here when a request
+ * arrives and hand them back when they go idle or close, so buffer capacity is
+ * recycled instead of being reallocated for every connection or request.
+ * Each thread has its own list, so there is no locking. Buffers that grew past
+ * MAX_RETAINED_CAPACITY (a large upload or file) are freed rather than pooled.
+ */
+class BufferPool {
+  public:
+    static constexpr size_t INITIAL_CAPACITY = 8192;       // Fits a typical request head
+    static constexpr size_t MAX_RETAINED_CAPACITY = 65536; // Larger buffers are not kept
+    static constexpr size_t MAX_POOLED = 256;              // Per thread
+
+    /**
+     * Get an empty buffer with at least INITIAL_CAPACITY bytes reserved
+     */
+    static std::string acquire();
+
+    /**
+     * Return a buffer to this thread's pool. Its contents are discarded.
+     */
+    static void release(std::string&& buffer);
+
+    /**
+     * Number of buffers currently pooled on the calling thread
+     */
+    static size_t pooled();
+};
+
+#endif /* !SHELOB_BUFFER_POOL_H */
@@ -1,7 +1,5 @@
 #include "cgi.h"
-#include <filesystem>
-#include <iostream>
-#include <sstream>
+#include <cctype>
 
 /* See: http://www.ietf.org/rfc/rfc3875 */
 /* meta-variable-name = "AUTH_TYPE" | "CONTENT_LENGTH" |
@@ -13,64 +11,61 @@
                            "SCRIPT_NAME" | "SERVER_NAME" |
                            "SERVER_PORT" | "SERVER_PROTOCOL" |
                            "SERVER_SOFTWARE" | scheme |*/
-void Cgi::setupEnv(const std::map<std::string, std::string>& headermap) {
-    auto auth_it = headermap.find("AUTH_TYPE");
-    if (auth_it != headermap.end()) {
-        setenv("AUTH_TYPE", auth_it->second.c_str(), 1);
-    }
-
-    auto content_len_it = headermap.find("CONTENT_LENGTH");
-    if (content_len_it != headermap.end()) {
-        setenv("CONTENT_LENGTH", content_len_it->second.c_str(), 1);
-    }
-
-    setenv("GATEWAY_INTERFACE", "CGI/1.1", 1);
-
-    auto query_it = headermap.find("QUERY_STRING");
-    if (query_it != headermap.end()) {
-        setenv("QUERY_STRING", query_it->second.c_str(), 1);
-    }
-
-    setenv("REQUEST_METHOD", "GET", 1);
-    setenv("SERVER_PROTOCOL", "HTTP/1.1", 1);
-    setenv("SERVER_SOFTWARE", "SHELOB/3.14", 1);
-}
-
-bool Cgi::executeCGI(std::string_view filename, int accept_fd,
-                     const std::map<std::string, std::string>& headermap) {
-    int pid;
-    std::string fullpath;
+std::vector<std::pair<std::string, std::string>>
+Cgi::environment(const Request& request, const std::map<std::string, std::string>& headermap) {
+    std::string_view uri = request.uri;
+    size_t question = uri.find('?');
+    std::string_view path = uri.substr(0, question);
+    std::string_view query = question == std::string_view::npos ? "" : uri.substr(question + 1);
 
-    pid = fork();
+    std::vector<std::pair<std::string, std::string>> env = {
+        {"GATEWAY_INTERFACE", "CGI/1.1"},
+        {"SERVER_SOFTWARE", "SHELOB/0.5"},
+        {"SERVER_PROTOCOL", std::string(request.protocol)},
+        {"REQUEST_METHOD", std::string(request.method)},
+        {"REQUEST_URI", std::string(uri)},
+        {"SCRIPT_NAME", std::string(path)},
+        {"SCRIPT_FILENAME", std::string(request.script_filename)},
+        {"DOCUMENT_ROOT", std::string(request.document_root)},
+        {"QUERY_STRING", std::string(query)},
+        {"REMOTE_ADDR", std::string(request.remote_addr)},
+        {"REMOTE_PORT", std::to_string(request.remote_port)},
+        {"CONTENT_LENGTH", request.content_length > 0 ? std::to_string(request.content_length)
+                                                       : std::string()},
+    };
 
-    if (pid < 0) {
-        perror("ERROR on fork");
-        return false; // Fork failed, returning false.
+    // SERVER_NAME and SERVER_PORT come from the Host the client asked for
+    std::string_view host;
+    if (auto host_it = headermap.find("Host"); host_it != headermap.end()) {
+        host = host_it->second;
     }
+    size_t colon = host.rfind(':');
+    bool has_port =
+        colon != std::string_view::npos && host.find(']', colon) == std::string_view::npos;
+    env.emplace_back("SERVER_NAME", std::string(host.substr(0, has_port ? colon : host.size())));
+    env.emplace_back("SERVER_PORT", has_port ? std::string(host.substr(colon + 1)) : "80");
 
-    /* Child */
-    if (pid == 0) {
-        setupEnv(headermap);
-
-        dup2(accept_fd, STDOUT_FILENO);
-
-        std::string filename_str(filename.substr(7));
-        printf("HTTP/1.1 200 OK\r\n");
-
-        try {
-            auto current_path = std::filesystem::current_path();
-            fullpath = (current_path / "htdocs" / filename_str).string();
-        } catch (const std::filesystem::filesystem_error& e) {
-            std::cerr << "Filesystem error: " << e.what() << std::endl;
-            exit(1);
+    for (const auto& [name, value] : headermap) {
+        if (name == request.method) {
+            continue; // The request line, stored under the method
+        }
+        if (name == "Content-Type") {
+            env.emplace_back("CONTENT_TYPE", value);
+            continue;
+        }
+        if (name == "Content-Length" || name == "Proxy") {
+            continue;
+        }
+        if (name == "Authorization") {
+            env.emplace_back("AUTH_TYPE", value.substr(0, value.find(' ')));
         }
 
-        // Added nullptr as sentinel
-        execlp(fullpath.c_str(), filename_str.c_str(), nullptr);
-
-        perror("CGI error");
-        exit(1); // If exec fails, terminate the child process.
+        std::string variable = "HTTP_";
+        for (char c : name) {
+            unsigned char u = static_cast<unsigned char>(c);
+            variable += c == '-' ? '_' : static_cast<char>(std::toupper(u));
+        }
+        env.emplace_back(std::move(variable), value);
     }
-
-    return true; // Successful execution
+    return env;
 }
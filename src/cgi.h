@@ -1,21 +1,40 @@
 #ifndef SHELOB_CGI_H
 #define SHELOB_CGI_H 1
 
-#include <stdlib.h>
-#include <sys/param.h>
-#include <unistd.h>
-
+#include <cstdint>
 #include <map>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "global.h"
 
+/**
+ * CGI/1.1 meta-variables (RFC 3875) for requests handed to an application
+ *
+ * Scripts are no longer forked per request: the variables travel to the
+ * FastCGI application as FCGI_PARAMS (see FastCgiPool).
+ */
 class Cgi {
   public:
-    void setupEnv(const std::map<std::string, std::string>& headermap);
-    bool executeCGI(std::string_view filename, int accept_fd,
-                    const std::map<std::string, std::string>& headermap);
+    struct Request {
+        std::string_view method;
+        std::string_view uri;             // Path and query, as requested
+        std::string_view script_filename; // File the path maps to
+        std::string_view document_root;
+        std::string_view protocol;
+        std::string_view remote_addr;
+        uint16_t remote_port = 0;
+        size_t content_length = 0;
+    };
+
+    /**
+     * The CGI variables for a request, plus an HTTP_* variable for each
+     * request header (except Proxy, see httpoxy)
+     */
+    static std::vector<std::pair<std::string, std::string>>
+    environment(const Request& request, const std::map<std::string, std::string>& headermap);
 };
 
 #endif /* !SHELOB_CGI_H */
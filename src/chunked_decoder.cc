@@ -0,0 +1,125 @@
+#include "chunked_decoder.h"
+#include "request_limits.h"
+#include <algorithm>
+
+namespace {
+
+// Sizes past 2^60 are certainly bogus, and can't overflow
+constexpr size_t MAX_SIZE_DIGITS = 15;
+
+std::optional<unsigned> hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+void ChunkedDecoder::start_data() {
+    chunk_size_ = remaining_;
+    state_ = remaining_ == 0 ? State::TrailerStart : State::Data;
+    digits_ = 0;
+}
+
+std::optional<size_t> ChunkedDecoder::consume(std::string_view input, std::string_view& data) {
+    data = {};
+    size_t pos = 0;
+    while (pos < input.size() && state_ != State::Done) {
+        char c = input[pos];
+        switch (state_) {
+        case State::Size:
+            if (auto digit = hex_value(c)) {
+                if (++digits_ > MAX_SIZE_DIGITS) {
+                    return std::nullopt;
+                }
+                remaining_ = remaining_ * 16 + *digit;
+            } else if (digits_ == 0) {
+                return std::nullopt;
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                state_ = State::Extension;
+                skipped_ = 0;
+            } else if (c == '\r') {
+                state_ = State::SizeLineEnd;
+            } else if (c == '\n') {
+                start_data();
+            } else {
+                return std::nullopt;
+            }
+            break;
+        case State::Extension:
+            if (++skipped_ > RequestLimits::MAX_HEADER_LINE) {
+                return std::nullopt;
+            }
+            if (c == '\n') {
+                start_data();
+            }
+            break;
+        case State::SizeLineEnd:
+            if (c != '\n') {
+                return std::nullopt;
+            }
+            start_data();
+            break;
+        case State::Data: {
+            size_t size = static_cast<size_t>(std::min<uint64_t>(remaining_, input.size() - pos));
+            data = input.substr(pos, size);
+            remaining_ -= size;
+            if (remaining_ == 0) {
+                state_ = State::DataCr;
+            }
+            return pos + size;
+        }
+        case State::DataCr:
+            if (c == '\r') {
+                state_ = State::DataLf;
+            } else if (c == '\n') {
+                state_ = State::Size;
+            } else {
+                return std::nullopt;
+            }
+            break;
+        case State::DataLf:
+            if (c != '\n') {
+                return std::nullopt;
+            }
+            state_ = State::Size;
+            break;
+        case State::TrailerStart:
+            // The empty line ending the body, or a trailer field
+            if (c == '\r') {
+                state_ = State::TrailerEnd;
+            } else if (c == '\n') {
+                state_ = State::Done;
+            } else {
+                state_ = State::Trailer;
+                continue; // Count it as part of the field
+            }
+            break;
+        case State::Trailer:
+            if (++skipped_ > RequestLimits::MAX_HEADER_SIZE) {
+                return std::nullopt;
+            }
+            if (c == '\n') {
+                state_ = State::TrailerStart;
+            }
+            break;
+        case State::TrailerEnd:
+            if (c != '\n') {
+                return std::nullopt;
+            }
+            state_ = State::Done;
+            break;
+        case State::Done:
+            break;
+        }
+        ++pos;
+    }
+    return pos;
+}
@@ -0,0 +1,58 @@
+#ifndef CHUNKED_DECODER_H
+#define CHUNKED_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/**
+ * Incremental parser for a chunked transfer-coded body (RFC 9112 section 7.1)
+ *
+ * Fed whatever bytes have arrived, in pieces split anywhere, it returns chunk
+ * data as slices of the input, so nothing is copied and a body of any size
+ * needs no more memory than the caller's read buffer. Chunk extensions and
+ * trailer fields are skipped. Lines may end with a bare LF.
+ */
+class ChunkedDecoder {
+  public:
+    /**
+     * Parse from the start of input up to and including the next piece of
+     * chunk data, or as far as the input goes
+     * @param data Set to the chunk data consumed (empty if none was reached)
+     * @return Bytes of input consumed, or nothing if the framing is malformed
+     */
+    std::optional<size_t> consume(std::string_view input, std::string_view& data);
+
+    // The last chunk and trailer have been consumed; bytes after them aren't part of the body
+    bool done() const { return state_ == State::Done; }
+
+    // Size of the chunk whose data is being read (or was read last)
+    uint64_t chunk_size() const { return chunk_size_; }
+
+    void reset() { *this = ChunkedDecoder(); }
+
+  private:
+    enum class State : uint8_t {
+        Size,
+        Extension,
+        SizeLineEnd,
+        Data,
+        DataCr,
+        DataLf,
+        TrailerStart,
+        Trailer,
+        TrailerEnd,
+        Done
+    };
+
+    void start_data();
+
+    State state_ = State::Size;
+    uint64_t remaining_ = 0; // Of the current chunk's data, or its size while parsing it
+    size_t digits_ = 0;
+    size_t skipped_ = 0; // Extension or trailer bytes since the last size line
+    uint64_t chunk_size_ = 0;
+};
+
+#endif // CHUNKED_DECODER_H
@@ -0,0 +1,397 @@
+#include "conditional_request.h"
+#include <array>
+#include <cstdint>
+#include <format>
+
+namespace {
+
+constexpr std::array<std::string_view, 7> kDayNames = {"Sun", "Mon", "Tue", "Wed",
+                                                       "Thu", "Fri", "Sat"};
+constexpr std::array<std::string_view, 7> kLongDayNames = {
+    "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+constexpr std::array<std::string_view, 12> kMonthNames = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+/**
+ * Parse exactly `count` decimal digits starting at `pos`.
+ * A leading space is accepted when `allow_space` is set (asctime day field).
+ * Returns -1 on failure.
+ */
+int parseDigits(std::string_view s, size_t pos, size_t count, bool allow_space = false) {
+    if (pos + count > s.size()) {
+        return -1;
+    }
+    int value = 0;
+    for (size_t i = 0; i < count; ++i) {
+        char c = s[pos + i];
+        if (allow_space && i == 0 && c == ' ') {
+            continue;
+        }
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return value;
+}
+
+int monthIndex(std::string_view s) {
+    for (size_t i = 0; i < kMonthNames.size(); ++i) {
+        if (s == kMonthNames[i]) {
+            return static_cast<int>(i) + 1;
+        }
+    }
+    return -1;
+}
+
+template <size_t N>
+bool isOneOf(std::string_view s, const std::array<std::string_view, N>& names) {
+    for (auto name : names) {
+        if (s == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Days since 1970-01-01 for a proleptic Gregorian date
+ * (Howard Hinnant's days_from_civil algorithm)
+ */
+int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+/**
+ * Inverse of daysFromCivil
+ */
+void civilFromDays(int64_t z, int64_t& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+bool isLeapYear(int y) { return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0; }
+
+std::optional<time_t> makeTime(int year, int month, int day, int hour, int minute, int second) {
+    static constexpr int kDaysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || hour > 23 || minute > 59 ||
+        second > 60) {
+        return std::nullopt;
+    }
+    int max_day = kDaysInMonth[month - 1] + (month == 2 && isLeapYear(year) ? 1 : 0);
+    if (day > max_day) {
+        return std::nullopt;
+    }
+
+    int64_t days = daysFromCivil(year, static_cast<unsigned>(month), static_cast<unsigned>(day));
+    return static_cast<time_t>(days * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+/**
+ * Parse "HH:MM:SS" at the given offset
+ */
+bool parseTimeOfDay(std::string_view s, size_t pos, int& hour, int& minute, int& second) {
+    if (pos + 8 > s.size() || s[pos + 2] != ':' || s[pos + 5] != ':') {
+        return false;
+    }
+    hour = parseDigits(s, pos, 2);
+    minute = parseDigits(s, pos + 3, 2);
+    second = parseDigits(s, pos + 6, 2);
+    return hour >= 0 && minute >= 0 && second >= 0;
+}
+
+std::string_view trimOws(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+/**
+ * Strip the surrounding quotes (and an optional weak prefix) from an entity tag
+ */
+std::string_view opaqueTag(std::string_view etag) {
+    if (etag.starts_with("W/")) {
+        etag.remove_prefix(2);
+    }
+    if (etag.size() >= 2 && etag.front() == '"' && etag.back() == '"') {
+        return etag.substr(1, etag.size() - 2);
+    }
+    return etag;
+}
+
+std::string_view findHeader(const std::map<std::string, std::string>& headers,
+                            const std::string& canonical, const std::string& lowercase) {
+    auto it = headers.find(canonical);
+    if (it == headers.end()) {
+        it = headers.find(lowercase);
+    }
+    return it != headers.end() ? std::string_view(it->second) : std::string_view();
+}
+
+} // anonymous namespace
+
+ConditionalHeaders ConditionalHeaders::from(const std::map<std::string, std::string>& headers) {
+    ConditionalHeaders result;
+    result.if_match = findHeader(headers, "If-Match", "if-match");
+    result.if_none_match = findHeader(headers, "If-None-Match", "if-none-match");
+    result.if_modified_since = findHeader(headers, "If-Modified-Since", "if-modified-since");
+    result.if_unmodified_since = findHeader(headers, "If-Unmodified-Since", "if-unmodified-since");
+    result.if_range = findHeader(headers, "If-Range", "if-range");
+    return result;
+}
+
+/**
+ * Parse an HTTP-date per RFC 9110 Section 5.6.7. Recipients must accept all
+ * three historical formats; only IMF-fixdate is ever generated.
+ */
+std::optional<time_t> ConditionalRequest::parseHttpDate(std::string_view date) {
+    date = trimOws(date);
+    int hour = 0, minute = 0, second = 0;
+
+    // IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (date.size() == 29 && date[3] == ',') {
+        if (!isOneOf(date.substr(0, 3), kDayNames) || date[4] != ' ' || date[7] != ' ' ||
+            date[11] != ' ' || date[16] != ' ' || date.substr(25) != " GMT") {
+            return std::nullopt;
+        }
+        int day = parseDigits(date, 5, 2);
+        int month = monthIndex(date.substr(8, 3));
+        int year = parseDigits(date, 12, 4);
+        if (day < 0 || month < 0 || year < 0 || !parseTimeOfDay(date, 17, hour, minute, second)) {
+            return std::nullopt;
+        }
+        return makeTime(year, month, day, hour, minute, second);
+    }
+
+    // asctime: "Sun Nov  6 08:49:37 1994"
+    if (date.size() == 24 && date[3] == ' ') {
+        if (!isOneOf(date.substr(0, 3), kDayNames) || date[7] != ' ' || date[10] != ' ' ||
+            date[19] != ' ') {
+            return std::nullopt;
+        }
+        int month = monthIndex(date.substr(4, 3));
+        int day = parseDigits(date, 8, 2, true);
+        int year = parseDigits(date, 20, 4);
+        if (day < 0 || month < 0 || year < 0 || !parseTimeOfDay(date, 11, hour, minute, second)) {
+            return std::nullopt;
+        }
+        return makeTime(year, month, day, hour, minute, second);
+    }
+
+    // RFC 850: "Sunday, 06-Nov-94 08:49:37 GMT"
+    auto comma = date.find(',');
+    if (comma != std::string_view::npos && date.size() == comma + 24) {
+        if (!isOneOf(date.substr(0, comma), kLongDayNames)) {
+            return std::nullopt;
+        }
+        std::string_view rest = date.substr(comma + 2);
+        if (date[comma + 1] != ' ' || rest[2] != '-' || rest[6] != '-' || rest[9] != ' ' ||
+            rest.substr(18) != " GMT") {
+            return std::nullopt;
+        }
+        int day = parseDigits(rest, 0, 2);
+        int month = monthIndex(rest.substr(3, 3));
+        int year = parseDigits(rest, 7, 2);
+        if (day < 0 || month < 0 || year < 0 || !parseTimeOfDay(rest, 10, hour, minute, second)) {
+            return std::nullopt;
+        }
+        // Two-digit years: 70-99 are 19xx, 00-69 are 20xx
+        year += year >= 70 ? 1900 : 2000;
+        return makeTime(year, month, day, hour, minute, second);
+    }
+
+    return std::nullopt;
+}
+
+void ConditionalRequest::formatHttpDate(time_t time, char (&out)[30]) {
+    int64_t t = static_cast<int64_t>(time);
+    int64_t days = t / 86400;
+    int64_t secs = t % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        --days;
+    }
+
+    int64_t year = 0;
+    unsigned month = 0, day = 0;
+    civilFromDays(days, year, month, day);
+    // 1970-01-01 was a Thursday
+    int64_t weekday = (days % 7 + 11) % 7;
+
+    auto put2 = [&out](size_t pos, unsigned v) {
+        out[pos] = static_cast<char>('0' + v / 10);
+        out[pos + 1] = static_cast<char>('0' + v % 10);
+    };
+
+    std::string_view day_name = kDayNames[static_cast<size_t>(weekday)];
+    std::string_view month_name = kMonthNames[month - 1];
+    out[0] = day_name[0];
+    out[1] = day_name[1];
+    out[2] = day_name[2];
+    out[3] = ',';
+    out[4] = ' ';
+    put2(5, day);
+    out[7] = ' ';
+    out[8] = month_name[0];
+    out[9] = month_name[1];
+    out[10] = month_name[2];
+    out[11] = ' ';
+    unsigned y = static_cast<unsigned>(year % 10000);
+    put2(12, y / 100);
+    put2(14, y % 100);
+    out[16] = ' ';
+    put2(17, static_cast<unsigned>(secs / 3600));
+    out[19] = ':';
+    put2(20, static_cast<unsigned>(secs / 60 % 60));
+    out[22] = ':';
+    put2(23, static_cast<unsigned>(secs % 60));
+    out[25] = ' ';
+    out[26] = 'G';
+    out[27] = 'M';
+    out[28] = 'T';
+    out[29] = '\0';
+}
+
+std::string ConditionalRequest::formatHttpDate(time_t time) {
+    char buf[30];
+    formatHttpDate(time, buf);
+    return std::string(buf, 29);
+}
+
+std::string ConditionalRequest::makeETag(const struct stat& file_stat) {
+    // "inode-size-mtime_ns" in hex; any content change that updates size or
+    // mtime (or replaces the file) produces a new tag
+    auto mtime_ns = static_cast<unsigned long long>(file_stat.st_mtim.tv_sec) * 1000000000ULL +
+                    static_cast<unsigned long long>(file_stat.st_mtim.tv_nsec);
+
+    return std::format("\"{:x}-{:x}-{:x}\"", static_cast<unsigned long long>(file_stat.st_ino),
+                       static_cast<unsigned long long>(file_stat.st_size), mtime_ns);
+}
+
+ResourceValidators ConditionalRequest::validatorsFor(const struct stat& file_stat) {
+    return ResourceValidators{makeETag(file_stat), file_stat.st_mtime};
+}
+
+bool ConditionalRequest::etagListMatches(std::string_view list, std::string_view etag, bool weak) {
+    list = trimOws(list);
+    if (list.empty() || etag.empty()) {
+        return false;
+    }
+    if (list == "*") {
+        return true;
+    }
+
+    bool current_is_weak = etag.starts_with("W/");
+    std::string_view current = opaqueTag(etag);
+
+    size_t pos = 0;
+    while (pos < list.size()) {
+        // Skip separators
+        while (pos < list.size() && (list[pos] == ',' || list[pos] == ' ' || list[pos] == '\t')) {
+            ++pos;
+        }
+        if (pos >= list.size()) {
+            break;
+        }
+
+        bool candidate_is_weak = false;
+        if (list.substr(pos, 2) == "W/") {
+            candidate_is_weak = true;
+            pos += 2;
+        }
+        if (pos >= list.size() || list[pos] != '"') {
+            // Malformed element - skip to next comma
+            pos = list.find(',', pos);
+            if (pos == std::string_view::npos) {
+                break;
+            }
+            continue;
+        }
+
+        size_t close = list.find('"', pos + 1);
+        if (close == std::string_view::npos) {
+            break;
+        }
+        std::string_view candidate = list.substr(pos + 1, close - pos - 1);
+        pos = close + 1;
+
+        if (candidate != current) {
+            continue;
+        }
+        if (weak || (!candidate_is_weak && !current_is_weak)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+PreconditionResult ConditionalRequest::evaluate(std::string_view method,
+                                                const ConditionalHeaders& headers,
+                                                const ResourceValidators& validators) {
+    bool is_get_or_head = method == "GET" || method == "HEAD";
+
+    // Step 1/2: If-Match, otherwise If-Unmodified-Since
+    if (!headers.if_match.empty()) {
+        if (!etagListMatches(headers.if_match, validators.etag, false)) {
+            return PreconditionResult::PreconditionFailed;
+        }
+    } else if (!headers.if_unmodified_since.empty()) {
+        auto date = parseHttpDate(headers.if_unmodified_since);
+        if (date && validators.last_modified > *date) {
+            return PreconditionResult::PreconditionFailed;
+        }
+    }
+
+    // Step 3/4: If-None-Match, otherwise If-Modified-Since (GET/HEAD only)
+    if (!headers.if_none_match.empty()) {
+        if (etagListMatches(headers.if_none_match, validators.etag, true)) {
+            return is_get_or_head ? PreconditionResult::NotModified
+                                  : PreconditionResult::PreconditionFailed;
+        }
+    } else if (is_get_or_head && !headers.if_modified_since.empty()) {
+        auto date = parseHttpDate(headers.if_modified_since);
+        if (date && validators.last_modified <= *date) {
+            return PreconditionResult::NotModified;
+        }
+    }
+
+    return PreconditionResult::Proceed;
+}
+
+bool ConditionalRequest::ifRangeMatches(std::string_view if_range,
+                                        const ResourceValidators& validators) {
+    if_range = trimOws(if_range);
+    if (if_range.empty()) {
+        return true;
+    }
+
+    // Entity tag: must match using the strong comparison function
+    if (if_range.front() == '"' || if_range.starts_with("W/")) {
+        if (if_range.starts_with("W/")) {
+            return false;
+        }
+        return etagListMatches(if_range, validators.etag, false);
+    }
+
+    // HTTP-date: must exactly match Last-Modified
+    auto date = parseHttpDate(if_range);
+    return date && *date == validators.last_modified;
+}
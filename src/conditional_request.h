@@ -0,0 +1,114 @@
+#ifndef SHELOB_CONDITIONAL_REQUEST_H
+#define SHELOB_CONDITIONAL_REQUEST_H 1
+
+#include <ctime>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "global.h"
+
+/**
+ * Validators describing the selected representation of a resource
+ * (RFC 9110 Section 8.8)
+ */
+struct ResourceValidators {
+    std::string etag;       // Strong entity tag including quotes, e.g. "1a2b-400-5f3c"
+    time_t last_modified{}; // Modification time in seconds since the epoch
+};
+
+/**
+ * Conditional request header values, empty when the header is absent.
+ * Views point into the request's header storage and must not outlive it.
+ */
+struct ConditionalHeaders {
+    std::string_view if_match;
+    std::string_view if_none_match;
+    std::string_view if_modified_since;
+    std::string_view if_unmodified_since;
+    std::string_view if_range;
+
+    /**
+     * Collect the conditional headers from a parsed header map.
+     * Accepts both canonical (HTTP/1.1) and lowercase (HTTP/2) field names.
+     */
+    static ConditionalHeaders from(const std::map<std::string, std::string>& headers);
+};
+
+/**
+ * Outcome of evaluating request preconditions
+ */
+enum class PreconditionResult {
+    Proceed,           // Perform the method normally
+    NotModified,       // Respond 304 Not Modified (GET/HEAD only)
+    PreconditionFailed // Respond 412 Precondition Failed
+};
+
+/**
+ * Conditional request engine (RFC 9110 Section 13)
+ *
+ * Generates strong ETags from file metadata and evaluates If-Match,
+ * If-None-Match, If-Modified-Since, If-Unmodified-Since and If-Range in the
+ * order mandated by RFC 9110 Section 13.2.2. Date handling is thread-safe and
+ * does not allocate or touch the process timezone.
+ */
+class ConditionalRequest {
+  public:
+    /**
+     * Parse an HTTP-date (IMF-fixdate, obsolete RFC 850 or asctime format)
+     * Example: "Sun, 06 Nov 1994 08:49:37 GMT"
+     * @return Seconds since the epoch, or std::nullopt if the date is invalid
+     */
+    static std::optional<time_t> parseHttpDate(std::string_view date);
+
+    /**
+     * Format a time as an IMF-fixdate
+     * @param time Seconds since the epoch
+     * @param out Buffer receiving exactly 29 characters plus a terminating NUL
+     */
+    static void formatHttpDate(time_t time, char (&out)[30]);
+
+    /**
+     * Format a time as an IMF-fixdate string
+     */
+    static std::string formatHttpDate(time_t time);
+
+    /**
+     * Build a strong ETag from inode, size and modification time (with
+     * nanosecond resolution where the platform provides it)
+     */
+    static std::string makeETag(const struct stat& file_stat);
+
+    /**
+     * Build validators (ETag and Last-Modified) for a file
+     */
+    static ResourceValidators validatorsFor(const struct stat& file_stat);
+
+    /**
+     * Evaluate preconditions for a request against the current representation
+     * @param method Request method (GET, HEAD, PUT, DELETE, ...)
+     * @param headers Conditional headers from the request
+     * @param validators Validators of the selected representation
+     */
+    static PreconditionResult evaluate(std::string_view method, const ConditionalHeaders& headers,
+                                       const ResourceValidators& validators);
+
+    /**
+     * Evaluate If-Range (RFC 9110 Section 13.1.5)
+     * @return true if the Range header should be honoured
+     */
+    static bool ifRangeMatches(std::string_view if_range, const ResourceValidators& validators);
+
+    /**
+     * Check whether an entity-tag list ("*" or comma separated tags) matches
+     * @param list Header value such as "\"a\", W/\"b\""
+     * @param etag Current entity tag including quotes
+     * @param weak Use weak comparison (If-None-Match) instead of strong (If-Match)
+     */
+    static bool etagListMatches(std::string_view list, std::string_view etag, bool weak);
+};
+
+#endif /* !SHELOB_CONDITIONAL_REQUEST_H */
@@ -1,4 +1,5 @@
 #include "content_negotiator.h"
+#include "open_file_cache.h"
 #include <algorithm>
 #include <cctype>
 #include <cmath>
@@ -189,12 +190,21 @@ std::string ContentNegotiator::getMimeType(std::string_view extension) {
     return "application/octet-stream";
 }
 
+namespace {
+
+// Extensions of the variants looked for, in the order findVariants() tries them
+const std::vector<std::string>& variantExtensions() {
+    static const std::vector<std::string> extensions = {"html", "json", "xml", "txt",  "pdf", "png",
+                                                        "jpg",  "jpeg", "gif", "webp", "svg"};
+    return extensions;
+}
+
+} // namespace
+
 /**
- * Find all file variants for a base path
+ * Paths of the possible variants of a base path: filename.extension
  */
-std::map<std::string, std::string> ContentNegotiator::findVariants(std::string_view base_path) {
-    std::map<std::string, std::string> variants;
-
+std::vector<std::string> ContentNegotiator::variantPaths(std::string_view base_path) {
     // Remove leading slash if present
     std::string clean_path(base_path);
     if (!clean_path.empty() && clean_path[0] == '/') {
@@ -205,17 +215,25 @@ std::map<std::string, std::string> ContentNegotiator::findVariants(std::string_v
     std::filesystem::path parent = base.parent_path();
     std::string filename = base.filename().string();
 
-    // Try to find files matching the pattern: filename.extension
-    // Common extensions to check
-    static const std::vector<std::string> extensions = {"html", "json", "xml", "txt",  "pdf", "png",
-                                                        "jpg",  "jpeg", "gif", "webp", "svg"};
+    std::vector<std::string> paths;
+    for (const auto& ext : variantExtensions()) {
+        paths.push_back((parent / (filename + "." + ext)).string());
+    }
+    return paths;
+}
 
-    for (const auto& ext : extensions) {
-        std::filesystem::path variant_path = parent / (filename + "." + ext);
+/**
+ * Find all file variants for a base path
+ */
+std::map<std::string, std::string> ContentNegotiator::findVariants(std::string_view base_path) {
+    std::map<std::string, std::string> variants;
 
-        if (std::filesystem::exists(variant_path)) {
-            std::string content_type = getMimeType(ext);
-            variants[variant_path.string()] = content_type;
+    // Looked up through the open file cache, which remembers misses too
+    std::vector<std::string> paths = variantPaths(base_path);
+    const std::vector<std::string>& extensions = variantExtensions();
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (OpenFileCache::getInstance().open(paths[i])->found()) {
+            variants[paths[i]] = getMimeType(extensions[i]);
         }
     }
 
@@ -49,6 +49,11 @@ class ContentNegotiator {
      */
     std::map<std::string, std::string> findVariants(std::string_view base_path);
 
+    /**
+     * The paths findVariants() looks up for a base path, one per extension it knows
+     */
+    static std::vector<std::string> variantPaths(std::string_view base_path);
+
     /**
      * Select the best matching file variant based on Accept header
      * Returns the file path of the best match, or empty string if no match
@@ -0,0 +1,118 @@
+#include "directory_watcher.h"
+#include <array>
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <utility>
+
+DirectoryWatcher::DirectoryWatcher(uint32_t mask, Callback callback)
+    : mask_(mask | IN_ONLYDIR), callback_(std::move(callback)) {
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_ >= 0 && wake_ >= 0) {
+        thread_ = std::thread([this] { run(); });
+    }
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    if (thread_.joinable()) {
+        uint64_t stop = 1;
+        if (::write(wake_, &stop, sizeof(stop)) == sizeof(stop)) {
+            thread_.join();
+        } else {
+            thread_.detach();
+        }
+    }
+    for (int fd : {inotify_, wake_}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+bool DirectoryWatcher::watch(const std::string& directory) {
+    if (!active()) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    if (watches_.contains(directory)) {
+        return true;
+    }
+    int wd = inotify_add_watch(inotify_, directory.c_str(), mask_);
+    if (wd < 0) {
+        return false;
+    }
+    // Two names for one directory share its watch
+    watches_.emplace(directory, wd);
+    directories_[wd].push_back(directory);
+    return true;
+}
+
+void DirectoryWatcher::clear() {
+    std::lock_guard lock(mutex_);
+    for (const auto& [wd, names] : directories_) {
+        inotify_rm_watch(inotify_, wd);
+    }
+    watches_.clear();
+    directories_.clear();
+}
+
+void DirectoryWatcher::run() {
+    std::array<pollfd, 2> fds{{{inotify_, POLLIN, 0}, {wake_, POLLIN, 0}}};
+    while (true) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents != 0) {
+            read_events();
+        }
+    }
+}
+
+void DirectoryWatcher::read_events() {
+    alignas(inotify_event) std::array<char, 16 * 1024> buffer;
+    std::vector<std::pair<std::string, std::string>> changes;
+    ssize_t length;
+    while ((length = ::read(inotify_, buffer.data(), buffer.size())) > 0) {
+        changes.clear();
+        {
+            std::lock_guard lock(mutex_);
+            for (ssize_t pos = 0; pos < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer.data() + pos);
+                pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    changes.emplace_back();
+                    continue;
+                }
+                auto watched = directories_.find(event->wd);
+                if (watched == directories_.end()) {
+                    continue; // Removed by clear()
+                }
+                if (event->len > 0) {
+                    for (const std::string& directory : watched->second) {
+                        changes.emplace_back(directory, event->name);
+                    }
+                } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    inotify_rm_watch(inotify_, event->wd);
+                    for (const std::string& directory : watched->second) {
+                        watches_.erase(directory);
+                        changes.emplace_back(directory, "");
+                    }
+                    directories_.erase(watched);
+                }
+            }
+        }
+        // Called unlocked, so the callback can take a lock watch() is called under
+        for (const auto& [directory, name] : changes) {
+            callback_(directory, name);
+        }
+    }
+}
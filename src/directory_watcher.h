@@ -0,0 +1,59 @@
+#ifndef DIRECTORY_WATCHER_H
+#define DIRECTORY_WATCHER_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Directories watched with inotify from a thread of its own
+ *
+ * The callback runs on that thread for each change to a name in a watched
+ * directory, without the watcher's lock held, so it may take a lock that
+ * watch() is called under. A directory that is removed or moved away stops
+ * being watched and is reported with an empty name; when the kernel's event
+ * queue overflows, an empty directory is reported, as any change may have
+ * been missed.
+ */
+class DirectoryWatcher {
+  public:
+    using Callback = std::function<void(const std::string& directory, std::string_view name)>;
+
+    /**
+     * Start watching for the inotify events in mask
+     * @param callback Called with the directory (as passed to watch()) and name
+     */
+    DirectoryWatcher(uint32_t mask, Callback callback);
+    ~DirectoryWatcher();
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // Whether inotify could be set up; without it nothing is ever reported
+    bool active() const { return thread_.joinable(); }
+
+    // Watch a directory; false if it can't be (missing, or out of watches)
+    bool watch(const std::string& directory);
+
+    // Stop watching every directory
+    void clear();
+
+  private:
+    void run();
+    void read_events();
+
+    const uint32_t mask_;
+    const Callback callback_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, int> watches_;                  // Directory to watch
+    std::unordered_map<int, std::vector<std::string>> directories_; // Watch to its names
+    int inotify_ = -1;
+    int wake_ = -1; // eventfd stopping the thread
+    std::thread thread_;
+};
+
+#endif // DIRECTORY_WATCHER_H
@@ -0,0 +1,294 @@
+#include "fastcgi.h"
+#include "conditional_request.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+#include <format>
+
+namespace {
+
+FastCgi::Options& configuredOptions() {
+    static FastCgi::Options options;
+    return options;
+}
+
+std::string_view trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(start, end - start + 1);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+// Lengths under 128 take one byte, others four with the high bit set
+void append_length(std::string& out, size_t length) {
+    if (length < 128) {
+        out += static_cast<char>(length);
+        return;
+    }
+    out += static_cast<char>(((length >> 24) & 0x7F) | 0x80);
+    out += static_cast<char>((length >> 16) & 0xFF);
+    out += static_cast<char>((length >> 8) & 0xFF);
+    out += static_cast<char>(length & 0xFF);
+}
+
+std::optional<size_t> read_length(std::string_view& data) {
+    if (data.empty()) {
+        return std::nullopt;
+    }
+    auto byte = [&](size_t i) { return static_cast<size_t>(static_cast<uint8_t>(data[i])); };
+    if ((byte(0) & 0x80) == 0) {
+        size_t length = byte(0);
+        data.remove_prefix(1);
+        return length;
+    }
+    if (data.size() < 4) {
+        return std::nullopt;
+    }
+    size_t length = ((byte(0) & 0x7F) << 24) | (byte(1) << 16) | (byte(2) << 8) | byte(3);
+    data.remove_prefix(4);
+    return length;
+}
+
+// Reason phrase for a Status header that only gives the code
+std::string_view reason_phrase(int status) {
+    switch (status) {
+    case 200:
+        return "OK";
+    case 201:
+        return "Created";
+    case 204:
+        return "No Content";
+    case 301:
+        return "Moved Permanently";
+    case 302:
+        return "Found";
+    case 303:
+        return "See Other";
+    case 304:
+        return "Not Modified";
+    case 307:
+        return "Temporary Redirect";
+    case 400:
+        return "Bad Request";
+    case 401:
+        return "Unauthorized";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 500:
+        return "Internal Server Error";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    case 504:
+        return "Gateway Timeout";
+    default:
+        return "Unknown";
+    }
+}
+
+} // namespace
+
+const FastCgi::Options& FastCgi::options() { return configuredOptions(); }
+
+void FastCgi::configure(const Options& options) { configuredOptions() = options; }
+
+bool FastCgi::handles(std::string_view path, const Options& options) {
+    if (!options.enabled) {
+        return false;
+    }
+    return std::ranges::any_of(options.extensions, [&](const std::string& extension) {
+        return path.size() > extension.size() && path.ends_with(extension);
+    });
+}
+
+std::optional<FastCgi::Header> FastCgi::parse_header(std::string_view data) {
+    if (data.size() < HEADER_SIZE || data[0] != 1) {
+        return std::nullopt;
+    }
+    auto byte = [&](size_t i) { return static_cast<uint8_t>(data[i]); };
+    Header header;
+    header.type = byte(1);
+    header.request_id = static_cast<uint16_t>((byte(2) << 8) | byte(3));
+    header.content_length = static_cast<uint16_t>((byte(4) << 8) | byte(5));
+    header.padding_length = byte(6);
+    return header;
+}
+
+std::string FastCgi::header(uint8_t type, uint16_t request_id, size_t content_length) {
+    return {static_cast<char>(1),
+            static_cast<char>(type),
+            static_cast<char>(request_id >> 8),
+            static_cast<char>(request_id & 0xFF),
+            static_cast<char>((content_length >> 8) & 0xFF),
+            static_cast<char>(content_length & 0xFF),
+            0,
+            0};
+}
+
+void FastCgi::append_record(std::string& out, uint8_t type, uint16_t request_id,
+                            std::string_view content) {
+    out += header(type, request_id, content.size());
+    out += content;
+}
+
+void FastCgi::append_stream(std::string& out, uint8_t type, uint16_t request_id,
+                            std::string_view data) {
+    while (!data.empty()) {
+        size_t chunk = std::min(data.size(), MAX_CONTENT);
+        append_record(out, type, request_id, data.substr(0, chunk));
+        data.remove_prefix(chunk);
+    }
+}
+
+void FastCgi::append_begin_request(std::string& out, uint16_t request_id, bool keep_conn) {
+    const char body[8] = {0, static_cast<char>(RESPONDER), keep_conn ? char(KEEP_CONN) : char(0)};
+    append_record(out, BEGIN_REQUEST, request_id, std::string_view(body, sizeof(body)));
+}
+
+void FastCgi::append_end_request(std::string& out, uint16_t request_id, uint32_t app_status,
+                                 uint8_t protocol_status) {
+    const char body[8] = {static_cast<char>(app_status >> 24),
+                          static_cast<char>((app_status >> 16) & 0xFF),
+                          static_cast<char>((app_status >> 8) & 0xFF),
+                          static_cast<char>(app_status & 0xFF),
+                          static_cast<char>(protocol_status)};
+    append_record(out, END_REQUEST, request_id, std::string_view(body, sizeof(body)));
+}
+
+void FastCgi::encode_params(const Params& params, std::string& out) {
+    for (const auto& [name, value] : params) {
+        append_length(out, name.size());
+        append_length(out, value.size());
+        out += name;
+        out += value;
+    }
+}
+
+bool FastCgi::decode_params(std::string_view data, Params& params) {
+    while (!data.empty()) {
+        auto name_length = read_length(data);
+        auto value_length = name_length ? read_length(data) : std::nullopt;
+        if (!value_length || data.size() < *name_length + *value_length) {
+            return false;
+        }
+        params.emplace_back(data.substr(0, *name_length),
+                            data.substr(*name_length, *value_length));
+        data.remove_prefix(*name_length + *value_length);
+    }
+    return true;
+}
+
+std::optional<size_t> FastCgi::parse_response_head(std::string_view output, ResponseHead& head) {
+    head = ResponseHead{};
+    if (output.starts_with("\r\n") || output.starts_with("\n")) {
+        return output[0] == '\r' ? 2 : 1; // No headers at all
+    }
+
+    // Applications may end lines with LF alone
+    size_t end = output.find("\n\r\n");
+    size_t terminator = 3;
+    size_t bare = output.find("\n\n");
+    if (bare != std::string_view::npos && (end == std::string_view::npos || bare < end)) {
+        end = bare;
+        terminator = 2;
+    }
+    if (end == std::string_view::npos) {
+        return 0;
+    }
+
+    bool has_status = false;
+    bool has_location = false;
+    std::string_view block = output.substr(0, end + 1);
+    while (!block.empty()) {
+        size_t newline = block.find('\n');
+        std::string_view line = block.substr(0, newline);
+        block.remove_prefix(newline + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            return std::nullopt;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if (iequals(name, "Status")) {
+            int status = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), status);
+            if (ec != std::errc() || status < 100 || status > 999) {
+                return std::nullopt;
+            }
+            std::string_view reason = trim(value.substr(ptr - value.data()));
+            head.status = status;
+            head.reason = reason.empty() ? reason_phrase(status) : reason;
+            has_status = true;
+            continue;
+        }
+        if (iequals(name, "Content-Length")) {
+            size_t length = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (ec != std::errc() || ptr != value.data() + value.size()) {
+                return std::nullopt;
+            }
+            head.content_length = length;
+        }
+        if (iequals(name, "Location")) {
+            has_location = true;
+        }
+        head.headers.emplace_back(name, value);
+    }
+
+    // A local redirect the server would follow is sent as a client redirect
+    if (has_location && !has_status) {
+        head.status = 302;
+        head.reason = reason_phrase(302);
+    }
+    return end + terminator;
+}
+
+std::string FastCgi::http_head(const ResponseHead& head, bool chunked, bool keep_alive) {
+    std::string out = std::format("HTTP/1.1 {} {}\r\n", head.status, head.reason);
+    out += "Date: " + ConditionalRequest::formatHttpDate(time(nullptr)) + "\r\n";
+    out += "Server: SHELOB/0.5 (Unix)\r\n";
+    for (const auto& [name, value] : head.headers) {
+        if (iequals(name, "Connection") || iequals(name, "Keep-Alive") ||
+            iequals(name, "Transfer-Encoding")) {
+            continue;
+        }
+        out += name + ": " + value + "\r\n";
+    }
+    if (chunked) {
+        out += "Transfer-Encoding: chunked\r\n";
+    }
+    out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return out;
+}
+
+std::string FastCgi::error_response(int status, bool keep_alive) {
+    std::string_view reason = reason_phrase(status);
+    std::string body =
+        std::format("<html><body><h1>{} {}</h1></body></html>", status, reason);
+    ResponseHead head{.status = status,
+                      .reason = std::string(reason),
+                      .headers = {{"Content-Type", "text/html"},
+                                  {"Content-Length", std::to_string(body.size())}},
+                      .content_length = body.size()};
+    return http_head(head, false, keep_alive) + body;
+}
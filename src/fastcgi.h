@@ -0,0 +1,149 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * FastCGI (version 1) records, settings and CGI response parsing
+ *
+ * Requests for the configured extensions are forwarded to a local
+ * application over a Unix socket instead of forking a CGI process. The
+ * connection handling lives in FastCgiPool; this class is the wire format,
+ * shared by the client and the bundled test application.
+ */
+class FastCgi {
+  public:
+    struct Options {
+        bool enabled = false;
+        std::string socket;                            // Unix socket of the application
+        std::vector<std::string> extensions = {".sh"}; // Paths forwarded to the application
+        size_t connections = 4;                        // Per server thread
+        size_t streams = 16;                           // Requests per connection, if multiplexed
+        size_t timeout = 30;                           // Seconds to wait for application output
+    };
+
+    // CGI meta-variables sent as FCGI_PARAMS, in order
+    using Params = std::vector<std::pair<std::string, std::string>>;
+
+    enum RecordType : uint8_t {
+        BEGIN_REQUEST = 1,
+        ABORT_REQUEST = 2,
+        END_REQUEST = 3,
+        PARAMS = 4,
+        STDIN = 5,
+        STDOUT = 6,
+        STDERR = 7,
+        DATA = 8,
+        GET_VALUES = 9,
+        GET_VALUES_RESULT = 10,
+        UNKNOWN_TYPE = 11
+    };
+
+    enum ProtocolStatus : uint8_t {
+        REQUEST_COMPLETE = 0,
+        CANT_MPX_CONN = 1,
+        OVERLOADED = 2,
+        UNKNOWN_ROLE = 3
+    };
+
+    static constexpr uint16_t RESPONDER = 1;
+    static constexpr uint8_t KEEP_CONN = 1;
+    static constexpr size_t HEADER_SIZE = 8;
+    static constexpr size_t MAX_CONTENT = 65535;
+
+    struct Header {
+        uint8_t type = 0;
+        uint16_t request_id = 0;
+        uint16_t content_length = 0;
+        uint8_t padding_length = 0;
+
+        // Header, content and padding
+        size_t record_size() const { return HEADER_SIZE + content_length + padding_length; }
+    };
+
+    /**
+     * The process-wide settings used by the connection driver
+     */
+    static const Options& options();
+
+    /**
+     * Set the process-wide settings; call before accepting connections
+     */
+    static void configure(const Options& options);
+
+    /**
+     * Whether a request path (without query) goes to the application
+     */
+    static bool handles(std::string_view path, const Options& options);
+
+    /**
+     * Decode a record header
+     * @return Nothing if fewer than HEADER_SIZE bytes or not version 1
+     */
+    static std::optional<Header> parse_header(std::string_view data);
+
+    /**
+     * The 8-byte header of a record with the given content length (no padding)
+     */
+    static std::string header(uint8_t type, uint16_t request_id, size_t content_length);
+
+    /**
+     * Append one record; content must fit in MAX_CONTENT bytes
+     */
+    static void append_record(std::string& out, uint8_t type, uint16_t request_id,
+                              std::string_view content);
+
+    /**
+     * Append a stream's data as records of up to MAX_CONTENT bytes. Streams
+     * end with an empty record, which callers append separately.
+     */
+    static void append_stream(std::string& out, uint8_t type, uint16_t request_id,
+                              std::string_view data);
+
+    static void append_begin_request(std::string& out, uint16_t request_id, bool keep_conn);
+    static void append_end_request(std::string& out, uint16_t request_id, uint32_t app_status,
+                                   uint8_t protocol_status);
+
+    /**
+     * Name-value pair encoding used by FCGI_PARAMS and FCGI_GET_VALUES
+     */
+    static void encode_params(const Params& params, std::string& out);
+    static bool decode_params(std::string_view data, Params& params);
+
+    /**
+     * Header block at the start of a CGI response (RFC 3875 6.2)
+     */
+    struct ResponseHead {
+        int status = 200;
+        std::string reason = "OK";
+        std::vector<std::pair<std::string, std::string>> headers; // Without Status
+        std::optional<size_t> content_length;
+    };
+
+    /**
+     * Parse the header block an application writes before its body
+     * @return Bytes of output taken by the block, 0 if it isn't complete yet,
+     *         or nothing if it is malformed
+     */
+    static std::optional<size_t> parse_response_head(std::string_view output, ResponseHead& head);
+
+    /**
+     * HTTP/1.1 response head for an application's response. Hop-by-hop
+     * headers from the application are dropped.
+     * @param chunked Add Transfer-Encoding: chunked (no Content-Length was given)
+     */
+    static std::string http_head(const ResponseHead& head, bool chunked, bool keep_alive);
+
+    /**
+     * Whole response for a request the application didn't answer (502, 503 or 504)
+     */
+    static std::string error_response(int status, bool keep_alive);
+};
+
+#endif // FASTCGI_H
@@ -0,0 +1,453 @@
+#include "fastcgi_pool.h"
+#include "metrics.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <iostream>
+#include <optional>
+
+using local_socket = asio::local::stream_protocol::socket;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Received bytes are parsed out of a buffer grown by this much per read
+constexpr size_t READ_CHUNK = 64 * 1024;
+
+// How long a new connection waits for the application's FCGI_GET_VALUES_RESULT
+constexpr auto VALUES_TIMEOUT = std::chrono::seconds(1);
+
+size_t param_number(const FastCgi::Params& params, std::string_view name) {
+    for (const auto& [key, value] : params) {
+        size_t number = 0;
+        if (key == name &&
+            std::from_chars(value.data(), value.data() + value.size(), number).ec == std::errc()) {
+            return number;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+asio::execution_context::id FastCgiPool::id;
+
+/**
+ * One socket to the application and the requests multiplexed over it,
+ * indexed by request ID - 1
+ */
+class FastCgiPool::Connection : public std::enable_shared_from_this<Connection> {
+  public:
+    Connection(FastCgiPool& pool, const asio::any_io_executor& executor)
+        : pool_(pool), socket_(executor) {}
+
+    /**
+     * Connect, start reading and ask how many requests may share the connection
+     */
+    asio::awaitable<bool> open(const FastCgi::Options& options);
+
+    asio::any_io_executor executor() { return socket_.get_executor(); }
+
+    // Whether another request fits
+    bool available() const { return open_ && active_ < capacity_; }
+    size_t active() const { return active_; }
+
+    // Give a request an ID on this connection
+    void reserve(const std::shared_ptr<Exchange>& exchange);
+
+    /**
+     * Write records, one writer at a time so records never interleave mid-way
+     * @return False if the connection failed
+     */
+    template <typename Buffers> asio::awaitable<bool> write(const Buffers& buffers);
+
+    /**
+     * Send an exchange's BEGIN_REQUEST, PARAMS and the body it started with
+     */
+    static asio::awaitable<void> send(std::shared_ptr<Connection> self,
+                                      std::shared_ptr<Exchange> exchange);
+
+    // Tell the application to stop working on a request
+    static asio::awaitable<void> abort(std::shared_ptr<Connection> self, uint16_t request_id);
+
+    // Fail every request and leave the pool
+    void close();
+
+  private:
+    asio::awaitable<void> read_records();
+    asio::awaitable<void> dispatch(const FastCgi::Header& header, std::string_view content);
+    void finish(Exchange& exchange);
+
+    FastCgiPool& pool_;
+    local_socket socket_;
+    std::vector<std::shared_ptr<Exchange>> exchanges_;
+    size_t capacity_ = 0; // Zero until the application has been asked
+    size_t active_ = 0;
+    bool open_ = false;
+    bool writing_ = false;
+    Signal write_ready_;
+    std::optional<FastCgi::Params> values_;
+    Signal values_ready_;
+};
+
+// ============================================================================
+// Signal
+// ============================================================================
+
+asio::awaitable<bool> FastCgiPool::Signal::wait(Clock::time_point deadline) {
+    asio::steady_timer timer(co_await asio::this_coro::executor, deadline);
+    waiters_.push_back(&timer);
+    auto [ec] = co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+    std::erase(waiters_, &timer);
+    co_return ec == asio::error::operation_aborted;
+}
+
+void FastCgiPool::Signal::notify() {
+    for (asio::steady_timer* timer : waiters_) {
+        timer->cancel();
+    }
+}
+
+// ============================================================================
+// Exchange
+// ============================================================================
+
+asio::awaitable<bool> FastCgiPool::Exchange::read(std::string& out, Clock::duration timeout) {
+    auto deadline = Clock::now() + timeout;
+    while (output_.empty() && !ended_ && !failed_) {
+        if (!co_await readable_.wait(deadline) && output_.empty() && !ended_ && !failed_) {
+            timed_out_ = true;
+            co_return false;
+        }
+    }
+    if (output_.empty()) {
+        co_return false;
+    }
+    out.clear();
+    out.swap(output_);
+    drained_.notify();
+    co_return true;
+}
+
+asio::awaitable<bool> FastCgiPool::Exchange::write_body(std::string_view data) {
+    // One record per write, so other requests' records get in between
+    std::shared_ptr<Connection> connection = connection_;
+    do {
+        if (!connection || abandoned_ || ended_ || failed_) {
+            co_return false;
+        }
+        size_t chunk = std::min(data.size(), FastCgi::MAX_CONTENT);
+        std::string header = FastCgi::header(FastCgi::STDIN, request_id_, chunk);
+        std::array<asio::const_buffer, 2> buffers = {asio::buffer(header),
+                                                     asio::buffer(data.data(), chunk)};
+        if (!co_await connection->write(buffers)) {
+            co_return false;
+        }
+        data.remove_prefix(chunk);
+    } while (!data.empty());
+    co_return true;
+}
+
+void FastCgiPool::Exchange::abandon() {
+    if (abandoned_) {
+        return;
+    }
+    abandoned_ = true;
+    output_.clear();
+    drained_.notify();
+    if (connection_ && !ended_) {
+        asio::co_spawn(connection_->executor(),
+                       Connection::abort(connection_, request_id_), asio::detached);
+    }
+}
+
+// ============================================================================
+// Connection
+// ============================================================================
+
+asio::awaitable<bool> FastCgiPool::Connection::open(const FastCgi::Options& options) {
+    asio::local::stream_protocol::endpoint endpoint(options.socket);
+    auto [ec] = co_await socket_.async_connect(endpoint, asio::as_tuple(asio::use_awaitable));
+    if (ec) {
+        std::cerr << "FastCGI: can't connect to " << options.socket << ": " << ec.message()
+                  << std::endl;
+        co_return false;
+    }
+    open_ = true;
+    Metrics::increment(Metrics::Counter::FastCgiConnectionsOpened);
+    Metrics::add(Metrics::Gauge::FastCgiConnections, 1);
+    asio::co_spawn(
+        socket_.get_executor(), [self = shared_from_this()] { return self->read_records(); },
+        asio::detached);
+
+    std::string query;
+    std::string names;
+    FastCgi::encode_params({{"FCGI_MPXS_CONNS", ""}, {"FCGI_MAX_REQS", ""}}, names);
+    FastCgi::append_record(query, FastCgi::GET_VALUES, 0, names);
+    if (!co_await write(asio::buffer(query))) {
+        co_return false;
+    }
+    auto deadline = Clock::now() + VALUES_TIMEOUT;
+    while (open_ && !values_) {
+        if (!co_await values_ready_.wait(deadline)) {
+            break;
+        }
+    }
+    if (!open_) {
+        co_return false;
+    }
+
+    // Applications that don't answer, or don't multiplex, get one request at a time
+    size_t capacity = 1;
+    if (values_ && param_number(*values_, "FCGI_MPXS_CONNS") == 1) {
+        size_t max_requests = param_number(*values_, "FCGI_MAX_REQS");
+        capacity = std::min(options.streams, max_requests > 0 ? max_requests : options.streams);
+    }
+    capacity_ = std::clamp<size_t>(capacity, 1, UINT16_MAX);
+    exchanges_.resize(capacity_);
+    co_return true;
+}
+
+void FastCgiPool::Connection::reserve(const std::shared_ptr<Exchange>& exchange) {
+    auto slot = std::ranges::find(exchanges_, nullptr);
+    *slot = exchange;
+    ++active_;
+    exchange->connection_ = shared_from_this();
+    exchange->request_id_ = static_cast<uint16_t>(slot - exchanges_.begin() + 1);
+}
+
+template <typename Buffers>
+asio::awaitable<bool> FastCgiPool::Connection::write(const Buffers& buffers) {
+    while (open_ && writing_) {
+        co_await write_ready_.wait();
+    }
+    if (!open_) {
+        co_return false;
+    }
+    writing_ = true;
+    auto [ec, written] =
+        co_await asio::async_write(socket_, buffers, asio::as_tuple(asio::use_awaitable));
+    writing_ = false;
+    write_ready_.notify();
+    if (ec) {
+        close();
+    }
+    co_return !ec;
+}
+
+asio::awaitable<void> FastCgiPool::Connection::send(std::shared_ptr<Connection> self,
+                                                    std::shared_ptr<Exchange> exchange) {
+    uint16_t id = exchange->request_id_;
+    std::string params;
+    FastCgi::encode_params(exchange->params_, params);
+    std::string records;
+    FastCgi::append_begin_request(records, id, true);
+    FastCgi::append_stream(records, FastCgi::PARAMS, id, params);
+    FastCgi::append_record(records, FastCgi::PARAMS, id, {});
+    if (!co_await self->write(asio::buffer(records))) {
+        co_return;
+    }
+
+    std::string body = std::move(exchange->body_);
+    if (!body.empty()) {
+        bool written = co_await exchange->write_body(body);
+        if (!written) {
+            co_return;
+        }
+    }
+    if (!exchange->body_follows_) {
+        co_await exchange->write_body({}); // The empty record ending STDIN
+    }
+}
+
+asio::awaitable<void> FastCgiPool::Connection::abort(std::shared_ptr<Connection> self,
+                                                     uint16_t request_id) {
+    std::string record = FastCgi::header(FastCgi::ABORT_REQUEST, request_id, 0);
+    co_await self->write(asio::buffer(record));
+}
+
+asio::awaitable<void> FastCgiPool::Connection::read_records() {
+    std::string input;
+    size_t parsed = 0;
+    while (open_) {
+        std::string_view pending = std::string_view(input).substr(parsed);
+        auto header = FastCgi::parse_header(pending);
+        if (!header && pending.size() >= FastCgi::HEADER_SIZE) {
+            std::cerr << "FastCGI: malformed record from the application" << std::endl;
+            break;
+        }
+        if (header && pending.size() >= header->record_size()) {
+            std::string_view content = pending.substr(FastCgi::HEADER_SIZE, header->content_length);
+            co_await dispatch(*header, content);
+            parsed += header->record_size();
+            continue;
+        }
+
+        input.erase(0, parsed);
+        parsed = 0;
+        size_t received = input.size();
+        input.resize(received + READ_CHUNK);
+        auto [ec, bytes] = co_await socket_.async_read_some(
+            asio::buffer(input.data() + received, READ_CHUNK), asio::as_tuple(asio::use_awaitable));
+        input.resize(received + bytes);
+        if (ec) {
+            break; // The application closed the connection (or it failed)
+        }
+    }
+    close();
+}
+
+asio::awaitable<void> FastCgiPool::Connection::dispatch(const FastCgi::Header& header,
+                                                        std::string_view content) {
+    if (header.type == FastCgi::GET_VALUES_RESULT) {
+        values_.emplace();
+        FastCgi::decode_params(content, *values_);
+        values_ready_.notify();
+        co_return;
+    }
+
+    size_t index = header.request_id - 1;
+    if (header.request_id == 0 || index >= exchanges_.size() || !exchanges_[index]) {
+        co_return; // Management record, or a request that already ended
+    }
+    std::shared_ptr<Exchange> exchange = exchanges_[index];
+
+    switch (header.type) {
+    case FastCgi::STDOUT:
+        if (exchange->abandoned_) {
+            break;
+        }
+        exchange->output_.append(content);
+        exchange->readable_.notify();
+        // Let the client catch up before reading more from the application
+        while (open_ && !exchange->abandoned_ &&
+               exchange->output_.size() > FastCgiPool::MAX_BUFFERED) {
+            co_await exchange->drained_.wait();
+        }
+        break;
+    case FastCgi::STDERR:
+        if (!content.empty()) {
+            std::cerr << "FastCGI: " << content << (content.back() == '\n' ? "" : "\n");
+        }
+        break;
+    case FastCgi::END_REQUEST:
+        exchange->protocol_status_ = FastCgi::REQUEST_COMPLETE;
+        if (content.size() >= 5) {
+            exchange->protocol_status_ = static_cast<uint8_t>(content[4]);
+        }
+        if (exchange->protocol_status_ != FastCgi::REQUEST_COMPLETE) {
+            exchange->failed_ = true;
+        }
+        if (exchange->protocol_status_ == FastCgi::CANT_MPX_CONN) {
+            capacity_ = 1;
+        }
+        finish(*exchange);
+        break;
+    default:
+        break;
+    }
+}
+
+void FastCgiPool::Connection::finish(Exchange& exchange) {
+    exchange.ended_ = true;
+    exchange.readable_.notify();
+    exchange.drained_.notify();
+    exchanges_[exchange.request_id_ - 1].reset();
+    --active_;
+    exchange.connection_.reset();
+    pool_.slot_free_.notify();
+}
+
+void FastCgiPool::Connection::close() {
+    if (!open_ && exchanges_.empty()) {
+        return;
+    }
+    if (open_) {
+        Metrics::add(Metrics::Gauge::FastCgiConnections, -1);
+    }
+    open_ = false;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+
+    auto exchanges = std::move(exchanges_);
+    exchanges_.clear();
+    active_ = 0;
+    for (auto& exchange : exchanges) {
+        if (exchange) {
+            exchange->failed_ = true;
+            exchange->readable_.notify();
+            exchange->drained_.notify();
+            exchange->connection_.reset();
+        }
+    }
+    write_ready_.notify();
+    values_ready_.notify();
+    pool_.remove(this);
+}
+
+// ============================================================================
+// FastCgiPool
+// ============================================================================
+
+FastCgiPool::FastCgiPool(asio::execution_context& context)
+    : asio::execution_context::service(context) {}
+
+asio::awaitable<std::shared_ptr<FastCgiPool::Exchange>>
+FastCgiPool::start(const FastCgi::Options& options, FastCgi::Params params, std::string body,
+                   bool body_follows) {
+    auto executor = co_await asio::this_coro::executor;
+    auto exchange = std::make_shared<Exchange>(std::move(params), std::move(body));
+    exchange->body_follows_ = body_follows;
+    auto deadline = Clock::now() + std::chrono::seconds(options.timeout);
+
+    while (true) {
+        std::shared_ptr<Connection> least_busy;
+        for (const auto& connection : connections_) {
+            if (connection->available() &&
+                (!least_busy || connection->active() < least_busy->active())) {
+                least_busy = connection;
+            }
+        }
+        if (least_busy) {
+            least_busy->reserve(exchange);
+            if (body_follows) {
+                // Later body records must not overtake the parameters
+                co_await Connection::send(least_busy, exchange);
+            } else {
+                asio::co_spawn(executor, Connection::send(least_busy, exchange), asio::detached);
+            }
+            co_return exchange;
+        }
+
+        if (connections_.size() < std::max<size_t>(options.connections, 1)) {
+            // Counted before connecting, so concurrent requests don't all connect
+            auto connection = std::make_shared<Connection>(*this, executor);
+            connections_.push_back(connection);
+            bool opened = co_await connection->open(options);
+            if (!opened) {
+                connection->close();
+                remove(connection.get());
+                co_return nullptr;
+            }
+            slot_free_.notify(); // Its other slots are free for waiting requests
+            continue;
+        }
+
+        if (!co_await slot_free_.wait(deadline) && Clock::now() >= deadline) {
+            co_return nullptr;
+        }
+    }
+}
+
+void FastCgiPool::remove(const Connection* connection) {
+    std::erase_if(connections_, [&](const auto& open) { return open.get() == connection; });
+    slot_free_.notify();
+}
+
+void FastCgiPool::shutdown() {
+    auto connections = std::move(connections_);
+    connections_.clear();
+    for (auto& connection : connections) {
+        connection->close();
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef FASTCGI_POOL_H
+#define FASTCGI_POOL_H
+
+#include "fastcgi.h"
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace asio = boost::asio;
+
+/**
+ * Pooled, multiplexed connections to a FastCGI application over a Unix socket
+ *
+ * Each io_context gets one pool, found with asio::use_service, so its
+ * connections and requests are only touched from that context's thread and
+ * need no locking. A pool opens up to Options::connections connections, each
+ * carrying as many concurrent requests as the application allows (asked with
+ * FCGI_GET_VALUES when the connection opens: FCGI_MPXS_CONNS and
+ * FCGI_MAX_REQS, capped at Options::streams; one if it doesn't answer).
+ * Connections are kept open between requests (FCGI_KEEP_CONN).
+ *
+ * Request bodies go out as STDIN records straight from the request's buffer,
+ * interleaved with other requests' records, while the response is read, or
+ * piece by piece as the client sends them (see Exchange::write_body).
+ * FastCGI has no flow control, so when a client reads its response more
+ * slowly than the application writes it, the connection stops reading once
+ * that request has MAX_BUFFERED bytes waiting, which also holds up the other
+ * requests sharing the connection.
+ */
+class FastCgiPool : public asio::execution_context::service {
+  public:
+    static asio::execution_context::id id;
+
+    // Response bytes held per request before the connection stops reading
+    static constexpr size_t MAX_BUFFERED = 256 * 1024;
+
+    explicit FastCgiPool(asio::execution_context& context);
+
+    /**
+     * Wakes the coroutines waiting on it; they recheck their condition
+     */
+    class Signal {
+      public:
+        /**
+         * Wait for notify() or the deadline
+         * @return False if the deadline passed first
+         */
+        asio::awaitable<bool> wait(std::chrono::steady_clock::time_point deadline =
+                                       std::chrono::steady_clock::time_point::max());
+        void notify();
+
+      private:
+        std::vector<asio::steady_timer*> waiters_;
+    };
+
+    class Connection;
+
+    /**
+     * One request in flight on a pooled connection
+     */
+    class Exchange {
+      public:
+        Exchange(FastCgi::Params params, std::string body)
+            : params_(std::move(params)), body_(std::move(body)) {}
+
+        /**
+         * Wait for response output (FCGI_STDOUT) and swap it into out
+         * @param timeout Longest wait for the application to write something
+         * @return False once the response is complete, or if it failed or
+         *         timed out (see failed() and timed_out())
+         */
+        asio::awaitable<bool> read(std::string& out, std::chrono::steady_clock::duration timeout);
+
+        /**
+         * Send more of the body, for a request started with body_follows;
+         * an empty piece ends it
+         * @return False if the request ended or failed first
+         */
+        asio::awaitable<bool> write_body(std::string_view data);
+
+        // The connection closed, or the application refused the request
+        bool failed() const { return failed_; }
+        // The application ended the request (its output may still be unread)
+        bool ended() const { return ended_; }
+        bool timed_out() const { return timed_out_; }
+        uint8_t protocol_status() const { return protocol_status_; }
+
+        /**
+         * Give up on the response (the client went away): the application is
+         * sent FCGI_ABORT_REQUEST and further output is discarded
+         */
+        void abandon();
+
+      private:
+        friend class FastCgiPool;
+        friend class Connection;
+
+        std::shared_ptr<Connection> connection_; // Until the request ends
+        uint16_t request_id_ = 0;
+        FastCgi::Params params_;
+        std::string body_;
+        bool body_follows_ = false;
+        std::string output_;
+        bool ended_ = false;
+        bool failed_ = false;
+        bool timed_out_ = false;
+        bool abandoned_ = false;
+        uint8_t protocol_status_ = FastCgi::REQUEST_COMPLETE;
+        Signal readable_; // Output arrived or the request ended
+        Signal drained_;  // The client took the output
+    };
+
+    /**
+     * Start a request on the least busy connection with a free slot,
+     * opening a connection if the pool has room and waiting otherwise. The
+     * parameters and body are sent in the background.
+     * @param body_follows The body continues through Exchange::write_body(),
+     *        so the parameters are sent before this returns
+     * @return Nothing if the application can't be reached in time
+     */
+    asio::awaitable<std::shared_ptr<Exchange>> start(const FastCgi::Options& options,
+                                                     FastCgi::Params params, std::string body,
+                                                     bool body_follows = false);
+
+    // Open connections
+    size_t connections() const { return connections_.size(); }
+
+  private:
+    void shutdown() override;
+    void remove(const Connection* connection);
+
+    std::vector<std::shared_ptr<Connection>> connections_;
+    Signal slot_free_;
+};
+
+#endif // FASTCGI_POOL_H
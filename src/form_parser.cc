@@ -0,0 +1,448 @@
+#include "form_parser.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <unistd.h>
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+/**
+ * A parameter of a header field value such as "form-data; name=\"a\"", with
+ * quoted-string escapes undone
+ */
+std::optional<std::string> parameter(std::string_view value, std::string_view name) {
+    size_t pos = value.find(';');
+    while (pos != std::string_view::npos) {
+        size_t equals = value.find_first_of("=;", pos + 1);
+        if (equals == std::string_view::npos || value[equals] == ';') {
+            pos = equals;
+            continue;
+        }
+        std::string_view key = trim(value.substr(pos + 1, equals - pos - 1));
+        pos = value.find_first_not_of(" \t", equals + 1);
+        std::string result;
+        if (pos != std::string_view::npos && value[pos] == '"') {
+            for (++pos; pos < value.size() && value[pos] != '"'; ++pos) {
+                if (value[pos] == '\\' && pos + 1 < value.size()) {
+                    ++pos;
+                }
+                result += value[pos];
+            }
+            pos = value.find(';', pos);
+        } else if (pos != std::string_view::npos) {
+            size_t end = value.find(';', pos);
+            result = trim(value.substr(pos, end - pos));
+            pos = end;
+        }
+        if (equals_ignore_case(key, name)) {
+            return result;
+        }
+    }
+    return std::nullopt;
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    return std::tolower(static_cast<unsigned char>(c)) - 'a' + 10;
+}
+
+} // namespace
+
+HorspoolSearch::HorspoolSearch(std::string pattern) : pattern_(std::move(pattern)) {
+    shift_.fill(std::max<size_t>(pattern_.size(), 1));
+    for (size_t i = 0; i + 1 < pattern_.size(); ++i) {
+        shift_[static_cast<unsigned char>(pattern_[i])] = pattern_.size() - 1 - i;
+    }
+}
+
+size_t HorspoolSearch::find(std::string_view text) const {
+    if (pattern_.empty()) {
+        return 0;
+    }
+    const size_t last = pattern_.size() - 1;
+    for (size_t pos = 0; pos + last < text.size();) {
+        char c = text[pos + last];
+        if (c == pattern_[last] && std::memcmp(text.data() + pos, pattern_.data(), last) == 0) {
+            return pos;
+        }
+        pos += shift_[static_cast<unsigned char>(c)];
+    }
+    return std::string_view::npos;
+}
+
+std::unique_ptr<FormParser> FormParser::create(std::string_view content_type) {
+    std::string_view type = trim(content_type.substr(0, content_type.find(';')));
+    if (equals_ignore_case(type, "application/x-www-form-urlencoded")) {
+        return std::make_unique<UrlEncodedParser>();
+    }
+    if (equals_ignore_case(type, "multipart/form-data")) {
+        return std::make_unique<MultipartParser>(parameter(content_type, "boundary").value_or(""));
+    }
+    return nullptr;
+}
+
+std::optional<std::string_view> FormParser::find(std::string_view name) const {
+    for (auto field = fields_.rbegin(); field != fields_.rend(); ++field) {
+        if (field->name == name && !field->spooled()) {
+            return field->value;
+        }
+    }
+    return std::nullopt;
+}
+
+bool UrlEncodedParser::consume(std::string_view input) {
+    for (char c : input) {
+        if (error_ != Error::None) {
+            return false;
+        }
+        if (escaping_) {
+            if (std::isxdigit(static_cast<unsigned char>(c))) {
+                escape_[escaped_++] = c;
+                if (escaped_ == 2) {
+                    append(static_cast<char>(hex_value(escape_[0]) * 16 + hex_value(escape_[1])));
+                    escaping_ = false;
+                }
+                continue;
+            }
+            // Not an escape after all; kept as it was, and c read as usual
+            append('%');
+            for (size_t i = 0; i < escaped_; ++i) {
+                append(escape_[i]);
+            }
+            escaping_ = false;
+        }
+        if (c == '%') {
+            escaping_ = true;
+            escaped_ = 0;
+        } else if (c == '&') {
+            end_pair();
+        } else if (c == '=' && !in_value_) {
+            current_.value = data_.size();
+            in_value_ = true;
+        } else {
+            append(c == '+' ? ' ' : c);
+        }
+    }
+    return error_ == Error::None;
+}
+
+bool UrlEncodedParser::finish() {
+    if (escaping_) {
+        append('%');
+        for (size_t i = 0; i < escaped_; ++i) {
+            append(escape_[i]);
+        }
+        escaping_ = false;
+    }
+    end_pair();
+    if (error_ != Error::None) {
+        return false;
+    }
+
+    // data_ doesn't grow any more, so views of it stay valid
+    std::string_view data = data_;
+    fields_.clear();
+    for (const Span& span : spans_) {
+        FormField& field = fields_.emplace_back();
+        field.name = data.substr(span.name, span.value - span.name);
+        field.value = data.substr(span.value, span.end - span.value);
+        field.size = field.value.size();
+    }
+    return true;
+}
+
+void UrlEncodedParser::append(char c) {
+    if (data_.size() >= max_size_) {
+        fail(Error::TooLarge);
+        return;
+    }
+    data_ += c;
+}
+
+void UrlEncodedParser::end_pair() {
+    if (!in_value_) {
+        current_.value = data_.size();
+    }
+    current_.end = data_.size();
+    if (current_.value > current_.name) {
+        if (spans_.size() == RequestLimits::MAX_FORM_FIELDS) {
+            fail(Error::TooLarge);
+        }
+        spans_.push_back(current_);
+    } else {
+        data_.resize(current_.name); // No name, so not a field
+    }
+    current_ = {.name = data_.size()};
+    in_value_ = false;
+}
+
+MultipartParser::MultipartParser(std::string_view boundary)
+    : MultipartParser(boundary, Options()) {}
+
+MultipartParser::MultipartParser(std::string_view boundary, Options options)
+    : options_(std::move(options)), delimiter_("\r\n--" + std::string(boundary)) {
+    // RFC 2046 boundaries are 1 to 70 characters without CR or LF. The search
+    // relies on that: a CR only ever starts a delimiter.
+    if (boundary.empty() || boundary.size() > 70 ||
+        boundary.find_first_of("\r\n") != std::string_view::npos) {
+        fail(Error::Malformed);
+    }
+}
+
+MultipartParser::~MultipartParser() {
+    if (spool_fd_ >= 0) {
+        ::close(spool_fd_);
+    }
+    for (const Part& part : parts_) {
+        if (!part.file.empty()) {
+            ::unlink(part.file.c_str()); // Unless the caller moved it away
+        }
+    }
+}
+
+bool MultipartParser::consume(std::string_view input) {
+    while (!input.empty() && error_ == Error::None && state_ != State::Done) {
+        switch (state_) {
+        case State::Preamble:
+        case State::Data:
+            input = scan(input);
+            break;
+        case State::DelimiterLine: {
+            // "--" closes the body; otherwise only whitespace may follow the delimiter
+            size_t end = input.find('\n');
+            size_t take = end == std::string_view::npos ? input.size() : end + 1;
+            line_.append(input.substr(0, take));
+            input.remove_prefix(take);
+            if (line_.starts_with("--")) {
+                state_ = State::Done; // Anything after it is the epilogue
+            } else if (line_.size() > RequestLimits::MAX_HEADER_LINE) {
+                return fail(Error::Malformed);
+            } else if (end != std::string_view::npos) {
+                if (!line_.ends_with("\r\n") ||
+                    line_.find_first_not_of(" \t") != line_.size() - 2) {
+                    return fail(Error::Malformed);
+                }
+                line_.clear();
+                state_ = State::Headers;
+            }
+            break;
+        }
+        case State::Headers: {
+            // The block ends at an empty line, the only line of a part without fields
+            size_t searched = line_.size();
+            size_t take = std::min(input.size(), RequestLimits::MAX_HEADER_SIZE - line_.size());
+            line_.append(input.substr(0, take));
+            size_t end = std::string_view::npos;
+            if (line_.starts_with("\r\n")) {
+                end = 2;
+            } else if (size_t blank = line_.find("\r\n\r\n", searched < 3 ? 0 : searched - 3);
+                       blank != std::string::npos) {
+                end = blank + 4;
+            }
+            if (end == std::string_view::npos) {
+                if (line_.size() == RequestLimits::MAX_HEADER_SIZE) {
+                    return fail(Error::Malformed);
+                }
+                input.remove_prefix(take);
+                break;
+            }
+            input.remove_prefix(take - (line_.size() - end)); // The rest is the part's data
+            line_.resize(end);
+            if (!start_part(line_)) {
+                return false;
+            }
+            line_.clear();
+            state_ = State::Data;
+            break;
+        }
+        case State::Done:
+            break;
+        }
+    }
+    return error_ == Error::None;
+}
+
+bool MultipartParser::finish() {
+    if (error_ == Error::None && state_ != State::Done) {
+        fail(Error::Malformed); // Cut short
+    }
+    if (spool_fd_ >= 0) {
+        ::close(spool_fd_);
+        spool_fd_ = -1;
+    }
+    if (error_ != Error::None) {
+        return false;
+    }
+
+    // parts_ doesn't change any more, so views of it stay valid
+    fields_.clear();
+    for (const Part& part : parts_) {
+        if (!part.name.empty()) {
+            fields_.push_back({.name = part.name,
+                               .value = part.data,
+                               .filename = part.filename,
+                               .content_type = part.content_type,
+                               .file = part.file,
+                               .size = part.size});
+        }
+    }
+    return true;
+}
+
+std::string_view MultipartParser::scan(std::string_view input) {
+    const std::string& delimiter = delimiter_.pattern();
+    if (!pending_.empty()) {
+        // pending_ is the start of the delimiter; see whether input completes it
+        size_t missing = delimiter.size() - pending_.size();
+        size_t have = std::min(missing, input.size());
+        if (input.substr(0, have) == std::string_view(delimiter).substr(pending_.size(), have)) {
+            if (have < missing) {
+                pending_.append(input);
+                return {};
+            }
+            pending_.clear();
+            end_part();
+            return input.substr(have);
+        }
+        // Data after all, and with no other CR it can't hold the start of another delimiter
+        append(pending_);
+        pending_.clear();
+    }
+
+    size_t found = delimiter_.find(input);
+    if (found != std::string_view::npos) {
+        append(input.substr(0, found));
+        end_part();
+        return input.substr(found + delimiter.size());
+    }
+
+    // Hold back a tail that could be the start of a delimiter split across inputs
+    size_t keep = 0;
+    std::string_view tail = input.substr(input.size() - std::min(input.size(), delimiter.size()));
+    if (size_t cr = tail.rfind('\r'); cr != std::string_view::npos) {
+        tail.remove_prefix(cr);
+        keep = delimiter.starts_with(tail) ? tail.size() : 0;
+    }
+    append(input.substr(0, input.size() - keep));
+    pending_.assign(input.substr(input.size() - keep));
+    return {};
+}
+
+void MultipartParser::append(std::string_view data) {
+    if (state_ != State::Data || data.empty()) {
+        return; // The preamble is skipped
+    }
+    Part& part = parts_.back();
+    part.size += data.size();
+    if (part.file.empty() && (part.data.size() + data.size() > options_.max_part_memory ||
+                              memory_ + data.size() > options_.max_memory)) {
+        if (!spool(part)) {
+            return;
+        }
+    }
+    if (part.file.empty()) {
+        part.data.append(data);
+        memory_ += data.size();
+    } else {
+        write_spool(data);
+    }
+}
+
+bool MultipartParser::spool(Part& part) {
+    std::error_code ec;
+    std::filesystem::path dir = options_.spool_dir;
+    if (dir.empty()) {
+        dir = std::filesystem::temp_directory_path(ec);
+        if (ec) {
+            return fail(Error::Spool);
+        }
+    }
+    std::string path = (dir / "fishjelly-upload-XXXXXX").string();
+    spool_fd_ = ::mkostemp(path.data(), O_CLOEXEC);
+    if (spool_fd_ < 0) {
+        return fail(Error::Spool);
+    }
+    part.file = std::move(path);
+
+    // What was read so far goes first
+    bool written = write_spool(part.data);
+    memory_ -= part.data.size();
+    part.data = std::string();
+    return written;
+}
+
+bool MultipartParser::write_spool(std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(spool_fd_, data.data(), data.size());
+        if (written < 0 && errno != EINTR) {
+            return fail(Error::Spool);
+        }
+        data.remove_prefix(std::max<ssize_t>(written, 0));
+    }
+    return true;
+}
+
+void MultipartParser::end_part() {
+    if (state_ == State::Data && spool_fd_ >= 0) {
+        if (::close(spool_fd_) != 0) {
+            fail(Error::Spool);
+        }
+        spool_fd_ = -1;
+    }
+    state_ = State::DelimiterLine;
+    line_.clear();
+}
+
+bool MultipartParser::start_part(std::string_view headers) {
+    if (parts_.size() == RequestLimits::MAX_FORM_FIELDS) {
+        return fail(Error::TooLarge);
+    }
+    Part part;
+    for (size_t pos = 0; pos < headers.size();) {
+        size_t end = headers.find("\r\n", pos);
+        std::string_view line = headers.substr(pos, end - pos);
+        pos = end == std::string_view::npos ? end : end + 2;
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        std::string_view name = trim(line.substr(0, colon));
+        std::string_view value = trim(line.substr(colon + 1));
+        if (equals_ignore_case(name, "Content-Disposition")) {
+            part.name = parameter(value, "name").value_or("");
+            part.filename = parameter(value, "filename").value_or("");
+        } else if (equals_ignore_case(name, "Content-Type")) {
+            part.content_type = value;
+        }
+    }
+
+    // Names count against the memory limit too, so many small parts can't add up
+    size_t size = part.name.size() + part.filename.size() + part.content_type.size();
+    if (memory_ + size > options_.max_memory) {
+        return fail(Error::TooLarge);
+    }
+    memory_ += size;
+    parts_.push_back(std::move(part));
+    return true;
+}
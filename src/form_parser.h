@@ -0,0 +1,195 @@
+#ifndef FORM_PARSER_H
+#define FORM_PARSER_H
+
+#include "request_limits.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Boyer-Moore-Horspool search for one fixed pattern
+ *
+ * After a mismatch the window moves by how far the byte under its last
+ * position is from the end of the pattern, so for a multipart delimiter of
+ * 40-odd bytes most of the input is stepped over rather than compared.
+ */
+class HorspoolSearch {
+  public:
+    explicit HorspoolSearch(std::string pattern);
+
+    // Position of the first occurrence in text, or npos
+    size_t find(std::string_view text) const;
+
+    const std::string& pattern() const { return pattern_; }
+
+  private:
+    std::string pattern_;
+    std::array<size_t, 256> shift_{};
+};
+
+/**
+ * A field of a parsed form, viewing storage owned by its parser
+ */
+struct FormField {
+    std::string_view name;
+    std::string_view value;        // Empty when spooled to file
+    std::string_view filename;     // Multipart file parts only
+    std::string_view content_type; // Multipart parts only
+    std::string_view file;         // Temporary file holding a part too large to keep in memory
+    size_t size = 0;               // Of the value, also when spooled
+
+    bool spooled() const { return !file.empty(); }
+};
+
+/**
+ * Incremental parser for a request body holding a form
+ *
+ * Fed the body in pieces split anywhere as it arrives, so the body itself is
+ * never buffered whole. Field data is kept up to RequestLimits::MAX_FORM_MEMORY
+ * per request; multipart parts past that (or past MAX_FORM_FIELD_MEMORY each)
+ * are written to temporary files instead, which are removed with the parser.
+ */
+class FormParser {
+  public:
+    enum class Error : uint8_t {
+        None,
+        Malformed,
+        TooLarge, // More field data than can be kept in memory, or too many parts
+        Spool     // A temporary file couldn't be written
+    };
+
+    virtual ~FormParser() = default;
+
+    /**
+     * A parser for a body with this Content-Type, or nothing if it isn't
+     * application/x-www-form-urlencoded or multipart/form-data
+     */
+    static std::unique_ptr<FormParser> create(std::string_view content_type);
+
+    /**
+     * Parse the next piece of the body
+     * @return false once the body is known to be unusable (see error())
+     */
+    virtual bool consume(std::string_view input) = 0;
+
+    /**
+     * Mark the end of the body
+     * @return Whether the whole body was well formed
+     */
+    virtual bool finish() = 0;
+
+    Error error() const { return error_; }
+
+    // Give up on a body found unusable outside the parser (its framing, or its size)
+    void reject(Error error) { fail(error); }
+
+    // The fields in body order, once finished; views valid while the parser lives
+    const std::vector<FormField>& fields() const { return fields_; }
+
+    // Value of the last in-memory field with this name
+    std::optional<std::string_view> find(std::string_view name) const;
+
+  protected:
+    FormParser() = default;
+    FormParser(const FormParser&) = delete;
+    FormParser& operator=(const FormParser&) = delete;
+
+    bool fail(Error error) {
+        error_ = error;
+        return false;
+    }
+
+    Error error_ = Error::None;
+    std::vector<FormField> fields_;
+};
+
+/**
+ * application/x-www-form-urlencoded: '&'-separated name=value pairs, with
+ * '+' for space and %XX escapes, decoded as they arrive. Pairs without a name
+ * are skipped, as are invalid escapes left as they are.
+ */
+class UrlEncodedParser : public FormParser {
+  public:
+    explicit UrlEncodedParser(size_t max_size = RequestLimits::MAX_FORM_MEMORY)
+        : max_size_(max_size) {}
+
+    bool consume(std::string_view input) override;
+    bool finish() override;
+
+  private:
+    // Offsets of a decoded pair in data_
+    struct Span {
+        size_t name = 0;
+        size_t value = 0;
+        size_t end = 0;
+    };
+
+    void append(char c);
+    void end_pair();
+
+    size_t max_size_;
+    std::string data_; // Decoded names and values, one after another
+    std::vector<Span> spans_;
+    Span current_;
+    bool in_value_ = false;
+    bool escaping_ = false; // After a '%'
+    char escape_[2] = {};   // Hex digits read since
+    size_t escaped_ = 0;
+};
+
+/**
+ * multipart/form-data (RFC 7578): parts between "--boundary" delimiter lines,
+ * each with its own header fields. Delimiters are found with a
+ * Boyer-Moore-Horspool search; the preamble and epilogue are skipped.
+ */
+class MultipartParser : public FormParser {
+  public:
+    struct Options {
+        // Part data kept in memory, in all and per part; the rest goes to files
+        size_t max_memory = RequestLimits::MAX_FORM_MEMORY;
+        size_t max_part_memory = RequestLimits::MAX_FORM_FIELD_MEMORY;
+        std::string spool_dir; // For the temporary files; the system's if empty
+    };
+
+    explicit MultipartParser(std::string_view boundary);
+    MultipartParser(std::string_view boundary, Options options);
+    ~MultipartParser() override;
+
+    bool consume(std::string_view input) override;
+    bool finish() override;
+
+  private:
+    enum class State : uint8_t { Preamble, DelimiterLine, Headers, Data, Done };
+
+    struct Part {
+        std::string name;
+        std::string filename;
+        std::string content_type;
+        std::string data; // Unless spooled
+        std::string file;
+        size_t size = 0;
+    };
+
+    std::string_view scan(std::string_view input);
+    void append(std::string_view data);
+    bool spool(Part& part);
+    bool write_spool(std::string_view data);
+    void end_part();
+    bool start_part(std::string_view headers);
+
+    Options options_;
+    HorspoolSearch delimiter_; // CRLF "--" boundary
+    State state_ = State::Preamble;
+    std::string pending_ = "\r\n"; // Start of a possible delimiter at the end of the last input
+    std::string line_;             // Rest of the delimiter line, or the part's header block
+    std::vector<Part> parts_;
+    size_t memory_ = 0; // Part data held in memory
+    int spool_fd_ = -1; // Of the part being read
+};
+
+#endif // FORM_PARSER_H
@@ -0,0 +1,303 @@
+#include "handler.h"
+#include "body_framing.h"
+#include "conditional_request.h"
+#include "http.h"
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <format>
+
+namespace {
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) ==
+                      std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Method, target and version of a request line
+struct RequestLine {
+    std::string_view method;
+    std::string_view target;
+    std::string_view version;
+};
+
+std::optional<RequestLine> parseRequestLine(std::string_view head) {
+    std::string_view line = head.substr(0, head.find("\r\n"));
+    size_t method_end = line.find(' ');
+    if (method_end == std::string_view::npos) {
+        return std::nullopt;
+    }
+    size_t target_end = line.find(' ', method_end + 1);
+    if (target_end == std::string_view::npos || target_end == method_end + 1) {
+        return std::nullopt;
+    }
+    return RequestLine{line.substr(0, method_end),
+                       line.substr(method_end + 1, target_end - method_end - 1),
+                       line.substr(target_end + 1)};
+}
+
+} // namespace
+
+std::optional<std::pair<Method, std::string_view>> Request::route_key(std::string_view head) {
+    auto line = parseRequestLine(head);
+    if (!line || (line->version != "HTTP/1.1" && line->version != "HTTP/1.0")) {
+        return std::nullopt;
+    }
+    auto method = parseMethod(line->method);
+    if (!method) {
+        return std::nullopt;
+    }
+    return std::pair(*method, line->target.substr(0, line->target.find('?')));
+}
+
+Request::Request(std::string_view head, std::string& input, size_t head_size,
+                 HandlerStream& stream)
+    : head_(head), input_(input), head_size_(head_size), stream_(stream) {
+    std::string_view text = head_;
+    auto line = parseRequestLine(text);
+    if (!line) {
+        valid_ = false;
+        return;
+    }
+    method_name_ = line->method;
+    target_ = line->target;
+    version_ = line->version;
+    method_ = parseMethod(method_name_).value_or(Method::Get);
+    size_t query_start = target_.find('?');
+    path_ = target_.substr(0, query_start);
+    query_ = query_start == std::string_view::npos ? "" : target_.substr(query_start + 1);
+
+    // Header fields, one per line up to the blank one
+    BodyFraming framing;
+    size_t pos = text.find("\r\n");
+    while (pos != std::string_view::npos && pos + 2 < text.size()) {
+        pos += 2;
+        size_t end = text.find("\r\n", pos);
+        std::string_view field = text.substr(pos, end - pos);
+        pos = end;
+        size_t colon = field.find(':');
+        if (field.empty() || colon == std::string_view::npos) {
+            continue;
+        }
+        std::string name(field.substr(0, colon));
+        framing.add(name, field.substr(colon + 1));
+        headers_[name] = trim(field.substr(colon + 1));
+    }
+
+    // A body that could be framed two ways could smuggle a request (CWE-444)
+    valid_ = valid_ && framing.valid();
+    chunked_ = framing.chunked();
+    remaining_ = framing.content_length().value_or(0);
+    if (version_ == "HTTP/1.1" && !header("Host")) {
+        valid_ = false;
+    }
+
+    auto connection = header("Connection");
+    keep_alive_ = version_ == "HTTP/1.0" ? connection && equalsIgnoreCase(*connection, "keep-alive")
+                                         : !connection || !equalsIgnoreCase(*connection, "close");
+}
+
+std::optional<std::string_view> Request::header(std::string_view name) const {
+    for (const auto& [field, value] : headers_) {
+        if (equalsIgnoreCase(field, name)) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+asio::awaitable<std::optional<std::string_view>> Request::read() {
+    // The last piece (and framing before it) is done with
+    input_.erase(head_size_, returned_);
+    returned_ = 0;
+
+    if (!chunked_) {
+        if (remaining_ == 0) {
+            co_return std::string_view();
+        }
+        if (input_.size() == head_size_) {
+            bool arrived = co_await stream_.read_more(input_);
+            if (!arrived) {
+                co_return std::nullopt;
+            }
+        }
+        size_t take = std::min(remaining_, input_.size() - head_size_);
+        remaining_ -= take;
+        returned_ = take;
+        bytes_read_ += take;
+        co_return std::string_view(input_).substr(head_size_, take);
+    }
+
+    while (!decoder_.done()) {
+        std::string_view available = std::string_view(input_).substr(head_size_ + returned_);
+        if (available.empty()) {
+            input_.erase(head_size_, returned_);
+            returned_ = 0;
+            bool arrived = co_await stream_.read_more(input_);
+            if (!arrived) {
+                co_return std::nullopt;
+            }
+            continue;
+        }
+        std::string_view data;
+        auto used = decoder_.consume(available, data);
+        if (!used) {
+            co_return std::nullopt;
+        }
+        returned_ += *used;
+        bytes_read_ += *used;
+        if (!data.empty()) {
+            co_return data;
+        }
+    }
+    co_return std::string_view();
+}
+
+asio::awaitable<std::optional<std::string>> Request::read_body(size_t limit) {
+    if (!chunked_ && remaining_ > limit) {
+        co_return std::nullopt;
+    }
+    std::string body;
+    while (true) {
+        auto piece = co_await read();
+        if (!piece || body.size() + piece->size() > limit) {
+            co_return std::nullopt;
+        }
+        if (piece->empty()) {
+            break;
+        }
+        body.append(*piece);
+    }
+    co_return body;
+}
+
+ResponseWriter::ResponseWriter(HandlerStream& stream, const Request& request)
+    : stream_(stream), head_only_(request.method() == Method::Head),
+      http10_(request.version() == "HTTP/1.0"), keep_alive_(request.keep_alive()) {}
+
+void ResponseWriter::header(std::string_view name, std::string_view value) {
+    if (head_sent_) {
+        return;
+    }
+    if (equalsIgnoreCase(name, "Connection")) {
+        // Written with the head; a handler can only ask for the connection to close
+        if (equalsIgnoreCase(value, "close")) {
+            keep_alive_ = false;
+        }
+        return;
+    }
+    if (equalsIgnoreCase(name, "Content-Length")) {
+        has_length_ = true;
+    }
+    fields_.append(name).append(": ").append(value).append("\r\n");
+}
+
+std::string ResponseWriter::make_head(std::optional<size_t> content_length) {
+    std::string reason(Http::reasonPhrase(status_));
+    if (reason.empty()) {
+        status_ = 500;
+        reason = Http::reasonPhrase(status_);
+    }
+    char date[30];
+    ConditionalRequest::formatHttpDate(time(nullptr), date);
+
+    std::string head = std::format("HTTP/1.1 {} {}\r\nDate: {}\r\nServer: SHELOB/0.5 (Unix)\r\n",
+                                   status_, reason, date);
+    if (content_length) {
+        head += std::format("Content-Length: {}\r\n", *content_length);
+    } else if (chunked_) {
+        head += "Transfer-Encoding: chunked\r\n";
+    }
+    head += keep_alive_ ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    head += fields_;
+    head += "\r\n";
+    return head;
+}
+
+asio::awaitable<bool> ResponseWriter::write(std::string_view data) {
+    if (finished_) {
+        co_return false;
+    }
+    std::string head;
+    if (!head_sent_) {
+        bool bodyless = status_ == 204 || status_ == 304;
+        if (!has_length_ && !bodyless) {
+            // HTTP/1.0 has no chunked coding; the body ends with the connection
+            chunked_ = !http10_;
+            keep_alive_ = keep_alive_ && chunked_;
+        }
+        head = make_head(std::nullopt);
+        head_sent_ = true;
+    }
+    if (head_only_) {
+        data = {};
+    }
+    if (head.empty() && data.empty()) {
+        co_return true;
+    }
+
+    bool written = co_await stream_.write(head, data, chunked_);
+    if (!written) {
+        keep_alive_ = false;
+        finished_ = true;
+        co_return false;
+    }
+    bytes_sent_ += head.size() + data.size();
+    if (chunked_ && !data.empty()) {
+        bytes_sent_ += std::format("{:x}", data.size()).size() + 4;
+    }
+    co_return true;
+}
+
+asio::awaitable<bool> ResponseWriter::end(std::string_view data) {
+    if (finished_) {
+        co_return false;
+    }
+    bool written = true;
+    if (!head_sent_) {
+        // All of the body is known, so its length goes in the head
+        bool bodyless = status_ == 204 || status_ == 304;
+        std::optional<size_t> length;
+        if (!has_length_ && !bodyless) {
+            length = data.size();
+        }
+        std::string head = make_head(length);
+        head_sent_ = true;
+        std::string_view body = head_only_ ? std::string_view() : data;
+        written = co_await stream_.write(head, body, false);
+        bytes_sent_ += head.size() + body.size();
+    } else {
+        written = co_await write(data);
+        if (written && chunked_ && !head_only_) {
+            static const std::string last_chunk = "0\r\n\r\n";
+            written = co_await stream_.write(last_chunk, {}, false);
+            bytes_sent_ += last_chunk.size();
+        }
+    }
+    finished_ = true;
+    if (!written) {
+        keep_alive_ = false;
+    }
+    co_return written;
+}
+
+asio::awaitable<bool> ResponseWriter::send(int code, std::string_view content_type,
+                                           std::string_view body) {
+    status_ = code;
+    if (!content_type.empty()) {
+        header("Content-Type", content_type);
+    }
+    co_return co_await end(body);
+}
@@ -0,0 +1,177 @@
+#ifndef HANDLER_H
+#define HANDLER_H
+
+#include "chunked_decoder.h"
+#include "request_limits.h"
+#include "router.h"
+#include <boost/asio/awaitable.hpp>
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace asio = boost::asio;
+
+/**
+ * The connection a coroutine handler's request is read from and its
+ * response written to, with the connection's timeouts applied
+ */
+class HandlerStream {
+  public:
+    virtual ~HandlerStream() = default;
+
+    // Append whatever arrives next to input; false on timeout, error or close
+    virtual asio::awaitable<bool> read_more(std::string& input) = 0;
+
+    // Write prefix, then data (as one HTTP chunk if chunked); false on timeout or error
+    virtual asio::awaitable<bool> write(std::string_view prefix, std::string_view data,
+                                        bool chunked) = 0;
+};
+
+/**
+ * A request as a coroutine handler sees it: the parsed head, and its body
+ * read on demand
+ *
+ * The head is copied out of the connection's input buffer, so views of it
+ * stay valid for the whole request. The body is left in the input buffer
+ * until the handler reads it, a piece at a time or whole; pieces read are
+ * dropped from the buffer, so a body of any size can be streamed through.
+ */
+class Request {
+  public:
+    /**
+     * @param input The connection's input buffer, the head at its front
+     * @param head_size Bytes of request line and headers, including the blank line
+     */
+    Request(std::string_view head, std::string& input, size_t head_size, HandlerStream& stream);
+
+    /**
+     * The method and path of a request head, from its request line alone, if
+     * it is a served method over HTTP/1.x (others are left to Http to reject)
+     */
+    static std::optional<std::pair<Method, std::string_view>> route_key(std::string_view head);
+
+    // False if the head is malformed or its body framing ambiguous; answered with a 400
+    bool valid() const { return valid_; }
+
+    Method method() const { return method_; }
+    std::string_view method_name() const { return method_name_; }
+    std::string_view target() const { return target_; } // Query included
+    std::string_view path() const { return path_; }
+    std::string_view query() const { return query_; } // After the '?', if any
+    std::string_view version() const { return version_; }
+
+    // Value of the first header field with this name, matched case-insensitively
+    std::optional<std::string_view> header(std::string_view name) const;
+
+    // Header fields by name as sent (Http's header map)
+    const std::map<std::string, std::string>& headers() const { return headers_; }
+
+    // Values of the route's :name and *name segments
+    const RouteParams& params() const { return params_; }
+    void set_params(RouteParams params) { params_ = std::move(params); }
+
+    // Whether the client asked for the connection to stay open
+    bool keep_alive() const { return keep_alive_; }
+
+    /**
+     * Read the next piece of the body, waiting for it to arrive if need be
+     * @return The piece, valid until the next read; empty once the body has
+     *         been read; nothing if the client went away or the chunked
+     *         framing is malformed
+     */
+    asio::awaitable<std::optional<std::string_view>> read();
+
+    /**
+     * Read the rest of the body into one string
+     * @return Nothing if it is larger than limit (the rest then stays unread),
+     *         or as for read()
+     */
+    asio::awaitable<std::optional<std::string>>
+    read_body(size_t limit = RequestLimits::MAX_BODY_SIZE);
+
+    // The body has been read to its end (or there is none)
+    bool body_read() const { return !chunked_ ? remaining_ == 0 : decoder_.done(); }
+
+    // Body bytes (and chunk framing) read from the input so far
+    size_t bytes_read() const { return bytes_read_; }
+
+    // Bytes of the input buffer still used by the request (its head, once the body is read)
+    size_t consumed() const { return head_size_ + returned_; }
+
+  private:
+    std::string head_;
+    std::string_view method_name_;
+    std::string_view target_;
+    std::string_view path_;
+    std::string_view query_;
+    std::string_view version_;
+    Method method_ = Method::Get;
+    std::map<std::string, std::string> headers_;
+    RouteParams params_;
+    bool keep_alive_ = false;
+    bool valid_ = true;
+
+    std::string& input_;
+    size_t head_size_;
+    HandlerStream& stream_;
+    bool chunked_ = false;
+    ChunkedDecoder decoder_;
+    size_t remaining_ = 0; // Of a Content-Length body
+    size_t returned_ = 0;  // Input bytes behind the piece last returned, dropped on the next read
+    size_t bytes_read_ = 0;
+};
+
+/**
+ * The response to a coroutine handler's request
+ *
+ * Status and header fields are set first; the head goes out with the first
+ * write(). Without a Content-Length field the body is sent chunked, or for
+ * HTTP/1.0 clients up to the connection closing. A response made by end()
+ * alone gets a Content-Length. Bodies of responses to HEAD aren't sent.
+ */
+class ResponseWriter {
+  public:
+    ResponseWriter(HandlerStream& stream, const Request& request);
+
+    void status(int code) { status_ = code; }
+    int status() const { return status_; }
+
+    // Add a header field; ignored once the head has been sent
+    void header(std::string_view name, std::string_view value);
+
+    // Send the head if it hasn't gone yet, then data; false if the client went away
+    asio::awaitable<bool> write(std::string_view data);
+
+    // Finish the response with data as its last part
+    asio::awaitable<bool> end(std::string_view data = {});
+
+    // Finish with a whole response at once
+    asio::awaitable<bool> send(int code, std::string_view content_type, std::string_view body);
+
+    bool head_sent() const { return head_sent_; }
+    bool finished() const { return finished_; }
+    size_t bytes_sent() const { return bytes_sent_; }
+
+    // Whether the connection can stay open after the response
+    bool keep_alive() const { return keep_alive_; }
+    void close() { keep_alive_ = false; }
+
+  private:
+    std::string make_head(std::optional<size_t> content_length);
+
+    HandlerStream& stream_;
+    int status_ = 200;
+    std::string fields_;
+    bool has_length_ = false;
+    bool chunked_ = false;
+    bool head_only_;
+    bool http10_;
+    bool keep_alive_;
+    bool head_sent_ = false;
+    bool finished_ = false;
+    size_t bytes_sent_ = 0;
+};
+
+#endif // HANDLER_H
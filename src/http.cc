@@ -1,12 +1,20 @@
 #include "http.h"
+#include "body_framing.h"
+#include "chunked_decoder.h"
 #include "compression_middleware.h"
+#include "fastcgi.h"
+#include "form_parser.h"
 #include "footer_middleware.h"
 #include "logging_middleware.h"
+#include "metrics.h"
+#include "negative_cache.h"
+#include "open_file_cache.h"
 #include "request_limits.h"
 #include "security_middleware.h"
 #include <algorithm>
 #include <arpa/inet.h>
 #include <array>
+#include <cerrno>
 #include <cctype>
 #include <chrono>
 #include <cstring>
@@ -14,8 +22,11 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
 #include <sstream>
 #include <sys/stat.h>
+#include <unistd.h>
 
 namespace {
 
@@ -24,35 +35,113 @@ namespace {
  * Returns the file size on success, or -1 on error.
  *
  * This function protects against:
- * - tellg() returning -1 on error
  * - Files larger than MAX_FILE_SIZE (prevents memory exhaustion)
- * - Integer overflow when converting streampos to size_t
- * - Symlinks to device files like /dev/zero
+ * - Symlinks to device files like /dev/zero (only regular files are opened)
  */
-long long getFileSizeSafe(std::ifstream& file) {
-    file.seekg(0, std::ios::end);
-    auto pos = file.tellg();
-    file.seekg(0, std::ios::beg);
+long long getFileSizeSafe(const OpenFileCache::File& file) {
+    if (file.fd() < 0 || file.size() < 0) {
+        return -1;
+    }
 
-    // Check for tellg() error
-    if (pos == std::streampos(-1)) {
+    // Check against maximum allowed file size
+    if (static_cast<size_t>(file.size()) > RequestLimits::MAX_FILE_SIZE) {
         return -1;
     }
 
-    // Convert to long long for comparison
-    auto size = static_cast<long long>(pos);
+    return file.size();
+}
 
-    // Check for negative size (shouldn't happen, but be defensive)
-    if (size < 0) {
-        return -1;
+/**
+ * Read part of an open file. pread leaves the descriptor's offset alone, so
+ * descriptors shared through the open file cache can be read concurrently.
+ * Returns nothing if the file ended early or the read failed.
+ */
+std::shared_ptr<std::string> readFileRange(const OpenFileCache::File& file, off_t offset,
+                                           size_t count) {
+    auto data = std::make_shared<std::string>(count, '\0');
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = pread(file.fd(), data->data() + done, count - done,
+                          offset + static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return nullptr;
+        }
+        done += static_cast<size_t>(n);
     }
+    return data;
+}
 
-    // Check against maximum allowed file size
-    if (static_cast<size_t>(size) > RequestLimits::MAX_FILE_SIZE) {
-        return -1;
+/**
+ * Files at least this large are handed to the transport to send straight from
+ * the page cache (Socket::send_file) instead of being read into the response
+ */
+constexpr long long SEND_FILE_MIN_SIZE = 64 * 1024;
+
+/**
+ * Whether a file's body is rewritten on the way out (footer filter)
+ */
+bool isFilteredExtension(std::string_view file_extension) {
+    return file_extension == ".shtml" || file_extension == ".shtm";
+}
+
+/**
+ * Build the ETag and Last-Modified response headers for a file
+ */
+std::vector<std::string> validatorHeaders(const ResourceValidators& validators) {
+    return {"ETag: " + validators.etag,
+            "Last-Modified: " + ConditionalRequest::formatHttpDate(validators.last_modified)};
+}
+
+/**
+ * The file a request target names under htdocs, index.html for a directory.
+ * lookup says whether a path is a directory; if it can't (nullptr), neither
+ * can this.
+ */
+template <typename Lookup>
+std::optional<std::string> mapTarget(std::string_view target, Lookup lookup) {
+    std::filesystem::path path;
+
+    // Remove leading '/' from the target
+    if (!target.empty() && target[0] == '/') {
+        target.remove_prefix(1);
     }
 
-    return size;
+    // Default page
+    if (target.empty()) {
+        path = "htdocs/index.html";
+    } else {
+        // Remove any trailing newlines
+        auto pos = target.find('\n');
+        if (pos != std::string_view::npos) {
+            target = target.substr(0, pos);
+        }
+        path = std::filesystem::path("htdocs") / target;
+
+        // If the path is a directory, append index.html
+        auto file = lookup(path.string());
+        if (!file) {
+            return std::nullopt;
+        }
+        if (file->directory()) {
+            path = path / "index.html";
+        }
+    }
+
+    return path.string();
+}
+
+/**
+ * A filename without its extension, the base content negotiation finds variants of
+ */
+std::string variantBase(const std::string& filename) {
+    std::string extension = std::filesystem::path(filename).extension().string();
+    if (!extension.empty() && extension.length() < filename.length()) {
+        return filename.substr(0, filename.length() - extension.length());
+    }
+    return filename;
 }
 
 } // anonymous namespace
@@ -98,51 +187,159 @@ void Http::setupDefaultMiddleware() {
 }
 
 /**
- * Parse HTTP date format (RFC 2616)
- * Example: "Wed, 01 Jan 2025 00:00:00 GMT"
+ * The shared routes, with the built-in cookie demo endpoints
  */
-time_t Http::parseHttpDate(const std::string& date_str) {
-    struct tm tm = {};
-    // Try to parse the date string
-    if (strptime(date_str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == nullptr) {
-        return 0; // Return epoch on parse failure
-    }
-    // Set DST flag to -1 to let mktime determine it
-    tm.tm_isdst = -1;
-
-    // Save current timezone
-    char* tz = getenv("TZ");
-    std::string old_tz;
-    if (tz)
-        old_tz = tz;
-
-    // Set timezone to UTC
-    setenv("TZ", "UTC", 1);
-    tzset();
-
-    // Convert to time_t
-    time_t result = mktime(&tm);
-
-    // Restore original timezone
-    if (old_tz.empty()) {
-        unsetenv("TZ");
+Router& Http::router() {
+    static Router routes = [] {
+        Router router;
+        router.add(Method::Get, "/cookie-demo",
+                   [](Http& http, const RouteRequest& request) { http.cookieDemo(request); });
+        router.add(Method::Get, "/set-cookie", [](Http& http, const RouteRequest& request) {
+            http.setCookieFromQuery(request);
+        });
+        router.add(Method::Get, "/clear-cookies",
+                   [](Http& http, const RouteRequest& request) { http.clearCookies(request); });
+        return router;
+    }();
+    return routes;
+}
+
+void Http::logAccess(std::string_view request_line, int status, size_t size,
+                     const std::map<std::string, std::string>& headermap) {
+    Log& log = Log::getInstance();
+    log.openLogFile("logs/access_log");
+    auto referer_it = headermap.find("Referer");
+    auto user_agent_it = headermap.find("User-Agent");
+    log.writeLogLine(inet_ntoa(sock->client.sin_addr), std::string(request_line), status, size,
+                     referer_it != headermap.end() ? referer_it->second : "",
+                     user_agent_it != headermap.end() ? user_agent_it->second : "");
+}
+
+/**
+ * GET /cookie-demo: count visits in a cookie and list the cookies sent
+ */
+void Http::cookieDemo(const RouteRequest& request) {
+    // Parse cookies from request
+    std::map<std::string, std::string> cookies;
+    auto cookie_it = request.headers.find("Cookie");
+    if (cookie_it != request.headers.end()) {
+        cookies = parseCookies(cookie_it->second);
+    }
+
+    // Generate response
+    std::string response = "<html><head><title>Cookie Demo</title></head><body>\n";
+    response += "<h1>Cookie Demo</h1>\n";
+
+    // Check if we have a visit count cookie
+    int visit_count = 1;
+    auto count_it = cookies.find("visit_count");
+    if (count_it != cookies.end()) {
+        try {
+            visit_count = std::stoi(count_it->second) + 1;
+        } catch (...) {
+            visit_count = 1;
+        }
+    }
+
+    response += "<p>Visit count: " + std::to_string(visit_count) + "</p>\n";
+
+    // Display all cookies
+    response += "<h2>Current Cookies:</h2>\n";
+    if (cookies.empty()) {
+        response += "<p>No cookies set</p>\n";
     } else {
-        setenv("TZ", old_tz.c_str(), 1);
+        response += "<ul>\n";
+        for (const auto& [name, value] : cookies) {
+            response += "<li>" + name + " = " + value + "</li>\n";
+        }
+        response += "</ul>\n";
     }
-    tzset();
 
-    return result;
+    response += "<h2>Actions:</h2>\n";
+    response += "<ul>\n";
+    response += "<li><a href='/cookie-demo'>Refresh (increment visit count)</a></li>\n";
+    response += "<li><a href='/set-cookie?name=user&value=john'>Set user=john cookie</a></li>\n";
+    response += "<li><a href='/set-cookie?name=theme&value=dark'>Set theme=dark cookie</a></li>\n";
+    response += "<li><a href='/clear-cookies'>Clear all cookies</a></li>\n";
+    response += "</ul>\n";
+    response += "</body></html>";
+
+    // Set visit count cookie
+    setCookie("visit_count", std::to_string(visit_count), "/", 3600); // 1 hour
+
+    sendHeader(200, response.length(), "text/html", request.keep_alive);
+    sock->write_line(response);
+    logAccess(request.request_line, 200, response.length(), request.headers);
 }
 
 /**
- * Check if a file has been modified since the given time
+ * GET /set-cookie?name=...&value=...: set a cookie, then go back to the demo
  */
-bool Http::isModifiedSince(const std::string& filename, time_t since_time) {
-    struct stat file_stat;
-    if (stat(filename.c_str(), &file_stat) != 0) {
-        return true; // If we can't stat the file, assume it's modified
+void Http::setCookieFromQuery(const RouteRequest& request) {
+    std::string_view query = request.query;
+    std::string cookie_name = "test";
+    std::string cookie_value = "value";
+
+    // Parse query parameters (simple implementation)
+    size_t name_pos = query.find("name=");
+    size_t value_pos = query.find("value=");
+    if (name_pos != std::string_view::npos) {
+        size_t end = query.find('&', name_pos);
+        cookie_name = query.substr(name_pos + 5, end != std::string_view::npos
+                                                     ? end - (name_pos + 5)
+                                                     : std::string_view::npos);
+    }
+    if (value_pos != std::string_view::npos) {
+        size_t end = query.find('&', value_pos);
+        cookie_value = query.substr(value_pos + 6, end != std::string_view::npos
+                                                       ? end - (value_pos + 6)
+                                                       : std::string_view::npos);
+    }
+
+    setCookie(cookie_name, cookie_value, "/", 3600); // 1 hour
+    sendRedirect(302, "/cookie-demo", request.keep_alive);
+    logAccess(request.request_line, 302, 0, request.headers);
+}
+
+/**
+ * GET /clear-cookies: expire the demo's cookies, then go back to it
+ */
+void Http::clearCookies(const RouteRequest& request) {
+    setCookie("visit_count", "", "/", 0);
+    setCookie("user", "", "/", 0);
+    setCookie("theme", "", "/", 0);
+
+    sendRedirect(302, "/cookie-demo", request.keep_alive);
+    logAccess(request.request_line, 302, 0, request.headers);
+}
+
+/**
+ * Evaluate conditional request headers (RFC 9110 Section 13.2.2).
+ * Sends 304 Not Modified or 412 Precondition Failed and returns false when
+ * the request must not be processed further.
+ */
+bool Http::checkPreconditions(std::string_view method,
+                              const std::map<std::string, std::string>& headermap,
+                              const ResourceValidators& validators, bool keep_alive,
+                              const std::vector<std::string>& extra_headers) {
+    auto conditions = ConditionalHeaders::from(headermap);
+    switch (ConditionalRequest::evaluate(method, conditions, validators)) {
+    case PreconditionResult::Proceed:
+        return true;
+    case PreconditionResult::NotModified:
+        // 304 carries the validators and Vary a 200 would have, but no body
+        sendHeader(304, 0, "", keep_alive, extra_headers);
+        return false;
+    case PreconditionResult::PreconditionFailed: {
+        std::string error_msg = "412 Precondition Failed\n";
+        sendHeader(412, error_msg.length(), "text/plain", keep_alive);
+        if (sock) {
+            sock->write_line(error_msg);
+        }
+        return false;
+    }
     }
-    return file_stat.st_mtime > since_time;
+    return true;
 }
 
 /**
@@ -201,40 +398,57 @@ void Http::printConnectionType(bool keep_alive) {
 }
 
 std::string Http::sanitizeFilename(std::string_view filename) {
-    std::filesystem::path path;
+    return *mapTarget(filename, [](const std::string& path) {
+        return OpenFileCache::getInstance().open(path);
+    });
+}
 
-    // Remove leading '/' from filename
-    if (!filename.empty() && filename[0] == '/') {
-        filename.remove_prefix(1);
+bool Http::servesFromCache(std::string_view target, bool negotiate) {
+    std::string_view path = target.substr(0, target.find('?'));
+    if (protects(std::string(target)) || path.ends_with(".sh") ||
+        FastCgi::handles(path, FastCgi::options())) {
+        return false; // Argon2, or left to the FastCGI application
     }
 
-    // Default page
-    if (filename.empty()) {
-        path = "htdocs/index.html";
-    } else {
-        // Remove any trailing newlines
-        auto pos = filename.find('\n');
-        if (pos != std::string_view::npos) {
-            filename = filename.substr(0, pos);
-        }
-        path = std::filesystem::path("htdocs") / filename;
-
-        // If the path is a directory, append index.html
-        if (std::filesystem::is_directory(path)) {
-            path = path / "index.html";
-        }
+    OpenFileCache& cache = OpenFileCache::getInstance();
+    auto filename = mapTarget(target, [&cache](const std::string& path) {
+        return cache.cached(path);
+    });
+    auto file = filename ? cache.cached(*filename) : nullptr;
+    if (!file) {
+        return false;
+    }
+    if (file->regular() && !negotiate) {
+        return true;
     }
+    // Content negotiation looks for variants, and so does remembering a missing file
+    return std::ranges::all_of(ContentNegotiator::variantPaths(variantBase(*filename)),
+                               [&cache](const std::string& variant) {
+                                   return cache.cached(variant) != nullptr;
+                               });
+}
 
-    return path.string();
+/**
+ * Remember a target whose file doesn't exist, so the connection answers it
+ * with NegativeCache's 404 from then on. Only plain misses qualify: the
+ * connection never looks up a target with a query, and a variant found by
+ * content negotiation would be served instead.
+ */
+void Http::rememberMissing(const std::string& target, const std::string& filename, int error) {
+    if ((error != ENOENT && error != ENOTDIR) || target.find('?') != std::string::npos ||
+        NegativeCache::options().max_entries == 0) {
+        return;
+    }
+    if (content_negotiator.findVariants(variantBase(filename)).empty()) {
+        NegativeCache::getInstance().insert(target, filename);
+    }
 }
 
 /**
  * Sends a file down an open socket.
  */
-void Http::sendFile(std::string_view filename) {
-    // Open file
-    std::ifstream file(filename.data(), std::ios::in | std::ios::binary);
-    if (!file) {
+void Http::sendFile(std::string_view filename, std::shared_ptr<const OpenFileCache::File> file) {
+    if (!file->regular()) {
         std::cerr << "Error opening file: " << filename << std::endl;
         return;
     }
@@ -244,41 +458,39 @@ void Http::sendFile(std::string_view filename) {
     std::string file_extension = filepath.extension().string();
 
     // Determine file size with overflow protection
-    auto size = getFileSizeSafe(file);
+    auto size = getFileSizeSafe(*file);
     if (size < 0) {
         std::cerr << "Error: file too large or invalid: " << filename << std::endl;
         return;
     }
 
-    // Read entire file into vector
-    std::vector<char> buffer(static_cast<size_t>(size));
-    if (!file.read(buffer.data(), size)) {
+    // Large unfiltered files go out without passing through this process
+    if (size >= SEND_FILE_MIN_SIZE && !isFilteredExtension(file_extension) &&
+        sock->send_file(file, 0, static_cast<size_t>(size))) {
+        return;
+    }
+
+    // Read the file into a buffer of its own, which the socket queues without copying
+    auto buffer = readFileRange(*file, 0, static_cast<size_t>(size));
+    if (!buffer) {
         std::cerr << "Error reading file!" << std::endl;
         return;
     }
 
     // Text manipulate contents of .shtml
-    std::string filtered;
-    if (file_extension == ".shtml" || file_extension == ".shtm") {
+    if (isFilteredExtension(file_extension)) {
         // Add the footer
-        std::string s_buffer(buffer.begin(), buffer.end());
         Filter filter;
-        filtered = filter.addFooter(s_buffer);
-
-        // Send filtered content
-        if (sock->write_raw(filtered.data(), filtered.length()) == -1) {
-            perror("send");
-        }
+        sock->write_shared(std::make_shared<const std::string>(filter.addFooter(*buffer)));
     } else {
-        // Send raw buffer
-        if (sock->write_raw(buffer.data(), buffer.size()) == -1) {
-            perror("send");
-        }
+        sock->write_shared(std::move(buffer));
     }
 }
 
-void Http::sendFileWithMiddleware(std::string_view filename, const std::string& method,
-                                  const std::string& path, const std::string& version,
+void Http::sendFileWithMiddleware(std::string_view filename,
+                                  std::shared_ptr<const OpenFileCache::File> file,
+                                  const std::string& method, const std::string& path,
+                                  const std::string& version,
                                   const std::map<std::string, std::string>& headermap) {
     // Create request context
     RequestContext ctx;
@@ -288,30 +500,37 @@ void Http::sendFileWithMiddleware(std::string_view filename, const std::string&
     ctx.headers = headermap;
     ctx.http_handler = this;
 
-    // Open file and read content
-    std::ifstream file(filename.data(), std::ios::in | std::ios::binary);
-    if (!file) {
+    // Read the file's content. Large files the footer filter doesn't touch
+    // are left on disk when the transport can send them directly; the chain
+    // then sees an empty body and the file is attached after it has run.
+    long long direct_size = -1;
+    if (!file->regular()) {
         ctx.status_code = 404;
         ctx.response_body =
             "<html><head><title>404</title></head><body>404 not found</body></html>";
         ctx.content_type = "text/html";
     } else {
         // Determine file size with overflow protection
-        auto size = getFileSizeSafe(file);
+        auto size = getFileSizeSafe(*file);
         if (size < 0) {
             ctx.status_code = 413;
             ctx.response_body = "<html><body>413 Payload Too Large - File exceeds size limit</body></html>";
             ctx.content_type = "text/html";
+        } else if (size >= SEND_FILE_MIN_SIZE && sock->can_send_file() &&
+                   !isFilteredExtension(std::filesystem::path(filename).extension().string())) {
+            direct_size = size;
+            ctx.status_code = 200;
+            ctx.content_type = Mime::getInstance().getMimeFromExtension(filename);
         } else {
             // Read entire file
-            std::vector<char> buffer(static_cast<size_t>(size));
-            if (!file.read(buffer.data(), size)) {
+            auto buffer = readFileRange(*file, 0, static_cast<size_t>(size));
+            if (!buffer) {
                 ctx.status_code = 500;
                 ctx.response_body = "<html><body>500 Internal Server Error</body></html>";
                 ctx.content_type = "text/html";
             } else {
                 ctx.status_code = 200;
-                ctx.response_body = std::string(buffer.begin(), buffer.end());
+                ctx.response_body = std::move(*buffer);
 
                 // Determine content type
                 Mime& mime = Mime::getInstance();
@@ -332,10 +551,18 @@ void Http::sendFileWithMiddleware(std::string_view filename, const std::string&
             sock->write_line(key + ": " + value);
         }
 
-        // Send the response body
-        if (sock->write_raw(ctx.response_body.data(), ctx.response_body.length()) == -1) {
-            perror("send");
+        // Send the file directly if nothing in the chain replaced the body
+        if (direct_size >= 0 && ctx.status_code == 200 && ctx.response_body.empty()) {
+            if (sock->send_file(file, 0, static_cast<size_t>(direct_size))) {
+                return;
+            }
+            if (auto buffer = readFileRange(*file, 0, static_cast<size_t>(direct_size))) {
+                ctx.response_body = std::move(*buffer);
+            }
         }
+
+        // Send the response body, moved rather than copied into the socket's output
+        sock->write_shared(std::make_shared<const std::string>(std::move(ctx.response_body)));
     }
 }
 
@@ -349,6 +576,10 @@ bool Http::parseHeader(std::string_view header) {
 
     unsigned int i;
 
+    last_status_ = 0;
+    last_method_.clear();
+    last_version_.clear();
+
     // Handle empty header (connection closed)
     if (header.empty()) {
         if (DEBUG) {
@@ -388,6 +619,8 @@ bool Http::parseHeader(std::string_view header) {
     std::string method = tokentmp[0];
     std::string uri = tokentmp[1];
     std::string http_version = tokentmp[2];
+    last_method_ = method;
+    last_version_ = http_version;
 
     // Store method and URI in headermap for backward compatibility
     headermap[method] = uri;
@@ -410,6 +643,7 @@ bool Http::parseHeader(std::string_view header) {
 
     /* Seperate each request header with the name and value and insert into a
      * hash map */
+    BodyFraming framing;
     for (i = 1; i < tokens.size(); i++) {
         // Skip empty lines
         if (tokens[i].empty() || tokens[i] == "\r") {
@@ -449,6 +683,7 @@ bool Http::parseHeader(std::string_view header) {
                 }
             }
 
+            framing.add(name, value);
             headermap[name] = value;
         }
     }
@@ -465,46 +700,24 @@ bool Http::parseHeader(std::string_view header) {
         }
     }
 
-    // SECURITY: Reject requests with both Content-Length and Transfer-Encoding
-    // This prevents CL.TE and TE.CL request smuggling attacks
-    if (headermap.find("Content-Length") != headermap.end() &&
-        headermap.find("Transfer-Encoding") != headermap.end()) {
+    // SECURITY: Reject requests whose body framing could be read two ways, whatever
+    // the case of the field names: Content-Length with Transfer-Encoding, a
+    // Content-Length that isn't all digits or disagrees with another, or a
+    // Transfer-Encoding other than "chunked". This prevents CL.TE and TE.CL request
+    // smuggling attacks
+    if (!framing.valid()) {
         if (DEBUG) {
-            std::cout << "SECURITY: Request has both Content-Length and Transfer-Encoding headers. "
+            std::cout << "SECURITY: Ambiguous Content-Length or Transfer-Encoding. "
                       << "Rejecting to prevent smuggling attack." << std::endl;
         }
         if (sock) {
             sendHeader(400, 0, "text/html", false);
-            sock->write_line(
-                "<html><body>400 Bad Request - Content-Length and Transfer-Encoding are "
-                "mutually exclusive</body></html>");
+            sock->write_line("<html><body>400 Bad Request - Invalid Content-Length or "
+                             "Transfer-Encoding</body></html>");
         }
         return false;
     }
 
-    // SECURITY: Validate Transfer-Encoding value is strictly "chunked"
-    // Reject malformed values like "chunked, identity" or "identity, chunked" that can cause
-    // smuggling
-    auto te_it = headermap.find("Transfer-Encoding");
-    if (te_it != headermap.end()) {
-        std::string te_value = te_it->second;
-        // Normalize whitespace for comparison
-        te_value.erase(std::remove_if(te_value.begin(), te_value.end(), ::isspace), te_value.end());
-
-        if (te_value != "chunked") {
-            if (DEBUG) {
-                std::cout << "SECURITY: Invalid Transfer-Encoding value: '" << te_it->second
-                          << "'. Only 'chunked' is supported." << std::endl;
-            }
-            if (sock) {
-                sendHeader(400, 0, "text/html", false);
-                sock->write_line("<html><body>400 Bad Request - Invalid Transfer-Encoding value. "
-                                 "Only 'chunked' is supported.</body></html>");
-            }
-            return false;
-        }
-    }
-
     // HTTP/1.1 requires Host header
     if (http_version == "HTTP/1.1" && headermap.find("Host") == headermap.end()) {
         if (DEBUG) {
@@ -547,7 +760,7 @@ bool Http::parseHeader(std::string_view header) {
         }
 
         // Periodically cleanup rate limit map (every 100th request)
-        static int cleanup_counter = 0;
+        thread_local int cleanup_counter = 0;
         if (++cleanup_counter >= 100) {
             cleanupRateLimitMap();
             cleanup_counter = 0;
@@ -563,9 +776,8 @@ bool Http::parseHeader(std::string_view header) {
     }
 
     // Check if we have a valid request method
-    if (headermap.find("GET") == headermap.end() && headermap.find("HEAD") == headermap.end() &&
-        headermap.find("POST") == headermap.end() && headermap.find("OPTIONS") == headermap.end() &&
-        headermap.find("PUT") == headermap.end() && headermap.find("DELETE") == headermap.end()) {
+    std::optional<Method> request_method = parseMethod(method);
+    if (!request_method) {
         if (DEBUG) {
             std::cout << "No valid request method found in headermap" << std::endl;
         }
@@ -573,6 +785,7 @@ bool Http::parseHeader(std::string_view header) {
             // Send 405 Method Not Allowed with Allow header
             std::ostringstream headerStream;
             headerStream << "HTTP/1.1 405 Method Not Allowed\r\n";
+            last_status_ = 405;
 
             // Generate date header
             std::array<char, 50> buf;
@@ -592,27 +805,84 @@ bool Http::parseHeader(std::string_view header) {
         return false;
     }
 
-    if (sock) {
-        if (headermap.find("GET") != headermap.end()) {
-            processGetRequest(headermap, request_line, keep_alive);
-        } else if (headermap.find("HEAD") != headermap.end()) {
-            processHeadRequest(headermap, keep_alive);
-        } else if (headermap.find("POST") != headermap.end()) {
-            processPostRequest(headermap, keep_alive);
-        } else if (headermap.find("PUT") != headermap.end()) {
-            processPutRequest(headermap, request_line, keep_alive);
-        } else if (headermap.find("DELETE") != headermap.end()) {
-            processDeleteRequest(headermap, request_line, keep_alive);
-        } else if (headermap.find("OPTIONS") != headermap.end()) {
-            processOptionsRequest(headermap, keep_alive);
+    if (!sock) {
+        return keep_alive;
+    }
+
+    // Registered handlers first, then files (coroutine handlers are run by the connection)
+    std::string_view target = uri;
+    size_t query_start = target.find('?');
+    std::string_view path = target.substr(0, query_start);
+    auto route = router().match(*request_method, path);
+    if (route && route->handler) {
+        if (checkAuthentication(uri, method, headermap, keep_alive)) {
+            std::string_view query =
+                query_start == std::string_view::npos ? "" : target.substr(query_start + 1);
+            RouteRequest request{headermap,    target,       path, query, request_line,
+                                 route->params, keep_alive};
+            (*route->handler)(*this, request);
         }
+        return keep_alive;
+    }
+
+    switch (*request_method) {
+    case Method::Get:
+        processGetRequest(headermap, request_line, keep_alive);
+        break;
+    case Method::Head:
+        processHeadRequest(headermap, keep_alive);
+        break;
+    case Method::Post:
+        processPostRequest(headermap, keep_alive);
+        break;
+    case Method::Put:
+        processPutRequest(headermap, request_line, keep_alive);
+        break;
+    case Method::Delete:
+        processDeleteRequest(headermap, request_line, keep_alive);
+        break;
+    case Method::Options:
+        processOptionsRequest(headermap, keep_alive);
+        break;
     }
 
     return keep_alive; // Return keep_alive status for connection handling
 }
 
+/**
+ * Whether a POST to this path runs a script (through the FastCGI
+ * application) rather than being answered here
+ */
+bool Http::runsScript(std::string_view path) {
+    struct stat script_stat;
+    std::string script = sanitizeFilename(path);
+    return FastCgi::handles(path, FastCgi::options()) ||
+           (stat(script.c_str(), &script_stat) == 0 && S_ISREG(script_stat.st_mode) &&
+            (script_stat.st_mode & S_IXUSR));
+}
+
 void Http::processPostRequest(const std::map<std::string, std::string>& headermap,
                               bool keep_alive) {
+    // Get the requested URI
+    auto post_it = headermap.find("POST");
+    if (post_it == headermap.end()) {
+        return;
+    }
+    std::string uri = post_it->second;
+
+    // A form body the connection parsed as it arrived, instead of buffering it
+    if (FormParser* form = sock->parsed_form()) {
+        form->finish();
+        sendPostResponse(headermap, uri, form, "", keep_alive);
+        return;
+    }
+
+    // A script's body the connection streams to the application as it arrives
+    if (sock->streamed_body()) {
+        forwardToApplication(headermap, "POST", uri, {}, keep_alive);
+        return;
+    }
+
     // Check for Transfer-Encoding header
     auto transfer_encoding_it = headermap.find("Transfer-Encoding");
     bool is_chunked = false;
@@ -624,10 +894,12 @@ void Http::processPostRequest(const std::map<std::string, std::string>& headerma
     std::string body_str;
 
     if (is_chunked) {
-        // Read chunked body
-        body_str = readChunkedBody();
-        // Note: empty body is valid for chunked encoding
-        // readChunkedBody() sends error responses if needed
+        // Read chunked body (empty is valid); readChunkedBody() sends error responses
+        auto chunked_body = readChunkedBody();
+        if (!chunked_body) {
+            return;
+        }
+        body_str = std::move(*chunked_body);
     } else {
         // Check for Content-Length header (required for POST when not chunked)
         auto content_length_it = headermap.find("Content-Length");
@@ -701,83 +973,83 @@ void Http::processPostRequest(const std::map<std::string, std::string>& headerma
         std::cout << "POST body (" << body_str.length() << " bytes): " << body_str << std::endl;
     }
 
-    // Get the requested URI
-    auto post_it = headermap.find("POST");
-    if (post_it == headermap.end()) {
+    // Scripts are run by the FastCGI application
+    if (runsScript(std::string_view(uri).substr(0, uri.find('?')))) {
+        forwardToApplication(headermap, "POST", uri, std::move(body_str), keep_alive);
         return;
     }
-    std::string uri = post_it->second;
 
-    // Parse Content-Type
-    std::string content_type;
+    // Parse the POST data based on content type
     auto content_type_it = headermap.find("Content-Type");
+    std::unique_ptr<FormParser> form;
     if (content_type_it != headermap.end()) {
-        content_type = content_type_it->second;
+        form = FormParser::create(content_type_it->second);
     }
-
-    // Parse the POST data based on content type
-    std::map<std::string, std::string> post_params;
-
-    if (content_type.find("application/x-www-form-urlencoded") != std::string::npos) {
-        post_params = parseFormUrlEncoded(body_str);
-    } else if (content_type.find("multipart/form-data") != std::string::npos) {
-        std::string boundary = getBoundaryFromContentType(content_type);
-        post_params = parseMultipartFormData(body_str, boundary);
+    if (form && form->consume(body_str)) {
+        form->finish();
     }
     // For other content types (like application/json), we keep the raw body
+    sendPostResponse(headermap, uri, form.get(), body_str, keep_alive);
+}
 
-    // Check if this is a CGI request
-    std::string filename = "htdocs" + uri;
-    filename = sanitizeFilename(filename);
-
-    // Check if file exists and is executable (CGI script)
-    struct stat file_stat;
-    if (stat(filename.c_str(), &file_stat) == 0 && (file_stat.st_mode & S_IXUSR)) {
-        // This is a CGI script - we need to set up the environment and execute it
-        // Create a new headermap with POST data for CGI
-        std::map<std::string, std::string> cgi_headers = headermap;
-        cgi_headers["REQUEST_METHOD"] = "POST";
-        cgi_headers["CONTENT_LENGTH"] = std::to_string(body_str.length());
-        if (!content_type.empty()) {
-            cgi_headers["CONTENT_TYPE"] = content_type;
-        }
-
-        // For CGI, we need to pipe the POST body to stdin
-        // This requires modifying the CGI handler to accept POST data
-        // For now, we'll send a response indicating CGI POST is not yet fully implemented
-        std::string response = "<html><body><h1>501 Not Implemented</h1>\n";
-        response += "<p>POST to CGI scripts is not yet fully implemented.</p>\n";
-        response += "</body></html>";
-
-        sendHeader(501, response.length(), "text/html", keep_alive);
-        sock->write_line(response);
-
-        // Log the request
-        Log& log = Log::getInstance();
-        log.openLogFile("logs/access_log");
-        auto referer_it = headermap.find("Referer");
-        auto user_agent_it = headermap.find("User-Agent");
-        log.writeLogLine(inet_ntoa(sock->client.sin_addr), "POST " + uri, 501, response.length(),
-                         referer_it != headermap.end() ? referer_it->second : "",
-                         user_agent_it != headermap.end() ? user_agent_it->second : "");
+/**
+ * Respond to a POST Http answers itself, listing the parsed form fields or
+ * else echoing the raw body
+ */
+void Http::sendPostResponse(const std::map<std::string, std::string>& headermap,
+                            const std::string& uri, const FormParser* form,
+                            std::string_view body, bool keep_alive) {
+    if (form && form->error() != FormParser::Error::None) {
+        std::string_view error_msg;
+        int status = 400;
+        if (form->error() == FormParser::Error::Malformed) {
+            error_msg = "<html><body>400 Bad Request - Malformed form data</body></html>";
+        } else if (form->error() == FormParser::Error::TooLarge) {
+            status = 413;
+            error_msg = "<html><body>413 Payload Too Large - Form data exceeds size "
+                        "limit</body></html>";
+        } else {
+            status = 500;
+            error_msg = "<html><body>500 Internal Server Error - Could not store "
+                        "upload</body></html>";
+        }
+        sendHeader(status, error_msg.length(), "text/html", keep_alive);
+        sock->write_line(error_msg);
         return;
     }
 
-    // For now, return a response showing the parsed POST data
+    auto content_type_it = headermap.find("Content-Type");
+    std::string content_type =
+        content_type_it != headermap.end() ? content_type_it->second : std::string();
+    auto content_length_it = headermap.find("Content-Length");
+    std::string content_length = content_length_it != headermap.end()
+                                     ? content_length_it->second
+                                     : std::to_string(body.length());
+
+    // For now, return a response showing the POST data
     std::string response = "<html><body><h1>POST Request Received</h1>\n";
     response += "<p>URI: " + uri + "</p>\n";
-    response += "<p>Content-Length: " + std::to_string(body_str.length()) + "</p>\n";
+    response += "<p>Content-Length: " + content_length + "</p>\n";
     response += "<p>Content-Type: " + content_type + "</p>\n";
 
-    if (!post_params.empty()) {
+    if (form && !form->fields().empty()) {
         response += "<h2>Parsed Form Data:</h2>\n<table border='1'>\n";
         response += "<tr><th>Field</th><th>Value</th></tr>\n";
-        for (const auto& [key, value] : post_params) {
-            response += "<tr><td>" + key + "</td><td>" + value + "</td></tr>\n";
+        for (const FormField& field : form->fields()) {
+            response += std::format("<tr><td>{}</td><td>", field.name);
+            if (field.spooled()) {
+                response += std::format("({} bytes{}{})", field.size,
+                                        field.filename.empty() ? "" : ", file ", field.filename);
+            } else {
+                response += field.value;
+            }
+            response += "</td></tr>\n";
         }
         response += "</table>\n";
     } else {
-        response += "<h2>Raw Body:</h2><pre>" + body_str + "</pre>\n";
+        response += "<h2>Raw Body:</h2><pre>";
+        response += body;
+        response += "</pre>\n";
     }
 
     response += "</body></html>";
@@ -820,10 +1092,12 @@ void Http::processPutRequest(const std::map<std::string, std::string>& headermap
     std::string body;
 
     if (is_chunked) {
-        // Read chunked body
-        body = readChunkedBody();
-        // Note: empty body is valid for chunked encoding
-        // readChunkedBody() sends error responses if needed
+        // Read chunked body (empty is valid); readChunkedBody() sends error responses
+        auto chunked_body = readChunkedBody();
+        if (!chunked_body) {
+            return;
+        }
+        body = std::move(*chunked_body);
     } else {
         // Check if Content-Length is present
         auto content_length_it = headermap.find("Content-Length");
@@ -857,7 +1131,17 @@ void Http::processPutRequest(const std::map<std::string, std::string>& headermap
     }
 
     // Check if file exists to determine response code
-    bool file_exists = std::filesystem::exists(filename);
+    struct stat file_stat;
+    bool file_exists = stat(filename.c_str(), &file_stat) == 0;
+
+    // If-Match / If-None-Match: * / If-Unmodified-Since guard against lost updates
+    ResourceValidators validators;
+    if (file_exists) {
+        validators = ConditionalRequest::validatorsFor(file_stat);
+    }
+    if (!checkPreconditions("PUT", headermap, validators, keep_alive)) {
+        return;
+    }
 
     // Write content to file
     std::ofstream outfile(filename, std::ios::binary | std::ios::trunc);
@@ -873,6 +1157,11 @@ void Http::processPutRequest(const std::map<std::string, std::string>& headermap
 
     outfile.write(body.c_str(), body.length());
     outfile.close();
+    OpenFileCache::getInstance().forget(filename);
+    if (!file_exists) {
+        // Other targets may name the same file, so every missing path is looked up again
+        NegativeCache::getInstance().clear();
+    }
 
     // Return 201 Created if new file, 200 OK if updated
     int status_code = file_exists ? 200 : 201;
@@ -927,9 +1216,18 @@ void Http::processDeleteRequest(const std::map<std::string, std::string>& header
         return;
     }
 
+    // Only delete the representation the client expects
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) == 0 &&
+        !checkPreconditions("DELETE", headermap, ConditionalRequest::validatorsFor(file_stat),
+                            keep_alive)) {
+        return;
+    }
+
     // Delete the file
     std::error_code ec;
     bool removed = std::filesystem::remove(filename, ec);
+    OpenFileCache::getInstance().forget(filename);
 
     if (!removed || ec) {
         // Could not delete file - return 500 Internal Server Error
@@ -956,91 +1254,57 @@ void Http::processDeleteRequest(const std::map<std::string, std::string>& header
 
 /**
  * Read a chunked request body according to RFC 7230
- * Returns the complete body with chunks decoded
+ * Returns the complete body with chunks decoded, or nothing once an error
+ * response has been sent
  */
-std::string Http::readChunkedBody() {
+std::optional<std::string> Http::readChunkedBody() {
+    // Decoded from slices of the buffered request, without copying lines out
     std::string body;
-    std::string line;
-
-    while (true) {
-        // Read chunk size line (hex number followed by CRLF)
-        if (!sock->read_line(&line)) {
-            break;
+    ChunkedDecoder decoder;
+    while (!decoder.done()) {
+        std::string_view input = sock->buffered_input();
+        if (input.empty()) {
+            // The connection stopped reading before the end (see AsioConnectionDriver)
+            std::string error_msg = "400 Bad Request - Incomplete chunk data\n";
+            sendHeader(400, error_msg.length(), "text/plain");
+            sock->write_line(error_msg);
+            return std::nullopt;
         }
 
-        // Parse chunk size (ignore any chunk extensions after semicolon)
-        size_t semicolon_pos = line.find(';');
-        std::string size_str =
-            semicolon_pos != std::string::npos ? line.substr(0, semicolon_pos) : line;
-
-        // Remove whitespace
-        size_str.erase(0, size_str.find_first_not_of(" \t"));
-        size_str.erase(size_str.find_last_not_of(" \t\r\n") + 1);
-
-        // Convert hex string to integer
-        size_t chunk_size;
-        try {
-            chunk_size = std::stoull(size_str, nullptr, 16);
-        } catch (...) {
-            // Invalid chunk size - send 400 Bad Request
+        std::string_view data;
+        auto used = decoder.consume(input, data);
+        if (!used) {
             std::string error_msg = "400 Bad Request - Invalid chunk size\n";
             sendHeader(400, error_msg.length(), "text/plain");
             sock->write_line(error_msg);
-            return "";
-        }
-
-        // Chunk size of 0 indicates end of chunks
-        if (chunk_size == 0) {
-            // Read trailing headers (if any) until empty line
-            while (true) {
-                if (!sock->read_line(&line)) {
-                    break;
-                }
-                if (line.empty() || line == "\r\n" || line == "\n") {
-                    break;
-                }
-            }
-            break;
+            return std::nullopt;
         }
 
         // Check individual chunk size limit
-        if (chunk_size > RequestLimits::MAX_CHUNK_SIZE) {
+        if (decoder.chunk_size() > RequestLimits::MAX_CHUNK_SIZE) {
             if (DEBUG) {
-                std::cout << "Chunk too large: " << chunk_size << " bytes" << std::endl;
+                std::cout << "Chunk too large: " << decoder.chunk_size() << " bytes" << std::endl;
             }
             sendHeader(413, 0, "text/html");
             sock->write_line(
                 "<html><body>413 Payload Too Large - Chunk exceeds size limit</body></html>");
-            return "";
+            return std::nullopt;
         }
 
         // Check total body size limit
-        if (body.length() + chunk_size > RequestLimits::MAX_BODY_SIZE) {
+        if (body.length() + data.size() > RequestLimits::MAX_BODY_SIZE) {
             if (DEBUG) {
-                std::cout << "Total chunked body too large: " << (body.length() + chunk_size)
+                std::cout << "Total chunked body too large: " << (body.length() + data.size())
                           << " bytes" << std::endl;
             }
             sendHeader(413, 0, "text/html");
             sock->write_line("<html><body>413 Payload Too Large - Request body exceeds size "
                              "limit</body></html>");
-            return "";
+            return std::nullopt;
         }
 
-        // Read chunk data
-        std::vector<char> chunk_data(chunk_size);
-        ssize_t bytes_read = sock->read_raw(chunk_data.data(), chunk_size);
-        if (bytes_read < static_cast<ssize_t>(chunk_size)) {
-            // Incomplete chunk - send 400 Bad Request
-            std::string error_msg = "400 Bad Request - Incomplete chunk data\n";
-            sendHeader(400, error_msg.length(), "text/plain");
-            sock->write_line(error_msg);
-            return "";
-        }
-
-        body.append(chunk_data.data(), chunk_size);
-
-        // Read trailing CRLF after chunk data
-        sock->read_line(&line);
+        body.append(data);
+        sock->skip(*used);
     }
 
     return body;
@@ -1074,118 +1338,50 @@ void Http::writeChunkedEnd() {
 }
 
 /**
- * Parse application/x-www-form-urlencoded data
+ * Send a response of unknown length, its body generated a piece at a time
  */
-std::map<std::string, std::string> Http::parseFormUrlEncoded(const std::string& body) {
-    std::map<std::string, std::string> params;
-    std::string key, value;
-    bool parsing_key = true;
-
-    for (size_t i = 0; i < body.length(); ++i) {
-        char c = body[i];
-
-        if (c == '=') {
-            parsing_key = false;
-        } else if (c == '&') {
-            // URL decode and store the key-value pair
-            if (!key.empty()) {
-                // Simple URL decoding (replace + with space, decode %XX)
-                std::string decoded_key = key;
-                std::string decoded_value = value;
-
-                // Replace + with space
-                size_t pos = 0;
-                while ((pos = decoded_key.find('+', pos)) != std::string::npos) {
-                    decoded_key[pos] = ' ';
-                    pos++;
-                }
-                pos = 0;
-                while ((pos = decoded_value.find('+', pos)) != std::string::npos) {
-                    decoded_value[pos] = ' ';
-                    pos++;
-                }
-
-                // Decode %XX sequences
-                auto url_decode = [](std::string& str) {
-                    size_t pos = 0;
-                    while ((pos = str.find('%', pos)) != std::string::npos) {
-                        if (pos + 2 < str.length()) {
-                            std::string hex = str.substr(pos + 1, 2);
-                            try {
-                                int value = std::stoi(hex, nullptr, 16);
-                                str.replace(pos, 3, 1, static_cast<char>(value));
-                            } catch (...) {
-                                // Invalid hex sequence, skip
-                                pos++;
-                                continue;
-                            }
-                        }
-                        pos++;
-                    }
-                };
-
-                url_decode(decoded_key);
-                url_decode(decoded_value);
-
-                params[decoded_key] = decoded_value;
-            }
-
-            // Reset for next pair
-            key.clear();
-            value.clear();
-            parsing_key = true;
-        } else {
-            if (parsing_key) {
-                key += c;
-            } else {
-                value += c;
-            }
-        }
+void Http::sendChunkedResponse(int code, std::string_view content_type, BodyProducer producer,
+                               bool keep_alive, const std::vector<std::string>& extra_headers) {
+    std::string piece;
+    if (last_version_ == "HTTP/1.0") {
+        // No chunked coding before HTTP/1.1, so the body is collected for its length
+        std::string body;
+        while (producer(piece)) {
+            body += piece;
+            piece.clear();
+        }
+        sendHeader(code, static_cast<int>(body.size()), content_type, keep_alive, extra_headers);
+        sock->write_raw(body.data(), body.size());
+        return;
     }
 
-    // Don't forget the last pair
-    if (!key.empty()) {
-        // URL decode the last pair
-        std::string decoded_key = key;
-        std::string decoded_value = value;
-
-        // Replace + with space
-        size_t pos = 0;
-        while ((pos = decoded_key.find('+', pos)) != std::string::npos) {
-            decoded_key[pos] = ' ';
-            pos++;
-        }
-        pos = 0;
-        while ((pos = decoded_value.find('+', pos)) != std::string::npos) {
-            decoded_value[pos] = ' ';
-            pos++;
-        }
-
-        // Decode %XX sequences
-        auto url_decode = [](std::string& str) {
-            size_t pos = 0;
-            while ((pos = str.find('%', pos)) != std::string::npos) {
-                if (pos + 2 < str.length()) {
-                    std::string hex = str.substr(pos + 1, 2);
-                    try {
-                        int value = std::stoi(hex, nullptr, 16);
-                        str.replace(pos, 3, 1, static_cast<char>(value));
-                    } catch (...) {
-                        // Invalid hex sequence, skip
-                        pos++;
-                        continue;
-                    }
-                }
-                pos++;
-            }
-        };
-
-        url_decode(decoded_key);
-        url_decode(decoded_value);
+    std::vector<std::string> headers = extra_headers;
+    headers.emplace_back("Transfer-Encoding: chunked");
+    sendHeader(code, 0, content_type, keep_alive, headers);
+    if (sock->can_stream_response()) {
+        sock->stream_response(std::move(producer)); // Run as the client takes the body
+        return;
+    }
 
-        params[decoded_key] = decoded_value;
+    // Otherwise the whole body is written here
+    while (producer(piece)) {
+        writeChunkedData(piece);
+        piece.clear();
     }
+    writeChunkedEnd();
+}
 
+/**
+ * Parse application/x-www-form-urlencoded data
+ */
+std::map<std::string, std::string> Http::parseFormUrlEncoded(const std::string& body) {
+    UrlEncodedParser parser(body.size());
+    std::map<std::string, std::string> params;
+    if (parser.consume(body) && parser.finish()) {
+        for (const FormField& field : parser.fields()) {
+            params.insert_or_assign(std::string(field.name), std::string(field.value));
+        }
+    }
     return params;
 }
 
@@ -1212,70 +1408,20 @@ std::string Http::getBoundaryFromContentType(const std::string& content_type) {
 }
 
 /**
- * Parse multipart/form-data
- * This is a simplified parser that handles basic text fields
+ * Parse multipart/form-data held in memory, keeping every part there
  */
 std::map<std::string, std::string> Http::parseMultipartFormData(const std::string& body,
                                                                 const std::string& boundary) {
+    MultipartParser::Options options;
+    options.max_memory = body.size();
+    options.max_part_memory = body.size();
+    MultipartParser parser(boundary, options);
     std::map<std::string, std::string> params;
-
-    if (boundary.empty()) {
-        return params;
-    }
-
-    std::string delimiter = "--" + boundary;
-    std::string end_delimiter = "--" + boundary + "--";
-
-    size_t pos = 0;
-    size_t end_pos = body.find(end_delimiter);
-
-    while ((pos = body.find(delimiter, pos)) != std::string::npos && pos < end_pos) {
-        pos += delimiter.length();
-
-        // Skip CRLF after boundary
-        if (pos + 2 <= body.length() && body.substr(pos, 2) == "\r\n") {
-            pos += 2;
+    if (parser.consume(body) && parser.finish()) {
+        for (const FormField& field : parser.fields()) {
+            params.insert_or_assign(std::string(field.name), std::string(field.value));
         }
-
-        // Find headers end
-        size_t headers_end = body.find("\r\n\r\n", pos);
-        if (headers_end == std::string::npos) {
-            break;
-        }
-
-        // Parse headers
-        std::string headers = body.substr(pos, headers_end - pos);
-        std::string name;
-
-        // Extract name from Content-Disposition header
-        size_t name_pos = headers.find("name=\"");
-        if (name_pos != std::string::npos) {
-            name_pos += 6;
-            size_t name_end = headers.find("\"", name_pos);
-            if (name_end != std::string::npos) {
-                name = headers.substr(name_pos, name_end - name_pos);
-            }
-        }
-
-        // Move to content start
-        pos = headers_end + 4;
-
-        // Find next boundary
-        size_t content_end = body.find("\r\n" + delimiter, pos);
-        if (content_end == std::string::npos) {
-            break;
-        }
-
-        // Extract content
-        std::string content = body.substr(pos, content_end - pos);
-
-        if (!name.empty()) {
-            params[name] = content;
-        }
-
-        pos = content_end + 2;
     }
-
     return params;
 }
 
@@ -1394,6 +1540,45 @@ void Http::processOptionsRequest(const std::map<std::string, std::string>& heade
     sendOptionsHeader(keep_alive);
 }
 
+/**
+ * Leave a script request to the FastCGI application. The connection streams
+ * the application's response; nothing is written here unless the request
+ * can't be forwarded.
+ */
+void Http::forwardToApplication(const std::map<std::string, std::string>& headermap,
+                                std::string_view method, std::string_view uri, std::string body,
+                                bool keep_alive) {
+    std::string_view path = uri.substr(0, uri.find('?'));
+    std::string script = sanitizeFilename(path);
+    struct stat script_stat;
+    if (stat(script.c_str(), &script_stat) != 0 || !S_ISREG(script_stat.st_mode)) {
+        sendHeader(404, 0, "text/html", keep_alive);
+        sock->write_line("<html><head><title>404</title></head><body>404 not "
+                         "found</body></html>");
+        return;
+    }
+
+    std::error_code ec;
+    std::string document_root = std::filesystem::absolute("htdocs", ec).string();
+    std::string script_filename = std::filesystem::absolute(script, ec).string();
+    std::string remote_addr = inet_ntoa(sock->client.sin_addr);
+    // A streamed body has the length the client gave, or none if it is chunked
+    const BodyFraming* streamed = sock->streamed_body();
+    Cgi::Request request{.method = method,
+                         .uri = uri,
+                         .script_filename = script_filename,
+                         .document_root = document_root,
+                         .protocol = last_version_,
+                         .remote_addr = remote_addr,
+                         .remote_port = ntohs(sock->client.sin_port),
+                         .content_length = streamed ? streamed->content_length().value_or(0)
+                                                    : body.size()};
+    if (!sock->forward_fastcgi(Cgi::environment(request, headermap), std::move(body))) {
+        sendHeader(501, 0, "text/plain", keep_alive);
+        sock->write_line("501 Not Implemented - scripts need a FastCGI application (--fastcgi)\n");
+    }
+}
+
 /**
  * Processes an HTTP HEAD request.
  * @param headermap A map containing parsed HTTP headers.
@@ -1410,27 +1595,24 @@ void Http::processHeadRequest(const std::map<std::string, std::string>& headerma
     std::string file_extension = filepath.extension().string();
 
     // Open file
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    auto file = OpenFileCache::getInstance().open(filename);
 
     // Can't find the file, send 404 header
-    if (!file.is_open()) {
-        sendHeader(404, 0, "text/html", false);
+    if (!file->regular()) {
+        rememberMissing(it->second, filename, file->error());
+        sendHeader(404, NegativeCache::NOT_FOUND_BODY.size(), "text/html", keep_alive);
         return;
     }
 
-    // Check If-Modified-Since header
-    auto if_modified_since_it = headermap.find("If-Modified-Since");
-    if (if_modified_since_it != headermap.end()) {
-        time_t since_time = parseHttpDate(if_modified_since_it->second);
-        if (since_time > 0 && !isModifiedSince(filename, since_time)) {
-            // File has not been modified, send 304
-            sendHeader(304, 0, "", keep_alive);
-            return;
-        }
+    // Evaluate conditional headers against the file's stat
+    ResourceValidators validators = ConditionalRequest::validatorsFor(file->info());
+    std::vector<std::string> validator_headers = validatorHeaders(validators);
+    if (!checkPreconditions("HEAD", headermap, validators, keep_alive, validator_headers)) {
+        return;
     }
 
     // Determine file size with validation
-    auto size = getFileSizeSafe(file);
+    auto size = getFileSizeSafe(*file);
     if (size < 0) {
         sendHeader(413, 0, "text/html", keep_alive);
         sock->write_line("<html><body>413 Payload Too Large - File exceeds size limit</body></html>");
@@ -1445,21 +1627,9 @@ void Http::processHeadRequest(const std::map<std::string, std::string>& headerma
     auto range_it = headermap.find("Range");
     if (range_it != headermap.end()) {
         // If-Range support
-        bool honor_range = true;
         auto if_range_it = headermap.find("If-Range");
-        if (if_range_it != headermap.end()) {
-            if (if_range_it->second.find("GMT") != std::string::npos) {
-                time_t if_range_time = parseHttpDate(if_range_it->second);
-                struct stat file_stat;
-                if (stat(filename.c_str(), &file_stat) == 0) {
-                    if (file_stat.st_mtime > if_range_time) {
-                        honor_range = false;
-                    }
-                }
-            } else {
-                honor_range = false;
-            }
-        }
+        bool honor_range = if_range_it == headermap.end() ||
+                           ConditionalRequest::ifRangeMatches(if_range_it->second, validators);
 
         if (honor_range) {
             std::vector<ByteRange> ranges = parseRangeHeader(range_it->second);
@@ -1482,6 +1652,7 @@ void Http::processHeadRequest(const std::map<std::string, std::string>& headerma
                     // Send 206 header with Content-Range
                     std::ostringstream headerStream;
                     headerStream << "HTTP/1.1 206 Partial Content\r\n";
+                    last_status_ = 206;
 
                     std::array<char, 50> buf;
                     time_t ltime = time(nullptr);
@@ -1495,6 +1666,9 @@ void Http::processHeadRequest(const std::map<std::string, std::string>& headerma
                                  << "\r\n";
                     headerStream << "Content-Length: " << content_length << "\r\n";
                     headerStream << "Accept-Ranges: bytes\r\n";
+                    for (const auto& header : validator_headers) {
+                        headerStream << header << "\r\n";
+                    }
                     headerStream << "Connection: " << (keep_alive ? "keep-alive" : "close")
                                  << "\r\n";
                     headerStream << "\r\n";
@@ -1522,7 +1696,7 @@ void Http::processHeadRequest(const std::map<std::string, std::string>& headerma
                      user_agent_it != headermap.end() ? user_agent_it->second : "");
 
     // Send header
-    sendHeader(200, size, content_type, keep_alive);
+    sendHeader(200, size, content_type, keep_alive, validator_headers);
 }
 
 void Http::processGetRequest(const std::map<std::string, std::string>& headermap,
@@ -1538,135 +1712,10 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
         return; // Authentication failed, 401 already sent
     }
 
-    // Handle cookie demo
-    if (it->second == "/cookie-demo") {
-        // Parse cookies from request
-        std::map<std::string, std::string> cookies;
-        auto cookie_it = headermap.find("Cookie");
-        if (cookie_it != headermap.end()) {
-            cookies = parseCookies(cookie_it->second);
-        }
-
-        // Generate response
-        std::string response = "<html><head><title>Cookie Demo</title></head><body>\n";
-        response += "<h1>Cookie Demo</h1>\n";
-
-        // Check if we have a visit count cookie
-        int visit_count = 1;
-        auto count_it = cookies.find("visit_count");
-        if (count_it != cookies.end()) {
-            try {
-                visit_count = std::stoi(count_it->second) + 1;
-            } catch (...) {
-                visit_count = 1;
-            }
-        }
-
-        response += "<p>Visit count: " + std::to_string(visit_count) + "</p>\n";
-
-        // Display all cookies
-        response += "<h2>Current Cookies:</h2>\n";
-        if (cookies.empty()) {
-            response += "<p>No cookies set</p>\n";
-        } else {
-            response += "<ul>\n";
-            for (const auto& [name, value] : cookies) {
-                response += "<li>" + name + " = " + value + "</li>\n";
-            }
-            response += "</ul>\n";
-        }
-
-        response += "<h2>Actions:</h2>\n";
-        response += "<ul>\n";
-        response += "<li><a href='/cookie-demo'>Refresh (increment visit count)</a></li>\n";
-        response +=
-            "<li><a href='/set-cookie?name=user&value=john'>Set user=john cookie</a></li>\n";
-        response +=
-            "<li><a href='/set-cookie?name=theme&value=dark'>Set theme=dark cookie</a></li>\n";
-        response += "<li><a href='/clear-cookies'>Clear all cookies</a></li>\n";
-        response += "</ul>\n";
-        response += "</body></html>";
-
-        // Set visit count cookie
-        setCookie("visit_count", std::to_string(visit_count), "/", 3600); // 1 hour
-
-        // Send response
-        sendHeader(200, response.length(), "text/html", keep_alive);
-        sock->write_line(response);
-
-        // Log request
-        Log& log = Log::getInstance();
-        log.openLogFile("logs/access_log");
-        auto referer_it = headermap.find("Referer");
-        auto user_agent_it = headermap.find("User-Agent");
-        log.writeLogLine(inet_ntoa(sock->client.sin_addr), std::string(request_line), 200,
-                         response.length(), referer_it != headermap.end() ? referer_it->second : "",
-                         user_agent_it != headermap.end() ? user_agent_it->second : "");
-        return;
-    }
-
-    // Handle set-cookie endpoint
-    if (it->second.find("/set-cookie") == 0) {
-        std::string query = it->second.substr(11); // Remove "/set-cookie"
-        std::string cookie_name = "test";
-        std::string cookie_value = "value";
-
-        // Parse query parameters (simple implementation)
-        if (query.length() > 1 && query[0] == '?') {
-            query = query.substr(1);
-            size_t name_pos = query.find("name=");
-            size_t value_pos = query.find("value=");
-
-            if (name_pos != std::string::npos) {
-                size_t end = query.find('&', name_pos);
-                cookie_name =
-                    query.substr(name_pos + 5, end != std::string::npos ? end - (name_pos + 5)
-                                                                        : std::string::npos);
-            }
-
-            if (value_pos != std::string::npos) {
-                size_t end = query.find('&', value_pos);
-                cookie_value =
-                    query.substr(value_pos + 6, end != std::string::npos ? end - (value_pos + 6)
-                                                                         : std::string::npos);
-            }
-        }
-
-        // Set the cookie
-        setCookie(cookie_name, cookie_value, "/", 3600); // 1 hour
-
-        // Redirect back to demo using proper HTTP redirect
-        sendRedirect(302, "/cookie-demo", keep_alive);
-
-        // Log request
-        Log& log = Log::getInstance();
-        log.openLogFile("logs/access_log");
-        auto referer_it = headermap.find("Referer");
-        auto user_agent_it = headermap.find("User-Agent");
-        log.writeLogLine(inet_ntoa(sock->client.sin_addr), std::string(request_line), 302, 0,
-                         referer_it != headermap.end() ? referer_it->second : "",
-                         user_agent_it != headermap.end() ? user_agent_it->second : "");
-        return;
-    }
-
-    // Handle clear-cookies endpoint
-    if (it->second == "/clear-cookies") {
-        // Set all cookies to expire
-        setCookie("visit_count", "", "/", 0);
-        setCookie("user", "", "/", 0);
-        setCookie("theme", "", "/", 0);
-
-        // Redirect back to demo using proper HTTP redirect
-        sendRedirect(302, "/cookie-demo", keep_alive);
-
-        // Log request
-        Log& log = Log::getInstance();
-        log.openLogFile("logs/access_log");
-        auto referer_it = headermap.find("Referer");
-        auto user_agent_it = headermap.find("User-Agent");
-        log.writeLogLine(inet_ntoa(sock->client.sin_addr), std::string(request_line), 302, 0,
-                         referer_it != headermap.end() ? referer_it->second : "",
-                         user_agent_it != headermap.end() ? user_agent_it->second : "");
+    // Scripts are run by the FastCGI application
+    std::string_view script_path = std::string_view(it->second).substr(0, it->second.find('?'));
+    if (script_path.ends_with(".sh") || FastCgi::handles(script_path, FastCgi::options())) {
+        forwardToApplication(headermap, "GET", it->second, {}, keep_alive);
         return;
     }
 
@@ -1680,10 +1729,7 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
 
     if (accept_it != headermap.end()) {
         // Remove extension from path to find base path for variants
-        std::string base_path = filename;
-        if (!file_extension.empty() && file_extension.length() < filename.length()) {
-            base_path = filename.substr(0, filename.length() - file_extension.length());
-        }
+        std::string base_path = variantBase(filename);
 
         // Try to find variants for the base path
         auto variants = content_negotiator.findVariants(base_path);
@@ -1712,61 +1758,43 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
         }
     }
 
-    // Check if file exists and we have permission to read it
-    struct stat file_stat;
-    if (stat(filename.c_str(), &file_stat) == 0) {
-        // File exists - check if we have read permission
-        if (access(filename.c_str(), R_OK) != 0) {
-            // File exists but we don't have permission to read it
-            std::string error_msg = "<html><head><title>403 Forbidden</title></head>"
-                                    "<body><h1>403 Forbidden</h1>"
-                                    "<p>You don't have permission to access this resource.</p>"
-                                    "</body></html>";
-            sendHeader(403, error_msg.length(), "text/html", keep_alive);
-            sock->write_line(error_msg);
-            return;
-        }
+    // Open the file, or reuse its descriptor and stat from the open file cache
+    auto file = OpenFileCache::getInstance().open(filename);
+    if (file->error() == EACCES) {
+        // File exists but we don't have permission to read it
+        std::string error_msg = "<html><head><title>403 Forbidden</title></head>"
+                                "<body><h1>403 Forbidden</h1>"
+                                "<p>You don't have permission to access this resource.</p>"
+                                "</body></html>";
+        sendHeader(403, error_msg.length(), "text/html", keep_alive);
+        sock->write_line(error_msg);
+        return;
     }
 
-    // Open file
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-
     // can't find file, 404 it
-    if (!file.is_open()) {
-        sendHeader(404, 0, "text/html", false);
-        sock->write_line("<html><head><title>404</title></head><body>404 not "
-                         "found</body></html>");
-        // sock->close_socket();
+    if (!file->regular()) {
+        rememberMissing(it->second, filename, file->error());
+        sendHeader(404, NegativeCache::NOT_FOUND_BODY.size(), "text/html", keep_alive);
+        sock->write_line(NegativeCache::NOT_FOUND_BODY);
         return;
     }
 
-    // Check If-Modified-Since header
-    auto if_modified_since_it = headermap.find("If-Modified-Since");
-    if (if_modified_since_it != headermap.end()) {
-        time_t since_time = parseHttpDate(if_modified_since_it->second);
-        if (since_time > 0 && !isModifiedSince(filename, since_time)) {
-            // File has not been modified, send 304
-            sendHeader(304, 0, "", keep_alive);
-            return;
-        }
+    // Evaluate conditional headers; the 304 repeats ETag, Last-Modified and Vary
+    ResourceValidators validators = ConditionalRequest::validatorsFor(file->info());
+    std::vector<std::string> validator_headers = validatorHeaders(validators);
+    extra_headers.insert(extra_headers.end(), validator_headers.begin(), validator_headers.end());
+    if (!checkPreconditions("GET", headermap, validators, keep_alive, extra_headers)) {
+        return;
     }
 
     // Determine file size with validation
-    auto size = getFileSizeSafe(file);
+    auto size = getFileSizeSafe(*file);
     if (size < 0) {
         sendHeader(413, 0, "text/html", keep_alive);
         sock->write_line("<html><body>413 Payload Too Large - File exceeds size limit</body></html>");
         return;
     }
 
-    // CGI support disabled - requires fork-based socket with file descriptor
-    // The ASIO-based architecture doesn't expose raw file descriptors
-    if (file_extension == ".sh") {
-        sendHeader(501, 0, "text/plain", keep_alive);
-        sock->write_line("501 Not Implemented - CGI support not available in ASIO mode\n");
-        return;
-    }
-
     // Get MIME type
     Mime& mime = Mime::getInstance();
     std::string content_type = mime.getMimeFromExtension(filename);
@@ -1774,28 +1802,10 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
     // Check for Range header
     auto range_it = headermap.find("Range");
     if (range_it != headermap.end()) {
-        // If-Range support: only honor Range if If-Range conditions match
-        bool honor_range = true;
+        // If-Range support: only honor Range if the validator still matches
         auto if_range_it = headermap.find("If-Range");
-        if (if_range_it != headermap.end()) {
-            // If-Range can be either an ETag or a date
-            // For simplicity, we'll check if it's a date (contains spaces/GMT)
-            if (if_range_it->second.find("GMT") != std::string::npos) {
-                // It's a date - check if file was modified
-                time_t if_range_time = parseHttpDate(if_range_it->second);
-                struct stat file_stat;
-                if (stat(filename.c_str(), &file_stat) == 0) {
-                    if (file_stat.st_mtime > if_range_time) {
-                        honor_range = false; // File modified, return full content
-                    }
-                }
-            }
-            // For ETags, we'd need to implement ETag generation and comparison
-            // For now, we'll assume ETag matching fails and return full content
-            else {
-                honor_range = false;
-            }
-        }
+        bool honor_range = if_range_it == headermap.end() ||
+                           ConditionalRequest::ifRangeMatches(if_range_it->second, validators);
 
         if (honor_range) {
             // Parse and handle Range request
@@ -1811,7 +1821,8 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
                                  user_agent_it != headermap.end() ? user_agent_it->second : "");
 
                 // Send partial content
-                sendPartialContent(filename, ranges, size, content_type, keep_alive);
+                sendPartialContent(filename, file, ranges, size, content_type, keep_alive,
+                                   extra_headers);
                 return;
             }
         }
@@ -1834,9 +1845,9 @@ void Http::processGetRequest(const std::map<std::string, std::string>& headermap
 
     // Use middleware if available, otherwise use legacy sendFile
     if (middleware_chain) {
-        sendFileWithMiddleware(filename, "GET", it->second, "HTTP/1.1", headermap);
+        sendFileWithMiddleware(filename, file, "GET", it->second, "HTTP/1.1", headermap);
     } else {
-        sendFile(filename);
+        sendFile(filename, file);
     }
 }
 
@@ -1921,127 +1932,117 @@ std::string Http::getHeader(bool use_timeout) {
     return clientBuffer;
 }
 
-/**
- * Send HTTP headers to the client
- */
-void Http::sendHeader(int code, int size, std::string_view file_type, bool keep_alive,
-                      const std::vector<std::string>& extra_headers) {
-    assert(code > 99 && code < 600);
-    assert(size >= 0);
-
-    std::ostringstream headerStream;
-
+std::string_view Http::reasonPhrase(int code) {
     switch (code) {
     case 200:
-        headerStream << "HTTP/1.1 200 OK\r\n";
-        break;
+        return "OK";
     case 201:
-        headerStream << "HTTP/1.1 201 Created\r\n";
-        break;
+        return "Created";
     case 204:
-        headerStream << "HTTP/1.1 204 No Content\r\n";
-        break;
+        return "No Content";
+    case 206:
+        return "Partial Content";
     case 301:
-        headerStream << "HTTP/1.1 301 Moved Permanently\r\n";
-        break;
+        return "Moved Permanently";
     case 302:
-        headerStream << "HTTP/1.1 302 Found\r\n";
-        break;
+        return "Found";
     case 303:
-        headerStream << "HTTP/1.1 303 See Other\r\n";
-        break;
+        return "See Other";
     case 304:
-        headerStream << "HTTP/1.1 304 Not Modified\r\n";
-        break;
+        return "Not Modified";
     case 307:
-        headerStream << "HTTP/1.1 307 Temporary Redirect\r\n";
-        break;
+        return "Temporary Redirect";
     case 308:
-        headerStream << "HTTP/1.1 308 Permanent Redirect\r\n";
-        break;
-    case 206:
-        headerStream << "HTTP/1.1 206 Partial Content\r\n";
-        break;
+        return "Permanent Redirect";
     case 400:
-        headerStream << "HTTP/1.1 400 Bad Request\r\n";
-        break;
+        return "Bad Request";
     case 401:
-        headerStream << "HTTP/1.1 401 Unauthorized\r\n";
-        break;
+        return "Unauthorized";
     case 403:
-        headerStream << "HTTP/1.1 403 Forbidden\r\n";
-        break;
-    case 416:
-        headerStream << "HTTP/1.1 416 Range Not Satisfiable\r\n";
-        break;
+        return "Forbidden";
     case 404:
-        headerStream << "HTTP/1.1 404 Not Found\r\n";
-        break;
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
     case 406:
-        headerStream << "HTTP/1.1 406 Not Acceptable\r\n";
-        break;
+        return "Not Acceptable";
     case 408:
-        headerStream << "HTTP/1.1 408 Request Timeout\r\n";
-        break;
+        return "Request Timeout";
     case 411:
-        headerStream << "HTTP/1.1 411 Length Required\r\n";
-        break;
+        return "Length Required";
+    case 412:
+        return "Precondition Failed";
     case 413:
-        headerStream << "HTTP/1.1 413 Request Entity Too Large\r\n";
-        break;
-    case 405:
-        headerStream << "HTTP/1.1 405 Method Not Allowed\r\n";
-        break;
+        return "Request Entity Too Large";
+    case 416:
+        return "Range Not Satisfiable";
     case 429:
-        headerStream << "HTTP/1.1 429 Too Many Requests\r\n";
-        break;
+        return "Too Many Requests";
+    case 500:
+        return "Internal Server Error";
     case 501:
-        headerStream << "HTTP/1.1 501 Not Implemented\r\n";
-        break;
+        return "Not Implemented";
     case 503:
-        headerStream << "HTTP/1.1 503 Service Unavailable\r\n";
-        break;
+        return "Service Unavailable";
     case 505:
-        headerStream << "HTTP/1.1 505 HTTP Version Not Supported\r\n";
-        break;
+        return "HTTP Version Not Supported";
     default:
+        return "";
+    }
+}
+
+/**
+ * Send HTTP headers to the client
+ */
+void Http::sendHeader(int code, int size, std::string_view file_type, bool keep_alive,
+                      const std::vector<std::string>& extra_headers) {
+    assert(code > 99 && code < 600);
+    assert(size >= 0);
+
+    last_status_ = code;
+
+    std::string_view reason = reasonPhrase(code);
+    if (reason.empty()) {
         std::cerr << "Wrong HTTP CODE!" << std::endl;
-        headerStream << "HTTP/1.1 500 Internal Server Error\r\n";
+        code = 500;
+        reason = reasonPhrase(code);
     }
 
+    // Built in place, reusing the capacity of the previous request's header
+    lastHeader.clear();
+    std::format_to(std::back_inserter(lastHeader), "HTTP/1.1 {} {}\r\n", code, reason);
+
     // Generate date header
-    std::array<char, 50> buf;
-    time_t ltime = time(nullptr);
-    struct tm* today = gmtime(&ltime);
-    strftime(buf.data(), buf.size(), "%a, %d %b %Y %H:%M:%S GMT", today);
-    headerStream << "Date: " << buf.data() << "\r\n";
+    char date[30];
+    ConditionalRequest::formatHttpDate(time(nullptr), date);
+    lastHeader.append("Date: ").append(date).append("\r\n");
 
-    headerStream << "Server: SHELOB/0.5 (Unix)\r\n";
+    lastHeader += "Server: SHELOB/0.5 (Unix)\r\n";
 
     if (size != 0)
-        headerStream << "Content-Length: " << size << "\r\n";
+        std::format_to(std::back_inserter(lastHeader), "Content-Length: {}\r\n", size);
 
-    headerStream << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
-    headerStream << "Content-Type: " << file_type << "\r\n";
+    lastHeader += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if (!file_type.empty()) {
+        lastHeader.append("Content-Type: ").append(file_type).append("\r\n");
+    }
 
     // Add Accept-Ranges header for 200 OK responses
     if (code == 200) {
-        headerStream << "Accept-Ranges: bytes\r\n";
+        lastHeader += "Accept-Ranges: bytes\r\n";
     }
 
     // Add Set-Cookie headers
     for (const auto& cookie : response_cookies) {
-        headerStream << "Set-Cookie: " << cookie << "\r\n";
+        lastHeader.append("Set-Cookie: ").append(cookie).append("\r\n");
     }
 
     // Add extra headers
     for (const auto& header : extra_headers) {
-        headerStream << header << "\r\n";
+        lastHeader.append(header).append("\r\n");
     }
 
-    headerStream << "\r\n";
-
-    lastHeader = headerStream.str();
+    lastHeader += "\r\n";
 
     if (sock) {
         sock->write_line(lastHeader);
@@ -2083,6 +2084,7 @@ void Http::sendOptionsHeader(bool keep_alive) {
 
     // Status line
     headerStream << "HTTP/1.1 200 OK\r\n";
+    last_status_ = 200;
 
     // Generate date header
     std::array<char, 50> buf;
@@ -2113,16 +2115,6 @@ void Http::sendOptionsHeader(bool keep_alive) {
     }
 }
 
-/**
- * Format time_t as HTTP date string
- */
-std::string Http::formatHttpDate(time_t time) {
-    std::array<char, 50> buf;
-    struct tm* gmt = gmtime(&time);
-    strftime(buf.data(), buf.size(), "%a, %d %b %Y %H:%M:%S GMT", gmt);
-    return std::string(buf.data());
-}
-
 /**
  * Check authentication for a path
  * Returns true if authentication passed or path is not protected
@@ -2212,6 +2204,7 @@ bool Http::checkRateLimit(const std::string& client_ip, bool keep_alive) {
                                 std::to_string(retry_after) + " seconds.</p></body></html>";
 
         sendHeader(429, error_msg.length(), "text/html", keep_alive, extra_headers);
+        Metrics::increment(Metrics::Counter::RateLimitRejections);
         if (sock) {
             sock->write_line(error_msg);
         }
@@ -2243,6 +2236,7 @@ bool Http::checkRateLimit(const std::string& client_ip, bool keep_alive) {
                                 " seconds.</p></body></html>";
 
         sendHeader(429, error_msg.length(), "text/html", keep_alive, extra_headers);
+        Metrics::increment(Metrics::Counter::RateLimitRejections);
         if (sock) {
             sock->write_line(error_msg);
         }
@@ -2410,8 +2404,11 @@ bool Http::validateRange(const ByteRange& range, long long file_size, long long&
  * Send partial content response (206)
  * Handles both single and multiple ranges
  */
-void Http::sendPartialContent(std::string_view filename, const std::vector<ByteRange>& ranges,
-                              long long file_size, std::string_view content_type, bool keep_alive) {
+void Http::sendPartialContent(std::string_view filename,
+                              std::shared_ptr<const OpenFileCache::File> file,
+                              const std::vector<ByteRange>& ranges, long long file_size,
+                              std::string_view content_type, bool keep_alive,
+                              const std::vector<std::string>& extra_headers) {
     // Validate all ranges first
     std::vector<std::pair<long long, long long>> valid_ranges;
     for (const auto& range : ranges) {
@@ -2425,6 +2422,7 @@ void Http::sendPartialContent(std::string_view filename, const std::vector<ByteR
         // All ranges are invalid - send 416
         std::ostringstream headerStream;
         headerStream << "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        last_status_ = 416;
 
         std::array<char, 50> buf;
         time_t ltime = time(nullptr);
@@ -2452,6 +2450,7 @@ void Http::sendPartialContent(std::string_view filename, const std::vector<ByteR
 
         std::ostringstream headerStream;
         headerStream << "HTTP/1.1 206 Partial Content\r\n";
+        last_status_ = 206;
 
         std::array<char, 50> buf;
         time_t ltime = time(nullptr);
@@ -2465,34 +2464,42 @@ void Http::sendPartialContent(std::string_view filename, const std::vector<ByteR
                      << "\r\n";
         headerStream << "Content-Length: " << content_length << "\r\n";
         headerStream << "Accept-Ranges: bytes\r\n";
+        for (const auto& header : extra_headers) {
+            headerStream << header << "\r\n";
+        }
         headerStream << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
         headerStream << "\r\n";
 
         if (sock) {
             sock->write_line(headerStream.str());
 
-            // Send the requested byte range
-            std::ifstream file(filename.data(), std::ios::in | std::ios::binary);
-            if (file) {
-                file.seekg(start);
-                std::vector<char> buffer(content_length);
-                if (file.read(buffer.data(), content_length)) {
-                    sock->write_raw(buffer.data(), content_length);
+            // Send the requested byte range, straight from the page cache when it's large
+            if (content_length >= SEND_FILE_MIN_SIZE &&
+                sock->send_file(file, start, static_cast<size_t>(content_length))) {
+                return;
+            }
+            if (file->fd() >= 0) {
+                auto buffer = readFileRange(*file, start, static_cast<size_t>(content_length));
+                if (buffer) {
+                    sock->write_shared(std::move(buffer));
                 }
             }
         }
     } else {
         // Multiple ranges - use multipart/byteranges
-        sendMultipartRanges(filename, ranges, file_size, content_type, keep_alive);
+        sendMultipartRanges(filename, std::move(file), ranges, file_size, content_type, keep_alive,
+                            extra_headers);
     }
 }
 
 /**
  * Send multipart/byteranges response for multiple ranges
  */
-void Http::sendMultipartRanges(std::string_view filename, const std::vector<ByteRange>& ranges,
-                               long long file_size, std::string_view content_type,
-                               bool keep_alive) {
+void Http::sendMultipartRanges(std::string_view filename,
+                               std::shared_ptr<const OpenFileCache::File> file,
+                               const std::vector<ByteRange>& ranges, long long file_size,
+                               std::string_view content_type, bool keep_alive,
+                               const std::vector<std::string>& extra_headers) {
     // Generate boundary
     std::string boundary = "SHELOB_MULTIPART_BOUNDARY";
 
@@ -2507,14 +2514,13 @@ void Http::sendMultipartRanges(std::string_view filename, const std::vector<Byte
 
     if (valid_ranges.empty()) {
         // All ranges invalid - send 416
-        sendPartialContent(filename, ranges, file_size, content_type, keep_alive);
+        sendPartialContent(filename, std::move(file), ranges, file_size, content_type, keep_alive);
         return;
     }
 
     // Build the multipart body
     std::ostringstream body;
-    std::ifstream file(filename.data(), std::ios::in | std::ios::binary);
-    if (!file) {
+    if (file->fd() < 0) {
         sendHeader(404, 0, "text/html", keep_alive);
         if (sock) {
             sock->write_line("<html><body>404 Not Found</body></html>");
@@ -2532,10 +2538,8 @@ void Http::sendMultipartRanges(std::string_view filename, const std::vector<Byte
         body << "\r\n";
 
         // Read and append data
-        file.seekg(start);
-        std::vector<char> buffer(content_length);
-        if (file.read(buffer.data(), content_length)) {
-            body.write(buffer.data(), content_length);
+        if (auto buffer = readFileRange(*file, start, static_cast<size_t>(content_length))) {
+            body << *buffer;
         }
     }
 
@@ -2547,6 +2551,7 @@ void Http::sendMultipartRanges(std::string_view filename, const std::vector<Byte
     // Send headers
     std::ostringstream headerStream;
     headerStream << "HTTP/1.1 206 Partial Content\r\n";
+    last_status_ = 206;
 
     std::array<char, 50> buf;
     time_t ltime = time(nullptr);
@@ -2558,6 +2563,9 @@ void Http::sendMultipartRanges(std::string_view filename, const std::vector<Byte
     headerStream << "Content-Type: multipart/byteranges; boundary=" << boundary << "\r\n";
     headerStream << "Content-Length: " << body_str.length() << "\r\n";
     headerStream << "Accept-Ranges: bytes\r\n";
+    for (const auto& header : extra_headers) {
+        headerStream << header << "\r\n";
+    }
     headerStream << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
     headerStream << "\r\n";
 
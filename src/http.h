@@ -3,6 +3,7 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -11,11 +12,15 @@
 
 #include "auth.h"
 #include "cgi.h"
+#include "conditional_request.h"
 #include "content_negotiator.h"
 #include "filter.h"
+#include "form_parser.h"
 #include "log.h"
 #include "middleware.h"
 #include "mime.h"
+#include "open_file_cache.h"
+#include "router.h"
 #include "socket.h"
 #include "token.h"
 
@@ -34,43 +39,57 @@ class Http {
     void printContentLength(int size);
     void printConnectionType(bool keep_alive = false);
     std::string sanitizeFilename(std::string_view filename);
-    void sendFile(std::string_view filename);
-    void sendFileWithMiddleware(std::string_view filename, const std::string& method,
-                                const std::string& path, const std::string& version,
+    void rememberMissing(const std::string& target, const std::string& filename, int error);
+    void sendFile(std::string_view filename, std::shared_ptr<const OpenFileCache::File> file);
+    void sendFileWithMiddleware(std::string_view filename,
+                                std::shared_ptr<const OpenFileCache::File> file,
+                                const std::string& method, const std::string& path,
+                                const std::string& version,
                                 const std::map<std::string, std::string>& headermap);
     void processHeadRequest(const std::map<std::string, std::string>& headermap, bool keep_alive);
     void processGetRequest(const std::map<std::string, std::string>& headermap,
                            std::string_view request_line, bool keep_alive);
     void processPostRequest(const std::map<std::string, std::string>& headermap, bool keep_alive);
+    void sendPostResponse(const std::map<std::string, std::string>& headermap,
+                          const std::string& uri, const FormParser* form, std::string_view body,
+                          bool keep_alive);
+    void forwardToApplication(const std::map<std::string, std::string>& headermap,
+                              std::string_view method, std::string_view uri, std::string body,
+                              bool keep_alive);
     void processPutRequest(const std::map<std::string, std::string>& headermap,
                            std::string_view request_line, bool keep_alive);
     void processDeleteRequest(const std::map<std::string, std::string>& headermap,
                               std::string_view request_line, bool keep_alive);
-    std::string readChunkedBody();
+    std::optional<std::string> readChunkedBody(); // Nothing if it sent an error response
     void writeChunkedData(std::string_view data);
     void writeChunkedEnd();
-    std::map<std::string, std::string> parseFormUrlEncoded(const std::string& body);
-    std::map<std::string, std::string> parseMultipartFormData(const std::string& body,
-                                                              const std::string& boundary);
-    std::string getBoundaryFromContentType(const std::string& content_type);
-    std::map<std::string, std::string> parseCookies(const std::string& cookie_header);
-    void setCookie(const std::string& name, const std::string& value, const std::string& path = "/",
-                   int max_age = -1, bool secure = false, bool http_only = false,
-                   const std::string& same_site = "");
     void processOptionsRequest(const std::map<std::string, std::string>& headermap,
                                bool keep_alive);
-    time_t parseHttpDate(const std::string& date_str);
-    bool isModifiedSince(const std::string& filename, time_t since_time);
+    bool checkPreconditions(std::string_view method,
+                            const std::map<std::string, std::string>& headermap,
+                            const ResourceValidators& validators, bool keep_alive,
+                            const std::vector<std::string>& extra_headers = {});
 
     // Range request support
-    std::vector<ByteRange> parseRangeHeader(const std::string& range_header);
     bool validateRange(const ByteRange& range, long long file_size, long long& start,
                        long long& end);
-    void sendPartialContent(std::string_view filename, const std::vector<ByteRange>& ranges,
-                            long long file_size, std::string_view content_type, bool keep_alive);
-    void sendMultipartRanges(std::string_view filename, const std::vector<ByteRange>& ranges,
-                             long long file_size, std::string_view content_type, bool keep_alive);
-    std::string formatHttpDate(time_t time);
+    void sendPartialContent(std::string_view filename,
+                            std::shared_ptr<const OpenFileCache::File> file,
+                            const std::vector<ByteRange>& ranges, long long file_size,
+                            std::string_view content_type, bool keep_alive,
+                            const std::vector<std::string>& extra_headers = {});
+    void sendMultipartRanges(std::string_view filename,
+                             std::shared_ptr<const OpenFileCache::File> file,
+                             const std::vector<ByteRange>& ranges, long long file_size,
+                             std::string_view content_type, bool keep_alive,
+                             const std::vector<std::string>& extra_headers = {});
+
+    // Built-in routes (see router())
+    void cookieDemo(const RouteRequest& request);
+    void setCookieFromQuery(const RouteRequest& request);
+    void clearCookies(const RouteRequest& request);
+    void logAccess(std::string_view request_line, int status, size_t size,
+                   const std::map<std::string, std::string>& headermap);
 
     // Authentication support
     bool checkAuthentication(const std::string& path, const std::string& method,
@@ -78,6 +97,11 @@ class Http {
 
     std::string lastHeader; // Store last sent header for testing
 
+    // Outcome of the last parseHeader() call, for metrics
+    int last_status_ = 0;
+    std::string last_method_;
+    std::string last_version_;
+
     // Middleware chain
     std::unique_ptr<MiddlewareChain> middleware_chain;
 
@@ -116,9 +140,77 @@ class Http {
                     bool keep_alive = false, const std::vector<std::string>& extra_headers = {});
     void sendRedirect(int code, const std::string& location, bool keep_alive = false);
     void sendOptionsHeader(bool keep_alive = false);
+
+    /**
+     * Send a response whose length isn't known up front, its body generated a
+     * piece at a time (see BodyProducer) and sent chunked. Over a connection
+     * that can stream, each piece is generated only once the last one has
+     * been written, so the body never sits in memory whole; otherwise it is
+     * all written here. HTTP/1.0 clients get it whole with a Content-Length.
+     */
+    void sendChunkedResponse(int code, std::string_view content_type, BodyProducer producer,
+                             bool keep_alive = false,
+                             const std::vector<std::string>& extra_headers = {});
+    void setCookie(const std::string& name, const std::string& value, const std::string& path = "/",
+                   int max_age = -1, bool secure = false, bool http_only = false,
+                   const std::string& same_site = "");
     std::string getHeader(bool use_timeout = false);
     bool parseHeader(std::string_view header);
 
+    /**
+     * The handlers requests are dispatched to before being served from files,
+     * shared by every connection. Add routes before the server starts.
+     */
+    static Router& router();
+
+    /**
+     * Check the credentials of a request for a protected path that isn't
+     * dispatched through parseHeader() (a coroutine route), sending the 401
+     * when they don't pass
+     * @return true if the request may go on
+     */
+    bool authorize(const std::string& path, const std::string& method,
+                   const std::map<std::string, std::string>& headermap, bool keep_alive) {
+        return checkAuthentication(path, method, headermap, keep_alive);
+    }
+
+    // Whether requests for this path must authenticate
+    bool protects(const std::string& path) {
+        std::string realm;
+        return auth.is_protected(path, realm);
+    }
+
+    /**
+     * Whether a GET or HEAD for target is answered without blocking: the path
+     * needs no password and every lookup serving it makes (its file, a
+     * directory's index.html, and the variants content negotiation or a 404
+     * looks for) is held by the open file cache
+     * @param negotiate Whether content negotiation runs (a GET with Accept)
+     */
+    bool servesFromCache(std::string_view target, bool negotiate);
+
+    // Whether requests can be turned away before dispatch (maintenance mode, rate limits)
+    bool screensRequests() const { return maintenance_mode_ || rate_limiting_enabled_; }
+
+    // Reason phrase of a status code sent, empty for codes that aren't
+    static std::string_view reasonPhrase(int code);
+
+    // Whether a POST to this path goes to a script rather than being answered here
+    bool runsScript(std::string_view path);
+
+    // Request parsers (no socket I/O, also used directly by the microbenchmarks)
+    std::vector<ByteRange> parseRangeHeader(const std::string& range_header);
+    std::map<std::string, std::string> parseFormUrlEncoded(const std::string& body);
+    std::map<std::string, std::string> parseMultipartFormData(const std::string& body,
+                                                              const std::string& boundary);
+    std::string getBoundaryFromContentType(const std::string& content_type);
+    std::map<std::string, std::string> parseCookies(const std::string& cookie_header);
+
+    // Status code, method and HTTP version of the last request (status 0 if none was sent)
+    int lastStatus() const { return last_status_; }
+    const std::string& lastMethod() const { return last_method_; }
+    const std::string& lastVersion() const { return last_version_; }
+
     // Middleware configuration
     void setMiddlewareChain(std::unique_ptr<MiddlewareChain> chain) {
         middleware_chain = std::move(chain);
@@ -137,7 +229,7 @@ class Http {
     void setMaintenanceMode(bool enabled) { maintenance_mode_ = enabled; }
     void setMaintenanceMessage(const std::string& message) { maintenance_message_ = message; }
 
-    std::unique_ptr<Socket> sock;
+    Socket* sock = nullptr; // Not owned: the connection the requests arrive on
 };
 
 #endif /* !SHELOB_HTTP_H */
@@ -2,8 +2,11 @@
 
 #ifdef HAVE_NGHTTP2
 
+#include "blocking_pool.h"
+#include "conditional_request.h"
 #include "connection_timeouts.h"
 #include "log.h"
+#include "metrics.h"
 #include "mime.h"
 #include "request_limits.h"
 #include "security_middleware.h"
@@ -14,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <utility>
 
 using namespace boost::asio::experimental::awaitable_operators;
 
@@ -21,34 +25,67 @@ using namespace boost::asio::experimental::awaitable_operators;
 // Http2Session Implementation
 // ============================================================================
 
-Http2Session::Http2Session(ssl_socket socket) : socket_(std::move(socket)), session_(nullptr) {}
+Http2Session::Http2Session(ssl_socket socket, TimerWheel& timers)
+    : socket_(std::move(socket)), session_(nullptr), deadline_(timers, [this] {
+          if (deadline_.too_slow()) {
+              std::cerr << "HTTP/2 connection below minimum data rate - closing" << std::endl;
+              Metrics::increment(Metrics::Counter::SlowConnectionsClosed);
+          } else {
+              std::cerr << "HTTP/2 timeout - possible slow attack" << std::endl;
+          }
+          boost::system::error_code ignored;
+          socket_.lowest_layer().cancel(ignored);
+      }) {}
 
 Http2Session::~Http2Session() {
+    Metrics::add(Metrics::Gauge::ActiveHttp2Streams, -static_cast<int64_t>(streams_.size()));
     if (session_) {
         nghttp2_session_del(session_);
     }
 }
 
-// Send callback - called by nghttp2 to send data
-ssize_t Http2Session::send_callback(nghttp2_session* session, const uint8_t* data, size_t length,
-                                    int flags, void* user_data) {
-    (void)session;
-    (void)flags;
-
-    auto* self = static_cast<Http2Session*>(user_data);
-
-    try {
-        boost::system::error_code ec;
-        size_t written = asio::write(self->socket_, asio::buffer(data, length), ec);
+asio::awaitable<bool> Http2Session::flush() {
+    arm_deadline();
+    while (true) {
+        // Gather queued frames; each chunk is only valid until the next mem_send call
+        output_.clear();
+        while (output_.size() < OUTPUT_BATCH_SIZE) {
+            const uint8_t* data = nullptr;
+            ssize_t length = nghttp2_session_mem_send(session_, &data);
+            if (length < 0) {
+                std::cerr << "nghttp2_session_mem_send error: " << nghttp2_strerror(length)
+                          << std::endl;
+                co_return false;
+            }
+            if (length == 0) {
+                break;
+            }
+            output_.append(reinterpret_cast<const char*>(data), static_cast<size_t>(length));
+        }
+        if (output_.empty()) {
+            co_return true;
+        }
 
+        auto [ec, written] =
+            co_await asio::async_write(socket_, asio::buffer(output_),
+                                       deadline_.reporting(asio::transfer_all()),
+                                       asio::as_tuple(asio::use_awaitable));
         if (ec) {
-            return NGHTTP2_ERR_CALLBACK_FAILURE;
+            co_return false;
         }
+    }
+}
 
-        return written;
-    } catch (...) {
-        return NGHTTP2_ERR_CALLBACK_FAILURE;
+void Http2Session::arm_deadline() {
+    if (streams_.empty()) {
+        deadline_.arm(std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
+    } else if (!deadline_.transferring() || stream_closed_) {
+        // Each finished stream restarts the response timeout; the data rate
+        // is enforced across all open streams in both directions
+        deadline_.arm_transfer(
+            std::chrono::seconds(ConnectionTimeouts::WRITE_RESPONSE_TIMEOUT_SEC));
     }
+    stream_closed_ = false;
 }
 
 // Frame received callback
@@ -58,9 +95,9 @@ int Http2Session::on_frame_recv_callback(nghttp2_session* session, const nghttp2
 
     switch (frame->hd.type) {
     case NGHTTP2_HEADERS:
-        // If this is end of headers, process the request
+        // If this is end of headers, process the request once the read is handled
         if (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) {
-            self->process_request(frame->hd.stream_id);
+            self->pending_requests_.push_back(frame->hd.stream_id);
         }
         break;
 
@@ -145,7 +182,9 @@ int Http2Session::on_stream_close_callback(nghttp2_session* session, int32_t str
                 NGHTTP2_ENHANCE_YOUR_CALM, reinterpret_cast<const uint8_t*>("Too many resets"), 15);
 
             // Clean up stream data
-            self->streams_.erase(stream_id);
+            if (self->streams_.erase(stream_id)) {
+                Metrics::add(Metrics::Gauge::ActiveHttp2Streams, -1);
+            }
 
             // Return error to stop processing
             return NGHTTP2_ERR_CALLBACK_FAILURE;
@@ -153,7 +192,10 @@ int Http2Session::on_stream_close_callback(nghttp2_session* session, int32_t str
     }
 
     // Clean up stream data
-    self->streams_.erase(stream_id);
+    if (self->streams_.erase(stream_id)) {
+        Metrics::add(Metrics::Gauge::ActiveHttp2Streams, -1);
+    }
+    self->stream_closed_ = true;
 
     return 0;
 }
@@ -239,7 +281,12 @@ int Http2Session::on_begin_headers_callback(nghttp2_session* session, const nght
 
     // Initialize stream data
     int32_t stream_id = frame->hd.stream_id;
-    self->streams_[stream_id] = StreamData{};
+    auto [it, inserted] = self->streams_.insert_or_assign(stream_id, StreamData{});
+    it->second.start = std::chrono::steady_clock::now();
+    if (inserted) {
+        Metrics::increment(Metrics::Counter::Http2Streams);
+        Metrics::add(Metrics::Gauge::ActiveHttp2Streams, 1);
+    }
 
     return 0;
 }
@@ -271,15 +318,13 @@ int Http2Session::on_data_chunk_recv_callback(nghttp2_session* session, uint8_t
     return 0;
 }
 
-void Http2Session::process_request(int32_t stream_id) {
-    auto it = streams_.find(stream_id);
-    if (it == streams_.end()) {
-        send_error(stream_id, 500, "Internal Server Error");
-        return;
-    }
-
-    const auto& stream = it->second;
+Http2Session::Response Http2Session::error_response(int status, const std::string& message) {
+    return {status, "text/html",
+            "<html><body><h1>" + std::to_string(status) + " " + message + "</h1></body></html>",
+            {}};
+}
 
+Http2Session::Response Http2Session::load_response(const StreamData& stream) {
     std::string path = stream.path;
 
     // Default to index.html for directory requests
@@ -292,14 +337,12 @@ void Http2Session::process_request(int32_t stream_id) {
     std::string file_path =
         SecurityMiddleware::sanitize_path(path, std::filesystem::path("htdocs"));
     if (file_path.empty()) {
-        send_error(stream_id, 400, "Bad Request - Invalid Path");
-        return;
+        return error_response(400, "Bad Request - Invalid Path");
     }
 
     // Check if file exists
     if (!std::filesystem::exists(file_path)) {
-        send_error(stream_id, 404, "Not Found");
-        return;
+        return error_response(404, "Not Found");
     }
 
     // Check if it's a directory
@@ -308,11 +351,30 @@ void Http2Session::process_request(int32_t stream_id) {
         if (std::filesystem::exists(index_path)) {
             file_path = index_path;
         } else {
-            send_error(stream_id, 403, "Directory listing not allowed");
-            return;
+            return error_response(403, "Directory listing not allowed");
         }
     }
 
+    // Conditional request handling - a 304 costs one stat and a HEADERS frame
+    struct stat file_stat;
+    if (stat(file_path.c_str(), &file_stat) != 0) {
+        return error_response(404, "Not Found");
+    }
+    ResourceValidators validators = ConditionalRequest::validatorsFor(file_stat);
+    std::vector<std::pair<std::string, std::string>> validator_headers = {
+        {"etag", validators.etag},
+        {"last-modified", ConditionalRequest::formatHttpDate(validators.last_modified)}};
+
+    switch (ConditionalRequest::evaluate(stream.method, ConditionalHeaders::from(stream.headers),
+                                         validators)) {
+    case PreconditionResult::NotModified:
+        return {304, "", "", validator_headers};
+    case PreconditionResult::PreconditionFailed:
+        return error_response(412, "Precondition Failed");
+    case PreconditionResult::Proceed:
+        break;
+    }
+
     // Get MIME type
     Mime& mime = Mime::getInstance();
     std::string content_type = mime.getMimeFromExtension(file_path);
@@ -320,30 +382,46 @@ void Http2Session::process_request(int32_t stream_id) {
     // Read file
     std::ifstream file(file_path, std::ios::binary);
     if (!file.is_open()) {
-        send_error(stream_id, 500, "Failed to read file");
-        return;
+        return error_response(500, "Failed to read file");
     }
 
     std::stringstream buffer;
     buffer << file.rdbuf();
-    std::string content = buffer.str();
+    return {200, content_type, buffer.str(), validator_headers};
+}
 
-    // Send response
-    send_response(stream_id, 200, content_type, content);
+asio::awaitable<void> Http2Session::process_request(int32_t stream_id) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        send_error(stream_id, 500, "Internal Server Error");
+        co_return;
+    }
+
+    // The session reads no frames until this returns, so the stream stays put
+    // while a worker reads it
+    const auto& stream = it->second;
+    Response response =
+        co_await BlockingPool::getInstance().run([&stream] { return load_response(stream); });
+    send_response(stream_id, response.status, response.content_type, response.body,
+                  response.headers);
+    if (response.status != 200) {
+        co_return;
+    }
 
     // Log access
     try {
         auto client_ip = socket_.lowest_layer().remote_endpoint().address().to_string();
         std::string request = stream.method + " " + stream.path + " HTTP/2";
         Log& logger = Log::getInstance();
-        logger.writeLogLine(client_ip, request, 200, content.size(), "-", "-");
+        logger.writeLogLine(client_ip, request, 200, response.body.size(), "-", "-");
     } catch (...) {
         // Ignore logging errors
     }
 }
 
-void Http2Session::send_response(int32_t stream_id, int status, const std::string& content_type,
-                                 const std::string& body) {
+void Http2Session::send_response(
+    int32_t stream_id, int status, const std::string& content_type, const std::string& body,
+    const std::vector<std::pair<std::string, std::string>>& extra_headers) {
     // Store response body in stream data
     auto it = streams_.find(stream_id);
     if (it == streams_.end()) {
@@ -352,30 +430,37 @@ void Http2Session::send_response(int32_t stream_id, int status, const std::strin
     it->second.response_body = body;
     it->second.bytes_sent = 0;
 
-    // Prepare response headers with persistent strings
-    static const char status_200[] = "200";
-    static const char status_404[] = "404";
-    static const char status_403[] = "403";
-    static const char status_500[] = "500";
+    Metrics::increment(Metrics::Counter::BytesReceived,
+                       it->second.total_header_size + it->second.request_body.size());
+    Metrics::record_request(Metrics::Protocol::Http2, it->second.method, status,
+                            std::chrono::steady_clock::now() - it->second.start);
 
-    const char* status_str = status_200;
-    if (status == 404)
-        status_str = status_404;
-    else if (status == 403)
-        status_str = status_403;
-    else if (status == 500)
-        status_str = status_500;
+    // nghttp2 copies name/value pairs on submit, so locals are fine here
+    std::string status_str = std::to_string(status);
 
     std::vector<nghttp2_nv> nva;
 
-    auto make_nv = [](const char* name, const char* value) -> nghttp2_nv {
-        return {const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(name)),
-                const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(value)), std::strlen(name),
-                std::strlen(value), NGHTTP2_NV_FLAG_NONE};
+    auto make_nv = [](const std::string& name, const std::string& value) -> nghttp2_nv {
+        return {const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(name.data())),
+                const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(value.data())), name.size(),
+                value.size(), NGHTTP2_NV_FLAG_NONE};
     };
 
-    nva.push_back(make_nv(":status", status_str));
-    nva.push_back(make_nv("content-type", content_type.c_str()));
+    static const std::string status_name = ":status";
+    static const std::string content_type_name = "content-type";
+    nva.push_back(make_nv(status_name, status_str));
+    if (!content_type.empty()) {
+        nva.push_back(make_nv(content_type_name, content_type));
+    }
+    for (const auto& [name, value] : extra_headers) {
+        nva.push_back(make_nv(name, value));
+    }
+
+    // 304 Not Modified and 204 No Content never carry a body
+    if (status == 304 || status == 204) {
+        nghttp2_submit_response(session_, stream_id, nva.data(), nva.size(), nullptr);
+        return;
+    }
 
     // Create data provider for response body
     nghttp2_data_provider data_prd;
@@ -401,6 +486,7 @@ void Http2Session::send_response(int32_t stream_id, int status, const std::strin
         if (to_copy > 0) {
             std::memcpy(buf, response_body.data() + bytes_sent, to_copy);
             bytes_sent += to_copy;
+            Metrics::increment(Metrics::Counter::BytesSent, to_copy);
         }
 
         if (bytes_sent >= response_body.size()) {
@@ -410,15 +496,13 @@ void Http2Session::send_response(int32_t stream_id, int status, const std::strin
         return to_copy;
     };
 
-    // Submit response
+    // Submit response; it is written by the session loop's next flush()
     nghttp2_submit_response(session_, stream_id, nva.data(), nva.size(), &data_prd);
-    nghttp2_session_send(session_);
 }
 
 void Http2Session::send_error(int32_t stream_id, int status, const std::string& message) {
-    std::string body =
-        "<html><body><h1>" + std::to_string(status) + " " + message + "</h1></body></html>";
-    send_response(stream_id, status, "text/html", body);
+    Response response = error_response(status, message);
+    send_response(stream_id, status, response.content_type, response.body);
 }
 
 asio::awaitable<void> Http2Session::start() {
@@ -427,7 +511,6 @@ asio::awaitable<void> Http2Session::start() {
         nghttp2_session_callbacks* callbacks;
         nghttp2_session_callbacks_new(&callbacks);
 
-        nghttp2_session_callbacks_set_send_callback(callbacks, send_callback);
         nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv_callback);
         nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close_callback);
         nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header_callback);
@@ -467,32 +550,21 @@ asio::awaitable<void> Http2Session::start() {
 
         nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings,
                                 sizeof(settings) / sizeof(settings[0]));
-        nghttp2_session_send(session_);
 
         // Main HTTP/2 processing loop with timeout protection
         std::vector<uint8_t> buffer(8192);
 
-        while (true) {
-            // Read from socket with timeout (protects against slow HTTP/2 attacks)
-            asio::steady_timer timer(socket_.get_executor());
-            timer.expires_after(std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
-
-            auto result = co_await (socket_.async_read_some(asio::buffer(buffer),
-                                                            asio::as_tuple(asio::use_awaitable)) ||
-                                    timer.async_wait(asio::as_tuple(asio::use_awaitable)));
-
-            if (result.index() == 1) {
-                // Timeout occurred - terminate connection
-                std::cerr << "HTTP/2 read timeout - possible slow attack" << std::endl;
-                break;
-            }
-
-            auto [ec, bytes_read] = std::get<0>(result);
+        while (co_await flush()) {
+            // Read with the idle or data rate deadline (protects against slow HTTP/2 attacks)
+            arm_deadline();
+            auto [ec, bytes_read] = co_await socket_.async_read_some(
+                asio::buffer(buffer), asio::as_tuple(asio::use_awaitable));
             if (ec) {
                 break;
             }
+            deadline_.add_bytes(bytes_read);
 
-            // Process received data
+            // Process received data; responses are queued for the next flush()
             ssize_t read_len = nghttp2_session_mem_recv(session_, buffer.data(), bytes_read);
 
             if (read_len < 0) {
@@ -501,11 +573,9 @@ asio::awaitable<void> Http2Session::start() {
                 break;
             }
 
-            // Send any pending data
-            int rv = nghttp2_session_send(session_);
-            if (rv != 0) {
-                std::cerr << "nghttp2_session_send error: " << nghttp2_strerror(rv) << std::endl;
-                break;
+            // File reads run on the blocking pool; responses go out with the next flush()
+            for (int32_t stream_id : std::exchange(pending_requests_, {})) {
+                co_await process_request(stream_id);
             }
 
             // Check if session wants to terminate
@@ -514,6 +584,7 @@ asio::awaitable<void> Http2Session::start() {
                 break;
             }
         }
+        deadline_.cancel();
     } catch (const std::exception& e) {
         std::cerr << "HTTP/2 session error: " << e.what() << std::endl;
     }
@@ -527,7 +598,7 @@ asio::awaitable<void> Http2Session::start() {
 
 Http2Server::Http2Server(int port, bool use_tls, const std::string& cert_path,
                          const std::string& key_path)
-    : ssl_context_(asio::ssl::context::tlsv12_server),
+    : timers_(io_context_.get_executor()), ssl_context_(asio::ssl::context::tlsv12_server),
       acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)),
       signals_(io_context_, SIGINT, SIGTERM), port_(port), use_tls_(use_tls), cert_path_(cert_path),
       key_path_(key_path) {
@@ -572,7 +643,11 @@ Http2Server::Http2Server(int port, bool use_tls, const std::string& cert_path,
     signals_.async_wait([this](const boost::system::error_code& /*ec*/, int /*signo*/) { stop(); });
 }
 
-Http2Server::~Http2Server() { stop(); }
+Http2Server::~Http2Server() {
+    stop();
+    // Workers may still be finishing requests for this io_context
+    BlockingPool::getInstance().drain();
+}
 
 void Http2Server::run() {
     // Start accepting connections
@@ -596,6 +671,7 @@ asio::awaitable<void> Http2Server::listener() {
         while (!stopping_) {
             // Accept TCP connection
             auto socket = co_await acceptor_.async_accept(asio::use_awaitable);
+            Metrics::increment(Metrics::Counter::ConnectionsAccepted);
 
             // Wrap in SSL stream
             ssl_socket ssl_sock(std::move(socket), ssl_context_);
@@ -611,31 +687,38 @@ asio::awaitable<void> Http2Server::listener() {
 }
 
 asio::awaitable<void> Http2Server::handle_connection(ssl_socket socket) {
+    Metrics::GaugeGuard active_connection(Metrics::Gauge::ActiveTlsConnections);
+
     try {
         // Perform SSL handshake with timeout
         asio::steady_timer handshake_timer(socket.get_executor());
         handshake_timer.expires_after(
             std::chrono::seconds(ConnectionTimeouts::SSL_HANDSHAKE_TIMEOUT_SEC));
 
+        auto handshake_start = std::chrono::steady_clock::now();
         auto handshake_result =
             co_await (socket.async_handshake(asio::ssl::stream_base::server,
                                              asio::as_tuple(asio::use_awaitable)) ||
                       handshake_timer.async_wait(asio::as_tuple(asio::use_awaitable)));
+        auto handshake_time = std::chrono::steady_clock::now() - handshake_start;
 
         if (handshake_result.index() == 1) {
             // Handshake timeout
             std::cerr << "HTTP/2 SSL handshake timeout" << std::endl;
+            Metrics::record_tls_handshake(handshake_time, false);
             co_return;
         }
 
         auto [handshake_ec] = std::get<0>(handshake_result);
         if (handshake_ec) {
             std::cerr << "HTTP/2 SSL handshake failed: " << handshake_ec.message() << std::endl;
+            Metrics::record_tls_handshake(handshake_time, false);
             co_return;
         }
+        Metrics::record_tls_handshake(handshake_time, true);
 
         // Create HTTP/2 session
-        auto session = std::make_shared<Http2Session>(std::move(socket));
+        auto session = std::make_shared<Http2Session>(std::move(socket), timers_);
 
         // Start HTTP/2 processing
         co_await session->start();
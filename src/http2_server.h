@@ -3,6 +3,7 @@
 
 #ifdef HAVE_NGHTTP2
 
+#include "timer_wheel.h"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/asio/awaitable.hpp>
@@ -25,19 +26,30 @@ using ssl_socket = asio::ssl::stream<tcp::socket>;
 /**
  * HTTP/2 connection session
  * Manages a single HTTP/2 connection with multiple streams
+ *
+ * Frames are serialized with nghttp2_session_mem_send() and written
+ * asynchronously, so a client that stops reading stalls only its own session.
+ * An idle connection gets the header read timeout; while streams are open the
+ * connection must keep up the minimum data rate from ConnectionTimeouts.
  */
 class Http2Session {
   public:
-    Http2Session(ssl_socket socket);
+    Http2Session(ssl_socket socket, TimerWheel& timers);
     ~Http2Session();
 
     asio::awaitable<void> start();
 
   private:
-    // nghttp2 callbacks
-    static ssize_t send_callback(nghttp2_session* session, const uint8_t* data, size_t length,
-                                 int flags, void* user_data);
+    // Bytes of serialized frames gathered into one socket write
+    static constexpr size_t OUTPUT_BATCH_SIZE = 64 * 1024;
+
+    // Write every frame nghttp2 has queued
+    asio::awaitable<bool> flush();
+
+    // Arm the deadline for what the connection is doing now (idle or transferring)
+    void arm_deadline();
 
+    // nghttp2 callbacks
     static int on_frame_recv_callback(nghttp2_session* session, const nghttp2_frame* frame,
                                       void* user_data);
 
@@ -55,18 +67,38 @@ class Http2Session {
                                            int32_t stream_id, const uint8_t* data, size_t len,
                                            void* user_data);
 
-    // Process a stream request
-    void process_request(int32_t stream_id);
+    struct StreamData;
+
+    // A response built off the session thread
+    struct Response {
+        int status = 200;
+        std::string content_type;
+        std::string body;
+        std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    // Resolve and read the requested file; runs on the BlockingPool
+    static Response load_response(const StreamData& stream);
+
+    static Response error_response(int status, const std::string& message);
+
+    // Process a stream request whose headers are complete
+    asio::awaitable<void> process_request(int32_t stream_id);
 
-    // Send response
+    // Send response (304 and 204 responses are sent without a body)
     void send_response(int32_t stream_id, int status, const std::string& content_type,
-                       const std::string& body);
+                       const std::string& body,
+                       const std::vector<std::pair<std::string, std::string>>& extra_headers = {});
 
     // Send error response
     void send_error(int32_t stream_id, int status, const std::string& message);
 
     ssl_socket socket_;
     nghttp2_session* session_;
+    TransferDeadline deadline_;
+    std::string output_;                    // Frames waiting to be written
+    bool stream_closed_ = false;            // A stream finished since the deadline was armed
+    std::vector<int32_t> pending_requests_; // Streams whose headers just completed
 
     // Stream data
     struct StreamData {
@@ -80,6 +112,7 @@ class Http2Session {
         size_t bytes_sent = 0;        // Track bytes sent
         size_t header_count = 0;      // Track number of headers
         size_t total_header_size = 0; // Track total header size (names + values)
+        std::chrono::steady_clock::time_point start; // When the request headers began
     };
 
     std::map<int32_t, StreamData> streams_;
@@ -127,6 +160,7 @@ class Http2Server {
     asio::awaitable<void> handle_connection(ssl_socket socket);
 
     asio::io_context io_context_;
+    TimerWheel timers_; // Session read and write timeouts
     asio::ssl::context ssl_context_;
     tcp::acceptor acceptor_;
     asio::signal_set signals_;
@@ -0,0 +1,50 @@
+#include "ktls_stream.h"
+#include <stdexcept>
+#include <utility>
+
+KtlsStream::KtlsStream(tcp::socket socket, ssl::context& context)
+    : socket_(std::move(socket)), ssl_(SSL_new(context.native_handle())) {
+    if (!ssl_) {
+        throw std::runtime_error("Failed to create SSL object");
+    }
+
+    // OpenSSL reads and writes the descriptor itself; asio only waits for readiness
+    socket_.non_blocking(true);
+    SSL_set_fd(ssl_, static_cast<int>(socket_.native_handle()));
+    SSL_set_mode(ssl_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+
+KtlsStream::KtlsStream(KtlsStream&& other) noexcept
+    : socket_(std::move(other.socket_)), ssl_(std::exchange(other.ssl_, nullptr)) {}
+
+KtlsStream::~KtlsStream() {
+    if (ssl_) {
+        SSL_free(ssl_);
+    }
+}
+
+bool KtlsStream::ktls_send() const { return BIO_get_ktls_send(SSL_get_wbio(ssl_)); }
+
+boost::system::error_code KtlsStream::ssl_error(int result, bool& want_read, bool& want_write) {
+    if (result > 0) {
+        return {};
+    }
+
+    switch (SSL_get_error(ssl_, result)) {
+    case SSL_ERROR_WANT_READ:
+        want_read = true;
+        return {};
+    case SSL_ERROR_WANT_WRITE:
+        want_write = true;
+        return {};
+    case SSL_ERROR_ZERO_RETURN:
+        return asio::error::eof;
+    case SSL_ERROR_SYSCALL:
+        if (errno != 0) {
+            return {errno, boost::system::system_category()};
+        }
+        return ssl::error::stream_truncated;
+    default:
+        return {static_cast<int>(ERR_get_error()), asio::error::get_ssl_category()};
+    }
+}
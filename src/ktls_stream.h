@@ -0,0 +1,196 @@
+#ifndef KTLS_STREAM_H
+#define KTLS_STREAM_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <cerrno>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/types.h>
+#include <type_traits>
+
+namespace asio = boost::asio;
+namespace ssl = boost::asio::ssl;
+using tcp = asio::ip::tcp;
+
+/**
+ * TLS stream with OpenSSL reading and writing the socket directly
+ *
+ * asio::ssl::stream feeds OpenSSL through a memory BIO pair, which rules out
+ * kernel TLS: OpenSSL only hands the record layer to the kernel when its BIO
+ * is the socket itself. This stream attaches the SSL object to the socket's
+ * file descriptor and drives the non-blocking SSL calls with asio readiness
+ * waits. When the context has SSL_OP_ENABLE_KTLS and the kernel accepts the
+ * negotiated cipher, records are encrypted in the kernel after the handshake
+ * and files can go out with async_sendfile(). Otherwise it behaves as an
+ * ordinary userspace TLS stream.
+ *
+ * Offers the subset of the ssl::stream interface used by AsioSSLServer and
+ * AsioConnectionDriver, so either stream type works with them.
+ */
+class KtlsStream {
+  public:
+    using executor_type = tcp::socket::executor_type;
+    using next_layer_type = tcp::socket;
+    using lowest_layer_type = tcp::socket::lowest_layer_type;
+
+    /**
+     * @throws std::runtime_error if the SSL object can't be created
+     */
+    KtlsStream(tcp::socket socket, ssl::context& context);
+    KtlsStream(KtlsStream&& other) noexcept;
+    ~KtlsStream();
+
+    KtlsStream(const KtlsStream&) = delete;
+    KtlsStream& operator=(const KtlsStream&) = delete;
+    KtlsStream& operator=(KtlsStream&&) = delete;
+
+    executor_type get_executor() { return socket_.get_executor(); }
+    next_layer_type& next_layer() { return socket_; }
+    lowest_layer_type& lowest_layer() { return socket_.lowest_layer(); }
+    SSL* native_handle() { return ssl_; }
+
+    /**
+     * Whether the kernel encrypts outgoing records (valid after the handshake)
+     */
+    bool ktls_send() const;
+
+    template <typename Token>
+    auto async_handshake(ssl::stream_base::handshake_type type, Token&& token) {
+        if (type == ssl::stream_base::server) {
+            SSL_set_accept_state(ssl_);
+        } else {
+            SSL_set_connect_state(ssl_);
+        }
+        return async_ssl<false>([this](size_t&) { return SSL_do_handshake(ssl_); },
+                                std::forward<Token>(token));
+    }
+
+    /**
+     * Send close_notify. Doesn't wait for the peer's, as the socket is
+     * closed right after.
+     */
+    template <typename Token> auto async_shutdown(Token&& token) {
+        return async_ssl<false>(
+            [this](size_t&) {
+                int result = SSL_shutdown(ssl_);
+                return result == 0 ? 1 : result;
+            },
+            std::forward<Token>(token));
+    }
+
+    template <typename MutableBufferSequence, typename Token>
+    auto async_read_some(const MutableBufferSequence& buffers, Token&& token) {
+        asio::mutable_buffer buffer = first_buffer(buffers);
+        return async_ssl<true>(
+            [this, buffer](size_t& transferred) {
+                if (buffer.size() == 0) {
+                    return 1;
+                }
+                return SSL_read_ex(ssl_, buffer.data(), buffer.size(), &transferred);
+            },
+            std::forward<Token>(token));
+    }
+
+    template <typename ConstBufferSequence, typename Token>
+    auto async_write_some(const ConstBufferSequence& buffers, Token&& token) {
+        asio::const_buffer buffer = first_buffer(buffers);
+        return async_ssl<true>(
+            [this, buffer](size_t& transferred) {
+                if (buffer.size() == 0) {
+                    return 1;
+                }
+                return SSL_write_ex(ssl_, buffer.data(), buffer.size(), &transferred);
+            },
+            std::forward<Token>(token));
+    }
+
+    /**
+     * Send up to count bytes of a file through kernel TLS (requires ktls_send()).
+     * Completes with the number of bytes sent, which may be fewer than count.
+     */
+    template <typename Token>
+    auto async_sendfile(int fd, off_t offset, size_t count, Token&& token) {
+        return async_ssl<true>(
+            [this, fd, offset, count](size_t& transferred) {
+                ossl_ssize_t sent = SSL_sendfile(ssl_, fd, offset, count, 0);
+                if (sent <= 0) {
+                    return static_cast<int>(sent);
+                }
+                transferred = static_cast<size_t>(sent);
+                return 1;
+            },
+            std::forward<Token>(token));
+    }
+
+  private:
+    template <typename BufferSequence> static auto first_buffer(const BufferSequence& buffers) {
+        auto it = asio::buffer_sequence_begin(buffers);
+        auto end = asio::buffer_sequence_end(buffers);
+        for (; it != end; ++it) {
+            if (it->size() > 0) {
+                return *it;
+            }
+        }
+        return std::decay_t<decltype(*it)>{};
+    }
+
+    /**
+     * Error for an SSL call that returned result, or success if it wants to
+     * be retried once the socket is ready (want_read/want_write set)
+     */
+    boost::system::error_code ssl_error(int result, bool& want_read, bool& want_write);
+
+    /**
+     * Repeat an SSL call until it stops asking for socket readiness
+     * @tparam Sized Complete with (error_code, size_t) rather than (error_code)
+     * @param operation Returns the SSL call's result (> 0 on success) and sets
+     *                  the bytes transferred
+     */
+    template <bool Sized, typename Operation, typename Token>
+    auto async_ssl(Operation operation, Token&& token) {
+        using Signature = std::conditional_t<Sized, void(boost::system::error_code, size_t),
+                                             void(boost::system::error_code)>;
+        return asio::async_compose<Token, Signature>(
+            [this, operation, started = false, done = false, result = boost::system::error_code(),
+             transferred = size_t(0)](auto& self,
+                                      boost::system::error_code ec = {}) mutable {
+                if (!done) {
+                    bool first_call = !started;
+                    started = true;
+                    if (ec) {
+                        result = ec; // Wait failed or was cancelled
+                    } else {
+                        ERR_clear_error();
+                        errno = 0;
+                        bool want_read = false;
+                        bool want_write = false;
+                        result = ssl_error(operation(transferred), want_read, want_write);
+                        if (want_read || want_write) {
+                            socket_.async_wait(want_read ? tcp::socket::wait_read
+                                                         : tcp::socket::wait_write,
+                                               std::move(self));
+                            return;
+                        }
+                    }
+                    done = true;
+                    if (first_call) {
+                        // Never complete inside the initiating function
+                        asio::post(socket_.get_executor(), std::move(self));
+                        return;
+                    }
+                }
+                if constexpr (Sized) {
+                    self.complete(result, result ? 0 : transferred);
+                } else {
+                    self.complete(result);
+                }
+            },
+            token, socket_);
+    }
+
+    tcp::socket socket_;
+    SSL* ssl_ = nullptr;
+};
+
+#endif // KTLS_STREAM_H
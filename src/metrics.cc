@@ -0,0 +1,492 @@
+#include "metrics.h"
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// ============================================================================
+// LogLinearHistogram
+// ============================================================================
+
+void LogLinearHistogram::record(uint64_t value, uint64_t count) noexcept {
+    if (count == 0) {
+        return;
+    }
+    buckets_[bucket_index(value)] += count;
+    count_ += count;
+    sum_ += value * count;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+}
+
+void LogLinearHistogram::record_corrected(uint64_t value, uint64_t expected_interval) noexcept {
+    record(value);
+    if (expected_interval == 0 || value <= expected_interval) {
+        return;
+    }
+    for (uint64_t missing = value - expected_interval; missing >= expected_interval;
+         missing -= expected_interval) {
+        record(missing);
+    }
+}
+
+void LogLinearHistogram::merge(const LogLinearHistogram& other) noexcept {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+void LogLinearHistogram::reset() noexcept { *this = LogLinearHistogram{}; }
+
+uint64_t LogLinearHistogram::percentile(double quantile) const noexcept {
+    if (count_ == 0) {
+        return 0;
+    }
+    quantile = std::clamp(quantile, 0.0, 1.0);
+    auto target = static_cast<uint64_t>(quantile * static_cast<double>(count_));
+    target = std::max<uint64_t>(target, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += buckets_[i];
+        if (seen >= target) {
+            return std::min(bucket_upper_bound(i), max_);
+        }
+    }
+    return max_;
+}
+
+// ============================================================================
+// Metrics shards
+// ============================================================================
+
+namespace {
+
+constexpr std::array<std::string_view, 7> kMethods = {"GET", "HEAD",    "POST", "PUT",
+                                                      "DELETE", "OPTIONS", "OTHER"};
+
+// Status codes the server produces; anything else is reported as "other"
+constexpr std::array<int, 27> kStatusCodes = {200, 201, 204, 206, 301, 302, 303, 304, 307,
+                                              308, 400, 401, 403, 404, 405, 406, 408, 411,
+                                              412, 413, 416, 429, 500, 501, 503, 505, 0};
+
+constexpr size_t kProtocols = static_cast<size_t>(Metrics::Protocol::COUNT);
+constexpr size_t kCounters = static_cast<size_t>(Metrics::Counter::COUNT);
+constexpr size_t kGauges = static_cast<size_t>(Metrics::Gauge::COUNT);
+constexpr size_t kRequestSlots = kProtocols * kMethods.size() * kStatusCodes.size();
+
+constexpr std::array<uint8_t, 600> kStatusIndex = [] {
+    std::array<uint8_t, 600> index{};
+    index.fill(static_cast<uint8_t>(kStatusCodes.size() - 1));
+    for (size_t i = 0; i + 1 < kStatusCodes.size(); ++i) {
+        index[static_cast<size_t>(kStatusCodes[i])] = static_cast<uint8_t>(i);
+    }
+    return index;
+}();
+
+constexpr std::array<std::string_view, kProtocols> kProtocolLabels = {"1.0", "1.1", "2"};
+
+/**
+ * Single-writer increment: only the owning thread stores, so a relaxed
+ * load/store pair is enough and avoids a locked read-modify-write
+ */
+template <typename T> inline void bump(std::atomic<T>& cell, T amount) noexcept {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct ShardHistogram {
+    std::array<std::atomic<uint64_t>, LogLinearHistogram::BUCKET_COUNT> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+
+    void record(uint64_t value) noexcept {
+        bump<uint64_t>(buckets[LogLinearHistogram::bucket_index(value)], 1);
+        bump<uint64_t>(count, 1);
+        bump(sum, value);
+    }
+};
+
+struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, kCounters> counters{};
+    std::array<std::atomic<int64_t>, kGauges> gauges{};
+    std::array<std::atomic<uint64_t>, kRequestSlots> requests{};
+    std::array<ShardHistogram, kProtocols> request_duration;
+    ShardHistogram tls_handshake;
+    ShardHistogram blocking_wait;
+};
+
+std::mutex& registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<Shard>>& registry() {
+    static std::vector<std::unique_ptr<Shard>> shards;
+    return shards;
+}
+
+thread_local Shard* tls_shard = nullptr;
+
+Shard& local_shard() {
+    if (!tls_shard) [[unlikely]] {
+        auto shard = std::make_unique<Shard>();
+        tls_shard = shard.get();
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry().push_back(std::move(shard));
+    }
+    return *tls_shard;
+}
+
+size_t method_index(std::string_view method) noexcept {
+    for (size_t i = 0; i + 1 < kMethods.size(); ++i) {
+        if (method == kMethods[i]) {
+            return i;
+        }
+    }
+    return kMethods.size() - 1;
+}
+
+size_t status_index(int status) noexcept {
+    if (status < 0 || status >= static_cast<int>(kStatusIndex.size())) {
+        return kStatusCodes.size() - 1;
+    }
+    return kStatusIndex[static_cast<size_t>(status)];
+}
+
+/**
+ * Summed view of a histogram across all shards
+ */
+struct HistogramTotals {
+    std::array<uint64_t, LogLinearHistogram::BUCKET_COUNT> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    void add(const ShardHistogram& h) {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+        }
+        count += h.count.load(std::memory_order_relaxed);
+        sum += h.sum.load(std::memory_order_relaxed);
+    }
+};
+
+void render_help(std::string& out, std::string_view name, std::string_view type,
+                 std::string_view help) {
+    out += std::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+/**
+ * Emit a histogram in seconds using one `le` bucket per power of two from
+ * ~1us to ~69s. Octave boundaries coincide with log-linear bucket
+ * boundaries, so the cumulative counts are exact.
+ */
+void render_histogram(std::string& out, std::string_view name, std::string_view labels,
+                      const HistogramTotals& h) {
+    constexpr unsigned kFirstOctave = 10; // 2^10 ns
+    constexpr unsigned kLastOctave = 36;  // 2^36 ns
+    std::string_view sep = labels.empty() ? "" : ",";
+
+    uint64_t cumulative = 0;
+    size_t next_bucket = 0;
+    for (unsigned octave = kFirstOctave; octave <= kLastOctave; ++octave) {
+        uint64_t bound_ns = (uint64_t{1} << octave) - 1;
+        size_t last = LogLinearHistogram::bucket_index(bound_ns);
+        for (; next_bucket <= last; ++next_bucket) {
+            cumulative += h.buckets[next_bucket];
+        }
+        out += std::format("{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, sep,
+                           static_cast<double>(bound_ns) / 1e9, cumulative);
+    }
+    out += std::format("{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, sep, h.count);
+    std::string label_set = labels.empty() ? "" : std::format("{{{}}}", labels);
+    out += std::format("{}_sum{} {}\n", name, label_set, static_cast<double>(h.sum) / 1e9);
+    out += std::format("{}_count{} {}\n", name, label_set, h.count);
+}
+
+} // anonymous namespace
+
+// ============================================================================
+// Metrics
+// ============================================================================
+
+void Metrics::record_request(Protocol protocol, std::string_view method, int status,
+                             std::chrono::nanoseconds duration) noexcept {
+    Shard& shard = local_shard();
+    auto p = static_cast<size_t>(protocol);
+    size_t slot = (p * kMethods.size() + method_index(method)) * kStatusCodes.size() +
+                  status_index(status);
+    bump<uint64_t>(shard.requests[slot], 1);
+    shard.request_duration[p].record(
+        static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+}
+
+void Metrics::increment(Counter counter, uint64_t amount) noexcept {
+    bump(local_shard().counters[static_cast<size_t>(counter)], amount);
+}
+
+void Metrics::add(Gauge gauge, int64_t delta) noexcept {
+    bump(local_shard().gauges[static_cast<size_t>(gauge)], delta);
+}
+
+void Metrics::record_tls_handshake(std::chrono::nanoseconds duration, bool success,
+                                   bool resumed) noexcept {
+    Shard& shard = local_shard();
+    if (success) {
+        bump<uint64_t>(shard.counters[static_cast<size_t>(Counter::TlsHandshakes)], 1);
+        if (resumed) {
+            bump<uint64_t>(shard.counters[static_cast<size_t>(Counter::TlsResumedHandshakes)], 1);
+        }
+        shard.tls_handshake.record(static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+    } else {
+        bump<uint64_t>(shard.counters[static_cast<size_t>(Counter::TlsHandshakeFailures)], 1);
+    }
+}
+
+void Metrics::record_blocking_wait(std::chrono::nanoseconds wait) noexcept {
+    Shard& shard = local_shard();
+    bump<uint64_t>(shard.counters[static_cast<size_t>(Counter::BlockingTasks)], 1);
+    shard.blocking_wait.record(static_cast<uint64_t>(std::max<int64_t>(wait.count(), 0)));
+}
+
+Metrics::Protocol Metrics::protocol_from_version(std::string_view version) noexcept {
+    if (version == "HTTP/1.0") {
+        return Protocol::Http10;
+    }
+    if (version == "HTTP/2" || version == "HTTP/2.0") {
+        return Protocol::Http2;
+    }
+    return Protocol::Http11;
+}
+
+std::string Metrics::render() {
+    std::array<uint64_t, kCounters> counters{};
+    std::array<int64_t, kGauges> gauges{};
+    std::vector<uint64_t> requests(kRequestSlots, 0);
+    std::array<HistogramTotals, kProtocols> durations;
+    HistogramTotals handshakes;
+    HistogramTotals blocking_waits;
+
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (const auto& shard : registry()) {
+            for (size_t i = 0; i < kCounters; ++i) {
+                counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < kGauges; ++i) {
+                gauges[i] += shard->gauges[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < kRequestSlots; ++i) {
+                requests[i] += shard->requests[i].load(std::memory_order_relaxed);
+            }
+            for (size_t p = 0; p < kProtocols; ++p) {
+                durations[p].add(shard->request_duration[p]);
+            }
+            handshakes.add(shard->tls_handshake);
+            blocking_waits.add(shard->blocking_wait);
+        }
+    }
+
+    auto counter = [&counters](Counter c) { return counters[static_cast<size_t>(c)]; };
+    auto gauge = [&gauges](Gauge g) { return gauges[static_cast<size_t>(g)]; };
+
+    std::string out;
+    out.reserve(16384);
+
+    render_help(out, "shelob_http_requests_total", "counter",
+                "HTTP requests by protocol, method and status code.");
+    for (size_t p = 0; p < kProtocols; ++p) {
+        for (size_t m = 0; m < kMethods.size(); ++m) {
+            for (size_t s = 0; s < kStatusCodes.size(); ++s) {
+                uint64_t value = requests[(p * kMethods.size() + m) * kStatusCodes.size() + s];
+                if (value == 0) {
+                    continue;
+                }
+                std::string code = kStatusCodes[s] ? std::to_string(kStatusCodes[s]) : "other";
+                out += std::format(
+                    "shelob_http_requests_total{{protocol=\"{}\",method=\"{}\",code=\"{}\"}} {}\n",
+                    kProtocolLabels[p], kMethods[m], code, value);
+            }
+        }
+    }
+
+    render_help(out, "shelob_http_request_duration_seconds", "histogram",
+                "Time from request receipt until the response was written.");
+    for (size_t p = 0; p < kProtocols; ++p) {
+        if (durations[p].count == 0) {
+            continue;
+        }
+        render_histogram(out, "shelob_http_request_duration_seconds",
+                         std::format("protocol=\"{}\"", kProtocolLabels[p]), durations[p]);
+    }
+
+    render_help(out, "shelob_received_bytes_total", "counter", "Bytes read from clients.");
+    out += std::format("shelob_received_bytes_total {}\n", counter(Counter::BytesReceived));
+    render_help(out, "shelob_sent_bytes_total", "counter", "Bytes written to clients.");
+    out += std::format("shelob_sent_bytes_total {}\n", counter(Counter::BytesSent));
+
+    render_help(out, "shelob_connections_accepted_total", "counter", "Accepted connections.");
+    out += std::format("shelob_connections_accepted_total {}\n",
+                       counter(Counter::ConnectionsAccepted));
+    render_help(out, "shelob_active_connections", "gauge", "Currently open client connections.");
+    out += std::format("shelob_active_connections{{transport=\"tcp\"}} {}\n",
+                       gauge(Gauge::ActiveConnections));
+    out += std::format("shelob_active_connections{{transport=\"tls\"}} {}\n",
+                       gauge(Gauge::ActiveTlsConnections));
+    render_help(out, "shelob_keepalive_requests_total", "counter",
+                "Requests served on a reused keep-alive connection.");
+    out += std::format("shelob_keepalive_requests_total {}\n", counter(Counter::KeepAliveReuse));
+    render_help(out, "shelob_slow_connections_closed_total", "counter",
+                "Connections closed for transferring below the minimum data rate.");
+    out += std::format("shelob_slow_connections_closed_total {}\n",
+                       counter(Counter::SlowConnectionsClosed));
+
+    render_help(out, "shelob_tls_handshakes_total", "counter", "TLS handshakes by result.");
+    out += std::format("shelob_tls_handshakes_total{{result=\"success\"}} {}\n",
+                       counter(Counter::TlsHandshakes));
+    out += std::format("shelob_tls_handshakes_total{{result=\"failure\"}} {}\n",
+                       counter(Counter::TlsHandshakeFailures));
+    uint64_t resumed = counter(Counter::TlsResumedHandshakes);
+    uint64_t full = std::max(counter(Counter::TlsHandshakes), resumed) - resumed;
+    render_help(out, "shelob_tls_sessions_total", "counter",
+                "Successful TLS handshakes by session: full or resumed.");
+    out += std::format("shelob_tls_sessions_total{{session=\"full\"}} {}\n", full);
+    out += std::format("shelob_tls_sessions_total{{session=\"resumed\"}} {}\n", resumed);
+    render_help(out, "shelob_tls_handshake_duration_seconds", "histogram",
+                "Duration of successful TLS handshakes.");
+    render_histogram(out, "shelob_tls_handshake_duration_seconds", "", handshakes);
+
+    render_help(out, "shelob_http2_streams_total", "counter", "HTTP/2 streams opened.");
+    out += std::format("shelob_http2_streams_total {}\n", counter(Counter::Http2Streams));
+    render_help(out, "shelob_http2_active_streams", "gauge", "Currently open HTTP/2 streams.");
+    out += std::format("shelob_http2_active_streams {}\n", gauge(Gauge::ActiveHttp2Streams));
+
+    render_help(out, "shelob_rate_limit_rejections_total", "counter",
+                "Requests rejected with 429 by the rate limiter.");
+    out += std::format("shelob_rate_limit_rejections_total {}\n",
+                       counter(Counter::RateLimitRejections));
+
+    render_help(out, "shelob_auth_cache_requests_total", "counter",
+                "Basic auth credential cache lookups by result.");
+    out += std::format("shelob_auth_cache_requests_total{{result=\"hit\"}} {}\n",
+                       counter(Counter::AuthCacheHits));
+    out += std::format("shelob_auth_cache_requests_total{{result=\"miss\"}} {}\n",
+                       counter(Counter::AuthCacheMisses));
+
+    render_help(out, "shelob_websocket_subscribers", "gauge",
+                "Connections subscribed to a pub/sub topic.");
+    out += std::format("shelob_websocket_subscribers {}\n", gauge(Gauge::WebSocketSubscribers));
+    render_help(out, "shelob_websocket_messages_published_total", "counter",
+                "Messages published to pub/sub topics.");
+    out += std::format("shelob_websocket_messages_published_total {}\n",
+                       counter(Counter::WebSocketMessagesPublished));
+    render_help(out, "shelob_websocket_frames_total", "counter",
+                "Frames queued for subscribers by result: sent or dropped from a full queue.");
+    out += std::format("shelob_websocket_frames_total{{result=\"sent\"}} {}\n",
+                       counter(Counter::WebSocketFramesSent));
+    out += std::format("shelob_websocket_frames_total{{result=\"dropped\"}} {}\n",
+                       counter(Counter::WebSocketFramesDropped));
+    render_help(out, "shelob_websocket_slow_consumers_closed_total", "counter",
+                "Subscribers disconnected because their queue was full.");
+    out += std::format("shelob_websocket_slow_consumers_closed_total {}\n",
+                       counter(Counter::WebSocketSlowConsumersClosed));
+
+    render_help(out, "shelob_fastcgi_requests_total", "counter",
+                "Requests forwarded to the FastCGI application by result.");
+    uint64_t fastcgi_failed = counter(Counter::FastCgiFailures);
+    out += std::format("shelob_fastcgi_requests_total{{result=\"answered\"}} {}\n",
+                       std::max(counter(Counter::FastCgiRequests), fastcgi_failed) -
+                           fastcgi_failed);
+    out += std::format("shelob_fastcgi_requests_total{{result=\"failed\"}} {}\n",
+                       fastcgi_failed);
+    render_help(out, "shelob_fastcgi_connections", "gauge",
+                "Open connections to the FastCGI application.");
+    out += std::format("shelob_fastcgi_connections {}\n", gauge(Gauge::FastCgiConnections));
+    render_help(out, "shelob_fastcgi_connections_opened_total", "counter",
+                "Connections made to the FastCGI application.");
+    out += std::format("shelob_fastcgi_connections_opened_total {}\n",
+                       counter(Counter::FastCgiConnectionsOpened));
+
+    render_help(out, "shelob_proxy_requests_total", "counter",
+                "Requests forwarded to upstream servers by result.");
+    uint64_t proxy_failed = counter(Counter::ProxyFailures);
+    out += std::format("shelob_proxy_requests_total{{result=\"answered\"}} {}\n",
+                       std::max(counter(Counter::ProxyRequests), proxy_failed) - proxy_failed);
+    out += std::format("shelob_proxy_requests_total{{result=\"failed\"}} {}\n", proxy_failed);
+    render_help(out, "shelob_proxy_retries_total", "counter",
+                "Requests resent because a reused upstream connection had closed.");
+    out += std::format("shelob_proxy_retries_total {}\n", counter(Counter::ProxyRetries));
+    render_help(out, "shelob_proxy_upstream_connections_total", "counter",
+                "Upstream connections used by whether they were opened or reused.");
+    out += std::format("shelob_proxy_upstream_connections_total{{kind=\"opened\"}} {}\n",
+                       counter(Counter::ProxyConnectionsOpened));
+    out += std::format("shelob_proxy_upstream_connections_total{{kind=\"reused\"}} {}\n",
+                       counter(Counter::ProxyConnectionsReused));
+    render_help(out, "shelob_proxy_idle_connections", "gauge",
+                "Idle keep-alive connections to upstream servers.");
+    out += std::format("shelob_proxy_idle_connections {}\n", gauge(Gauge::ProxyIdleConnections));
+    render_help(out, "shelob_proxy_servers_marked_down_total", "counter",
+                "Times an upstream server was taken out of rotation after failures.");
+    out += std::format("shelob_proxy_servers_marked_down_total {}\n",
+                       counter(Counter::ProxyServersMarkedDown));
+
+    render_help(out, "shelob_cache_requests_total", "counter",
+                "Response cache lookups by result: fresh hit, stale hit or miss.");
+    uint64_t cache_hits = counter(Counter::CacheHits);
+    uint64_t cache_stale = counter(Counter::CacheStaleHits);
+    uint64_t cache_misses = counter(Counter::CacheMisses);
+    out += std::format("shelob_cache_requests_total{{result=\"hit\"}} {}\n", cache_hits);
+    out += std::format("shelob_cache_requests_total{{result=\"stale\"}} {}\n", cache_stale);
+    out += std::format("shelob_cache_requests_total{{result=\"miss\"}} {}\n", cache_misses);
+    render_help(out, "shelob_cache_hit_ratio", "gauge",
+                "Share of response cache lookups answered from the cache.");
+    uint64_t cache_lookups = cache_hits + cache_stale + cache_misses;
+    out += std::format("shelob_cache_hit_ratio {}\n",
+                       cache_lookups ? static_cast<double>(cache_hits + cache_stale) /
+                                           static_cast<double>(cache_lookups)
+                                     : 0.0);
+    render_help(out, "shelob_cache_coalesced_waiters_total", "counter",
+                "Cache misses that waited for another request's fetch of the same response.");
+    out += std::format("shelob_cache_coalesced_waiters_total {}\n",
+                       counter(Counter::CacheCoalescedWaiters));
+    render_help(out, "shelob_cache_saved_bytes_total", "counter",
+                "Response bytes sent from the cache instead of a backend.");
+    out += std::format("shelob_cache_saved_bytes_total {}\n", counter(Counter::CacheBytesSaved));
+    render_help(out, "shelob_cache_bytes", "gauge", "Bytes of responses stored by tier.");
+    out += std::format("shelob_cache_bytes{{tier=\"memory\"}} {}\n",
+                       gauge(Gauge::CacheMemoryBytes));
+    out += std::format("shelob_cache_bytes{{tier=\"disk\"}} {}\n", gauge(Gauge::CacheDiskBytes));
+    render_help(out, "shelob_cache_entries", "gauge", "Responses stored in the cache.");
+    out += std::format("shelob_cache_entries {}\n", gauge(Gauge::CacheEntries));
+
+    render_help(out, "shelob_open_file_cache_requests_total", "counter",
+                "Open file cache lookups of static files by result.");
+    out += std::format("shelob_open_file_cache_requests_total{{result=\"hit\"}} {}\n",
+                       counter(Counter::OpenFileCacheHits));
+    out += std::format("shelob_open_file_cache_requests_total{{result=\"miss\"}} {}\n",
+                       counter(Counter::OpenFileCacheMisses));
+
+    render_help(out, "shelob_negative_cache_hits_total", "counter",
+                "Requests for known missing paths answered with a prepared 404.");
+    out += std::format("shelob_negative_cache_hits_total {}\n",
+                       counter(Counter::NegativeCacheHits));
+
+    render_help(out, "shelob_blocking_tasks_total", "counter",
+                "Blocking file I/O and CPU work by where it ran.");
+    out += std::format("shelob_blocking_tasks_total{{executor=\"pool\"}} {}\n",
+                       counter(Counter::BlockingTasks));
+    out += std::format("shelob_blocking_tasks_total{{executor=\"inline\"}} {}\n",
+                       counter(Counter::BlockingTasksInline));
+    render_help(out, "shelob_blocking_queue_depth", "gauge",
+                "Tasks waiting for a blocking pool worker.");
+    out += std::format("shelob_blocking_queue_depth {}\n", gauge(Gauge::BlockingQueueDepth));
+    render_help(out, "shelob_blocking_wait_seconds", "histogram",
+                "Time tasks waited in the blocking pool queue.");
+    render_histogram(out, "shelob_blocking_wait_seconds", "", blocking_waits);
+
+    return out;
+}
@@ -0,0 +1,204 @@
+#ifndef SHELOB_METRICS_H
+#define SHELOB_METRICS_H 1
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Log-linear histogram (HdrHistogram-style bucketing)
+ *
+ * Each power-of-two octave is split into SUB_BUCKETS linear buckets, giving a
+ * bounded relative error of 1/SUB_BUCKETS (12.5%) over the whole range with a
+ * fixed, allocation-free bucket array. Values are unsigned integers, normally
+ * nanoseconds. Not thread-safe; see Metrics for the sharded variant.
+ */
+class LogLinearHistogram {
+  public:
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr unsigned MAX_EXPONENT = 40; // Values >= 2^40 (~18 min in ns) are clamped
+    static constexpr size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static constexpr size_t bucket_index(uint64_t value) noexcept {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        unsigned msb = static_cast<unsigned>(std::bit_width(value)) - 1;
+        if (msb >= MAX_EXPONENT) {
+            return BUCKET_COUNT - 1;
+        }
+        unsigned shift = msb - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    /**
+     * Largest value (inclusive) that maps to the given bucket
+     */
+    static constexpr uint64_t bucket_upper_bound(size_t index) noexcept {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        unsigned shift = static_cast<unsigned>(index / SUB_BUCKETS) - 1;
+        uint64_t lower = static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+        return lower + (uint64_t{1} << shift) - 1;
+    }
+
+    void record(uint64_t value, uint64_t count = 1) noexcept;
+
+    /**
+     * Record a value with coordinated-omission correction: when a sample took
+     * longer than the expected interval between samples, also record the
+     * samples that would have been taken while the system was stalled.
+     */
+    void record_corrected(uint64_t value, uint64_t expected_interval) noexcept;
+
+    void merge(const LogLinearHistogram& other) noexcept;
+    void reset() noexcept;
+
+    uint64_t count() const noexcept { return count_; }
+    uint64_t sum() const noexcept { return sum_; }
+    uint64_t min() const noexcept { return count_ ? min_ : 0; }
+    uint64_t max() const noexcept { return max_; }
+    double mean() const noexcept {
+        return count_ ? static_cast<double>(sum_) / static_cast<double>(count_) : 0.0;
+    }
+    uint64_t bucket(size_t index) const noexcept { return buckets_[index]; }
+
+    /**
+     * Value at the given quantile (0.0 - 1.0), reported as the upper bound
+     * of the bucket containing it
+     */
+    uint64_t percentile(double quantile) const noexcept;
+
+  private:
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+/**
+ * Process-wide server metrics exported in Prometheus text format
+ *
+ * Every thread that records a metric gets its own shard, so the hot path is a
+ * thread-local lookup plus a relaxed load/store on a cache line no other core
+ * writes to. There are no shared atomics and no read-modify-write
+ * instructions. Shards are only summed when the metrics endpoint is scraped.
+ * Shards are never freed, so totals stay monotonic when threads exit.
+ */
+class Metrics {
+  public:
+    enum class Counter : size_t {
+        BytesReceived,
+        BytesSent,
+        ConnectionsAccepted,
+        KeepAliveReuse,        // Requests served on an already-used connection
+        SlowConnectionsClosed, // Evicted for falling below the minimum data rate
+        TlsHandshakes,
+        TlsHandshakeFailures,
+        TlsResumedHandshakes, // Successful handshakes that resumed a session
+        Http2Streams,
+        RateLimitRejections,
+        AuthCacheHits,
+        AuthCacheMisses,
+        BlockingTasks,       // Work run on the BlockingPool
+        BlockingTasksInline, // Run on the calling thread because the pool was full
+        WebSocketMessagesPublished,
+        WebSocketFramesSent,
+        WebSocketFramesDropped,       // Oldest frames discarded from a full subscriber queue
+        WebSocketSlowConsumersClosed, // Subscribers disconnected for a full queue
+        FastCgiRequests,
+        FastCgiFailures, // Requests the application didn't answer
+        FastCgiConnectionsOpened,
+        ProxyRequests,
+        ProxyFailures, // Requests no upstream answered in full
+        ProxyRetries,  // Resent after a reused upstream connection turned out closed
+        ProxyConnectionsOpened,
+        ProxyConnectionsReused,
+        ProxyServersMarkedDown, // Taken out of rotation by passive health checks
+        CacheHits,
+        CacheStaleHits,        // Served stale while revalidating or instead of an error
+        CacheMisses,
+        CacheCoalescedWaiters, // Misses that waited for another request's fetch
+        CacheBytesSaved,       // Response bytes sent from the cache instead of a backend
+        OpenFileCacheHits,
+        OpenFileCacheMisses, // Looked up again, including entries stat()ed after expiring
+        NegativeCacheHits,   // Known missing paths answered without Http
+        COUNT
+    };
+
+    enum class Gauge : size_t {
+        ActiveConnections,
+        ActiveTlsConnections,
+        ActiveHttp2Streams,
+        BlockingQueueDepth, // Tasks waiting for a BlockingPool worker
+        WebSocketSubscribers,
+        FastCgiConnections,
+        ProxyIdleConnections, // Upstream keep-alive connections waiting for a request
+        CacheMemoryBytes,
+        CacheDiskBytes,
+        CacheEntries,
+        COUNT
+    };
+
+    enum class Protocol : size_t { Http10, Http11, Http2, COUNT };
+
+    /**
+     * Count a completed request and record its latency
+     * @param protocol HTTP protocol version
+     * @param method Request method (unknown methods are counted as OTHER)
+     * @param status Response status code (0 if no response was produced)
+     * @param duration Time from request receipt to response written
+     */
+    static void record_request(Protocol protocol, std::string_view method, int status,
+                               std::chrono::nanoseconds duration) noexcept;
+
+    static void increment(Counter counter, uint64_t amount = 1) noexcept;
+    static void add(Gauge gauge, int64_t delta) noexcept;
+
+    /**
+     * Count a TLS handshake and record its duration if it succeeded
+     * @param resumed The client resumed a session (ticket or session cache)
+     */
+    static void record_tls_handshake(std::chrono::nanoseconds duration, bool success,
+                                     bool resumed = false) noexcept;
+
+    /**
+     * Record how long a task waited in the BlockingPool queue before a worker
+     * picked it up
+     */
+    static void record_blocking_wait(std::chrono::nanoseconds wait) noexcept;
+
+    /**
+     * Map an HTTP version string ("HTTP/1.0", "HTTP/1.1") to a protocol label
+     */
+    static Protocol protocol_from_version(std::string_view version) noexcept;
+
+    /**
+     * Aggregate all shards and render the Prometheus text exposition format
+     */
+    static std::string render();
+
+    /**
+     * RAII helper keeping a gauge incremented for the lifetime of a scope
+     */
+    class GaugeGuard {
+      public:
+        explicit GaugeGuard(Gauge gauge) : gauge_(gauge) { Metrics::add(gauge_, 1); }
+        ~GaugeGuard() { Metrics::add(gauge_, -1); }
+        GaugeGuard(const GaugeGuard&) = delete;
+        GaugeGuard& operator=(const GaugeGuard&) = delete;
+
+      private:
+        Gauge gauge_;
+    };
+};
+
+#endif /* !SHELOB_METRICS_H */
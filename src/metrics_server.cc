@@ -0,0 +1,83 @@
+#include "metrics_server.h"
+#include "connection_timeouts.h"
+#include "metrics.h"
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <format>
+#include <iostream>
+
+using namespace boost::asio::experimental::awaitable_operators;
+
+MetricsServer::MetricsServer(const std::string& address, int port)
+    : acceptor_(io_context_,
+                tcp::endpoint(asio::ip::make_address(address), static_cast<unsigned short>(port))) {
+    std::cout << "Metrics endpoint on http://" << address << ":" << port << "/metrics"
+              << std::endl;
+}
+
+MetricsServer::~MetricsServer() { stop(); }
+
+void MetricsServer::start() {
+    asio::co_spawn(io_context_, listener(), asio::detached);
+    thread_ = std::thread([this] { io_context_.run(); });
+}
+
+void MetricsServer::stop() {
+    io_context_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+asio::awaitable<void> MetricsServer::listener() {
+    try {
+        while (true) {
+            auto socket = co_await acceptor_.async_accept(asio::use_awaitable);
+            asio::co_spawn(io_context_, handle_connection(std::move(socket)), asio::detached);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Metrics accept error: " << e.what() << std::endl;
+    }
+}
+
+asio::awaitable<void> MetricsServer::handle_connection(tcp::socket socket) {
+    try {
+        std::string request;
+        asio::steady_timer timer(socket.get_executor());
+        timer.expires_after(std::chrono::seconds(ConnectionTimeouts::READ_HEADER_TIMEOUT_SEC));
+
+        auto result = co_await (asio::async_read_until(socket, asio::dynamic_buffer(request, 8192),
+                                                       "\r\n\r\n",
+                                                       asio::as_tuple(asio::use_awaitable)) ||
+                                timer.async_wait(asio::as_tuple(asio::use_awaitable)));
+        if (result.index() == 1 || std::get<0>(std::get<0>(result))) {
+            co_return;
+        }
+
+        std::string_view request_line(request.data(), request.find("\r\n"));
+        bool is_get = request_line.starts_with("GET ");
+        bool is_metrics = request_line.starts_with("GET /metrics ") ||
+                          request_line.starts_with("GET /metrics?");
+
+        std::string response;
+        if (is_get && is_metrics) {
+            std::string body = Metrics::render();
+            response = std::format("HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                   "Content-Length: {}\r\n"
+                                   "Connection: close\r\n\r\n",
+                                   body.size());
+            response += body;
+        } else {
+            response = is_get ? "HTTP/1.1 404 Not Found\r\n" : "HTTP/1.1 405 Method Not Allowed\r\n";
+            response += "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+
+        co_await asio::async_write(socket, asio::buffer(response), asio::use_awaitable);
+        boost::system::error_code ec;
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+    } catch (const std::exception& e) {
+        // Scraper disconnected
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <string>
+#include <thread>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+/**
+ * Internal HTTP endpoint serving GET /metrics in Prometheus text format
+ *
+ * Runs its own io_context on a dedicated thread so scrapes never compete
+ * with client traffic, and binds to loopback by default.
+ */
+class MetricsServer {
+  public:
+    /**
+     * @param address Address to bind (e.g. "127.0.0.1")
+     * @param port Port to listen on
+     */
+    MetricsServer(const std::string& address, int port);
+    ~MetricsServer();
+
+    // Start serving on a background thread
+    void start();
+    void stop();
+
+  private:
+    asio::awaitable<void> listener();
+    asio::awaitable<void> handle_connection(tcp::socket socket);
+
+    asio::io_context io_context_;
+    tcp::acceptor acceptor_;
+    std::thread thread_;
+};
+
+#endif // METRICS_SERVER_H
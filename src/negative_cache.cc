@@ -0,0 +1,207 @@
+#include "negative_cache.h"
+#include "conditional_request.h"
+#include <array>
+#include <bit>
+#include <chrono>
+#include <ctime>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+// A name appearing in a watched directory, or the directory itself going
+constexpr uint32_t WATCH_EVENTS = IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+constexpr size_t FILTER_BITS_PER_ENTRY = 16;
+constexpr int FILTER_HASHES = 8; // About 0.05% false positives at 16 bits per entry
+
+NegativeCache::Options& configuredOptions() {
+    static NegativeCache::Options options;
+    return options;
+}
+
+std::string directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// The k bit positions of a path are h1 + i * h2 (Kirsch-Mitzenmacher)
+uint64_t second_hash(uint64_t hash) { return (std::rotl(hash, 32) * 0x9e3779b97f4a7c15ULL) | 1; }
+
+} // namespace
+
+const NegativeCache::Options& NegativeCache::options() { return configuredOptions(); }
+
+void NegativeCache::configure(const Options& options) {
+    NegativeCache& cache = getInstance();
+    std::lock_guard lock(cache.mutex_);
+    configuredOptions() = options;
+    cache.added_ = 0;
+    size_t words = options.max_entries == 0
+                       ? 0
+                       : std::bit_ceil(options.max_entries * FILTER_BITS_PER_ENTRY / 64 + 1);
+    cache.filter_ = std::vector<std::atomic<uint64_t>>(words);
+    bool watching = cache.entries_.configure(
+        options.max_entries > 0, WATCH_EVENTS,
+        [&cache](const std::string& directory, std::string_view) { cache.changed(directory); });
+    if (!watching) {
+        std::cerr << "Warning: negative cache can't use inotify; new files are seen after "
+                  << options.valid << "s" << std::endl;
+    }
+}
+
+NegativeCache& NegativeCache::getInstance() {
+    static NegativeCache cache;
+    return cache;
+}
+
+std::shared_ptr<const std::string> NegativeCache::response(bool keep_alive, bool head) {
+    // Keep-alive and close, each with and without the body
+    thread_local std::array<std::shared_ptr<const std::string>, 4> responses;
+    thread_local time_t built = 0;
+    time_t now = time(nullptr);
+    if (now != built) {
+        char date[30];
+        ConditionalRequest::formatHttpDate(now, date);
+        for (size_t i = 0; i < responses.size(); ++i) {
+            // Laid out as Http::sendHeader does
+            auto response = std::make_shared<std::string>(std::format(
+                "HTTP/1.1 404 Not Found\r\nDate: {}\r\nServer: SHELOB/0.5 (Unix)\r\n"
+                "Content-Length: {}\r\nConnection: {}\r\nContent-Type: text/html\r\n\r\n",
+                date, NOT_FOUND_BODY.size(), i < 2 ? "keep-alive" : "close"));
+            if (i % 2 == 0) {
+                *response += NOT_FOUND_BODY;
+            }
+            responses[i] = std::move(response);
+        }
+        built = now;
+    }
+    return responses[(keep_alive ? 0 : 2) + (head ? 1 : 0)];
+}
+
+bool NegativeCache::contains(std::string_view path) {
+    if (configuredOptions().max_entries == 0 ||
+        !maybe_contains(std::hash<std::string_view>{}(path))) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    Entries::Entry* entry = entries_.find(path);
+    if (!entry) {
+        return false;
+    }
+    if (Entries::Clock::now() >= entry->expires) {
+        entries_.erase(path);
+        return false;
+    }
+    return true;
+}
+
+void NegativeCache::insert(std::string_view path, const std::string& filename) {
+    const Options& options = configuredOptions();
+    if (options.max_entries == 0) {
+        return;
+    }
+    uint64_t generation;
+    DirectoryWatcher* watcher;
+    {
+        std::lock_guard lock(mutex_);
+        generation = entries_.generation();
+        watcher = entries_.watcher();
+    }
+
+    // Watch the nearest directory that exists: creating the file, or a
+    // directory on the way to it, adds a name there
+    std::string directory;
+    if (watcher) {
+        for (std::string parent = directory_of(filename);; parent = directory_of(parent)) {
+            if (watcher->watch(parent)) {
+                directory = std::move(parent);
+                break;
+            }
+            if (parent == "." || parent == "/") {
+                break;
+            }
+        }
+    }
+    // Created before the watch started
+    if (::access(filename.c_str(), F_OK) == 0) {
+        return;
+    }
+
+    // Not kept if something was created meanwhile; the next miss is remembered instead
+    std::lock_guard lock(mutex_);
+    auto expires = Entries::Clock::now() + std::chrono::seconds(options.valid);
+    if (!entries_.put(generation, path, std::move(directory), expires, options.max_entries)) {
+        return;
+    }
+    add_to_filter(std::hash<std::string_view>{}(path));
+    // Dropped paths still set bits; start over before they fill the filter
+    if (++added_ >= options.max_entries) {
+        rebuild_filter();
+    }
+}
+
+void NegativeCache::clear() {
+    std::lock_guard lock(mutex_);
+    entries_.invalidate_all();
+    rebuild_filter();
+}
+
+size_t NegativeCache::entries() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+bool NegativeCache::watching() const {
+    std::lock_guard lock(mutex_);
+    return entries_.watching();
+}
+
+bool NegativeCache::maybe_contains(uint64_t hash) const {
+    if (filter_.empty()) {
+        return false;
+    }
+    uint64_t bits = filter_.size() * 64;
+    uint64_t step = second_hash(hash);
+    for (int i = 0; i < FILTER_HASHES; ++i, hash += step) {
+        uint64_t bit = hash & (bits - 1);
+        if (!(filter_[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void NegativeCache::add_to_filter(uint64_t hash) {
+    uint64_t bits = filter_.size() * 64;
+    uint64_t step = second_hash(hash);
+    for (int i = 0; i < FILTER_HASHES; ++i, hash += step) {
+        uint64_t bit = hash & (bits - 1);
+        filter_[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+    }
+}
+
+void NegativeCache::rebuild_filter() {
+    // Lookups racing with this may miss a path, and go to Http as if it weren't cached
+    for (auto& word : filter_) {
+        word.store(0, std::memory_order_relaxed);
+    }
+    for (const Entries::Entry& entry : entries_) {
+        add_to_filter(std::hash<std::string_view>{}(entry.key));
+    }
+    added_ = 0;
+}
+
+void NegativeCache::changed(const std::string& directory) {
+    std::lock_guard lock(mutex_);
+    // An empty directory means events were lost, so every entry goes
+    entries_.invalidate_if([&directory](const Entries::Entry& entry) {
+        return directory.empty() || entry.value == directory;
+    });
+}
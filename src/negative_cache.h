@@ -0,0 +1,99 @@
+#ifndef NEGATIVE_CACHE_H
+#define NEGATIVE_CACHE_H
+
+#include "watched_lru.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Request paths recently found missing, answered with a ready-made 404
+ *
+ * Most requests for files that don't exist come from scanners probing for
+ * well-known paths, and each one costs a full Http request: parsing the
+ * header, checking the path and looking the file up. Once Http has answered
+ * a path with a 404 because its file doesn't exist, the connection answers
+ * later requests for it straight from the request line, without Http and
+ * without touching the filesystem.
+ *
+ * A Bloom filter in front of the exact entries keeps requests for paths that
+ * aren't missing off the lock; it is only ever written under the lock, and is
+ * rebuilt from the entries once as many paths were added as can be kept.
+ * Entries are least recently used first out, and kept for valid seconds.
+ *
+ * The nearest existing directory above each missing file is watched with
+ * inotify, and anything created or moved into it drops the entries filed
+ * under it, so a file is served as soon as it appears. Without inotify a
+ * new file is seen once its entry expires.
+ */
+class NegativeCache {
+  public:
+    struct Options {
+        size_t max_entries = 0; // Missing paths kept, least recently used dropped first; 0 disables
+        size_t valid = 60;      // Seconds a path is answered without looking again
+    };
+
+    // Body of the 404 sent for a missing file, by Http and from the cache alike
+    static constexpr std::string_view NOT_FOUND_BODY =
+        "<html><head><title>404</title></head><body>404 not found</body></html>\n";
+
+    static const Options& options();
+
+    /**
+     * Set the options and empty the cache, starting the inotify thread the
+     * first time it is enabled. Call before serving: the Bloom filter is
+     * resized without the lock.
+     */
+    static void configure(const Options& options);
+
+    // The process-wide cache
+    static NegativeCache& getInstance();
+
+    /**
+     * A complete 404 response, its Date current to the second. Each thread
+     * builds its own once a second; holding one keeps it intact while it is
+     * written, after the next second's has been built.
+     * @param head Without the body, for a HEAD request
+     */
+    static std::shared_ptr<const std::string> response(bool keep_alive, bool head);
+
+    // Whether a request path (without a query) is known to be missing
+    bool contains(std::string_view path);
+
+    /**
+     * Remember a path whose file wasn't found
+     * @param filename The file it was looked up as, to watch its directory
+     */
+    void insert(std::string_view path, const std::string& filename);
+
+    // Forget every path, after the server created a file itself
+    void clear();
+
+    size_t entries() const;
+
+    // Whether created files are seen through inotify
+    bool watching() const;
+
+  private:
+    // Each path's watched directory, the one its file would appear in
+    using Entries = WatchedLru<std::string>;
+
+    NegativeCache() = default;
+
+    bool maybe_contains(uint64_t hash) const;
+    void add_to_filter(uint64_t hash);
+    void rebuild_filter();
+    void changed(const std::string& directory);
+
+    mutable std::mutex mutex_;
+    std::vector<std::atomic<uint64_t>> filter_; // Bloom filter bits
+    size_t added_ = 0;                          // Paths added since the filter was rebuilt
+    Entries entries_; // Under mutex_, which its watcher's callback takes
+};
+
+#endif // NEGATIVE_CACHE_H
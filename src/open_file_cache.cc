@@ -0,0 +1,201 @@
+#include "open_file_cache.h"
+#include "metrics.h"
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+// Changes to a name in a watched directory that can change what looking it up finds
+constexpr uint32_t WATCH_EVENTS = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                  IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+                                  IN_MOVED_TO;
+
+OpenFileCache::Options& configuredOptions() {
+    static OpenFileCache::Options options;
+    return options;
+}
+
+// Failures that say something about the path, rather than about the server (EMFILE)
+bool cacheable_error(int error) { return error == ENOENT || error == ENOTDIR || error == EACCES; }
+
+std::string directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// The path a name in a watched directory is cached under
+std::string child_of(const std::string& directory, std::string_view name) {
+    if (directory == ".") {
+        return std::string(name);
+    }
+    std::string path = directory;
+    if (!path.ends_with('/')) {
+        path += '/';
+    }
+    return path.append(name);
+}
+
+// The same file, not written to or chmod'ed since before was taken
+bool unchanged(const struct stat& before, const struct stat& after) {
+    return before.st_dev == after.st_dev && before.st_ino == after.st_ino &&
+           before.st_size == after.st_size && before.st_mode == after.st_mode &&
+           before.st_mtim.tv_sec == after.st_mtim.tv_sec &&
+           before.st_mtim.tv_nsec == after.st_mtim.tv_nsec &&
+           before.st_ctim.tv_sec == after.st_ctim.tv_sec &&
+           before.st_ctim.tv_nsec == after.st_ctim.tv_nsec;
+}
+
+} // namespace
+
+OpenFileCache::File::~File() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+const OpenFileCache::Options& OpenFileCache::options() { return configuredOptions(); }
+
+void OpenFileCache::configure(const Options& options) {
+    OpenFileCache& cache = getInstance();
+    std::lock_guard lock(cache.mutex_);
+    configuredOptions() = options;
+    bool watching = cache.entries_.configure(
+        options.max_entries > 0, WATCH_EVENTS,
+        [&cache](const std::string& directory, std::string_view name) {
+            cache.changed(directory, name);
+        });
+    if (!watching) {
+        std::cerr << "Warning: open file cache can't use inotify; entries are checked every "
+                  << options.valid << "s" << std::endl;
+    }
+}
+
+OpenFileCache& OpenFileCache::getInstance() {
+    static OpenFileCache cache;
+    return cache;
+}
+
+std::shared_ptr<const OpenFileCache::File> OpenFileCache::open(const std::string& path) {
+    const Options& options = configuredOptions();
+    if (options.max_entries == 0) {
+        return lookup(path);
+    }
+
+    Entries::Clock::time_point now = Entries::Clock::now();
+    std::shared_ptr<const File> expired;
+    uint64_t generation;
+    {
+        std::lock_guard lock(mutex_);
+        if (Entries::Entry* entry = entries_.find(path)) {
+            if (now < entry->expires) {
+                Metrics::increment(Metrics::Counter::OpenFileCacheHits);
+                return entry->value;
+            }
+            expired = entry->value;
+        }
+        // Watched before looking, so a change from here on is seen. Out of
+        // watches, or no such directory: the entry is only checked when it expires
+        if (DirectoryWatcher* watcher = entries_.watcher()) {
+            watcher->watch(directory_of(path));
+        }
+        generation = entries_.generation();
+    }
+    Metrics::increment(Metrics::Counter::OpenFileCacheMisses);
+
+    // An expired file is still good if one stat() shows it unchanged
+    std::shared_ptr<const File> file;
+    if (expired && expired->found()) {
+        struct stat info;
+        if (::stat(path.c_str(), &info) == 0 && unchanged(expired->info(), info)) {
+            file = std::move(expired);
+        }
+    }
+    if (!file) {
+        file = lookup(path);
+    }
+    bool keep = file->found() || (cacheable_error(file->error()) && options.errors_valid > 0);
+
+    std::lock_guard lock(mutex_);
+    if (!keep) {
+        entries_.erase(path);
+        return file;
+    }
+    // Not kept if something changed while it was looked up; the next request looks again
+    auto expires = now + std::chrono::seconds(file->found() ? options.valid : options.errors_valid);
+    entries_.put(generation, path, file, expires, options.max_entries);
+    return file;
+}
+
+std::shared_ptr<const OpenFileCache::File> OpenFileCache::cached(const std::string& path) {
+    if (configuredOptions().max_entries == 0) {
+        return nullptr;
+    }
+    Entries::Clock::time_point now = Entries::Clock::now();
+    std::lock_guard lock(mutex_);
+    Entries::Entry* entry = entries_.find(path);
+    if (!entry || now >= entry->expires) {
+        return nullptr;
+    }
+    return entry->value;
+}
+
+void OpenFileCache::forget(const std::string& path) {
+    std::lock_guard lock(mutex_);
+    entries_.invalidate(path);
+}
+
+size_t OpenFileCache::entries() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+bool OpenFileCache::watching() const {
+    std::lock_guard lock(mutex_);
+    return entries_.watching();
+}
+
+std::shared_ptr<const OpenFileCache::File> OpenFileCache::lookup(const std::string& path) {
+    struct stat info{};
+    // Non-blocking so opening a FIFO doesn't wait for a writer
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        int error = errno;
+        // A directory that can be searched but not listed still counts as one
+        if (error == EACCES && ::stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+            return std::make_shared<const File>(-1, 0, info);
+        }
+        return std::make_shared<const File>(-1, error, info);
+    }
+    if (::fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        return std::make_shared<const File>(-1, error, info);
+    }
+    if (!S_ISREG(info.st_mode)) {
+        ::close(fd);
+        fd = -1;
+    }
+    return std::make_shared<const File>(fd, 0, info);
+}
+
+void OpenFileCache::changed(const std::string& directory, std::string_view name) {
+    std::lock_guard lock(mutex_);
+    if (directory.empty()) {
+        // Events were lost, so nothing cached can be trusted
+        entries_.invalidate_all();
+    } else if (!name.empty()) {
+        entries_.invalidate(child_of(directory, name));
+    } else {
+        // The directory itself went; its entries go and it is watched again when needed
+        entries_.invalidate_if([&directory](const Entries::Entry& entry) {
+            return directory_of(entry.key) == directory;
+        });
+    }
+}
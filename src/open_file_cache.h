@@ -0,0 +1,112 @@
+#ifndef OPEN_FILE_CACHE_H
+#define OPEN_FILE_CACHE_H
+
+#include "watched_lru.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+
+/**
+ * Open descriptors and stat() results of static files, like nginx's
+ * open_file_cache
+ *
+ * Serving a file takes a stat, an open and reading its size; with the cache
+ * those are done once per path and the descriptor is shared by every request
+ * for it (sendfile and pread take their own offsets). An entry is used for
+ * valid seconds and then checked with one stat(), keeping the descriptor if
+ * the file is unchanged. Lookups that fail with ENOENT, ENOTDIR or EACCES are
+ * remembered for errors_valid seconds.
+ *
+ * The directories of cached paths are watched with inotify, and a thread
+ * drops entries as soon as their file is changed, replaced, created or
+ * removed, so the validity window only matters where inotify can't see (out
+ * of watches, or a directory further up renamed). One instance and its lock
+ * are shared by all threads; cached files are immutable and reference-
+ * counted, so requests keep using a dropped file's descriptor until they
+ * finish.
+ */
+class OpenFileCache {
+  public:
+    struct Options {
+        size_t max_entries = 0;   // Paths kept, least recently used dropped first; 0 disables
+        size_t valid = 60;        // Seconds an entry is used before its file is stat()ed again
+        size_t errors_valid = 60; // Seconds a failed lookup is remembered; 0 to not keep them
+    };
+
+    /**
+     * What looking up a path found; immutable once made
+     */
+    class File {
+      public:
+        File(int fd, int error, const struct stat& info) : fd_(fd), error_(error), info_(info) {}
+        ~File();
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        // Open descriptor of a regular file, else -1
+        int fd() const { return fd_; }
+
+        // errno of the failed lookup, or 0
+        int error() const { return error_; }
+        bool found() const { return error_ == 0; }
+
+        bool regular() const { return found() && S_ISREG(info_.st_mode); }
+        bool directory() const { return found() && S_ISDIR(info_.st_mode); }
+        off_t size() const { return info_.st_size; }
+        const struct stat& info() const { return info_; }
+
+      private:
+        int fd_;
+        int error_;
+        struct stat info_;
+    };
+
+    static const Options& options();
+
+    /**
+     * Set the options and empty the cache, starting the inotify thread the
+     * first time it is enabled. Without inotify, entries are only checked
+     * after the validity window.
+     */
+    static void configure(const Options& options);
+
+    // The process-wide cache
+    static OpenFileCache& getInstance();
+
+    /**
+     * Look a path up, opening it if it is a regular file. Without the cache
+     * (or once it's no longer valid) this makes the syscalls, so call it on
+     * the BlockingPool.
+     */
+    std::shared_ptr<const File> open(const std::string& path);
+
+    /**
+     * What open() would return without touching the disk: the path's entry
+     * if it is cached and still valid, else nullptr
+     */
+    std::shared_ptr<const File> cached(const std::string& path);
+
+    // Drop a path's entry right away, after the server wrote or removed the file itself
+    void forget(const std::string& path);
+
+    size_t entries() const;
+
+    // Whether changes are seen through inotify
+    bool watching() const;
+
+  private:
+    using Entries = WatchedLru<std::shared_ptr<const File>>;
+
+    OpenFileCache() = default;
+
+    static std::shared_ptr<const File> lookup(const std::string& path);
+    void changed(const std::string& directory, std::string_view name);
+
+    mutable std::mutex mutex_;
+    Entries entries_; // Under mutex_, which its watcher's callback takes
+};
+
+#endif // OPEN_FILE_CACHE_H
@@ -0,0 +1,81 @@
+#include "output_chain.h"
+#include <unistd.h>
+
+void OutputChain::append(std::string_view data) {
+    if (data.empty()) {
+        return;
+    }
+    // Owned text is contiguous in owned_, so consecutive writes extend one segment
+    if (segments_.empty() || !segments_.back().owned()) {
+        segments_.push_back(Segment{owned_.size(), 0, nullptr, {}, nullptr});
+    }
+    owned_.append(data);
+    segments_.back().size += data.size();
+    memory_size_ += data.size();
+}
+
+void OutputChain::append(std::shared_ptr<const std::string> data) {
+    if (!data || data->empty()) {
+        return;
+    }
+    size_t size = data->size();
+    segments_.push_back(Segment{0, size, std::move(data), {}, nullptr});
+    memory_size_ += size;
+}
+
+void OutputChain::append_file(int fd, off_t offset, size_t count,
+                              std::shared_ptr<const void> owner) {
+    segments_.push_back(Segment{0, 0, nullptr, FileRange{fd, offset, count}, std::move(owner)});
+    file_size_ += count;
+}
+
+const OutputChain::FileRange& OutputChain::file() const {
+    static const FileRange none;
+    for (const Segment& segment : segments_) {
+        if (segment.file.fd >= 0) {
+            return segment.file;
+        }
+    }
+    return none;
+}
+
+size_t OutputChain::gather(size_t index, std::vector<boost::asio::const_buffer>& buffers) const {
+    for (; index < segments_.size() && segments_[index].file.fd < 0; ++index) {
+        const Segment& segment = segments_[index];
+        const char* data = segment.shared ? segment.shared->data() : owned_.data() + segment.offset;
+        buffers.emplace_back(data, segment.size);
+    }
+    return index;
+}
+
+const OutputChain::FileRange* OutputChain::file_at(size_t index) const {
+    if (index >= segments_.size() || segments_[index].file.fd < 0) {
+        return nullptr;
+    }
+    return &segments_[index].file;
+}
+
+std::string OutputChain::str() const {
+    std::string text;
+    text.reserve(memory_size_);
+    for (const Segment& segment : segments_) {
+        if (segment.shared) {
+            text += *segment.shared;
+        } else if (segment.file.fd < 0) {
+            text.append(owned_, segment.offset, segment.size);
+        }
+    }
+    return text;
+}
+
+void OutputChain::clear() {
+    for (const Segment& segment : segments_) {
+        if (segment.file.fd >= 0 && !segment.owner) {
+            ::close(segment.file.fd);
+        }
+    }
+    segments_.clear();
+    owned_.clear();
+    memory_size_ = 0;
+    file_size_ = 0;
+}
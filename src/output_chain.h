@@ -0,0 +1,92 @@
+#ifndef OUTPUT_CHAIN_H
+#define OUTPUT_CHAIN_H
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * A response as the segments it is sent from, in the order they were written
+ *
+ * Small writes (status line, header fields, generated bodies) are copied into
+ * one owned buffer, whose capacity is kept across requests. Bodies that
+ * already live in memory elsewhere, such as a file read once into a
+ * refcounted buffer, are referenced instead of copied in, and file ranges are
+ * left on disk for the connection to sendfile(). Each run of memory segments
+ * goes out with one gather write.
+ */
+class OutputChain {
+  public:
+    // Part of a file; the chain owns the descriptor
+    struct FileRange {
+        int fd = -1;
+        off_t offset = 0;
+        size_t count = 0;
+    };
+
+    OutputChain() = default;
+    ~OutputChain() { clear(); }
+    OutputChain(const OutputChain&) = delete;
+    OutputChain& operator=(const OutputChain&) = delete;
+
+    // Copy data into the owned buffer
+    void append(std::string_view data);
+
+    // Send data without copying it, keeping it alive until clear()
+    void append(std::shared_ptr<const std::string> data);
+
+    // Send count bytes of fd from offset, taking ownership of fd unless owner keeps it open
+    void append_file(int fd, off_t offset, size_t count,
+                     std::shared_ptr<const void> owner = nullptr);
+
+    bool empty() const { return segments_.empty(); }
+    size_t segments() const { return segments_.size(); }
+
+    // Bytes sent from memory (owned and shared) and from files
+    size_t memory_size() const { return memory_size_; }
+    size_t file_size() const { return file_size_; }
+
+    // The first file range, or one with no descriptor
+    const FileRange& file() const;
+
+    /**
+     * Add the memory segments from index up to the next file range (or the
+     * end) to buffers, for one gather write
+     * @return Index of the segment after them
+     */
+    size_t gather(size_t index, std::vector<boost::asio::const_buffer>& buffers) const;
+
+    // The file range at index, if that segment is one
+    const FileRange* file_at(size_t index) const;
+
+    // The memory segments copied into one string (for tests, and consumers needing it whole)
+    std::string str() const;
+
+    // Drop every segment, closing files, and keep the owned buffer's capacity
+    void clear();
+
+    // The owned buffer, so an empty chain's capacity can be swapped with a pooled buffer
+    std::string& owned() { return owned_; }
+
+  private:
+    struct Segment {
+        size_t offset = 0; // Into owned_, for owned segments
+        size_t size = 0;
+        std::shared_ptr<const std::string> shared;
+        FileRange file;
+        std::shared_ptr<const void> owner; // Of file.fd, when the chain doesn't close it
+
+        bool owned() const { return !shared && file.fd < 0; }
+    };
+
+    std::string owned_;
+    std::vector<Segment> segments_;
+    size_t memory_size_ = 0;
+    size_t file_size_ = 0;
+};
+
+#endif // OUTPUT_CHAIN_H
@@ -0,0 +1,246 @@
+#include "path_rules.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+unsigned char fold(unsigned char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; }
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) { return fold(x) == fold(y); });
+}
+
+std::string_view trim(std::string_view str) {
+    size_t start = str.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    return str.substr(start, str.find_last_not_of(" \t\r") - start + 1);
+}
+
+} // namespace
+
+void PathRules::Trie::insert(std::string_view key, int32_t rule) {
+    uint32_t node = 0;
+    for (unsigned char c : key) {
+        auto& children = nodes[node].children;
+        auto it = std::ranges::lower_bound(children, c, {}, &Child::first);
+        if (it != children.end() && it->first == c) {
+            node = it->second;
+            continue;
+        }
+        uint32_t added = static_cast<uint32_t>(nodes.size());
+        children.insert(it, {c, added});
+        nodes.emplace_back(); // After the insert: it moves the children
+        node = added;
+    }
+    // Where two rules share a pattern the first is reported
+    if (nodes[node].rule == NO_RULE) {
+        nodes[node].rule = rule;
+    }
+}
+
+uint32_t PathRules::Trie::child(uint32_t node, unsigned char c) const {
+    const auto& children = nodes[node].children;
+    auto it = std::ranges::lower_bound(children, c, {}, &Child::first);
+    return it != children.end() && it->first == c ? it->second : 0;
+}
+
+PathRules::PathRules(std::vector<Rule> rules, bool scan_query, std::vector<std::string> headers)
+    : rules_(std::move(rules)), scan_query_(scan_query), headers_(std::move(headers)) {
+    for (size_t i = 0; i < rules_.size(); ++i) {
+        Rule& rule = rules_[i];
+        if (rule.pattern.empty()) {
+            throw std::runtime_error("Path rule " + std::to_string(i + 1) + " has no pattern");
+        }
+        switch (rule.kind) {
+        case Kind::Prefix:
+            prefixes_.insert(rule.pattern, static_cast<int32_t>(i));
+            break;
+        case Kind::Extension: {
+            if (rule.pattern.front() != '.') {
+                rule.pattern.insert(0, 1, '.');
+            }
+            std::string reversed(rule.pattern.rbegin(), rule.pattern.rend());
+            std::ranges::transform(reversed, reversed.begin(), fold);
+            extensions_.insert(reversed, static_cast<int32_t>(i));
+            break;
+        }
+        case Kind::Substring:
+            break;
+        }
+    }
+    compile_substrings();
+}
+
+void PathRules::compile_substrings() {
+    // Only bytes some pattern has get a class of their own, a letter sharing
+    // its lower case one, which keeps the transition table narrow
+    for (const Rule& rule : rules_) {
+        if (rule.kind != Kind::Substring) {
+            continue;
+        }
+        for (unsigned char c : rule.pattern) {
+            if (byte_class_[fold(c)] == 0) {
+                byte_class_[fold(c)] = static_cast<uint8_t>(class_count_++);
+            }
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; ++c) {
+        byte_class_[c] = byte_class_[fold(c)];
+    }
+
+    // The trie of patterns, with 0 for the transitions it lacks (the root is
+    // never a child)
+    next_.assign(class_count_, 0);
+    output_.assign(1, NO_RULE);
+    for (size_t i = 0; i < rules_.size(); ++i) {
+        if (rules_[i].kind != Kind::Substring) {
+            continue;
+        }
+        uint32_t state = 0;
+        for (unsigned char c : rules_[i].pattern) {
+            size_t transition = state * class_count_ + byte_class_[c];
+            if (next_[transition] == 0) {
+                next_[transition] = static_cast<uint32_t>(output_.size());
+                next_.resize(next_.size() + class_count_, 0);
+                output_.push_back(NO_RULE);
+            }
+            state = next_[transition];
+        }
+        if (output_[state] == NO_RULE) {
+            output_[state] = static_cast<int32_t>(i);
+        }
+    }
+
+    // Breadth first, each state's failure state is shallower and complete:
+    // missing transitions take the failure state's, and a state reports the
+    // rule its longest suffix that ends one does
+    std::vector<uint32_t> failure(output_.size(), 0);
+    std::vector<uint32_t> queue;
+    for (size_t c = 0; c < class_count_; ++c) {
+        if (next_[c] != 0) {
+            queue.push_back(next_[c]);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+        uint32_t state = queue[head];
+        if (output_[state] == NO_RULE) {
+            output_[state] = output_[failure[state]];
+        }
+        for (size_t c = 0; c < class_count_; ++c) {
+            uint32_t& target = next_[state * class_count_ + c];
+            uint32_t fallback = next_[failure[state] * class_count_ + c];
+            if (target == 0) {
+                target = fallback;
+            } else {
+                failure[target] = fallback;
+                queue.push_back(target);
+            }
+        }
+    }
+}
+
+int32_t PathRules::find_substring(std::string_view text) const {
+    if (output_.size() == 1) {
+        return NO_RULE;
+    }
+    uint32_t state = 0;
+    for (unsigned char c : text) {
+        state = next_[state * class_count_ + byte_class_[c]];
+        if (output_[state] != NO_RULE) {
+            return output_[state];
+        }
+    }
+    return NO_RULE;
+}
+
+PathRules PathRules::parse(std::string_view text) {
+    std::vector<Rule> rules;
+    bool scan_query = false;
+    std::vector<std::string> headers;
+    for (size_t number = 1; !text.empty(); ++number) {
+        size_t end = text.find('\n');
+        std::string_view line = trim(text.substr(0, end));
+        text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+
+        size_t space = line.find_first_of(" \t");
+        std::string_view directive = line.substr(0, space);
+        std::string_view argument =
+            space == std::string_view::npos ? std::string_view() : trim(line.substr(space));
+        if (directive == "query" && argument.empty()) {
+            scan_query = true;
+        } else if (directive == "header" && !argument.empty()) {
+            headers.emplace_back(argument);
+        } else if (directive == "prefix" && !argument.empty()) {
+            rules.push_back({Kind::Prefix, std::string(argument)});
+        } else if (directive == "substring" && !argument.empty()) {
+            rules.push_back({Kind::Substring, std::string(argument)});
+        } else if (directive == "extension" && !argument.empty()) {
+            rules.push_back({Kind::Extension, std::string(argument)});
+        } else {
+            throw std::runtime_error("Path rules line " + std::to_string(number) + ": " +
+                                     std::string(line));
+        }
+    }
+    return PathRules(std::move(rules), scan_query, std::move(headers));
+}
+
+std::shared_ptr<const PathRules> PathRules::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.good()) {
+        throw std::runtime_error("Path rules file not found: " + filename);
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return std::make_shared<const PathRules>(parse(text));
+}
+
+const PathRules::Rule* PathRules::match(std::string_view path, std::string_view query,
+                                        const std::map<std::string, std::string>* headers) const {
+    uint32_t node = 0;
+    for (unsigned char c : path) {
+        node = prefixes_.child(node, c);
+        if (node == 0) {
+            break;
+        }
+        if (prefixes_.nodes[node].rule != NO_RULE) {
+            return &rules_[prefixes_.nodes[node].rule];
+        }
+    }
+
+    // The last segment, backwards
+    node = 0;
+    for (size_t i = path.size(); i > 0 && path[i - 1] != '/'; --i) {
+        node = extensions_.child(node, fold(path[i - 1]));
+        if (node == 0) {
+            break;
+        }
+        if (extensions_.nodes[node].rule != NO_RULE) {
+            return &rules_[extensions_.nodes[node].rule];
+        }
+    }
+
+    int32_t rule = find_substring(path);
+    if (rule == NO_RULE && scan_query_) {
+        rule = find_substring(query);
+    }
+    if (rule == NO_RULE && headers && !headers_.empty()) {
+        for (const auto& [name, value] : *headers) {
+            bool scanned = std::ranges::any_of(headers_, [&name](const std::string& header) {
+                return equals_ignore_case(name, header);
+            });
+            if (scanned) {
+                rule = find_substring(value);
+                if (rule != NO_RULE) {
+                    break;
+                }
+            }
+        }
+    }
+    return rule == NO_RULE ? nullptr : &rules_[rule];
+}
@@ -0,0 +1,108 @@
+#ifndef PATH_RULES_H
+#define PATH_RULES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Blocklist rules compiled to be matched in one pass, whatever their number
+ *
+ * A prefix rule matches paths starting with its pattern, exactly as written.
+ * An extension rule matches paths whose last segment ends with it, and a
+ * substring rule paths containing it anywhere; both ignore ASCII case, as
+ * scanners vary it. Substring rules can also be run over the query and the
+ * values of chosen headers.
+ *
+ * Prefixes go in a trie walked along the path, extensions in one walked
+ * backwards from its end, and substrings in an Aho-Corasick automaton with a
+ * transition for every byte class, so a lookup costs time in the length of
+ * what is scanned, not the number of rules. A compiled set is never changed;
+ * new rules are compiled into a new set that replaces it.
+ */
+class PathRules {
+  public:
+    enum class Kind : uint8_t { Prefix, Substring, Extension };
+
+    struct Rule {
+        Kind kind;
+        std::string pattern;
+    };
+
+    // Matches nothing
+    PathRules() = default;
+
+    /**
+     * @param scan_query Also match substring rules against the query
+     * @param headers Headers whose values substring rules are matched against
+     * @throws std::runtime_error for an empty pattern
+     */
+    explicit PathRules(std::vector<Rule> rules, bool scan_query = false,
+                       std::vector<std::string> headers = {});
+
+    /**
+     * Compile rules written one to a line: "prefix /wp-admin", "substring
+     * ../", "extension .bak"; "query" scans the query and "header NAME" that
+     * header too. Blank lines and lines starting with '#' are skipped.
+     * @throws std::runtime_error naming the line of anything else
+     */
+    static PathRules parse(std::string_view text);
+
+    /**
+     * Read and compile a rules file
+     * @throws std::runtime_error if it can't be read or doesn't parse
+     */
+    static std::shared_ptr<const PathRules> load(const std::string& filename);
+
+    /**
+     * The rule a request matches, or nullptr if none does
+     * @param path Decoded request path, without the query
+     * @param query Decoded query, scanned if the rules ask for it
+     * @param headers Request headers, those the rules name scanned
+     */
+    const Rule* match(std::string_view path, std::string_view query = {},
+                      const std::map<std::string, std::string>* headers = nullptr) const;
+
+    const std::vector<Rule>& rules() const { return rules_; }
+
+  private:
+    static constexpr int32_t NO_RULE = -1;
+
+    // A byte trie with sorted children, small for the sparse nodes most have
+    struct Trie {
+        using Child = std::pair<unsigned char, uint32_t>;
+
+        struct Node {
+            std::vector<Child> children; // By byte
+            int32_t rule = NO_RULE;
+        };
+
+        std::vector<Node> nodes{Node{}};
+
+        void insert(std::string_view key, int32_t rule);
+        uint32_t child(uint32_t node, unsigned char c) const; // 0 if there is none
+    };
+
+    void compile_substrings();
+    int32_t find_substring(std::string_view text) const;
+
+    std::vector<Rule> rules_;
+    bool scan_query_ = false;
+    std::vector<std::string> headers_;
+    Trie prefixes_;
+    Trie extensions_; // Reversed, folded to lower case
+
+    // Aho-Corasick automaton: next_[state * class_count_ + byte_class_[c]]
+    std::array<uint8_t, 256> byte_class_{}; // 0 for bytes in no pattern
+    size_t class_count_ = 1;
+    std::vector<uint32_t> next_{0};
+    std::vector<int32_t> output_{NO_RULE}; // A rule ending at each state, through its suffixes
+};
+
+#endif // PATH_RULES_H
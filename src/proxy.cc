@@ -0,0 +1,494 @@
+#include "proxy.h"
+#include "body_framing.h"
+#include "conditional_request.h"
+#include "metrics.h"
+#include <algorithm>
+#include <boost/asio/io_context.hpp>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+#include <format>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Points each server gets on the consistent hash ring
+constexpr size_t RING_POINTS = 160;
+
+Proxy::Options& configuredOptions() {
+    static Proxy::Options options;
+    return options;
+}
+
+std::vector<std::unique_ptr<Proxy::Group>>& configuredGroups() {
+    static std::vector<std::unique_ptr<Proxy::Group>> groups;
+    return groups;
+}
+
+int64_t ticks(Clock::time_point time) { return time.time_since_epoch().count(); }
+
+int64_t ticks(std::chrono::seconds duration) {
+    return std::chrono::duration_cast<Clock::duration>(duration).count();
+}
+
+// FNV-1a, finished with the splitmix64 mixer so nearby keys spread over the ring
+uint64_t hash(std::string_view key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+std::string_view trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// Whether a comma-separated field value lists token
+bool has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        if (iequals(trim(value.substr(0, comma)), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+/**
+ * Fields describing one connection rather than the message, which a proxy
+ * must not forward: the fixed set plus any the Connection field names
+ */
+bool hop_by_hop(std::string_view name, const std::vector<Proxy::Header>& headers) {
+    static constexpr std::string_view fixed[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Transfer-Encoding",
+        "Upgrade",    "Content-Length"}; // Framing is rewritten
+    if (std::ranges::any_of(fixed, [&](std::string_view hop) { return iequals(name, hop); })) {
+        return true;
+    }
+    return std::ranges::any_of(headers, [&](const Proxy::Header& header) {
+        return iequals(header.first, "Connection") && has_token(header.second, name);
+    });
+}
+
+/**
+ * Split header lines into fields and work out the body framing they declare
+ * @return False if a line is malformed or the framing is ambiguous
+ */
+bool parse_fields(std::string_view block, std::vector<Proxy::Header>& headers,
+                  std::optional<size_t>& content_length, bool& chunked,
+                  std::string_view& connection) {
+    BodyFraming framing;
+    while (!block.empty()) {
+        size_t newline = block.find('\n');
+        std::string_view line = block.substr(0, newline);
+        block.remove_prefix(newline == std::string_view::npos ? block.size() : newline + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            break;
+        }
+
+        // No whitespace before the colon, and no obsolete line folding
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0 || line[0] == ' ' || line[0] == '\t' ||
+            line.substr(0, colon).find_first_of(" \t") != std::string_view::npos) {
+            return false;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = trim(line.substr(colon + 1));
+        headers.emplace_back(name, value);
+
+        if (!framing.add(name, value)) {
+            return false;
+        }
+        if (iequals(name, "Connection")) {
+            connection = value;
+        }
+    }
+    content_length = framing.content_length();
+    chunked = framing.chunked();
+    return true;
+}
+
+// The head up to its blank line, split into the start line and the fields
+std::pair<std::string_view, std::string_view> split_head(std::string_view head) {
+    size_t newline = head.find('\n');
+    if (newline == std::string_view::npos) {
+        return {head, {}};
+    }
+    std::string_view line = head.substr(0, newline);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    return {line, head.substr(newline + 1)};
+}
+
+std::string_view reason_phrase(int status) {
+    switch (status) {
+    case 400:
+        return "Bad Request";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    case 504:
+        return "Gateway Timeout";
+    default:
+        return "Error";
+    }
+}
+
+// Split "host:port" or "[v6 address]:port"
+std::optional<std::pair<std::string, std::string>> split_host_port(std::string_view upstream) {
+    size_t colon = upstream.rfind(':');
+    if (colon == std::string_view::npos || colon == 0 || colon + 1 == upstream.size()) {
+        return std::nullopt;
+    }
+    std::string_view host = upstream.substr(0, colon);
+    if (host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    return std::make_pair(std::string(host), std::string(upstream.substr(colon + 1)));
+}
+
+} // namespace
+
+// ============================================================================
+// Server and Group
+// ============================================================================
+
+bool Proxy::Server::available(Clock::time_point now) const {
+    return down_until_.load(std::memory_order_relaxed) <= ticks(now);
+}
+
+Proxy::Group::Group(std::string prefix, std::vector<std::unique_ptr<Server>> servers,
+                    Balance balance)
+    : prefix_(std::move(prefix)), servers_(std::move(servers)), balance_(balance) {
+    if (balance_ == Balance::ConsistentHash) {
+        for (size_t index = 0; index < servers_.size(); ++index) {
+            for (size_t point = 0; point < RING_POINTS; ++point) {
+                ring_.emplace_back(hash(std::format("{}#{}", servers_[index]->name(), point)),
+                                   index);
+            }
+        }
+        std::ranges::sort(ring_);
+    }
+}
+
+bool Proxy::Group::eligible(size_t index, const std::vector<bool>& tried,
+                            Clock::time_point now) const {
+    return !tried[index] && (servers_.size() == 1 || servers_[index]->available(now));
+}
+
+std::optional<size_t> Proxy::Group::pick(std::string_view key, const std::vector<bool>& tried) {
+    auto now = Clock::now();
+    size_t count = servers_.size();
+    switch (balance_) {
+    case Balance::RoundRobin: {
+        size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i) {
+            if (eligible((start + i) % count, tried, now)) {
+                return (start + i) % count;
+            }
+        }
+        break;
+    }
+    case Balance::LeastConnections: {
+        // Ties go round-robin so idle servers share the load
+        size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+        std::optional<size_t> best;
+        for (size_t i = 0; i < count; ++i) {
+            size_t index = (start + i) % count;
+            if (eligible(index, tried, now) &&
+                (!best || servers_[index]->active() < servers_[*best]->active())) {
+                best = index;
+            }
+        }
+        return best;
+    }
+    case Balance::ConsistentHash: {
+        // The first eligible server clockwise from the key's point
+        auto it = std::ranges::lower_bound(ring_, std::make_pair(hash(key), size_t{0}));
+        size_t start = static_cast<size_t>(it - ring_.begin());
+        for (size_t i = 0; i < ring_.size(); ++i) {
+            size_t index = ring_[(start + i) % ring_.size()].second;
+            if (eligible(index, tried, now)) {
+                return index;
+            }
+        }
+        break;
+    }
+    }
+    return std::nullopt;
+}
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+const Proxy::Options& Proxy::options() { return configuredOptions(); }
+
+std::optional<std::string> Proxy::configure(const Options& options) {
+    std::vector<std::unique_ptr<Group>> groups;
+    asio::io_context io;
+    tcp::resolver resolver(io);
+    for (const Route& route : options.routes) {
+        std::vector<std::unique_ptr<Server>> servers;
+        for (const std::string& upstream : route.upstreams) {
+            auto host_port = split_host_port(upstream);
+            if (!host_port) {
+                return "proxy upstream " + upstream + " is not HOST:PORT";
+            }
+            boost::system::error_code ec;
+            auto results = resolver.resolve(host_port->first, host_port->second, ec);
+            if (ec || results.empty()) {
+                return "can't resolve proxy upstream " + upstream + ": " + ec.message();
+            }
+            std::vector<tcp::endpoint> endpoints;
+            for (const auto& result : results) {
+                endpoints.push_back(result.endpoint());
+            }
+            servers.push_back(std::make_unique<Server>(upstream, std::move(endpoints)));
+        }
+        if (servers.empty()) {
+            return "proxy route " + route.prefix + " has no upstreams";
+        }
+        groups.push_back(
+            std::make_unique<Group>(route.prefix, std::move(servers), options.balance));
+    }
+
+    // Longest prefix first, so the first match is the best
+    std::ranges::stable_sort(groups, std::ranges::greater{},
+                             [](const auto& group) { return group->prefix().size(); });
+    configuredOptions() = options;
+    configuredGroups() = std::move(groups);
+    return std::nullopt;
+}
+
+std::optional<Proxy::Route> Proxy::parse_route(std::string_view spec) {
+    size_t equals = spec.find('=');
+    if (equals == std::string_view::npos || !spec.starts_with('/')) {
+        return std::nullopt;
+    }
+    Route route{.prefix = std::string(spec.substr(0, equals)), .upstreams = {}};
+    std::string_view upstreams = spec.substr(equals + 1);
+    while (!upstreams.empty()) {
+        size_t comma = upstreams.find(',');
+        std::string_view upstream = upstreams.substr(0, comma);
+        if (!upstream.empty()) {
+            if (!split_host_port(upstream)) {
+                return std::nullopt;
+            }
+            route.upstreams.emplace_back(upstream);
+        }
+        upstreams.remove_prefix(comma == std::string_view::npos ? upstreams.size() : comma + 1);
+    }
+    if (route.upstreams.empty()) {
+        return std::nullopt;
+    }
+    return route;
+}
+
+Proxy::Group* Proxy::match(std::string_view target) {
+    for (const auto& group : configuredGroups()) {
+        if (target.starts_with(group->prefix())) {
+            return group.get();
+        }
+    }
+    return nullptr;
+}
+
+Proxy::Group* Proxy::match_request(std::string_view head) {
+    if (configuredGroups().empty()) {
+        return nullptr;
+    }
+    size_t start = head.find(' ');
+    if (start == std::string_view::npos) {
+        return nullptr;
+    }
+    std::string_view target = head.substr(start + 1);
+    return match(target.substr(0, target.find_first_of(" \r\n")));
+}
+
+// ============================================================================
+// Passive health checks
+// ============================================================================
+
+bool Proxy::report_failure(Server& server, bool alone) {
+    const Options& options = configuredOptions();
+    if (alone || options.max_fails == 0) {
+        return false;
+    }
+    int64_t now = ticks(Clock::now());
+    int64_t window = ticks(std::chrono::seconds(options.fail_timeout));
+
+    // Failures only count together within fail_timeout of the first
+    if (now - server.fail_window_start_.load(std::memory_order_relaxed) > window) {
+        server.fail_window_start_.store(now, std::memory_order_relaxed);
+        server.fails_.store(0, std::memory_order_relaxed);
+    }
+    if (server.fails_.fetch_add(1, std::memory_order_relaxed) + 1 < options.max_fails) {
+        return false;
+    }
+    server.fails_.store(0, std::memory_order_relaxed);
+    server.down_until_.store(now + window, std::memory_order_relaxed);
+    Metrics::increment(Metrics::Counter::ProxyServersMarkedDown);
+    return true;
+}
+
+void Proxy::report_success(Server& server) {
+    if (server.fails_.load(std::memory_order_relaxed) != 0) {
+        server.fails_.store(0, std::memory_order_relaxed);
+    }
+}
+
+// ============================================================================
+// Message heads
+// ============================================================================
+
+std::optional<Proxy::Request> Proxy::parse_request(std::string_view head) {
+    auto [line, fields] = split_head(head);
+    Request request;
+    size_t first = line.find(' ');
+    size_t second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+    if (second == std::string_view::npos || first == 0 || second == first + 1) {
+        return std::nullopt;
+    }
+    request.method = line.substr(0, first);
+    request.target = line.substr(first + 1, second - first - 1);
+    request.version = line.substr(second + 1);
+    if (request.version != "HTTP/1.1" && request.version != "HTTP/1.0") {
+        return std::nullopt;
+    }
+
+    std::string_view connection;
+    if (!parse_fields(fields, request.headers, request.content_length, request.chunked,
+                      connection)) {
+        return std::nullopt;
+    }
+    request.keep_alive = request.version == "HTTP/1.1" ? !has_token(connection, "close")
+                                                       : has_token(connection, "keep-alive");
+    // HTTP/1.0 clients don't understand interim responses
+    request.expect_continue =
+        request.version == "HTTP/1.1" &&
+        std::ranges::any_of(request.headers, [](const Header& header) {
+            return iequals(header.first, "Expect") && iequals(header.second, "100-continue");
+        });
+    return request;
+}
+
+std::optional<Proxy::Response> Proxy::parse_response(std::string_view head) {
+    auto [line, fields] = split_head(head);
+    Response response;
+    if (line.size() < 12 || !line.starts_with("HTTP/1.") || line[8] != ' ') {
+        return std::nullopt;
+    }
+    auto [ptr, ec] = std::from_chars(line.data() + 9, line.data() + 12, response.status);
+    if (ec != std::errc() || ptr != line.data() + 12 || response.status < 100) {
+        return std::nullopt;
+    }
+    response.reason = line.size() > 13 ? line.substr(13) : std::string_view();
+
+    std::string_view connection;
+    if (!parse_fields(fields, response.headers, response.content_length, response.chunked,
+                      connection)) {
+        return std::nullopt;
+    }
+    response.keep_alive = line.starts_with("HTTP/1.1") ? !has_token(connection, "close")
+                                                       : has_token(connection, "keep-alive");
+    return response;
+}
+
+std::string Proxy::upstream_head(const Request& request, std::string_view client_address,
+                                 bool tls, const Server& server) {
+    std::string out;
+    out.reserve(512);
+    out += request.method;
+    out += ' ';
+    out += request.target;
+    out += " HTTP/1.1\r\n";
+
+    bool has_host = false;
+    std::string forwarded_for;
+    for (const auto& [name, value] : request.headers) {
+        if (hop_by_hop(name, request.headers) || iequals(name, "Expect") ||
+            iequals(name, "X-Forwarded-Proto")) {
+            continue;
+        }
+        if (iequals(name, "X-Forwarded-For")) {
+            forwarded_for += value;
+            forwarded_for += ", ";
+            continue;
+        }
+        has_host = has_host || iequals(name, "Host");
+        out += name;
+        out += ": ";
+        out += value;
+        out += "\r\n";
+    }
+    if (!has_host) {
+        out += "Host: " + server.name() + "\r\n";
+    }
+    out += std::format("X-Forwarded-For: {}{}\r\n", forwarded_for, client_address);
+    out += tls ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n";
+    if (request.chunked) {
+        out += "Transfer-Encoding: chunked\r\n";
+    } else if (request.content_length) {
+        out += std::format("Content-Length: {}\r\n", *request.content_length);
+    }
+    out += "\r\n";
+    return out;
+}
+
+std::string Proxy::client_head(const Response& response, bool chunked, bool keep_alive) {
+    std::string out = std::format("HTTP/1.1 {} {}\r\n", response.status, response.reason);
+    for (const auto& [name, value] : response.headers) {
+        if (hop_by_hop(name, response.headers)) {
+            continue;
+        }
+        out += name;
+        out += ": ";
+        out += value;
+        out += "\r\n";
+    }
+    if (chunked) {
+        out += "Transfer-Encoding: chunked\r\n";
+    } else if (response.content_length) {
+        out += std::format("Content-Length: {}\r\n", *response.content_length);
+    }
+    out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return out;
+}
+
+std::string Proxy::error_response(int status, bool keep_alive) {
+    std::string body =
+        std::format("<html><body><h1>{} {}</h1></body></html>", status, reason_phrase(status));
+    return std::format("HTTP/1.1 {} {}\r\nDate: {}\r\nServer: SHELOB/0.5 (Unix)\r\n"
+                       "Content-Type: text/html\r\nContent-Length: {}\r\nConnection: {}\r\n\r\n{}",
+                       status, reason_phrase(status),
+                       ConditionalRequest::formatHttpDate(time(nullptr)), body.size(),
+                       keep_alive ? "keep-alive" : "close", body);
+}
@@ -0,0 +1,198 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <atomic>
+#include <boost/asio/ip/tcp.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Reverse proxy routes, upstream groups and HTTP/1.1 message rewriting
+ *
+ * Requests whose path starts with a configured prefix are forwarded to one of
+ * that route's upstream servers instead of being served from htdocs. The
+ * connection driver does the forwarding (see AsioConnectionDriver) and each
+ * thread keeps its own idle keep-alive connections (ProxyPool); this class
+ * picks the server and rewrites the heads.
+ *
+ * Health checking is passive: max_fails connection or response failures on a
+ * server within fail_timeout take it out of rotation for fail_timeout, unless
+ * it is the only server of its group. Failure counts, the down marks and the
+ * in-flight counts least-connections balances on are shared by all threads.
+ */
+class Proxy {
+  public:
+    enum class Balance { RoundRobin, LeastConnections, ConsistentHash };
+
+    struct Route {
+        std::string prefix;                 // Request paths forwarded, e.g. "/api/"
+        std::vector<std::string> upstreams; // "host:port" of each server
+    };
+
+    struct Options {
+        std::vector<Route> routes;
+        Balance balance = Balance::RoundRobin;
+        size_t idle_connections = 32; // Kept open per server and thread
+        size_t timeout = 60;          // Seconds to connect or wait for upstream data
+        size_t max_fails = 3;
+        size_t fail_timeout = 10; // Seconds
+    };
+
+    /**
+     * One upstream server and its health, shared by all threads
+     */
+    class Server {
+      public:
+        Server(std::string name, std::vector<boost::asio::ip::tcp::endpoint> endpoints)
+            : name_(std::move(name)), endpoints_(std::move(endpoints)) {}
+
+        const std::string& name() const { return name_; }
+        const std::vector<boost::asio::ip::tcp::endpoint>& endpoints() const {
+            return endpoints_;
+        }
+
+        // Not marked down by failures
+        bool available(std::chrono::steady_clock::time_point now) const;
+
+        // Requests in flight on it, from all threads
+        size_t active() const { return active_.load(std::memory_order_relaxed); }
+
+      private:
+        friend class Proxy;
+
+        std::string name_;
+        std::vector<boost::asio::ip::tcp::endpoint> endpoints_;
+        std::atomic<size_t> active_ = 0;
+        std::atomic<size_t> fails_ = 0;
+        std::atomic<int64_t> fail_window_start_ = 0; // steady_clock ticks
+        std::atomic<int64_t> down_until_ = 0;
+    };
+
+    /**
+     * A route's servers and how requests are spread over them
+     */
+    class Group {
+      public:
+        Group(std::string prefix, std::vector<std::unique_ptr<Server>> servers, Balance balance);
+
+        const std::string& prefix() const { return prefix_; }
+        size_t size() const { return servers_.size(); }
+        Server& server(size_t index) const { return *servers_[index]; }
+
+        /**
+         * Choose a server for a request
+         * @param key What consistent hashing hashes (the request target)
+         * @param tried Servers already tried for this request, by index
+         * @return Index of the server, or nothing if every untried one is down
+         */
+        std::optional<size_t> pick(std::string_view key, const std::vector<bool>& tried);
+
+      private:
+        bool eligible(size_t index, const std::vector<bool>& tried,
+                      std::chrono::steady_clock::time_point now) const;
+
+        std::string prefix_;
+        std::vector<std::unique_ptr<Server>> servers_;
+        Balance balance_;
+        std::vector<std::pair<uint64_t, size_t>> ring_; // Hash point -> server, sorted
+        std::atomic<size_t> next_ = 0;                  // Round-robin position
+    };
+
+    static const Options& options();
+
+    /**
+     * Set the routes, resolving every upstream
+     * @return An error message if an upstream can't be parsed or resolved
+     */
+    static std::optional<std::string> configure(const Options& options);
+
+    /**
+     * Parse a --proxy argument: PREFIX=HOST:PORT[,HOST:PORT...]
+     */
+    static std::optional<Route> parse_route(std::string_view spec);
+
+    // Group with the longest prefix matching a request target, if any
+    static Group* match(std::string_view target);
+
+    /**
+     * Whether a request head's target is proxied, judged from the request line
+     * alone so the body can be left unread
+     */
+    static Group* match_request(std::string_view head);
+
+    // Count a request starting or finishing on a server
+    static void begin(Server& server) { server.active_.fetch_add(1, std::memory_order_relaxed); }
+    static void end(Server& server) { server.active_.fetch_sub(1, std::memory_order_relaxed); }
+
+    /**
+     * Report a failed or successful exchange for passive health checking
+     * @param alone The server is its group's only one and is never marked down
+     * @return True if the failure took the server out of rotation
+     */
+    static bool report_failure(Server& server, bool alone);
+    static void report_success(Server& server);
+
+    // One header field, as it appeared in the message
+    using Header = std::pair<std::string_view, std::string_view>;
+
+    /**
+     * A request head as the client sent it
+     */
+    struct Request {
+        std::string_view method;
+        std::string_view target;
+        std::string_view version;
+        std::vector<Header> headers;
+        std::optional<size_t> content_length;
+        bool chunked = false;
+        bool keep_alive = false; // By version and Connection
+        bool expect_continue = false;
+    };
+
+    /**
+     * A response head as the upstream sent it
+     */
+    struct Response {
+        int status = 0;
+        std::string_view reason;
+        std::vector<Header> headers;
+        std::optional<size_t> content_length;
+        bool chunked = false;
+        bool keep_alive = false;
+    };
+
+    /**
+     * Parse a request head (through the blank line)
+     * @return Nothing if malformed, or if its body framing is ambiguous
+     *         (Content-Length with Transfer-Encoding, or a coding besides chunked)
+     */
+    static std::optional<Request> parse_request(std::string_view head);
+
+    // Same for a response head
+    static std::optional<Response> parse_response(std::string_view head);
+
+    /**
+     * Head to send upstream: HTTP/1.1, without hop-by-hop fields, with
+     * X-Forwarded-For and X-Forwarded-Proto added
+     */
+    static std::string upstream_head(const Request& request, std::string_view client_address,
+                                     bool tls, const Server& server);
+
+    /**
+     * Head to send the client, without hop-by-hop fields
+     * @param chunked The body is sent chunked
+     */
+    static std::string client_head(const Response& response, bool chunked, bool keep_alive);
+
+    // A small error page, such as 502 when no upstream answered
+    static std::string error_response(int status, bool keep_alive);
+};
+
+#endif // PROXY_H
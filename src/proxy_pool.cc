@@ -0,0 +1,65 @@
+#include "proxy_pool.h"
+#include "metrics.h"
+#include <array>
+
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Still open with nothing to read: a closed connection reads EOF, and a
+// response nobody asked for means the connection can't be trusted
+bool still_open(tcp::socket& socket) {
+    boost::system::error_code ec;
+    socket.non_blocking(true, ec);
+    std::array<char, 1> byte;
+    socket.receive(asio::buffer(byte), tcp::socket::message_peek, ec);
+    return ec == asio::error::would_block;
+}
+
+} // namespace
+
+asio::execution_context::id ProxyPool::id;
+
+ProxyPool::ProxyPool(asio::execution_context& context)
+    : asio::execution_context::service(context) {}
+
+std::optional<tcp::socket> ProxyPool::take(const Proxy::Server& server) {
+    auto it = idle_.find(&server);
+    if (it == idle_.end()) {
+        return std::nullopt;
+    }
+    auto now = Clock::now();
+    std::vector<Idle>& sockets = it->second;
+    while (!sockets.empty()) {
+        Idle idle = std::move(sockets.back());
+        sockets.pop_back();
+        Metrics::add(Metrics::Gauge::ProxyIdleConnections, -1);
+        if (now - idle.since <= IDLE_TIMEOUT && still_open(idle.socket)) {
+            return std::move(idle.socket);
+        }
+    }
+    return std::nullopt;
+}
+
+void ProxyPool::put(const Proxy::Server& server, tcp::socket socket) {
+    std::vector<Idle>& sockets = idle_[&server];
+    if (sockets.size() >= Proxy::options().idle_connections) {
+        return; // Closed as it goes out of scope
+    }
+    sockets.push_back(Idle{.socket = std::move(socket), .since = Clock::now()});
+    Metrics::add(Metrics::Gauge::ProxyIdleConnections, 1);
+}
+
+size_t ProxyPool::idle() const {
+    size_t count = 0;
+    for (const auto& [server, sockets] : idle_) {
+        count += sockets.size();
+    }
+    return count;
+}
+
+void ProxyPool::shutdown() {
+    Metrics::add(Metrics::Gauge::ProxyIdleConnections, -static_cast<int64_t>(idle()));
+    idle_.clear();
+}
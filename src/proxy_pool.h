@@ -0,0 +1,55 @@
+#ifndef PROXY_POOL_H
+#define PROXY_POOL_H
+
+#include "proxy.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+
+/**
+ * Idle keep-alive connections to upstream servers, one pool per io_context
+ *
+ * Found with asio::use_service, so a thread only ever reuses its own sockets
+ * and nothing is locked. Connections are handed out most recently used first
+ * and checked on the way out: one the server has closed (or sent unasked-for
+ * bytes on), or that sat idle longer than IDLE_TIMEOUT, is dropped. A server
+ * can still close a connection just as a request goes out on it; the driver
+ * resends the request on a new connection when that is safe.
+ */
+class ProxyPool : public asio::execution_context::service {
+  public:
+    static asio::execution_context::id id;
+
+    // Idle connections older than this are closed rather than reused
+    static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);
+
+    explicit ProxyPool(asio::execution_context& context);
+
+    // An open idle connection to server, if there is one
+    std::optional<asio::ip::tcp::socket> take(const Proxy::Server& server);
+
+    /**
+     * Keep a connection whose last response was read in full, closing it
+     * instead if server already has Options::idle_connections idle
+     */
+    void put(const Proxy::Server& server, asio::ip::tcp::socket socket);
+
+    // Idle connections to all servers
+    size_t idle() const;
+
+  private:
+    struct Idle {
+        asio::ip::tcp::socket socket;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    void shutdown() override;
+
+    std::unordered_map<const Proxy::Server*, std::vector<Idle>> idle_;
+};
+
+#endif // PROXY_POOL_H
@@ -0,0 +1,47 @@
+#include "registered_buffers.h"
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+
+#include <iostream>
+
+asio::execution_context::id RegisteredBuffers::id;
+
+RegisteredBuffers::RegisteredBuffers(asio::execution_context& context)
+    : asio::execution_context::service(context), storage_(BUFFER_SIZE * COUNT) {
+    for (size_t i = 0; i < COUNT; ++i) {
+        buffers_.push_back(asio::buffer(storage_.data() + i * BUFFER_SIZE, BUFFER_SIZE));
+    }
+
+    try {
+        registration_.emplace(asio::register_buffers(context, buffers_));
+    } catch (const boost::system::system_error& e) {
+        std::cerr << "io_uring buffer registration failed, using unregistered reads: "
+                  << e.what() << std::endl;
+        return;
+    }
+
+    for (size_t i = COUNT; i > 0; --i) {
+        free_.push_back(i - 1);
+    }
+}
+
+std::optional<RegisteredBuffers::Lease> RegisteredBuffers::acquire() {
+    if (free_.empty()) {
+        return std::nullopt;
+    }
+    size_t index = free_.back();
+    free_.pop_back();
+    return Lease(*this, index);
+}
+
+RegisteredBuffers::Lease::~Lease() {
+    if (owner_) {
+        owner_->free_.push_back(index_);
+    }
+}
+
+asio::mutable_registered_buffer RegisteredBuffers::Lease::buffer() const {
+    return (*owner_->registration_)[index_];
+}
+
+#endif // BOOST_ASIO_HAS_IO_URING
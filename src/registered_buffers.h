@@ -0,0 +1,72 @@
+#ifndef REGISTERED_BUFFERS_H
+#define REGISTERED_BUFFERS_H
+
+#include <boost/asio.hpp>
+
+#ifdef BOOST_ASIO_HAS_IO_URING
+
+#include <boost/asio/buffer_registration.hpp>
+#include <boost/asio/registered_buffer.hpp>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace asio = boost::asio;
+
+/**
+ * Static file read buffers registered with an io_context's io_uring
+ *
+ * Registered (fixed) buffers are pinned and mapped into the kernel once, so a
+ * read into one (IORING_OP_READ_FIXED) skips the page pinning an ordinary read
+ * pays on every call. Each io_context gets one set, found with
+ * asio::use_service. The servers run every io_context on a single thread, so
+ * leases need no locking. Registration can fail (RLIMIT_MEMLOCK or an old
+ * kernel); acquire() then returns nothing and callers read into an ordinary
+ * buffer.
+ */
+class RegisteredBuffers : public asio::execution_context::service {
+  public:
+    static asio::execution_context::id id;
+
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t COUNT = 32; // 2 MiB of locked memory per io_context
+
+    explicit RegisteredBuffers(asio::execution_context& context);
+
+    /**
+     * A registered buffer, returned to the set on destruction
+     */
+    class Lease {
+      public:
+        Lease(RegisteredBuffers& owner, size_t index) : owner_(&owner), index_(index) {}
+        Lease(Lease&& other) noexcept : owner_(other.owner_), index_(other.index_) {
+            other.owner_ = nullptr;
+        }
+        Lease& operator=(Lease&&) = delete;
+        ~Lease();
+
+        asio::mutable_registered_buffer buffer() const;
+
+      private:
+        RegisteredBuffers* owner_;
+        size_t index_;
+    };
+
+    /**
+     * Take a free buffer
+     * @return The lease, or nullopt if none is free or registration failed
+     */
+    std::optional<Lease> acquire();
+
+  private:
+    void shutdown() override {}
+
+    std::vector<char> storage_;
+    std::vector<asio::mutable_buffer> buffers_;
+    std::optional<asio::buffer_registration<std::vector<asio::mutable_buffer>>> registration_;
+    std::vector<size_t> free_;
+};
+
+#endif // BOOST_ASIO_HAS_IO_URING
+
+#endif // REGISTERED_BUFFERS_H
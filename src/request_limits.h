@@ -27,6 +27,11 @@ constexpr size_t MAX_BODY_SIZE = 10485760;    // 10MB request body
 constexpr size_t MAX_UPLOAD_SIZE = 104857600; // 100MB for file uploads (PUT)
 constexpr size_t MAX_CHUNK_SIZE = 1048576;    // 1MB per chunk in chunked encoding
 
+// Form bodies (parsed as they arrive; larger multipart parts go to temporary files)
+constexpr size_t MAX_FORM_MEMORY = 1048576;     // 1MB of field data kept in memory per request
+constexpr size_t MAX_FORM_FIELD_MEMORY = 65536; // 64KB per multipart part kept in memory
+constexpr size_t MAX_FORM_FIELDS = 1000;        // Fields or parts per form
+
 // File size limits (protection against integer overflow and memory exhaustion)
 // When serving files, we must validate the size before allocating buffers
 constexpr size_t MAX_FILE_SIZE = 1073741824;  // 1GB max file size for serving
@@ -0,0 +1,602 @@
+#include "response_cache.h"
+#include "conditional_request.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+
+using Clock = std::chrono::steady_clock;
+using Field = ResponseCache::Field;
+
+namespace {
+
+// Statuses cacheable by default (RFC 9110 section 15.1), less 206 since
+// ranges aren't stored
+constexpr int CACHEABLE_STATUSES[] = {200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501};
+
+// Disk tier files, the only ones configure() removes from the directory
+constexpr std::string_view FILE_EXTENSION = ".cache";
+
+ResponseCache::Options& configuredOptions() {
+    static ResponseCache::Options options;
+    return options;
+}
+
+// Case-insensitive, with '_' matching '-' for CGI variable names
+bool field_equals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        x = x == '_' ? '-' : static_cast<char>(std::tolower(static_cast<unsigned char>(x)));
+        y = y == '_' ? '-' : static_cast<char>(std::tolower(static_cast<unsigned char>(y)));
+        return x == y;
+    });
+}
+
+std::string_view trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+std::string lowercase(std::string_view s) {
+    std::string out(s);
+    for (char& c : out) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return out;
+}
+
+// Every value of a field, joined as if it had been sent once
+std::optional<std::string> field_value(const std::vector<Field>& fields, std::string_view name) {
+    std::optional<std::string> value;
+    for (const auto& [field, text] : fields) {
+        if (field_equals(field, name)) {
+            value = value ? *value + ", " + text : text;
+        }
+    }
+    return value;
+}
+
+// Each element of a comma-separated field value, trimmed
+template <typename F> void for_each_element(std::string_view value, F fn) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        if (std::string_view element = trim(value.substr(0, comma)); !element.empty()) {
+            fn(element);
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+}
+
+/**
+ * Cache-Control directives a shared cache acts on
+ */
+struct CacheControl {
+    bool no_store = false;
+    bool no_cache = false;
+    bool is_private = false;
+    bool must_revalidate = false; // Or proxy-revalidate
+    std::optional<long> max_age;
+    std::optional<long> s_maxage;
+    long stale_while_revalidate = 0;
+    long stale_if_error = 0;
+
+    static CacheControl parse(const std::vector<Field>& fields) {
+        CacheControl cc;
+        auto value = field_value(fields, "Cache-Control");
+        for_each_element(value.value_or(""), [&](std::string_view directive) {
+            size_t equals = directive.find('=');
+            std::string name = lowercase(trim(directive.substr(0, equals)));
+            std::optional<long> seconds;
+            if (equals != std::string_view::npos) {
+                std::string_view argument = trim(directive.substr(equals + 1));
+                if (argument.size() >= 2 && argument.front() == '"' && argument.back() == '"') {
+                    argument = argument.substr(1, argument.size() - 2);
+                }
+                long parsed = 0;
+                auto [ptr, ec] =
+                    std::from_chars(argument.data(), argument.data() + argument.size(), parsed);
+                if (ec == std::errc() && ptr == argument.data() + argument.size() && parsed >= 0) {
+                    seconds = parsed;
+                }
+            }
+            if (name == "no-store") {
+                cc.no_store = true;
+            } else if (name == "no-cache") {
+                cc.no_cache = true;
+            } else if (name == "private") {
+                cc.is_private = true;
+            } else if (name == "must-revalidate" || name == "proxy-revalidate") {
+                cc.must_revalidate = true;
+            } else if (name == "max-age" && seconds) {
+                cc.max_age = seconds;
+            } else if (name == "s-maxage" && seconds) {
+                cc.s_maxage = seconds;
+            } else if (name == "stale-while-revalidate" && seconds) {
+                cc.stale_while_revalidate = *seconds;
+            } else if (name == "stale-if-error" && seconds) {
+                cc.stale_if_error = *seconds;
+            }
+        });
+        return cc;
+    }
+};
+
+// Framing and connection fields, which are rewritten for every client
+bool stored_field(std::string_view name, const std::vector<Field>& fields) {
+    static constexpr std::string_view dropped[] = {
+        "Connection", "Keep-Alive",     "Proxy-Connection", "TE",    "Trailer", "Transfer-Encoding",
+        "Upgrade",    "Content-Length", "Age",              "Status"};
+    if (std::ranges::any_of(dropped,
+                            [&](std::string_view drop) { return field_equals(name, drop); })) {
+        return false;
+    }
+    bool listed = false;
+    for_each_element(field_value(fields, "Connection").value_or(""),
+                     [&](std::string_view token) { listed = listed || field_equals(token, name); });
+    return !listed;
+}
+
+std::filesystem::path disk_file(size_t number) {
+    return std::filesystem::path(configuredOptions().disk_path) /
+           std::format("{}{}", number, FILE_EXTENSION);
+}
+
+/**
+ * Publishes the change in the cache's size made while it is alive; created
+ * after taking the lock so it is destroyed before the lock is released
+ */
+class SizeGauges {
+  public:
+    SizeGauges(const size_t& memory, const size_t& disk, const size_t& entries)
+        : memory_(memory), disk_(disk), entries_(entries), memory_before_(memory),
+          disk_before_(disk), entries_before_(entries) {}
+    ~SizeGauges() {
+        publish(Metrics::Gauge::CacheMemoryBytes, memory_before_, memory_);
+        publish(Metrics::Gauge::CacheDiskBytes, disk_before_, disk_);
+        publish(Metrics::Gauge::CacheEntries, entries_before_, entries_);
+    }
+    SizeGauges(const SizeGauges&) = delete;
+    SizeGauges& operator=(const SizeGauges&) = delete;
+
+  private:
+    static void publish(Metrics::Gauge gauge, size_t before, size_t after) {
+        if (before != after) {
+            Metrics::add(gauge, static_cast<int64_t>(after) - static_cast<int64_t>(before));
+        }
+    }
+
+    const size_t& memory_;
+    const size_t& disk_;
+    const size_t& entries_;
+    size_t memory_before_;
+    size_t disk_before_;
+    size_t entries_before_;
+};
+
+} // namespace
+
+size_t ResponseCache::Entry::size() const {
+    size_t size = sizeof(Entry) + reason.size() + body.size();
+    for (const auto& [name, value] : fields) {
+        size += name.size() + value.size();
+    }
+    for (const auto& [name, value] : vary) {
+        size += name.size() + value.size();
+    }
+    return size;
+}
+
+asio::awaitable<void> ResponseCache::Fetch::wait(Clock::duration timeout) {
+    auto executor = co_await asio::this_coro::executor;
+    auto timer = std::make_shared<asio::steady_timer>(executor, timeout);
+    {
+        std::lock_guard lock(mutex_);
+        if (done_) {
+            co_return;
+        }
+        // The fetch may finish on another thread, which must not touch the timer
+        waiters_.push_back(
+            [executor, timer] { asio::post(executor, [timer] { timer->cancel(); }); });
+    }
+    co_await timer->async_wait(asio::as_tuple(asio::use_awaitable));
+}
+
+void ResponseCache::Fetch::finish() {
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard lock(mutex_);
+        done_ = true;
+        waiters.swap(waiters_);
+    }
+    for (auto& wake : waiters) {
+        wake();
+    }
+}
+
+ResponseCache::FetchLock& ResponseCache::FetchLock::operator=(FetchLock&& other) noexcept {
+    if (this != &other) {
+        release();
+        cache_ = std::exchange(other.cache_, nullptr);
+        key_ = std::move(other.key_);
+        fetch_ = std::move(other.fetch_);
+    }
+    return *this;
+}
+
+void ResponseCache::FetchLock::release() {
+    if (!cache_) {
+        return;
+    }
+    {
+        std::lock_guard lock(cache_->mutex_);
+        auto it = cache_->fetches_.find(key_);
+        if (it != cache_->fetches_.end() && it->second == fetch_) {
+            cache_->fetches_.erase(it);
+        }
+    }
+    fetch_->finish();
+    cache_ = nullptr;
+}
+
+const ResponseCache::Options& ResponseCache::options() { return configuredOptions(); }
+
+std::optional<std::string> ResponseCache::configure(const Options& options) {
+    ResponseCache& cache = getInstance();
+    std::lock_guard lock(cache.mutex_);
+    SizeGauges gauges(cache.memory_bytes_, cache.disk_bytes_, cache.entries_);
+    configuredOptions() = options;
+    cache.memory_.clear();
+    cache.disk_.clear();
+    cache.index_.clear();
+    cache.variants_.clear();
+    cache.memory_bytes_ = 0;
+    cache.disk_bytes_ = 0;
+    cache.entries_ = 0;
+    if (options.disk_path.empty()) {
+        return std::nullopt;
+    }
+
+    // Files left by an earlier run aren't in the index, so they go
+    std::error_code ec;
+    std::filesystem::create_directories(options.disk_path, ec);
+    if (ec) {
+        return std::format("can't create cache directory {}: {}", options.disk_path,
+                           ec.message());
+    }
+    for (const auto& file : std::filesystem::directory_iterator(options.disk_path, ec)) {
+        if (file.is_regular_file(ec) && file.path().extension() == FILE_EXTENSION) {
+            std::filesystem::remove(file.path(), ec);
+        }
+    }
+    if (ec) {
+        return std::format("can't empty cache directory {}: {}", options.disk_path, ec.message());
+    }
+    return std::nullopt;
+}
+
+ResponseCache& ResponseCache::getInstance() {
+    static ResponseCache cache;
+    return cache;
+}
+
+std::optional<ResponseCache::Request> ResponseCache::request(std::string_view method,
+                                                             std::string_view target,
+                                                             std::vector<Field> fields) {
+    if (method != "GET" && method != "HEAD") {
+        return std::nullopt;
+    }
+    CacheControl cc = CacheControl::parse(fields);
+    if (cc.no_store || field_value(fields, "Authorization")) {
+        return std::nullopt;
+    }
+
+    Request request;
+    request.head = method == "HEAD";
+    request.refresh = cc.no_cache || cc.max_age == 0L ||
+                      field_value(fields, "Pragma").value_or("").contains("no-cache");
+    // HEAD is answered from the GET response
+    request.key = std::format("GET {}{}", lowercase(field_value(fields, "Host").value_or("")),
+                              target);
+    request.fields = std::move(fields);
+    return request;
+}
+
+bool ResponseCache::cacheable(int status, const std::vector<Field>& fields) {
+    if (std::ranges::find(CACHEABLE_STATUSES, status) == std::end(CACHEABLE_STATUSES) ||
+        field_value(fields, "Set-Cookie")) {
+        return false;
+    }
+    bool vary_all = false;
+    for_each_element(field_value(fields, "Vary").value_or(""),
+                     [&](std::string_view name) { vary_all = vary_all || name == "*"; });
+    CacheControl cc = CacheControl::parse(fields);
+    if (vary_all || cc.no_store || cc.no_cache || cc.is_private) {
+        return false;
+    }
+    // Only explicit freshness; no heuristics
+    return cc.s_maxage || cc.max_age || field_value(fields, "Expires");
+}
+
+std::string ResponseCache::variant_key(const std::string& primary,
+                                       const std::vector<std::string>& names,
+                                       const std::vector<Field>& fields) const {
+    std::string key = primary;
+    for (const std::string& name : names) {
+        key += '\n';
+        key += name;
+        key += ':';
+        key += field_value(fields, name).value_or("");
+    }
+    return key;
+}
+
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::find(const Request& request) {
+    std::lock_guard lock(mutex_);
+    auto variants = variants_.find(request.key);
+    if (variants == variants_.end()) {
+        return nullptr;
+    }
+    auto it = index_.find(variant_key(request.key, variants->second.names, request.fields));
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    Lru& lru = it->second->file.empty() ? memory_ : disk_;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->entry;
+}
+
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::load(const Request& request,
+                                                                const Entry& entry) {
+    std::string key;
+    std::string file;
+    {
+        std::lock_guard lock(mutex_);
+        auto variants = variants_.find(request.key);
+        if (variants == variants_.end()) {
+            return nullptr;
+        }
+        key = variant_key(request.key, variants->second.names, request.fields);
+        auto it = index_.find(key);
+        if (it == index_.end() || it->second->entry.get() != &entry) {
+            return nullptr;
+        }
+        if (!it->second->entry->on_disk()) {
+            return it->second->entry; // Still being written out
+        }
+        file = it->second->file;
+    }
+
+    std::ifstream in(file, std::ios::binary);
+    std::string body(std::istreambuf_iterator<char>(in), {});
+    if (!in || body.size() != entry.body_size) {
+        return nullptr;
+    }
+    auto loaded = std::make_shared<Entry>(entry);
+    loaded->body = std::move(body);
+
+    // Back to the memory tier, unless it changed while the file was read
+    DiskWork work;
+    {
+        std::lock_guard lock(mutex_);
+        SizeGauges gauges(memory_bytes_, disk_bytes_, entries_);
+        auto it = index_.find(key);
+        if (it != index_.end() && it->second->entry.get() == &entry) {
+            Node& node = *it->second;
+            disk_bytes_ -= entry.body_size;
+            work.remove.push_back(std::move(node.file));
+            node.file.clear();
+            node.entry = loaded;
+            memory_.splice(memory_.begin(), disk_, it->second);
+            memory_bytes_ += loaded->size();
+            make_room(work);
+        }
+    }
+    finish_disk_work(std::move(work));
+    return loaded;
+}
+
+bool ResponseCache::store(const Request& request, int status, std::string_view reason,
+                          const std::vector<Field>& fields, std::string body) {
+    const Options& options = configuredOptions();
+    if (request.head || !cacheable(status, fields) || body.size() > options.max_object_size) {
+        return false;
+    }
+
+    // Freshness lifetime, less the age the response arrived with
+    CacheControl cc = CacheControl::parse(fields);
+    time_t now = time(nullptr);
+    time_t date = now;
+    if (auto value = field_value(fields, "Date")) {
+        date = ConditionalRequest::parseHttpDate(*value).value_or(now);
+    }
+    long lifetime = 0;
+    if (cc.s_maxage || cc.max_age) {
+        lifetime = cc.s_maxage ? *cc.s_maxage : *cc.max_age;
+    } else if (auto expires = ConditionalRequest::parseHttpDate(
+                   field_value(fields, "Expires").value_or(""))) {
+        lifetime = static_cast<long>(*expires - date); // An invalid Expires means already stale
+    }
+    long age = std::max<long>(0, static_cast<long>(now - date));
+    if (auto value = field_value(fields, "Age")) {
+        long sent_age = 0;
+        std::from_chars(value->data(), value->data() + value->size(), sent_age);
+        age = std::max(age, sent_age);
+    }
+    long stale_while_revalidate = cc.must_revalidate ? 0 : cc.stale_while_revalidate;
+    long stale_if_error = cc.must_revalidate ? 0 : cc.stale_if_error;
+    if (lifetime <= age && stale_while_revalidate == 0 && stale_if_error == 0) {
+        return false; // Never usable
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->status = status;
+    entry->reason = reason;
+    for (const auto& [name, value] : fields) {
+        if (stored_field(name, fields)) {
+            entry->fields.emplace_back(name, value);
+        }
+    }
+    std::vector<std::string> vary_names;
+    for_each_element(field_value(fields, "Vary").value_or(""), [&](std::string_view name) {
+        vary_names.push_back(lowercase(name));
+    });
+    for (const std::string& name : vary_names) {
+        entry->vary.emplace_back(name, field_value(request.fields, name).value_or(""));
+    }
+    entry->body_size = body.size();
+    entry->body = std::move(body);
+    entry->stored = Clock::now();
+    entry->initial_age = std::chrono::seconds(age);
+    entry->fresh_until = entry->stored + std::chrono::seconds(std::max(0L, lifetime - age));
+    entry->revalidate_until = entry->fresh_until + std::chrono::seconds(stale_while_revalidate);
+    entry->error_until = entry->fresh_until + std::chrono::seconds(stale_if_error);
+    if (entry->size() > options.memory_size) {
+        return false;
+    }
+
+    DiskWork work;
+    {
+        std::lock_guard lock(mutex_);
+        SizeGauges gauges(memory_bytes_, disk_bytes_, entries_);
+        // Later lookups use the Vary of the latest response; older variants
+        // become unreachable and age out
+        std::string key = variant_key(request.key, vary_names, request.fields);
+        if (auto it = index_.find(key); it != index_.end()) {
+            erase(it, work); // May drop the key's Variants along with its last variant
+        }
+        Variants& variants = variants_[request.key];
+        variants.names = vary_names;
+        ++variants.count;
+        memory_.push_front(Node{.key = key, .primary = request.key, .entry = entry, .file = {}});
+        index_.emplace(std::move(key), memory_.begin());
+        memory_bytes_ += entry->size();
+        ++entries_;
+        make_room(work);
+    }
+    finish_disk_work(std::move(work));
+    return true;
+}
+
+void ResponseCache::make_room(DiskWork& work) {
+    const Options& options = configuredOptions();
+    while (memory_bytes_ > options.memory_size && !memory_.empty()) {
+        auto victim = std::prev(memory_.end());
+        if (options.disk_path.empty() || victim->entry->body_size > options.disk_size) {
+            erase(index_.find(victim->key), work);
+            continue;
+        }
+        // Its body is written out once the lock is released
+        memory_bytes_ -= victim->entry->size();
+        victim->file = disk_file(next_file_++).string();
+        disk_.splice(disk_.begin(), memory_, victim);
+        disk_bytes_ += victim->entry->body_size;
+        work.write.push_back(*victim);
+    }
+    while (disk_bytes_ > options.disk_size && !disk_.empty()) {
+        erase(index_.find(std::prev(disk_.end())->key), work);
+    }
+}
+
+void ResponseCache::erase(std::unordered_map<std::string, Lru::iterator>::iterator it,
+                          DiskWork& work) {
+    Lru::iterator node = it->second;
+    auto variants = variants_.find(node->primary);
+    if (variants != variants_.end() && --variants->second.count == 0) {
+        variants_.erase(variants);
+    }
+    if (node->file.empty()) {
+        memory_bytes_ -= node->entry->size();
+        memory_.erase(node);
+    } else {
+        disk_bytes_ -= node->entry->body_size;
+        work.remove.push_back(node->file);
+        disk_.erase(node);
+    }
+    index_.erase(it);
+    --entries_;
+}
+
+void ResponseCache::finish_disk_work(DiskWork work) {
+    for (Node& node : work.write) {
+        std::ofstream out(node.file, std::ios::binary | std::ios::trunc);
+        out.write(node.entry->body.data(), static_cast<std::streamsize>(node.entry->body.size()));
+        out.close();
+        bool written = static_cast<bool>(out);
+
+        // Drop the body from memory, or the entry if it couldn't be written
+        std::lock_guard lock(mutex_);
+        SizeGauges gauges(memory_bytes_, disk_bytes_, entries_);
+        auto it = index_.find(node.key);
+        if (it == index_.end() || it->second->file != node.file) {
+            continue; // Replaced or evicted meanwhile; its file is already being removed
+        }
+        if (written) {
+            auto meta = std::make_shared<Entry>(*node.entry);
+            meta->body.clear();
+            meta->body.shrink_to_fit();
+            it->second->entry = std::move(meta);
+        } else {
+            erase(it, work);
+        }
+    }
+    std::error_code ec;
+    for (const std::string& file : work.remove) {
+        std::filesystem::remove(file, ec);
+    }
+}
+
+std::variant<ResponseCache::FetchLock, std::shared_ptr<ResponseCache::Fetch>>
+ResponseCache::claim(const std::string& key) {
+    std::lock_guard lock(mutex_);
+    auto [it, inserted] = fetches_.try_emplace(key);
+    if (!inserted) {
+        return it->second;
+    }
+    it->second = std::make_shared<Fetch>();
+    return FetchLock(*this, key, it->second);
+}
+
+std::string ResponseCache::head(const Entry& entry, bool keep_alive,
+                                std::string_view status_field) {
+    auto age = entry.initial_age +
+               std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - entry.stored);
+    std::string out = std::format("HTTP/1.1 {} {}\r\n", entry.status, entry.reason);
+    for (const auto& [name, value] : entry.fields) {
+        out += name;
+        out += ": ";
+        out += value;
+        out += "\r\n";
+    }
+    out += std::format("Age: {}\r\nX-Cache: {}\r\n", age.count(), status_field);
+    if (entry.status != 204) {
+        out += std::format("Content-Length: {}\r\n", entry.body_size);
+    }
+    out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return out;
+}
+
+size_t ResponseCache::memory_bytes() const {
+    std::lock_guard lock(mutex_);
+    return memory_bytes_;
+}
+
+size_t ResponseCache::disk_bytes() const {
+    std::lock_guard lock(mutex_);
+    return disk_bytes_;
+}
+
+size_t ResponseCache::entries() const {
+    std::lock_guard lock(mutex_);
+    return entries_;
+}
@@ -0,0 +1,235 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace asio = boost::asio;
+
+/**
+ * Shared micro-cache for proxied and FastCGI responses
+ *
+ * GET responses that say how long they stay fresh (Cache-Control s-maxage or
+ * max-age, or Expires) are kept and served to later requests for the same
+ * method, host and target, and the same values of the request fields the
+ * response's Vary lists. Nothing is cached without explicit freshness, and
+ * never for requests with credentials or responses that are private or set
+ * cookies.
+ *
+ * A stale response is still sent while a background fetch replaces it
+ * within its stale-while-revalidate window, and instead of an error within
+ * its stale-if-error window. Concurrent misses for a key are coalesced: one
+ * request fetches while the rest wait up to lock_timeout for its result.
+ *
+ * Responses live in memory up to memory_size, least recently used evicted
+ * first. With a disk_path, evicted responses move to files there (up to
+ * disk_size) and back into memory when requested again. The index of those
+ * files is kept in memory, so the directory is emptied when the cache is
+ * configured. One instance and its lock are shared by all threads; bodies
+ * are immutable and reference-counted, so a hit holds the lock only to look
+ * the entry up.
+ */
+class ResponseCache {
+  public:
+    struct Options {
+        bool enabled = false;
+        size_t memory_size = 64 * 1024 * 1024; // Bytes of responses kept in memory
+        size_t max_object_size = 1024 * 1024;  // Larger responses aren't stored
+        std::string disk_path;                 // Directory for the disk tier, if any
+        size_t disk_size = 1024 * 1024 * 1024;
+        size_t lock_timeout = 5; // Seconds a coalesced miss waits for the fetch
+    };
+
+    // A header field name and value
+    using Field = std::pair<std::string, std::string>;
+
+    /**
+     * A request that may be answered from the cache
+     */
+    struct Request {
+        std::string key;           // Method, host and target
+        std::vector<Field> fields; // The request's fields, for Vary
+        bool head = false;         // HEAD, answered from the GET response without its body
+        bool refresh = false;      // Cache-Control: no-cache; fetched and stored but not looked up
+    };
+
+    /**
+     * A stored response; immutable once stored
+     */
+    struct Entry {
+        int status = 200;
+        std::string reason;
+        std::vector<Field> fields; // End-to-end fields, without framing or Age
+        std::string body;          // Empty while on the disk tier
+        size_t body_size = 0;      // Also while the body is on disk
+        std::vector<Field> vary;   // Request fields the response varies on, with their values
+        std::chrono::steady_clock::time_point stored;
+        std::chrono::seconds initial_age{0}; // Age the response already had
+        std::chrono::steady_clock::time_point fresh_until;
+        std::chrono::steady_clock::time_point revalidate_until; // stale-while-revalidate
+        std::chrono::steady_clock::time_point error_until;      // stale-if-error
+
+        bool fresh(std::chrono::steady_clock::time_point now) const { return now < fresh_until; }
+        bool revalidatable(std::chrono::steady_clock::time_point now) const {
+            return now < revalidate_until;
+        }
+        bool usable_on_error(std::chrono::steady_clock::time_point now) const {
+            return now < error_until;
+        }
+        bool on_disk() const { return body.size() != body_size; }
+        size_t size() const;
+    };
+
+    /**
+     * The one fetch of a key in progress, which concurrent misses wait on
+     */
+    class Fetch {
+      public:
+        // Resume when the fetch finishes, or after timeout
+        asio::awaitable<void> wait(std::chrono::steady_clock::duration timeout);
+
+      private:
+        friend class ResponseCache;
+        void finish();
+
+        std::mutex mutex_;
+        bool done_ = false;
+        std::vector<std::function<void()>> waiters_; // Wake one waiter on its own thread
+    };
+
+    /**
+     * Ownership of a key's fetch; finishing it (going out of scope) wakes the
+     * requests waiting on it, so store the response before letting it go
+     */
+    class FetchLock {
+      public:
+        FetchLock(ResponseCache& cache, std::string key, std::shared_ptr<Fetch> fetch)
+            : cache_(&cache), key_(std::move(key)), fetch_(std::move(fetch)) {}
+        FetchLock(FetchLock&& other) noexcept
+            : cache_(std::exchange(other.cache_, nullptr)), key_(std::move(other.key_)),
+              fetch_(std::move(other.fetch_)) {}
+        FetchLock& operator=(FetchLock&& other) noexcept;
+        ~FetchLock() { release(); }
+
+      private:
+        void release();
+
+        ResponseCache* cache_;
+        std::string key_;
+        std::shared_ptr<Fetch> fetch_;
+    };
+
+    static const Options& options();
+
+    /**
+     * Set the options and empty the cache, creating the disk tier's directory
+     * @return An error message if the directory can't be created or emptied
+     */
+    static std::optional<std::string> configure(const Options& options);
+
+    // The process-wide cache
+    static ResponseCache& getInstance();
+
+    /**
+     * The cache's view of a request
+     * @param fields Request header fields; names are compared case-insensitively,
+     *        with '_' matching '-' so CGI variable names can be used
+     * @return Nothing if the request can't be answered from the cache or
+     *         stored: not GET or HEAD, with credentials, or Cache-Control: no-store
+     */
+    static std::optional<Request> request(std::string_view method, std::string_view target,
+                                          std::vector<Field> fields);
+
+    // Whether a response with this status and these fields may be stored
+    static bool cacheable(int status, const std::vector<Field>& fields);
+
+    /**
+     * The stored response for a request, fresh or not, if there is one
+     * (its body may be on disk; see load())
+     */
+    std::shared_ptr<const Entry> find(const Request& request);
+
+    /**
+     * Read an entry's body back from the disk tier into memory. Does file
+     * I/O, so call it on the BlockingPool.
+     * @return The entry with its body, or nothing if it is gone
+     */
+    std::shared_ptr<const Entry> load(const Request& request, const Entry& entry);
+
+    /**
+     * Keep a complete response to a GET request if it may be cached, evicting
+     * others as needed. May write evicted responses to the disk tier, so with
+     * one configured call it on the BlockingPool.
+     * @return Whether it was stored
+     */
+    bool store(const Request& request, int status, std::string_view reason,
+               const std::vector<Field>& fields, std::string body);
+
+    /**
+     * Become the one fetching a key, or get the fetch already in progress
+     */
+    std::variant<FetchLock, std::shared_ptr<Fetch>> claim(const std::string& key);
+
+    /**
+     * Response head for a stored response, with its current Age
+     * @param status_field X-Cache value sent with it, e.g. "HIT"
+     */
+    static std::string head(const Entry& entry, bool keep_alive, std::string_view status_field);
+
+    size_t memory_bytes() const;
+    size_t disk_bytes() const;
+    size_t entries() const;
+
+  private:
+    struct Node {
+        std::string key;     // With the Vary values
+        std::string primary; // Request::key
+        std::shared_ptr<const Entry> entry;
+        std::string file; // Set once the node moves to the disk tier
+    };
+    using Lru = std::list<Node>; // Most recently used first
+
+    // File I/O left for after the lock is released
+    struct DiskWork {
+        std::vector<Node> write; // Moved to the disk tier, bodies still in memory
+        std::vector<std::string> remove;
+    };
+
+    // Vary field names last stored for a key, and how many variants use them
+    struct Variants {
+        std::vector<std::string> names;
+        size_t count = 0;
+    };
+
+    std::string variant_key(const std::string& primary, const std::vector<std::string>& names,
+                            const std::vector<Field>& fields) const;
+    void make_room(DiskWork& work);
+    void erase(std::unordered_map<std::string, Lru::iterator>::iterator it, DiskWork& work);
+    void finish_disk_work(DiskWork work);
+
+    mutable std::mutex mutex_;
+    Lru memory_;
+    Lru disk_;
+    std::unordered_map<std::string, Lru::iterator> index_;
+    std::unordered_map<std::string, Variants> variants_;
+    std::unordered_map<std::string, std::shared_ptr<Fetch>> fetches_;
+    size_t memory_bytes_ = 0;
+    size_t disk_bytes_ = 0;
+    size_t entries_ = 0;
+    size_t next_file_ = 0;
+};
+
+#endif // RESPONSE_CACHE_H
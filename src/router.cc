@@ -0,0 +1,202 @@
+#include "router.h"
+#include "handler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+std::optional<Method> parseMethod(std::string_view name) {
+    if (name == "GET") {
+        return Method::Get;
+    }
+    if (name == "HEAD") {
+        return Method::Head;
+    }
+    if (name == "POST") {
+        return Method::Post;
+    }
+    if (name == "PUT") {
+        return Method::Put;
+    }
+    if (name == "DELETE") {
+        return Method::Delete;
+    }
+    if (name == "OPTIONS") {
+        return Method::Options;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string_view> RouteParams::find(std::string_view name) const {
+    for (const auto& [key, value] : values_) {
+        if (key == name) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * Descend from node along static text, splitting the edge where the text
+ * leaves it and adding a child for what no edge covers
+ * @return The node at the end of the text
+ */
+Router::Node& Router::insert_static(Node& node, std::string_view text) {
+    Node* current = &node;
+    while (!text.empty()) {
+        size_t index = current->indices.find(text[0]);
+        if (index == std::string::npos) {
+            auto child = std::make_unique<Node>();
+            child->prefix = text;
+            current->indices += text[0];
+            current->children.push_back(std::move(child));
+            return *current->children.back();
+        }
+
+        Node& child = *current->children[index];
+        size_t common = std::ranges::mismatch(child.prefix, text).in1 - child.prefix.begin();
+        if (common < child.prefix.size()) {
+            // The child keeps the shared part, its old contents move below it
+            std::string shared = child.prefix.substr(0, common);
+            auto rest = std::make_unique<Node>(std::move(child));
+            rest->prefix.erase(0, common);
+            child = Node();
+            child.prefix = std::move(shared);
+            child.indices = rest->prefix.substr(0, 1);
+            child.children.push_back(std::move(rest));
+        }
+        text.remove_prefix(common);
+        current = &child;
+    }
+    return *current;
+}
+
+/**
+ * The node a pattern ends at, added along with the nodes leading to it
+ * @throws std::runtime_error as for add()
+ */
+Router::Node& Router::insert(Method method, std::string_view pattern) {
+    auto fail = [&](std::string_view why) {
+        throw std::runtime_error("Route " + std::string(pattern) + ": " + std::string(why));
+    };
+    if (!pattern.starts_with('/')) {
+        fail("must start with '/'");
+    }
+
+    Node* node = &trees_[static_cast<size_t>(method)];
+    size_t pos = 0;
+    while (pos < pattern.size()) {
+        // Parameters and wildcards start a segment; ':' and '*' elsewhere are plain text
+        size_t mark = pos;
+        while (mark < pattern.size() &&
+               !((pattern[mark] == ':' || pattern[mark] == '*') && pattern[mark - 1] == '/')) {
+            ++mark;
+        }
+        node = &insert_static(*node, pattern.substr(pos, mark - pos));
+        if (mark == pattern.size()) {
+            break;
+        }
+
+        size_t end = std::min(pattern.find('/', mark), pattern.size());
+        std::string_view name = pattern.substr(mark + 1, end - mark - 1);
+        if (name.empty()) {
+            fail("parameter without a name");
+        }
+        std::unique_ptr<Node>& child = pattern[mark] == ':' ? node->param : node->wildcard;
+        if (pattern[mark] == '*' && end != pattern.size()) {
+            fail("wildcard must be the last segment");
+        }
+        if (!child) {
+            child = std::make_unique<Node>();
+            child->name = name;
+        } else if (child->name != name) {
+            fail("conflicts with parameter " + child->name + " of another route");
+        }
+        node = child.get();
+        pos = end;
+    }
+
+    if (node->routed()) {
+        fail("already routed");
+    }
+    ++size_;
+    return *node;
+}
+
+void Router::add(Method method, std::string_view pattern, Handler handler) {
+    insert(method, pattern).handler = std::move(handler);
+}
+
+void Router::add(Method method, std::string_view pattern, AsyncHandler handler) {
+    insert(method, pattern).async_handler = std::move(handler);
+}
+
+/**
+ * Match the rest of the path below node: static children first, then the
+ * parameter, then the wildcard, so the most specific route wins
+ */
+const Router::Node* Router::lookup(const Node& node, std::string_view path,
+                                   RouteParams& params) {
+    if (path.empty() && node.routed()) {
+        return &node;
+    }
+
+    if (!path.empty()) {
+        size_t index = node.indices.find(path[0]);
+        if (index != std::string::npos) {
+            const Node& child = *node.children[index];
+            if (path.starts_with(child.prefix)) {
+                if (const Node* found = lookup(child, path.substr(child.prefix.size()), params)) {
+                    return found;
+                }
+            }
+        }
+
+        if (node.param) {
+            std::string_view value = path.substr(0, path.find('/'));
+            if (!value.empty()) {
+                params.values_.emplace_back(node.param->name, value);
+                if (const Node* found = lookup(*node.param, path.substr(value.size()), params)) {
+                    return found;
+                }
+                params.values_.pop_back();
+            }
+        }
+    }
+
+    if (node.wildcard) {
+        params.values_.emplace_back(node.wildcard->name, path);
+        return node.wildcard.get();
+    }
+    return nullptr;
+}
+
+std::optional<Router::Match> Router::match(Method method, std::string_view path) const {
+    Match match;
+    const Node* node = lookup(trees_[static_cast<size_t>(method)], path, match.params);
+    if (!node) {
+        return std::nullopt;
+    }
+    if (node->handler) {
+        match.handler = &node->handler;
+    } else {
+        match.async_handler = &node->async_handler;
+    }
+    return match;
+}
+
+boost::asio::awaitable<void> Router::run(const AsyncHandler& handler, Request& request,
+                                         ResponseWriter& response) const {
+    return run_from(0, handler, request, response);
+}
+
+boost::asio::awaitable<void> Router::run_from(size_t index, const AsyncHandler& handler,
+                                              Request& request, ResponseWriter& response) const {
+    if (index == middleware_.size()) {
+        co_await handler(request, response);
+        co_return;
+    }
+    AsyncHandler next = [this, index, &handler](Request& request, ResponseWriter& response) {
+        return run_from(index + 1, handler, request, response);
+    };
+    co_await middleware_[index](request, response, next);
+}
@@ -0,0 +1,147 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <array>
+#include <boost/asio/awaitable.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Http;
+class Request;
+class ResponseWriter;
+
+/**
+ * Request methods served, indexing the router's trees
+ */
+enum class Method : uint8_t { Get, Head, Post, Put, Delete, Options };
+
+constexpr size_t METHOD_COUNT = 6;
+
+// The method named by a request line, or nothing if it isn't served
+std::optional<Method> parseMethod(std::string_view name);
+
+/**
+ * Values of a matched route's parameters, viewing the request path
+ */
+class RouteParams {
+  public:
+    // Value of the :name or *name segment, or nothing if the route has none
+    std::optional<std::string_view> find(std::string_view name) const;
+
+    const std::vector<std::pair<std::string_view, std::string_view>>& values() const {
+        return values_;
+    }
+
+  private:
+    friend class Router;
+
+    std::vector<std::pair<std::string_view, std::string_view>> values_;
+};
+
+/**
+ * A routed request as its handler sees it; views valid during the call
+ */
+struct RouteRequest {
+    const std::map<std::string, std::string>& headers;
+    std::string_view target; // As requested, query included
+    std::string_view path;
+    std::string_view query; // After the '?', if any
+    std::string_view request_line;
+    const RouteParams& params;
+    bool keep_alive;
+};
+
+/**
+ * Maps method and path to the handler answering it, with one compressed
+ * radix tree per method
+ *
+ * Patterns are paths whose segments may be parameters: ":name" matches one
+ * non-empty segment, and a final "*name" matches the rest of the path (empty
+ * included). Where routes overlap, static text wins over a parameter and a
+ * parameter over a wildcard, falling back to the next if the rest of the path
+ * doesn't match. A lookup costs time in the length of the path, not the
+ * number of routes.
+ *
+ * Routes are added at startup; lookups don't lock, so none may be added once
+ * requests are being served. Requests matching no route are served from files.
+ * A route's handler is either synchronous, run by Http, or a coroutine the
+ * connection runs itself (over the asio servers; Http, which the other
+ * servers use, only serves the synchronous ones).
+ */
+class Router {
+  public:
+    // A synchronous handler, run by Http on the BlockingPool like the rest of its requests
+    using Handler = std::function<void(Http&, const RouteRequest&)>;
+
+    /**
+     * A coroutine handler (see Request and ResponseWriter). It runs on the
+     * connection's event loop, so it may co_await body reads, timers and
+     * outbound connections; blocking work (files, hashing) belongs on the
+     * BlockingPool, co_await-ed as well.
+     */
+    using AsyncHandler =
+        std::function<boost::asio::awaitable<void>(Request&, ResponseWriter&)>;
+
+    // Runs around coroutine handlers: co_await next to go on, or answer the request itself
+    using Middleware = std::function<boost::asio::awaitable<void>(Request&, ResponseWriter&,
+                                                                  const AsyncHandler& next)>;
+
+    struct Match {
+        const Handler* handler = nullptr;            // One of the two is set
+        const AsyncHandler* async_handler = nullptr;
+        RouteParams params;
+    };
+
+    /**
+     * Add a route
+     * @throws std::runtime_error if the pattern is malformed, or already routed
+     * for this method (also when it differs only in parameter names)
+     */
+    void add(Method method, std::string_view pattern, Handler handler);
+    void add(Method method, std::string_view pattern, AsyncHandler handler);
+
+    // Add middleware run around every coroutine handler, after those added before
+    void use(Middleware middleware) { middleware_.push_back(std::move(middleware)); }
+
+    // Run a coroutine handler through the middleware
+    boost::asio::awaitable<void> run(const AsyncHandler& handler, Request& request,
+                                     ResponseWriter& response) const;
+
+    // The route for this path (without its query), if any
+    std::optional<Match> match(Method method, std::string_view path) const;
+
+    size_t size() const { return size_; }
+
+  private:
+    struct Node {
+        std::string prefix;  // Static text matched on the way in; empty for parameters
+        std::string indices; // First byte of each static child's prefix
+        std::vector<std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> param;    // ":name" child
+        std::unique_ptr<Node> wildcard; // "*name" child, always a leaf
+        std::string name;               // Of a parameter or wildcard node
+        Handler handler;
+        AsyncHandler async_handler;
+
+        bool routed() const { return handler || async_handler; }
+    };
+
+    Node& insert(Method method, std::string_view pattern);
+    static Node& insert_static(Node& node, std::string_view text);
+    static const Node* lookup(const Node& node, std::string_view path, RouteParams& params);
+    boost::asio::awaitable<void> run_from(size_t index, const AsyncHandler& handler,
+                                          Request& request, ResponseWriter& response) const;
+
+    std::array<Node, METHOD_COUNT> trees_;
+    std::vector<Middleware> middleware_;
+    size_t size_ = 0;
+};
+
+#endif // ROUTER_H
@@ -1,7 +1,44 @@
 #include "security_middleware.h"
 #include "http.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <iostream>
+
+namespace {
+
+std::atomic<std::shared_ptr<const PathRules>>& installed_rules() {
+    static std::atomic<std::shared_ptr<const PathRules>> rules(SecurityMiddleware::default_rules());
+    return rules;
+}
+
+} // namespace
+
+std::shared_ptr<const PathRules> SecurityMiddleware::default_rules() {
+    using Kind = PathRules::Kind;
+    static const auto rules = std::make_shared<const PathRules>(std::vector<PathRules::Rule>{
+        {Kind::Prefix, "/.env"},
+        {Kind::Prefix, "/.git"},
+        {Kind::Prefix, "/.htaccess"},
+        {Kind::Prefix, "/wp-admin"},
+        {Kind::Prefix, "/wp-login.php"},
+        {Kind::Prefix, "/admin"},
+        {Kind::Prefix, "/.ssh"}});
+    return rules;
+}
+
+std::shared_ptr<const PathRules> SecurityMiddleware::rules() { return installed_rules().load(); }
+
+void SecurityMiddleware::set_rules(std::shared_ptr<const PathRules> rules) {
+    installed_rules().store(std::move(rules));
+}
+
+void SecurityMiddleware::load_rules(const std::string& filename) {
+    auto rules = PathRules::load(filename);
+    size_t count = rules->rules().size();
+    set_rules(std::move(rules));
+    std::cout << "Loaded " << count << " path rule(s): " << filename << std::endl;
+}
 
 /**
  * URL decode a string (handles %XX encoding)
@@ -89,13 +126,13 @@ std::string SecurityMiddleware::sanitize_path(const std::string& path,
 
         // 5. If empty after removing slashes, use current directory
         if (decoded.empty()) {
-            decoded = ".";
+            decoded.assign(1, '.');
         }
 
         // 6. Normalize multiple slashes to single slashes
         size_t pos = 0;
         while ((pos = decoded.find("//", pos)) != std::string::npos) {
-            decoded.replace(pos, 2, "/");
+            decoded.erase(pos, 1);
         }
 
         // 7. Construct the full path and canonicalize it
@@ -128,14 +165,18 @@ std::string SecurityMiddleware::sanitize_path(const std::string& path,
 }
 
 void SecurityMiddleware::process(RequestContext& ctx, std::function<void()> next) {
-    // Check for blocked paths (before sanitization to catch raw attempts)
-    for (const auto& blocked : blocked_paths) {
-        if (ctx.path.find(blocked) == 0) { // starts_with equivalent
-            ctx.status_code = 403;
-            ctx.response_body = "<html><body>403 Forbidden</body></html>";
-            ctx.should_continue = false;
-            return;
-        }
+    // Check the blocklist against the decoded path, so encoding can't hide a
+    // blocked one, and the query and headers if the rules scan them
+    size_t query_start = ctx.path.find('?');
+    std::string path = url_decode_recursive(ctx.path.substr(0, query_start));
+    std::string query = query_start == std::string::npos
+                            ? std::string()
+                            : url_decode_recursive(ctx.path.substr(query_start + 1));
+    if (rules()->match(path, query, &ctx.headers)) {
+        ctx.status_code = 403;
+        ctx.response_body = "<html><body>403 Forbidden</body></html>";
+        ctx.should_continue = false;
+        return;
     }
 
     // Sanitize the path and check for traversal attempts
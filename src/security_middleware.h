@@ -2,8 +2,9 @@
 #define SHELOB_SECURITY_MIDDLEWARE_H 1
 
 #include "middleware.h"
+#include "path_rules.h"
 #include <filesystem>
-#include <set>
+#include <memory>
 #include <string>
 
 /**
@@ -12,7 +13,6 @@
  */
 class SecurityMiddleware : public Middleware {
   private:
-    std::set<std::string> blocked_paths;
     bool add_security_headers;
 
     /**
@@ -35,11 +35,30 @@ class SecurityMiddleware : public Middleware {
      */
     static std::string sanitize_path(const std::string& path,
                                      const std::filesystem::path& base_dir);
-    SecurityMiddleware(bool add_headers = true) : add_security_headers(add_headers) {
-        // Block some common attack paths
-        blocked_paths = {"/.env",         "/.git",  "/.htaccess", "/wp-admin",
-                         "/wp-login.php", "/admin", "/.ssh"};
-    }
+    SecurityMiddleware(bool add_headers = true) : add_security_headers(add_headers) {}
+
+    /**
+     * The blocklist every SecurityMiddleware checks requests against
+     */
+    static std::shared_ptr<const PathRules> rules();
+
+    /**
+     * Replace the blocklist, atomically: a request being checked finishes
+     * with the rules it started with, and the next one sees the new rules
+     */
+    static void set_rules(std::shared_ptr<const PathRules> rules);
+
+    /**
+     * Compile a rules file (see PathRules::parse) and make it the blocklist.
+     * A file that fails to load leaves the rules as they are.
+     * @throws std::runtime_error if it can't be read or doesn't parse
+     */
+    static void load_rules(const std::string& filename);
+
+    /**
+     * The built-in blocklist: prefixes of paths scanners commonly probe
+     */
+    static std::shared_ptr<const PathRules> default_rules();
 
     void process(RequestContext& ctx, std::function<void()> next) override;
 };
@@ -1,11 +1,27 @@
 #ifndef SHELOB_SOCKET_H
 #define SHELOB_SOCKET_H 1
 
+#include "open_file_cache.h"
 #include <cstdio>
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include <netinet/in.h>
+#include <sys/types.h>
+
+class BodyFraming;
+class FormParser;
+
+/**
+ * Generates a response body a piece at a time: appends the next piece to
+ * the (emptied) string and returns true, or returns false once the body is
+ * complete. May block, so the connection runs it on the BlockingPool.
+ */
+using BodyProducer = std::function<bool(std::string& piece)>;
 
 /**
  * Socket interface for HTTP I/O operations
@@ -36,6 +52,13 @@ class Socket {
      */
     virtual ssize_t read_raw(char* buffer, size_t size) = 0;
 
+    /**
+     * Request bytes already received but not read yet, for parsers that work
+     * on buffer slices instead of copying lines out; skip() reads them
+     */
+    virtual std::string_view buffered_input() const { return {}; }
+    virtual void skip(size_t /*count*/) {}
+
     /**
      * Write a line to the socket
      * @param line String view of data to write
@@ -50,6 +73,75 @@ class Socket {
      */
     virtual int write_raw(const char* data, size_t size) = 0;
 
+    /**
+     * Write a buffer that may be shared with other responses (a file body
+     * read once, say). Implementations that queue output keep a reference
+     * instead of copying it; the data must not change afterwards.
+     */
+    virtual void write_shared(std::shared_ptr<const std::string> data) {
+        write_raw(data->data(), data->size());
+    }
+
+    /**
+     * Whether send_file() can be used on this connection
+     */
+    virtual bool can_send_file() const { return false; }
+
+    /**
+     * Send part of a file after everything written so far, letting the
+     * transport move it without copying it through userspace (sendfile)
+     * @param file Open file to send, held until it has been sent
+     * @param offset First byte to send
+     * @param count Number of bytes to send
+     * @return false if not supported; the caller then writes the data itself
+     */
+    virtual bool send_file(std::shared_ptr<const OpenFileCache::File> /*file*/, off_t /*offset*/,
+                           size_t /*count*/) {
+        return false;
+    }
+
+    /**
+     * Whether forward_fastcgi() can be used on this connection
+     */
+    virtual bool can_forward_fastcgi() const { return false; }
+
+    /**
+     * Leave the response to the FastCGI application: instead of anything
+     * written here, the connection sends the application's response to the
+     * request described by params (CGI variables) and body
+     * @return false if not supported; the caller then responds itself
+     */
+    virtual bool forward_fastcgi(std::vector<std::pair<std::string, std::string>> /*params*/,
+                                 std::string /*body*/) {
+        return false;
+    }
+
+    /**
+     * The request's form body, if the connection parsed it while reading it
+     * instead of buffering it for read_raw()
+     */
+    virtual FormParser* parsed_form() { return nullptr; }
+
+    /**
+     * The framing of a request body the connection left unread, to stream to
+     * the FastCGI application as it arrives; only POSTs to scripts have one
+     */
+    virtual const BodyFraming* streamed_body() const { return nullptr; }
+
+    /**
+     * Whether stream_response() can be used on this connection
+     */
+    virtual bool can_stream_response() const { return false; }
+
+    /**
+     * Send the rest of the response body as the producer generates it, after
+     * everything written so far. The producer is asked for the next piece
+     * only once the last one has been written to the client, so a slow
+     * client holds it back instead of the body piling up in memory.
+     * @return false if not supported; the caller then writes the body itself
+     */
+    virtual bool stream_response(BodyProducer /*producer*/) { return false; }
+
   protected:
     /**
      * Protected constructor - only implementations can instantiate
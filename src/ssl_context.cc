@@ -14,9 +14,9 @@ void SSLContext::configure_security_options() {
                      ssl::context::no_sslv3 | ssl::context::no_tlsv1 | ssl::context::no_tlsv1_1 |
                      ssl::context::single_dh_use);
 
-    // Enable session caching for performance
-    SSL_CTX_set_session_cache_mode(ctx_.native_handle(),
-                                   SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    // Enable session caching for performance (per process unless
+    // enable_shared_session_cache() replaces it)
+    SSL_CTX_set_session_cache_mode(ctx_.native_handle(), SSL_SESS_CACHE_SERVER);
 
     // Set session timeout (2 hours)
     SSL_CTX_set_timeout(ctx_.native_handle(), 7200);
@@ -116,6 +116,43 @@ void SSLContext::set_cipher_list(const std::string& ciphers) {
     std::cout << "Set custom cipher list: " << ciphers << std::endl;
 }
 
+bool SSLContext::enable_ktls() {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(ctx_.native_handle(), SSL_OP_ENABLE_KTLS);
+    ktls_enabled_ = true;
+    std::cout << "Kernel TLS offload enabled (used when the kernel supports the cipher)"
+              << std::endl;
+#else
+    std::cerr << "Warning: OpenSSL was built without kTLS support; using userspace TLS"
+              << std::endl;
+#endif
+    return ktls_enabled_;
+}
+
+void SSLContext::enable_session_tickets(std::chrono::seconds rotation_period,
+                                        const std::string& key_file) {
+    auto keys = std::make_unique<TicketKeyRing>(rotation_period);
+    if (!key_file.empty()) {
+        keys->load_file(key_file);
+    }
+    keys->install(ctx_.native_handle());
+    ticket_keys_ = std::move(keys);
+    if (rotation_period.count() > 0) {
+        std::cout << "Session ticket keys rotate every " << rotation_period.count() << "s"
+                  << std::endl;
+    }
+}
+
+void SSLContext::enable_shared_session_cache(const std::string& name, size_t slots) {
+    auto cache = std::make_unique<SharedSessionCache>(name, slots);
+    cache->install(ctx_.native_handle());
+    SSL_CTX_set_session_cache_mode(ctx_.native_handle(),
+                                   SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    session_cache_ = std::move(cache);
+    std::cout << "Shared TLS session cache: " << name << " (" << slots << " sessions)"
+              << std::endl;
+}
+
 ssl::context& SSLContext::get_context() { return ctx_; }
 
 bool SSLContext::is_configured() const { return configured_; }
@@ -1,7 +1,10 @@
 #ifndef FISHJELLY_SSL_CONTEXT_H
 #define FISHJELLY_SSL_CONTEXT_H
 
+#include "tls_session.h"
 #include <boost/asio/ssl.hpp>
+#include <chrono>
+#include <memory>
 #include <string>
 
 namespace ssl = boost::asio::ssl;
@@ -12,11 +15,15 @@ namespace ssl = boost::asio::ssl;
  */
 class SSLContext {
   private:
+    // Declared before ctx_ so the SSL_CTX callbacks never outlive them
+    std::unique_ptr<TicketKeyRing> ticket_keys_;
+    std::unique_ptr<SharedSessionCache> session_cache_;
     ssl::context ctx_;
     std::string cert_file_;
     std::string key_file_;
     std::string dh_file_;
     bool configured_;
+    bool ktls_enabled_ = false;
 
     void configure_security_options();
     void set_default_ciphers();
@@ -54,6 +61,42 @@ class SSLContext {
      */
     void set_cipher_list(const std::string& ciphers);
 
+    /**
+     * Ask OpenSSL to move the record layer into the kernel (kTLS) after the
+     * handshake, so static files can be sent with sendfile. Connections fall
+     * back to userspace TLS when the kernel or negotiated cipher doesn't
+     * support it.
+     * @return false if this OpenSSL build has no kTLS support
+     */
+    bool enable_ktls();
+
+    /**
+     * Whether enable_ktls() succeeded
+     */
+    bool ktls_enabled() const { return ktls_enabled_; }
+
+    /**
+     * Issue session tickets under managed keys instead of OpenSSL's per-context
+     * default, so tickets survive restarts and work across every worker and
+     * instance that shares the key file
+     * @param rotation_period Time between key rotations (0 never rotates)
+     * @param key_file Key file shared between processes; keys are generated
+     *                 in-process when empty
+     * @throws std::runtime_error if key_file can't be loaded
+     */
+    void enable_session_tickets(std::chrono::seconds rotation_period,
+                                const std::string& key_file = "");
+
+    /**
+     * Cache sessions for TLS 1.2 session-ID resumption in a shared memory
+     * segment used by every process that opens the same name
+     * @param name Shared memory segment name
+     * @param slots Number of cached sessions
+     * @throws std::runtime_error if the segment can't be opened
+     */
+    void enable_shared_session_cache(const std::string& name,
+                                     size_t slots = SharedSessionCache::DEFAULT_SLOTS);
+
     /**
      * Get the underlying ASIO SSL context
      * @return Reference to boost::asio::ssl::context
@@ -0,0 +1,160 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(const asio::any_io_executor& executor)
+    : timer_(executor), epoch_(clock::now()) {}
+
+TimerWheel::~TimerWheel() {
+    // Deadlines normally die first; detach any that outlive the wheel
+    for (Deadline*& head : buckets_) {
+        while (head) {
+            Deadline* deadline = head;
+            head = deadline->next_;
+            deadline->prev_ = deadline->next_ = nullptr;
+            deadline->armed_ = false;
+        }
+    }
+}
+
+uint64_t TimerWheel::tick_at(clock::time_point time) const {
+    return static_cast<uint64_t>(std::max(time - epoch_, clock::duration::zero()) / TICK);
+}
+
+void TimerWheel::link(Deadline& deadline, clock::duration timeout) {
+    auto now = clock::now();
+    if (armed_ == 0) {
+        // Nothing was waiting, so no bucket before now needs visiting
+        current_tick_ = std::max(current_tick_, tick_at(now));
+    }
+
+    // Round up so a deadline never fires early
+    uint64_t expiry = tick_at(now + timeout + TICK - clock::duration(1));
+    deadline.expiry_tick_ = std::max(expiry, current_tick_ + 1);
+
+    Deadline*& head = buckets_[deadline.expiry_tick_ % SLOTS];
+    deadline.prev_ = nullptr;
+    deadline.next_ = head;
+    if (head) {
+        head->prev_ = &deadline;
+    }
+    head = &deadline;
+    deadline.armed_ = true;
+    ++armed_;
+    schedule();
+}
+
+void TimerWheel::unlink(Deadline& deadline) {
+    if (deadline.prev_) {
+        deadline.prev_->next_ = deadline.next_;
+    } else {
+        buckets_[deadline.expiry_tick_ % SLOTS] = deadline.next_;
+    }
+    if (deadline.next_) {
+        deadline.next_->prev_ = deadline.prev_;
+    }
+    deadline.prev_ = deadline.next_ = nullptr;
+    deadline.armed_ = false;
+    --armed_;
+}
+
+void TimerWheel::advance(clock::time_point now) {
+    uint64_t target = tick_at(now);
+    if (target <= current_tick_) {
+        return;
+    }
+
+    // Unlink everything due first, so callbacks are free to re-arm or cancel
+    // deadlines. A gap longer than a revolution visits each bucket once.
+    Deadline* fired = nullptr;
+    uint64_t last = std::min(target, current_tick_ + SLOTS);
+    for (uint64_t tick = current_tick_ + 1; tick <= last; ++tick) {
+        Deadline* deadline = buckets_[tick % SLOTS];
+        while (deadline) {
+            Deadline* next = deadline->next_;
+            if (deadline->expiry_tick_ <= target) {
+                unlink(*deadline);
+                deadline->expired_ = true;
+                deadline->next_ = fired;
+                fired = deadline;
+            }
+            deadline = next;
+        }
+    }
+    current_tick_ = target;
+
+    while (fired) {
+        Deadline* deadline = fired;
+        fired = deadline->next_;
+        deadline->next_ = nullptr;
+        if (deadline->expired_ && !deadline->armed_ && deadline->on_expire_) {
+            deadline->on_expire_();
+        }
+    }
+}
+
+void TimerWheel::schedule() {
+    if (scheduled_ || armed_ == 0) {
+        return;
+    }
+    scheduled_ = true;
+    timer_.expires_at(epoch_ + TICK * static_cast<int64_t>(current_tick_ + 1));
+    timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec == asio::error::operation_aborted) {
+            return; // Wheel destroyed
+        }
+        scheduled_ = false;
+        advance(clock::now());
+        schedule();
+    });
+}
+
+Deadline::Deadline(TimerWheel& wheel, std::function<void()> on_expire)
+    : wheel_(wheel), on_expire_(std::move(on_expire)) {}
+
+void Deadline::arm(std::chrono::steady_clock::duration timeout) {
+    cancel();
+    expired_ = false;
+    wheel_.link(*this, timeout);
+}
+
+void Deadline::cancel() {
+    if (armed_) {
+        wheel_.unlink(*this);
+    }
+}
+
+TransferDeadline::TransferDeadline(TimerWheel& wheel, std::function<void()> on_expire)
+    : deadline_(wheel, [this] { check(); }), on_expire_(std::move(on_expire)) {}
+
+void TransferDeadline::arm(std::chrono::steady_clock::duration timeout) {
+    enforce_rate_ = false;
+    too_slow_ = false;
+    deadline_.arm(timeout);
+}
+
+void TransferDeadline::arm_transfer(std::chrono::steady_clock::duration timeout) {
+    enforce_rate_ = true;
+    too_slow_ = false;
+    stage_end_ = std::chrono::steady_clock::now() + timeout;
+    rate_.reset();
+    deadline_.arm(std::min<std::chrono::steady_clock::duration>(
+        timeout, std::chrono::seconds(ConnectionTimeouts::RATE_MEASUREMENT_WINDOW_SEC)));
+}
+
+void TransferDeadline::check() {
+    auto now = std::chrono::steady_clock::now();
+    if (enforce_rate_ && now < stage_end_) {
+        if (!rate_.is_too_slow()) {
+            // Fast enough this window; measure the next one
+            rate_.reset();
+            deadline_.arm(std::min<std::chrono::steady_clock::duration>(
+                stage_end_ - now,
+                std::chrono::seconds(ConnectionTimeouts::RATE_MEASUREMENT_WINDOW_SEC)));
+            return;
+        }
+        too_slow_ = true;
+    }
+    if (on_expire_) {
+        on_expire_();
+    }
+}
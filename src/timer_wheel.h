@@ -0,0 +1,175 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "connection_timeouts.h"
+#include <array>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace asio = boost::asio;
+
+class Deadline;
+
+/**
+ * Hashed timing wheel for connection timeouts
+ *
+ * Racing every read and write against its own steady_timer costs a timer, an
+ * entry in the reactor's timer heap and an extra coroutine branch per
+ * operation. Instead each connection owns one Deadline, linked into one of
+ * SLOTS buckets by its expiry tick, so arming, re-arming or cancelling it is an
+ * O(1) list splice. One steady_timer per wheel advances a bucket every TICK
+ * and expires whatever is due, so the reactor sees a single timer however many
+ * connections are open, and none at all while no deadline is armed. Deadlines
+ * more than one revolution away stay in their bucket until their tick comes
+ * round.
+ *
+ * Deadlines fire up to one TICK late, which is fine for the second-granularity
+ * limits in ConnectionTimeouts. Not thread-safe: each io_context thread gets
+ * its own wheel (the servers own one next to their io_context).
+ */
+class TimerWheel {
+  public:
+    using clock = std::chrono::steady_clock;
+    static constexpr std::chrono::milliseconds TICK{250};
+    static constexpr size_t SLOTS = 256; // One revolution covers 64 seconds
+
+    explicit TimerWheel(const asio::any_io_executor& executor);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * Number of armed deadlines
+     */
+    size_t armed() const { return armed_; }
+
+    /**
+     * Expire every deadline due by now. Driven by the wheel's own timer; public
+     * so tests can step time.
+     */
+    void advance(clock::time_point now);
+
+  private:
+    friend class Deadline;
+
+    uint64_t tick_at(clock::time_point time) const;
+    void link(Deadline& deadline, clock::duration timeout);
+    void unlink(Deadline& deadline);
+    void schedule();
+
+    asio::steady_timer timer_;
+    clock::time_point epoch_;
+    uint64_t current_tick_ = 0; // Last tick whose bucket has been expired
+    std::array<Deadline*, SLOTS> buckets_{};
+    size_t armed_ = 0;
+    bool scheduled_ = false;
+};
+
+/**
+ * A connection's timeout slot in a TimerWheel
+ *
+ * Re-armed for every I/O stage. On expiry the callback runs, normally
+ * cancelling the connection's socket so the pending operation completes with
+ * operation_aborted, and expired() stays set until the next arm().
+ */
+class Deadline {
+  public:
+    Deadline(TimerWheel& wheel, std::function<void()> on_expire);
+    ~Deadline() { cancel(); }
+
+    Deadline(const Deadline&) = delete;
+    Deadline& operator=(const Deadline&) = delete;
+
+    /**
+     * Expire after timeout, replacing any earlier deadline
+     */
+    void arm(std::chrono::steady_clock::duration timeout);
+
+    /**
+     * Disarm without expiring (no-op if not armed)
+     */
+    void cancel();
+
+    bool armed() const { return armed_; }
+    bool expired() const { return expired_; }
+
+  private:
+    friend class TimerWheel;
+
+    TimerWheel& wheel_;
+    std::function<void()> on_expire_;
+    Deadline* prev_ = nullptr; // Bucket list links
+    Deadline* next_ = nullptr;
+    uint64_t expiry_tick_ = 0;
+    bool armed_ = false;
+    bool expired_ = false;
+};
+
+/**
+ * A Deadline that also evicts connections moving data too slowly
+ *
+ * A stage armed with arm_transfer() must finish within its timeout and, in
+ * every RATE_MEASUREMENT_WINDOW_SEC window along the way, move at least
+ * MIN_DATA_RATE_BYTES_PER_SEC on average, as reported through add_bytes(). The
+ * rate is measured afresh each window, so a response that filled the socket
+ * buffers in its first window can't coast on that burst while the client reads
+ * a byte at a time. Either failure runs the expiry callback; too_slow() tells
+ * the two apart.
+ */
+class TransferDeadline {
+  public:
+    TransferDeadline(TimerWheel& wheel, std::function<void()> on_expire);
+
+    /**
+     * Expire after timeout, without a minimum data rate
+     */
+    void arm(std::chrono::steady_clock::duration timeout);
+
+    /**
+     * Expire after timeout, or earlier at the end of any measurement window in
+     * which the transfer fell below the minimum data rate
+     */
+    void arm_transfer(std::chrono::steady_clock::duration timeout);
+
+    // Progress of the current transfer
+    void add_bytes(size_t bytes) { rate_.add_bytes(bytes); }
+
+    /**
+     * Wrap an asio completion condition so every step of a composed read or
+     * write is reported through add_bytes()
+     */
+    template <typename Condition> auto reporting(Condition condition) {
+        return [this, condition, reported = size_t{0}](const boost::system::error_code& ec,
+                                                       size_t transferred) mutable {
+            add_bytes(transferred - reported);
+            reported = transferred;
+            return condition(ec, transferred);
+        };
+    }
+
+    void cancel() { deadline_.cancel(); }
+
+    bool armed() const { return deadline_.armed(); }
+    bool expired() const { return deadline_.expired(); }
+    bool transferring() const { return deadline_.armed() && enforce_rate_; }
+
+    // Whether the last expiry was for falling below the minimum data rate
+    bool too_slow() const { return too_slow_; }
+
+  private:
+    void check();
+
+    Deadline deadline_;
+    std::function<void()> on_expire_;
+    ConnectionTimeouts::ConnectionState rate_;
+    std::chrono::steady_clock::time_point stage_end_;
+    bool enforce_rate_ = false;
+    bool too_slow_ = false;
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,460 @@
+#include "tls_session.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+namespace {
+
+int ticket_ring_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+int session_cache_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+/**
+ * Pick the ticket key and set up the ticket cipher; the MAC is keyed by the caller
+ * @return OpenSSL ticket callback result: 1 ok, 2 ok but reissue, 0 unknown key, -1 error
+ */
+int prepare_ticket_cipher(SSL* ssl, unsigned char* key_name, unsigned char* iv,
+                          EVP_CIPHER_CTX* cipher, int encrypt, TicketKeyRing::Key& key) {
+    auto* ring =
+        static_cast<TicketKeyRing*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_ring_index()));
+    if (!ring) {
+        return -1;
+    }
+
+    int result = 1;
+    const EVP_CIPHER* aes = EVP_aes_256_cbc();
+    if (encrypt) {
+        key = ring->encryption_key();
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(aes)) != 1) {
+            return -1;
+        }
+        std::memcpy(key_name, key.name.data(), key.name.size());
+    } else {
+        bool current = false;
+        auto found = ring->find(key_name, current);
+        if (!found) {
+            return 0; // Unknown or retired key: fall back to a full handshake
+        }
+        key = *found;
+        result = current ? 1 : 2;
+    }
+
+    if (EVP_CipherInit_ex(cipher, aes, nullptr, key.aes_key.data(), iv, encrypt) != 1) {
+        return -1;
+    }
+    return result;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int ticket_key_callback(SSL* ssl, unsigned char* key_name, unsigned char* iv,
+                        EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt) {
+    TicketKeyRing::Key key;
+    int result = prepare_ticket_cipher(ssl, key_name, iv, cipher, encrypt, key);
+    if (result > 0) {
+        char digest[] = "SHA256";
+        OSSL_PARAM params[] = {OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                                                 key.hmac_secret.data(),
+                                                                 key.hmac_secret.size()),
+                               OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+                               OSSL_PARAM_construct_end()};
+        if (EVP_MAC_CTX_set_params(mac, params) != 1) {
+            result = -1;
+        }
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+#else
+int ticket_key_callback(SSL* ssl, unsigned char* key_name, unsigned char* iv,
+                        EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int encrypt) {
+    TicketKeyRing::Key key;
+    int result = prepare_ticket_cipher(ssl, key_name, iv, cipher, encrypt, key);
+    if (result > 0 && HMAC_Init_ex(mac, key.hmac_secret.data(),
+                                   static_cast<int>(key.hmac_secret.size()), EVP_sha256(),
+                                   nullptr) != 1) {
+        result = -1;
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+#endif
+
+SharedSessionCache* cache_from(SSL_CTX* ctx) {
+    return static_cast<SharedSessionCache*>(SSL_CTX_get_ex_data(ctx, session_cache_index()));
+}
+
+std::span<const unsigned char> session_id(const SSL_SESSION* session) {
+    unsigned int length = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &length);
+    return {id, length};
+}
+
+int new_session_callback(SSL* ssl, SSL_SESSION* session) {
+    SharedSessionCache* cache = cache_from(SSL_get_SSL_CTX(ssl));
+    int size = i2d_SSL_SESSION(session, nullptr);
+    if (!cache || size <= 0 || static_cast<size_t>(size) > SharedSessionCache::MAX_SESSION_SIZE) {
+        return 0;
+    }
+
+    std::array<unsigned char, SharedSessionCache::MAX_SESSION_SIZE> encoded;
+    unsigned char* out = encoded.data();
+    i2d_SSL_SESSION(session, &out);
+    cache->store(session_id(session), std::span(encoded.data(), static_cast<size_t>(size)),
+                 static_cast<int64_t>(SSL_SESSION_get_time(session)) +
+                     static_cast<int64_t>(SSL_SESSION_get_timeout(session)));
+    return 0; // No reference kept on the SSL_SESSION itself
+}
+
+SSL_SESSION* get_session_callback(SSL* ssl, const unsigned char* id, int length, int* copy) {
+    *copy = 0; // The decoded session is handed over with its only reference
+    SharedSessionCache* cache = cache_from(SSL_get_SSL_CTX(ssl));
+    if (!cache || length <= 0) {
+        return nullptr;
+    }
+
+    auto encoded = cache->lookup(std::span(id, static_cast<size_t>(length)), time(nullptr));
+    if (encoded.empty()) {
+        return nullptr;
+    }
+    const unsigned char* in = encoded.data();
+    return d2i_SSL_SESSION(nullptr, &in, static_cast<long>(encoded.size()));
+}
+
+void remove_session_callback(SSL_CTX* ctx, SSL_SESSION* session) {
+    if (SharedSessionCache* cache = cache_from(ctx)) {
+        cache->remove(session_id(session));
+    }
+}
+
+std::string segment_name(const std::string& name) {
+    return name.starts_with('/') ? name : "/" + name;
+}
+
+} // namespace
+
+// TicketKeyRing
+
+TicketKeyRing::TicketKeyRing(std::chrono::seconds rotation_period)
+    : rotation_period_(rotation_period),
+      next_rotation_(std::chrono::steady_clock::now() + rotation_period) {
+    keys_.push_back(generate_key());
+}
+
+TicketKeyRing::Key TicketKeyRing::generate_key() {
+    Key key;
+    if (RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) != 1 ||
+        RAND_bytes(key.hmac_secret.data(), static_cast<int>(key.hmac_secret.size())) != 1 ||
+        RAND_bytes(key.aes_key.data(), static_cast<int>(key.aes_key.size())) != 1) {
+        throw std::runtime_error("Failed to generate session ticket key");
+    }
+    return key;
+}
+
+std::vector<TicketKeyRing::Key> TicketKeyRing::parse_keys(std::string_view data) {
+    if (data.empty() || data.size() % KEY_FILE_RECORD != 0) {
+        throw std::runtime_error("Session ticket key data must be a multiple of " +
+                                 std::to_string(KEY_FILE_RECORD) + " bytes");
+    }
+
+    std::vector<Key> keys(data.size() / KEY_FILE_RECORD);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const char* record = data.data() + i * KEY_FILE_RECORD;
+        std::memcpy(keys[i].name.data(), record, KEY_NAME_SIZE);
+        std::memcpy(keys[i].hmac_secret.data(), record + KEY_NAME_SIZE, SECRET_SIZE);
+        std::memcpy(keys[i].aes_key.data(), record + KEY_NAME_SIZE + SECRET_SIZE, SECRET_SIZE);
+    }
+    return keys;
+}
+
+std::vector<TicketKeyRing::Key> TicketKeyRing::read_key_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good()) {
+        throw std::runtime_error("Session ticket key file not found: " + path);
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto keys = parse_keys(data);
+    OPENSSL_cleanse(data.data(), data.size());
+    return keys;
+}
+
+void TicketKeyRing::load_file(const std::string& path) {
+    auto keys = read_key_file(path);
+    size_t count = keys.size();
+
+    std::unique_lock lock(mutex_);
+    keys_ = std::move(keys);
+    key_file_ = path;
+    next_rotation_ = std::chrono::steady_clock::now() + rotation_period_;
+    lock.unlock();
+
+    std::cout << "Loaded " << count << " session ticket key(s): " << path << std::endl;
+}
+
+void TicketKeyRing::rotate() {
+    std::string path;
+    {
+        std::shared_lock lock(mutex_);
+        path = key_file_;
+    }
+
+    // Read outside the lock so handshakes keep using the current keys meanwhile
+    std::vector<Key> keys;
+    if (!path.empty()) {
+        try {
+            keys = read_key_file(path);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: keeping current session ticket keys: " << e.what()
+                      << std::endl;
+        }
+    } else {
+        keys.push_back(generate_key());
+    }
+
+    std::unique_lock lock(mutex_);
+    if (path.empty()) {
+        // New key encrypts; the previous ones still decrypt outstanding tickets
+        size_t retained = std::min(keys_.size(), RETAINED_KEYS);
+        keys.insert(keys.end(), keys_.begin(), keys_.begin() + static_cast<ptrdiff_t>(retained));
+    }
+    if (!keys.empty()) {
+        keys_ = std::move(keys);
+    }
+    next_rotation_ = std::chrono::steady_clock::now() + rotation_period_;
+}
+
+TicketKeyRing::Key TicketKeyRing::encryption_key() {
+    if (rotation_period_.count() > 0) {
+        bool due = false;
+        {
+            std::shared_lock lock(mutex_);
+            due = std::chrono::steady_clock::now() >= next_rotation_;
+        }
+        if (due) {
+            rotate();
+        }
+    }
+
+    std::shared_lock lock(mutex_);
+    return keys_.front();
+}
+
+std::optional<TicketKeyRing::Key> TicketKeyRing::find(const unsigned char* name,
+                                                      bool& current) const {
+    std::shared_lock lock(mutex_);
+    for (size_t i = 0; i < keys_.size(); ++i) {
+        if (std::memcmp(keys_[i].name.data(), name, KEY_NAME_SIZE) == 0) {
+            current = i == 0;
+            return keys_[i];
+        }
+    }
+    return std::nullopt;
+}
+
+size_t TicketKeyRing::size() const {
+    std::shared_lock lock(mutex_);
+    return keys_.size();
+}
+
+void TicketKeyRing::install(SSL_CTX* ctx) {
+    SSL_CTX_set_ex_data(ctx, ticket_ring_index(), this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_callback);
+#endif
+}
+
+// SharedSessionCache
+
+struct SharedSessionCache::Header {
+    static constexpr uint64_t MAGIC = 0x66697368544c5331; // "fishTLS1"
+
+    uint64_t magic;
+    uint64_t slots;
+    pthread_mutex_t mutex;
+};
+
+struct SharedSessionCache::Slot {
+    int64_t expires; // 0 when empty
+    uint32_t id_length;
+    uint32_t session_length;
+    unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    unsigned char session[MAX_SESSION_SIZE];
+};
+
+/**
+ * Holds the table mutex; recovers it if the previous owner died holding it
+ */
+class SharedSessionCache::Lock {
+  public:
+    explicit Lock(Header* header) : mutex_(&header->mutex) {
+        if (pthread_mutex_lock(mutex_) == EOWNERDEAD) {
+            // The dead owner may have left one slot half-written; a torn
+            // session fails to decode and counts as a miss
+            pthread_mutex_consistent(mutex_);
+        }
+    }
+    ~Lock() { pthread_mutex_unlock(mutex_); }
+
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+  private:
+    pthread_mutex_t* mutex_;
+};
+
+SharedSessionCache::SharedSessionCache(const std::string& name, size_t slots) {
+    static_assert(sizeof(Slot) == 1024, "MAX_SESSION_SIZE should fill a 1 KiB slot");
+    if (slots == 0) {
+        throw std::runtime_error("Session cache needs at least one slot");
+    }
+    mapping_size_ = sizeof(Header) + slots * sizeof(Slot);
+
+    std::string path = segment_name(name);
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open session cache " + path + ": " +
+                                 std::strerror(errno));
+    }
+
+    // Serialize first-time setup between processes starting together
+    flock(fd, LOCK_EX);
+    struct stat info{};
+    bool created = fstat(fd, &info) == 0 && info.st_size == 0;
+    std::string error;
+    if (created && ftruncate(fd, static_cast<off_t>(mapping_size_)) != 0) {
+        error = std::string("resize failed: ") + std::strerror(errno);
+    } else if (!created && static_cast<size_t>(info.st_size) != mapping_size_) {
+        error = "exists with a different size";
+    } else {
+        mapping_ = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping_ == MAP_FAILED) {
+            mapping_ = nullptr;
+            error = std::string("mmap failed: ") + std::strerror(errno);
+        }
+    }
+
+    if (mapping_) {
+        header_ = static_cast<Header*>(mapping_);
+        slots_ = reinterpret_cast<Slot*>(static_cast<char*>(mapping_) + sizeof(Header));
+        if (created) {
+            // ftruncate zero-fills, so every slot starts out empty
+            pthread_mutexattr_t attributes;
+            pthread_mutexattr_init(&attributes);
+            pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&header_->mutex, &attributes);
+            pthread_mutexattr_destroy(&attributes);
+            header_->slots = slots;
+            header_->magic = Header::MAGIC;
+        } else if (header_->magic != Header::MAGIC || header_->slots != slots) {
+            error = "not a session cache of this size";
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (!error.empty()) {
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+        throw std::runtime_error("Session cache " + path + ": " + error);
+    }
+}
+
+SharedSessionCache::~SharedSessionCache() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+SharedSessionCache::Slot& SharedSessionCache::slot_for(std::span<const unsigned char> id) const {
+    // FNV-1a rather than std::hash, so every binary sharing the segment agrees
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char byte : id) {
+        hash = (hash ^ byte) * 0x100000001b3;
+    }
+    return slots_[hash % header_->slots];
+}
+
+bool SharedSessionCache::store(std::span<const unsigned char> id,
+                               std::span<const unsigned char> session, int64_t expires) {
+    if (id.empty() || id.size() > SSL_MAX_SSL_SESSION_ID_LENGTH ||
+        session.size() > MAX_SESSION_SIZE) {
+        return false;
+    }
+
+    Slot& slot = slot_for(id);
+    Lock lock(header_);
+    slot.expires = expires;
+    slot.id_length = static_cast<uint32_t>(id.size());
+    slot.session_length = static_cast<uint32_t>(session.size());
+    std::memcpy(slot.id, id.data(), id.size());
+    std::memcpy(slot.session, session.data(), session.size());
+    return true;
+}
+
+std::vector<unsigned char> SharedSessionCache::lookup(std::span<const unsigned char> id,
+                                                      int64_t now) const {
+    if (id.empty() || id.size() > SSL_MAX_SSL_SESSION_ID_LENGTH) {
+        return {};
+    }
+
+    const Slot& slot = slot_for(id);
+    Lock lock(header_);
+    if (slot.expires <= now || slot.id_length != id.size() ||
+        std::memcmp(slot.id, id.data(), id.size()) != 0) {
+        return {};
+    }
+    return std::vector<unsigned char>(slot.session,
+                                      slot.session + std::min<size_t>(slot.session_length,
+                                                                      MAX_SESSION_SIZE));
+}
+
+void SharedSessionCache::remove(std::span<const unsigned char> id) {
+    if (id.empty() || id.size() > SSL_MAX_SSL_SESSION_ID_LENGTH) {
+        return;
+    }
+
+    Slot& slot = slot_for(id);
+    Lock lock(header_);
+    if (slot.id_length == id.size() && std::memcmp(slot.id, id.data(), id.size()) == 0) {
+        slot.expires = 0;
+    }
+}
+
+void SharedSessionCache::install(SSL_CTX* ctx) {
+    SSL_CTX_set_ex_data(ctx, session_cache_index(), this);
+    SSL_CTX_sess_set_new_cb(ctx, new_session_callback);
+    SSL_CTX_sess_set_get_cb(ctx, get_session_callback);
+    SSL_CTX_sess_set_remove_cb(ctx, remove_session_callback);
+}
+
+void SharedSessionCache::unlink(const std::string& name) {
+    shm_unlink(segment_name(name).c_str());
+}
@@ -0,0 +1,166 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <openssl/ssl.h>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Session ticket keys shared by every connection on an SSL_CTX
+ *
+ * OpenSSL's default ticket key is random per SSL_CTX and never changes, so a
+ * ticket issued by one process can't be resumed by another and a leaked key
+ * decrypts every ticket ever issued. The ring owns the keys instead: the newest
+ * key encrypts new tickets, older keys only decrypt, and a ticket under an older
+ * key is reissued under the newest one when it is used.
+ *
+ * Keys are either generated in-process or read from a key file, so every
+ * worker and instance loading the same file accepts each other's tickets.
+ * Either way they rotate every rotation period: generated keys are replaced and
+ * the file is re-read, as whoever distributes it rotates its contents.
+ *
+ * The key file format matches nginx's ssl_session_ticket_key: 80 bytes per key
+ * (16-byte name, 32-byte HMAC-SHA256 secret, 32-byte AES-256 key), several keys
+ * back to back, the first one encrypting. Thread-safe.
+ */
+class TicketKeyRing {
+  public:
+    static constexpr size_t KEY_NAME_SIZE = 16;
+    static constexpr size_t SECRET_SIZE = 32;
+    static constexpr size_t KEY_FILE_RECORD = KEY_NAME_SIZE + 2 * SECRET_SIZE;
+    static constexpr size_t RETAINED_KEYS = 2; // Generated keys kept after they stop encrypting
+
+    struct Key {
+        std::array<unsigned char, KEY_NAME_SIZE> name{};
+        std::array<unsigned char, SECRET_SIZE> hmac_secret{};
+        std::array<unsigned char, SECRET_SIZE> aes_key{};
+    };
+
+    /**
+     * @param rotation_period Time between rotations (0 never rotates)
+     */
+    explicit TicketKeyRing(std::chrono::seconds rotation_period);
+
+    /**
+     * Take keys from a file instead of generating them; re-read on rotation
+     * @throws std::runtime_error if the file can't be read or holds no valid key
+     */
+    void load_file(const std::string& path);
+
+    /**
+     * Rotate now: re-read the key file, or generate a new encrypting key and
+     * drop the oldest. A key file that fails to reload leaves the keys as they are.
+     */
+    void rotate();
+
+    /**
+     * Key for new tickets, rotating first if the period has elapsed
+     */
+    Key encryption_key();
+
+    /**
+     * Find the key a ticket was issued under
+     * @param current Set to whether it is still the encrypting key
+     */
+    std::optional<Key> find(const unsigned char* name, bool& current) const;
+
+    size_t size() const;
+
+    /**
+     * Make the ring ctx's ticket key callback. The ring must outlive ctx.
+     */
+    void install(SSL_CTX* ctx);
+
+    /**
+     * Parse key file contents
+     * @throws std::runtime_error unless data is a non-empty multiple of KEY_FILE_RECORD
+     */
+    static std::vector<Key> parse_keys(std::string_view data);
+
+  private:
+    static Key generate_key();
+    static std::vector<Key> read_key_file(const std::string& path);
+
+    mutable std::shared_mutex mutex_;
+    std::vector<Key> keys_; // keys_[0] encrypts
+    std::string key_file_;
+    std::chrono::seconds rotation_period_;
+    std::chrono::steady_clock::time_point next_rotation_;
+};
+
+/**
+ * TLS 1.2 session-ID cache in POSIX shared memory
+ *
+ * Clients that resume by session ID rather than by ticket need the server to
+ * remember their session. OpenSSL's internal cache lives in one SSL_CTX in one
+ * process, so it stays disabled and sessions go to a fixed-size table in a
+ * named shared memory segment that every process opening the same name uses.
+ * Slots are direct-mapped by session ID hash and a colliding session replaces
+ * the older one. A process-shared robust mutex guards the table, so a process
+ * dying mid-update can't wedge the others.
+ */
+class SharedSessionCache {
+  public:
+    static constexpr size_t DEFAULT_SLOTS = 8192;
+    static constexpr size_t MAX_SESSION_SIZE = 1024 - 48; // Encoded session; slots are 1 KiB
+
+    /**
+     * Open the segment, creating it if no other process has yet
+     * @param name Segment name (shm_open, a leading '/' is added if missing)
+     * @param slots Table size; must match processes already using the segment
+     * @throws std::runtime_error if the segment can't be opened or mapped, or
+     *         exists with a different size
+     */
+    explicit SharedSessionCache(const std::string& name, size_t slots = DEFAULT_SLOTS);
+    ~SharedSessionCache();
+
+    SharedSessionCache(const SharedSessionCache&) = delete;
+    SharedSessionCache& operator=(const SharedSessionCache&) = delete;
+
+    /**
+     * Store an encoded session (i2d_SSL_SESSION)
+     * @param expires Unix time after which lookups miss
+     * @return false if the session ID or encoding doesn't fit a slot
+     */
+    bool store(std::span<const unsigned char> id, std::span<const unsigned char> session,
+               int64_t expires);
+
+    /**
+     * Encoded session stored under id, or empty if missing or expired at now
+     */
+    std::vector<unsigned char> lookup(std::span<const unsigned char> id, int64_t now) const;
+
+    void remove(std::span<const unsigned char> id);
+
+    /**
+     * Make the cache ctx's external session cache. The cache must outlive ctx.
+     */
+    void install(SSL_CTX* ctx);
+
+    /**
+     * Delete a segment's name; processes that have it mapped keep using it
+     */
+    static void unlink(const std::string& name);
+
+  private:
+    struct Header;
+    struct Slot;
+    class Lock;
+
+    Slot& slot_for(std::span<const unsigned char> id) const;
+
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    Header* header_ = nullptr;
+    Slot* slots_ = nullptr;
+};
+
+#endif // TLS_SESSION_H
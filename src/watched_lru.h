@@ -0,0 +1,145 @@
+#ifndef WATCHED_LRU_H
+#define WATCHED_LRU_H
+
+#include "directory_watcher.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * The entries of a cache of paths, least recently used first out, kept
+ * fresh by a DirectoryWatcher; OpenFileCache and NegativeCache are built on
+ * it
+ *
+ * It has no lock of its own: the cache holds its lock around every call,
+ * and takes the same lock in the watcher's callback. Entries are looked up
+ * with the lock held but made without it, so every invalidation bumps a
+ * generation, and put() only keeps an entry if none happened since the
+ * generation it was made at was read.
+ */
+template <typename Value> class WatchedLru {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string key;
+        Value value;
+        Clock::time_point expires;
+    };
+
+    /**
+     * Drop every entry and stop watching every directory, for new options,
+     * starting the watcher the first time the cache is enabled
+     * @return false if the watcher was just started but can't use inotify
+     */
+    bool configure(bool enabled, uint32_t mask, DirectoryWatcher::Callback callback) {
+        invalidate_all();
+        if (watcher_) {
+            watcher_->clear();
+            return true;
+        }
+        if (!enabled) {
+            return true;
+        }
+        watcher_ = std::make_unique<DirectoryWatcher>(mask, std::move(callback));
+        return watcher_->active();
+    }
+
+    // Nullptr until the cache is first enabled
+    DirectoryWatcher* watcher() const { return watcher_.get(); }
+
+    // Whether changes are seen through inotify
+    bool watching() const { return watcher_ && watcher_->active(); }
+
+    uint64_t generation() const { return generation_; }
+
+    // A key's entry, made the most recently used, or nullptr
+    Entry* find(std::string_view key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return nullptr;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return &*it->second;
+    }
+
+    /**
+     * Keep an entry made since generation() returned generation, dropping
+     * the least recently used beyond max_entries
+     * @return true if the key is new; false if it was updated, or something
+     *         was invalidated meanwhile and the entry wasn't kept
+     */
+    bool put(uint64_t generation, std::string_view key, Value value, Clock::time_point expires,
+             size_t max_entries) {
+        if (generation != generation_) {
+            return false;
+        }
+        if (Entry* entry = find(key)) {
+            entry->value = std::move(value);
+            entry->expires = expires;
+            return false;
+        }
+        lru_.push_front(Entry{std::string(key), std::move(value), expires});
+        index_.emplace(lru_.front().key, lru_.begin());
+        while (index_.size() > max_entries) {
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+        return true;
+    }
+
+    // Drop an expired or unwanted entry
+    void erase(std::string_view key) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+    }
+
+    // Drop an entry whose path changed
+    void invalidate(std::string_view key) {
+        ++generation_;
+        erase(key);
+    }
+
+    // Drop the entries whose path changed, those for which changed(entry) is true
+    template <typename Predicate> void invalidate_if(Predicate changed) {
+        ++generation_;
+        for (auto it = lru_.begin(); it != lru_.end();) {
+            if (changed(std::as_const(*it))) {
+                index_.erase(it->key);
+                it = lru_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void invalidate_all() {
+        ++generation_;
+        lru_.clear();
+        index_.clear();
+    }
+
+    size_t size() const { return index_.size(); }
+
+    // Most recently used first
+    auto begin() const { return lru_.cbegin(); }
+    auto end() const { return lru_.cend(); }
+
+  private:
+    std::list<Entry> lru_;
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index_; // Views keys
+    uint64_t generation_ = 0;
+    // Last, so its thread stops before the entries it invalidates go
+    std::unique_ptr<DirectoryWatcher> watcher_;
+};
+
+#endif // WATCHED_LRU_H
@@ -1,18 +1,32 @@
 #include "webserver.h"
 #include "asio_server.h"
 #include "asio_ssl_server.h"
+#include "blocking_pool.h"
+#include "fastcgi.h"
+#include "metrics_server.h"
+#include "negative_cache.h"
+#include "open_file_cache.h"
+#include "proxy.h"
+#include "response_cache.h"
 #include "ssl_context.h"
+#include "websocket_deflate.h"
+#include "websocket_hub.h"
 #ifdef HAVE_NGHTTP2
 #include "http2_server.h"
 #endif
+#include <algorithm>
 #include <argparse.hpp>
+#include <chrono>
 #include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <ranges>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 #ifndef GIT_HASH
 #define GIT_HASH "unknown"
@@ -102,14 +116,55 @@ void controlBreak(int sigNo) {
  * Parses command line options using argparse.
  */
 struct CommandLineArgs {
-    int port;             // HTTP port
-    bool daemon;          // Run as daemon
-    bool use_ssl;         // Enable SSL/TLS
-    bool use_http2;       // Enable HTTP/2
-    int ssl_port;         // HTTPS port (default: 443)
-    std::string ssl_cert; // Path to SSL certificate
-    std::string ssl_key;  // Path to SSL private key
-    std::string ssl_dh;   // Path to DH parameters (optional)
+    int port;                    // HTTP port
+    bool daemon;                 // Run as daemon
+    bool use_ssl;                // Enable SSL/TLS
+    bool use_http2;              // Enable HTTP/2
+    int ssl_port;                // HTTPS port (default: 443)
+    std::string ssl_cert;        // Path to SSL certificate
+    std::string ssl_key;         // Path to SSL private key
+    std::string ssl_dh;          // Path to DH parameters (optional)
+    bool ktls;                   // Kernel TLS offload for HTTPS
+    std::string ticket_key_file; // Session ticket keys shared between processes
+    int ticket_rotation;         // Seconds between ticket key rotations
+    std::string session_cache;   // Shared memory TLS session cache name
+    int metrics_port;            // Prometheus metrics port (0 = disabled)
+    std::string metrics_address; // Address the metrics endpoint binds to
+    int blocking_threads;        // Workers for file I/O, hashing and compression
+    int pubsub_threads;          // WebSocket hub shards
+    int pubsub_queue;            // Frames queued per pub/sub subscriber
+    std::string pubsub_slow;     // What happens to a subscriber whose queue is full
+    bool ws_deflate;             // Offer permessage-deflate to WebSocket clients
+    int ws_deflate_level;        // zlib compression level
+    int ws_deflate_window;       // LZ77 window bits
+    int ws_deflate_min_size;     // Smallest message worth compressing
+    int ws_deflate_takeover;     // Connections above which context takeover is refused
+    std::string fastcgi;         // Unix socket of the FastCGI application (empty = none)
+    std::string fastcgi_ext;     // Comma-separated extensions forwarded to it
+    int fastcgi_connections;     // Connections to the application per server thread
+    int fastcgi_streams;         // Requests multiplexed on one connection
+    int fastcgi_timeout;         // Seconds to wait for application output
+
+    std::vector<std::string> proxy; // Reverse proxy routes: PREFIX=HOST:PORT[,HOST:PORT...]
+    std::string proxy_balance;      // How a route's requests are spread over its servers
+    int proxy_idle;                 // Idle upstream connections kept per server and thread
+    int proxy_timeout;              // Seconds to connect or wait for upstream data
+    int proxy_max_fails;            // Failures that take an upstream out of rotation
+    int proxy_fail_timeout;         // Seconds failures are counted over and it stays out
+
+    bool cache;             // Cache proxied and FastCGI responses
+    int cache_memory;       // Megabytes of responses kept in memory
+    int cache_max_object;   // Largest response stored, in kilobytes
+    std::string cache_disk; // Directory evicted responses move to (empty = none)
+    int cache_disk_size;    // Megabytes of responses kept on disk
+    int cache_lock_timeout; // Seconds a miss waits for another request's fetch
+
+    int open_file_cache;        // Static file descriptors and stats kept open (0 = off)
+    int open_file_cache_valid;  // Seconds an entry is used before its file is checked
+    int open_file_cache_errors; // Seconds a missing file is remembered (0 = never)
+
+    int negative_cache;       // Missing paths answered with a prepared 404 (0 = off)
+    int negative_cache_valid; // Seconds a missing path is answered without looking again
 };
 
 CommandLineArgs parseCommandLineOptions(int argc, char* argv[]) {
@@ -157,6 +212,233 @@ CommandLineArgs parseCommandLineOptions(int argc, char* argv[]) {
         .default_value(std::string("ssl/dhparam.pem"))
         .metavar("FILE");
 
+    program.add_argument("--ktls")
+        .help("offload TLS record encryption to the kernel (Linux kTLS) when supported")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--ssl-ticket-key")
+        .help("session ticket key file shared by all instances (80-byte keys, first encrypts)")
+        .default_value(std::string(""))
+        .metavar("FILE");
+
+    program.add_argument("--ssl-ticket-rotation")
+        .help("seconds between session ticket key rotations (0 never rotates)")
+        .default_value(3600)
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    program.add_argument("--ssl-session-cache")
+        .help("shared memory segment for a TLS 1.2 session cache shared by all processes")
+        .default_value(std::string(""))
+        .metavar("NAME");
+
+    program.add_argument("--metrics-port")
+        .help("serve Prometheus metrics at /metrics on this port (0 disables)")
+        .default_value(0)
+        .scan<'i', int>()
+        .metavar("PORT");
+
+    program.add_argument("--metrics-address")
+        .help("address for the metrics endpoint")
+        .default_value(std::string("127.0.0.1"))
+        .metavar("ADDR");
+
+    program.add_argument("--blocking-threads")
+        .help("worker threads for file I/O, password hashing and compression (0 runs them on "
+              "the event loop)")
+        .default_value(static_cast<int>(BlockingPool::DEFAULT_THREADS))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--pubsub-threads")
+        .help("threads serving WebSocket /pubsub/ subscribers")
+        .default_value(static_cast<int>(WebSocketHub::Options{}.shards))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--pubsub-queue")
+        .help("frames queued per pub/sub subscriber before the slow consumer policy applies")
+        .default_value(static_cast<int>(WebSocketHub::Options{}.queue_limit))
+        .scan<'i', int>()
+        .metavar("FRAMES");
+
+    program.add_argument("--pubsub-slow-consumer")
+        .help("slow subscriber policy: drop (oldest frames) or disconnect")
+        .default_value(std::string("drop"))
+        .choices("drop", "disconnect")
+        .metavar("POLICY");
+
+    const WebSocketDeflate::Options deflate_defaults;
+    program.add_argument("--ws-deflate")
+        .help("compress WebSocket messages (permessage-deflate)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--ws-deflate-level")
+        .help("WebSocket compression level, 0-9")
+        .default_value(deflate_defaults.level)
+        .scan<'i', int>()
+        .metavar("LEVEL");
+
+    program.add_argument("--ws-deflate-window-bits")
+        .help("WebSocket compression window, 9-15 (2^BITS bytes per direction and connection)")
+        .default_value(deflate_defaults.window_bits)
+        .scan<'i', int>()
+        .metavar("BITS");
+
+    program.add_argument("--ws-deflate-min-size")
+        .help("WebSocket messages smaller than this are sent uncompressed")
+        .default_value(static_cast<int>(deflate_defaults.min_size))
+        .scan<'i', int>()
+        .metavar("BYTES");
+
+    program.add_argument("--ws-deflate-takeover-limit")
+        .help("WebSocket connections beyond which new ones compress each message independently "
+              "(no context takeover) to save memory; 0 always does")
+        .default_value(static_cast<int>(deflate_defaults.context_takeover_limit))
+        .scan<'i', int>()
+        .metavar("N");
+
+    const FastCgi::Options fastcgi_defaults;
+    program.add_argument("--fastcgi")
+        .help("Unix socket of a FastCGI application that runs scripts")
+        .default_value(std::string(""))
+        .metavar("SOCKET");
+
+    program.add_argument("--fastcgi-ext")
+        .help("comma-separated file extensions handled by the FastCGI application")
+        .default_value(std::string(".sh"))
+        .metavar("EXTS");
+
+    program.add_argument("--fastcgi-connections")
+        .help("connections to the FastCGI application per server thread")
+        .default_value(static_cast<int>(fastcgi_defaults.connections))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--fastcgi-streams")
+        .help("requests sharing one FastCGI connection, if the application multiplexes")
+        .default_value(static_cast<int>(fastcgi_defaults.streams))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--fastcgi-timeout")
+        .help("seconds to wait for output from the FastCGI application")
+        .default_value(static_cast<int>(fastcgi_defaults.timeout))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    const Proxy::Options proxy_defaults;
+    program.add_argument("--proxy")
+        .help("forward requests under PREFIX to upstream HTTP servers (repeatable)")
+        .default_value(std::vector<std::string>{})
+        .append()
+        .metavar("PREFIX=HOST:PORT[,HOST:PORT...]");
+
+    program.add_argument("--proxy-balance")
+        .help("spread requests over a route's servers: round-robin, least-conn, or hash "
+              "(consistent hashing on the request target)")
+        .default_value(std::string("round-robin"))
+        .choices("round-robin", "least-conn", "hash")
+        .metavar("METHOD");
+
+    program.add_argument("--proxy-idle")
+        .help("idle keep-alive connections kept per upstream server and server thread")
+        .default_value(static_cast<int>(proxy_defaults.idle_connections))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--proxy-timeout")
+        .help("seconds to connect to an upstream server or wait for it to send")
+        .default_value(static_cast<int>(proxy_defaults.timeout))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    program.add_argument("--proxy-max-fails")
+        .help("failures within --proxy-fail-timeout that take an upstream server out of "
+              "rotation (0 never does)")
+        .default_value(static_cast<int>(proxy_defaults.max_fails))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--proxy-fail-timeout")
+        .help("seconds failures are counted over, and a failed upstream server is left out")
+        .default_value(static_cast<int>(proxy_defaults.fail_timeout))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    const ResponseCache::Options cache_defaults;
+    program.add_argument("--cache")
+        .help("cache proxied and FastCGI GET responses that allow it (Cache-Control, Expires)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--cache-memory")
+        .help("megabytes of cached responses kept in memory")
+        .default_value(static_cast<int>(cache_defaults.memory_size >> 20))
+        .scan<'i', int>()
+        .metavar("MB");
+
+    program.add_argument("--cache-max-object")
+        .help("largest response cached, in kilobytes")
+        .default_value(static_cast<int>(cache_defaults.max_object_size >> 10))
+        .scan<'i', int>()
+        .metavar("KB");
+
+    program.add_argument("--cache-disk")
+        .help("directory cached responses move to when evicted from memory (emptied at start)")
+        .default_value(std::string(""))
+        .metavar("DIR");
+
+    program.add_argument("--cache-disk-size")
+        .help("megabytes of cached responses kept in --cache-disk")
+        .default_value(static_cast<int>(cache_defaults.disk_size >> 20))
+        .scan<'i', int>()
+        .metavar("MB");
+
+    program.add_argument("--cache-lock-timeout")
+        .help("seconds a cache miss waits for a concurrent request fetching the same response")
+        .default_value(static_cast<int>(cache_defaults.lock_timeout))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    const OpenFileCache::Options open_file_defaults;
+    program.add_argument("--open-file-cache")
+        .help("static files whose descriptor and stat are kept open between requests (0 = off)")
+        .default_value(static_cast<int>(open_file_defaults.max_entries))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--open-file-cache-valid")
+        .help("seconds a cached file is used before it is stat()ed again (inotify sees most "
+              "changes sooner)")
+        .default_value(static_cast<int>(open_file_defaults.valid))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    program.add_argument("--open-file-cache-errors")
+        .help("seconds a missing or forbidden file is remembered by the open file cache "
+              "(0 = never)")
+        .default_value(static_cast<int>(open_file_defaults.errors_valid))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
+    const NegativeCache::Options negative_defaults;
+    program.add_argument("--negative-cache")
+        .help("request paths found missing that are answered with a 404 without looking them "
+              "up again (0 = off)")
+        .default_value(static_cast<int>(negative_defaults.max_entries))
+        .scan<'i', int>()
+        .metavar("N");
+
+    program.add_argument("--negative-cache-valid")
+        .help("seconds a missing path is answered from the negative cache (inotify sees new "
+              "files sooner)")
+        .default_value(static_cast<int>(negative_defaults.valid))
+        .scan<'i', int>()
+        .metavar("SECONDS");
+
     try {
         program.parse_args(argc, argv);
     } catch (const std::runtime_error& err) {
@@ -174,7 +456,44 @@ CommandLineArgs parseCommandLineOptions(int argc, char* argv[]) {
             .ssl_port = program.get<int>("--ssl-port"),
             .ssl_cert = program.get<std::string>("--ssl-cert"),
             .ssl_key = program.get<std::string>("--ssl-key"),
-            .ssl_dh = program.get<std::string>("--ssl-dh")};
+            .ssl_dh = program.get<std::string>("--ssl-dh"),
+            .ktls = program.get<bool>("--ktls"),
+            .ticket_key_file = program.get<std::string>("--ssl-ticket-key"),
+            .ticket_rotation = program.get<int>("--ssl-ticket-rotation"),
+            .session_cache = program.get<std::string>("--ssl-session-cache"),
+            .metrics_port = program.get<int>("--metrics-port"),
+            .metrics_address = program.get<std::string>("--metrics-address"),
+            .blocking_threads = program.get<int>("--blocking-threads"),
+            .pubsub_threads = program.get<int>("--pubsub-threads"),
+            .pubsub_queue = program.get<int>("--pubsub-queue"),
+            .pubsub_slow = program.get<std::string>("--pubsub-slow-consumer"),
+            .ws_deflate = program.get<bool>("--ws-deflate"),
+            .ws_deflate_level = program.get<int>("--ws-deflate-level"),
+            .ws_deflate_window = program.get<int>("--ws-deflate-window-bits"),
+            .ws_deflate_min_size = program.get<int>("--ws-deflate-min-size"),
+            .ws_deflate_takeover = program.get<int>("--ws-deflate-takeover-limit"),
+            .fastcgi = program.get<std::string>("--fastcgi"),
+            .fastcgi_ext = program.get<std::string>("--fastcgi-ext"),
+            .fastcgi_connections = program.get<int>("--fastcgi-connections"),
+            .fastcgi_streams = program.get<int>("--fastcgi-streams"),
+            .fastcgi_timeout = program.get<int>("--fastcgi-timeout"),
+            .proxy = program.get<std::vector<std::string>>("--proxy"),
+            .proxy_balance = program.get<std::string>("--proxy-balance"),
+            .proxy_idle = program.get<int>("--proxy-idle"),
+            .proxy_timeout = program.get<int>("--proxy-timeout"),
+            .proxy_max_fails = program.get<int>("--proxy-max-fails"),
+            .proxy_fail_timeout = program.get<int>("--proxy-fail-timeout"),
+            .cache = program.get<bool>("--cache"),
+            .cache_memory = program.get<int>("--cache-memory"),
+            .cache_max_object = program.get<int>("--cache-max-object"),
+            .cache_disk = program.get<std::string>("--cache-disk"),
+            .cache_disk_size = program.get<int>("--cache-disk-size"),
+            .cache_lock_timeout = program.get<int>("--cache-lock-timeout"),
+            .open_file_cache = program.get<int>("--open-file-cache"),
+            .open_file_cache_valid = program.get<int>("--open-file-cache-valid"),
+            .open_file_cache_errors = program.get<int>("--open-file-cache-errors"),
+            .negative_cache = program.get<int>("--negative-cache"),
+            .negative_cache_valid = program.get<int>("--negative-cache-valid")};
 }
 
 /**
@@ -202,6 +521,14 @@ int main(int argc, char* argv[]) {
 
     setupSignals();
 
+    // A relative socket or cache path names a file in the starting directory
+    if (!args.fastcgi.empty()) {
+        args.fastcgi = std::filesystem::absolute(args.fastcgi).string();
+    }
+    if (!args.cache_disk.empty()) {
+        args.cache_disk = std::filesystem::absolute(args.cache_disk).string();
+    }
+
     // Change to base directory if it exists and we're not already in it
     try {
         auto current = std::filesystem::current_path();
@@ -222,6 +549,90 @@ int main(int argc, char* argv[]) {
 
     createPidFile("fishjelly.pid", pid);
 
+    // Started on first use, after daemonizing
+    BlockingPool::configure(static_cast<size_t>(std::max(args.blocking_threads, 0)));
+    WebSocketDeflate::Options deflate{
+        .enabled = args.ws_deflate,
+        .window_bits = std::clamp(args.ws_deflate_window, 9, 15),
+        .level = std::clamp(args.ws_deflate_level, 0, 9),
+        .mem_level = WebSocketDeflate::Options{}.mem_level,
+        .min_size = static_cast<size_t>(std::max(args.ws_deflate_min_size, 0)),
+        .context_takeover_limit = static_cast<size_t>(std::max(args.ws_deflate_takeover, 0))};
+    WebSocketDeflate::configure(deflate);
+    WebSocketHub::configure({.shards = static_cast<size_t>(std::max(args.pubsub_threads, 1)),
+                             .queue_limit = static_cast<size_t>(std::max(args.pubsub_queue, 1)),
+                             .policy = args.pubsub_slow == "disconnect"
+                                           ? WebSocketHub::SlowConsumerPolicy::Disconnect
+                                           : WebSocketHub::SlowConsumerPolicy::DropOldest,
+                             .deflate = deflate});
+    FastCgi::Options fastcgi{
+        .enabled = !args.fastcgi.empty(),
+        .socket = args.fastcgi,
+        .extensions = {},
+        .connections = static_cast<size_t>(std::max(args.fastcgi_connections, 1)),
+        .streams = static_cast<size_t>(std::max(args.fastcgi_streams, 1)),
+        .timeout = static_cast<size_t>(std::max(args.fastcgi_timeout, 1))};
+    for (const auto& extension : std::views::split(args.fastcgi_ext, ',')) {
+        if (!extension.empty()) {
+            fastcgi.extensions.emplace_back(extension.begin(), extension.end());
+        }
+    }
+    FastCgi::configure(fastcgi);
+
+    Proxy::Options proxy{
+        .routes = {},
+        .balance = args.proxy_balance == "least-conn" ? Proxy::Balance::LeastConnections
+                   : args.proxy_balance == "hash"     ? Proxy::Balance::ConsistentHash
+                                                      : Proxy::Balance::RoundRobin,
+        .idle_connections = static_cast<size_t>(std::max(args.proxy_idle, 0)),
+        .timeout = static_cast<size_t>(std::max(args.proxy_timeout, 1)),
+        .max_fails = static_cast<size_t>(std::max(args.proxy_max_fails, 0)),
+        .fail_timeout = static_cast<size_t>(std::max(args.proxy_fail_timeout, 1))};
+    for (const std::string& spec : args.proxy) {
+        auto route = Proxy::parse_route(spec);
+        if (!route) {
+            std::cerr << "Error: --proxy " << spec << " is not PREFIX=HOST:PORT[,HOST:PORT...]"
+                      << std::endl;
+            return 1;
+        }
+        proxy.routes.push_back(std::move(*route));
+    }
+    if (auto error = Proxy::configure(proxy)) {
+        std::cerr << "Error: " << *error << std::endl;
+        return 1;
+    }
+    ResponseCache::Options cache{
+        .enabled = args.cache,
+        .memory_size = static_cast<size_t>(std::max(args.cache_memory, 1)) << 20,
+        .max_object_size = static_cast<size_t>(std::max(args.cache_max_object, 1)) << 10,
+        .disk_path = args.cache_disk,
+        .disk_size = static_cast<size_t>(std::max(args.cache_disk_size, 0)) << 20,
+        .lock_timeout = static_cast<size_t>(std::max(args.cache_lock_timeout, 0))};
+    if (auto error = ResponseCache::configure(cache)) {
+        std::cerr << "Error: " << *error << std::endl;
+        return 1;
+    }
+    OpenFileCache::configure(
+        {.max_entries = static_cast<size_t>(std::max(args.open_file_cache, 0)),
+         .valid = static_cast<size_t>(std::max(args.open_file_cache_valid, 0)),
+         .errors_valid = static_cast<size_t>(std::max(args.open_file_cache_errors, 0))});
+    NegativeCache::configure(
+        {.max_entries = static_cast<size_t>(std::max(args.negative_cache, 0)),
+         .valid = static_cast<size_t>(std::max(args.negative_cache_valid, 0))});
+
+    // Internal metrics endpoint on its own thread (started after daemonizing)
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (args.metrics_port > 0) {
+        try {
+            metrics_server = std::make_unique<MetricsServer>(args.metrics_address,
+                                                             args.metrics_port);
+            metrics_server->start();
+        } catch (const std::exception& e) {
+            std::cerr << "Metrics Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     // Check for HTTP/2 requirements
     if (args.use_http2) {
 #ifndef HAVE_NGHTTP2
@@ -259,6 +670,14 @@ int main(int argc, char* argv[]) {
             if (std::filesystem::exists(args.ssl_dh)) {
                 ssl_context.load_dh_params(args.ssl_dh);
             }
+            if (args.ktls) {
+                ssl_context.enable_ktls();
+            }
+            ssl_context.enable_session_tickets(
+                std::chrono::seconds(std::max(args.ticket_rotation, 0)), args.ticket_key_file);
+            if (!args.session_cache.empty()) {
+                ssl_context.enable_shared_session_cache(args.session_cache);
+            }
 
             AsioSSLServer server(args.ssl_port, ssl_context);
             server.run();
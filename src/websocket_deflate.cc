@@ -0,0 +1,249 @@
+#include "websocket_deflate.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+
+namespace zlib = boost::beast::zlib;
+
+namespace {
+
+// Output grows by this much while inflating
+constexpr size_t INFLATE_CHUNK = 16 * 1024;
+
+// Appended to every compressed message before inflating (RFC 7692 7.2.2)
+constexpr std::array<char, 4> SYNC_TAIL = {'\x00', '\x00', '\xFF', '\xFF'};
+
+WebSocketDeflate::Options& configuredOptions() {
+    static WebSocketDeflate::Options options;
+    return options;
+}
+
+// zlib silently treats a window of 8 as 9, so 9 is the smallest usable
+int clamp_window_bits(int bits) { return std::clamp(bits, 9, 15); }
+
+std::string_view trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) ==
+               std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+// Window bits parameter value: 8..15, optionally quoted
+std::optional<int> parse_bits(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    int bits = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), bits);
+    if (ec != std::errc() || end != value.data() + value.size() || bits < 8 || bits > 15) {
+        return std::nullopt;
+    }
+    return bits;
+}
+
+/**
+ * Parse one offer ("permessage-deflate; param[=value]; ...") into an
+ * accepted parameter set, or nothing if it can't be accepted
+ */
+std::optional<WebSocketDeflate::Params> accept_offer(std::string_view offer,
+                                                     const WebSocketDeflate::Options& options,
+                                                     bool server_context_takeover,
+                                                     bool client_context_takeover) {
+    size_t semicolon = offer.find(';');
+    if (!iequals(trim(offer.substr(0, semicolon)), "permessage-deflate")) {
+        return std::nullopt;
+    }
+
+    WebSocketDeflate::Params params;
+    int bits = clamp_window_bits(options.window_bits);
+    params.server_max_window_bits = bits;
+    bool server_takeover_seen = false;
+    bool client_takeover_seen = false;
+    std::optional<int> client_bits;
+    while (semicolon != std::string_view::npos) {
+        offer.remove_prefix(semicolon + 1);
+        semicolon = offer.find(';');
+        std::string_view param = trim(offer.substr(0, semicolon));
+        size_t equals = param.find('=');
+        std::string_view name = trim(param.substr(0, equals));
+        std::optional<std::string_view> value;
+        if (equals != std::string_view::npos) {
+            value = trim(param.substr(equals + 1));
+        }
+
+        if (iequals(name, "server_no_context_takeover") && !value && !server_takeover_seen) {
+            server_takeover_seen = true;
+            params.server_no_context_takeover = true;
+        } else if (iequals(name, "client_no_context_takeover") && !value &&
+                   !client_takeover_seen) {
+            client_takeover_seen = true;
+            params.client_no_context_takeover = true;
+        } else if (iequals(name, "server_max_window_bits") && value &&
+                   !params.server_max_window_bits_offered) {
+            auto offered = parse_bits(*value);
+            // Our compressor's window can't shrink per client
+            if (!offered || *offered < bits) {
+                return std::nullopt;
+            }
+            params.server_max_window_bits_offered = true;
+        } else if (iequals(name, "client_max_window_bits") &&
+                   !params.client_max_window_bits_offered) {
+            if (value && !(client_bits = parse_bits(*value))) {
+                return std::nullopt;
+            }
+            params.client_max_window_bits_offered = true;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (!server_context_takeover) {
+        params.server_no_context_takeover = true;
+    }
+    if (!client_context_takeover) {
+        params.client_no_context_takeover = true;
+    }
+    // Without the parameter in the offer the client may use any window;
+    // with it, ours can be no larger than what it offered
+    if (params.client_max_window_bits_offered) {
+        params.client_max_window_bits = client_bits ? std::min(*client_bits, bits) : bits;
+    }
+    return params;
+}
+
+} // namespace
+
+std::string WebSocketDeflate::Params::response() const {
+    std::string response = "permessage-deflate";
+    if (server_no_context_takeover) {
+        response += "; server_no_context_takeover";
+    }
+    if (client_no_context_takeover) {
+        response += "; client_no_context_takeover";
+    }
+    if (server_max_window_bits_offered) {
+        response += "; server_max_window_bits=" + std::to_string(server_max_window_bits);
+    }
+    if (client_max_window_bits_offered) {
+        response += "; client_max_window_bits=" + std::to_string(client_max_window_bits);
+    }
+    return response;
+}
+
+const WebSocketDeflate::Options& WebSocketDeflate::options() { return configuredOptions(); }
+
+void WebSocketDeflate::configure(const Options& options) { configuredOptions() = options; }
+
+bool WebSocketDeflate::context_takeover(const Options& options, size_t connections) {
+    return connections < options.context_takeover_limit;
+}
+
+std::optional<WebSocketDeflate::Params>
+WebSocketDeflate::negotiate(std::string_view extensions, const Options& options,
+                            bool server_context_takeover, bool client_context_takeover) {
+    if (!options.enabled) {
+        return std::nullopt;
+    }
+    // Offers are comma separated, in order of the client's preference. Commas
+    // can't occur inside the values this extension defines.
+    while (!extensions.empty()) {
+        size_t comma = extensions.find(',');
+        auto params = accept_offer(extensions.substr(0, comma), options, server_context_takeover,
+                                   client_context_takeover);
+        if (params) {
+            return params;
+        }
+        extensions = comma == std::string_view::npos ? std::string_view{}
+                                                     : extensions.substr(comma + 1);
+    }
+    return std::nullopt;
+}
+
+// ============================================================================
+// Deflater / Inflater
+// ============================================================================
+
+WebSocketDeflate::Deflater::Deflater(const Options& options, int window_bits,
+                                     bool context_takeover)
+    : context_takeover_(context_takeover) {
+    stream_.reset(std::clamp(options.level, 0, 9), clamp_window_bits(window_bits),
+                  std::clamp(options.mem_level, 1, 9), zlib::Strategy::normal);
+}
+
+void WebSocketDeflate::Deflater::compress(std::string_view message, std::string& out) {
+    size_t start = out.size();
+    // Room for the whole message plus the sync flush marker, so one call is
+    // normally enough
+    out.resize(start + stream_.upper_bound(message.size()) + 16);
+
+    zlib::z_params zs;
+    zs.next_in = message.data();
+    zs.avail_in = message.size();
+    size_t produced = 0;
+    while (true) {
+        zs.next_out = out.data() + start + produced;
+        zs.avail_out = out.size() - start - produced;
+        boost::system::error_code ec;
+        stream_.write(zs, zlib::Flush::sync, ec);
+        produced = zs.total_out;
+        if (zs.avail_out > 0) {
+            break; // Flushed completely
+        }
+        out.resize(out.size() * 2);
+    }
+    // Every flushed message ends in 00 00 FF FF, which is left off the wire
+    out.resize(start + produced - std::min<size_t>(produced, SYNC_TAIL.size()));
+
+    if (!context_takeover_) {
+        stream_.reset();
+    }
+}
+
+WebSocketDeflate::Inflater::Inflater(int window_bits) {
+    stream_.reset(clamp_window_bits(window_bits));
+}
+
+bool WebSocketDeflate::Inflater::decompress(std::string_view message, std::string& out,
+                                            size_t limit) {
+    size_t start = out.size();
+    zlib::z_params zs;
+    for (std::string_view input : {message, std::string_view(SYNC_TAIL.data(), SYNC_TAIL.size())}) {
+        zs.next_in = input.data();
+        zs.avail_in = input.size();
+        while (true) {
+            size_t before = out.size();
+            out.resize(before + INFLATE_CHUNK);
+            zs.next_out = out.data() + before;
+            zs.avail_out = INFLATE_CHUNK;
+            boost::system::error_code ec;
+            stream_.write(zs, zlib::Flush::sync, ec);
+            out.resize(out.size() - zs.avail_out);
+            if (out.size() - start > limit) {
+                return false;
+            }
+            if (ec == zlib::error::end_of_stream) {
+                // The client ended the deflate stream (BFINAL); the next
+                // message starts a new one
+                stream_.reset();
+                return true;
+            }
+            if (ec && ec != zlib::error::need_buffers) {
+                return false;
+            }
+            if (zs.avail_out > 0) {
+                break; // Stopped for lack of input, not of room
+            }
+        }
+    }
+    return true;
+}
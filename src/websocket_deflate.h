@@ -0,0 +1,121 @@
+#ifndef WEBSOCKET_DEFLATE_H
+#define WEBSOCKET_DEFLATE_H
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <boost/beast/zlib/inflate_stream.hpp>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * permessage-deflate (RFC 7692) settings, negotiation and codecs
+ *
+ * Compression is off unless enabled. Each compressing connection holds a
+ * deflate and an inflate window (2^window_bits bytes each, plus deflate's
+ * hash tables, which grow with mem_level). With context takeover the
+ * windows carry over from one message to the next, which compresses
+ * repetitive JSON best but keeps that memory for the connection's lifetime.
+ * Once more than context_takeover_limit WebSocket connections are open, new
+ * ones negotiate no context takeover, so every message is compressed on its
+ * own and the hub can share one compressed frame between subscribers.
+ */
+class WebSocketDeflate {
+  public:
+    struct Options {
+        bool enabled = false;
+        int window_bits = 15;                // LZ77 window, 9..15
+        int level = 6;                       // zlib compression level, 0..9
+        int mem_level = 8;                   // zlib memory level, 1..9
+        size_t min_size = 256;               // Smaller messages are sent uncompressed
+        size_t context_takeover_limit = 512; // Connections; 0 never takes over context
+
+        bool operator==(const Options&) const = default;
+    };
+
+    /**
+     * Parameters agreed with one client
+     */
+    struct Params {
+        int server_max_window_bits = 15;
+        int client_max_window_bits = 15;
+        bool server_no_context_takeover = false;
+        bool client_no_context_takeover = false;
+        bool server_max_window_bits_offered = false;
+        bool client_max_window_bits_offered = false;
+
+        /**
+         * Sec-WebSocket-Extensions value accepting these parameters
+         */
+        std::string response() const;
+    };
+
+    /**
+     * The process-wide settings used by the WebSocket handler
+     */
+    static const Options& options();
+
+    /**
+     * Set the process-wide settings; call before accepting connections
+     */
+    static void configure(const Options& options);
+
+    /**
+     * Whether a new connection may keep its compression context between
+     * messages, given how many WebSocket connections are already open
+     */
+    static bool context_takeover(const Options& options, size_t connections);
+
+    /**
+     * Pick the first acceptable permessage-deflate offer from a request's
+     * Sec-WebSocket-Extensions value. Offers with unknown or repeated
+     * parameters, or that need a server window smaller than
+     * options.window_bits, are skipped.
+     * @param server_context_takeover False to reset our compressor per message
+     * @param client_context_takeover False to ask the client to do the same
+     * @return Nothing if no offer is acceptable (or compression is disabled)
+     */
+    static std::optional<Params> negotiate(std::string_view extensions, const Options& options,
+                                           bool server_context_takeover,
+                                           bool client_context_takeover);
+
+    /**
+     * Message compressor for one direction of one connection (or, without
+     * context takeover, for any number of them)
+     */
+    class Deflater {
+      public:
+        Deflater(const Options& options, int window_bits, bool context_takeover);
+
+        /**
+         * Compress a whole message, appending the deflate data without the
+         * trailing 00 00 FF FF that RFC 7692 strips
+         */
+        void compress(std::string_view message, std::string& out);
+
+      private:
+        boost::beast::zlib::deflate_stream stream_;
+        bool context_takeover_;
+    };
+
+    /**
+     * Message decompressor for the client side of one connection. Without
+     * client context takeover a fresh one can be used for every message, so
+     * idle connections hold no window.
+     */
+    class Inflater {
+      public:
+        explicit Inflater(int window_bits);
+
+        /**
+         * Decompress a whole message, appending to out
+         * @return False if the data is corrupt or inflates past limit bytes
+         */
+        bool decompress(std::string_view message, std::string& out, size_t limit);
+
+      private:
+        boost::beast::zlib::inflate_stream stream_;
+    };
+};
+
+#endif // WEBSOCKET_DEFLATE_H
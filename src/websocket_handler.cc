@@ -1,4 +1,8 @@
 #include "websocket_handler.h"
+#include "websocket_deflate.h"
+#include "websocket_hub.h"
+#include <algorithm>
+#include <atomic>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
 #include <boost/asio/use_awaitable.hpp>
@@ -10,6 +14,47 @@ namespace websocket = beast::websocket;
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 
+namespace {
+
+// Open echo sessions; hub subscribers are counted by the hub
+std::atomic<size_t> echo_sessions{0};
+
+struct EchoSessionCount {
+    EchoSessionCount() { echo_sessions.fetch_add(1, std::memory_order_relaxed); }
+    ~EchoSessionCount() { echo_sessions.fetch_sub(1, std::memory_order_relaxed); }
+};
+
+size_t websocket_connections() {
+    return echo_sessions.load(std::memory_order_relaxed) +
+           WebSocketHub::getInstance().subscribers();
+}
+
+// Newer Beast versions can leave small messages uncompressed; older ones
+// compress every message once the extension is negotiated
+template <typename Option> void set_min_size(Option& option, size_t min_size) {
+    if constexpr (requires { option.msg_size_threshold; }) {
+        option.msg_size_threshold = min_size;
+    }
+}
+
+/**
+ * Beast's permessage-deflate settings for an echo session
+ */
+websocket::permessage_deflate echo_deflate(const WebSocketDeflate::Options& options,
+                                           bool context_takeover) {
+    websocket::permessage_deflate pmd;
+    pmd.server_enable = true;
+    pmd.server_max_window_bits = std::clamp(options.window_bits, 9, 15);
+    pmd.server_no_context_takeover = !context_takeover;
+    pmd.client_no_context_takeover = !context_takeover;
+    pmd.compLevel = std::clamp(options.level, 0, 9);
+    pmd.memLevel = std::clamp(options.mem_level, 1, 9);
+    set_min_size(pmd, options.min_size);
+    return pmd;
+}
+
+} // namespace
+
 asio::awaitable<void> WebSocketHandler::handle_session(tcp::socket socket,
                                                        const std::string& http_request) {
     try {
@@ -19,11 +64,6 @@ asio::awaitable<void> WebSocketHandler::handle_session(tcp::socket socket,
         // Set timeout options
         ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
 
-        // Set a decorator to change the Server header
-        ws.set_option(websocket::stream_base::decorator([](websocket::response_type& res) {
-            res.set(beast::http::field::server, "Fishjelly/0.6 WebSocket");
-        }));
-
         // Parse the HTTP request
         beast::http::request_parser<beast::http::string_body> parser;
         beast::error_code ec;
@@ -34,9 +74,56 @@ asio::awaitable<void> WebSocketHandler::handle_session(tcp::socket socket,
             co_return;
         }
 
+        // Requests under /pubsub/ join a topic on the hub instead of the echo loop
+        auto request_target = parser.get().target();
+        std::string_view target(request_target.data(), request_target.size());
+        std::string_view topic = WebSocketHub::topic_for(target);
+        if (topic.empty() && target.starts_with(WebSocketHub::PATH_PREFIX)) {
+            beast::http::response<beast::http::string_body> res{beast::http::status::bad_request,
+                                                                11};
+            res.set(beast::http::field::connection, "close");
+            res.body() = "Invalid pub/sub topic\n";
+            res.prepare_payload();
+            co_await beast::http::async_write(ws.next_layer(), res, asio::use_awaitable);
+            co_return;
+        }
+
+        // Beast compresses echo sessions itself. The hub frames its own
+        // messages, so for topics the extension is negotiated here and the
+        // agreed parameters are handed over with the socket.
+        std::optional<WebSocketDeflate::Params> hub_deflate;
+        if (!topic.empty()) {
+            WebSocketHub& hub = WebSocketHub::getInstance();
+            const auto& options = hub.options().deflate;
+            auto offers = parser.get()[beast::http::field::sec_websocket_extensions];
+            hub_deflate = WebSocketDeflate::negotiate(
+                std::string_view(offers.data(), offers.size()), options, false,
+                WebSocketDeflate::context_takeover(options, websocket_connections()));
+        } else if (const auto& options = WebSocketDeflate::options(); options.enabled) {
+            ws.set_option(echo_deflate(
+                options, WebSocketDeflate::context_takeover(options, websocket_connections())));
+        }
+
+        // Set a decorator to change the Server header
+        ws.set_option(
+            websocket::stream_base::decorator([&hub_deflate](websocket::response_type& res) {
+                res.set(beast::http::field::server, "Fishjelly/0.6 WebSocket");
+                if (hub_deflate) {
+                    res.set(beast::http::field::sec_websocket_extensions,
+                            hub_deflate->response());
+                }
+            }));
+
         // Accept the WebSocket handshake using the parsed request
         co_await ws.async_accept(parser.get(), asio::use_awaitable);
 
+        if (!topic.empty()) {
+            WebSocketHub::getInstance().subscribe(std::move(ws.next_layer()), std::string(topic),
+                                                  std::move(hub_deflate));
+            co_return;
+        }
+
+        EchoSessionCount session;
         std::cout << "WebSocket connection established" << std::endl;
 
         // Run the echo loop
@@ -18,6 +18,8 @@ using tcp = asio::ip::tcp;
  * Handles WebSocket connections with:
  * - Automatic upgrade from HTTP
  * - Echo server functionality
+ * - Topic subscriptions on the WebSocketHub for /pubsub/<topic>
+ * - permessage-deflate when WebSocketDeflate is enabled
  * - Ping/pong keep-alive
  * - Graceful close handling
  */
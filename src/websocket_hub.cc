@@ -0,0 +1,478 @@
+#include "websocket_hub.h"
+#include "metrics.h"
+#include <array>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <deque>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+// Frames gathered into one write (well under IOV_MAX)
+constexpr size_t MAX_WRITE_BATCH = 64;
+
+// RFC 6455 close status codes
+constexpr uint16_t CLOSE_NORMAL = 1000;
+constexpr uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+constexpr uint16_t CLOSE_TOO_BIG = 1009;
+
+WebSocketHub::Options& configuredOptions() {
+    static WebSocketHub::Options options;
+    return options;
+}
+
+// Compressor for shared frames. Without context takeover its state doesn't
+// depend on earlier messages, so each publishing thread can keep its own.
+WebSocketDeflate::Deflater& shared_deflater(const WebSocketDeflate::Options& options) {
+    thread_local std::unique_ptr<WebSocketDeflate::Deflater> deflater;
+    thread_local WebSocketDeflate::Options made_for;
+    if (!deflater || !(made_for == options)) {
+        deflater = std::make_unique<WebSocketDeflate::Deflater>(options, options.window_bits,
+                                                                false);
+        made_for = options;
+    }
+    return *deflater;
+}
+
+} // namespace
+
+/**
+ * One subscribed connection, owned by its read and write coroutines
+ *
+ * Lives entirely on its shard's thread. Frames wait in queue_ until the
+ * writer moves a batch of them to inflight_ and writes them in one go.
+ */
+class WebSocketHub::Subscriber : public std::enable_shared_from_this<Subscriber> {
+  public:
+    Subscriber(WebSocketHub& hub, Shard& shard, tcp::socket socket, std::string topic,
+               std::optional<WebSocketDeflate::Params> deflate)
+        : hub_(hub), shard_(shard), socket_(std::move(socket)), topic_(std::move(topic)),
+          deflate_(std::move(deflate)) {}
+
+    const std::string& topic() const { return topic_; }
+
+    // Register with the shard and start reading client frames
+    void start();
+
+    // Queue a published frame (the compressed one if both it and
+    // permessage-deflate are available), applying the slow consumer policy
+    void deliver(const Frame& frame, const Frame& deflated);
+
+    size_t slot = 0; // Index in the shard's list for this topic
+
+  private:
+    // Both hold self, so the subscriber lives until neither is running
+    asio::awaitable<void> read_loop(std::shared_ptr<Subscriber> self);
+    asio::awaitable<void> write_loop(std::shared_ptr<Subscriber> self);
+
+    // Handle one client frame; false once the connection should end
+    bool on_frame(ClientFrame& frame);
+
+    // Publish a complete client message; false once the connection should end
+    bool on_message(std::string& payload, uint8_t opcode, bool compressed);
+
+    // Queue a frame regardless of the queue limit (control frames)
+    void enqueue(Frame frame);
+
+    // Queue a close frame; nothing is sent after it
+    void send_close(uint16_t code);
+
+    void close();
+
+    WebSocketHub& hub_;
+    Shard& shard_;
+    tcp::socket socket_;
+    std::string topic_;
+    std::optional<WebSocketDeflate::Params> deflate_;
+    // Only exists between messages with client context takeover
+    std::unique_ptr<WebSocketDeflate::Inflater> inflater_;
+    std::deque<Frame> queue_;
+    std::vector<Frame> inflight_;
+    std::string message_;        // Fragmented message being reassembled
+    uint8_t message_opcode_ = 0; // Its opcode, 0 when none is in progress
+    bool message_compressed_ = false;
+    bool writing_ = false;
+    bool closing_ = false; // Close frame queued
+    bool closed_ = false;
+};
+
+void WebSocketHub::Subscriber::start() {
+    shard_.add(*this);
+    hub_.subscribers_.fetch_add(1, std::memory_order_relaxed);
+    if (deflate_) {
+        hub_.deflate_subscribers_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Metrics::add(Metrics::Gauge::WebSocketSubscribers, 1);
+    asio::co_spawn(socket_.get_executor(), read_loop(shared_from_this()), asio::detached);
+}
+
+void WebSocketHub::Subscriber::deliver(const Frame& frame, const Frame& deflated) {
+    if (closed_ || closing_) {
+        return;
+    }
+    if (queue_.size() >= hub_.options_.queue_limit) {
+        if (hub_.options_.policy == SlowConsumerPolicy::Disconnect) {
+            Metrics::increment(Metrics::Counter::WebSocketSlowConsumersClosed);
+            close();
+            return;
+        }
+        queue_.pop_front();
+        Metrics::increment(Metrics::Counter::WebSocketFramesDropped);
+    }
+    enqueue(deflate_ && deflated ? deflated : frame);
+}
+
+void WebSocketHub::Subscriber::enqueue(Frame frame) {
+    queue_.push_back(std::move(frame));
+    if (!writing_) {
+        writing_ = true;
+        asio::co_spawn(socket_.get_executor(), write_loop(shared_from_this()), asio::detached);
+    }
+}
+
+void WebSocketHub::Subscriber::send_close(uint16_t code) {
+    std::string payload = {static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)};
+    enqueue(std::make_shared<const std::string>(encode_frame(OPCODE_CLOSE, payload)));
+    closing_ = true;
+}
+
+void WebSocketHub::Subscriber::close() {
+    closed_ = true;
+    queue_.clear();
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+}
+
+asio::awaitable<void>
+WebSocketHub::Subscriber::read_loop([[maybe_unused]] std::shared_ptr<Subscriber> self) {
+    std::array<char, 8192> buffer;
+    std::string input;
+    bool open = true;
+    while (open) {
+        auto [ec, bytes] = co_await socket_.async_read_some(asio::buffer(buffer),
+                                                            asio::as_tuple(asio::use_awaitable));
+        if (ec) {
+            break;
+        }
+        input.append(buffer.data(), bytes);
+
+        size_t offset = 0;
+        ClientFrame frame;
+        DecodeResult result = DecodeResult::Incomplete;
+        while (open && (result = decode_client_frame(std::string_view(input).substr(offset), frame,
+                                                     deflate_.has_value())) ==
+                           DecodeResult::Complete) {
+            offset += frame.size;
+            open = on_frame(frame);
+        }
+        if (open && result == DecodeResult::Invalid) {
+            send_close(CLOSE_PROTOCOL_ERROR);
+            open = false;
+        }
+        input.erase(0, offset);
+    }
+
+    shard_.remove(*this);
+    hub_.subscribers_.fetch_sub(1, std::memory_order_relaxed);
+    if (deflate_) {
+        hub_.deflate_subscribers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    Metrics::add(Metrics::Gauge::WebSocketSubscribers, -1);
+    if (!closing_) {
+        close(); // The writer closes the socket once the close frame is out
+    }
+}
+
+bool WebSocketHub::Subscriber::on_frame(ClientFrame& frame) {
+    switch (frame.opcode) {
+    case OPCODE_PING:
+        enqueue(std::make_shared<const std::string>(encode_frame(OPCODE_PONG, frame.payload)));
+        return true;
+    case OPCODE_PONG:
+        return true;
+    case OPCODE_CLOSE:
+        send_close(CLOSE_NORMAL);
+        return false;
+    case OPCODE_TEXT:
+    case OPCODE_BINARY:
+        if (message_opcode_ != 0) {
+            break; // A new message started before the fragmented one finished
+        }
+        if (frame.fin) {
+            return on_message(frame.payload, frame.opcode, frame.compressed);
+        }
+        message_opcode_ = frame.opcode;
+        message_compressed_ = frame.compressed;
+        message_ = std::move(frame.payload);
+        return true;
+    case OPCODE_CONTINUATION:
+        if (message_opcode_ == 0) {
+            break;
+        }
+        if (message_.size() + frame.payload.size() > MAX_MESSAGE_SIZE) {
+            send_close(CLOSE_TOO_BIG);
+            return false;
+        }
+        message_ += frame.payload;
+        if (frame.fin) {
+            uint8_t opcode = std::exchange(message_opcode_, 0);
+            bool open = on_message(message_, opcode, message_compressed_);
+            message_.clear();
+            return open;
+        }
+        return true;
+    default:
+        break;
+    }
+    send_close(CLOSE_PROTOCOL_ERROR);
+    return false;
+}
+
+bool WebSocketHub::Subscriber::on_message(std::string& payload, uint8_t opcode, bool compressed) {
+    if (!compressed) {
+        hub_.publish(topic_, payload, opcode == OPCODE_BINARY);
+        return true;
+    }
+    if (!inflater_) {
+        inflater_ = std::make_unique<WebSocketDeflate::Inflater>(deflate_->client_max_window_bits);
+    }
+    std::string message;
+    bool ok = inflater_->decompress(payload, message, MAX_MESSAGE_SIZE);
+    if (deflate_->client_no_context_takeover) {
+        inflater_.reset(); // The next message starts from an empty window anyway
+    }
+    if (!ok) {
+        send_close(message.size() > MAX_MESSAGE_SIZE ? CLOSE_TOO_BIG : CLOSE_PROTOCOL_ERROR);
+        return false;
+    }
+    hub_.publish(topic_, message, opcode == OPCODE_BINARY);
+    return true;
+}
+
+asio::awaitable<void>
+WebSocketHub::Subscriber::write_loop([[maybe_unused]] std::shared_ptr<Subscriber> self) {
+    std::vector<asio::const_buffer> buffers;
+    while (!queue_.empty() && !closed_) {
+        // The frames are shared with every other subscriber; only pointers are gathered
+        buffers.clear();
+        while (!queue_.empty() && inflight_.size() < MAX_WRITE_BATCH) {
+            inflight_.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+            buffers.push_back(asio::buffer(*inflight_.back()));
+        }
+        auto [ec, written] =
+            co_await asio::async_write(socket_, buffers, asio::as_tuple(asio::use_awaitable));
+        if (ec) {
+            inflight_.clear();
+            close();
+            break;
+        }
+        Metrics::increment(Metrics::Counter::WebSocketFramesSent, inflight_.size());
+        inflight_.clear();
+    }
+    writing_ = false;
+    if (closing_ && !closed_) {
+        close();
+    }
+}
+
+// ============================================================================
+// Shard
+// ============================================================================
+
+void WebSocketHub::Shard::add(Subscriber& subscriber) {
+    auto& list = topics[subscriber.topic()];
+    subscriber.slot = list.size();
+    list.push_back(&subscriber);
+}
+
+void WebSocketHub::Shard::remove(Subscriber& subscriber) {
+    auto it = topics.find(subscriber.topic());
+    if (it == topics.end()) {
+        return;
+    }
+    auto& list = it->second;
+    list[subscriber.slot] = list.back();
+    list[subscriber.slot]->slot = subscriber.slot;
+    list.pop_back();
+    if (list.empty()) {
+        topics.erase(it);
+    }
+}
+
+void WebSocketHub::Shard::deliver(const std::string& topic, const Frame& frame,
+                                  const Frame& deflated) {
+    auto it = topics.find(topic);
+    if (it == topics.end()) {
+        return;
+    }
+    // Delivery never unsubscribes (that happens when the read loop ends), so
+    // the list is stable while it is walked
+    for (Subscriber* subscriber : it->second) {
+        subscriber->deliver(frame, deflated);
+    }
+}
+
+// ============================================================================
+// WebSocketHub
+// ============================================================================
+
+WebSocketHub& WebSocketHub::getInstance() {
+    static WebSocketHub instance(configuredOptions());
+    return instance;
+}
+
+void WebSocketHub::configure(const Options& options) { configuredOptions() = options; }
+
+std::string_view WebSocketHub::topic_for(std::string_view target) {
+    if (!target.starts_with(PATH_PREFIX)) {
+        return {};
+    }
+    std::string_view topic = target.substr(PATH_PREFIX.size());
+    topic = topic.substr(0, topic.find('?'));
+    if (topic.size() > MAX_TOPIC_SIZE) {
+        return {};
+    }
+    return topic;
+}
+
+WebSocketHub::WebSocketHub(const Options& options) : options_(options) {
+    options_.shards = std::max<size_t>(options_.shards, 1);
+    options_.queue_limit = std::max<size_t>(options_.queue_limit, 1);
+    for (size_t i = 0; i < options_.shards; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->thread = std::thread([io = &shard->io] { io->run(); });
+        shards_.push_back(std::move(shard));
+    }
+}
+
+WebSocketHub::~WebSocketHub() {
+    for (auto& shard : shards_) {
+        shard->work.reset();
+        shard->io.stop();
+        shard->thread.join();
+    }
+    // Connections still open are dropped with their io_context
+    Metrics::add(Metrics::Gauge::WebSocketSubscribers, -static_cast<int64_t>(subscribers()));
+}
+
+void WebSocketHub::subscribe(tcp::socket socket, std::string topic,
+                             std::optional<WebSocketDeflate::Params> deflate) {
+    Shard& shard = *shards_[next_shard_.fetch_add(1, std::memory_order_relaxed) % shards_.size()];
+
+    // Move the descriptor to the shard's io_context
+    boost::system::error_code ec;
+    auto protocol = socket.local_endpoint(ec).protocol();
+    tcp::socket::native_handle_type fd = ec ? -1 : socket.release(ec);
+    if (ec) {
+        std::cerr << "WebSocket hub: cannot take over connection: " << ec.message() << std::endl;
+        return;
+    }
+    auto subscriber = std::make_shared<Subscriber>(
+        *this, shard, tcp::socket(shard.io, protocol, fd), std::move(topic), std::move(deflate));
+    asio::post(shard.io, [subscriber] { subscriber->start(); });
+}
+
+void WebSocketHub::publish(std::string_view topic, std::string_view payload, bool binary) {
+    // Encoded once; every subscriber on every shard queues this same buffer
+    uint8_t opcode = binary ? OPCODE_BINARY : OPCODE_TEXT;
+    Frame frame = std::make_shared<const std::string>(encode_frame(opcode, payload));
+
+    // Likewise compressed at most once, and only kept if it is smaller
+    Frame deflated;
+    if (deflate_subscribers_.load(std::memory_order_relaxed) > 0 &&
+        payload.size() >= options_.deflate.min_size) {
+        std::string compressed;
+        shared_deflater(options_.deflate).compress(payload, compressed);
+        if (compressed.size() < payload.size()) {
+            deflated = std::make_shared<const std::string>(encode_frame(opcode, compressed, true));
+        }
+    }
+
+    Metrics::increment(Metrics::Counter::WebSocketMessagesPublished);
+    for (auto& shard : shards_) {
+        asio::post(shard->io, [&shard = *shard, topic = std::string(topic), frame, deflated] {
+            shard.deliver(topic, frame, deflated);
+        });
+    }
+}
+
+std::string WebSocketHub::encode_frame(uint8_t opcode, std::string_view payload,
+                                       bool compressed) {
+    std::string frame;
+    uint64_t size = payload.size();
+    frame.reserve(payload.size() + 10);
+    frame.push_back(static_cast<char>(0x80 | (compressed ? 0x40 : 0) | opcode)); // FIN, RSV1
+    if (size < 126) {
+        frame.push_back(static_cast<char>(size));
+    } else if (size <= 0xFFFF) {
+        frame.push_back(static_cast<char>(126));
+        frame.push_back(static_cast<char>(size >> 8));
+        frame.push_back(static_cast<char>(size & 0xFF));
+    } else {
+        frame.push_back(static_cast<char>(127));
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame.push_back(static_cast<char>((size >> shift) & 0xFF));
+        }
+    }
+    frame.append(payload);
+    return frame;
+}
+
+WebSocketHub::DecodeResult WebSocketHub::decode_client_frame(std::string_view data,
+                                                             ClientFrame& frame, bool deflate) {
+    auto byte = [data](size_t i) { return static_cast<uint8_t>(data[i]); };
+    if (data.size() < 2) {
+        return DecodeResult::Incomplete;
+    }
+    bool fin = byte(0) & 0x80;
+    bool compressed = byte(0) & 0x40;
+    uint8_t opcode = byte(0) & 0x0F;
+    if ((byte(0) & 0x30) != 0 || (byte(1) & 0x80) == 0) {
+        return DecodeResult::Invalid; // No extension uses RSV2/3 and clients must mask
+    }
+    // RSV1 marks the first frame of a compressed data message
+    if (compressed && (!deflate || (opcode != OPCODE_TEXT && opcode != OPCODE_BINARY))) {
+        return DecodeResult::Invalid;
+    }
+
+    uint64_t length = byte(1) & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+        if (data.size() < 4) {
+            return DecodeResult::Incomplete;
+        }
+        length = (uint64_t{byte(2)} << 8) | byte(3);
+        header = 4;
+    } else if (length == 127) {
+        if (data.size() < 10) {
+            return DecodeResult::Incomplete;
+        }
+        length = 0;
+        for (size_t i = 2; i < 10; ++i) {
+            length = (length << 8) | byte(i);
+        }
+        header = 10;
+    }
+    bool control = (opcode & 0x8) != 0;
+    if ((control && (!fin || length > 125)) || length > MAX_MESSAGE_SIZE) {
+        return DecodeResult::Invalid;
+    }
+
+    header += 4; // Masking key
+    if (data.size() < header + length) {
+        return DecodeResult::Incomplete;
+    }
+    std::string_view mask = data.substr(header - 4, 4);
+    frame.fin = fin;
+    frame.compressed = compressed;
+    frame.opcode = opcode;
+    frame.payload.assign(data.substr(header, length));
+    for (size_t i = 0; i < frame.payload.size(); ++i) {
+        frame.payload[i] = static_cast<char>(frame.payload[i] ^ mask[i % 4]);
+    }
+    frame.size = header + length;
+    return DecodeResult::Complete;
+}
@@ -0,0 +1,164 @@
+#ifndef WEBSOCKET_HUB_H
+#define WEBSOCKET_HUB_H
+
+#include "websocket_deflate.h"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+/**
+ * Topic-based WebSocket publish/subscribe hub
+ *
+ * Clients join by upgrading a request for PATH_PREFIX<topic>; every text or
+ * binary message a subscriber sends is published to its topic, and server code
+ * can publish() directly. A message is encoded into a WebSocket frame once and
+ * that immutable, reference-counted buffer is queued on every subscriber:
+ * server frames are unmasked, so the bytes on the wire are the same for all of
+ * them. Queued frames are written with one gathered write per batch.
+ *
+ * Subscribers are spread over shards, each an io_context on its own thread.
+ * A publish posts the shared frame once per shard and each shard fans it out
+ * to its own subscribers without locking.
+ *
+ * Every subscriber's queue holds at most queue_limit frames. A consumer that
+ * falls that far behind either loses its oldest unsent frames
+ * (SlowConsumerPolicy::DropOldest) or is disconnected (Disconnect).
+ *
+ * Subscribers that negotiated permessage-deflate always get server no context
+ * takeover, so a message of at least deflate.min_size bytes is compressed
+ * once into a second shared frame rather than once per subscriber.
+ */
+class WebSocketHub {
+  public:
+    using Frame = std::shared_ptr<const std::string>;
+
+    enum class SlowConsumerPolicy { DropOldest, Disconnect };
+
+    struct Options {
+        size_t shards = 4;
+        size_t queue_limit = 256; // Frames per subscriber
+        SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldest;
+        WebSocketDeflate::Options deflate;
+    };
+
+    static constexpr std::string_view PATH_PREFIX = "/pubsub/";
+    static constexpr size_t MAX_TOPIC_SIZE = 256;
+    static constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024;
+
+    // RFC 6455 opcodes
+    static constexpr uint8_t OPCODE_CONTINUATION = 0x0;
+    static constexpr uint8_t OPCODE_TEXT = 0x1;
+    static constexpr uint8_t OPCODE_BINARY = 0x2;
+    static constexpr uint8_t OPCODE_CLOSE = 0x8;
+    static constexpr uint8_t OPCODE_PING = 0x9;
+    static constexpr uint8_t OPCODE_PONG = 0xA;
+
+    /**
+     * The process-wide hub, started on first use
+     */
+    static WebSocketHub& getInstance();
+
+    /**
+     * Set the options getInstance() starts with; only effective before first use
+     */
+    static void configure(const Options& options);
+
+    /**
+     * Topic named by a request target, or empty if it isn't a hub path
+     */
+    static std::string_view topic_for(std::string_view target);
+
+    explicit WebSocketHub(const Options& options);
+    ~WebSocketHub();
+
+    WebSocketHub(const WebSocketHub&) = delete;
+    WebSocketHub& operator=(const WebSocketHub&) = delete;
+
+    /**
+     * Take over a connection whose WebSocket handshake is done and subscribe
+     * it to a topic. The socket moves to one of the hub's threads.
+     * @param deflate permessage-deflate parameters agreed in the handshake
+     *                (negotiated with server_context_takeover false)
+     */
+    void subscribe(tcp::socket socket, std::string topic,
+                   std::optional<WebSocketDeflate::Params> deflate = std::nullopt);
+
+    /**
+     * Send a message to every subscriber of a topic. Safe from any thread.
+     * @param binary Send a binary frame instead of a text frame
+     */
+    void publish(std::string_view topic, std::string_view payload, bool binary = false);
+
+    /**
+     * Current subscribers across all shards
+     */
+    size_t subscribers() const { return subscribers_.load(std::memory_order_relaxed); }
+
+    const Options& options() const { return options_; }
+
+    /**
+     * Encode an unfragmented, unmasked server frame
+     * @param compressed Set RSV1: the payload is a permessage-deflate message
+     */
+    static std::string encode_frame(uint8_t opcode, std::string_view payload,
+                                    bool compressed = false);
+
+    /**
+     * One frame read from a client
+     */
+    struct ClientFrame {
+        bool fin = false;
+        bool compressed = false; // RSV1 on the first frame of a deflated message
+        uint8_t opcode = 0;
+        std::string payload; // Unmasked
+        size_t size = 0;     // Bytes the frame took up on the wire
+    };
+
+    enum class DecodeResult { Complete, Incomplete, Invalid };
+
+    /**
+     * Decode a masked client frame from the front of data
+     * Frames that aren't masked, set reserved bits, are oversized control
+     * frames or exceed MAX_MESSAGE_SIZE are Invalid.
+     * @param deflate permessage-deflate is negotiated, so RSV1 may be set on
+     *                the first frame of a data message
+     */
+    static DecodeResult decode_client_frame(std::string_view data, ClientFrame& frame,
+                                            bool deflate = false);
+
+  private:
+    class Subscriber;
+
+    struct Shard {
+        asio::io_context io{1};
+        asio::executor_work_guard<asio::io_context::executor_type> work{io.get_executor()};
+        // Subscribers by topic; each knows its own index so removal is O(1)
+        std::unordered_map<std::string, std::vector<Subscriber*>> topics;
+        std::thread thread;
+
+        void add(Subscriber& subscriber);
+        void remove(Subscriber& subscriber);
+        // deflated is null when the message wasn't compressed
+        void deliver(const std::string& topic, const Frame& frame, const Frame& deflated);
+    };
+
+    Options options_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<size_t> next_shard_{0};
+    std::atomic<size_t> subscribers_{0};
+    std::atomic<size_t> deflate_subscribers_{0};
+};
+
+#endif // WEBSOCKET_HUB_H
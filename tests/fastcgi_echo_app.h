@@ -0,0 +1,227 @@
+#ifndef FASTCGI_ECHO_APP_H
+#define FASTCGI_ECHO_APP_H
+
+#include "../src/fastcgi.h"
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace asio = boost::asio;
+
+/**
+ * Tiny FastCGI responder standing in for an application in tests and benchmarks
+ *
+ * Answers every request with "METHOD SCRIPT_NAME\n" followed by the request
+ * body. Query parameters change the answer:
+ *   status=N  respond with that status
+ *   size=N    send N bytes of 'x' instead, without Content-Length
+ *   delay=MS  wait that long before answering
+ * Requests on one connection are multiplexed unless multiplex is false,
+ * which is what applications like php-fpm do.
+ */
+class FastCgiEchoApp {
+  public:
+    FastCgiEchoApp(asio::io_context& io, const std::string& path, bool multiplex = true)
+        : acceptor_(io, asio::local::stream_protocol::endpoint(path)), multiplex_(multiplex) {
+        asio::co_spawn(io, accept(), asio::detached);
+    }
+
+    size_t connections() const { return connections_; }
+    size_t requests() const { return requests_; }
+    size_t aborted() const { return aborted_; }
+
+    // Most requests in flight at once on one connection
+    size_t max_in_flight() const { return max_in_flight_; }
+
+  private:
+    using Socket = asio::local::stream_protocol::socket;
+
+    struct Request {
+        std::string params;
+        std::string body;
+        bool keep_conn = false;
+    };
+
+    // One connection; responses are queued so that delayed ones don't interleave
+    struct Peer {
+        explicit Peer(Socket s) : socket(std::move(s)) {}
+        Socket socket;
+        std::map<uint16_t, Request> requests;
+        std::deque<std::string> queue;
+        bool writing = false;
+        bool close_after_write = false;
+    };
+
+    asio::awaitable<void> accept() {
+        while (true) {
+            auto [ec, socket] =
+                co_await acceptor_.async_accept(asio::as_tuple(asio::use_awaitable));
+            if (ec) {
+                co_return;
+            }
+            ++connections_;
+            auto peer = std::make_shared<Peer>(std::move(socket));
+            asio::co_spawn(acceptor_.get_executor(), serve(peer), asio::detached);
+        }
+    }
+
+    asio::awaitable<void> serve(std::shared_ptr<Peer> peer) {
+        std::string input;
+        while (true) {
+            auto header = FastCgi::parse_header(input);
+            if (!header || input.size() < header->record_size()) {
+                char buffer[16384];
+                auto [ec, n] = co_await peer->socket.async_read_some(
+                    asio::buffer(buffer), asio::as_tuple(asio::use_awaitable));
+                if (ec) {
+                    co_return;
+                }
+                input.append(buffer, n);
+                continue;
+            }
+            std::string content = input.substr(FastCgi::HEADER_SIZE, header->content_length);
+            input.erase(0, header->record_size());
+            handle(peer, *header, content);
+        }
+    }
+
+    void handle(const std::shared_ptr<Peer>& peer, const FastCgi::Header& header,
+                const std::string& content) {
+        uint16_t id = header.request_id;
+        switch (header.type) {
+        case FastCgi::GET_VALUES: {
+            std::string values;
+            FastCgi::encode_params(
+                {{"FCGI_MPXS_CONNS", multiplex_ ? "1" : "0"}, {"FCGI_MAX_REQS", "100"}}, values);
+            std::string record;
+            FastCgi::append_record(record, FastCgi::GET_VALUES_RESULT, 0, values);
+            send(peer, std::move(record));
+            break;
+        }
+        case FastCgi::BEGIN_REQUEST:
+            if (!multiplex_ && !peer->requests.empty()) {
+                std::string record;
+                FastCgi::append_end_request(record, id, 0, FastCgi::CANT_MPX_CONN);
+                send(peer, std::move(record));
+                break;
+            }
+            peer->requests[id].keep_conn = content.size() > 2 && (content[2] & FastCgi::KEEP_CONN);
+            max_in_flight_ = std::max(max_in_flight_, peer->requests.size());
+            break;
+        case FastCgi::PARAMS:
+            if (auto it = peer->requests.find(id); it != peer->requests.end()) {
+                it->second.params += content;
+            }
+            break;
+        case FastCgi::STDIN:
+            if (auto it = peer->requests.find(id); it != peer->requests.end()) {
+                if (!content.empty()) {
+                    it->second.body += content;
+                } else {
+                    asio::co_spawn(acceptor_.get_executor(), respond(peer, id), asio::detached);
+                }
+            }
+            break;
+        case FastCgi::ABORT_REQUEST:
+            if (peer->requests.erase(id) > 0) {
+                ++aborted_;
+                std::string record;
+                FastCgi::append_end_request(record, id, 0, FastCgi::REQUEST_COMPLETE);
+                send(peer, std::move(record));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    asio::awaitable<void> respond(std::shared_ptr<Peer> peer, uint16_t id) {
+        FastCgi::Params params;
+        FastCgi::decode_params(peer->requests[id].params, params);
+        auto param = [&](std::string_view name) {
+            auto it = std::ranges::find(params, name, &FastCgi::Params::value_type::first);
+            return it == params.end() ? std::string() : it->second;
+        };
+        auto query = [&](std::string_view name) -> size_t {
+            std::string query_string = "&" + param("QUERY_STRING");
+            size_t pos = query_string.find("&" + std::string(name) + "=");
+            if (pos == std::string::npos) {
+                return 0;
+            }
+            return std::stoul(query_string.substr(pos + name.size() + 2));
+        };
+
+        if (size_t delay = query("delay"); delay > 0) {
+            asio::steady_timer timer(acceptor_.get_executor(), std::chrono::milliseconds(delay));
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        auto it = peer->requests.find(id);
+        if (it == peer->requests.end()) {
+            co_return; // Aborted meanwhile
+        }
+        Request request = std::move(it->second);
+        peer->requests.erase(it);
+
+        std::string output;
+        if (size_t status = query("status"); status > 0) {
+            output += "Status: " + std::to_string(status) + "\r\n";
+        }
+        output += "Content-Type: text/plain\r\n";
+        std::string body;
+        if (size_t size = query("size"); size > 0) {
+            body.assign(size, 'x');
+        } else {
+            body = param("REQUEST_METHOD") + " " + param("SCRIPT_NAME") + "\n" + request.body;
+            output += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+        output += "\r\n" + body;
+
+        std::string records;
+        FastCgi::append_stream(records, FastCgi::STDOUT, id, output);
+        FastCgi::append_record(records, FastCgi::STDOUT, id, {});
+        FastCgi::append_end_request(records, id, 0, FastCgi::REQUEST_COMPLETE);
+        ++requests_;
+        if (!request.keep_conn) {
+            peer->close_after_write = true;
+        }
+        send(peer, std::move(records));
+    }
+
+    void send(const std::shared_ptr<Peer>& peer, std::string records) {
+        peer->queue.push_back(std::move(records));
+        if (!peer->writing) {
+            peer->writing = true;
+            asio::co_spawn(acceptor_.get_executor(), write_queue(peer), asio::detached);
+        }
+    }
+
+    asio::awaitable<void> write_queue(std::shared_ptr<Peer> peer) {
+        while (!peer->queue.empty()) {
+            std::string records = std::move(peer->queue.front());
+            peer->queue.pop_front();
+            auto [ec, n] = co_await asio::async_write(peer->socket, asio::buffer(records),
+                                                      asio::as_tuple(asio::use_awaitable));
+            if (ec) {
+                break;
+            }
+        }
+        peer->writing = false;
+        if (peer->close_after_write) {
+            boost::system::error_code ignored;
+            peer->socket.close(ignored);
+        }
+    }
+
+    asio::local::stream_protocol::acceptor acceptor_;
+    bool multiplex_;
+    size_t connections_ = 0;
+    size_t requests_ = 0;
+    size_t aborted_ = 0;
+    size_t max_in_flight_ = 0;
+};
+
+#endif // FASTCGI_ECHO_APP_H
@@ -0,0 +1,172 @@
+#ifndef HTTP_ECHO_UPSTREAM_H
+#define HTTP_ECHO_UPSTREAM_H
+
+#include "../src/chunked_decoder.h"
+#include "../src/proxy.h"
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <format>
+#include <string>
+
+namespace asio = boost::asio;
+
+/**
+ * Tiny HTTP/1.1 server standing in for a reverse proxy upstream in tests
+ *
+ * Answers every request with its name on the first line, then the request head
+ * and body exactly as received, with Content-Length and keep-alive. Query
+ * parameters change the answer:
+ *   status=N  respond with that status
+ *   size=N    send N bytes of 'x' instead, chunked
+ *   close=1   send no Content-Length and end the body by closing
+ *   delay=MS  wait that long before answering
+ *   max_age=N, swr=N, sie=N
+ *             send Cache-Control with max-age, stale-while-revalidate and
+ *             stale-if-error
+ */
+class HttpEchoUpstream {
+  public:
+    HttpEchoUpstream(asio::io_context& io, std::string name)
+        : acceptor_(io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0)),
+          name_(std::move(name)) {
+        asio::co_spawn(io, accept(), asio::detached);
+    }
+
+    unsigned short port() const { return port_; }
+    std::string address() const { return std::format("127.0.0.1:{}", port_); }
+    size_t connections() const { return connections_; }
+    size_t requests() const { return requests_; }
+
+    // Refuse new connections, and close open ones at their next request
+    // (call on the io_context's thread)
+    void stop() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        stopped_ = true;
+    }
+
+    // Answer every request with this status from now on, 0 to stop (call on
+    // the io_context's thread)
+    void fail_with(size_t status) { fail_status_ = status; }
+
+  private:
+    using tcp = asio::ip::tcp;
+
+    asio::awaitable<void> accept() {
+        while (true) {
+            auto [ec, socket] =
+                co_await acceptor_.async_accept(asio::as_tuple(asio::use_awaitable));
+            if (ec) {
+                co_return;
+            }
+            ++connections_;
+            asio::co_spawn(acceptor_.get_executor(), serve(std::move(socket)), asio::detached);
+        }
+    }
+
+    static size_t param(std::string_view target, std::string_view name) {
+        std::string key = std::format("{}=", name);
+        size_t query = target.find('?');
+        size_t pos = query == std::string_view::npos ? query : target.find(key, query);
+        if (pos == std::string_view::npos) {
+            return 0;
+        }
+        return std::stoul(std::string(target.substr(pos + key.size())));
+    }
+
+    asio::awaitable<void> serve(tcp::socket socket) {
+        std::string buffer;
+        while (true) {
+            auto [ec, head_size] =
+                co_await asio::async_read_until(socket, asio::dynamic_buffer(buffer), "\r\n\r\n",
+                                                asio::as_tuple(asio::use_awaitable));
+            if (ec || stopped_) {
+                co_return;
+            }
+            std::string head = buffer.substr(0, head_size);
+            buffer.erase(0, head_size);
+            auto request = Proxy::parse_request(head);
+            if (!request) {
+                co_return;
+            }
+
+            // The body, whichever way it is framed
+            std::string body;
+            ChunkedDecoder decoder;
+            size_t length = request->content_length.value_or(0);
+            while (request->chunked ? !decoder.done() : buffer.size() < length) {
+                if (request->chunked && !buffer.empty()) {
+                    std::string_view data;
+                    auto used = decoder.consume(buffer, data);
+                    if (!used) {
+                        co_return;
+                    }
+                    body += data;
+                    buffer.erase(0, *used);
+                    continue;
+                }
+                auto [read_ec, size] = co_await asio::async_read(
+                    socket, asio::dynamic_buffer(buffer), asio::transfer_at_least(1),
+                    asio::as_tuple(asio::use_awaitable));
+                if (read_ec) {
+                    co_return;
+                }
+            }
+            if (!request->chunked) {
+                body = buffer.substr(0, length);
+                buffer.erase(0, length);
+            }
+            ++requests_;
+
+            std::string_view target = request->target;
+            if (size_t delay = param(target, "delay")) {
+                asio::steady_timer timer(socket.get_executor(), std::chrono::milliseconds(delay));
+                co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+            }
+            size_t status = fail_status_ ? fail_status_ : param(target, "status");
+            std::string response =
+                std::format("HTTP/1.1 {} OK\r\nX-Upstream: {}\r\n", status ? status : 200, name_);
+            size_t max_age = param(target, "max_age");
+            size_t swr = param(target, "swr");
+            size_t sie = param(target, "sie");
+            if (max_age || swr || sie) {
+                response += std::format("Cache-Control: max-age={}, stale-while-revalidate={}, "
+                                        "stale-if-error={}\r\n",
+                                        max_age, swr, sie);
+            }
+            bool close = param(target, "close") != 0;
+            if (size_t size = param(target, "size")) {
+                response += "Transfer-Encoding: chunked\r\n\r\n";
+                for (size_t sent = 0; sent < size; sent += 16384) {
+                    size_t chunk = std::min<size_t>(16384, size - sent);
+                    response += std::format("{:x}\r\n{}\r\n", chunk, std::string(chunk, 'x'));
+                }
+                response += "0\r\n\r\n";
+            } else {
+                std::string echo = name_ + "\n" + head + body;
+                response += close ? "Connection: close\r\n\r\n"
+                                  : std::format("Content-Length: {}\r\n\r\n", echo.size());
+                if (request->method != "HEAD") {
+                    response += echo;
+                }
+            }
+
+            auto [write_ec, written] = co_await asio::async_write(
+                socket, asio::buffer(response), asio::as_tuple(asio::use_awaitable));
+            if (write_ec || close || !request->keep_alive) {
+                co_return;
+            }
+        }
+    }
+
+    tcp::acceptor acceptor_;
+    unsigned short port_ = acceptor_.local_endpoint().port();
+    std::string name_;
+    size_t connections_ = 0;
+    size_t requests_ = 0;
+    bool stopped_ = false;
+    size_t fail_status_ = 0;
+};
+
+#endif // HTTP_ECHO_UPSTREAM_H
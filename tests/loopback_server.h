@@ -0,0 +1,138 @@
+#ifndef LOOPBACK_SERVER_H
+#define LOOPBACK_SERVER_H
+
+#include "../src/asio_server.h"
+#include "../src/metrics.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Current value of one series in the metrics exposition (0 if absent)
+inline uint64_t metric(const std::string& series) {
+    std::string text = Metrics::render();
+    auto pos = text.find("\n" + series + " ");
+    return pos == std::string::npos ? 0 : std::stoull(text.substr(pos + series.size() + 2));
+}
+
+// Poll until a series reaches value, or give up after timeout
+inline bool wait_for_metric(const std::string& series, uint64_t value,
+                            std::chrono::steady_clock::duration timeout) {
+    using Clock = std::chrono::steady_clock;
+    for (auto end = Clock::now() + timeout; Clock::now() < end;) {
+        if (metric(series) == value) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+/**
+ * Runs each test in a fresh temporary directory, with an empty htdocs, logs
+ * and a mime.types for text/html, removed again afterwards
+ */
+class TempRootTest : public ::testing::Test {
+  protected:
+    // The directory is fishjelly-<name>-<pid>, so parallel suites don't share one
+    explicit TempRootTest(std::string name) : name_(std::move(name)) {}
+
+    void SetUp() override {
+        previous_dir_ = std::filesystem::current_path();
+        root_ = std::filesystem::temp_directory_path() /
+                ("fishjelly-" + name_ + "-" + std::to_string(getpid()));
+        std::filesystem::create_directories(root_ / "htdocs");
+        std::filesystem::create_directories(root_ / "logs");
+        std::ofstream(root_ / "mime.types") << "text/html html\n";
+        std::filesystem::current_path(root_);
+    }
+
+    void TearDown() override {
+        std::filesystem::current_path(previous_dir_);
+        std::filesystem::remove_all(root_);
+    }
+
+    std::string name_;
+    std::filesystem::path previous_dir_;
+    std::filesystem::path root_;
+};
+
+/**
+ * Runs an AsioServer on a loopback port, on its own thread, serving a
+ * TempRootTest directory
+ *
+ * Fixtures add files and configure modules in prepare(), which runs in the
+ * directory before the server starts, and undo that in cleanup(), after it
+ * stops. Those that configure the server per test pass start_in_setup false
+ * and call start_server() themselves.
+ */
+class LoopbackServerTest : public TempRootTest {
+  protected:
+    explicit LoopbackServerTest(std::string name, bool start_in_setup = true)
+        : TempRootTest(std::move(name)), start_in_setup_(start_in_setup) {}
+
+    void SetUp() override {
+        TempRootTest::SetUp();
+        prepare();
+        if (start_in_setup_ && !HasFatalFailure()) {
+            start_server();
+        }
+    }
+
+    void TearDown() override {
+        if (server_) {
+            std::raise(SIGTERM); // Handled by the server's signal_set on its own thread
+            thread_.join();
+            server_.reset();
+        }
+        cleanup();
+        TempRootTest::TearDown();
+    }
+
+    virtual void prepare() {}
+    virtual void cleanup() {}
+
+    void start_server() {
+        server_ = std::make_unique<AsioServer>(0);
+        port_ = server_->port();
+        thread_ = std::thread([this] { server_->run(); });
+    }
+
+    // A connection to the server, with a small receive buffer if asked for
+    tcp::socket connect(asio::io_context& io, int receive_buffer = 0) const {
+        tcp::socket socket(io);
+        socket.open(tcp::v4());
+        if (receive_buffer > 0) {
+            socket.set_option(asio::socket_base::receive_buffer_size(receive_buffer));
+        }
+        socket.connect(tcp::endpoint(asio::ip::address_v4::loopback(), port_));
+        return socket;
+    }
+
+    // Send requests on one connection and read until the server closes it
+    std::string exchange(const std::string& requests) const {
+        asio::io_context io;
+        tcp::socket socket = connect(io);
+        boost::system::error_code ec;
+        asio::write(socket, asio::buffer(requests), ec);
+        std::string response;
+        asio::read(socket, asio::dynamic_buffer(response), ec);
+        return response;
+    }
+
+    std::unique_ptr<AsioServer> server_;
+    std::thread thread_;
+    int port_ = 0;
+
+  private:
+    bool start_in_setup_;
+};
+
+#endif // LOOPBACK_SERVER_H
@@ -0,0 +1,155 @@
+#include "../src/blocking_pool.h"
+#include "loopback_server.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <future>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Run a coroutine to completion on io, rethrowing anything it throws
+template <typename Awaitable> void run_on(asio::io_context& io, Awaitable awaitable) {
+    std::exception_ptr error;
+    bool done = false;
+    asio::co_spawn(io, std::move(awaitable), [&](std::exception_ptr e) {
+        error = e;
+        done = true;
+    });
+    io.run_for(10s);
+    ASSERT_TRUE(done);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace
+
+class BlockingPoolTest : public ::testing::Test {
+  protected:
+    asio::io_context io_;
+};
+
+TEST_F(BlockingPoolTest, RunsOnWorkerAndResumesOnCaller) {
+    BlockingPool pool(2);
+    auto caller = std::this_thread::get_id();
+    std::thread::id worker;
+    std::thread::id resumed;
+
+    run_on(io_, [&]() -> asio::awaitable<void> {
+        worker = co_await pool.run([] { return std::this_thread::get_id(); });
+        resumed = std::this_thread::get_id();
+    }());
+
+    EXPECT_NE(worker, caller);
+    EXPECT_EQ(resumed, caller);
+}
+
+TEST_F(BlockingPoolTest, ReturnsValuesAndRethrows) {
+    BlockingPool pool(1);
+    int answer = 0;
+    bool ran = false;
+    bool caught = false;
+
+    run_on(io_, [&]() -> asio::awaitable<void> {
+        answer = co_await pool.run([] { return 6 * 7; });
+        co_await pool.run([&] { ran = true; });
+        try {
+            co_await pool.run([]() -> int { throw std::runtime_error("disk on fire"); });
+        } catch (const std::runtime_error& e) {
+            caught = std::string(e.what()) == "disk on fire";
+        }
+    }());
+
+    EXPECT_EQ(answer, 42);
+    EXPECT_TRUE(ran);
+    EXPECT_TRUE(caught);
+}
+
+TEST_F(BlockingPoolTest, EventLoopKeepsServingWhileWorkBlocks) {
+    BlockingPool pool(1);
+    asio::steady_timer timer(io_, 20ms);
+    bool timer_fired = false;
+    bool timer_fired_first = false;
+    timer.async_wait([&](boost::system::error_code) { timer_fired = true; });
+
+    run_on(io_, [&]() -> asio::awaitable<void> {
+        co_await pool.run([] { std::this_thread::sleep_for(200ms); });
+        timer_fired_first = timer_fired;
+    }());
+
+    EXPECT_TRUE(timer_fired_first);
+}
+
+TEST_F(BlockingPoolTest, FullQueueRunsInline) {
+    BlockingPool pool(1, 1);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    const std::string inline_tasks = "shelob_blocking_tasks_total{executor=\"inline\"}";
+    uint64_t inline_before = metric(inline_tasks);
+    auto caller = std::this_thread::get_id();
+    std::thread::id overflow_thread;
+    int finished = 0;
+
+    auto blocked = [&]() -> asio::awaitable<void> {
+        co_await pool.run([released] { released.wait(); });
+        ++finished;
+    };
+    // The first occupies the worker, the second fills the queue
+    asio::co_spawn(io_, blocked(), asio::detached);
+    io_.poll();
+    while (pool.queued() != 0) {
+        std::this_thread::yield();
+    }
+    asio::co_spawn(io_, blocked(), asio::detached);
+    io_.poll();
+    EXPECT_EQ(pool.queued(), 1u);
+
+    asio::co_spawn(
+        io_,
+        [&]() -> asio::awaitable<void> {
+            overflow_thread = co_await pool.run([] { return std::this_thread::get_id(); });
+            release.set_value();
+        },
+        asio::detached);
+    io_.run_for(5s);
+
+    EXPECT_EQ(overflow_thread, caller);
+    EXPECT_EQ(finished, 2);
+    EXPECT_EQ(metric(inline_tasks), inline_before + 1);
+}
+
+TEST_F(BlockingPoolTest, WithoutWorkersEverythingRunsInline) {
+    BlockingPool pool(0);
+    auto caller = std::this_thread::get_id();
+    std::thread::id ran_on;
+
+    run_on(io_, [&]() -> asio::awaitable<void> {
+        ran_on = co_await pool.run([] { return std::this_thread::get_id(); });
+    }());
+
+    EXPECT_EQ(pool.threads(), 0u);
+    EXPECT_EQ(ran_on, caller);
+}
+
+TEST_F(BlockingPoolTest, QueueMetrics) {
+    BlockingPool pool(2);
+    uint64_t waits_before = metric("shelob_blocking_wait_seconds_count");
+    uint64_t tasks_before = metric("shelob_blocking_tasks_total{executor=\"pool\"}");
+
+    run_on(io_, [&]() -> asio::awaitable<void> {
+        for (int i = 0; i < 10; ++i) {
+            co_await pool.run([] {});
+        }
+    }());
+    pool.drain();
+
+    EXPECT_EQ(metric("shelob_blocking_wait_seconds_count"), waits_before + 10);
+    EXPECT_EQ(metric("shelob_blocking_tasks_total{executor=\"pool\"}"), tasks_before + 10);
+    EXPECT_EQ(metric("shelob_blocking_queue_depth"), 0u);
+}
@@ -0,0 +1,40 @@
+#include "../src/body_framing.h"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(BodyFramingTest, ReadsContentLengthAndChunked) {
+    auto framing = BodyFraming::parse("POST / HTTP/1.1\r\nContent-Length: 42\r\n\r\n");
+    ASSERT_TRUE(framing);
+    EXPECT_EQ(framing->content_length(), 42u);
+    EXPECT_FALSE(framing->chunked());
+    EXPECT_EQ(BodyFraming::parse("POST / HTTP/1.1\r\ncontent-length:7\r\n\r\n")->content_length(),
+              7u);
+    EXPECT_EQ(BodyFraming::parse("POST / HTTP/1.1\r\nContent-Length: 7\r\n"
+                                 "Content-Length: 7\r\n\r\n")
+                  ->content_length(),
+              7u);
+    EXPECT_FALSE(BodyFraming::parse("GET / HTTP/1.1\r\nHost: a\r\n\r\n")->content_length());
+
+    EXPECT_TRUE(BodyFraming::parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n")->chunked());
+    EXPECT_TRUE(
+        BodyFraming::parse("POST / HTTP/1.1\r\ntransfer-encoding:  Chunked \r\n")->chunked());
+    EXPECT_FALSE(BodyFraming::parse("POST / HTTP/1.1\r\nContent-Length: 4\r\n")->chunked());
+}
+
+TEST(BodyFramingTest, RefusesAmbiguousFraming) {
+    for (const char* fields : {"Content-Length: x\r\n",
+                               "Content-Length: 5abc\r\n",
+                               "Content-Length: 5, 50\r\n",
+                               "Content-Length: -5\r\n",
+                               "Content-Length:\r\n",
+                               "Content-Length : 5\r\n",
+                               "Content-Length: 5\r\ncontent-length: 50\r\n",
+                               "Transfer-Encoding: gzip, chunked\r\n",
+                               "Transfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n",
+                               "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n",
+                               "content-length: 5\r\ntransfer-encoding: chunked\r\n",
+                               "transfer-encoding: chunked\r\nCONTENT-LENGTH: 5\r\n"}) {
+        EXPECT_FALSE(BodyFraming::parse(std::string("POST / HTTP/1.1\r\n") + fields + "\r\n"))
+            << fields;
+    }
+}
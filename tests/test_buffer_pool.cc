@@ -0,0 +1,83 @@
+#include "../src/asio_http_connection.h"
+#include "../src/buffer_pool.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(BufferPoolTest, AcquireReservesInitialCapacity) {
+    std::string buffer = BufferPool::acquire();
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_GE(buffer.capacity(), BufferPool::INITIAL_CAPACITY);
+}
+
+TEST(BufferPoolTest, ReleasedBuffersAreReused) {
+    std::string buffer = BufferPool::acquire();
+    buffer.assign("leftover request bytes");
+    const char* storage = buffer.data();
+    size_t before = BufferPool::pooled();
+
+    BufferPool::release(std::move(buffer));
+    EXPECT_EQ(BufferPool::pooled(), before + 1);
+
+    std::string reused = BufferPool::acquire();
+    EXPECT_EQ(BufferPool::pooled(), before);
+    EXPECT_EQ(reused.data(), storage);
+    EXPECT_TRUE(reused.empty());
+}
+
+TEST(BufferPoolTest, OversizedBuffersAreDropped) {
+    std::string buffer;
+    buffer.reserve(BufferPool::MAX_RETAINED_CAPACITY * 2);
+    size_t before = BufferPool::pooled();
+    BufferPool::release(std::move(buffer));
+    EXPECT_EQ(BufferPool::pooled(), before);
+}
+
+TEST(BufferPoolTest, PoolsArePerThread) {
+    BufferPool::release(BufferPool::acquire());
+    size_t other_thread_pooled = 1;
+    std::thread worker([&] { other_thread_pooled = BufferPool::pooled(); });
+    worker.join();
+    EXPECT_EQ(other_thread_pooled, 0u);
+}
+
+TEST(AsioHttpConnectionTest, ObjectsAreRecycled) {
+    AsioHttpConnection* first = nullptr;
+    {
+        auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+        first = connection.get();
+    }
+    size_t pooled = AsioHttpConnection::pooled();
+    EXPECT_GE(pooled, 1u);
+
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    EXPECT_EQ(connection.get(), first);
+    EXPECT_EQ(AsioHttpConnection::pooled(), pooled - 1);
+}
+
+TEST(AsioHttpConnectionTest, PipelinedRequestsStayBuffered) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    const std::string first = "GET /missing-one HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    const std::string second = "GET /missing-two HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    connection->input() = first + second;
+
+    EXPECT_TRUE(connection->process(first.size(), 0));
+    EXPECT_EQ(connection->consumed(), first.size());
+    EXPECT_NE(connection->response().find("HTTP/1.1 404"), std::string::npos);
+
+    connection->finishRequest();
+    EXPECT_TRUE(connection->response().empty());
+    EXPECT_EQ(connection->input(), second);
+    EXPECT_TRUE(connection->hasPendingInput());
+}
+
+TEST(AsioHttpConnectionTest, BuffersReleasedWhileIdle) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    size_t before = BufferPool::pooled();
+    connection->releaseBuffers();
+    EXPECT_EQ(BufferPool::pooled(), before + 2);
+    EXPECT_EQ(connection->input().capacity(), std::string().capacity());
+
+    connection->acquireBuffers();
+    EXPECT_EQ(BufferPool::pooled(), before);
+    EXPECT_GE(connection->input().capacity(), BufferPool::INITIAL_CAPACITY);
+}
@@ -0,0 +1,158 @@
+#include "../src/conditional_request.h"
+#include <gtest/gtest.h>
+
+class ConditionalRequestTest : public ::testing::Test {
+  protected:
+    // Sun, 06 Nov 1994 08:49:37 GMT
+    static constexpr time_t kRfcExample = 784111777;
+
+    ResourceValidators validators{"\"abc-10-20\"", kRfcExample};
+};
+
+TEST_F(ConditionalRequestTest, ParseImfFixdate) {
+    auto t = ConditionalRequest::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT");
+    ASSERT_TRUE(t.has_value());
+    EXPECT_EQ(*t, kRfcExample);
+}
+
+TEST_F(ConditionalRequestTest, ParseObsoleteFormats) {
+    auto rfc850 = ConditionalRequest::parseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT");
+    ASSERT_TRUE(rfc850.has_value());
+    EXPECT_EQ(*rfc850, kRfcExample);
+
+    auto asctime = ConditionalRequest::parseHttpDate("Sun Nov  6 08:49:37 1994");
+    ASSERT_TRUE(asctime.has_value());
+    EXPECT_EQ(*asctime, kRfcExample);
+}
+
+TEST_F(ConditionalRequestTest, ParseRejectsInvalidDates) {
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("").has_value());
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("yesterday").has_value());
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("Sun, 06 Foo 1994 08:49:37 GMT").has_value());
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("Sun, 31 Feb 1994 08:49:37 GMT").has_value());
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("Sun, 06 Nov 1994 25:49:37 GMT").has_value());
+    EXPECT_FALSE(ConditionalRequest::parseHttpDate("Sun, 06 Nov 1994 08:49:37 PST").has_value());
+}
+
+TEST_F(ConditionalRequestTest, FormatRoundTrip) {
+    EXPECT_EQ(ConditionalRequest::formatHttpDate(kRfcExample), "Sun, 06 Nov 1994 08:49:37 GMT");
+    EXPECT_EQ(ConditionalRequest::formatHttpDate(0), "Thu, 01 Jan 1970 00:00:00 GMT");
+
+    // Leap day
+    time_t leap = 951782400; // 2000-02-29
+    std::string formatted = ConditionalRequest::formatHttpDate(leap);
+    EXPECT_EQ(formatted, "Tue, 29 Feb 2000 00:00:00 GMT");
+    EXPECT_EQ(ConditionalRequest::parseHttpDate(formatted), leap);
+}
+
+TEST_F(ConditionalRequestTest, ETagChangesWithFileMetadata) {
+    struct stat st = {};
+    st.st_ino = 42;
+    st.st_size = 1024;
+    st.st_mtim.tv_sec = kRfcExample;
+    std::string etag = ConditionalRequest::makeETag(st);
+
+    EXPECT_EQ(etag.front(), '"');
+    EXPECT_EQ(etag.back(), '"');
+
+    st.st_mtim.tv_nsec = 1;
+    EXPECT_NE(ConditionalRequest::makeETag(st), etag);
+    st.st_mtim.tv_nsec = 0;
+    st.st_size = 1025;
+    EXPECT_NE(ConditionalRequest::makeETag(st), etag);
+}
+
+TEST_F(ConditionalRequestTest, ETagListComparison) {
+    EXPECT_TRUE(ConditionalRequest::etagListMatches("\"abc-10-20\"", validators.etag, false));
+    EXPECT_TRUE(ConditionalRequest::etagListMatches("\"x\", \"abc-10-20\"", validators.etag, false));
+    EXPECT_TRUE(ConditionalRequest::etagListMatches("*", validators.etag, false));
+    EXPECT_FALSE(ConditionalRequest::etagListMatches("\"x\"", validators.etag, false));
+
+    // Weak tags only match under weak comparison
+    EXPECT_FALSE(ConditionalRequest::etagListMatches("W/\"abc-10-20\"", validators.etag, false));
+    EXPECT_TRUE(ConditionalRequest::etagListMatches("W/\"abc-10-20\"", validators.etag, true));
+
+    // Nothing matches a resource that does not exist
+    EXPECT_FALSE(ConditionalRequest::etagListMatches("*", "", false));
+}
+
+TEST_F(ConditionalRequestTest, IfNoneMatchGivesNotModified) {
+    ConditionalHeaders headers;
+    headers.if_none_match = "\"abc-10-20\"";
+    EXPECT_EQ(ConditionalRequest::evaluate("GET", headers, validators),
+              PreconditionResult::NotModified);
+    EXPECT_EQ(ConditionalRequest::evaluate("HEAD", headers, validators),
+              PreconditionResult::NotModified);
+    EXPECT_EQ(ConditionalRequest::evaluate("PUT", headers, validators),
+              PreconditionResult::PreconditionFailed);
+}
+
+TEST_F(ConditionalRequestTest, IfNoneMatchTakesPrecedenceOverIfModifiedSince) {
+    ConditionalHeaders headers;
+    headers.if_none_match = "\"other\"";
+    headers.if_modified_since = "Sun, 06 Nov 1994 08:49:37 GMT";
+    EXPECT_EQ(ConditionalRequest::evaluate("GET", headers, validators),
+              PreconditionResult::Proceed);
+}
+
+TEST_F(ConditionalRequestTest, IfModifiedSince) {
+    ConditionalHeaders headers;
+    headers.if_modified_since = "Sun, 06 Nov 1994 08:49:37 GMT";
+    EXPECT_EQ(ConditionalRequest::evaluate("GET", headers, validators),
+              PreconditionResult::NotModified);
+
+    headers.if_modified_since = "Sun, 06 Nov 1994 08:49:36 GMT";
+    EXPECT_EQ(ConditionalRequest::evaluate("GET", headers, validators),
+              PreconditionResult::Proceed);
+
+    // Invalid dates are ignored
+    headers.if_modified_since = "not a date";
+    EXPECT_EQ(ConditionalRequest::evaluate("GET", headers, validators),
+              PreconditionResult::Proceed);
+
+    // Only applies to GET and HEAD
+    headers.if_modified_since = "Sun, 06 Nov 1994 08:49:37 GMT";
+    EXPECT_EQ(ConditionalRequest::evaluate("DELETE", headers, validators),
+              PreconditionResult::Proceed);
+}
+
+TEST_F(ConditionalRequestTest, IfMatchAndIfUnmodifiedSince) {
+    ConditionalHeaders headers;
+    headers.if_match = "\"other\"";
+    EXPECT_EQ(ConditionalRequest::evaluate("PUT", headers, validators),
+              PreconditionResult::PreconditionFailed);
+
+    headers.if_match = "\"abc-10-20\"";
+    headers.if_unmodified_since = "Thu, 01 Jan 1970 00:00:00 GMT"; // Ignored when If-Match present
+    EXPECT_EQ(ConditionalRequest::evaluate("PUT", headers, validators),
+              PreconditionResult::Proceed);
+
+    headers.if_match = {};
+    EXPECT_EQ(ConditionalRequest::evaluate("DELETE", headers, validators),
+              PreconditionResult::PreconditionFailed);
+}
+
+TEST_F(ConditionalRequestTest, IfNoneMatchStarPreventsOverwrite) {
+    ConditionalHeaders headers;
+    headers.if_none_match = "*";
+    EXPECT_EQ(ConditionalRequest::evaluate("PUT", headers, validators),
+              PreconditionResult::PreconditionFailed);
+    EXPECT_EQ(ConditionalRequest::evaluate("PUT", headers, ResourceValidators{}),
+              PreconditionResult::Proceed);
+}
+
+TEST_F(ConditionalRequestTest, IfRange) {
+    EXPECT_TRUE(ConditionalRequest::ifRangeMatches("\"abc-10-20\"", validators));
+    EXPECT_FALSE(ConditionalRequest::ifRangeMatches("\"other\"", validators));
+    EXPECT_FALSE(ConditionalRequest::ifRangeMatches("W/\"abc-10-20\"", validators));
+    EXPECT_TRUE(ConditionalRequest::ifRangeMatches("Sun, 06 Nov 1994 08:49:37 GMT", validators));
+    EXPECT_FALSE(ConditionalRequest::ifRangeMatches("Sun, 06 Nov 1994 08:49:38 GMT", validators));
+}
+
+TEST_F(ConditionalRequestTest, HeadersFromMapAcceptBothCases) {
+    std::map<std::string, std::string> http1 = {{"If-None-Match", "\"a\""}};
+    std::map<std::string, std::string> http2 = {{"if-none-match", "\"b\""}};
+    EXPECT_EQ(ConditionalHeaders::from(http1).if_none_match, "\"a\"");
+    EXPECT_EQ(ConditionalHeaders::from(http2).if_none_match, "\"b\"");
+    EXPECT_TRUE(ConditionalHeaders::from(http1).if_match.empty());
+}
@@ -0,0 +1,417 @@
+#include "../src/asio_server.h"
+#include "../src/cgi.h"
+#include "../src/fastcgi.h"
+#include "../src/fastcgi_pool.h"
+#include "../src/request_limits.h"
+#include "fastcgi_echo_app.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <optional>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+using tcp = asio::ip::tcp;
+
+namespace {
+
+std::string socket_path(const std::string& name) {
+    return (std::filesystem::temp_directory_path() /
+            ("fishjelly-" + name + "-" + std::to_string(getpid()) + ".sock"))
+        .string();
+}
+
+// Run the io_context until the coroutine finishes (the app's accept loop never does)
+template <typename T> T run(asio::io_context& io, asio::awaitable<T> task) {
+    std::optional<T> result;
+    asio::co_spawn(io, std::move(task), [&](std::exception_ptr error, T value) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        result = std::move(value);
+    });
+    while (!result) {
+        io.run_one();
+    }
+    return std::move(*result);
+}
+
+struct Response {
+    bool complete = false;
+    std::string output;
+};
+
+// Everything the application writes for one request
+asio::awaitable<Response> fetch(FastCgiPool& pool, FastCgi::Options options, std::string uri,
+                                std::string body = {}) {
+    std::string query = uri.find('?') == std::string::npos ? "" : uri.substr(uri.find('?') + 1);
+    FastCgi::Params params = {{"REQUEST_METHOD", body.empty() ? "GET" : "POST"},
+                              {"SCRIPT_NAME", uri.substr(0, uri.find('?'))},
+                              {"QUERY_STRING", query},
+                              {"CONTENT_LENGTH", std::to_string(body.size())}};
+    auto exchange = co_await pool.start(options, std::move(params), std::move(body));
+    Response response;
+    if (!exchange) {
+        co_return response;
+    }
+    std::string chunk;
+    while (co_await exchange->read(chunk, 5s)) {
+        response.output += chunk;
+    }
+    response.complete = !exchange->failed() && !exchange->timed_out();
+    co_return response;
+}
+
+FastCgi::Params query_params(const std::string& query_string) {
+    return {{"QUERY_STRING", query_string}};
+}
+
+std::string body_of(const std::string& output) {
+    FastCgi::ResponseHead head;
+    auto head_size = FastCgi::parse_response_head(output, head);
+    return head_size && *head_size > 0 ? output.substr(*head_size) : std::string();
+}
+
+} // namespace
+
+TEST(FastCgiTest, RecordsRoundTrip) {
+    std::string long_value(300, 'v'); // Needs the four-byte length form
+    FastCgi::Params params = {{"SCRIPT_NAME", "/hello.sh"}, {"LONG", long_value}, {"EMPTY", ""}};
+    std::string encoded;
+    FastCgi::encode_params(params, encoded);
+
+    std::string records;
+    FastCgi::append_begin_request(records, 7, true);
+    FastCgi::append_stream(records, FastCgi::PARAMS, 7, encoded);
+    FastCgi::append_stream(records, FastCgi::STDIN, 7, std::string(FastCgi::MAX_CONTENT + 10, 'b'));
+
+    auto begin = FastCgi::parse_header(records);
+    ASSERT_TRUE(begin);
+    EXPECT_EQ(begin->type, FastCgi::BEGIN_REQUEST);
+    EXPECT_EQ(begin->request_id, 7);
+    ASSERT_EQ(begin->content_length, 8);
+    EXPECT_EQ(records[FastCgi::HEADER_SIZE + 1], FastCgi::RESPONDER);
+    EXPECT_EQ(records[FastCgi::HEADER_SIZE + 2], FastCgi::KEEP_CONN);
+
+    std::string_view rest = std::string_view(records).substr(begin->record_size());
+    auto param_header = FastCgi::parse_header(rest);
+    ASSERT_TRUE(param_header);
+    EXPECT_EQ(param_header->type, FastCgi::PARAMS);
+    FastCgi::Params decoded;
+    ASSERT_TRUE(FastCgi::decode_params(
+        rest.substr(FastCgi::HEADER_SIZE, param_header->content_length), decoded));
+    EXPECT_EQ(decoded, params);
+
+    // Stream data over MAX_CONTENT is split into two records
+    rest.remove_prefix(param_header->record_size());
+    auto first = FastCgi::parse_header(rest);
+    ASSERT_TRUE(first);
+    EXPECT_EQ(first->content_length, FastCgi::MAX_CONTENT);
+    auto second = FastCgi::parse_header(rest.substr(first->record_size()));
+    ASSERT_TRUE(second);
+    EXPECT_EQ(second->content_length, 10);
+
+    EXPECT_FALSE(FastCgi::parse_header("\x01\x06"));
+    EXPECT_FALSE(FastCgi::decode_params(std::string("\x05\x01") + "ab", decoded)); // Truncated
+}
+
+TEST(FastCgiTest, ParsesCgiResponseHead) {
+    FastCgi::ResponseHead head;
+    EXPECT_EQ(FastCgi::parse_response_head("Content-Type: text/plain\r\n", head), 0u);
+
+    std::string output = "Status: 404\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nno";
+    EXPECT_EQ(FastCgi::parse_response_head(output, head), output.size() - 2);
+    EXPECT_EQ(head.status, 404);
+    EXPECT_EQ(head.reason, "Not Found");
+    EXPECT_EQ(head.content_length, 2u);
+    ASSERT_EQ(head.headers.size(), 2u); // Status isn't passed on
+
+    // Bare LF line ends, and Location without Status redirects
+    output = "Location: /elsewhere\nX-Custom: a: b\n\nbody";
+    EXPECT_EQ(FastCgi::parse_response_head(output, head), output.size() - 4);
+    EXPECT_EQ(head.status, 302);
+    EXPECT_EQ(head.headers[1], std::make_pair(std::string("X-Custom"), std::string("a: b")));
+    EXPECT_FALSE(head.content_length);
+
+    std::string http = FastCgi::http_head(head, true, true);
+    EXPECT_EQ(http.rfind("HTTP/1.1 302 Found\r\n", 0), 0u);
+    EXPECT_NE(http.find("\r\nLocation: /elsewhere\r\n"), std::string::npos);
+    EXPECT_NE(http.find("\r\nTransfer-Encoding: chunked\r\n"), std::string::npos);
+
+    EXPECT_FALSE(FastCgi::parse_response_head("not a header\r\n\r\n", head));
+    EXPECT_FALSE(FastCgi::parse_response_head("Status: abc\r\n\r\n", head));
+}
+
+TEST(FastCgiTest, BuildsCgiEnvironment) {
+    std::map<std::string, std::string> headers = {{"POST", "/app/run.sh?a=1&b=2"},
+                                                  {"Host", "example.com:8080"},
+                                                  {"Content-Type", "application/json"},
+                                                  {"Content-Length", "2"},
+                                                  {"X-Forwarded-For", "10.0.0.1"},
+                                                  {"Proxy", "http://evil"}};
+    Cgi::Request request{.method = "POST",
+                         .uri = "/app/run.sh?a=1&b=2",
+                         .script_filename = "/srv/htdocs/app/run.sh",
+                         .document_root = "/srv/htdocs",
+                         .protocol = "HTTP/1.1",
+                         .remote_addr = "127.0.0.1",
+                         .remote_port = 4242,
+                         .content_length = 2};
+    auto env = Cgi::environment(request, headers);
+    auto get = [&](const std::string& name) -> std::optional<std::string> {
+        for (const auto& [key, value] : env) {
+            if (key == name) {
+                return value;
+            }
+        }
+        return std::nullopt;
+    };
+
+    EXPECT_EQ(get("REQUEST_METHOD"), "POST");
+    EXPECT_EQ(get("SCRIPT_NAME"), "/app/run.sh");
+    EXPECT_EQ(get("SCRIPT_FILENAME"), "/srv/htdocs/app/run.sh");
+    EXPECT_EQ(get("QUERY_STRING"), "a=1&b=2");
+    EXPECT_EQ(get("CONTENT_LENGTH"), "2");
+    EXPECT_EQ(get("CONTENT_TYPE"), "application/json");
+    EXPECT_EQ(get("SERVER_NAME"), "example.com");
+    EXPECT_EQ(get("SERVER_PORT"), "8080");
+    EXPECT_EQ(get("REMOTE_PORT"), "4242");
+    EXPECT_EQ(get("HTTP_X_FORWARDED_FOR"), "10.0.0.1");
+    EXPECT_EQ(get("HTTP_HOST"), "example.com:8080");
+    EXPECT_FALSE(get("HTTP_PROXY"));
+    EXPECT_FALSE(get("HTTP_CONTENT_LENGTH"));
+    EXPECT_FALSE(get("HTTP_POST"));
+}
+
+/**
+ * A FastCgiPool and the echo application on one io_context
+ */
+class FastCgiPoolTest : public ::testing::Test {
+  protected:
+    void start_app(bool multiplex) {
+        std::filesystem::remove(path_);
+        app_.emplace(io_, path_, multiplex);
+        options_.enabled = true;
+        options_.socket = path_;
+    }
+
+    void TearDown() override { std::filesystem::remove(path_); }
+
+    FastCgiPool& pool() {
+        return asio::use_service<FastCgiPool>(
+            asio::query(io_.get_executor(), asio::execution::context));
+    }
+
+    // Run several fetches at once
+    std::vector<Response> fetch_all(const std::vector<std::string>& uris) {
+        std::vector<Response> responses(uris.size());
+        size_t done = 0;
+        for (size_t i = 0; i < uris.size(); ++i) {
+            asio::co_spawn(io_, fetch(pool(), options_, uris[i]),
+                           [&, i](std::exception_ptr, Response response) {
+                               responses[i] = std::move(response);
+                               ++done;
+                           });
+        }
+        while (done < uris.size()) {
+            io_.run_one();
+        }
+        return responses;
+    }
+
+    asio::io_context io_;
+    std::string path_ = socket_path("fcgi-pool");
+    std::optional<FastCgiEchoApp> app_;
+    FastCgi::Options options_;
+};
+
+TEST_F(FastCgiPoolTest, StreamsParamsAndBody) {
+    start_app(true);
+    std::string body(200 * 1024, 'p'); // Several STDIN records
+    body[12345] = 'q';
+    Response response = run(io_, fetch(pool(), options_, "/echo.sh", body));
+    ASSERT_TRUE(response.complete);
+    EXPECT_EQ(body_of(response.output), "POST /echo.sh\n" + body);
+
+    // A large response arrives in pieces, all of it
+    response = run(io_, fetch(pool(), options_, "/echo.sh?size=1000000"));
+    ASSERT_TRUE(response.complete);
+    EXPECT_EQ(body_of(response.output), std::string(1000000, 'x'));
+    EXPECT_EQ(app_->connections(), 1u); // Kept open between requests
+}
+
+TEST_F(FastCgiPoolTest, MultiplexesRequestsOnOneConnection) {
+    start_app(true);
+    options_.connections = 1;
+    std::vector<std::string> uris(8, "/slow.sh?delay=50");
+    for (const Response& response : fetch_all(uris)) {
+        EXPECT_TRUE(response.complete);
+        EXPECT_EQ(body_of(response.output), "GET /slow.sh\n");
+    }
+    EXPECT_EQ(app_->connections(), 1u);
+    EXPECT_EQ(app_->max_in_flight(), 8u);
+    EXPECT_EQ(pool().connections(), 1u);
+}
+
+TEST_F(FastCgiPoolTest, OneRequestPerConnectionWithoutMultiplexing) {
+    start_app(false);
+    options_.connections = 2;
+    std::vector<std::string> uris(6, "/slow.sh?delay=20");
+    for (const Response& response : fetch_all(uris)) {
+        EXPECT_TRUE(response.complete);
+    }
+    EXPECT_EQ(app_->connections(), 2u);
+    EXPECT_EQ(app_->max_in_flight(), 1u);
+    EXPECT_EQ(app_->requests(), 6u);
+}
+
+TEST_F(FastCgiPoolTest, AbandonedRequestIsAborted) {
+    start_app(true);
+    options_.connections = 1;
+    auto abandon = [&]() -> asio::awaitable<bool> {
+        auto exchange = co_await pool().start(options_, query_params("delay=200"), {});
+        if (exchange) {
+            exchange->abandon();
+        }
+        co_return exchange != nullptr;
+    };
+    ASSERT_TRUE(run(io_, abandon()));
+    while (app_->aborted() == 0) {
+        io_.run_one();
+    }
+
+    // The connection carries on
+    Response response = run(io_, fetch(pool(), options_, "/after.sh"));
+    EXPECT_TRUE(response.complete);
+    EXPECT_EQ(app_->connections(), 1u);
+}
+
+TEST_F(FastCgiPoolTest, ReportsTimeouts) {
+    start_app(true);
+    auto slow = [&]() -> asio::awaitable<bool> {
+        auto exchange = co_await pool().start(options_, query_params("delay=2000"), {});
+        std::string chunk;
+        bool got_output = co_await exchange->read(chunk, 100ms);
+        co_return !got_output && exchange->timed_out();
+    };
+    EXPECT_TRUE(run(io_, slow()));
+}
+
+TEST_F(FastCgiPoolTest, UnreachableApplicationFails) {
+    options_.enabled = true;
+    options_.socket = socket_path("fcgi-missing");
+    EXPECT_FALSE(run(io_, fetch(pool(), options_, "/hello.sh")).complete);
+    EXPECT_EQ(pool().connections(), 0u);
+}
+
+/**
+ * An AsioServer forwarding scripts to the echo application on its own thread
+ */
+class FastCgiServerTest : public LoopbackServerTest {
+  protected:
+    FastCgiServerTest() : LoopbackServerTest("fastcgi") {}
+
+    void prepare() override {
+        std::ofstream("htdocs/hello.sh") << "#!/bin/sh\n";
+        std::filesystem::remove(path_);
+        app_.emplace(app_io_, path_, true);
+        app_thread_ = std::thread([this] { app_io_.run(); });
+        FastCgi::configure({.enabled = true, .socket = path_});
+    }
+
+    void cleanup() override {
+        app_io_.stop();
+        app_thread_.join();
+        FastCgi::configure({});
+        std::filesystem::remove(path_);
+    }
+
+    std::string path_ = socket_path("fcgi-server");
+    asio::io_context app_io_;
+    std::optional<FastCgiEchoApp> app_;
+    std::thread app_thread_;
+};
+
+TEST_F(FastCgiServerTest, ServesScriptsThroughTheApplication) {
+    std::string response = exchange("GET /hello.sh?status=201 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                    "POST /hello.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Content-Length: 5\r\n\r\nhello"
+                                    "GET /missing.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Connection: close\r\n\r\n");
+
+    // Both script responses came back on the kept-alive connection, then the 404
+    size_t first = response.find("HTTP/1.1 201 Created\r\n");
+    size_t second = response.find("HTTP/1.1 200 OK\r\n");
+    size_t third = response.find("HTTP/1.1 404");
+    ASSERT_NE(first, std::string::npos) << response;
+    ASSERT_NE(second, std::string::npos) << response;
+    ASSERT_NE(third, std::string::npos) << response;
+    EXPECT_LT(first, second);
+    EXPECT_LT(second, third);
+    EXPECT_NE(response.find("\r\n\r\nGET /hello.sh\n"), std::string::npos);
+    EXPECT_NE(response.find("\r\n\r\nPOST /hello.sh\nhello"), std::string::npos);
+}
+
+TEST_F(FastCgiServerTest, StreamsRequestBodies) {
+    // Larger than Http would read into memory itself
+    std::string large(RequestLimits::MAX_BODY_SIZE + 1024 * 1024, 'b');
+    std::string response = exchange("POST /hello.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Content-Length: " + std::to_string(large.size()) +
+                                    "\r\n\r\n" + large +
+                                    "POST /hello.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Transfer-Encoding: chunked\r\n\r\n"
+                                    "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"
+                                    "GET /hello.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Connection: close\r\n\r\n");
+    EXPECT_NE(response.find("\r\n\r\nPOST /hello.sh\n" + large + "HTTP/1.1 200"),
+              std::string::npos);
+    EXPECT_NE(response.find("\r\n\r\nPOST /hello.sh\nhello worldHTTP/1.1 200"),
+              std::string::npos)
+        << response.substr(response.size() - std::min<size_t>(response.size(), 400));
+    EXPECT_TRUE(response.ends_with("\r\n\r\nGET /hello.sh\n"));
+}
+
+TEST_F(FastCgiServerTest, RefusesMalformedStreamedBodies) {
+    std::string response = exchange("POST /hello.sh HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Transfer-Encoding: chunked\r\n\r\n"
+                                    "5\r\nhello\r\nzz\r\n"
+                                    "GET /hello.sh HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 400 Bad Request\r\n")) << response;
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos);
+    EXPECT_EQ(response.find("GET /hello.sh"), std::string::npos); // Not read past the body
+}
+
+TEST_F(FastCgiServerTest, ChunksResponsesWithoutLength) {
+    // Chunked while the connection stays open, then delimited by closing it
+    std::string response = exchange("GET /hello.sh?size=300000 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                    "GET /hello.sh?size=1000 HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Connection: close\r\n\r\n");
+    size_t head_end = response.find("\r\n\r\n");
+    ASSERT_NE(head_end, std::string::npos);
+    EXPECT_NE(response.substr(0, head_end).find("Transfer-Encoding: chunked"), std::string::npos);
+
+    // Decode the chunks
+    std::string body;
+    size_t pos = head_end + 4;
+    while (true) {
+        size_t line_end = response.find("\r\n", pos);
+        ASSERT_NE(line_end, std::string::npos);
+        size_t size = std::stoul(response.substr(pos, line_end - pos), nullptr, 16);
+        pos = line_end + 2 + size + 2;
+        if (size == 0) {
+            break;
+        }
+        body += response.substr(line_end + 2, size);
+    }
+    EXPECT_EQ(body, std::string(300000, 'x'));
+
+    std::string last = response.substr(pos);
+    head_end = last.find("\r\n\r\n");
+    ASSERT_NE(head_end, std::string::npos);
+    EXPECT_EQ(last.find("Transfer-Encoding"), std::string::npos);
+    EXPECT_NE(last.find("Connection: close"), std::string::npos);
+    EXPECT_EQ(last.substr(head_end + 4), std::string(1000, 'x'));
+}
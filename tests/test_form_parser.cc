@@ -0,0 +1,313 @@
+#include "../src/form_parser.h"
+#include "../src/http.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// Feed input in pieces of the given size
+bool feed(FormParser& parser, std::string_view input, size_t piece) {
+    for (size_t pos = 0; pos < input.size(); pos += piece) {
+        if (!parser.consume(input.substr(pos, piece))) {
+            return false;
+        }
+    }
+    return parser.finish();
+}
+
+std::vector<std::pair<std::string, std::string>> pairs(const FormParser& parser) {
+    std::vector<std::pair<std::string, std::string>> result;
+    for (const FormField& field : parser.fields()) {
+        result.emplace_back(field.name, field.value);
+    }
+    return result;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+const std::string BOUNDARY = "----fishjelly7MA4YWxk";
+
+std::string multipart_body() {
+    return "preamble to ignore\r\n"
+           "--" +
+           BOUNDARY +
+           "\r\n"
+           "Content-Disposition: form-data; name=\"title\"\r\n"
+           "\r\n"
+           "Hello\r\nworld\r\n--not the boundary\r\n"
+           "--" +
+           BOUNDARY +
+           "  \r\n"
+           "Content-Disposition: form-data; name=\"upload\"; filename=\"a \\\"b\\\".txt\"\r\n"
+           "Content-Type: text/plain\r\n"
+           "\r\n"
+           "file contents\r\n"
+           "--" +
+           BOUNDARY +
+           "\r\n"
+           "\r\n"
+           "a part without a name\r\n"
+           "--" +
+           BOUNDARY + "--\r\nepilogue to ignore";
+}
+
+} // namespace
+
+TEST(HorspoolSearchTest, FindsFirstOccurrence) {
+    HorspoolSearch search("\r\n--abc");
+    EXPECT_EQ(search.find("\r\n--abc"), 0u);
+    EXPECT_EQ(search.find("xx\r\n--ab\r\n--abc\r\n--abc"), 8u);
+    EXPECT_EQ(search.find("xx\r\n--ab"), std::string_view::npos);
+    EXPECT_EQ(search.find("\r\n--abd"), std::string_view::npos);
+    EXPECT_EQ(search.find(""), std::string_view::npos);
+    EXPECT_EQ(HorspoolSearch("a").find("bba"), 2u);
+}
+
+TEST(UrlEncodedParserTest, DecodesPairsSplitAnywhere) {
+    std::string body = "name=J%C3%B6rg+Smith&empty=&flag&=skipped&&a=1%2B1%3D2&bad=%zz%4&a=again";
+    for (size_t piece = 1; piece <= body.size(); ++piece) {
+        UrlEncodedParser parser;
+        ASSERT_TRUE(feed(parser, body, piece)) << piece;
+        std::vector<std::pair<std::string, std::string>> expected = {
+            {"name", "J\xC3\xB6rg Smith"}, {"empty", ""},      {"flag", ""},
+            {"a", "1+1=2"},                {"bad", "%zz%4"}, {"a", "again"}};
+        EXPECT_EQ(pairs(parser), expected) << piece;
+        EXPECT_EQ(parser.find("a"), "again");
+        EXPECT_FALSE(parser.find("missing"));
+    }
+}
+
+TEST(UrlEncodedParserTest, KeepsEscapeCutShortAtTheEnd) {
+    UrlEncodedParser parser;
+    ASSERT_TRUE(feed(parser, "q=100%", 1));
+    EXPECT_EQ(parser.find("q"), "100%");
+}
+
+TEST(UrlEncodedParserTest, LimitsDecodedSize) {
+    UrlEncodedParser parser(8);
+    EXPECT_TRUE(parser.consume("a=1234"));
+    EXPECT_FALSE(parser.consume("567&b=2"));
+    EXPECT_EQ(parser.error(), FormParser::Error::TooLarge);
+    EXPECT_FALSE(parser.finish());
+}
+
+TEST(UrlEncodedParserTest, LimitsFieldCount) {
+    std::string body;
+    for (size_t i = 0; i <= RequestLimits::MAX_FORM_FIELDS; ++i) {
+        body += "f=&";
+    }
+    UrlEncodedParser parser;
+    EXPECT_FALSE(feed(parser, body, body.size()));
+    EXPECT_EQ(parser.error(), FormParser::Error::TooLarge);
+}
+
+TEST(MultipartParserTest, ParsesPartsSplitAnywhere) {
+    std::string body = multipart_body();
+    for (size_t piece : {size_t{1}, size_t{2}, size_t{3}, size_t{7}, size_t{1000}}) {
+        MultipartParser parser(BOUNDARY);
+        ASSERT_TRUE(feed(parser, body, piece)) << piece;
+        std::vector<std::pair<std::string, std::string>> expected = {
+            {"title", "Hello\r\nworld\r\n--not the boundary"}, {"upload", "file contents"}};
+        EXPECT_EQ(pairs(parser), expected) << piece;
+        ASSERT_EQ(parser.fields().size(), 2u);
+        EXPECT_EQ(parser.fields()[1].filename, "a \"b\".txt");
+        EXPECT_EQ(parser.fields()[1].content_type, "text/plain");
+        EXPECT_EQ(parser.fields()[1].size, 13u);
+        EXPECT_FALSE(parser.fields()[1].spooled());
+    }
+}
+
+TEST(MultipartParserTest, EmptyFirstPartAfterNoPreamble) {
+    MultipartParser parser("b");
+    ASSERT_TRUE(feed(parser,
+                     "--b\r\nContent-Disposition: form-data; name=x\r\n\r\n"
+                     "\r\n--b--",
+                     4));
+    ASSERT_EQ(parser.fields().size(), 1u);
+    EXPECT_EQ(parser.find("x"), "");
+}
+
+TEST(MultipartParserTest, SpoolsLargePartsToFiles) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+                                ("fishjelly-form-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+
+    std::string large(5000, 'x');
+    large[100] = '\r';
+    std::string body = "--b\r\nContent-Disposition: form-data; name=\"small\"\r\n\r\n"
+                       "tiny\r\n"
+                       "--b\r\nContent-Disposition: form-data; name=\"big\"; filename=\"big.bin\""
+                       "\r\n\r\n" +
+                       large +
+                       "\r\n--b\r\nContent-Disposition: form-data; name=\"over\"\r\n\r\n"
+                       "0123456789\r\n--b--";
+    std::string spooled;
+    {
+        MultipartParser::Options options;
+        options.max_memory = 24;
+        options.max_part_memory = 1000;
+        options.spool_dir = dir.string();
+        MultipartParser parser("b", options);
+        ASSERT_TRUE(feed(parser, body, 333));
+
+        const std::vector<FormField>& fields = parser.fields();
+        ASSERT_EQ(fields.size(), 3u);
+        EXPECT_EQ(fields[0].value, "tiny");
+        EXPECT_FALSE(fields[0].spooled());
+
+        // Past the part limit
+        ASSERT_TRUE(fields[1].spooled());
+        EXPECT_TRUE(fields[1].value.empty());
+        EXPECT_EQ(fields[1].size, large.size());
+        EXPECT_EQ(fields[1].filename, "big.bin");
+        spooled = fields[1].file;
+        EXPECT_EQ(std::filesystem::path(spooled).parent_path(), dir);
+        EXPECT_EQ(read_file(spooled), large);
+
+        // Past what is left of the memory limit for all parts
+        ASSERT_TRUE(fields[2].spooled());
+        EXPECT_EQ(read_file(std::string(fields[2].file)), "0123456789");
+        EXPECT_FALSE(parser.find("over"));
+    }
+    EXPECT_FALSE(std::filesystem::exists(spooled));
+    EXPECT_TRUE(std::filesystem::is_empty(dir));
+    std::filesystem::remove_all(dir);
+}
+
+TEST(MultipartParserTest, RejectsMalformedBodies) {
+    std::string part = "--b\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n";
+
+    MultipartParser truncated("b");
+    EXPECT_FALSE(feed(truncated, part, 5));
+    EXPECT_EQ(truncated.error(), FormParser::Error::Malformed);
+
+    MultipartParser junk("b");
+    EXPECT_FALSE(feed(junk, "--b junk\r\n\r\n\r\n--b--", 3));
+    EXPECT_EQ(junk.error(), FormParser::Error::Malformed);
+
+    MultipartParser endless_headers("b");
+    EXPECT_FALSE(feed(endless_headers,
+                      "--b\r\nX: " + std::string(RequestLimits::MAX_HEADER_SIZE, 'h'), 1000));
+    EXPECT_EQ(endless_headers.error(), FormParser::Error::Malformed);
+
+    MultipartParser no_boundary("");
+    EXPECT_FALSE(no_boundary.consume(part));
+    EXPECT_EQ(no_boundary.error(), FormParser::Error::Malformed);
+
+    MultipartParser long_boundary(std::string(71, 'b'));
+    EXPECT_EQ(long_boundary.error(), FormParser::Error::Malformed);
+}
+
+TEST(MultipartParserTest, LimitsPartCount) {
+    std::string body;
+    for (size_t i = 0; i <= RequestLimits::MAX_FORM_FIELDS; ++i) {
+        body += "--b\r\n\r\n\r\n";
+    }
+    body += "--b--";
+    MultipartParser parser("b");
+    EXPECT_FALSE(feed(parser, body, 4096));
+    EXPECT_EQ(parser.error(), FormParser::Error::TooLarge);
+}
+
+TEST(FormParserTest, CreatesParserForContentType) {
+    EXPECT_TRUE(dynamic_cast<UrlEncodedParser*>(
+        FormParser::create("application/x-www-form-urlencoded; charset=UTF-8").get()));
+
+    std::unique_ptr<FormParser> multipart =
+        FormParser::create("Multipart/Form-Data; charset=utf-8; Boundary=\"x y\"");
+    ASSERT_TRUE(dynamic_cast<MultipartParser*>(multipart.get()));
+    EXPECT_TRUE(
+        feed(*multipart, "--x y\r\nContent-Disposition: form-data; name=k\r\n\r\nv\r\n--x y--", 2));
+    EXPECT_EQ(multipart->find("k"), "v");
+
+    EXPECT_EQ(FormParser::create("multipart/form-data")->error(), FormParser::Error::Malformed);
+    EXPECT_FALSE(FormParser::create("application/json"));
+    EXPECT_FALSE(FormParser::create(""));
+}
+
+TEST(FormParserTest, HttpHelpersUseTheParsers) {
+    Http http;
+    std::map<std::string, std::string> form = http.parseFormUrlEncoded("a=1&b=x+y&a=2");
+    EXPECT_EQ(form, (std::map<std::string, std::string>{{"a", "2"}, {"b", "x y"}}));
+
+    std::string body = multipart_body();
+    std::map<std::string, std::string> parts = http.parseMultipartFormData(body, BOUNDARY);
+    EXPECT_EQ(parts.size(), 2u);
+    EXPECT_EQ(parts["upload"], "file contents");
+}
+
+/**
+ * An AsioServer answering POSTs itself, with forms parsed as they arrive
+ */
+class FormServerTest : public LoopbackServerTest {
+  protected:
+    FormServerTest() : LoopbackServerTest("form-server") {}
+
+    // POST a body on its own connection, written in small pieces, and read the response
+    std::string post(const std::string& content_type, const std::string& body) {
+        asio::io_context io;
+        tcp::socket socket = connect(io);
+        std::string request = "POST /submit HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                              "Content-Type: " +
+                              content_type + "\r\nContent-Length: " + std::to_string(body.size()) +
+                              "\r\n\r\n" + body;
+        for (size_t pos = 0; pos < request.size(); pos += 50000) {
+            asio::write(socket, asio::buffer(request.substr(pos, 50000)));
+        }
+        std::string response;
+        boost::system::error_code ec;
+        asio::read(socket, asio::dynamic_buffer(response), ec);
+        return response;
+    }
+};
+
+TEST_F(FormServerTest, ListsUrlEncodedFields) {
+    std::string response =
+        post("application/x-www-form-urlencoded", "name=J%C3%B6rg&comment=a+b%21");
+    EXPECT_NE(response.find("HTTP/1.1 200 OK\r\n"), std::string::npos) << response;
+    EXPECT_NE(response.find("<tr><td>name</td><td>J\xC3\xB6rg</td></tr>"), std::string::npos);
+    EXPECT_NE(response.find("<tr><td>comment</td><td>a b!</td></tr>"), std::string::npos);
+}
+
+TEST_F(FormServerTest, SpoolsLargeUploads) {
+    std::string upload(3 * RequestLimits::MAX_FORM_MEMORY, 'u');
+    std::string body = "--" + BOUNDARY +
+                       "\r\nContent-Disposition: form-data; name=\"note\"\r\n\r\nhi\r\n"
+                       "--" +
+                       BOUNDARY +
+                       "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"u.bin\"\r\n"
+                       "\r\n" +
+                       upload + "\r\n--" + BOUNDARY + "--\r\n";
+    std::string response = post("multipart/form-data; boundary=" + BOUNDARY, body);
+    EXPECT_NE(response.find("HTTP/1.1 200 OK\r\n"), std::string::npos) << response.substr(0, 200);
+    EXPECT_NE(response.find("<p>Content-Length: " + std::to_string(body.size()) + "</p>"),
+              std::string::npos);
+    EXPECT_NE(response.find("<tr><td>note</td><td>hi</td></tr>"), std::string::npos);
+    EXPECT_NE(response.find(std::format("<tr><td>file</td><td>({} bytes, file u.bin)</td></tr>",
+                                        upload.size())),
+              std::string::npos);
+}
+
+TEST_F(FormServerTest, RejectsBadForms) {
+    std::string malformed = post("multipart/form-data; boundary=b", "--b\r\n\r\nno end");
+    EXPECT_NE(malformed.find("HTTP/1.1 400"), std::string::npos) << malformed;
+
+    std::string too_large = post("application/x-www-form-urlencoded",
+                                 "big=" + std::string(RequestLimits::MAX_FORM_MEMORY, 'x'));
+    EXPECT_NE(too_large.find("HTTP/1.1 413"), std::string::npos) << too_large.substr(0, 200);
+}
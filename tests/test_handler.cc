@@ -0,0 +1,379 @@
+#include "../src/blocking_pool.h"
+#include "../src/chunked_decoder.h"
+#include "../src/handler.h"
+#include "../src/http.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <deque>
+#include <format>
+#include <gtest/gtest.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+using namespace std::chrono_literals;
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// A connection whose input arrives in the given pieces and whose output is kept
+class FakeStream : public HandlerStream {
+  public:
+    asio::awaitable<bool> read_more(std::string& input) override {
+        if (pieces.empty()) {
+            co_return false;
+        }
+        input += pieces.front();
+        pieces.pop_front();
+        co_return true;
+    }
+
+    asio::awaitable<bool> write(std::string_view prefix, std::string_view data,
+                                bool chunked) override {
+        output += prefix;
+        if (chunked && !data.empty()) {
+            output += std::format("{:x}\r\n", data.size());
+            output += data;
+            output += "\r\n";
+        } else {
+            output += data;
+        }
+        co_return true;
+    }
+
+    std::deque<std::string> pieces;
+    std::string output;
+};
+
+// Run a coroutine to completion and return its result
+template <typename T> T run(asio::awaitable<T> task) {
+    asio::io_context io;
+    std::optional<T> result;
+    asio::co_spawn(io, std::move(task), [&](std::exception_ptr error, T value) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        result = std::move(value);
+    });
+    io.run();
+    return *result;
+}
+
+// A request whose head is at the front of input
+struct Parsed {
+    Parsed(std::string head, std::string rest = "") : input(head + rest) {
+        request = std::make_unique<Request>(head, input, head.size(), stream);
+    }
+
+    FakeStream stream;
+    std::string input;
+    std::unique_ptr<Request> request;
+};
+
+// Data of a chunked body, up to its last chunk
+std::string dechunk(std::string_view body) {
+    ChunkedDecoder decoder;
+    std::string data;
+    while (!body.empty() && !decoder.done()) {
+        std::string_view piece;
+        auto used = decoder.consume(body, piece);
+        if (!used) {
+            return "<malformed>";
+        }
+        data += piece;
+        body.remove_prefix(*used);
+    }
+    return decoder.done() ? data : "<unfinished>";
+}
+
+// Body of the response at the front of a connection's output
+std::string body_of(const std::string& response) {
+    size_t end = response.find("\r\n\r\n");
+    return end == std::string::npos ? "" : response.substr(end + 4);
+}
+
+} // namespace
+
+TEST(RequestTest, ParsesHead) {
+    Parsed parsed("GET /a/b?x=1&y HTTP/1.1\r\nHost: localhost\r\nX-Test:  value \r\n\r\n");
+    const Request& request = *parsed.request;
+    EXPECT_TRUE(request.valid());
+    EXPECT_EQ(request.method(), Method::Get);
+    EXPECT_EQ(request.method_name(), "GET");
+    EXPECT_EQ(request.target(), "/a/b?x=1&y");
+    EXPECT_EQ(request.path(), "/a/b");
+    EXPECT_EQ(request.query(), "x=1&y");
+    EXPECT_EQ(request.version(), "HTTP/1.1");
+    EXPECT_EQ(request.header("x-test"), "value");
+    EXPECT_FALSE(request.header("Missing"));
+    EXPECT_TRUE(request.keep_alive());
+    EXPECT_TRUE(request.body_read());
+
+    EXPECT_FALSE(Parsed("GET / HTTP/1.1\r\nHost: x\r\nConnection: Close\r\n\r\n")
+                     .request->keep_alive());
+    EXPECT_FALSE(Parsed("GET / HTTP/1.0\r\n\r\n").request->keep_alive());
+    EXPECT_TRUE(
+        Parsed("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n").request->keep_alive());
+}
+
+TEST(RequestTest, RejectsAmbiguousFraming) {
+    auto valid = [](const std::string& fields) {
+        return Parsed("POST / HTTP/1.1\r\nHost: x\r\n" + fields + "\r\n").request->valid();
+    };
+    EXPECT_TRUE(valid("Content-Length: 4\r\n"));
+    EXPECT_TRUE(valid("Transfer-Encoding: chunked\r\n"));
+    EXPECT_FALSE(valid("Content-Length: 4\r\nTransfer-Encoding: chunked\r\n"));
+    EXPECT_FALSE(valid("Content-Length: 4\r\nContent-Length: 5\r\n"));
+    EXPECT_FALSE(valid("Content-Length: 4x\r\n"));
+    EXPECT_FALSE(valid("Transfer-Encoding: gzip, chunked\r\n"));
+    EXPECT_FALSE(valid("content-length: 4\r\ntransfer-encoding: chunked\r\n"));
+    EXPECT_FALSE(valid("Content-Length: 4\r\ncontent-length: 5\r\n"));
+    EXPECT_FALSE(Parsed("GET / HTTP/1.1\r\n\r\n").request->valid()); // No Host
+}
+
+TEST(RequestTest, ReadsRouteKeyFromRequestLine) {
+    auto key = Request::route_key("DELETE /items/7?force=1 HTTP/1.1\r\nHost: x\r\n\r\n");
+    ASSERT_TRUE(key);
+    EXPECT_EQ(key->first, Method::Delete);
+    EXPECT_EQ(key->second, "/items/7");
+    EXPECT_FALSE(Request::route_key("PATCH /items HTTP/1.1\r\n\r\n"));
+    EXPECT_FALSE(Request::route_key("GET /items HTTP/2.0\r\n\r\n"));
+    EXPECT_FALSE(Request::route_key("GET\r\n\r\n"));
+}
+
+TEST(RequestTest, StreamsContentLengthBody) {
+    const std::string next = "GET /next HTTP/1.1\r\n";
+    Parsed parsed("POST /up HTTP/1.1\r\nHost: x\r\nContent-Length: 11\r\n\r\n", "hel");
+    parsed.stream.pieces = {"lo ", "world" + next};
+    Request& request = *parsed.request;
+    size_t head_size = request.consumed();
+
+    std::vector<std::string> pieces;
+    while (auto piece = run(request.read())) {
+        if (piece->empty()) {
+            break;
+        }
+        pieces.emplace_back(*piece);
+        // Pieces read before are dropped from the input
+        EXPECT_LE(parsed.input.size(), head_size + piece->size() + next.size());
+    }
+    EXPECT_EQ(pieces, (std::vector<std::string>{"hel", "lo ", "world"}));
+    EXPECT_TRUE(request.body_read());
+    EXPECT_EQ(request.bytes_read(), 11u);
+    // What follows the body is left for the next request
+    EXPECT_EQ(parsed.input.substr(request.consumed()), next);
+}
+
+TEST(RequestTest, ReadsChunkedBodyWhole) {
+    Parsed parsed("PUT /up HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n", "5\r\nhel");
+    parsed.stream.pieces = {"lo\r\n6;ext=1\r\n world\r\n", "0\r\n\r\nNEXT"};
+    Request& request = *parsed.request;
+
+    EXPECT_EQ(run(request.read_body()), "hello world");
+    EXPECT_TRUE(request.body_read());
+    EXPECT_EQ(parsed.input.substr(request.consumed()), "NEXT");
+}
+
+TEST(RequestTest, FailsOnBadChunksAndOversizedBodies) {
+    Parsed bad("PUT / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n", "zz\r\n");
+    EXPECT_FALSE(run(bad.request->read()));
+
+    Parsed truncated("PUT / HTTP/1.1\r\nHost: x\r\nContent-Length: 9\r\n\r\n", "abc");
+    EXPECT_FALSE(run(truncated.request->read_body()));
+    EXPECT_FALSE(truncated.request->body_read());
+
+    Parsed large("PUT / HTTP/1.1\r\nHost: x\r\nContent-Length: 9\r\n\r\n", "123456789");
+    EXPECT_FALSE(run(large.request->read_body(8)));
+    EXPECT_FALSE(large.request->body_read()); // Left unread
+}
+
+TEST(ResponseWriterTest, SendsWholeBodyWithLength) {
+    Parsed parsed("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ResponseWriter response(parsed.stream, *parsed.request);
+    response.header("X-Test", "1");
+    EXPECT_TRUE(run(response.send(201, "text/plain", "made")));
+    const std::string& output = parsed.stream.output;
+    EXPECT_TRUE(output.starts_with("HTTP/1.1 201 Created\r\n")) << output;
+    EXPECT_NE(output.find("Content-Length: 4\r\n"), std::string::npos);
+    EXPECT_NE(output.find("Connection: keep-alive\r\n"), std::string::npos);
+    EXPECT_NE(output.find("Content-Type: text/plain\r\n"), std::string::npos);
+    EXPECT_NE(output.find("X-Test: 1\r\n"), std::string::npos);
+    EXPECT_TRUE(output.ends_with("\r\n\r\nmade"));
+    EXPECT_EQ(response.bytes_sent(), output.size());
+    EXPECT_TRUE(response.finished());
+    EXPECT_FALSE(run(response.write("more")));
+}
+
+TEST(ResponseWriterTest, StreamsChunkedWithoutLength) {
+    Parsed parsed("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ResponseWriter response(parsed.stream, *parsed.request);
+    EXPECT_TRUE(run(response.write("abc")));
+    EXPECT_TRUE(response.head_sent());
+    response.header("X-Late", "ignored");
+    EXPECT_TRUE(run(response.end("de")));
+    const std::string& output = parsed.stream.output;
+    EXPECT_NE(output.find("Transfer-Encoding: chunked\r\n"), std::string::npos);
+    EXPECT_EQ(output.find("X-Late"), std::string::npos);
+    EXPECT_TRUE(output.ends_with("\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n")) << output;
+    EXPECT_EQ(response.bytes_sent(), output.size());
+    EXPECT_TRUE(response.keep_alive());
+}
+
+TEST(ResponseWriterTest, ClosesHttp10StreamsAndKeepsDeclaredLengths) {
+    Parsed http10("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+    ResponseWriter streamed(http10.stream, *http10.request);
+    EXPECT_TRUE(run(streamed.write("abc")));
+    EXPECT_TRUE(run(streamed.end()));
+    EXPECT_EQ(http10.stream.output.find("Transfer-Encoding"), std::string::npos);
+    EXPECT_NE(http10.stream.output.find("Connection: close\r\n"), std::string::npos);
+    EXPECT_TRUE(http10.stream.output.ends_with("\r\n\r\nabc"));
+    EXPECT_FALSE(streamed.keep_alive());
+
+    Parsed parsed("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ResponseWriter declared(parsed.stream, *parsed.request);
+    declared.header("Content-Length", "3");
+    EXPECT_TRUE(run(declared.write("ab")));
+    EXPECT_TRUE(run(declared.end("c")));
+    EXPECT_EQ(parsed.stream.output.find("Transfer-Encoding"), std::string::npos);
+    EXPECT_TRUE(parsed.stream.output.ends_with("\r\n\r\nabc"));
+    EXPECT_TRUE(declared.keep_alive());
+}
+
+TEST(ResponseWriterTest, LeavesOutBodiesOfHeadAndNoContent) {
+    Parsed head("HEAD / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ResponseWriter response(head.stream, *head.request);
+    EXPECT_TRUE(run(response.send(200, "text/plain", "body")));
+    EXPECT_NE(head.stream.output.find("Content-Length: 4\r\n"), std::string::npos);
+    EXPECT_TRUE(head.stream.output.ends_with("\r\n\r\n"));
+
+    Parsed parsed("DELETE /x HTTP/1.1\r\nHost: x\r\n\r\n");
+    ResponseWriter no_content(parsed.stream, *parsed.request);
+    no_content.status(204);
+    EXPECT_TRUE(run(no_content.end()));
+    EXPECT_TRUE(parsed.stream.output.starts_with("HTTP/1.1 204 No Content\r\n"));
+    EXPECT_EQ(parsed.stream.output.find("Content-Length"), std::string::npos);
+    EXPECT_EQ(parsed.stream.output.find("Transfer-Encoding"), std::string::npos);
+}
+
+/**
+ * Coroutine routes served by an AsioServer, registered once on the shared
+ * router along with a middleware that only acts on their paths
+ */
+class HandlerServerTest : public LoopbackServerTest {
+  protected:
+    HandlerServerTest() : LoopbackServerTest("handler") {}
+
+    static void SetUpTestSuite() {
+        Router& router = Http::router();
+        router.use([](Request& request, ResponseWriter& response,
+                      const Router::AsyncHandler& next) -> asio::awaitable<void> {
+            if (request.path() == "/handler-test/denied") {
+                co_await response.send(403, "text/plain", "denied by middleware\n");
+                co_return;
+            }
+            response.header("X-Middleware", "before");
+            co_await next(request, response);
+        });
+
+        // Echoes the body a piece at a time, after waiting on a timer and the blocking pool
+        router.add(Method::Post, "/handler-test/echo/:name",
+                   [](Request& request, ResponseWriter& response) -> asio::awaitable<void> {
+                       asio::steady_timer timer(co_await asio::this_coro::executor, 5ms);
+                       co_await timer.async_wait(asio::use_awaitable);
+                       std::string name(*request.params().find("name"));
+                       std::string greeting = co_await BlockingPool::getInstance().run(
+                           [&name] { return "hello " + name + "\n"; });
+                       co_await response.write(greeting);
+                       while (auto piece = co_await request.read()) {
+                           if (piece->empty()) {
+                               break;
+                           }
+                           co_await response.write(*piece);
+                       }
+                       co_await response.end();
+                   });
+        router.add(Method::Get, "/handler-test/denied",
+                   [](Request&, ResponseWriter&) -> asio::awaitable<void> {
+                       ADD_FAILURE() << "Middleware should have answered";
+                       co_return;
+                   });
+        router.add(Method::Get, "/handler-test/throws",
+                   [](Request&, ResponseWriter&) -> asio::awaitable<void> {
+                       throw std::runtime_error("handler failed");
+                       co_return;
+                   });
+        router.add(Method::Get, "/handler-test/silent",
+                   [](Request&, ResponseWriter& response) -> asio::awaitable<void> {
+                       response.status(204);
+                       co_return;
+                   });
+    }
+
+    // Send each piece after a pause, and read until the server closes
+    std::string exchange(const std::vector<std::string>& pieces) {
+        asio::io_context io;
+        tcp::socket socket = connect(io);
+        boost::system::error_code ec;
+        for (const std::string& piece : pieces) {
+            asio::write(socket, asio::buffer(piece), ec);
+            std::this_thread::sleep_for(10ms);
+        }
+        std::string response;
+        asio::read(socket, asio::dynamic_buffer(response), ec);
+        return response;
+    }
+};
+
+TEST_F(HandlerServerTest, StreamsBodyThroughCoroutineHandler) {
+    std::string response = exchange({"POST /handler-test/echo/fish HTTP/1.1\r\nHost: localhost\r\n"
+                                     "Content-Length: 10\r\n\r\nfirst",
+                                     " half",
+                                     "GET /missing HTTP/1.1\r\nHost: localhost\r\n"
+                                     "Connection: close\r\n\r\n"});
+    ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+    EXPECT_NE(response.find("X-Middleware: before\r\n"), std::string::npos);
+    EXPECT_NE(response.find("Transfer-Encoding: chunked\r\n"), std::string::npos);
+    EXPECT_EQ(dechunk(body_of(response)), "hello fish\nfirst half") << response;
+    // The pipelined request after the body went on to Http
+    EXPECT_NE(response.find("HTTP/1.1 404"), std::string::npos) << response;
+}
+
+TEST_F(HandlerServerTest, DecodesChunkedRequestBodies) {
+    std::string response = exchange({"POST /handler-test/echo/chunks HTTP/1.1\r\n"
+                                     "Host: localhost\r\nConnection: close\r\n"
+                                     "Transfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n",
+                                     "2\r\nde\r\n0\r\n\r\n"});
+    EXPECT_EQ(dechunk(body_of(response)), "hello chunks\nabcde") << response;
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos);
+}
+
+TEST_F(HandlerServerTest, MiddlewareCanAnswer) {
+    std::string response = exchange({"GET /handler-test/denied HTTP/1.1\r\nHost: localhost\r\n"
+                                     "Connection: close\r\n\r\n"});
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 403 Forbidden\r\n")) << response;
+    EXPECT_TRUE(response.ends_with("denied by middleware\n"));
+}
+
+TEST_F(HandlerServerTest, FinishesWhatHandlersLeave) {
+    std::string response =
+        exchange({"GET /handler-test/throws HTTP/1.1\r\nHost: localhost\r\n\r\n"});
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 500 Internal Server Error\r\n")) << response;
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos);
+
+    response = exchange({"GET /handler-test/silent HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                         "GET /handler-test/silent HTTP/1.1\r\nHost: localhost\r\n"
+                         "Connection: close\r\n\r\n"});
+    size_t first = response.find("HTTP/1.1 204 No Content\r\n");
+    ASSERT_EQ(first, 0u) << response;
+    EXPECT_NE(response.find("HTTP/1.1 204 No Content\r\n", first + 1), std::string::npos);
+}
+
+TEST_F(HandlerServerTest, RejectsMalformedRequests) {
+    // No Host field, so nothing is left unread for closing the connection to reset
+    std::string response =
+        exchange({"POST /handler-test/echo/x HTTP/1.1\r\nContent-Length: 0\r\n\r\n"});
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 400 Bad Request\r\n")) << response;
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos);
+}
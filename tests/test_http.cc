@@ -110,6 +110,19 @@ TEST_F(HttpTest, ParseHeaderWithBody) {
     EXPECT_TRUE(http.parseHeader(header));
 }
 
+TEST_F(HttpTest, ParseHeaderRejectsAmbiguousFraming) {
+    EXPECT_FALSE(http.parseHeader("POST /submit HTTP/1.1\r\n"
+                                  "Host: example.com\r\n"
+                                  "content-length: 5\r\n"
+                                  "transfer-encoding: chunked\r\n"
+                                  "\r\n"));
+    EXPECT_FALSE(http.parseHeader("POST /submit HTTP/1.1\r\n"
+                                  "Host: example.com\r\n"
+                                  "Content-Length: 5\r\n"
+                                  "Content-Length: 50\r\n"
+                                  "\r\n"));
+}
+
 // Content Negotiation Tests
 TEST_F(HttpTest, SendHeaderWithVaryHeader) {
     std::vector<std::string> extra_headers = {"Vary: Accept"};
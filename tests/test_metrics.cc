@@ -0,0 +1,147 @@
+#include "../src/auth.h"
+#include "../src/metrics.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(LogLinearHistogramTest, BucketIndexIsMonotonic) {
+    size_t previous = 0;
+    for (uint64_t v = 0; v < 100000; ++v) {
+        size_t index = LogLinearHistogram::bucket_index(v);
+        EXPECT_GE(index, previous);
+        EXPECT_LE(v, LogLinearHistogram::bucket_upper_bound(index));
+        previous = index;
+    }
+}
+
+TEST(LogLinearHistogramTest, RelativeErrorIsBounded) {
+    for (uint64_t v : {10ULL, 999ULL, 123456ULL, 987654321ULL}) {
+        uint64_t upper =
+            LogLinearHistogram::bucket_upper_bound(LogLinearHistogram::bucket_index(v));
+        EXPECT_LE(static_cast<double>(upper - v) / static_cast<double>(v),
+                  1.0 / LogLinearHistogram::SUB_BUCKETS);
+    }
+}
+
+TEST(LogLinearHistogramTest, LargeValuesAreClamped) {
+    EXPECT_EQ(LogLinearHistogram::bucket_index(UINT64_MAX), LogLinearHistogram::BUCKET_COUNT - 1);
+}
+
+TEST(LogLinearHistogramTest, Percentiles) {
+    LogLinearHistogram h;
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        h.record(v);
+    }
+    EXPECT_EQ(h.count(), 1000u);
+    EXPECT_EQ(h.min(), 1u);
+    EXPECT_EQ(h.max(), 1000u);
+    EXPECT_NEAR(h.mean(), 500.5, 0.001);
+
+    uint64_t p50 = h.percentile(0.5);
+    EXPECT_GE(p50, 500u);
+    EXPECT_LE(p50, 500u + 500u / LogLinearHistogram::SUB_BUCKETS);
+    EXPECT_EQ(h.percentile(1.0), 1000u);
+}
+
+TEST(LogLinearHistogramTest, CoordinatedOmissionCorrection) {
+    LogLinearHistogram h;
+    // One 100ms stall while sampling every 10ms hides 9 delayed requests
+    h.record_corrected(100, 10);
+    EXPECT_EQ(h.count(), 10u);
+    EXPECT_EQ(h.min(), 10u);
+    EXPECT_EQ(h.max(), 100u);
+}
+
+TEST(LogLinearHistogramTest, Merge) {
+    LogLinearHistogram a, b;
+    a.record(5);
+    b.record(50);
+    b.record(500);
+    a.merge(b);
+    EXPECT_EQ(a.count(), 3u);
+    EXPECT_EQ(a.sum(), 555u);
+    EXPECT_EQ(a.min(), 5u);
+    EXPECT_EQ(a.max(), 500u);
+}
+
+TEST(MetricsTest, RenderAggregatesAcrossThreads) {
+    std::thread worker([] {
+        for (int i = 0; i < 1000; ++i) {
+            Metrics::record_request(Metrics::Protocol::Http10, "PUT", 201,
+                                    std::chrono::microseconds(250));
+        }
+    });
+    worker.join();
+    Metrics::record_request(Metrics::Protocol::Http10, "PUT", 201, std::chrono::microseconds(250));
+
+    std::string text = Metrics::render();
+    EXPECT_NE(text.find("shelob_http_requests_total{protocol=\"1.0\",method=\"PUT\",code=\"201\"} "
+                        "1001\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("shelob_http_request_duration_seconds_count{protocol=\"1.0\"} 1001\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("# TYPE shelob_http_request_duration_seconds histogram\n"),
+              std::string::npos);
+}
+
+TEST(MetricsTest, UnknownMethodsAndStatusesAreBucketed) {
+    Metrics::record_request(Metrics::Protocol::Http2, "BREW", 418, std::chrono::nanoseconds(1));
+    std::string text = Metrics::render();
+    EXPECT_NE(text.find("{protocol=\"2\",method=\"OTHER\",code=\"other\"}"), std::string::npos);
+}
+
+TEST(MetricsTest, GaugeGuard) {
+    auto active = [] {
+        std::string text = Metrics::render();
+        std::string key = "\nshelob_http2_active_streams ";
+        auto pos = text.find(key);
+        return std::stoll(text.substr(pos + key.size()));
+    };
+
+    long long before = active();
+    {
+        Metrics::GaugeGuard guard(Metrics::Gauge::ActiveHttp2Streams);
+        EXPECT_EQ(active(), before + 1);
+    }
+    EXPECT_EQ(active(), before);
+}
+
+TEST(MetricsTest, AuthCacheSkipsRepeatVerification) {
+    auto count = [](const std::string& result) {
+        std::string text = Metrics::render();
+        std::string key = "shelob_auth_cache_requests_total{result=\"" + result + "\"} ";
+        auto pos = text.find(key);
+        return std::stoull(text.substr(pos + key.size()));
+    };
+
+    Auth auth;
+    auth.add_user("alice", "secret");
+    uint64_t hits = count("hit");
+    uint64_t misses = count("miss");
+
+    EXPECT_TRUE(auth.validate_basic_auth("Basic YWxpY2U6c2VjcmV0")); // alice:secret
+    EXPECT_TRUE(auth.validate_basic_auth("Basic YWxpY2U6c2VjcmV0"));
+    EXPECT_FALSE(auth.validate_basic_auth("Basic YWxpY2U6d3Jvbmc=")); // alice:wrong
+    EXPECT_EQ(count("hit"), hits + 1);
+    EXPECT_EQ(count("miss"), misses + 2);
+
+    // Entries are tied to the stored hash, so a new password isn't answered from the cache
+    auth.add_user("alice", "changed");
+    EXPECT_FALSE(auth.validate_basic_auth("Basic YWxpY2U6c2VjcmV0"));
+}
+
+TEST(MetricsTest, TlsSessionsSplitFullAndResumed) {
+    auto sessions = [](const std::string& kind) {
+        std::string text = Metrics::render();
+        std::string key = "shelob_tls_sessions_total{session=\"" + kind + "\"} ";
+        auto pos = text.find(key);
+        return std::stoll(text.substr(pos + key.size()));
+    };
+
+    long long full = sessions("full");
+    long long resumed = sessions("resumed");
+    Metrics::record_tls_handshake(std::chrono::milliseconds(2), true);
+    Metrics::record_tls_handshake(std::chrono::microseconds(300), true, true);
+    Metrics::record_tls_handshake(std::chrono::milliseconds(1), false, true);
+    EXPECT_EQ(sessions("full"), full + 1);
+    EXPECT_EQ(sessions("resumed"), resumed + 1);
+}
@@ -0,0 +1,195 @@
+#include "../src/asio_http_connection.h"
+#include "../src/negative_cache.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// Wait for the inotify thread to drop a path
+bool dropped(std::string_view path) {
+    auto deadline = std::chrono::steady_clock::now() + 2s;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!NegativeCache::getInstance().contains(path)) {
+            return true;
+        }
+        std::this_thread::sleep_for(5ms);
+    }
+    return false;
+}
+
+} // namespace
+
+class NegativeCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               ("negative_cache_test_" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir_);
+        NegativeCache::configure({.max_entries = 16, .valid = 60});
+    }
+
+    void TearDown() override {
+        NegativeCache::configure({});
+        std::filesystem::remove_all(dir_);
+    }
+
+    std::string file(const std::string& name) const { return (dir_ / name).string(); }
+
+    std::filesystem::path dir_;
+};
+
+TEST_F(NegativeCacheTest, RemembersMissingPaths) {
+    NegativeCache::getInstance().insert("/missing.html", file("missing.html"));
+    EXPECT_TRUE(NegativeCache::getInstance().contains("/missing.html"));
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/other.html"));
+    EXPECT_EQ(NegativeCache::getInstance().entries(), 1u);
+}
+
+TEST_F(NegativeCacheTest, ExistingFilesAreNotRemembered) {
+    std::ofstream(file("there.html")) << "x";
+    NegativeCache::getInstance().insert("/there.html", file("there.html"));
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/there.html"));
+    EXPECT_EQ(NegativeCache::getInstance().entries(), 0u);
+}
+
+TEST_F(NegativeCacheTest, CreatingTheFileForgetsThePath) {
+    if (!NegativeCache::getInstance().watching()) {
+        GTEST_SKIP() << "inotify unavailable";
+    }
+    NegativeCache::getInstance().insert("/later.html", file("later.html"));
+    ASSERT_TRUE(NegativeCache::getInstance().contains("/later.html"));
+    std::ofstream(file("later.html")) << "now";
+    EXPECT_TRUE(dropped("/later.html"));
+
+    // A missing directory on the way: the nearest one that exists is watched
+    NegativeCache::getInstance().insert("/sub/deep.html", file("sub/deep.html"));
+    ASSERT_TRUE(NegativeCache::getInstance().contains("/sub/deep.html"));
+    std::filesystem::create_directory(dir_ / "sub");
+    EXPECT_TRUE(dropped("/sub/deep.html"));
+}
+
+TEST_F(NegativeCacheTest, LeastRecentlyUsedAndExpiredPathsAreDropped) {
+    NegativeCache::configure({.max_entries = 2, .valid = 60});
+    NegativeCache::getInstance().insert("/a", file("a"));
+    NegativeCache::getInstance().insert("/b", file("b"));
+    EXPECT_TRUE(NegativeCache::getInstance().contains("/a"));
+    NegativeCache::getInstance().insert("/c", file("c"));
+    EXPECT_EQ(NegativeCache::getInstance().entries(), 2u);
+    EXPECT_TRUE(NegativeCache::getInstance().contains("/a"));
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/b"));
+    EXPECT_TRUE(NegativeCache::getInstance().contains("/c"));
+
+    NegativeCache::configure({.max_entries = 2, .valid = 0});
+    NegativeCache::getInstance().insert("/a", file("a"));
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/a"));
+}
+
+TEST_F(NegativeCacheTest, ClearForgetsEverything) {
+    NegativeCache::getInstance().insert("/a", file("a"));
+    NegativeCache::getInstance().clear();
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/a"));
+    EXPECT_EQ(NegativeCache::getInstance().entries(), 0u);
+}
+
+TEST(NegativeCacheDisabledTest, RemembersNothing) {
+    NegativeCache::configure({});
+    NegativeCache::getInstance().insert("/missing", "htdocs/missing");
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/missing"));
+}
+
+TEST(NegativeCacheResponseTest, IsACompleteNotFound) {
+    auto response = NegativeCache::response(true, false);
+    EXPECT_TRUE(response->starts_with("HTTP/1.1 404 Not Found\r\n"));
+    EXPECT_NE(response->find("Connection: keep-alive\r\n"), std::string::npos);
+    EXPECT_NE(response->find(std::format("Content-Length: {}\r\n",
+                                         NegativeCache::NOT_FOUND_BODY.size())),
+              std::string::npos);
+    EXPECT_TRUE(response->ends_with(std::string("\r\n\r\n") +
+                                    std::string(NegativeCache::NOT_FOUND_BODY)));
+
+    auto head = NegativeCache::response(false, true);
+    EXPECT_NE(head->find("Connection: close\r\n"), std::string::npos);
+    EXPECT_TRUE(head->ends_with("\r\n\r\n"));
+    EXPECT_EQ(NegativeCache::response(true, false), response);
+}
+
+class NegativeCacheHttpTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        created_dir_ = std::filesystem::create_directory("htdocs");
+        NegativeCache::configure({.max_entries = 16, .valid = 60});
+    }
+
+    void TearDown() override {
+        NegativeCache::configure({});
+        if (created_dir_) {
+            std::filesystem::remove_all("htdocs");
+        }
+    }
+
+    static std::string get(const std::string& target) {
+        auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+        const std::string request = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        connection->input() = request;
+        connection->process(request.size(), 0);
+        return connection->response();
+    }
+
+    bool created_dir_ = false;
+};
+
+TEST_F(NegativeCacheHttpTest, HttpRemembersMissingFiles) {
+    std::string response = get("/negative-cache-missing.html");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 404 Not Found\r\n"));
+    EXPECT_TRUE(response.ends_with(NegativeCache::NOT_FOUND_BODY));
+    EXPECT_NE(response.find("Connection: keep-alive\r\n"), std::string::npos);
+    EXPECT_TRUE(NegativeCache::getInstance().contains("/negative-cache-missing.html"));
+
+    // The connection only answers targets without a query itself
+    get("/negative-cache-query.html?x=1");
+    EXPECT_FALSE(NegativeCache::getInstance().contains("/negative-cache-query.html"));
+}
+
+class NegativeCacheServerTest : public LoopbackServerTest {
+  protected:
+    NegativeCacheServerTest() : LoopbackServerTest("negative") {}
+
+    void prepare() override { NegativeCache::configure({.max_entries = 16, .valid = 60}); }
+
+    void cleanup() override { NegativeCache::configure({}); }
+};
+
+TEST_F(NegativeCacheServerTest, KnownMissingPathsSkipHttp) {
+    uint64_t hits = metric("shelob_negative_cache_hits_total");
+    std::string response = exchange("GET /scanned.php HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                    "GET /scanned.php HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                    "HEAD /scanned.php HTTP/1.1\r\nHost: localhost\r\n"
+                                    "Connection: close\r\n\r\n");
+    const std::string full = "\r\n\r\n" + std::string(NegativeCache::NOT_FOUND_BODY);
+    size_t first = response.find(full);
+    ASSERT_NE(first, std::string::npos) << response;
+    size_t second = response.find(full, first + full.size());
+    ASSERT_NE(second, std::string::npos) << response;
+    EXPECT_TRUE(response.ends_with("Connection: close\r\nContent-Type: text/html\r\n\r\n"))
+        << response;
+    EXPECT_EQ(metric("shelob_negative_cache_hits_total"), hits + 2);
+
+    if (!NegativeCache::getInstance().watching()) {
+        GTEST_SKIP() << "inotify unavailable";
+    }
+    std::ofstream("htdocs/scanned.php") << "<?php";
+    ASSERT_TRUE(dropped("/scanned.php"));
+    response = exchange("GET /scanned.php HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+}
@@ -0,0 +1,210 @@
+#include "../src/asio_http_connection.h"
+#include "../src/open_file_cache.h"
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Wait for the inotify thread to drop a path's entry
+bool dropped(const std::string& path, const std::shared_ptr<const OpenFileCache::File>& before) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (OpenFileCache::getInstance().open(path) != before) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+} // namespace
+
+class OpenFileCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               ("open_file_cache_test_" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir_);
+        path_ = (dir_ / "page.html").string();
+        std::ofstream(path_) << "hello";
+        OpenFileCache::configure({.max_entries = 16, .valid = 60, .errors_valid = 60});
+    }
+
+    void TearDown() override {
+        OpenFileCache::configure({});
+        std::filesystem::remove_all(dir_);
+    }
+
+    std::filesystem::path dir_;
+    std::string path_;
+};
+
+TEST_F(OpenFileCacheTest, HitsShareTheOpenFile) {
+    auto first = OpenFileCache::getInstance().open(path_);
+    ASSERT_TRUE(first->regular());
+    EXPECT_GE(first->fd(), 0);
+    EXPECT_EQ(first->size(), 5);
+
+    auto second = OpenFileCache::getInstance().open(path_);
+    EXPECT_EQ(second, first);
+    EXPECT_EQ(OpenFileCache::getInstance().entries(), 1u);
+}
+
+TEST_F(OpenFileCacheTest, DirectoriesAreNotOpened) {
+    auto dir = OpenFileCache::getInstance().open(dir_.string());
+    EXPECT_TRUE(dir->directory());
+    EXPECT_FALSE(dir->regular());
+    EXPECT_EQ(dir->fd(), -1);
+}
+
+TEST_F(OpenFileCacheTest, MissingFilesAreRememberedUntilCreated) {
+    std::string missing = (dir_ / "later.html").string();
+    auto before = OpenFileCache::getInstance().open(missing);
+    EXPECT_EQ(before->error(), ENOENT);
+    EXPECT_EQ(OpenFileCache::getInstance().open(missing), before);
+
+    if (!OpenFileCache::getInstance().watching()) {
+        GTEST_SKIP() << "inotify unavailable";
+    }
+    std::ofstream(missing) << "now";
+    ASSERT_TRUE(dropped(missing, before));
+    EXPECT_EQ(OpenFileCache::getInstance().open(missing)->size(), 3);
+}
+
+TEST_F(OpenFileCacheTest, ChangesDropEntries) {
+    if (!OpenFileCache::getInstance().watching()) {
+        GTEST_SKIP() << "inotify unavailable";
+    }
+    auto before = OpenFileCache::getInstance().open(path_);
+    std::ofstream(path_, std::ios::app) << ", world";
+    ASSERT_TRUE(dropped(path_, before));
+    EXPECT_EQ(OpenFileCache::getInstance().open(path_)->size(), 12);
+
+    before = OpenFileCache::getInstance().open(path_);
+    std::filesystem::remove(path_);
+    ASSERT_TRUE(dropped(path_, before));
+    EXPECT_FALSE(OpenFileCache::getInstance().open(path_)->found());
+}
+
+TEST_F(OpenFileCacheTest, ExpiredEntriesKeepUnchangedFiles) {
+    OpenFileCache::configure({.max_entries = 16, .valid = 0, .errors_valid = 0});
+    auto first = OpenFileCache::getInstance().open(path_);
+    EXPECT_EQ(OpenFileCache::getInstance().open(path_), first);
+
+    // Failures aren't kept with errors_valid 0
+    std::string missing = (dir_ / "missing.html").string();
+    EXPECT_FALSE(OpenFileCache::getInstance().open(missing)->found());
+    EXPECT_EQ(OpenFileCache::getInstance().entries(), 1u);
+}
+
+TEST_F(OpenFileCacheTest, LeastRecentlyUsedEntriesAreDropped) {
+    OpenFileCache::configure({.max_entries = 2, .valid = 60, .errors_valid = 60});
+    auto page = OpenFileCache::getInstance().open(path_);
+    OpenFileCache::getInstance().open((dir_ / "a").string());
+    OpenFileCache::getInstance().open(path_);
+    OpenFileCache::getInstance().open((dir_ / "b").string());
+    EXPECT_EQ(OpenFileCache::getInstance().entries(), 2u);
+    EXPECT_EQ(OpenFileCache::getInstance().open(path_), page);
+}
+
+TEST_F(OpenFileCacheTest, ForgetDropsAnEntryRightAway) {
+    auto before = OpenFileCache::getInstance().open(path_);
+    OpenFileCache::getInstance().forget(path_);
+    EXPECT_EQ(OpenFileCache::getInstance().entries(), 0u);
+    EXPECT_NE(OpenFileCache::getInstance().open(path_), before);
+}
+
+TEST(OpenFileCacheDisabledTest, LooksUpEveryTime) {
+    OpenFileCache::configure({});
+    std::string path = std::filesystem::temp_directory_path() / "open_file_cache_disabled";
+    std::ofstream(path) << "x";
+    auto first = OpenFileCache::getInstance().open(path);
+    EXPECT_TRUE(first->regular());
+    EXPECT_NE(OpenFileCache::getInstance().open(path), first);
+    EXPECT_EQ(OpenFileCache::getInstance().entries(), 0u);
+    std::filesystem::remove(path);
+}
+
+class OpenFileCacheHttpTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        created_dir_ = std::filesystem::create_directory("htdocs");
+        std::ofstream("htdocs/open-file-cache.txt") << "cached body";
+        std::ofstream("htdocs/open-file-cache-large.bin", std::ios::binary)
+            << std::string(kLarge, 'L');
+        OpenFileCache::configure({.max_entries = 16, .valid = 60, .errors_valid = 60});
+    }
+
+    void TearDown() override {
+        OpenFileCache::configure({});
+        std::filesystem::remove("htdocs/open-file-cache.txt");
+        std::filesystem::remove("htdocs/open-file-cache-large.bin");
+        if (created_dir_) {
+            std::filesystem::remove("htdocs");
+        }
+    }
+
+    static std::string get(AsioHttpConnection& connection, const std::string& path) {
+        const std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        connection.input() = request;
+        connection.process(request.size(), 0);
+        return connection.response();
+    }
+
+    static constexpr size_t kLarge = 128 * 1024;
+    bool created_dir_ = false;
+};
+
+TEST_F(OpenFileCacheHttpTest, StaticFilesAreServedFromCachedDescriptors) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    EXPECT_TRUE(get(*connection, "/open-file-cache.txt").ends_with("\r\n\r\ncached body"));
+    connection->finishRequest();
+    auto cached = OpenFileCache::getInstance().open("htdocs/open-file-cache.txt");
+    EXPECT_TRUE(get(*connection, "/open-file-cache.txt").ends_with("\r\n\r\ncached body"));
+    connection->finishRequest();
+    EXPECT_EQ(OpenFileCache::getInstance().open("htdocs/open-file-cache.txt"), cached);
+
+    EXPECT_NE(get(*connection, "/missing.txt").find("404"), std::string::npos);
+    connection->finishRequest();
+    EXPECT_EQ(OpenFileCache::getInstance().open("htdocs/missing.txt")->error(), ENOENT);
+}
+
+TEST_F(OpenFileCacheHttpTest, CachedFilesAreServedWithoutBlocking) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    const std::string head = "GET /open-file-cache.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    EXPECT_FALSE(connection->servesFromCache(head)); // Not looked up yet
+    EXPECT_EQ(OpenFileCache::getInstance().cached("htdocs/open-file-cache.txt"), nullptr);
+    get(*connection, "/open-file-cache.txt");
+    connection->finishRequest();
+    EXPECT_TRUE(connection->servesFromCache(head));
+    EXPECT_TRUE(connection->servesFromCache("HEAD /open-file-cache.txt HTTP/1.1\r\n\r\n"));
+    EXPECT_FALSE(connection->servesFromCache("POST /open-file-cache.txt HTTP/1.1\r\n\r\n"));
+
+    // Content negotiation looks for variants as well
+    const std::string negotiated =
+        "GET /open-file-cache.txt HTTP/1.1\r\nHost: localhost\r\nAccept: text/plain\r\n\r\n";
+    EXPECT_FALSE(connection->servesFromCache(negotiated));
+    connection->input() = negotiated;
+    connection->process(negotiated.size(), 0);
+    connection->finishRequest();
+    EXPECT_TRUE(connection->servesFromCache(negotiated));
+}
+
+TEST_F(OpenFileCacheHttpTest, SendfileSharesTheCachedDescriptor) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    connection->setFileSendEnabled(true);
+    get(*connection, "/open-file-cache-large.bin");
+    auto cached = OpenFileCache::getInstance().open("htdocs/open-file-cache-large.bin");
+    EXPECT_EQ(connection->fileBody().fd, cached->fd());
+    EXPECT_EQ(connection->fileBody().count, kLarge);
+
+    // Finishing the response leaves the shared descriptor open
+    connection->finishRequest();
+    EXPECT_EQ(connection->fileBody().fd, -1);
+    EXPECT_NE(fcntl(cached->fd(), F_GETFD), -1);
+}
@@ -0,0 +1,133 @@
+#include "../src/asio_http_connection.h"
+#include "../src/output_chain.h"
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+namespace {
+
+std::vector<boost::asio::const_buffer> gather_all(const OutputChain& chain, size_t index = 0) {
+    std::vector<boost::asio::const_buffer> buffers;
+    chain.gather(index, buffers);
+    return buffers;
+}
+
+} // namespace
+
+TEST(OutputChainTest, ConsecutiveWritesShareOneSegment) {
+    OutputChain chain;
+    chain.append("HTTP/1.1 200 OK\r\n");
+    chain.append("Content-Length: 2\r\n\r\n");
+    chain.append("");
+    EXPECT_EQ(chain.segments(), 1u);
+    EXPECT_EQ(chain.memory_size(), 38u);
+
+    auto buffers = gather_all(chain);
+    ASSERT_EQ(buffers.size(), 1u);
+    EXPECT_EQ(buffers[0].data(), chain.owned().data());
+    EXPECT_EQ(chain.str(), "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n");
+}
+
+TEST(OutputChainTest, SharedBuffersAreNotCopied) {
+    auto body = std::make_shared<const std::string>(4096, 'x');
+    OutputChain chain;
+    chain.append("head\r\n\r\n");
+    chain.append(body);
+    chain.append("trailer");
+    EXPECT_EQ(chain.segments(), 3u);
+    EXPECT_EQ(chain.owned(), "head\r\n\r\ntrailer");
+    EXPECT_EQ(body.use_count(), 2);
+
+    auto buffers = gather_all(chain);
+    ASSERT_EQ(buffers.size(), 3u);
+    EXPECT_EQ(buffers[1].data(), body->data());
+    EXPECT_EQ(buffers[1].size(), body->size());
+    EXPECT_EQ(chain.str(), "head\r\n\r\n" + *body + "trailer");
+
+    chain.clear();
+    EXPECT_EQ(body.use_count(), 1);
+}
+
+TEST(OutputChainTest, FileRangesSplitGatherWrites) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    OutputChain chain;
+    chain.append("head");
+    chain.append_file(fds[0], 10, 100);
+    chain.append("tail");
+    EXPECT_EQ(chain.memory_size(), 8u);
+    EXPECT_EQ(chain.file_size(), 100u);
+    EXPECT_EQ(chain.file().fd, fds[0]);
+    EXPECT_EQ(chain.file().offset, 10);
+
+    std::vector<boost::asio::const_buffer> buffers;
+    size_t index = chain.gather(0, buffers);
+    EXPECT_EQ(index, 1u);
+    EXPECT_EQ(buffers.size(), 1u);
+    ASSERT_NE(chain.file_at(index), nullptr);
+    EXPECT_EQ(chain.file_at(index)->count, 100u);
+    EXPECT_EQ(chain.file_at(0), nullptr);
+
+    buffers.clear();
+    EXPECT_EQ(chain.gather(index + 1, buffers), 3u);
+    ASSERT_EQ(buffers.size(), 1u);
+    EXPECT_EQ(std::string_view(static_cast<const char*>(buffers[0].data()), buffers[0].size()),
+              "tail");
+
+    // Clearing closes the descriptor
+    chain.clear();
+    EXPECT_EQ(fcntl(fds[0], F_GETFD), -1);
+    EXPECT_EQ(chain.file().fd, -1);
+    close(fds[1]);
+}
+
+TEST(OutputChainTest, ClearKeepsOwnedCapacity) {
+    OutputChain chain;
+    chain.append(std::string(1000, 'a'));
+    size_t capacity = chain.owned().capacity();
+    chain.clear();
+    EXPECT_TRUE(chain.empty());
+    EXPECT_EQ(chain.memory_size(), 0u);
+    EXPECT_EQ(chain.owned().capacity(), capacity);
+}
+
+class OutputChainFileTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        created_dir_ = std::filesystem::create_directory("htdocs");
+        std::ofstream("htdocs/output-chain.txt") << "static body";
+    }
+
+    void TearDown() override {
+        std::filesystem::remove("htdocs/output-chain.txt");
+        if (created_dir_) {
+            std::filesystem::remove("htdocs");
+        }
+    }
+
+    bool created_dir_ = false;
+};
+
+TEST_F(OutputChainFileTest, StaticFilesAreNotCopiedIntoTheResponseBuffer) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    const std::string request = "GET /output-chain.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    connection->input() = request;
+    connection->process(request.size(), 0);
+
+    const OutputChain& output = connection->output();
+    std::string response = connection->response();
+    EXPECT_NE(response.find("HTTP/1.1 200 OK\r\n"), std::string::npos);
+    EXPECT_TRUE(response.ends_with("\r\n\r\nstatic body"));
+
+    // The head is the only owned text; the body is its own segment
+    auto buffers = gather_all(output);
+    ASSERT_GE(buffers.size(), 2u);
+    EXPECT_EQ(std::string_view(static_cast<const char*>(buffers.back().data()),
+                               buffers.back().size()),
+              "static body");
+    EXPECT_EQ(output.memory_size(), response.size());
+    connection->finishRequest();
+    EXPECT_TRUE(connection->output().empty());
+}
@@ -0,0 +1,164 @@
+#include "../src/path_rules.h"
+#include "../src/security_middleware.h"
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <unistd.h>
+
+using Kind = PathRules::Kind;
+
+namespace {
+
+// The pattern of the rule matched, or "" if none is
+std::string matched(const PathRules& rules, std::string_view path, std::string_view query = {},
+                    const std::map<std::string, std::string>* headers = nullptr) {
+    const PathRules::Rule* rule = rules.match(path, query, headers);
+    return rule ? rule->pattern : "";
+}
+
+} // namespace
+
+TEST(PathRulesTest, EmptyRulesMatchNothing) {
+    PathRules rules;
+    EXPECT_EQ(rules.match("/anything"), nullptr);
+    EXPECT_EQ(PathRules(std::vector<PathRules::Rule>{}).match(""), nullptr);
+}
+
+TEST(PathRulesTest, PrefixesMatchTheStartOfThePath) {
+    PathRules rules({{Kind::Prefix, "/.git"}, {Kind::Prefix, "/wp-admin"}, {Kind::Prefix, "/w"}});
+    EXPECT_EQ(matched(rules, "/.git/config"), "/.git");
+    EXPECT_EQ(matched(rules, "/.github"), "/.git");
+    EXPECT_EQ(matched(rules, "/wp-admin/index.php"), "/w"); // The shortest is met first
+    EXPECT_EQ(matched(rules, "/docs/.git"), "");
+    EXPECT_EQ(matched(rules, "/.GIT"), ""); // As written: paths are case sensitive
+    EXPECT_EQ(matched(rules, "/"), "");
+}
+
+TEST(PathRulesTest, ExtensionsMatchTheLastSegment) {
+    PathRules rules(
+        {{Kind::Extension, ".bak"}, {Kind::Extension, "sql"}, {Kind::Extension, ".tar.gz"}});
+    EXPECT_EQ(rules.rules()[1].pattern, ".sql");
+    EXPECT_EQ(matched(rules, "/index.php.bak"), ".bak");
+    EXPECT_EQ(matched(rules, "/dump.SQL"), ".sql");
+    EXPECT_EQ(matched(rules, "/site.tar.gz"), ".tar.gz");
+    EXPECT_EQ(matched(rules, "/backup.gz"), "");
+    EXPECT_EQ(matched(rules, "/old.bak/index.html"), "");
+    EXPECT_EQ(matched(rules, "/mysql"), "");
+}
+
+TEST(PathRulesTest, SubstringsMatchAnywhereIgnoringCase) {
+    // The textbook set, whose patterns are suffixes and prefixes of each other
+    PathRules rules({{Kind::Substring, "he"},
+                     {Kind::Substring, "she"},
+                     {Kind::Substring, "his"},
+                     {Kind::Substring, "hers"},
+                     {Kind::Substring, "/etc/passwd"}});
+    EXPECT_EQ(matched(rules, "/ushers"), "she");
+    EXPECT_EQ(matched(rules, "/this"), "his");
+    EXPECT_EQ(matched(rules, "/aHIs"), "his");
+    EXPECT_EQ(matched(rules, "/x/ETC/PASSWD"), "/etc/passwd");
+    EXPECT_EQ(matched(rules, "/etc/passw"), "");
+    EXPECT_EQ(matched(rules, "/hx/sh/hi"), "");
+}
+
+TEST(PathRulesTest, ManyRulesMatchLikeALinearScan) {
+    std::vector<PathRules::Rule> list;
+    for (int i = 0; i < 2000; ++i) {
+        list.push_back({Kind::Substring, std::format("probe{}x", i * 7919 % 100000)});
+        list.push_back({Kind::Prefix, std::format("/p{}/", i)});
+    }
+    PathRules rules(list);
+    for (int i = 0; i < 3000; i += 37) {
+        std::string path = std::format("/a/probe{}x/", i * 7919 % 100000);
+        bool expected = std::ranges::any_of(list, [&path](const PathRules::Rule& rule) {
+            return rule.kind == Kind::Substring && path.find(rule.pattern) != std::string::npos;
+        });
+        EXPECT_EQ(rules.match(path) != nullptr, expected) << path;
+        EXPECT_EQ(rules.match(std::format("/p{}/x", i)) != nullptr, i < 2000) << i;
+    }
+}
+
+TEST(PathRulesTest, QueryAndHeadersOnlyWhenAsked) {
+    std::map<std::string, std::string> headers = {{"user-agent", "sqlmap/1.7"},
+                                                  {"Referer", "sqlmap"}};
+    PathRules path_only({{Kind::Substring, "sqlmap"}});
+    EXPECT_EQ(matched(path_only, "/", "q=sqlmap", &headers), "");
+
+    PathRules everywhere({{Kind::Substring, "sqlmap"}, {Kind::Prefix, "/q"}}, true,
+                         {"User-Agent"});
+    EXPECT_EQ(matched(everywhere, "/", "q=SQLMAP"), "sqlmap");
+    EXPECT_EQ(matched(everywhere, "/", "", &headers), "sqlmap");
+    EXPECT_EQ(matched(everywhere, "/", "sqlmap=/q"), "sqlmap");
+    headers.erase("user-agent");
+    EXPECT_EQ(matched(everywhere, "/", "", &headers), ""); // Referer isn't scanned
+}
+
+TEST(PathRulesTest, ParsesRuleFiles) {
+    PathRules rules = PathRules::parse("# scanners\n"
+                                       "prefix /wp-admin\r\n"
+                                       "\n"
+                                       "  substring   union select  \n"
+                                       "extension .env\n"
+                                       "query\n"
+                                       "header User-Agent");
+    ASSERT_EQ(rules.rules().size(), 3u);
+    EXPECT_EQ(rules.rules()[1].kind, Kind::Substring);
+    EXPECT_EQ(rules.rules()[1].pattern, "union select");
+    EXPECT_EQ(matched(rules, "/wp-admin/"), "/wp-admin");
+    EXPECT_EQ(matched(rules, "/", "id=1 UNION SELECT 1"), "union select");
+    EXPECT_EQ(matched(rules, "/prod.env"), ".env");
+
+    EXPECT_THROW(PathRules::parse("prefix /a\nblock /b\n"), std::runtime_error);
+    EXPECT_THROW(PathRules::parse("prefix\n"), std::runtime_error);
+    EXPECT_THROW(PathRules::parse("query yes\n"), std::runtime_error);
+    EXPECT_THROW(PathRules({{Kind::Prefix, ""}}), std::runtime_error);
+    EXPECT_THROW(PathRules::load("/nonexistent/rules"), std::runtime_error);
+}
+
+class SecurityMiddlewareRulesTest : public ::testing::Test {
+  protected:
+    void TearDown() override { SecurityMiddleware::set_rules(SecurityMiddleware::default_rules()); }
+
+    // Status the middleware leaves, 0 if it passed the request on
+    static int check(const std::string& path, std::map<std::string, std::string> headers = {}) {
+        RequestContext ctx;
+        ctx.path = path;
+        ctx.headers = std::move(headers);
+        bool passed = false;
+        SecurityMiddleware(false).process(ctx, [&passed] { passed = true; });
+        return passed ? 0 : ctx.status_code;
+    }
+};
+
+TEST_F(SecurityMiddlewareRulesTest, BlocksDecodedPaths) {
+    EXPECT_EQ(check("/.env"), 403);
+    EXPECT_EQ(check("/%2eenv"), 403);
+    EXPECT_EQ(check("/wp-admin%252Fsetup.php"), 403);
+    EXPECT_EQ(check("/admin?next=/"), 403);
+    EXPECT_EQ(check("/index.html"), 0);
+}
+
+TEST_F(SecurityMiddlewareRulesTest, SwapsRules) {
+    auto previous = SecurityMiddleware::rules();
+    SecurityMiddleware::set_rules(std::make_shared<const PathRules>(
+        PathRules({{Kind::Extension, ".php"}, {Kind::Substring, "<script"}}, true, {"X-Probe"})));
+    EXPECT_EQ(check("/.env"), 0);
+    EXPECT_EQ(check("/x.PHP"), 403);
+    EXPECT_EQ(check("/?q=%3CScript%3E"), 403);
+    EXPECT_EQ(check("/", {{"X-Probe", "<script>"}}), 403);
+    EXPECT_NE(previous->match("/.env"), nullptr); // Held rules stay as they were
+
+    auto file = std::filesystem::temp_directory_path() /
+                ("path_rules_test_" + std::to_string(getpid()));
+    std::ofstream(file) << "prefix /private\n";
+    SecurityMiddleware::load_rules(file.string());
+    EXPECT_EQ(check("/private/key"), 403);
+    EXPECT_EQ(check("/x.php"), 0);
+
+    std::ofstream(file) << "prefix /private\nbogus\n";
+    EXPECT_THROW(SecurityMiddleware::load_rules(file.string()), std::runtime_error);
+    EXPECT_EQ(check("/private/key"), 403); // Kept after a bad file
+    std::filesystem::remove(file);
+}
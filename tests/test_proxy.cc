@@ -0,0 +1,450 @@
+#include "../src/chunked_decoder.h"
+#include "../src/proxy.h"
+#include "http_echo_upstream.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <fstream>
+#include <future>
+#include <gtest/gtest.h>
+#include <map>
+#include <optional>
+#include <thread>
+
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// Decode a chunked body fed in pieces of the given size
+std::optional<std::string> decode(std::string_view input, size_t piece,
+                                  size_t* consumed = nullptr) {
+    ChunkedDecoder decoder;
+    std::string body;
+    size_t pos = 0;
+    while (pos < input.size() && !decoder.done()) {
+        std::string_view rest = input.substr(pos, piece);
+        size_t offset = 0;
+        while (offset < rest.size() && !decoder.done()) {
+            std::string_view data;
+            auto used = decoder.consume(rest.substr(offset), data);
+            if (!used) {
+                return std::nullopt;
+            }
+            body += data;
+            offset += *used;
+        }
+        pos += offset;
+    }
+    if (consumed) {
+        *consumed = pos;
+    }
+    return decoder.done() ? std::optional(body) : std::nullopt;
+}
+
+Proxy::Options options_for(std::vector<std::string> upstreams, Proxy::Balance balance) {
+    return {.routes = {{.prefix = "/", .upstreams = std::move(upstreams)}}, .balance = balance};
+}
+
+// Index of each server a group picks for a run of requests
+std::vector<size_t> picks(Proxy::Group& group, size_t count) {
+    std::vector<size_t> result;
+    std::vector<bool> tried(group.size());
+    for (size_t i = 0; i < count; ++i) {
+        result.push_back(*group.pick("/", tried));
+    }
+    return result;
+}
+
+} // namespace
+
+TEST(ChunkedDecoderTest, DecodesInputSplitAnywhere) {
+    std::string input = "4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n"
+                        "0\r\nExpires: never\r\n\r\nGET /next";
+    for (size_t piece : {1, 2, 3, 7, 1000}) {
+        size_t consumed = 0;
+        EXPECT_EQ(decode(input, piece, &consumed), "Wikipedia in\r\n\r\nchunks.") << piece;
+        EXPECT_EQ(input.substr(consumed), "GET /next") << piece;
+    }
+
+    // Bare LF line endings, and an empty body
+    EXPECT_EQ(decode("3\nabc\n0\n\n", 1), "abc");
+    EXPECT_EQ(decode("0\r\n\r\n", 1), "");
+}
+
+TEST(ChunkedDecoderTest, RejectsMalformedFraming) {
+    EXPECT_FALSE(decode("zz\r\n", 100));
+    EXPECT_FALSE(decode("\r\n", 100));
+    EXPECT_FALSE(decode("4\r\nWikiX\r\n0\r\n\r\n", 100));
+    EXPECT_FALSE(decode("1000000000000000\r\n", 100)); // 16 digits
+    EXPECT_FALSE(decode("4\r\nWi", 100));             // Incomplete
+}
+
+TEST(ProxyTest, ParsesRequestFraming) {
+    auto request = Proxy::parse_request("POST /api/x?y=1 HTTP/1.1\r\nHost: a\r\n"
+                                        "Content-Length: 5\r\nExpect: 100-continue\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->method, "POST");
+    EXPECT_EQ(request->target, "/api/x?y=1");
+    EXPECT_EQ(request->content_length, 5u);
+    EXPECT_FALSE(request->chunked);
+    EXPECT_TRUE(request->keep_alive);
+    EXPECT_TRUE(request->expect_continue);
+
+    request = Proxy::parse_request("POST / HTTP/1.0\r\nTransfer-Encoding: Chunked\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_TRUE(request->chunked);
+    EXPECT_FALSE(request->keep_alive);
+    request = Proxy::parse_request("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_TRUE(request->keep_alive);
+    request = Proxy::parse_request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_FALSE(request->keep_alive);
+
+    // Framing that could be read two ways is refused (request smuggling)
+    EXPECT_FALSE(Proxy::parse_request("POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                                      "Transfer-Encoding: chunked\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_request("POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                                      "Content-Length: 6\r\n\r\n"));
+    EXPECT_FALSE(
+        Proxy::parse_request("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_request("POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_request("POST / HTTP/1.1\r\nContent-Length: -5\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_request("GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_request("GET / HTTP/2\r\n\r\n"));
+}
+
+TEST(ProxyTest, RewritesRequestHead) {
+    Proxy::Server server("backend:8080", {});
+    auto request = Proxy::parse_request("POST /api HTTP/1.0\r\nHost: example.com\r\n"
+                                        "Connection: keep-alive, X-Hop\r\nX-Hop: 1\r\n"
+                                        "Keep-Alive: timeout=5\r\nTE: trailers\r\n"
+                                        "Expect: 100-continue\r\nX-Forwarded-For: 10.0.0.1\r\n"
+                                        "Content-Length: 3\r\nAccept: */*\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_EQ(Proxy::upstream_head(*request, "192.0.2.7", true, server),
+              "POST /api HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\n"
+              "X-Forwarded-For: 10.0.0.1, 192.0.2.7\r\nX-Forwarded-Proto: https\r\n"
+              "Content-Length: 3\r\n\r\n");
+
+    // HTTP/1.0 requests may leave out Host, which HTTP/1.1 requires
+    request = Proxy::parse_request("GET / HTTP/1.0\r\n\r\n");
+    ASSERT_TRUE(request);
+    EXPECT_EQ(Proxy::upstream_head(*request, "192.0.2.7", false, server),
+              "GET / HTTP/1.1\r\nHost: backend:8080\r\nX-Forwarded-For: 192.0.2.7\r\n"
+              "X-Forwarded-Proto: http\r\n\r\n");
+}
+
+TEST(ProxyTest, RewritesResponseHead) {
+    auto response = Proxy::parse_response("HTTP/1.1 404 Not Found\r\nServer: up\r\n"
+                                          "Transfer-Encoding: chunked\r\n"
+                                          "Connection: close\r\n\r\n");
+    ASSERT_TRUE(response);
+    EXPECT_EQ(response->status, 404);
+    EXPECT_EQ(response->reason, "Not Found");
+    EXPECT_TRUE(response->chunked);
+    EXPECT_FALSE(response->keep_alive);
+    EXPECT_EQ(Proxy::client_head(*response, true, true),
+              "HTTP/1.1 404 Not Found\r\nServer: up\r\nTransfer-Encoding: chunked\r\n"
+              "Connection: keep-alive\r\n\r\n");
+    EXPECT_EQ(Proxy::client_head(*response, false, false),
+              "HTTP/1.1 404 Not Found\r\nServer: up\r\nConnection: close\r\n\r\n");
+
+    response = Proxy::parse_response("HTTP/1.0 200 OK\r\nContent-Length: 12\r\n\r\n");
+    ASSERT_TRUE(response);
+    EXPECT_FALSE(response->keep_alive);
+    EXPECT_EQ(Proxy::client_head(*response, false, true),
+              "HTTP/1.1 200 OK\r\nContent-Length: 12\r\nConnection: keep-alive\r\n\r\n");
+
+    EXPECT_FALSE(Proxy::parse_response("HTTP/1.1 20 OK\r\n\r\n"));
+    EXPECT_FALSE(Proxy::parse_response("ICY 200 OK\r\n\r\n"));
+}
+
+TEST(ProxyTest, ParsesAndMatchesRoutes) {
+    auto route = Proxy::parse_route("/api/=127.0.0.1:8081,[::1]:8082");
+    ASSERT_TRUE(route);
+    EXPECT_EQ(route->prefix, "/api/");
+    EXPECT_EQ(route->upstreams, (std::vector<std::string>{"127.0.0.1:8081", "[::1]:8082"}));
+    EXPECT_FALSE(Proxy::parse_route("api=127.0.0.1:8081"));
+    EXPECT_FALSE(Proxy::parse_route("/api="));
+    EXPECT_FALSE(Proxy::parse_route("/api=localhost"));
+
+    ASSERT_FALSE(
+        Proxy::configure({.routes = {{.prefix = "/api/", .upstreams = {"127.0.0.1:1"}},
+                                     {.prefix = "/api/v2/", .upstreams = {"127.0.0.1:2"}}}}));
+    EXPECT_EQ(Proxy::match("/api/v2/users")->prefix(), "/api/v2/");
+    EXPECT_EQ(Proxy::match("/api/v1")->prefix(), "/api/");
+    EXPECT_EQ(Proxy::match("/index.html"), nullptr);
+    EXPECT_EQ(Proxy::match_request("GET /api/x HTTP/1.1\r\n\r\n")->prefix(), "/api/");
+    EXPECT_EQ(Proxy::match_request("GET /apix HTTP/1.1\r\n\r\n"), nullptr);
+    EXPECT_EQ(Proxy::match("/api/v2/users")->server(0).endpoints().front().port(), 2);
+
+    EXPECT_TRUE(Proxy::configure({.routes = {{.prefix = "/", .upstreams = {"no-port"}}}}));
+    ASSERT_FALSE(Proxy::configure({}));
+    EXPECT_EQ(Proxy::match_request("GET /api/x HTTP/1.1\r\n\r\n"), nullptr);
+}
+
+TEST(ProxyTest, BalancesRoundRobinAndLeastConnections) {
+    std::vector<std::string> upstreams = {"127.0.0.1:1", "127.0.0.1:2", "127.0.0.1:3"};
+    ASSERT_FALSE(Proxy::configure(options_for(upstreams, Proxy::Balance::RoundRobin)));
+    Proxy::Group& group = *Proxy::match("/");
+    EXPECT_EQ(picks(group, 6), (std::vector<size_t>{0, 1, 2, 0, 1, 2}));
+
+    // Servers already tried for the request are skipped
+    std::vector<bool> tried = {true, false, true};
+    EXPECT_EQ(group.pick("/", tried), 1u);
+    tried[1] = true;
+    EXPECT_FALSE(group.pick("/", tried));
+
+    ASSERT_FALSE(Proxy::configure(options_for(upstreams, Proxy::Balance::LeastConnections)));
+    Proxy::Group& least = *Proxy::match("/");
+    Proxy::begin(least.server(0));
+    Proxy::begin(least.server(0));
+    Proxy::begin(least.server(2));
+    EXPECT_EQ(picks(least, 3), (std::vector<size_t>{1, 1, 1}));
+    Proxy::end(least.server(0));
+    Proxy::end(least.server(0));
+    EXPECT_EQ(least.server(0).active(), 0u);
+    auto spread = picks(least, 2); // Ties rotate
+    EXPECT_NE(spread[0], spread[1]);
+    Proxy::end(least.server(2));
+    ASSERT_FALSE(Proxy::configure({}));
+}
+
+TEST(ProxyTest, ConsistentHashingMovesFewKeys) {
+    std::vector<std::string> upstreams = {"127.0.0.1:1", "127.0.0.1:2", "127.0.0.1:3",
+                                          "127.0.0.1:4"};
+    ASSERT_FALSE(Proxy::configure(options_for(upstreams, Proxy::Balance::ConsistentHash)));
+    Proxy::Group& group = *Proxy::match("/");
+    std::vector<bool> none(group.size());
+
+    std::map<std::string, size_t> before;
+    std::vector<size_t> load(group.size());
+    for (int i = 0; i < 4000; ++i) {
+        std::string key = "/item/" + std::to_string(i);
+        before[key] = *group.pick(key, none);
+        EXPECT_EQ(group.pick(key, none), before[key]);
+        ++load[before[key]];
+    }
+    for (size_t count : load) {
+        EXPECT_GT(count, 600u); // Roughly a quarter each
+    }
+
+    // Without server 2 only its keys move
+    std::vector<bool> without = {false, false, true, false};
+    for (const auto& [key, index] : before) {
+        size_t now = *group.pick(key, without);
+        if (index != 2) {
+            EXPECT_EQ(now, index) << key;
+        } else {
+            EXPECT_NE(now, 2u);
+        }
+    }
+    ASSERT_FALSE(Proxy::configure({}));
+}
+
+TEST(ProxyTest, FailuresTakeServersOutOfRotation) {
+    Proxy::Options options = options_for({"127.0.0.1:1", "127.0.0.1:2"},
+                                         Proxy::Balance::RoundRobin);
+    options.max_fails = 2;
+    options.fail_timeout = 60;
+    ASSERT_FALSE(Proxy::configure(options));
+    Proxy::Group& group = *Proxy::match("/");
+    auto now = std::chrono::steady_clock::now();
+
+    EXPECT_FALSE(Proxy::report_failure(group.server(0), false));
+    Proxy::report_success(group.server(0)); // Starts the count again
+    EXPECT_FALSE(Proxy::report_failure(group.server(0), false));
+    EXPECT_TRUE(group.server(0).available(now));
+    EXPECT_TRUE(Proxy::report_failure(group.server(0), false));
+    EXPECT_FALSE(group.server(0).available(std::chrono::steady_clock::now()));
+    EXPECT_EQ(picks(group, 3), (std::vector<size_t>{1, 1, 1}));
+
+    // With every server down there is nothing to pick
+    Proxy::report_failure(group.server(1), false);
+    Proxy::report_failure(group.server(1), false);
+    std::vector<bool> none(group.size());
+    EXPECT_FALSE(group.pick("/", none));
+
+    // A group's only server is never taken out
+    EXPECT_FALSE(Proxy::report_failure(group.server(0), true));
+    ASSERT_FALSE(Proxy::configure({}));
+}
+
+/**
+ * An AsioServer proxying /api/ to two echo upstreams on their own thread
+ */
+class ProxyServerTest : public LoopbackServerTest {
+  protected:
+    ProxyServerTest() : LoopbackServerTest("proxy", false) {}
+
+    void prepare() override {
+        std::ofstream("htdocs/index.html") << "static\n";
+        first_.emplace(upstream_io_, "first");
+        second_.emplace(upstream_io_, "second");
+        upstream_thread_ = std::thread([this] {
+            auto work = asio::make_work_guard(upstream_io_);
+            upstream_io_.run();
+        });
+    }
+
+    void start(Proxy::Options options) {
+        options.routes = {
+            {.prefix = "/api/", .upstreams = {first_->address(), second_->address()}}};
+        ASSERT_FALSE(Proxy::configure(options));
+        start_server();
+    }
+
+    void cleanup() override {
+        upstream_io_.stop();
+        upstream_thread_.join();
+        Proxy::configure({});
+    }
+
+    // Run something on the upstreams' thread and wait for it
+    template <typename F> void on_upstreams(F f) {
+        std::promise<void> done;
+        asio::post(upstream_io_, [&] {
+            f();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+
+    asio::io_context upstream_io_;
+    std::optional<HttpEchoUpstream> first_;
+    std::optional<HttpEchoUpstream> second_;
+    std::thread upstream_thread_;
+};
+
+TEST_F(ProxyServerTest, ForwardsRequestsOnReusedConnections) {
+    start({});
+    std::string get = "GET /api/a HTTP/1.1\r\nHost: example.com\r\n"
+                      "Connection: keep-alive, X-Hop\r\nX-Hop: 1\r\n\r\n";
+    std::string response = exchange(get + get + get + get +
+                                    "GET /index.html HTTP/1.1\r\nHost: example.com\r\n"
+                                    "Connection: close\r\n\r\n");
+
+    // Round robin over both upstreams, each connection opened once
+    size_t first = 0;
+    size_t second = 0;
+    for (size_t pos = 0; (pos = response.find("X-Upstream: ", pos)) != std::string::npos; ++pos) {
+        (response.compare(pos + 12, 5, "first") == 0 ? first : second)++;
+    }
+    EXPECT_EQ(first, 2u) << response;
+    EXPECT_EQ(second, 2u) << response;
+    on_upstreams([&] {
+        EXPECT_EQ(first_->connections(), 1u);
+        EXPECT_EQ(second_->connections(), 1u);
+        EXPECT_EQ(first_->requests(), 2u);
+    });
+
+    // Hop-by-hop fields stay behind; the client's address is passed on
+    EXPECT_NE(response.find("GET /api/a HTTP/1.1\r\nHost: example.com\r\n"
+                            "X-Forwarded-For: 127.0.0.1\r\nX-Forwarded-Proto: http\r\n\r\n"),
+              std::string::npos)
+        << response;
+    EXPECT_EQ(response.find("X-Hop"), std::string::npos);
+
+    // Paths outside the route are still served from htdocs, after the proxied ones
+    size_t last = response.rfind("HTTP/1.1 200");
+    EXPECT_NE(response.find("static\n", last), std::string::npos);
+}
+
+TEST_F(ProxyServerTest, StreamsRequestBodies) {
+    start({});
+    std::string large(3 * 1024 * 1024, 'b');
+    std::string response = exchange("POST /api/upload HTTP/1.1\r\nHost: a\r\n"
+                                    "Content-Length: " + std::to_string(large.size()) +
+                                    "\r\n\r\n" + large +
+                                    "POST /api/chunked HTTP/1.1\r\nHost: a\r\n"
+                                    "Transfer-Encoding: chunked\r\n\r\n"
+                                    "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"
+                                    "GET /api/last HTTP/1.1\r\nHost: a\r\n"
+                                    "Connection: close\r\n\r\n");
+    EXPECT_NE(response.find("\r\n\r\n" + large + "HTTP/1.1 200"), std::string::npos);
+    EXPECT_NE(response.find("POST /api/chunked HTTP/1.1\r\nHost: a\r\n"
+                            "X-Forwarded-For: 127.0.0.1\r\nX-Forwarded-Proto: http\r\n"
+                            "Transfer-Encoding: chunked\r\n\r\nhello world"),
+              std::string::npos)
+        << response.substr(response.size() - 1000);
+    EXPECT_NE(response.find("GET /api/last"), std::string::npos);
+}
+
+TEST_F(ProxyServerTest, ReframesResponsesForTheClient) {
+    start({});
+    std::string response = exchange("GET /api/big?size=100000 HTTP/1.1\r\nHost: a\r\n\r\n"
+                                    "GET /api/eof?close=1 HTTP/1.1\r\nHost: a\r\n\r\n"
+                                    "HEAD /api/head HTTP/1.1\r\nHost: a\r\n\r\n"
+                                    "GET /api/old?size=1000 HTTP/1.0\r\nHost: a\r\n\r\n");
+
+    // Chunked passes through, re-chunked, and a close-delimited body is chunked
+    // so the connection can stay open
+    size_t head_end = response.find("\r\n\r\n");
+    ASSERT_NE(head_end, std::string::npos);
+    EXPECT_NE(response.substr(0, head_end).find("Transfer-Encoding: chunked"), std::string::npos);
+    std::string body;
+    size_t pos = head_end + 4;
+    while (true) {
+        size_t line_end = response.find("\r\n", pos);
+        ASSERT_NE(line_end, std::string::npos);
+        size_t size = std::stoul(response.substr(pos, line_end - pos), nullptr, 16);
+        pos = line_end + 2 + size + 2;
+        if (size == 0) {
+            break;
+        }
+        body += response.substr(line_end + 2, size);
+    }
+    EXPECT_EQ(body, std::string(100000, 'x'));
+    std::string rest = response.substr(pos);
+    EXPECT_TRUE(rest.starts_with("HTTP/1.1 200 OK\r\n")) << rest.substr(0, 200);
+    EXPECT_NE(rest.find("Transfer-Encoding: chunked\r\nConnection: keep-alive"), std::string::npos);
+    EXPECT_NE(rest.find("GET /api/eof?close=1 HTTP/1.1"), std::string::npos);
+
+    // HEAD gets the head alone; HTTP/1.0 gets the body delimited by closing
+    pos = rest.find("HTTP/1.1 200 OK", 1);
+    ASSERT_NE(pos, std::string::npos);
+    rest = rest.substr(pos);
+    head_end = rest.find("\r\n\r\n");
+    EXPECT_NE(rest.substr(0, head_end).find("Content-Length:"), std::string::npos);
+    rest = rest.substr(head_end + 4);
+    ASSERT_TRUE(rest.starts_with("HTTP/1.1 200 OK\r\n")) << rest.substr(0, 200);
+    head_end = rest.find("\r\n\r\n");
+    EXPECT_EQ(rest.find("Transfer-Encoding"), std::string::npos);
+    EXPECT_NE(rest.find("Connection: close"), std::string::npos);
+    EXPECT_EQ(rest.substr(head_end + 4), std::string(1000, 'x'));
+}
+
+TEST_F(ProxyServerTest, FailsOverToHealthyServers) {
+    start({.routes = {}, .max_fails = 1, .fail_timeout = 60});
+    on_upstreams([&] { first_->stop(); });
+
+    std::string get = "GET /api/x HTTP/1.1\r\nHost: a\r\n\r\n";
+    std::string response = exchange(get + get + get + "GET /api/x HTTP/1.1\r\nHost: a\r\n"
+                                                      "Connection: close\r\n\r\n");
+    size_t answered = 0;
+    for (size_t pos = 0; (pos = response.find("X-Upstream: second", pos)) != std::string::npos;
+         ++pos) {
+        ++answered;
+    }
+    EXPECT_EQ(answered, 4u) << response;
+
+    // Once neither answers the client gets a gateway error
+    on_upstreams([&] { second_->stop(); });
+    response = exchange("GET /api/x HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 502 Bad Gateway\r\n")) << response;
+}
+
+TEST_F(ProxyServerTest, SlowUpstreamsTimeOut) {
+    start({.routes = {}, .timeout = 1});
+    std::string response =
+        exchange("GET /api/x?delay=3000 HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 504 Gateway Timeout\r\n")) << response;
+}
+
+TEST_F(ProxyServerTest, RejectsAmbiguousFraming) {
+    start({});
+    std::string response = exchange("POST /api/x HTTP/1.1\r\nHost: a\r\nContent-Length: 4\r\n"
+                                    "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 400 Bad Request\r\n")) << response;
+    on_upstreams([&] { EXPECT_EQ(first_->requests() + second_->requests(), 0u); });
+}
@@ -0,0 +1,395 @@
+#include "../src/proxy.h"
+#include "../src/response_cache.h"
+#include "http_echo_upstream.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using tcp = asio::ip::tcp;
+using Field = ResponseCache::Field;
+
+namespace {
+
+ResponseCache::Request get(std::string_view target, std::vector<Field> fields = {}) {
+    fields.emplace_back("Host", "example.com");
+    return *ResponseCache::request("GET", target, std::move(fields));
+}
+
+std::vector<Field> fresh_for(std::string_view seconds) {
+    return {{"Content-Type", "text/plain"}, {"Cache-Control", std::format("max-age={}", seconds)}};
+}
+
+size_t files_in(const std::filesystem::path& dir) {
+    return static_cast<size_t>(std::distance(std::filesystem::directory_iterator(dir),
+                                             std::filesystem::directory_iterator()));
+}
+
+class ResponseCacheTest : public ::testing::Test {
+  protected:
+    void TearDown() override { ResponseCache::configure({}); }
+
+    ResponseCache& cache_ = ResponseCache::getInstance();
+};
+
+} // namespace
+
+TEST_F(ResponseCacheTest, KeysRequestsAndRefusesPrivateOnes) {
+    auto request = ResponseCache::request("GET", "/a?b=1", {{"Host", "Example.COM"}});
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->key, "GET example.com/a?b=1");
+    EXPECT_FALSE(request->head);
+    EXPECT_FALSE(request->refresh);
+
+    // HEAD shares the GET response; CGI variable names match header names
+    auto head = ResponseCache::request("HEAD", "/a?b=1", {{"HOST", "example.com"}});
+    ASSERT_TRUE(head);
+    EXPECT_EQ(head->key, request->key);
+    EXPECT_TRUE(head->head);
+
+    EXPECT_FALSE(ResponseCache::request("POST", "/a", {{"Host", "example.com"}}));
+    EXPECT_FALSE(ResponseCache::request("GET", "/a", {{"Authorization", "Basic eDp5"}}));
+    EXPECT_FALSE(ResponseCache::request("GET", "/a", {{"Cache-Control", "no-store"}}));
+    EXPECT_TRUE(ResponseCache::request("GET", "/a", {{"Cache-Control", "no-cache"}})->refresh);
+    EXPECT_TRUE(ResponseCache::request("GET", "/a", {{"Pragma", "no-cache"}})->refresh);
+    EXPECT_TRUE(ResponseCache::request("GET", "/a", {{"Cache-Control", "max-age=0"}})->refresh);
+}
+
+TEST_F(ResponseCacheTest, OnlyStoresExplicitlyFreshSharedResponses) {
+    EXPECT_TRUE(ResponseCache::cacheable(200, fresh_for("60")));
+    EXPECT_TRUE(ResponseCache::cacheable(404, {{"Cache-Control", "s-maxage=5"}}));
+    EXPECT_TRUE(ResponseCache::cacheable(200, {{"Expires", "Thu, 01 Jan 2099 00:00:00 GMT"}}));
+
+    EXPECT_FALSE(ResponseCache::cacheable(200, {{"Content-Type", "text/plain"}}));
+    EXPECT_FALSE(ResponseCache::cacheable(500, fresh_for("60")));
+    EXPECT_FALSE(ResponseCache::cacheable(206, fresh_for("60")));
+    EXPECT_FALSE(ResponseCache::cacheable(200, {{"Cache-Control", "private, max-age=60"}}));
+    EXPECT_FALSE(ResponseCache::cacheable(200, {{"Cache-Control", "no-store, max-age=60"}}));
+    EXPECT_FALSE(ResponseCache::cacheable(200, {{"cache-control", "max-age=60, No-Cache"}}));
+    auto with = [](Field field) {
+        auto fields = fresh_for("60");
+        fields.push_back(std::move(field));
+        return fields;
+    };
+    EXPECT_FALSE(ResponseCache::cacheable(200, with({"Set-Cookie", "a=b"})));
+    EXPECT_FALSE(ResponseCache::cacheable(200, with({"Vary", "Accept, *"})));
+}
+
+TEST_F(ResponseCacheTest, TracksFreshnessAndStaleWindows) {
+    ResponseCache::configure({.enabled = true});
+    auto now = std::chrono::steady_clock::now();
+
+    ASSERT_TRUE(cache_.store(get("/fresh"), 200, "OK", fresh_for("60"), "body"));
+    auto entry = cache_.find(get("/fresh"));
+    ASSERT_TRUE(entry);
+    EXPECT_TRUE(entry->fresh(now));
+    EXPECT_EQ(entry->body, "body");
+
+    // s-maxage wins over max-age, and the age the response came with counts
+    ASSERT_TRUE(cache_.store(get("/aged"), 200, "OK",
+                             {{"Cache-Control", "max-age=600, s-maxage=60"}, {"Age", "50"}}, ""));
+    entry = cache_.find(get("/aged"));
+    ASSERT_TRUE(entry);
+    EXPECT_TRUE(entry->fresh(now));
+    EXPECT_FALSE(entry->fresh(now + std::chrono::seconds(15)));
+
+    // Already stale, but usable while revalidating or on error
+    ASSERT_TRUE(cache_.store(get("/stale"), 200, "OK",
+                             {{"Cache-Control",
+                               "max-age=0, stale-while-revalidate=30, stale-if-error=300"}},
+                             "old"));
+    now = std::chrono::steady_clock::now();
+    entry = cache_.find(get("/stale"));
+    ASSERT_TRUE(entry);
+    EXPECT_FALSE(entry->fresh(now));
+    EXPECT_TRUE(entry->revalidatable(now));
+    EXPECT_FALSE(entry->revalidatable(now + std::chrono::seconds(60)));
+    EXPECT_TRUE(entry->usable_on_error(now + std::chrono::seconds(60)));
+
+    // must-revalidate forbids stale responses, so this one would never be used
+    EXPECT_FALSE(cache_.store(get("/strict"), 200, "OK",
+                              {{"Cache-Control", "max-age=0, must-revalidate, stale-if-error=60"}},
+                              ""));
+    EXPECT_FALSE(cache_.store(get("/expired"), 200, "OK",
+                              {{"Date", "Thu, 01 Jan 2026 00:00:00 GMT"},
+                               {"Expires", "Thu, 01 Jan 2026 00:00:00 GMT"}},
+                              ""));
+
+    // HEAD responses have no body to store
+    auto head = *ResponseCache::request("HEAD", "/head", {{"Host", "example.com"}});
+    EXPECT_FALSE(cache_.store(head, 200, "OK", fresh_for("60"), ""));
+    EXPECT_EQ(cache_.entries(), 3u);
+}
+
+TEST_F(ResponseCacheTest, KeepsOneVariantPerVaryValue) {
+    ResponseCache::configure({.enabled = true});
+    auto fields = fresh_for("60");
+    fields.emplace_back("Vary", "Accept-Encoding");
+    auto gzip = get("/v", {{"Accept-Encoding", "gzip"}});
+    auto plain = get("/v", {{"accept-encoding", "identity"}});
+    ASSERT_TRUE(cache_.store(gzip, 200, "OK", fields, "compressed"));
+    EXPECT_FALSE(cache_.find(plain));
+    ASSERT_TRUE(cache_.store(plain, 200, "OK", fields, "plain"));
+
+    EXPECT_EQ(cache_.find(gzip)->body, "compressed");
+    EXPECT_EQ(cache_.find(plain)->body, "plain");
+    EXPECT_FALSE(cache_.find(get("/v")));
+    EXPECT_EQ(cache_.entries(), 2u);
+}
+
+TEST_F(ResponseCacheTest, RebuildsHeadsWithoutFraming) {
+    ResponseCache::configure({.enabled = true});
+    std::vector<Field> fields = {{"Content-Type", "text/plain"},
+                                 {"Cache-Control", "max-age=60"},
+                                 {"Transfer-Encoding", "chunked"},
+                                 {"Connection", "close, X-Hop"},
+                                 {"X-Hop", "1"},
+                                 {"Age", "5"}};
+    ASSERT_TRUE(cache_.store(get("/h"), 200, "OK", fields, "hello"));
+    std::string head = ResponseCache::head(*cache_.find(get("/h")), true, "HIT");
+
+    EXPECT_TRUE(head.starts_with("HTTP/1.1 200 OK\r\n"));
+    EXPECT_NE(head.find("Content-Type: text/plain\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Age: 5\r\n"), std::string::npos);
+    EXPECT_NE(head.find("X-Cache: HIT\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Content-Length: 5\r\n"), std::string::npos);
+    EXPECT_TRUE(head.ends_with("Connection: keep-alive\r\n\r\n"));
+    EXPECT_EQ(head.find("Transfer-Encoding"), std::string::npos);
+    EXPECT_EQ(head.find("X-Hop"), std::string::npos);
+    EXPECT_EQ(head.find("close"), std::string::npos);
+}
+
+TEST_F(ResponseCacheTest, EvictsLeastRecentlyUsedFromMemory) {
+    ResponseCache::configure({.enabled = true, .memory_size = 4096, .max_object_size = 1024});
+    std::string body(1000, 'x');
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(cache_.store(get(std::format("/{}", i)), 200, "OK", fresh_for("60"), body));
+    }
+    ASSERT_TRUE(cache_.find(get("/0"))); // Now more recently used than /1
+
+    for (int i = 3; i < 6; ++i) {
+        ASSERT_TRUE(cache_.store(get(std::format("/{}", i)), 200, "OK", fresh_for("60"), body));
+    }
+    EXPECT_LE(cache_.memory_bytes(), 4096u);
+    EXPECT_TRUE(cache_.find(get("/5")));
+    EXPECT_FALSE(cache_.find(get("/1")));
+    EXPECT_FALSE(cache_.store(get("/big"), 200, "OK", fresh_for("60"), std::string(2000, 'x')));
+}
+
+TEST_F(ResponseCacheTest, SpillsToDiskAndLoadsBack) {
+    auto dir = std::filesystem::temp_directory_path() /
+               ("fishjelly-cache-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "stale.cache") << "left by an earlier run";
+    std::ofstream(dir / "keep.txt") << "not ours";
+    ASSERT_FALSE(ResponseCache::configure({.enabled = true,
+                                           .memory_size = 4096,
+                                           .max_object_size = 2048,
+                                           .disk_path = dir.string(),
+                                           .disk_size = 3000}));
+    EXPECT_FALSE(std::filesystem::exists(dir / "stale.cache"));
+    EXPECT_TRUE(std::filesystem::exists(dir / "keep.txt"));
+
+    for (int i = 0; i < 4; ++i) {
+        std::string body(1000, static_cast<char>('a' + i));
+        ASSERT_TRUE(cache_.store(get(std::format("/{}", i)), 200, "OK", fresh_for("60"), body));
+    }
+    auto spilled = cache_.find(get("/0"));
+    ASSERT_TRUE(spilled);
+    EXPECT_TRUE(spilled->on_disk());
+    EXPECT_TRUE(spilled->body.empty());
+    EXPECT_EQ(cache_.disk_bytes(), 1000u);
+    EXPECT_EQ(files_in(dir), 2u);
+
+    // Read back into memory, pushing another response out to disk
+    auto loaded = cache_.load(get("/0"), *spilled);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded->body, std::string(1000, 'a'));
+    EXPECT_FALSE(cache_.find(get("/0"))->on_disk());
+    EXPECT_TRUE(cache_.find(get("/1"))->on_disk());
+    EXPECT_FALSE(cache_.load(get("/0"), *spilled)); // No longer the stored entry
+
+    // The disk tier has its own limit
+    for (int i = 4; i < 8; ++i) {
+        ASSERT_TRUE(cache_.store(get(std::format("/{}", i)), 200, "OK", fresh_for("60"),
+                                 std::string(1000, 'x')));
+    }
+    EXPECT_LE(cache_.disk_bytes(), 3000u);
+    EXPECT_EQ(files_in(dir), 1u + cache_.disk_bytes() / 1000);
+    EXPECT_EQ(cache_.entries(), 6u); // Three in memory, three on disk
+
+    ResponseCache::configure({});
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(ResponseCacheTest, CoalescesFetchesOfAKey) {
+    asio::io_context io;
+    auto first = cache_.claim("GET example.com/c");
+    ASSERT_TRUE(std::holds_alternative<ResponseCache::FetchLock>(first));
+    auto second = cache_.claim("GET example.com/c");
+    ASSERT_TRUE(std::holds_alternative<std::shared_ptr<ResponseCache::Fetch>>(second));
+    EXPECT_TRUE(std::holds_alternative<ResponseCache::FetchLock>(cache_.claim("GET other/")));
+
+    // The waiter resumes as soon as the lock goes, well before its timeout
+    auto fetch = std::get<std::shared_ptr<ResponseCache::Fetch>>(second);
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration waited{};
+    asio::co_spawn(
+        io,
+        [&]() -> asio::awaitable<void> {
+            co_await fetch->wait(std::chrono::seconds(10));
+            waited = std::chrono::steady_clock::now() - start;
+        },
+        asio::detached);
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        first = std::shared_ptr<ResponseCache::Fetch>(); // Another thread releases the lock
+    });
+    io.run();
+    releaser.join();
+    EXPECT_GE(waited, std::chrono::milliseconds(50));
+    EXPECT_LT(waited, std::chrono::seconds(5));
+    auto again = cache_.claim("GET example.com/c");
+    EXPECT_TRUE(std::holds_alternative<ResponseCache::FetchLock>(again));
+}
+
+namespace {
+
+// A proxy in front of one HttpEchoUpstream, with the cache enabled
+class ResponseCacheServerTest : public LoopbackServerTest {
+  protected:
+    ResponseCacheServerTest() : LoopbackServerTest("response-cache") {}
+
+    void prepare() override {
+        upstream_.emplace(upstream_io_, "origin");
+        upstream_thread_ = std::thread([this] {
+            auto work = asio::make_work_guard(upstream_io_);
+            upstream_io_.run();
+        });
+        ASSERT_FALSE(Proxy::configure(
+            {.routes = {{.prefix = "/api/", .upstreams = {upstream_->address()}}}}));
+        ASSERT_FALSE(ResponseCache::configure({.enabled = true}));
+    }
+
+    void cleanup() override {
+        upstream_io_.stop();
+        upstream_thread_.join();
+        Proxy::configure({});
+        ResponseCache::configure({});
+    }
+
+    std::string get(std::string_view target, std::string_view connection = "close") {
+        return std::format("GET {} HTTP/1.1\r\nHost: example.com\r\nConnection: {}\r\n\r\n",
+                           target, connection);
+    }
+
+    size_t upstream_requests() {
+        std::promise<size_t> requests;
+        asio::post(upstream_io_, [&] { requests.set_value(upstream_->requests()); });
+        return requests.get_future().get();
+    }
+
+    // Run something on the upstream's thread and wait for it
+    template <typename F> void on_upstream(F f) {
+        std::promise<void> done;
+        asio::post(upstream_io_, [&] {
+            f();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+
+    static size_t count(std::string_view text, std::string_view what) {
+        size_t found = 0;
+        for (size_t pos = text.find(what); pos != std::string_view::npos;
+             pos = text.find(what, pos + what.size())) {
+            ++found;
+        }
+        return found;
+    }
+
+    asio::io_context upstream_io_;
+    std::optional<HttpEchoUpstream> upstream_;
+    std::thread upstream_thread_;
+};
+
+} // namespace
+
+TEST_F(ResponseCacheServerTest, AnswersRepeatsFromTheCache) {
+    std::string response = exchange(get("/api/a?max_age=60", "keep-alive") +
+                                    get("/api/a?max_age=60", "keep-alive") +
+                                    "HEAD /api/a?max_age=60 HTTP/1.1\r\nHost: example.com\r\n\r\n" +
+                                    get("/api/a?max_age=60"));
+    EXPECT_EQ(count(response, "HTTP/1.1 200 OK"), 4u);
+    EXPECT_EQ(count(response, "X-Cache: HIT"), 3u);
+    EXPECT_EQ(count(response, "origin\nGET /api/a"), 3u); // HEAD has no body
+    EXPECT_EQ(upstream_requests(), 1u);
+
+    // Asking for a fresh response goes to the upstream, and stores what comes back
+    response = exchange("GET /api/a?max_age=60 HTTP/1.1\r\nHost: example.com\r\n"
+                        "Cache-Control: no-cache\r\nConnection: close\r\n\r\n");
+    EXPECT_EQ(response.find("X-Cache"), std::string::npos);
+    EXPECT_EQ(upstream_requests(), 2u);
+
+    // Responses without freshness aren't kept
+    exchange(get("/api/plain"));
+    exchange(get("/api/plain"));
+    EXPECT_EQ(upstream_requests(), 4u);
+}
+
+TEST_F(ResponseCacheServerTest, CoalescesConcurrentMisses) {
+    std::vector<std::future<std::string>> responses;
+    for (int i = 0; i < 8; ++i) {
+        responses.push_back(std::async(std::launch::async, [this] {
+            return exchange(get("/api/slow?max_age=60&delay=300"));
+        }));
+    }
+    size_t hits = 0;
+    for (auto& response : responses) {
+        std::string text = response.get();
+        EXPECT_NE(text.find("origin\nGET /api/slow"), std::string::npos);
+        hits += count(text, "X-Cache: HIT");
+    }
+    EXPECT_EQ(upstream_requests(), 1u);
+    EXPECT_EQ(hits, 7u);
+}
+
+TEST_F(ResponseCacheServerTest, ServesStaleWhileRevalidating) {
+    exchange(get("/api/s?max_age=0&swr=60"));
+    std::string response = exchange(get("/api/s?max_age=0&swr=60"));
+    EXPECT_NE(response.find("X-Cache: STALE"), std::string::npos);
+    EXPECT_NE(response.find("origin\nGET /api/s"), std::string::npos);
+
+    // Refetched in the background, once
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (upstream_requests() < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(upstream_requests(), 2u);
+}
+
+TEST_F(ResponseCacheServerTest, ServesStaleInsteadOfErrors) {
+    exchange(get("/api/e?max_age=0&sie=60"));
+
+    on_upstream([this] { upstream_->fail_with(503); });
+    std::string response = exchange(get("/api/e?max_age=0&sie=60"));
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_NE(response.find("X-Cache: STALE"), std::string::npos);
+
+    on_upstream([this] { upstream_->stop(); });
+    response = exchange(get("/api/e?max_age=0&sie=60"));
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_NE(response.find("X-Cache: STALE"), std::string::npos);
+
+    // Without a stored response the error goes through
+    response = exchange(get("/api/other?max_age=0&sie=60"));
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 502"));
+}
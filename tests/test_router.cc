@@ -0,0 +1,208 @@
+#include "../src/asio_http_connection.h"
+#include "../src/http.h"
+#include "../src/router.h"
+#include "loopback_server.h"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+using tcp = asio::ip::tcp;
+
+namespace {
+
+// A router whose handlers record which of them was called
+class RouterTest : public ::testing::Test {
+  protected:
+    void add(Method method, std::string_view pattern, int id) {
+        router_.add(method, pattern, [id](Http&, const RouteRequest&) { called_ = id; });
+    }
+
+    // Id of the handler matched, 0 if none
+    int match(Method method, std::string_view path) {
+        auto route = router_.match(method, path);
+        if (!route) {
+            return 0;
+        }
+        params_ = route->params;
+        called_ = 0;
+        static Http http;
+        std::map<std::string, std::string> headers;
+        RouteRequest request{headers, path, path, "", "", params_, false};
+        (*route->handler)(http, request);
+        return called_;
+    }
+
+    std::string param(std::string_view name) {
+        return std::string(params_.find(name).value_or("<none>"));
+    }
+
+    Router router_;
+    RouteParams params_;
+    static inline int called_ = 0;
+};
+
+} // namespace
+
+TEST(MethodTest, ParsesServedMethods) {
+    EXPECT_EQ(parseMethod("GET"), Method::Get);
+    EXPECT_EQ(parseMethod("HEAD"), Method::Head);
+    EXPECT_EQ(parseMethod("DELETE"), Method::Delete);
+    EXPECT_EQ(parseMethod("OPTIONS"), Method::Options);
+    EXPECT_FALSE(parseMethod("get"));
+    EXPECT_FALSE(parseMethod("PATCH"));
+}
+
+TEST_F(RouterTest, MatchesStaticRoutesSharingPrefixes) {
+    add(Method::Get, "/", 1);
+    add(Method::Get, "/users", 2);
+    add(Method::Get, "/users/new", 3);
+    add(Method::Get, "/user", 4);
+    add(Method::Get, "/uploads", 5);
+    EXPECT_EQ(router_.size(), 5u);
+
+    EXPECT_EQ(match(Method::Get, "/"), 1);
+    EXPECT_EQ(match(Method::Get, "/users"), 2);
+    EXPECT_EQ(match(Method::Get, "/users/new"), 3);
+    EXPECT_EQ(match(Method::Get, "/user"), 4);
+    EXPECT_EQ(match(Method::Get, "/uploads"), 5);
+    EXPECT_EQ(match(Method::Get, "/use"), 0);
+    EXPECT_EQ(match(Method::Get, "/users/"), 0);
+    EXPECT_EQ(match(Method::Get, "/users/newer"), 0);
+    EXPECT_EQ(match(Method::Get, ""), 0);
+}
+
+TEST_F(RouterTest, KeepsATreePerMethod) {
+    add(Method::Get, "/items", 1);
+    add(Method::Post, "/items", 2);
+    EXPECT_EQ(match(Method::Get, "/items"), 1);
+    EXPECT_EQ(match(Method::Post, "/items"), 2);
+    EXPECT_EQ(match(Method::Head, "/items"), 0);
+}
+
+TEST_F(RouterTest, ExtractsParameters) {
+    add(Method::Get, "/users/:id", 1);
+    add(Method::Get, "/users/:id/posts/:post", 2);
+
+    EXPECT_EQ(match(Method::Get, "/users/42"), 1);
+    EXPECT_EQ(param("id"), "42");
+    EXPECT_EQ(match(Method::Get, "/users/42/posts/hello-world"), 2);
+    EXPECT_EQ(param("id"), "42");
+    EXPECT_EQ(param("post"), "hello-world");
+    EXPECT_EQ(param("missing"), "<none>");
+
+    EXPECT_EQ(match(Method::Get, "/users/"), 0); // Parameters aren't empty
+    EXPECT_EQ(match(Method::Get, "/users/42/posts"), 0);
+}
+
+TEST_F(RouterTest, MatchesWildcardsToTheEnd) {
+    add(Method::Get, "/static/*file", 1);
+    EXPECT_EQ(match(Method::Get, "/static/css/site.css"), 1);
+    EXPECT_EQ(param("file"), "css/site.css");
+    EXPECT_EQ(match(Method::Get, "/static/"), 1);
+    EXPECT_EQ(param("file"), "");
+    EXPECT_EQ(match(Method::Get, "/static"), 0);
+}
+
+TEST_F(RouterTest, PrefersStaticThenParameterThenWildcard) {
+    add(Method::Get, "/files/new", 1);
+    add(Method::Get, "/files/:id/meta", 2);
+    add(Method::Get, "/files/*path", 3);
+
+    EXPECT_EQ(match(Method::Get, "/files/new"), 1);
+    // Falls back to the parameter when the static route doesn't go on
+    EXPECT_EQ(match(Method::Get, "/files/new/meta"), 2);
+    EXPECT_EQ(param("id"), "new");
+    EXPECT_EQ(match(Method::Get, "/files/7/meta"), 2);
+    EXPECT_EQ(param("id"), "7");
+    // And to the wildcard, without the parameter it tried
+    EXPECT_EQ(match(Method::Get, "/files/7/other"), 3);
+    EXPECT_EQ(param("path"), "7/other");
+    EXPECT_EQ(param("id"), "<none>");
+}
+
+TEST_F(RouterTest, TreatsMarksInsideSegmentsAsText) {
+    add(Method::Get, "/time/12:30", 1);
+    add(Method::Get, "/a*b", 2);
+    EXPECT_EQ(match(Method::Get, "/time/12:30"), 1);
+    EXPECT_EQ(match(Method::Get, "/time/12:31"), 0);
+    EXPECT_EQ(match(Method::Get, "/a*b"), 2);
+    EXPECT_EQ(match(Method::Get, "/axb"), 0);
+}
+
+TEST_F(RouterTest, RejectsBadPatterns) {
+    add(Method::Get, "/users/:id", 1);
+    add(Method::Get, "/all/*rest", 2);
+    EXPECT_THROW(add(Method::Get, "users", 0), std::runtime_error);
+    EXPECT_THROW(add(Method::Get, "/users/:", 0), std::runtime_error);
+    EXPECT_THROW(add(Method::Get, "/all/*rest/more", 0), std::runtime_error);
+    EXPECT_THROW(add(Method::Get, "/users/:id", 0), std::runtime_error);
+    EXPECT_THROW(add(Method::Get, "/users/:uid/posts", 0), std::runtime_error);
+    EXPECT_THROW(add(Method::Get, "/all/*path", 0), std::runtime_error);
+    EXPECT_NO_THROW(add(Method::Post, "/users/:id", 3));
+    EXPECT_EQ(router_.size(), 3u);
+}
+
+TEST_F(RouterTest, MatchesAmongManyRoutes) {
+    for (int i = 0; i < 1000; ++i) {
+        add(Method::Get, "/api/v1/resource" + std::to_string(i) + "/:id", i + 1);
+    }
+    for (int i = 0; i < 1000; i += 37) {
+        EXPECT_EQ(match(Method::Get, "/api/v1/resource" + std::to_string(i) + "/x"), i + 1);
+        EXPECT_EQ(param("id"), "x");
+    }
+    EXPECT_EQ(match(Method::Get, "/api/v1/resource1000/x"), 0);
+}
+
+/**
+ * Requests dispatched by Http through the shared router, run in a scratch
+ * directory for the access log
+ */
+class HttpRoutingTest : public TempRootTest {
+  protected:
+    HttpRoutingTest() : TempRootTest("router") {}
+
+    static std::string get(const std::string& target, const std::string& headers = "") {
+        auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+        std::string head = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n" + headers + "\r\n";
+        connection->input() = head;
+        connection->process(head.size(), 0);
+        return connection->response();
+    }
+};
+
+TEST_F(HttpRoutingTest, ServesRegisteredHandlers) {
+    static bool registered = [] {
+        Http::router().add(Method::Get, "/router-test/:name",
+                           [](Http& http, const RouteRequest& request) {
+                               std::string body = std::string(*request.params.find("name")) +
+                                                  "|" + std::string(request.query);
+                               http.sendHeader(200, body.size(), "text/plain",
+                                               request.keep_alive);
+                               http.sock->write_raw(body.data(), body.size());
+                           });
+        return true;
+    }();
+    ASSERT_TRUE(registered);
+
+    std::string response = get("/router-test/fish?x=1");
+    EXPECT_NE(response.find("HTTP/1.1 200 OK"), std::string::npos);
+    EXPECT_TRUE(response.ends_with("\r\n\r\nfish|x=1")) << response;
+
+    // Paths no route takes are served from files
+    EXPECT_NE(get("/router-test/").find("HTTP/1.1 404"), std::string::npos);
+}
+
+TEST_F(HttpRoutingTest, ServesCookieDemo) {
+    std::string response = get("/cookie-demo", "Cookie: visit_count=4\r\n");
+    EXPECT_NE(response.find("HTTP/1.1 200 OK"), std::string::npos);
+    EXPECT_NE(response.find("Set-Cookie: visit_count=5"), std::string::npos);
+    EXPECT_NE(response.find("<p>Visit count: 5</p>"), std::string::npos);
+
+    response = get("/set-cookie?name=theme&value=dark");
+    EXPECT_NE(response.find("HTTP/1.1 302"), std::string::npos);
+    EXPECT_NE(response.find("Location: /cookie-demo"), std::string::npos);
+    EXPECT_NE(response.find("Set-Cookie: theme=dark"), std::string::npos);
+
+    response = get("/clear-cookies");
+    EXPECT_NE(response.find("Set-Cookie: theme=; Path=/; Max-Age=0"), std::string::npos);
+}
@@ -0,0 +1,79 @@
+#include "../src/asio_http_connection.h"
+#include "loopback_server.h"
+#include <fstream>
+#include <gtest/gtest.h>
+
+/**
+ * Static files served by an AsioHttpConnection from a scratch document root,
+ * large ones left for sendfile when the connection allows it
+ */
+class AsioHttpConnectionFileTest : public TempRootTest {
+  protected:
+    AsioHttpConnectionFileTest() : TempRootTest("sendfile") {}
+
+    void SetUp() override {
+        TempRootTest::SetUp();
+        std::string content(kLarge, 'f');
+        content.replace(0, 4, "head");
+        content.replace(kLarge - 4, 4, "tail");
+        std::ofstream("htdocs/sendfile-test.bin", std::ios::binary) << content;
+        std::ofstream("htdocs/sendfile-small.txt") << "small";
+    }
+
+    static void get(AsioHttpConnection& connection, const std::string& path,
+                    const std::string& headers = "") {
+        const std::string request =
+            "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + headers + "\r\n";
+        connection.input() = request;
+        connection.process(request.size(), 0);
+    }
+
+    static constexpr size_t kLarge = 128 * 1024;
+};
+
+TEST_F(AsioHttpConnectionFileTest, LargeFilesAreQueuedForSendfile) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    connection->setFileSendEnabled(true);
+    get(*connection, "/sendfile-test.bin");
+
+    EXPECT_EQ(connection->fileBody().count, kLarge);
+    EXPECT_GE(connection->fileBody().fd, 0);
+    EXPECT_NE(connection->response().find("Content-Length: 131072"), std::string::npos);
+    EXPECT_LT(connection->response().size(), 1024u); // Headers only
+
+    connection->finishRequest();
+    EXPECT_EQ(connection->fileBody().fd, -1);
+}
+
+TEST_F(AsioHttpConnectionFileTest, FilesAreBufferedWithoutSendfile) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    get(*connection, "/sendfile-test.bin");
+    EXPECT_EQ(connection->fileBody().fd, -1);
+    EXPECT_GT(connection->response().size(), kLarge);
+}
+
+TEST_F(AsioHttpConnectionFileTest, SmallFilesAreBuffered) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    connection->setFileSendEnabled(true);
+    get(*connection, "/sendfile-small.txt");
+    EXPECT_EQ(connection->fileBody().fd, -1);
+    EXPECT_NE(connection->response().find("small"), std::string::npos);
+}
+
+TEST_F(AsioHttpConnectionFileTest, RangesAreSentFromTheOpenFile) {
+    auto connection = AsioHttpConnection::acquire(nullptr, tcp::endpoint());
+    connection->setFileSendEnabled(true);
+    get(*connection, "/sendfile-test.bin", "Range: bytes=4-70003\r\n");
+    EXPECT_NE(connection->response().find("206 Partial Content"), std::string::npos);
+    EXPECT_GE(connection->fileBody().fd, 0);
+    EXPECT_EQ(connection->fileBody().offset, 4);
+    EXPECT_EQ(connection->fileBody().count, 70000u);
+    connection->finishRequest();
+
+    get(*connection, "/sendfile-test.bin", "Range: bytes=0-3,-4\r\n");
+    EXPECT_EQ(connection->fileBody().fd, -1);
+    const std::string& response = connection->response();
+    EXPECT_NE(response.find("multipart/byteranges"), std::string::npos);
+    EXPECT_NE(response.find("bytes 0-3/131072\r\n\r\nhead"), std::string::npos);
+    EXPECT_NE(response.find("bytes 131068-131071/131072\r\n\r\ntail"), std::string::npos);
+}
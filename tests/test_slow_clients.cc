@@ -0,0 +1,114 @@
+#include "../src/connection_timeouts.h"
+#include "loopback_server.h"
+#include <atomic>
+#include <boost/asio.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t BIG_FILE_SIZE = 16 * 1024 * 1024;
+
+void send(tcp::socket& socket, const std::string& data) { asio::write(socket, asio::buffer(data)); }
+
+std::string post_head(size_t content_length) {
+    return "POST /index.html HTTP/1.1\r\nHost: localhost\r\nContent-Length: " +
+           std::to_string(content_length) + "\r\n\r\n";
+}
+
+/**
+ * Send size bytes of body, piece bytes every interval
+ * @return Whether the server accepted all of it
+ */
+bool trickle(tcp::socket& socket, size_t size, size_t piece, Clock::duration interval) {
+    std::string chunk(piece, 'x');
+    for (size_t sent = 0; sent < size; sent += piece) {
+        boost::system::error_code ec;
+        asio::write(socket, asio::buffer(chunk, std::min(piece, size - sent)), ec);
+        if (ec) {
+            return false;
+        }
+        std::this_thread::sleep_for(interval);
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * Throttled clients against a document root with one big file
+ */
+class SlowClientTest : public LoopbackServerTest {
+  protected:
+    SlowClientTest() : LoopbackServerTest("slow-clients") {}
+
+    void prepare() override {
+        std::ofstream("mime.types") << "text/html html\napplication/octet-stream bin\n";
+        std::ofstream("htdocs/index.html") << "<html><body>ok</body></html>\n";
+        std::ofstream("htdocs/big.bin", std::ios::binary) << std::string(BIG_FILE_SIZE, 'b');
+    }
+};
+
+TEST_F(SlowClientTest, ThrottledClientsAreEvicted) {
+    const std::string evictions = "shelob_slow_connections_closed_total";
+    uint64_t evicted_before = metric(evictions);
+    auto start = Clock::now();
+    asio::io_context io;
+
+    // Slow read: ask for a large file through a tiny receive window and never read it
+    auto slow_reader = connect(io, 4096);
+    send(slow_reader, "GET /big.bin HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    // Slow POST: promise a large body and send it at 400 bytes/s
+    std::atomic<bool> slow_post_cut_off = false;
+    std::thread slow_post([&] {
+        auto socket = connect(io);
+        send(socket, post_head(100000));
+        slow_post_cut_off = !trickle(socket, 8000, 100, 250ms);
+    });
+
+    // A slow but acceptable upload (8 KB/s, spanning measurement windows) is kept
+    std::atomic<bool> steady_post_served = false;
+    std::thread steady_post([&] {
+        auto socket = connect(io);
+        send(socket, post_head(48000));
+        if (trickle(socket, 48000, 2000, 250ms)) {
+            std::string response(64, '\0');
+            boost::system::error_code ec;
+            size_t n = socket.read_some(asio::buffer(response), ec);
+            steady_post_served = !ec && response.compare(0, 7, "HTTP/1.") == 0 && n > 0;
+        }
+    });
+
+    // Well-behaved clients are served in full meanwhile
+    {
+        auto client = connect(io);
+        send(client, "GET /big.bin HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+        std::string response;
+        boost::system::error_code ec;
+        asio::read(client, asio::dynamic_buffer(response), ec);
+        EXPECT_EQ(ec, asio::error::eof);
+        EXPECT_NE(response.find("200 OK"), std::string::npos);
+        EXPECT_GT(response.size(), BIG_FILE_SIZE);
+    }
+
+    slow_post.join();
+    EXPECT_TRUE(slow_post_cut_off);
+    EXPECT_TRUE(wait_for_metric(evictions, evicted_before + 2, 20s));
+
+    // Both were dropped well before the stage timeouts would have closed them
+    EXPECT_LT(Clock::now() - start,
+              std::chrono::seconds(ConnectionTimeouts::READ_BODY_TIMEOUT_SEC / 2));
+
+    steady_post.join();
+    EXPECT_TRUE(steady_post_served);
+    EXPECT_EQ(metric(evictions), evicted_before + 2);
+
+    // Every server-side connection is gone, including the slow reader's, whose
+    // own socket is still open
+    EXPECT_TRUE(wait_for_metric("shelob_active_connections{transport=\"tcp\"}", 0, 10s));
+}
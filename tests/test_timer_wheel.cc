@@ -0,0 +1,114 @@
+#include "../src/timer_wheel.h"
+#include <boost/asio/io_context.hpp>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+class TimerWheelTest : public ::testing::Test {
+  protected:
+    asio::io_context io_;
+    TimerWheel wheel_{io_.get_executor()};
+    int fired_ = 0;
+};
+
+TEST_F(TimerWheelTest, DeadlineFiresOnlyWhenDue) {
+    Deadline deadline(wheel_, [this] { ++fired_; });
+    auto start = TimerWheel::clock::now();
+    deadline.arm(1s);
+    EXPECT_TRUE(deadline.armed());
+    EXPECT_EQ(wheel_.armed(), 1u);
+
+    wheel_.advance(start + 500ms);
+    EXPECT_EQ(fired_, 0);
+    EXPECT_FALSE(deadline.expired());
+
+    wheel_.advance(start + 1s + 2 * TimerWheel::TICK);
+    EXPECT_EQ(fired_, 1);
+    EXPECT_TRUE(deadline.expired());
+    EXPECT_FALSE(deadline.armed());
+    EXPECT_EQ(wheel_.armed(), 0u);
+}
+
+TEST_F(TimerWheelTest, RearmAndCancel) {
+    Deadline deadline(wheel_, [this] { ++fired_; });
+    auto start = TimerWheel::clock::now();
+    deadline.arm(1s);
+    deadline.arm(10s); // Replaces the first deadline
+    EXPECT_EQ(wheel_.armed(), 1u);
+    wheel_.advance(start + 2s);
+    EXPECT_EQ(fired_, 0);
+
+    deadline.cancel();
+    EXPECT_EQ(wheel_.armed(), 0u);
+    wheel_.advance(start + 20s);
+    EXPECT_EQ(fired_, 0);
+    EXPECT_FALSE(deadline.expired());
+}
+
+TEST_F(TimerWheelTest, DeadlinesBeyondOneRevolution) {
+    auto revolution = TimerWheel::TICK * TimerWheel::SLOTS;
+    Deadline deadline(wheel_, [this] { ++fired_; });
+    auto start = TimerWheel::clock::now();
+    deadline.arm(revolution + 1s);
+
+    wheel_.advance(start + revolution - 1s);
+    wheel_.advance(start + revolution + 500ms);
+    EXPECT_EQ(fired_, 0); // Same bucket, next revolution
+
+    wheel_.advance(start + revolution + 1s + 2 * TimerWheel::TICK);
+    EXPECT_EQ(fired_, 1);
+}
+
+TEST_F(TimerWheelTest, ManyDeadlinesShareOneTimer) {
+    std::vector<std::unique_ptr<Deadline>> deadlines;
+    for (int i = 0; i < 1000; ++i) {
+        deadlines.push_back(std::make_unique<Deadline>(wheel_, [this] { ++fired_; }));
+        deadlines.back()->arm(std::chrono::seconds(1 + i % 5));
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        deadlines[i]->cancel();
+    }
+    EXPECT_EQ(wheel_.armed(), 500u);
+
+    wheel_.advance(TimerWheel::clock::now() + 6s);
+    EXPECT_EQ(fired_, 500);
+    EXPECT_EQ(wheel_.armed(), 0u);
+}
+
+TEST_F(TimerWheelTest, CallbacksMayRearm) {
+    Deadline deadline(wheel_, [&] {
+        if (++fired_ == 1) {
+            deadline.arm(1s);
+        }
+    });
+    auto start = TimerWheel::clock::now();
+    deadline.arm(1s);
+    wheel_.advance(start + 2s);
+    EXPECT_EQ(fired_, 1);
+    EXPECT_TRUE(deadline.armed());
+    wheel_.advance(start + 4s);
+    EXPECT_EQ(fired_, 2);
+}
+
+TEST_F(TimerWheelTest, IoContextDrivesTheWheel) {
+    Deadline deadline(wheel_, [this] { ++fired_; });
+    deadline.arm(TimerWheel::TICK);
+
+    // The wheel's timer only runs while something is armed, so run() returns
+    // once the deadline has fired
+    auto start = TimerWheel::clock::now();
+    io_.run_for(5s);
+    EXPECT_EQ(fired_, 1);
+    EXPECT_LT(TimerWheel::clock::now() - start, 2s);
+    EXPECT_GE(TimerWheel::clock::now() - start, TimerWheel::TICK);
+}
+
+TEST_F(TimerWheelTest, DeadlinesOutlivingTheWheel) {
+    auto wheel = std::make_unique<TimerWheel>(io_.get_executor());
+    Deadline deadline(*wheel, [this] { ++fired_; });
+    deadline.arm(1s);
+    wheel.reset();
+    EXPECT_FALSE(deadline.armed()); // Destroying the deadline must not touch the wheel
+}
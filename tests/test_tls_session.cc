@@ -0,0 +1,219 @@
+#include "../src/ssl_context.h"
+#include "../src/tls_session.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <unistd.h>
+
+namespace {
+
+std::string key_record(char fill) { return std::string(TicketKeyRing::KEY_FILE_RECORD, fill); }
+
+void write_file(const std::string& path, const std::string& data) {
+    std::ofstream(path, std::ios::binary) << data;
+}
+
+std::span<const unsigned char> bytes(const std::string& s) {
+    return {reinterpret_cast<const unsigned char*>(s.data()), s.size()};
+}
+
+// Self-signed P-256 certificate so handshakes can run in memory
+void use_test_certificate(SSL_CTX* ctx) {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509_sign(cert, key, EVP_sha256());
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+/**
+ * Run a TLS 1.2 handshake over a BIO pair, offering session if given
+ * @return Whether the session was resumed; session is replaced by the new one
+ */
+bool handshake(SSL_CTX* server_ctx, SSL_SESSION*& session, bool tickets = true) {
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(client_ctx, TLS1_2_VERSION);
+    if (!tickets) {
+        SSL_CTX_set_options(client_ctx, SSL_OP_NO_TICKET);
+    }
+    SSL* client = SSL_new(client_ctx);
+    SSL* server = SSL_new(server_ctx);
+    BIO* client_bio = nullptr;
+    BIO* server_bio = nullptr;
+    BIO_new_bio_pair(&client_bio, 0, &server_bio, 0);
+    SSL_set_bio(client, client_bio, client_bio);
+    SSL_set_bio(server, server_bio, server_bio);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+    if (session) {
+        SSL_set_session(client, session);
+        SSL_SESSION_free(session);
+    }
+
+    bool client_done = false;
+    bool server_done = false;
+    for (int i = 0; i < 20 && !(client_done && server_done); ++i) {
+        client_done = client_done || SSL_do_handshake(client) == 1;
+        server_done = server_done || SSL_do_handshake(server) == 1;
+    }
+    EXPECT_TRUE(client_done && server_done);
+
+    bool reused = SSL_session_reused(server) == 1;
+    session = SSL_get1_session(client);
+    SSL_shutdown(client); // Sessions of connections closed without close_notify can't resume
+    SSL_shutdown(server);
+    SSL_free(client);
+    SSL_free(server);
+    SSL_CTX_free(client_ctx);
+    return reused;
+}
+
+} // namespace
+
+TEST(TicketKeyRingTest, ParseKeys) {
+    std::string data = key_record('a') + key_record('b');
+    data[TicketKeyRing::KEY_NAME_SIZE] = 'h';
+    auto keys = TicketKeyRing::parse_keys(data);
+    ASSERT_EQ(keys.size(), 2u);
+    EXPECT_EQ(keys[0].name[0], 'a');
+    EXPECT_EQ(keys[0].hmac_secret[0], 'h');
+    EXPECT_EQ(keys[0].aes_key[0], 'a');
+    EXPECT_EQ(keys[1].name[0], 'b');
+
+    EXPECT_THROW(TicketKeyRing::parse_keys(""), std::runtime_error);
+    EXPECT_THROW(TicketKeyRing::parse_keys(key_record('a').substr(1)), std::runtime_error);
+}
+
+TEST(TicketKeyRingTest, RotationKeepsOldKeysForDecryption) {
+    TicketKeyRing ring(std::chrono::seconds(0));
+    auto first = ring.encryption_key();
+
+    ring.rotate();
+    auto second = ring.encryption_key();
+    EXPECT_NE(first.name, second.name);
+
+    bool current = true;
+    ASSERT_TRUE(ring.find(first.name.data(), current));
+    EXPECT_FALSE(current);
+    ASSERT_TRUE(ring.find(second.name.data(), current));
+    EXPECT_TRUE(current);
+
+    for (size_t i = 0; i < TicketKeyRing::RETAINED_KEYS; ++i) {
+        ring.rotate();
+    }
+    EXPECT_EQ(ring.size(), TicketKeyRing::RETAINED_KEYS + 1);
+    EXPECT_FALSE(ring.find(first.name.data(), current));
+}
+
+TEST(TicketKeyRingTest, KeyFileIsSharedAndReloaded) {
+    const std::string path = "ticket-keys-test.bin";
+    write_file(path, key_record('a') + key_record('b'));
+
+    TicketKeyRing one(std::chrono::seconds(0));
+    TicketKeyRing two(std::chrono::seconds(0));
+    one.load_file(path);
+    two.load_file(path);
+    EXPECT_EQ(one.encryption_key().name, two.encryption_key().name);
+    EXPECT_EQ(one.size(), 2u);
+
+    // Rotation picks up the new file contents
+    write_file(path, key_record('c') + key_record('a'));
+    one.rotate();
+    EXPECT_EQ(one.encryption_key().name[0], 'c');
+    bool current = true;
+    auto name = [](char fill) { return std::string(TicketKeyRing::KEY_NAME_SIZE, fill); };
+    ASSERT_TRUE(one.find(bytes(name('a')).data(), current));
+    EXPECT_FALSE(current);
+    EXPECT_FALSE(one.find(bytes(name('b')).data(), current));
+
+    // A broken file leaves the loaded keys in place
+    write_file(path, "short");
+    one.rotate();
+    EXPECT_EQ(one.encryption_key().name[0], 'c');
+
+    std::remove(path.c_str());
+    EXPECT_THROW(one.load_file(path), std::runtime_error);
+}
+
+TEST(TicketKeyRingTest, TicketsResumeAcrossContextsSharingKeys) {
+    const std::string path = "ticket-keys-resume.bin";
+    write_file(path, key_record('k'));
+
+    SSLContext first;
+    SSLContext second;
+    SSLContext other;
+    for (SSLContext* context : {&first, &second, &other}) {
+        use_test_certificate(context->get_context().native_handle());
+    }
+    first.enable_session_tickets(std::chrono::seconds(3600), path);
+    second.enable_session_tickets(std::chrono::seconds(3600), path);
+    other.enable_session_tickets(std::chrono::seconds(3600));
+
+    SSL_SESSION* session = nullptr;
+    EXPECT_FALSE(handshake(first.get_context().native_handle(), session));
+    EXPECT_TRUE(handshake(second.get_context().native_handle(), session));
+    EXPECT_FALSE(handshake(other.get_context().native_handle(), session));
+    SSL_SESSION_free(session);
+    std::remove(path.c_str());
+}
+
+class SharedSessionCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override { SharedSessionCache::unlink(name_); }
+    void TearDown() override { SharedSessionCache::unlink(name_); }
+
+    const std::string name_ = "fishjelly-test-" + std::to_string(getpid());
+};
+
+TEST_F(SharedSessionCacheTest, StoreLookupRemove) {
+    SharedSessionCache cache(name_, 64);
+    EXPECT_TRUE(cache.store(bytes("session-id"), bytes("encoded"), 200));
+
+    auto found = cache.lookup(bytes("session-id"), 100);
+    EXPECT_EQ(std::string(found.begin(), found.end()), "encoded");
+    EXPECT_TRUE(cache.lookup(bytes("other-id"), 100).empty());
+    EXPECT_TRUE(cache.lookup(bytes("session-id"), 200).empty()); // Expired
+
+    cache.remove(bytes("session-id"));
+    EXPECT_TRUE(cache.lookup(bytes("session-id"), 100).empty());
+
+    EXPECT_FALSE(cache.store(bytes(std::string(SSL_MAX_SSL_SESSION_ID_LENGTH + 1, 'x')),
+                             bytes("encoded"), 200));
+    EXPECT_FALSE(cache.store(bytes("session-id"),
+                             bytes(std::string(SharedSessionCache::MAX_SESSION_SIZE + 1, 'x')),
+                             200));
+}
+
+TEST_F(SharedSessionCacheTest, SegmentIsSharedByName) {
+    SharedSessionCache writer(name_, 64);
+    SharedSessionCache reader(name_, 64);
+    writer.store(bytes("session-id"), bytes("encoded"), 200);
+    EXPECT_FALSE(reader.lookup(bytes("session-id"), 100).empty());
+
+    EXPECT_THROW(SharedSessionCache(name_, 128), std::runtime_error);
+}
+
+TEST_F(SharedSessionCacheTest, SessionIdsResumeAcrossContexts) {
+    SSLContext first;
+    SSLContext second;
+    for (SSLContext* context : {&first, &second}) {
+        use_test_certificate(context->get_context().native_handle());
+        context->enable_shared_session_cache(name_, 64);
+    }
+
+    SSL_SESSION* session = nullptr;
+    EXPECT_FALSE(handshake(first.get_context().native_handle(), session, false));
+    EXPECT_TRUE(handshake(second.get_context().native_handle(), session, false));
+    SSL_SESSION_free(session);
+}
@@ -0,0 +1,109 @@
+#include "../src/websocket_deflate.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+std::string json_message(int id) {
+    return R"({"id":)" + std::to_string(id) +
+           R"(,"type":"quote","symbol":"FJ","bid":101.25,"ask":101.5,"venue":"loopback"})";
+}
+
+WebSocketDeflate::Options enabled() { return {.enabled = true}; }
+
+} // namespace
+
+TEST(WebSocketDeflateTest, NegotiatesFirstAcceptableOffer) {
+    // Typical browser offer
+    auto params = WebSocketDeflate::negotiate("permessage-deflate; client_max_window_bits",
+                                              enabled(), true, true);
+    ASSERT_TRUE(params);
+    EXPECT_FALSE(params->server_no_context_takeover);
+    EXPECT_EQ(params->client_max_window_bits, 15);
+    EXPECT_EQ(params->response(), "permessage-deflate; client_max_window_bits=15");
+
+    // Unknown extensions and parameters are skipped in favour of later offers
+    params = WebSocketDeflate::negotiate(
+        "x-webkit-deflate-frame, permessage-deflate; level=9, "
+        "permessage-deflate; server_no_context_takeover; client_max_window_bits=\"10\"",
+        enabled(), true, true);
+    ASSERT_TRUE(params);
+    EXPECT_TRUE(params->server_no_context_takeover);
+    EXPECT_EQ(params->client_max_window_bits, 10);
+    EXPECT_EQ(params->response(),
+              "permessage-deflate; server_no_context_takeover; client_max_window_bits=10");
+
+    EXPECT_FALSE(WebSocketDeflate::negotiate("permessage-deflate", {}, true, true));
+    EXPECT_FALSE(WebSocketDeflate::negotiate("", enabled(), true, true));
+    EXPECT_FALSE(WebSocketDeflate::negotiate(
+        "permessage-deflate; server_no_context_takeover; server_no_context_takeover", enabled(),
+        true, true));
+    EXPECT_FALSE(WebSocketDeflate::negotiate("permessage-deflate; client_max_window_bits=16",
+                                             enabled(), true, true));
+}
+
+TEST(WebSocketDeflateTest, WindowAndContextTakeoverLimits) {
+    WebSocketDeflate::Options options{.enabled = true, .window_bits = 12};
+
+    // A server window smaller than ours can't be honoured
+    EXPECT_FALSE(WebSocketDeflate::negotiate("permessage-deflate; server_max_window_bits=10",
+                                             options, true, true));
+    auto params = WebSocketDeflate::negotiate(
+        "permessage-deflate; server_max_window_bits=14; client_max_window_bits", options, true,
+        true);
+    ASSERT_TRUE(params);
+    EXPECT_EQ(params->response(),
+              "permessage-deflate; server_max_window_bits=12; client_max_window_bits=12");
+
+    // Refusing context takeover is announced even if the client didn't ask
+    params = WebSocketDeflate::negotiate("permessage-deflate", options, false, false);
+    ASSERT_TRUE(params);
+    EXPECT_EQ(params->response(),
+              "permessage-deflate; server_no_context_takeover; client_no_context_takeover");
+
+    options.context_takeover_limit = 2;
+    EXPECT_TRUE(WebSocketDeflate::context_takeover(options, 1));
+    EXPECT_FALSE(WebSocketDeflate::context_takeover(options, 2));
+    options.context_takeover_limit = 0;
+    EXPECT_FALSE(WebSocketDeflate::context_takeover(options, 0));
+}
+
+TEST(WebSocketDeflateTest, RoundTripsWithAndWithoutContextTakeover) {
+    for (bool takeover : {true, false}) {
+        WebSocketDeflate::Deflater deflater(enabled(), 15, takeover);
+        WebSocketDeflate::Inflater inflater(15);
+        size_t first_size = 0;
+        size_t last_size = 0;
+        for (int i = 0; i < 10; ++i) {
+            std::string message = json_message(i);
+            std::string compressed;
+            deflater.compress(message, compressed);
+            ASSERT_GE(compressed.size(), 4u);
+            EXPECT_NE(compressed.substr(compressed.size() - 4), std::string("\0\0\xFF\xFF", 4));
+
+            std::string inflated;
+            ASSERT_TRUE(inflater.decompress(compressed, inflated, 1024));
+            EXPECT_EQ(inflated, message);
+            (i == 0 ? first_size : last_size) = compressed.size();
+        }
+        // Only a shared window lets later messages refer back to earlier ones
+        if (takeover) {
+            EXPECT_LT(last_size, first_size / 2);
+        } else {
+            EXPECT_GE(last_size + 2, first_size);
+        }
+    }
+}
+
+TEST(WebSocketDeflateTest, InflateRejectsCorruptAndOversizedMessages) {
+    std::string big(100000, 'a');
+    std::string compressed;
+    WebSocketDeflate::Deflater(enabled(), 15, false).compress(big, compressed);
+    EXPECT_LT(compressed.size(), 1000u);
+
+    std::string out;
+    EXPECT_FALSE(WebSocketDeflate::Inflater(15).decompress(compressed, out, 64 * 1024));
+    EXPECT_GT(out.size(), 64u * 1024);
+
+    out.clear();
+    EXPECT_FALSE(WebSocketDeflate::Inflater(15).decompress("\xFF\xFF\xFF\xFF garbage", out, 1024));
+}
@@ -0,0 +1,315 @@
+#include "../src/websocket_hub.h"
+#include "loopback_server.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+template <typename Predicate> bool wait_until(Predicate done, Clock::duration timeout = 5s) {
+    for (auto end = Clock::now() + timeout; Clock::now() < end;) {
+        if (done()) {
+            return true;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    return done();
+}
+
+// A client frame as a browser would send it
+std::string masked_frame(uint8_t opcode, std::string_view payload, bool fin = true) {
+    std::string frame = WebSocketHub::encode_frame(opcode, payload);
+    size_t header = frame.size() - payload.size();
+    if (!fin) {
+        frame[0] = static_cast<char>(frame[0] & 0x7F);
+    }
+    frame[1] = static_cast<char>(frame[1] | 0x80);
+    const std::string mask = "\x12\x34\x56\x78";
+    std::string masked = frame.substr(0, header) + mask;
+    for (size_t i = 0; i < payload.size(); ++i) {
+        masked.push_back(static_cast<char>(payload[i] ^ mask[i % 4]));
+    }
+    return masked;
+}
+
+struct ServerFrame {
+    uint8_t opcode = 0;
+    std::string payload;
+    bool compressed = false;
+};
+
+// Read one unmasked server frame
+ServerFrame read_frame(tcp::socket& socket) {
+    uint8_t header[2];
+    asio::read(socket, asio::buffer(header));
+    uint64_t length = header[1] & 0x7F;
+    if (length == 126) {
+        uint8_t extended[2];
+        asio::read(socket, asio::buffer(extended));
+        length = (uint64_t{extended[0]} << 8) | extended[1];
+    } else if (length == 127) {
+        uint8_t extended[8];
+        asio::read(socket, asio::buffer(extended));
+        length = 0;
+        for (uint8_t b : extended) {
+            length = (length << 8) | b;
+        }
+    }
+    ServerFrame frame{static_cast<uint8_t>(header[0] & 0x0F), std::string(length, '\0'),
+                      (header[0] & 0x40) != 0};
+    asio::read(socket, asio::buffer(frame.payload));
+    return frame;
+}
+
+} // namespace
+
+TEST(WebSocketFrameTest, EncodesLengthForms) {
+    EXPECT_EQ(WebSocketHub::encode_frame(WebSocketHub::OPCODE_TEXT, "hi"), "\x81\x02hi");
+
+    std::string medium =
+        WebSocketHub::encode_frame(WebSocketHub::OPCODE_BINARY, std::string(300, 'x'));
+    ASSERT_EQ(medium.size(), 4u + 300);
+    EXPECT_EQ(static_cast<uint8_t>(medium[0]), 0x82);
+    EXPECT_EQ(static_cast<uint8_t>(medium[1]), 126);
+    EXPECT_EQ((static_cast<uint8_t>(medium[2]) << 8) | static_cast<uint8_t>(medium[3]), 300);
+
+    std::string large =
+        WebSocketHub::encode_frame(WebSocketHub::OPCODE_TEXT, std::string(70000, 'y'));
+    ASSERT_EQ(large.size(), 10u + 70000);
+    EXPECT_EQ(static_cast<uint8_t>(large[1]), 127);
+    EXPECT_EQ(static_cast<uint8_t>(large[7]), 0x01); // 70000 = 0x011170
+    EXPECT_EQ(static_cast<uint8_t>(large[8]), 0x11);
+    EXPECT_EQ(static_cast<uint8_t>(large[9]), 0x70);
+}
+
+TEST(WebSocketFrameTest, DecodesMaskedClientFrames) {
+    std::string wire = masked_frame(WebSocketHub::OPCODE_TEXT, "hello") +
+                       masked_frame(WebSocketHub::OPCODE_PING, "p");
+    WebSocketHub::ClientFrame frame;
+
+    ASSERT_EQ(WebSocketHub::decode_client_frame(wire, frame), WebSocketHub::DecodeResult::Complete);
+    EXPECT_TRUE(frame.fin);
+    EXPECT_EQ(frame.opcode, WebSocketHub::OPCODE_TEXT);
+    EXPECT_EQ(frame.payload, "hello");
+
+    std::string_view rest = std::string_view(wire).substr(frame.size);
+    ASSERT_EQ(WebSocketHub::decode_client_frame(rest, frame), WebSocketHub::DecodeResult::Complete);
+    EXPECT_EQ(frame.opcode, WebSocketHub::OPCODE_PING);
+    EXPECT_EQ(frame.size, rest.size());
+
+    // Every prefix of a frame is incomplete, not invalid
+    std::string big = masked_frame(WebSocketHub::OPCODE_BINARY, std::string(1000, 'z'));
+    for (size_t n = 0; n < big.size(); n += 97) {
+        EXPECT_EQ(WebSocketHub::decode_client_frame(std::string_view(big).substr(0, n), frame),
+                  WebSocketHub::DecodeResult::Incomplete);
+    }
+}
+
+TEST(WebSocketFrameTest, RejectsInvalidClientFrames) {
+    WebSocketHub::ClientFrame frame;
+    auto decode = [&frame](const std::string& wire) {
+        return WebSocketHub::decode_client_frame(wire, frame);
+    };
+    // Unmasked
+    EXPECT_EQ(decode(WebSocketHub::encode_frame(WebSocketHub::OPCODE_TEXT, "x")),
+              WebSocketHub::DecodeResult::Invalid);
+    // Reserved bit set (no extension negotiated)
+    std::string rsv = masked_frame(WebSocketHub::OPCODE_TEXT, "x");
+    rsv[0] = static_cast<char>(rsv[0] | 0x40);
+    EXPECT_EQ(decode(rsv), WebSocketHub::DecodeResult::Invalid);
+    // With permessage-deflate, RSV1 is allowed on data frames only
+    EXPECT_EQ(WebSocketHub::decode_client_frame(rsv, frame, true),
+              WebSocketHub::DecodeResult::Complete);
+    EXPECT_TRUE(frame.compressed);
+    std::string rsv_ping = masked_frame(WebSocketHub::OPCODE_PING, "x");
+    rsv_ping[0] = static_cast<char>(rsv_ping[0] | 0x40);
+    EXPECT_EQ(WebSocketHub::decode_client_frame(rsv_ping, frame, true),
+              WebSocketHub::DecodeResult::Invalid);
+    // Fragmented or oversized control frames
+    EXPECT_EQ(decode(masked_frame(WebSocketHub::OPCODE_PING, "x", false)),
+              WebSocketHub::DecodeResult::Invalid);
+    EXPECT_EQ(decode(masked_frame(WebSocketHub::OPCODE_PING, std::string(126, 'x'))),
+              WebSocketHub::DecodeResult::Invalid);
+    // Too large, rejected from the header alone
+    std::string huge = masked_frame(WebSocketHub::OPCODE_BINARY,
+                                    std::string(WebSocketHub::MAX_MESSAGE_SIZE + 1, 'x'));
+    EXPECT_EQ(decode(huge.substr(0, 14)), WebSocketHub::DecodeResult::Invalid);
+}
+
+TEST(WebSocketFrameTest, TopicForTarget) {
+    EXPECT_EQ(WebSocketHub::topic_for("/pubsub/news"), "news");
+    EXPECT_EQ(WebSocketHub::topic_for("/pubsub/news?since=5"), "news");
+    EXPECT_EQ(WebSocketHub::topic_for("/pubsub/"), "");
+    EXPECT_EQ(WebSocketHub::topic_for("/chat"), "");
+    EXPECT_EQ(WebSocketHub::topic_for("/pubsub/" + std::string(300, 't')), "");
+}
+
+/**
+ * A hub plus a loopback listener handing accepted connections to it, as
+ * WebSocketHandler does once the handshake is done
+ */
+class WebSocketHubTest : public ::testing::Test {
+  protected:
+    void start(WebSocketHub::Options options) { hub_ = std::make_unique<WebSocketHub>(options); }
+
+    tcp::socket join(const std::string& topic, int receive_buffer = 0,
+                     std::optional<WebSocketDeflate::Params> deflate = std::nullopt) {
+        tcp::socket client(io_);
+        client.open(tcp::v4());
+        if (receive_buffer > 0) {
+            client.set_option(asio::socket_base::receive_buffer_size(receive_buffer));
+        }
+        client.connect(acceptor_.local_endpoint());
+        size_t before = hub_->subscribers();
+        hub_->subscribe(acceptor_.accept(), topic, deflate);
+        EXPECT_TRUE(wait_until([&] { return hub_->subscribers() == before + 1; }));
+        return client;
+    }
+
+    asio::io_context io_;
+    tcp::acceptor acceptor_{io_, tcp::endpoint(asio::ip::address_v4::loopback(), 0)};
+    std::unique_ptr<WebSocketHub> hub_;
+};
+
+TEST_F(WebSocketHubTest, FansOutToTopicSubscribersAcrossShards) {
+    start({.shards = 3});
+    std::vector<tcp::socket> news;
+    for (int i = 0; i < 5; ++i) {
+        news.push_back(join("news"));
+    }
+    auto sports = join("sports");
+    uint64_t published = metric("shelob_websocket_messages_published_total");
+
+    hub_->publish("news", "headline");
+    hub_->publish("sports", std::string(200, 's'), true);
+
+    for (auto& client : news) {
+        auto frame = read_frame(client);
+        EXPECT_EQ(frame.opcode, WebSocketHub::OPCODE_TEXT);
+        EXPECT_EQ(frame.payload, "headline");
+    }
+    auto frame = read_frame(sports);
+    EXPECT_EQ(frame.opcode, WebSocketHub::OPCODE_BINARY);
+    EXPECT_EQ(frame.payload, std::string(200, 's'));
+    EXPECT_EQ(metric("shelob_websocket_messages_published_total"), published + 2);
+}
+
+TEST_F(WebSocketHubTest, ClientMessagesArePublishedToTheirTopic) {
+    start({.shards = 2});
+    auto alice = join("chat");
+    auto bob = join("chat");
+
+    // A fragmented message is reassembled before it is published
+    asio::write(alice, asio::buffer(masked_frame(WebSocketHub::OPCODE_TEXT, "hel", false) +
+                                    masked_frame(WebSocketHub::OPCODE_CONTINUATION, "lo")));
+    EXPECT_EQ(read_frame(bob).payload, "hello");
+    EXPECT_EQ(read_frame(alice).payload, "hello");
+
+    // Pings are answered to the sender only
+    asio::write(bob, asio::buffer(masked_frame(WebSocketHub::OPCODE_PING, "are you there")));
+    auto pong = read_frame(bob);
+    EXPECT_EQ(pong.opcode, WebSocketHub::OPCODE_PONG);
+    EXPECT_EQ(pong.payload, "are you there");
+
+    // Close is echoed and the subscriber leaves
+    asio::write(bob, asio::buffer(masked_frame(WebSocketHub::OPCODE_CLOSE, "\x03\xe8")));
+    EXPECT_EQ(read_frame(bob).opcode, WebSocketHub::OPCODE_CLOSE);
+    EXPECT_TRUE(wait_until([&] { return hub_->subscribers() == 1; }));
+
+    // Protocol errors close with 1002
+    asio::write(alice, asio::buffer(WebSocketHub::encode_frame(WebSocketHub::OPCODE_TEXT, "x")));
+    auto close = read_frame(alice);
+    EXPECT_EQ(close.opcode, WebSocketHub::OPCODE_CLOSE);
+    EXPECT_EQ(close.payload, "\x03\xea");
+    EXPECT_TRUE(wait_until([&] { return hub_->subscribers() == 0; }));
+}
+
+TEST_F(WebSocketHubTest, SlowConsumerIsDisconnected) {
+    start({.shards = 1, .queue_limit = 8, .policy = WebSocketHub::SlowConsumerPolicy::Disconnect});
+    auto slow = join("feed", 4096); // Never reads
+    auto fast = join("feed");
+    uint64_t closed = metric("shelob_websocket_slow_consumers_closed_total");
+
+    std::string payload(256 * 1024, 'p');
+    std::thread reader([&] {
+        for (int i = 0; i < 200; ++i) {
+            read_frame(fast);
+        }
+    });
+    for (int i = 0; i < 200; ++i) {
+        hub_->publish("feed", payload);
+        std::this_thread::sleep_for(1ms); // Lets the fast reader keep up
+    }
+    reader.join();
+
+    EXPECT_TRUE(wait_until([&] { return hub_->subscribers() == 1; }));
+    EXPECT_EQ(metric("shelob_websocket_slow_consumers_closed_total"), closed + 1);
+}
+
+TEST_F(WebSocketHubTest, SlowConsumerDropsOldestFrames) {
+    start({.shards = 1, .queue_limit = 8});
+    auto slow = join("feed", 4096);
+    uint64_t dropped = metric("shelob_websocket_frames_total{result=\"dropped\"}");
+
+    std::string payload(256 * 1024, 'p');
+    for (int i = 0; i < 100; ++i) {
+        hub_->publish("feed", payload);
+    }
+    hub_->publish("feed", "latest");
+
+    EXPECT_TRUE(wait_until(
+        [&] { return metric("shelob_websocket_frames_total{result=\"dropped\"}") > dropped; }));
+    EXPECT_EQ(hub_->subscribers(), 1u);
+
+    // Still connected, and the newest message survives
+    std::string last;
+    while (last != "latest") {
+        last = read_frame(slow).payload;
+    }
+}
+
+TEST_F(WebSocketHubTest, DeflateSubscribersShareACompressedFrame) {
+    start({.shards = 2, .deflate = {.enabled = true, .min_size = 64}});
+    WebSocketDeflate::Params params{.server_no_context_takeover = true,
+                                    .client_no_context_takeover = true};
+    auto compressing = join("json", 0, params);
+    auto also_compressing = join("json", 0, params);
+    auto plain = join("json");
+
+    std::string json;
+    for (int i = 0; i < 20; ++i) {
+        json += R"({"symbol":"FJ","price":101.5,"volume":1200},)";
+    }
+    hub_->publish("json", json);
+
+    auto first = read_frame(compressing);
+    auto second = read_frame(also_compressing);
+    EXPECT_TRUE(first.compressed);
+    EXPECT_LT(first.payload.size(), json.size() / 4);
+    EXPECT_EQ(first.payload, second.payload);
+    std::string inflated;
+    ASSERT_TRUE(WebSocketDeflate::Inflater(15).decompress(first.payload, inflated, json.size()));
+    EXPECT_EQ(inflated, json);
+
+    auto uncompressed = read_frame(plain);
+    EXPECT_FALSE(uncompressed.compressed);
+    EXPECT_EQ(uncompressed.payload, json);
+
+    // Below min_size nobody gets a compressed frame
+    hub_->publish("json", "{}");
+    EXPECT_FALSE(read_frame(compressing).compressed);
+    EXPECT_EQ(read_frame(plain).payload, "{}");
+    read_frame(also_compressing);
+
+    // Compressed client messages are inflated before they are published
+    std::string compressed;
+    WebSocketDeflate::Deflater({}, 15, false).compress(json, compressed);
+    std::string wire = masked_frame(WebSocketHub::OPCODE_TEXT, compressed);
+    wire[0] = static_cast<char>(wire[0] | 0x40);
+    asio::write(compressing, asio::buffer(wire));
+    EXPECT_EQ(read_frame(plain).payload, json);
+}